@@ -0,0 +1,625 @@
+#include <atomic>
+#include <benchmark/benchmark.h>
+#include <cstdlib>
+#include <fcntl.h>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <new>
+#include <random>
+#include <string>
+#include <unistd.h>
+#include <vector>
+#include "../include/clone_gadget.h"
+#include "../src/bitmap.h"
+#include "../src/checkout.h"
+#include "../src/commit_graph.h"
+#include "../src/delta.h"
+#include "../src/ingest.h"
+#include "../src/object_store.h"
+#include "../src/pack.h"
+#include "../src/repack.h"
+#include "../src/revision.h"
+
+// Git 核心热点路径的基准测试
+//
+// 每个基准在临时目录中生成合成仓库（大量小文件、少量大文件、深层目录、
+// 长 delta 链），不依赖网络。除吞吐量外还统计每次操作的堆分配次数，
+// 用于跨版本比较：
+//
+//   ./git_bench --benchmark_out=bench.json --benchmark_out_format=json
+
+namespace fs = std::filesystem;
+
+// ---- 堆分配计数 ----
+static std::atomic<size_t> g_allocations{0};
+
+void *operator new(size_t size) {
+  g_allocations.fetch_add(1, std::memory_order_relaxed);
+  if (void *p = std::malloc(size ? size : 1)) {
+    return p;
+  }
+  throw std::bad_alloc();
+}
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete(void *p, size_t) noexcept { std::free(p); }
+
+// 在基准循环结束后记录每次迭代的平均分配次数
+class AllocationCounter {
+public:
+  explicit AllocationCounter(benchmark::State &state)
+      : state_(state), start_(g_allocations.load()) {}
+  ~AllocationCounter() {
+    state_.counters["allocs_per_op"] = benchmark::Counter(
+        static_cast<double>(g_allocations.load() - start_),
+        benchmark::Counter::kAvgIterations);
+  }
+
+private:
+  benchmark::State &state_;
+  size_t start_;
+};
+
+// ---- 合成仓库 ----
+
+// 在临时目录中创建仓库并切换工作目录，析构时恢复并清理
+class ScratchRepo {
+public:
+  ScratchRepo() {
+    old_cwd_ = fs::current_path();
+    dir_ = fs::temp_directory_path() /
+           ("minigit_bench_" + std::to_string(getpid()) + "_" +
+            std::to_string(counter_++));
+    fs::remove_all(dir_);
+    fs::create_directories(dir_ / ".git/objects");
+    fs::create_directories(dir_ / ".git/refs/heads");
+    fs::current_path(dir_);
+  }
+  ~ScratchRepo() {
+    fs::current_path(old_cwd_);
+    fs::remove_all(dir_);
+  }
+  const fs::path &Path() const { return dir_; }
+
+private:
+  static inline int counter_ = 0;
+  fs::path dir_;
+  fs::path old_cwd_;
+};
+
+static std::string RandomText(size_t size, unsigned seed) {
+  static const char alphabet[] = "abcdefghijklmnopqrstuvwxyz \n{}();=";
+  std::mt19937 rng(seed);
+  std::string text(size, ' ');
+  for (auto &c : text) {
+    c = alphabet[rng() % (sizeof(alphabet) - 1)];
+  }
+  return text;
+}
+
+static void WriteFile(const fs::path &path, const std::string &content) {
+  if (path.has_parent_path()) {
+    fs::create_directories(path.parent_path());
+  }
+  std::ofstream(path, std::ios::binary) << content;
+}
+
+static size_t MakeManySmallFiles(const fs::path &root, int count) {
+  size_t total = 0;
+  for (int i = 0; i < count; i++) {
+    std::string content = RandomText(200 + i % 800, i);
+    WriteFile(root / ("dir" + std::to_string(i % 32)) /
+                  ("file" + std::to_string(i) + ".txt"),
+              content);
+    total += content.size();
+  }
+  return total;
+}
+
+static size_t MakeDeepTree(const fs::path &root, int depth) {
+  fs::path dir = root;
+  size_t total = 0;
+  for (int i = 0; i < depth; i++) {
+    dir /= "level" + std::to_string(i);
+    std::string content = RandomText(512, i);
+    WriteFile(dir / "leaf.txt", content);
+    total += content.size();
+  }
+  return total;
+}
+
+// delta 头部使用的变长整数（每字节7位，小端序）
+static void PutDeltaSize(std::string &out, size_t size) {
+  while (size >= 0x80) {
+    out.push_back(static_cast<char>((size & 0x7F) | 0x80));
+    size >>= 7;
+  }
+  out.push_back(static_cast<char>(size));
+}
+
+// COPY 指令：完整写出4字节偏移和3字节长度
+static void PutCopy(std::string &out, size_t offset, size_t size) {
+  out.push_back(static_cast<char>(0xFF));
+  for (int i = 0; i < 4; i++) {
+    out.push_back(static_cast<char>((offset >> (i * 8)) & 0xFF));
+  }
+  for (int i = 0; i < 3; i++) {
+    out.push_back(static_cast<char>((size >> (i * 8)) & 0xFF));
+  }
+}
+
+// 生成长度为 length 的 delta 链：每一环把基础对象中间的一小段替换掉
+struct DeltaChain {
+  std::string base;
+  std::vector<std::string> deltas;
+  std::string expected; // 整条链应用后的结果
+};
+
+static DeltaChain MakeDeltaChain(size_t base_size, int length) {
+  DeltaChain chain;
+  chain.base = RandomText(base_size, 7);
+  std::string current = chain.base;
+  for (int i = 0; i < length; i++) {
+    size_t cut = (current.size() / 3 + i * 131) % (current.size() - 64);
+    std::string insert = "edit" + std::to_string(i) + ";";
+    std::string next = current.substr(0, cut) + insert +
+                       current.substr(cut + 16);
+    std::string delta;
+    PutDeltaSize(delta, current.size());
+    PutDeltaSize(delta, next.size());
+    PutCopy(delta, 0, cut);
+    delta.push_back(static_cast<char>(insert.size()));
+    delta += insert;
+    PutCopy(delta, cut + 16, current.size() - cut - 16);
+    chain.deltas.push_back(delta);
+    current = next;
+  }
+  chain.expected = current;
+  return chain;
+}
+
+// pack 对象头：类型 + 变长长度（低4位在首字节）
+static void PutPackObjectHeader(std::string &out, int type, size_t size) {
+  unsigned char byte = static_cast<unsigned char>((type << 4) | (size & 0x0F));
+  size >>= 4;
+  while (size) {
+    out.push_back(static_cast<char>(byte | 0x80));
+    byte = size & 0x7F;
+    size >>= 7;
+  }
+  out.push_back(static_cast<char>(byte));
+}
+
+static std::string MakePack(int blobs, size_t blob_size) {
+  std::string pack = "PACK";
+  pack += std::string("\0\0\0\2", 4);
+  for (int i = 3; i >= 0; i--) {
+    pack.push_back(static_cast<char>((blobs >> (i * 8)) & 0xFF));
+  }
+  for (int i = 0; i < blobs; i++) {
+    std::string content = RandomText(blob_size, 1000 + i);
+    PutPackObjectHeader(pack, 3, content.size());
+    pack += compress_string(content);
+  }
+  pack += std::string(20, '\0'); // 校验和（unpack_objects 不检查）
+  return pack;
+}
+
+// ---- 基准 ----
+
+static void BM_HashObjectSmall(benchmark::State &state) {
+  ScratchRepo repo;
+  std::string content = RandomText(state.range(0), 1);
+  WriteFile("small.txt", content);
+  AllocationCounter allocs(state);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(hash_object("small.txt"));
+  }
+  state.SetBytesProcessed(state.iterations() * content.size());
+}
+BENCHMARK(BM_HashObjectSmall)->Arg(256)->Arg(4096);
+
+static void BM_HashObjectHuge(benchmark::State &state) {
+  ScratchRepo repo;
+  std::string content = RandomText(state.range(0) << 20, 2);
+  WriteFile("huge.bin", content);
+  AllocationCounter allocs(state);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(hash_object("huge.bin"));
+  }
+  state.SetBytesProcessed(state.iterations() * content.size());
+}
+BENCHMARK(BM_HashObjectHuge)->Arg(1)->Arg(4)->Unit(benchmark::kMillisecond);
+
+static void BM_WriteTreeManySmallFiles(benchmark::State &state) {
+  ScratchRepo repo;
+  size_t bytes = MakeManySmallFiles(repo.Path(), state.range(0));
+  AllocationCounter allocs(state);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(write_tree("."));
+  }
+  state.SetBytesProcessed(state.iterations() * bytes);
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_WriteTreeManySmallFiles)->Arg(1000)->Unit(benchmark::kMillisecond);
+
+static void BM_WriteTreeDeep(benchmark::State &state) {
+  ScratchRepo repo;
+  size_t bytes = MakeDeepTree(repo.Path(), state.range(0));
+  AllocationCounter allocs(state);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(write_tree("."));
+  }
+  state.SetBytesProcessed(state.iterations() * bytes);
+}
+BENCHMARK(BM_WriteTreeDeep)->Arg(64)->Unit(benchmark::kMillisecond);
+
+static void BM_ApplyDeltaChain(benchmark::State &state) {
+  DeltaChain chain = MakeDeltaChain(64 * 1024, state.range(0));
+  std::string check = chain.base;
+  for (const auto &delta : chain.deltas) {
+    check = apply_delta(delta, check);
+  }
+  if (check != chain.expected) {
+    state.SkipWithError("apply_delta produced wrong output");
+    return;
+  }
+  size_t bytes = 0;
+  AllocationCounter allocs(state);
+  for (auto _ : state) {
+    std::string current = chain.base;
+    for (const auto &delta : chain.deltas) {
+      current = apply_delta(delta, current);
+    }
+    bytes += current.size() * chain.deltas.size();
+    benchmark::DoNotOptimize(current);
+  }
+  state.SetBytesProcessed(bytes);
+}
+BENCHMARK(BM_ApplyDeltaChain)->Arg(10)->Arg(50)->Unit(benchmark::kMicrosecond);
+
+// 同一条链，交替复用两个输出缓冲区，稳态下不再分配内存
+static void BM_ApplyDeltaChainReuse(benchmark::State &state) {
+  DeltaChain chain = MakeDeltaChain(64 * 1024, state.range(0));
+  std::string buffers[2];
+  size_t bytes = 0;
+  AllocationCounter allocs(state);
+  for (auto _ : state) {
+    const std::string *current = &chain.base;
+    int next = 0;
+    for (const auto &delta : chain.deltas) {
+      apply_delta_to(delta, *current, buffers[next]);
+      current = &buffers[next];
+      next ^= 1;
+    }
+    bytes += current->size() * chain.deltas.size();
+    benchmark::DoNotOptimize(current->data());
+  }
+  state.SetBytesProcessed(bytes);
+}
+BENCHMARK(BM_ApplyDeltaChainReuse)->Arg(10)->Arg(50)->Unit(benchmark::kMicrosecond);
+
+// 对长 delta 链的两端生成 delta（repack 的 delta 搜索热点）
+static void BM_CreateDelta(benchmark::State &state) {
+  DeltaChain chain = MakeDeltaChain(state.range(0), 20);
+  DeltaIndex index(chain.base);
+  AllocationCounter allocs(state);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(index.CreateDelta(chain.expected));
+  }
+  state.SetBytesProcessed(state.iterations() * chain.expected.size());
+}
+BENCHMARK(BM_CreateDelta)->Arg(64 * 1024)->Arg(1 << 20);
+
+// 完整的 pack 生成（delta 搜索 + 写出），参数为 delta 搜索线程数
+static void BM_WritePack(benchmark::State &state) {
+  ScratchRepo repo;
+  std::map<std::string, GitObject> objects;
+  std::vector<pack::PackInput> inputs;
+  for (int file = 0; file < 50; file++) {
+    std::string content = RandomText(16 * 1024, 200 + file);
+    for (int version = 0; version < 20; version++) {
+      content.replace((version * 331) % (content.size() - 8), 8,
+                      "rev" + std::to_string(version) + ";;;;");
+      std::string hash = compute_sha1(
+          "blob " + std::to_string(content.size()) + '\0' + content);
+      objects[hash] = {ObjectType::kBlob, content};
+      inputs.push_back({hash, ObjectType::kBlob, content.size(),
+                        pack::NameHash("file" + std::to_string(file))});
+    }
+  }
+  pack::PackWriteOptions options;
+  options.threads = state.range(0);
+  AllocationCounter allocs(state);
+  for (auto _ : state) {
+    auto result = pack::WritePack(
+        ".git/objects/pack", inputs,
+        [&objects](const std::string &hash) { return objects.at(hash); },
+        options);
+    state.counters["deltas"] = result.deltas;
+  }
+  state.SetItemsProcessed(state.iterations() * inputs.size());
+}
+BENCHMARK(BM_WritePack)->Arg(1)->Arg(4)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+// 对象已全部在 pack 中时重新输出（serve/repack -a 的常见情况）：
+// 参数为 1 时原样复用已有 pack 的数据，为 0 时全部重新解压、搜索和压缩
+static void BM_WritePackReuse(benchmark::State &state) {
+  ScratchRepo repo;
+  std::map<std::string, GitObject> objects;
+  std::vector<pack::PackInput> inputs;
+  for (int file = 0; file < 50; file++) {
+    std::string content = RandomText(16 * 1024, 300 + file);
+    for (int version = 0; version < 20; version++) {
+      content.replace((version * 331) % (content.size() - 8), 8,
+                      "rev" + std::to_string(version) + ";;;;");
+      std::string hash = compute_sha1(
+          "blob " + std::to_string(content.size()) + '\0' + content);
+      objects[hash] = {ObjectType::kBlob, content};
+      inputs.push_back({hash, ObjectType::kBlob, content.size(),
+                        pack::NameHash("file" + std::to_string(file))});
+    }
+  }
+  auto loader = [&objects](const std::string &hash) { return objects.at(hash); };
+  auto written = pack::WritePack(".git/objects/pack", inputs, loader);
+  pack::PackFile existing(written.idx_path);
+  pack::PackWriteOptions options;
+  if (state.range(0)) {
+    options.reuse.push_back(&existing);
+  }
+  int fd = open("out.pack", O_RDWR | O_CREAT | O_TRUNC, 0644);
+  AllocationCounter allocs(state);
+  for (auto _ : state) {
+    state.PauseTiming();
+    [[maybe_unused]] int rc = ftruncate(fd, 0);
+    lseek(fd, 0, SEEK_SET);
+    state.ResumeTiming();
+    auto result = pack::WritePackStream(fd, inputs, loader, options);
+    state.counters["reused"] = result.reused;
+  }
+  close(fd);
+  state.SetItemsProcessed(state.iterations() * inputs.size());
+}
+BENCHMARK(BM_WritePackReuse)->Arg(0)->Arg(1)->Unit(benchmark::kMillisecond);
+
+// 深历史：主线 commits 个提交，从中点分出10个提交的分支，全部写进一个 pack
+struct DeepHistory {
+  std::vector<std::string> main_line;
+  std::string branch;
+};
+
+static DeepHistory BuildDeepHistory(int commits) {
+  std::map<std::string, GitObject> objects;
+  std::vector<pack::PackInput> inputs;
+  std::string tree = compute_sha1(std::string("tree 0") + '\0');
+  objects[tree] = {ObjectType::kTree, ""};
+  inputs.push_back({tree, ObjectType::kTree, 0, 0});
+  auto commit = [&](const std::string &parent, int i) {
+    std::string body = "tree " + tree + "\n";
+    if (!parent.empty()) {
+      body += "parent " + parent + "\n";
+    }
+    std::string who = "B <b@example.com> " + std::to_string(1600000000 + i) +
+                      " +0000\n";
+    body += "author " + who + "committer " + who + "\nc" +
+            std::to_string(i) + "\n";
+    std::string hash = compute_sha1("commit " + std::to_string(body.size()) +
+                                    '\0' + body);
+    objects[hash] = {ObjectType::kCommit, body};
+    inputs.push_back({hash, ObjectType::kCommit, body.size(), 0});
+    return hash;
+  };
+  DeepHistory history;
+  history.main_line.push_back(commit("", 0));
+  for (int i = 1; i < commits; i++) {
+    history.main_line.push_back(commit(history.main_line.back(), i));
+  }
+  history.branch = history.main_line[commits / 2];
+  for (int i = 0; i < 10; i++) {
+    history.branch = commit(history.branch, commits + i);
+  }
+  pack::PackWriteOptions options;
+  options.window = 0;
+  pack::WritePack(".git/objects/pack", inputs,
+                  [&objects](const std::string &hash) { return objects.at(hash); },
+                  options);
+  return history;
+}
+
+// 深历史上的 merge-base 和祖先判断（主线 20000 个提交）：
+// 参数为 1 时使用 commit-graph，为 0 时每个提交都要解压并解析
+static void BM_AncestryDeepHistory(benchmark::State &state) {
+  ScratchRepo repo;
+  DeepHistory history = BuildDeepHistory(20000);
+  ObjectStore store;
+  if (state.range(0)) {
+    commit_graph::Write(store, {history.main_line.back(), history.branch});
+  }
+  AllocationCounter allocs(state);
+  for (auto _ : state) {
+    commit_graph::CommitIndex index(store);
+    uint32_t tip = index.Lookup(history.main_line.back());
+    auto bases =
+        commit_graph::MergeBases(index, index.Lookup(history.branch), tip);
+    bool ancestor = commit_graph::IsAncestor(
+        index, index.Lookup(history.main_line[0]), tip);
+    benchmark::DoNotOptimize(bases);
+    benchmark::DoNotOptimize(ancestor);
+  }
+}
+BENCHMARK(BM_AncestryDeepHistory)->Arg(0)->Arg(1)->Unit(benchmark::kMillisecond);
+
+// rev-list 遍历（主线 20000 个提交，使用 commit-graph）：
+// 参数 0 为 --max-count=20，1 为全部历史，2 为 main..branch
+static void BM_RevWalkDeepHistory(benchmark::State &state) {
+  ScratchRepo repo;
+  DeepHistory history = BuildDeepHistory(20000);
+  ObjectStore store;
+  commit_graph::Write(store, {history.main_line.back(), history.branch});
+  AllocationCounter allocs(state);
+  size_t output = 0;
+  for (auto _ : state) {
+    commit_graph::CommitIndex index(store);
+    revision::RevWalkOptions options;
+    if (state.range(0) == 0) {
+      options.max_count = 20;
+    }
+    revision::RevWalk walk(index, options);
+    if (state.range(0) == 2) {
+      walk.Hide(index.Lookup(history.main_line.back()));
+      walk.Push(index.Lookup(history.branch));
+    } else {
+      walk.Push(index.Lookup(history.main_line.back()));
+    }
+    uint32_t id;
+    output = 0;
+    while (walk.Next(id)) {
+      output++;
+    }
+  }
+  state.counters["commits"] = output;
+}
+BENCHMARK(BM_RevWalkDeepHistory)->Arg(0)->Arg(1)->Arg(2)->Unit(benchmark::kMicrosecond);
+
+// 枚举全部可达对象（主线 20000 个提交，clone 和 count-objects 的开销）：
+// 参数为 1 时使用 .bitmap，为 0 时遍历每个提交和 tree
+static void BM_EnumerateDeepHistory(benchmark::State &state) {
+  ScratchRepo repo;
+  DeepHistory history = BuildDeepHistory(20000);
+  ObjectStore store;
+  std::vector<std::string> tips = {history.main_line.back(), history.branch};
+  commit_graph::Write(store, tips);
+  if (state.range(0)) {
+    bitmap::WriteBitmapIndex(store, *store.Packs().front(),
+                             EnumerateReachable(store, tips), tips);
+  }
+  AllocationCounter allocs(state);
+  size_t objects = 0;
+  for (auto _ : state) {
+    if (state.range(0)) {
+      auto bitmaps = bitmap::PackBitmap::Open(store);
+      objects = bitmaps->Reachable(tips).Count();
+    } else {
+      objects = EnumerateReachable(store, tips).size();
+    }
+  }
+  state.counters["objects"] = objects;
+}
+BENCHMARK(BM_EnumerateDeepHistory)->Arg(0)->Arg(1)->Unit(benchmark::kMillisecond);
+
+static void BM_DecompressString(benchmark::State &state) {
+  std::string content = RandomText(state.range(0), 3);
+  std::string compressed = compress_string(content);
+  AllocationCounter allocs(state);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(decompress_string(compressed));
+  }
+  state.SetBytesProcessed(state.iterations() * content.size());
+}
+BENCHMARK(BM_DecompressString)->Arg(1024)->Arg(1 << 20);
+
+static void BM_UnpackObjects(benchmark::State &state) {
+  ScratchRepo repo;
+  std::string pack = MakePack(state.range(0), 2048);
+  AllocationCounter allocs(state);
+  for (auto _ : state) {
+    state.PauseTiming();
+    fs::remove_all(".git/objects");
+    fs::create_directories(".git/objects");
+    state.ResumeTiming();
+    benchmark::DoNotOptimize(unpack_objects(pack, ".", ""));
+  }
+  state.SetBytesProcessed(state.iterations() * pack.size());
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_UnpackObjects)->Arg(200)->Unit(benchmark::kMillisecond);
+
+// 写出大量小的松散对象：0 = 逐个 compress_and_store，1 = io_uring 批量，
+// 2 = 线程池批量
+static void BM_WriteLooseObjects(benchmark::State &state) {
+  ScratchRepo repo;
+  constexpr int kObjects = 5000;
+  std::vector<std::string> raws;
+  std::vector<std::string> hashes;
+  for (int i = 0; i < kObjects; i++) {
+    std::string content = RandomText(200, 5000 + i);
+    raws.push_back("blob " + std::to_string(content.size()) + '\0' + content);
+    hashes.push_back(compute_sha1(raws.back()));
+  }
+  for (auto _ : state) {
+    state.PauseTiming();
+    fs::remove_all(".git/objects");
+    fs::create_directories(".git/objects");
+    state.ResumeTiming();
+    if (state.range(0) == 0) {
+      for (int i = 0; i < kObjects; i++) {
+        compress_and_store(hashes[i], raws[i]);
+      }
+    } else {
+      ingest::LooseObjectWriter writer(".", state.range(0) == 1
+                                                ? ingest::WriteMode::kUring
+                                                : ingest::WriteMode::kThreads);
+      for (int i = 0; i < kObjects; i++) {
+        writer.Write(hashes[i].c_str(), raws[i].data(), raws[i].size());
+      }
+      writer.Flush();
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * kObjects);
+}
+BENCHMARK(BM_WriteLooseObjects)->Arg(0)->Arg(1)->Arg(2)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+static void BM_RestoreTree(benchmark::State &state) {
+  ScratchRepo repo;
+  size_t bytes = MakeManySmallFiles(repo.Path() / "src", state.range(0));
+  std::string tree = write_tree(".");
+  fs::remove_all("src");
+  AllocationCounter allocs(state);
+  for (auto _ : state) {
+    state.PauseTiming();
+    fs::remove_all("out");
+    fs::create_directories("out");
+    state.ResumeTiming();
+    restore_tree(tree, "out", ".");
+  }
+  state.SetBytesProcessed(state.iterations() * bytes);
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_RestoreTree)->Arg(1000)->Unit(benchmark::kMillisecond);
+
+// 在只差几个文件的两个 tree 之间来回切换：Arg(0) 每次完整恢复工作区，
+// Arg(1) 按 tree 差异只改动变化的文件
+static void BM_CheckoutSwitch(benchmark::State &state) {
+  ScratchRepo repo;
+  const int files = 20000;
+  MakeManySmallFiles(repo.Path() / "src", files);
+  std::string trees[2];
+  trees[0] = write_tree(".");
+  for (int i = 0; i < 10; i++) {
+    WriteFile(repo.Path() / "src" / ("dir" + std::to_string(i)) /
+                  ("file" + std::to_string(i) + ".txt"),
+              RandomText(300, 1000 + i));
+  }
+  trees[1] = write_tree(".");
+  fs::remove_all("src");
+  ObjectStore store;
+  checkout::CheckoutTree(store, ".", "", trees[0]);
+  int current = 0;
+  AllocationCounter allocs(state);
+  for (auto _ : state) {
+    int next = 1 - current;
+    if (state.range(0) == 0) {
+      state.PauseTiming();
+      fs::remove_all("src");
+      state.ResumeTiming();
+      restore_tree(store, trees[next], ".");
+    } else {
+      checkout::CheckoutTree(store, ".", trees[current], trees[next]);
+    }
+    current = next;
+  }
+  state.SetItemsProcessed(state.iterations() * files);
+}
+BENCHMARK(BM_CheckoutSwitch)->Arg(0)->Arg(1)->Unit(benchmark::kMillisecond);
+
+BENCHMARK_MAIN();
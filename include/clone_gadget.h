@@ -22,7 +22,21 @@ void compressFile(const std::string data, uLong *bound, unsigned char *dest);
 
 std::string sha_file(std::string data);
 
-std::string hash_object(std::string file);
+/**
+ * @brief 计算文件作为 blob 的哈希，write_object 时同时写入 .git/objects
+ *
+ * 文件按块流式读入，任意大小的文件都只占用固定的内存。
+ * @throws std::runtime_error 文件无法读取、读取期间被修改或写入失败
+ */
+std::string hash_object(std::string file, bool write_object = true);
+
+/**
+ * @brief 计算内存中的内容作为 blob 的哈希，write_object 时同时写入
+ *        .git/objects
+ * @throws std::runtime_error 写入失败
+ */
+std::string hash_blob_buffer(const std::string &content,
+                             bool write_object = true);
 
 std::string write_tree(const std::string dir_path);
 
@@ -49,6 +63,7 @@ int compress(FILE *input, FILE *output);
  * @param hash Git对象的SHA-1哈希值（40字符十六进制字符串）
  * @param content 待压缩和存储的对象内容
  * @param dir 目标目录路径（可选参数，默认为当前目录）
+ * @throws std::runtime_error 写入失败
  */
 void compress_and_store(const std::string &hash, const std::string &content,
                         std::string dir = ".");
@@ -67,6 +82,7 @@ int read_length(const std::string &pack, int *pos);
  * @param delta_contents delta压缩指令数据
  * @param base_contents 基础对象的完整内容
  * @return 重建后的完整对象内容字符串
+ * @throws std::runtime_error delta非法、COPY越界或与基础对象长度不匹配
  * @note 实现Git pack协议中的delta解压缩算法，支持复制和添加两种指令
  */
 std::string apply_delta(const std::string &delta_contents,
@@ -103,6 +119,42 @@ size_t write_callback(void *received_data, size_t element_size,
 size_t pack_data_callback(void *received_data, size_t element_size,
                           size_t num_element, void *userdata);
 
+/**
+ * @brief 只请求 info/refs，返回远程 HEAD（或 master 分支）指向的提交哈希
+ * @return 请求失败时返回空字符串
+ */
+std::string fetch_remote_head(const std::string &url);
+
+/**
+ * @brief 向 git-upload-pack 请求 want 及其依赖的全部对象
+ * @param haves 本地已有完整历史的提交，服务器不再发送从它们可达的对象
+ * @return 服务器的完整响应：协商结果（NAK/ACK）后面跟 pack 数据
+ */
+std::string fetch_pack(const std::string &url, const std::string &want,
+                       const std::vector<std::string> &haves);
+
+/**
+ * @brief 同上，一次请求多个对象
+ * @param wants 提交，或部分克隆补取的 blob
+ * @param filter 非空时请求服务器按该条件省略对象（如 "blob:none"：只发送
+ *        提交和 tree）
+ */
+std::string fetch_pack(const std::string &url,
+                       const std::vector<std::string> &wants,
+                       const std::vector<std::string> &haves,
+                       const std::string &filter);
+
+/**
+ * @brief 部分克隆（clone --filter）的仓库从 remote.origin.url 取回本地缺少
+ *        的对象
+ * @param git_dir 仓库的 .git 目录
+ * @param hashes 要取回的对象（通常是检出需要的 blob）
+ * @return 取回的对象数；仓库不是部分克隆时为 0（什么都不做）
+ * @throws std::runtime_error 下载失败或响应中没有合法的 pack
+ */
+size_t fetch_missing_objects(const std::filesystem::path &git_dir,
+                             const std::vector<std::string> &hashes);
+
 /**
  * @brief 通过HTTP协议与Git远程仓库通信，获取pack文件和分支信息
  * @param url 远程Git仓库的URL地址
@@ -126,12 +178,54 @@ int cat_file_for_clone(const char *file_path, const std::string &dir,
 void restore_tree(const std::string &tree_hash, const std::string &dir,
                   const std::string &proj_dir);
 
+class ObjectStore;
+namespace sparse {
+class Cone;
+}
+
+/**
+ * @brief 同上，但复用调用者已经打开的对象库
+ * @param cone 不为空时只恢复 cone 之内的路径（见 src/sparse.h），cone 之外
+ *        的子树连 tree 对象都不读
+ */
+void restore_tree(const ObjectStore &store, const std::string &tree_hash,
+                  const std::string &dir, const sparse::Cone *cone = nullptr);
+
+/**
+ * @brief 解析pack数据中的全部对象并以松散对象形式存入本地对象库
+ * @param pack 以"PACK"开头的完整pack数据
+ * @param dir 本地仓库根目录（包含.git目录）
+ * @param packhash 远程master分支指向的提交哈希
+ * @return master提交对象的内容（从'\0'开始），pack中没有该提交时为空
+ * @throws std::invalid_argument 遇到暂不支持的OFS_DELTA对象
+ * @throws std::runtime_error pack被截断、对象损坏或长度与对象头不符
+ */
+std::string unpack_objects(const std::string &pack, const std::string &dir,
+                           const std::string &packhash);
+
 /**
  * @brief Git克隆功能的主函数，实现从远程仓库克隆到本地目录
  * @param url 远程Git仓库的URL地址
  * @param dir 本地目标目录路径
+ * @param shared_cache 共享对象缓存目录（见 src/shared_cache.h），为空时
+ *        使用环境变量 MINIGIT_SHARED_CACHE，也未设置则不使用缓存
  * @return 执行成功返回EXIT_SUCCESS，失败返回EXIT_FAILURE
  */
-int clone(std::string url, std::string dir);
+int clone(std::string url, std::string dir, std::string shared_cache = "");
+
+struct CloneOptions {
+  // 稀疏检出（见 src/sparse.h）：只检出根目录下的文件和 sparse_dirs
+  bool sparse = false;
+  std::vector<std::string> sparse_dirs;
+  // 部分克隆的过滤条件，目前只支持 "blob:none"：只下载提交和 tree，检出
+  // 需要的 blob 随后再取回。不能与共享缓存同时使用
+  std::string filter;
+};
+
+/**
+ * @brief 同上，可以只检出一部分、只下载需要的 blob
+ */
+int clone(std::string url, std::string dir, std::string shared_cache,
+          const CloneOptions &options);
 
 #endif // CLONE_GADGET_H
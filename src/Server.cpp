@@ -1,18 +1,186 @@
 #include "../include/clone_gadget.h"
+#include "bitmap.h"
+#include "checkout.h"
+#include "commit_graph.h"
+#include "config.h"
+#include "fsmonitor.h"
+#include "hash_batch.h"
+#include "object_store.h"
+#include "reflog.h"
 #include "refs.h"
+#include "repack.h"
+#include "revision.h"
+#include "shared_cache.h"
+#include "sparse.h"
+#include "status.h"
+#include "trace.h"
+#include "tree.h"
+#include "upload_pack.h"
 #include <algorithm>
+#include <climits>
+#include <ctime>
+#include <fcntl.h>
 #include <curl/curl.h>
 #include <filesystem>
 #include <fstream>
 #include <iostream>
+#include <optional>
 #include <openssl/sha.h>
 #include <string.h>
 #include <string>
+#include <string_view>
+#include <sys/stat.h>
+#include <unistd.h>
 #include <vector>
 #include <zlib.h>
 
 using namespace std;
 
+// 打开或关闭 sparse-checkout 时改写 .git/config，与 git 相同；index.sparse
+// 让 git 保留 index 中的稀疏目录
+static void SetSparseConfig(bool enable) {
+  Config config(".git");
+  if (config.GetBool("core.sparseCheckout", false) == enable) {
+    return; // 已经打开时保留用户对 index.sparse 的选择
+  }
+  config.Set("core.sparseCheckout", enable ? "true" : "false");
+  if (enable) {
+    config.Set("core.sparseCheckoutCone", "true");
+  } else {
+    config.Unset("core.sparseCheckoutCone");
+  }
+  config.Set("index.sparse", enable ? "true" : "false");
+}
+
+/**
+ * @brief 解析 "--<name>=<n>" 形式的选项值
+ * @param max n 的上限，下限为 0
+ * @return n 不是范围内的十进制整数时输出 fatal: 错误并返回 false
+ */
+static bool ParseIntOption(const std::string &arg, int max, int &value) {
+  size_t eq = arg.find('=');
+  std::string text = arg.substr(eq + 1);
+  if (!text.empty() && text.size() <= 10 &&
+      text.find_first_not_of("0123456789") == std::string::npos &&
+      std::stoll(text) <= max) {
+    value = std::stoi(text);
+    return true;
+  }
+  std::cerr << "fatal: " << arg.substr(0, eq)
+            << " expects an integer between 0 and " << max << ", got '"
+            << text << "'\n";
+  return false;
+}
+
+// 将用户输入的名字转换为 reflog 使用的完整引用名
+static std::string ReflogRefName(const MiniGitRef &refs,
+                                 const std::string &name) {
+  if (name.empty()) { // "@{n}" 指当前分支
+    return "refs/heads/" + refs.GetCurrentBranchName();
+  }
+  if (name == "HEAD" || name.starts_with("refs/")) {
+    return name;
+  }
+  return "refs/heads/" + name;
+}
+
+/**
+ * @brief 将修订名解析为40字符提交哈希
+ * @param rev 支持 HEAD、分支名、<name>@{n}、@{n} 以及完整哈希
+ * @return 解析失败时返回空字符串
+ */
+static std::string ResolveRevision(const MiniGitRef &refs,
+                                   const std::string &rev) {
+  if (auto spec = ParseReflogSpec(rev)) {
+    auto entry = Reflog().Lookup(ReflogRefName(refs, spec->first), spec->second);
+    return entry ? entry->new_hash : "";
+  }
+  if (rev == "HEAD") {
+    return refs.GetCurrentCommit();
+  }
+  if (refs.BranchExists(rev)) {
+    return refs.GetBranchCommit(rev);
+  }
+  if (rev.size() == 40 &&
+      rev.find_first_not_of("0123456789abcdef") == std::string::npos) {
+    return rev;
+  }
+  return "";
+}
+
+// 提交头部中的 "<name> <<email>> <秒数> <时区>" 格式化为 git log 的日期
+static std::string FormatSignatureDate(std::string_view signature) {
+  size_t gt = signature.rfind('>');
+  if (gt == std::string_view::npos) {
+    return "";
+  }
+  time_t seconds = 0;
+  char tz[8] = "+0000";
+  sscanf(std::string(signature.substr(gt + 1)).c_str(), " %ld %7s", &seconds,
+         tz);
+  int offset = 0;
+  if (strlen(tz) == 5) {
+    offset = ((tz[1] - '0') * 10 + (tz[2] - '0')) * 3600 +
+             ((tz[3] - '0') * 10 + (tz[4] - '0')) * 60;
+    if (tz[0] == '-') {
+      offset = -offset;
+    }
+  }
+  time_t local = seconds + offset;
+  struct tm tm;
+  gmtime_r(&local, &tm);
+  char day[16], rest[32];
+  strftime(day, sizeof(day), "%a %b", &tm);
+  strftime(rest, sizeof(rest), "%H:%M:%S %Y", &tm);
+  return std::string(day) + ' ' + std::to_string(tm.tm_mday) + ' ' + rest +
+         ' ' + tz;
+}
+
+// git log 默认格式的一条记录
+static void PrintLogEntry(const std::string &hash,
+                          const commit_graph::CommitHeader &commit) {
+  std::cout << "commit " << hash << '\n';
+  if (commit.parents.size() > 1) {
+    std::cout << "Merge:";
+    for (auto parent : commit.parents) {
+      std::cout << ' ' << parent.substr(0, 7);
+    }
+    std::cout << '\n';
+  }
+  std::cout << "Author: " << commit.author.substr(0, commit.author.rfind('>') + 1)
+            << '\n';
+  std::cout << "Date:   " << FormatSignatureDate(commit.author) << "\n\n";
+  std::string_view message = commit.message;
+  while (!message.empty() && message.back() == '\n') {
+    message.remove_suffix(1);
+  }
+  size_t pos = 0;
+  while (pos <= message.size()) {
+    size_t eol = message.find('\n', pos);
+    std::string_view line = message.substr(pos, eol - pos);
+    std::cout << "    " << line << '\n';
+    if (eol == std::string_view::npos) {
+      break;
+    }
+    pos = eol + 1;
+  }
+}
+
+// 提交的根 tree，没有提交（新分支）时为空树
+static std::string CommitTree(const ObjectStore &store,
+                              const std::string &commit) {
+  if (commit.empty()) {
+    return "";
+  }
+  auto object = store.Read(commit);
+  if (!object || object->type != ObjectType::kCommit) {
+    throw std::runtime_error("bad commit " + commit);
+  }
+  commit_graph::CommitHeader header;
+  commit_graph::ParseCommitHeader(commit, object->data, header);
+  return std::string(header.tree);
+}
+
 int main(int argc, char *argv[]) {
   // Flush after every std::cout / std::cerr
   std::cout << std::unitbuf;
@@ -29,10 +197,22 @@ int main(int argc, char *argv[]) {
   std::string command = argv[1];
 
   if (command == "init") {
+    // 可选参数：--ref-format=files|reftable
+    RefFormat ref_format = RefFormat::kFiles;
+    if (argc > 2) {
+      std::string flag = argv[2];
+      if (flag == "--ref-format=reftable") {
+        ref_format = RefFormat::kReftable;
+      } else if (flag != "--ref-format=files") {
+        std::cerr << "Unknown ref format: " << flag
+                  << "\nexpected --ref-format=files or --ref-format=reftable\n";
+        return EXIT_FAILURE;
+      }
+    }
     try {
       std::filesystem::create_directory(".git");
       std::filesystem::create_directory(".git/objects");
-      GitRefsSys.Init();
+      GitRefsSys.Init(ref_format);
       std::cout << "Initialized git directory\n";
     } catch (const std::filesystem::filesystem_error &e) {
       std::cerr << e.what() << '\n';
@@ -49,43 +229,68 @@ int main(int argc, char *argv[]) {
       return EXIT_FAILURE;
     }
     const string value = argv[3];
-    const string dir_name = value.substr(0, 2);
-    const string blob_sha = value.substr(2);
-    // not secure - technically. - can have LFI
-    std::string path = ".git/objects/" + dir_name + "/" + blob_sha;
-    std::ifstream in(path, std::ios::binary);
-    if (!in.is_open()) {
+    // 松散对象和 pack 中的对象都经由对象库读取
+    std::optional<GitObject> object;
+    try {
+      object = ObjectStore().Read(value);
+    } catch (const std::runtime_error &e) {
+      std::cerr << e.what() << '\n';
+      return EXIT_FAILURE;
+    }
+    if (!object) {
       std::cerr << "Failed to open object file?\n";
       return EXIT_FAILURE;
     }
-    in.seekg(0, std::ios::end);
-    int fileSize = in.tellg();
-    in.seekg(0, std::ios::beg);
-    if (fileSize > 0) {
-      std::vector<Bytef> buffer(fileSize);
-      in.read(reinterpret_cast<char *>(buffer.data()), fileSize);
-      uLongf decompressedSize = fileSize * 100;
-      std::vector<Bytef> decompressedData(decompressedSize);
-      int result = uncompress(decompressedData.data(), &decompressedSize,
-                              buffer.data(), fileSize);
-      if (result == Z_OK) {
-        bool isSignFound = false;
-        for (int i = 0; i < decompressedSize; i++) {
-          if (isSignFound)
-            std::cout << decompressedData[i];
-          if (decompressedData[i] == '\0') {
-            isSignFound = true;
-          }
+    std::cout.write(object->data.data(), object->data.size());
+  } else if (command == "hash-object") {
+    // hash-object [-w] <file>...
+    // hash-object [-w] [--threads=<n>] --stdin-paths | --batch
+    // 不带 -w 时只计算哈希；--batch 从标准输入读取 "<长度>\n<内容>"
+    hash_batch::Options options;
+    bool batch = false;
+    std::vector<std::string> files;
+    for (int i = 2; i < argc; i++) {
+      std::string arg = argv[i];
+      if (arg == "-w") {
+        options.write_objects = true;
+      } else if (arg == "--stdin-paths") {
+        batch = true;
+        options.input = hash_batch::Input::kPaths;
+      } else if (arg == "--batch") {
+        batch = true;
+        options.input = hash_batch::Input::kContents;
+      } else if (arg.starts_with("--threads=")) {
+        int threads = 0;
+        if (!ParseIntOption(arg, INT_MAX, threads)) {
+          return EXIT_FAILURE;
         }
+        options.threads = threads;
+      } else if (arg.starts_with("-")) {
+        std::cerr << "unknown option: " << arg << '\n';
+        return EXIT_FAILURE;
+      } else {
+        files.push_back(arg);
       }
     }
-  } else if (command == "hash-object") {
-    if (argc < 3) {
-      std::cerr << "Less than 3 argument " << '\n';
+    if (batch == !files.empty()) {
+      std::cerr << "usage: hash-object [-w] (<file>... | --stdin-paths | "
+                   "--batch)\n";
+      return EXIT_FAILURE;
+    }
+    try {
+      if (batch) {
+        std::ios::sync_with_stdio(false);
+        return hash_batch::Run(std::cin, std::cout, std::cerr, options)
+                   ? EXIT_SUCCESS
+                   : EXIT_FAILURE;
+      }
+      for (const std::string &file : files) {
+        cout << hash_object(file, options.write_objects) << endl;
+      }
+    } catch (const std::exception &e) {
+      std::cerr << "fatal: " << e.what() << '\n';
       return EXIT_FAILURE;
     }
-    std::string hash = argv[3];
-    cout << hash_object(hash) << endl;
   }
   // The ls-tree command
   else if (command == "ls-tree") {
@@ -109,51 +314,42 @@ int main(int argc, char *argv[]) {
                 << "\n";
       return EXIT_FAILURE;
     }
-    std::string dir_name = tree_sha.substr(0, 2);
-    std::string file_name = tree_sha.substr(2);
-    std::string path = "./.git/objects/" + dir_name + "/" + file_name;
-    auto file = std::ifstream(path);
-    if (!file.is_open()) {
-      std::cerr << "Failed to open file: " << path << "\n";
-      return EXIT_FAILURE;
-    }
-    auto tree_data = std::string(std::istreambuf_iterator<char>(file),
-                                 std::istreambuf_iterator<char>());
-    std::string buf;
-    buf.resize(tree_data.size());
-    while (true) {
-      auto buf_size = buf.size();
-      auto res = uncompress(reinterpret_cast<Bytef *>(buf.data()), &buf_size,
-                            reinterpret_cast<const Bytef *>(tree_data.data()),
-                            tree_data.size());
-      if (res == Z_BUF_ERROR) {
-        buf.resize(buf.size() * 2);
-      } else if (res != Z_OK) {
-        std::cerr << "Failed to decompress file, code:" << res << "\n";
-        return EXIT_FAILURE;
-      } else {
-        buf.resize(buf_size);
-        break;
-      }
+    std::optional<GitObject> tree;
+    try {
+      tree = ObjectStore().Read(tree_sha);
+    } catch (const std::runtime_error &e) {
+      std::cerr << "Failed to read tree " << tree_sha << ": " << e.what()
+                << "\n";
+      return EXIT_FAILURE;
+    }
+    if (!tree || tree->type != ObjectType::kTree) {
+      std::cerr << "Not a tree object: " << tree_sha << "\n";
+      return EXIT_FAILURE;
     }
-    std::string trimmed_data = buf.substr(buf.find('\0') + 1);
-    std::string line;
     std::vector<std::string> names;
-    do {
-
-      line = trimmed_data.substr(0, trimmed_data.find('\0'));
-      if (line.substr(0, 5) == "40000")
-        names.push_back(line.substr(6));
-      else
-        names.push_back(line.substr(7));
-      trimmed_data = trimmed_data.substr(trimmed_data.find('\0') + 21);
-    } while (trimmed_data.size() > 1);
+    try {
+      tree::TreeParser parser(tree->data, tree_sha);
+      tree::TreeEntry entry;
+      while (parser.Next(entry)) {
+        names.emplace_back(entry.name);
+      }
+    } catch (const std::runtime_error &e) {
+      std::cerr << e.what() << "\n";
+      return EXIT_FAILURE;
+    }
     sort(names.begin(), names.end());
     for (int i = 0; i < names.size(); i++) {
       std::cout << names[i] << "\n";
     }
   } else if (command == "write-tree") {
-    std::string tree_hash = write_tree(".");
+    TRACE_SPAN("write-tree");
+    std::string tree_hash;
+    try {
+      tree_hash = write_tree(".");
+    } catch (const std::exception &e) {
+      std::cerr << "fatal: " << e.what() << '\n';
+      return EXIT_FAILURE;
+    }
     if (tree_hash.empty()) {
       std::cerr << "Error in writing tree object\n";
       return EXIT_FAILURE;
@@ -183,19 +379,845 @@ int main(int argc, char *argv[]) {
       std::cerr << "No such flag " << '\n';
       return EXIT_FAILURE;
     }
+    TRACE_SPAN("commit-tree");
     auto commit_sha = commit_tree(treeSha, parentSha, commitMsg);
-    GitRefsSys.UpdateCurrentBranch(commit_sha);
+    std::string subject = commitMsg.substr(0, commitMsg.find('\n'));
+    GitRefsSys.UpdateCurrentBranch(
+        commit_sha, (parentSha.empty() ? "commit (initial): " : "commit: ") +
+                        subject);
   } else if (command == "clone") {
-    if (argc < 3) {
+    // clone [--shared-cache=<dir>] [--sparse] [--filter=blob:none] <url> <dir>
+    // 未给出 --shared-cache 时取环境变量 MINIGIT_SHARED_CACHE；--sparse 只
+    // 检出根目录下的文件，之后用 sparse-checkout add 加入目录
+    std::string shared_cache;
+    CloneOptions options;
+    std::vector<std::string> positional;
+    for (int i = 2; i < argc; i++) {
+      std::string arg = argv[i];
+      if (arg.starts_with("--shared-cache=")) {
+        shared_cache = arg.substr(15);
+      } else if (arg == "--shared-cache" && i + 1 < argc) {
+        shared_cache = argv[++i];
+      } else if (arg == "--sparse") {
+        options.sparse = true;
+      } else if (arg.starts_with("--filter=")) {
+        options.filter = arg.substr(9);
+      } else {
+        positional.push_back(arg);
+      }
+    }
+    if (positional.size() < 2) {
       std::cerr << "No repository provided.\n";
       return EXIT_FAILURE;
     }
-    std::string url = argv[2];
-    std::string directory = argv[3];
-    if (clone(url, directory) != EXIT_SUCCESS) {
+    std::string url = positional[0];
+    std::string directory = positional[1];
+    if (clone(url, directory, shared_cache, options) != EXIT_SUCCESS) {
       std::cerr << "Failed to clone repository.\n";
       return EXIT_FAILURE;
     }
+  } else if (command == "repack" || command == "gc") {
+    // repack [-a|-A] [-d] [-b|--write-bitmap-index] [--window=<n>] [--depth=<n>]
+    //        [--threads=<n>] [--window-memory=<size>]
+    // gc [--prune=<time>|--prune=now] 以及同样的 pack 选项
+    // 未指定的选项取自 .git/config 的 pack.window、pack.depth、pack.threads、
+    // pack.windowMemory、repack.writeBitmaps
+    RepackOptions options;
+    time_t prune_cutoff = ParseExpireTime("14.days.ago");
+    try {
+      Config config;
+      options.pack.window = config.GetInt("pack.window", options.pack.window);
+      options.pack.depth = config.GetInt("pack.depth", options.pack.depth);
+      options.pack.threads = config.GetInt("pack.threads", 0);
+      options.pack.window_memory = config.GetInt("pack.windowMemory", 0);
+      options.write_bitmap = config.GetBool("repack.writeBitmaps", false);
+    } catch (const std::invalid_argument &e) {
+      std::cerr << "fatal: " << e.what() << '\n';
+      return EXIT_FAILURE;
+    }
+    for (int i = 2; i < argc; i++) {
+      std::string arg = argv[i];
+      try {
+        if (command == "repack" && arg.size() > 1 && arg[0] == '-' &&
+            arg[1] != '-') {
+          // 短选项可以合写，如 -ad、-Adb
+          for (char flag : arg.substr(1)) {
+            switch (flag) {
+            case 'a':
+              options.all = true;
+              break;
+            case 'A':
+              // 同 -a，但 -d 删除的旧 pack 中不可达的对象写成松散对象
+              options.all = options.unpack_unreachable = true;
+              break;
+            case 'd':
+              options.remove_redundant = true;
+              break;
+            case 'b':
+              options.write_bitmap = true;
+              break;
+            default:
+              std::cerr << "Unknown option for repack: -" << flag << '\n';
+              return EXIT_FAILURE;
+            }
+          }
+        } else if (arg == "--write-bitmap-index" && command == "repack") {
+          options.write_bitmap = true;
+        } else if (arg.starts_with("--window=")) {
+          if (!ParseIntOption(arg, INT_MAX, options.pack.window)) {
+            return EXIT_FAILURE;
+          }
+        } else if (arg.starts_with("--depth=")) {
+          if (!ParseIntOption(arg, INT_MAX, options.pack.depth)) {
+            return EXIT_FAILURE;
+          }
+        } else if (arg.starts_with("--threads=")) {
+          if (!ParseIntOption(arg, INT_MAX, options.pack.threads)) {
+            return EXIT_FAILURE;
+          }
+        } else if (arg.starts_with("--window-memory=")) {
+          options.pack.window_memory = ParseConfigInt(arg.substr(16));
+        } else if (arg.starts_with("--prune=") && command == "gc") {
+          prune_cutoff = ParseExpireTime(arg.substr(8));
+        } else {
+          std::cerr << "Unknown option for " << command << ": " << arg << '\n';
+          return EXIT_FAILURE;
+        }
+      } catch (const std::invalid_argument &e) {
+        std::cerr << "Invalid value: " << arg << '\n';
+        return EXIT_FAILURE;
+      }
+    }
+    if (options.write_bitmap && !options.all && command == "repack") {
+      std::cerr << "warning: disabling bitmap writing, as some objects are "
+                   "not being packed\n";
+    }
+    try {
+      size_t pruned = 0;
+      RepackResult result = command == "gc"
+                                ? Gc(options, prune_cutoff, pruned)
+                                : Repack(options);
+      if (result.pack_checksum.empty()) {
+        std::cerr << "Nothing new to pack.\n";
+      } else {
+        std::cerr << "Total " << result.objects << " (delta " << result.deltas
+                  << "), reused " << result.reused << "\n";
+        std::cout << "pack-" << result.pack_checksum << '\n';
+      }
+      if (result.unpacked) {
+        std::cerr << "Unpacked " << result.unpacked
+                  << " unreachable objects\n";
+      }
+      if (result.bitmaps) {
+        std::cerr << "Wrote bitmaps for " << result.bitmaps << " commits\n";
+      }
+      if (result.removed_loose || result.removed_packs || pruned) {
+        std::cerr << "Removed " << result.removed_loose
+                  << " packed loose objects, " << result.removed_packs
+                  << " old packs, " << pruned << " unreachable objects\n";
+      }
+    } catch (const std::runtime_error &e) {
+      std::cerr << "fatal: " << e.what() << '\n';
+      return EXIT_FAILURE;
+    }
+  } else if (command == "serve" || command == "http-serve") {
+    // serve [--host=<addr>] [--port=<n>] [--workers=<n>]
+    // 以只读的智能 HTTP 服务当前仓库，供 clone 使用；pack 选项同 repack
+    std::string host = "127.0.0.1";
+    int port = 8080;
+    int workers = 0;
+    pack::PackWriteOptions pack_options;
+    try {
+      Config config;
+      pack_options.window = config.GetInt("pack.window", pack_options.window);
+      pack_options.depth = config.GetInt("pack.depth", pack_options.depth);
+      pack_options.threads = config.GetInt("pack.threads", 0);
+      pack_options.window_memory = config.GetInt("pack.windowMemory", 0);
+    } catch (const std::invalid_argument &e) {
+      std::cerr << "fatal: " << e.what() << '\n';
+      return EXIT_FAILURE;
+    }
+    for (int i = 2; i < argc; i++) {
+      std::string arg = argv[i];
+      if (arg.starts_with("--host=")) {
+        host = arg.substr(7);
+      } else if (arg.starts_with("--port=")) {
+        if (!ParseIntOption(arg, 65535, port)) {
+          return EXIT_FAILURE;
+        }
+      } else if (arg.starts_with("--workers=")) {
+        if (!ParseIntOption(arg, INT_MAX, workers)) {
+          return EXIT_FAILURE;
+        }
+      } else {
+        std::cerr << "Unknown option for " << command << ": " << arg << '\n';
+        return EXIT_FAILURE;
+      }
+    }
+    if (!std::filesystem::exists(".git")) {
+      std::cerr << "fatal: not a git repository\n";
+      return EXIT_FAILURE;
+    }
+    try {
+      HttpServer server(upload_pack::HttpHandler(".git", pack_options),
+                        workers);
+      server.Listen(host, port);
+      std::cerr << "Serving " << std::filesystem::current_path().string()
+                << " on http://" << host << ":" << server.Port() << "/\n";
+      server.Run();
+    } catch (const std::runtime_error &e) {
+      std::cerr << "fatal: " << e.what() << '\n';
+      return EXIT_FAILURE;
+    }
+  } else if (command == "reflog") {
+    // reflog [show] [<ref>] | reflog expire [--expire=<time>] [--all|<ref>...]
+    Reflog reflog;
+    std::string sub = argc > 2 ? argv[2] : "show";
+    if (sub == "expire") {
+      time_t cutoff = ParseExpireTime("90.days.ago");
+      std::vector<std::string> refs;
+      for (int i = 3; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg.starts_with("--expire=")) {
+          try {
+            cutoff = ParseExpireTime(arg.substr(9));
+          } catch (const std::invalid_argument &e) {
+            std::cerr << e.what() << '\n';
+            return EXIT_FAILURE;
+          }
+        } else if (arg == "--all") {
+          refs = reflog.ListRefs();
+        } else {
+          refs.push_back(ReflogRefName(GitRefsSys, arg));
+        }
+      }
+      if (refs.empty()) {
+        refs.push_back("HEAD");
+      }
+      try {
+        for (const auto &ref : refs) {
+          size_t removed = reflog.Expire(ref, cutoff);
+          std::cerr << "Expired " << removed << " entries from " << ref
+                    << '\n';
+        }
+      } catch (const std::exception &e) {
+        std::cerr << "fatal: " << e.what() << '\n';
+        return EXIT_FAILURE;
+      }
+    } else {
+      std::string name = sub == "show" ? (argc > 3 ? argv[3] : "HEAD") : sub;
+      std::string ref = ReflogRefName(GitRefsSys, name);
+      size_t count = reflog.Count(ref);
+      for (size_t i = 0; i < count; i++) {
+        auto entry = reflog.Lookup(ref, i);
+        if (entry) {
+          std::cout << entry->new_hash.substr(0, 7) << ' ' << name << "@{" << i
+                    << "}: " << entry->message << '\n';
+        }
+      }
+    }
+  } else if (command == "rev-parse") {
+    if (argc < 3) {
+      std::cerr << "Usage: rev-parse <rev>\n";
+      return EXIT_FAILURE;
+    }
+    std::string rev = ResolveRevision(GitRefsSys, argv[2]);
+    if (rev.empty()) {
+      std::cerr << "fatal: bad revision '" << argv[2] << "'\n";
+      return EXIT_FAILURE;
+    }
+    std::cout << rev << '\n';
+  } else if (command == "commit-graph") {
+    // commit-graph write：为全部可达提交写出 .git/objects/info/commit-graph，
+    // 之后的 rev-list、log、merge-base 直接读取其中的父提交和代数
+    if (argc < 3 || std::string(argv[2]) != "write") {
+      std::cerr << "Usage: commit-graph write\n";
+      return EXIT_FAILURE;
+    }
+    try {
+      ObjectStore store;
+      size_t commits = commit_graph::Write(store, ReachabilityTips(store));
+      std::cerr << "Wrote commit-graph with " << commits << " commits\n";
+    } catch (const std::runtime_error &e) {
+      std::cerr << "fatal: " << e.what() << '\n';
+      return EXIT_FAILURE;
+    }
+  } else if (command == "rev-list" || command == "log") {
+    // rev-list [<选项>] <rev>...  按提交时间从新到旧输出可达提交的哈希
+    // log [<选项>] [<rev>...]     同样的顺序输出作者、日期和提交说明，
+    //                             默认从 HEAD 开始
+    // <rev> 可以是 A..B（B 可达而 A 不可达，省略的一边为 HEAD）或 ^A；
+    // 选项：--max-count=<n>、-n <n>、-<n>、--first-parent
+    revision::RevWalkOptions options;
+    std::vector<std::string> revs;
+    for (int i = 2; i < argc; i++) {
+      std::string arg = argv[i];
+      try {
+        if (arg.starts_with("--max-count=")) {
+          options.max_count = std::stoul(arg.substr(12));
+        } else if (arg == "-n" && i + 1 < argc) {
+          options.max_count = std::stoul(argv[++i]);
+        } else if (arg.size() > 1 && arg[0] == '-' &&
+                   arg.find_first_not_of("0123456789", 1) ==
+                       std::string::npos) {
+          options.max_count = std::stoul(arg.substr(1));
+        } else if (arg == "--first-parent") {
+          options.first_parent = true;
+        } else if (arg.starts_with("-")) {
+          std::cerr << "Unknown option for " << command << ": " << arg << '\n';
+          return EXIT_FAILURE;
+        } else {
+          revs.push_back(arg);
+        }
+      } catch (const std::exception &e) {
+        std::cerr << "Invalid value: " << arg << '\n';
+        return EXIT_FAILURE;
+      }
+    }
+    if (revs.empty()) {
+      if (command == "rev-list") {
+        std::cerr << "Usage: rev-list [<options>] <rev>...\n";
+        return EXIT_FAILURE;
+      }
+      revs.push_back("HEAD");
+    }
+    try {
+      ObjectStore store;
+      commit_graph::CommitIndex index(store);
+      revision::RevWalk walk(index, options);
+      auto lookup = [&](const std::string &rev) -> std::optional<uint32_t> {
+        std::string hash =
+            ResolveRevision(GitRefsSys, rev.empty() ? "HEAD" : rev);
+        if (hash.empty()) {
+          std::cerr << "fatal: bad revision '" << rev << "'\n";
+          return std::nullopt;
+        }
+        return index.Lookup(hash);
+      };
+      for (const auto &rev : revs) {
+        size_t dots = rev.find("..");
+        if (dots != std::string::npos) {
+          auto from = lookup(rev.substr(0, dots));
+          auto to = lookup(rev.substr(dots + 2));
+          if (!from || !to) {
+            return EXIT_FAILURE;
+          }
+          walk.Hide(*from);
+          walk.Push(*to);
+        } else if (rev.starts_with("^")) {
+          auto from = lookup(rev.substr(1));
+          if (!from) {
+            return EXIT_FAILURE;
+          }
+          walk.Hide(*from);
+        } else {
+          auto to = lookup(rev);
+          if (!to) {
+            return EXIT_FAILURE;
+          }
+          walk.Push(*to);
+        }
+      }
+      revision::CommitCache commits(store, index);
+      bool first = true;
+      uint32_t id;
+      while (walk.Next(id)) {
+        std::string hash = index.Hash(id);
+        if (command == "rev-list") {
+          std::cout << hash << '\n';
+          continue;
+        }
+        if (!first) {
+          std::cout << '\n';
+        }
+        first = false;
+        PrintLogEntry(hash, commits.Get(id));
+      }
+    } catch (const std::runtime_error &e) {
+      std::cerr << "fatal: " << e.what() << '\n';
+      return EXIT_FAILURE;
+    }
+  } else if (command == "merge-base") {
+    // merge-base [--all] <a> <b>       输出最佳共同祖先（--all 输出全部）
+    // merge-base --is-ancestor <a> <b> a 是 b 的祖先时退出码为0，否则为1
+    bool all = false;
+    bool is_ancestor = false;
+    std::vector<std::string> revs;
+    for (int i = 2; i < argc; i++) {
+      std::string arg = argv[i];
+      if (arg == "--all") {
+        all = true;
+      } else if (arg == "--is-ancestor") {
+        is_ancestor = true;
+      } else {
+        revs.push_back(arg);
+      }
+    }
+    if (revs.size() != 2) {
+      std::cerr << "Usage: merge-base [--all | --is-ancestor] <a> <b>\n";
+      return EXIT_FAILURE;
+    }
+    try {
+      ObjectStore store;
+      commit_graph::CommitIndex index(store);
+      uint32_t ids[2];
+      for (int i = 0; i < 2; i++) {
+        std::string hash = ResolveRevision(GitRefsSys, revs[i]);
+        if (hash.empty()) {
+          std::cerr << "fatal: bad revision '" << revs[i] << "'\n";
+          return EXIT_FAILURE;
+        }
+        ids[i] = index.Lookup(hash);
+      }
+      if (is_ancestor) {
+        return commit_graph::IsAncestor(index, ids[0], ids[1]) ? EXIT_SUCCESS
+                                                               : EXIT_FAILURE;
+      }
+      auto bases = commit_graph::MergeBases(index, ids[0], ids[1]);
+      if (bases.empty()) {
+        return EXIT_FAILURE;
+      }
+      for (uint32_t base : bases) {
+        std::cout << index.Hash(base) << '\n';
+        if (!all) {
+          break;
+        }
+      }
+    } catch (const std::runtime_error &e) {
+      std::cerr << "fatal: " << e.what() << '\n';
+      return EXIT_FAILURE;
+    }
+  } else if (command == "diff-tree") {
+    // diff-tree [-r] <tree-ish> <tree-ish>  以 raw 格式输出两棵树之间改动的路径
+    // diff-tree [-r] [--root] <commit>      与第一个父提交比较，先输出提交哈希；
+    //                                       根提交只在 --root 时与空树比较
+    //                                       合并提交不输出
+    // -r 进入子树只输出文件，否则改动的子树作为一项输出
+    tree::DiffOptions options;
+    bool root = false;
+    std::vector<std::string> revs;
+    for (int i = 2; i < argc; i++) {
+      std::string arg = argv[i];
+      if (arg == "-r") {
+        options.recursive = true;
+      } else if (arg == "--root") {
+        root = true;
+      } else if (arg.starts_with("-")) {
+        std::cerr << "Unknown option for diff-tree: " << arg << '\n';
+        return EXIT_FAILURE;
+      } else {
+        revs.push_back(arg);
+      }
+    }
+    if (revs.empty() || revs.size() > 2) {
+      std::cerr << "Usage: diff-tree [-r] [--root] <tree-ish> [<tree-ish>]\n";
+      return EXIT_FAILURE;
+    }
+    try {
+      ObjectStore store;
+      // 提交取其根 tree（同时取出父提交），tree 原样返回
+      auto peel = [&](const std::string &rev,
+                      std::vector<std::string> &parents) {
+        std::string hash = ResolveRevision(GitRefsSys, rev);
+        auto object = hash.empty() ? std::nullopt : store.Read(hash);
+        if (!object) {
+          throw std::runtime_error("bad revision '" + rev + "'");
+        }
+        if (object->type == ObjectType::kTree) {
+          return hash;
+        }
+        if (object->type != ObjectType::kCommit) {
+          throw std::runtime_error("object " + hash + " is a " +
+                                   ObjectTypeName(object->type) +
+                                   ", expected tree-ish");
+        }
+        commit_graph::CommitHeader header;
+        commit_graph::ParseCommitHeader(hash, object->data, header);
+        parents.assign(header.parents.begin(), header.parents.end());
+        return std::string(header.tree);
+      };
+      std::vector<std::string> parents;
+      std::string old_tree, new_tree;
+      if (revs.size() == 2) {
+        old_tree = peel(revs[0], parents);
+        new_tree = peel(revs[1], parents);
+      } else {
+        std::string commit = ResolveRevision(GitRefsSys, revs[0]);
+        auto header = commit.empty() ? std::nullopt : store.ReadHeader(commit);
+        if (!header || header->first != ObjectType::kCommit) {
+          throw std::runtime_error("diff-tree with one argument needs a commit");
+        }
+        new_tree = peel(commit, parents);
+        // 与 git 相同，合并提交不指定 -m/-c/--cc 时什么都不输出
+        if ((parents.empty() && !root) || parents.size() > 1) {
+          return EXIT_SUCCESS;
+        }
+        if (!parents.empty()) {
+          std::vector<std::string> ignored;
+          old_tree = peel(parents[0], ignored);
+        }
+        std::cout << commit << '\n';
+      }
+      tree::DiffTrees(store, old_tree, new_tree, options,
+                      [](const tree::Change &change) {
+                        std::cout << tree::FormatRaw(change) << '\n';
+                      });
+    } catch (const std::runtime_error &e) {
+      std::cerr << "fatal: " << e.what() << '\n';
+      return EXIT_FAILURE;
+    }
+  } else if (command == "checkout") {
+    // checkout <branch>  按新旧提交的 tree 差异更新工作区，再把 HEAD 指向
+    //                    该分支；有本地改动的文件会被覆盖时什么都不做
+    if (argc != 3) {
+      std::cerr << "Usage: checkout <branch>\n";
+      return EXIT_FAILURE;
+    }
+    std::string branch = argv[2];
+    if (!GitRefsSys.BranchExists(branch)) {
+      std::cerr << "error: pathspec '" << branch
+                << "' did not match any branch\n";
+      return EXIT_FAILURE;
+    }
+    if (branch == GitRefsSys.GetCurrentBranchName()) {
+      std::cout << "Already on '" << branch << "'\n";
+      return EXIT_SUCCESS;
+    }
+    try {
+      ObjectStore store;
+      auto result = checkout::CheckoutTree(
+          store, ".", CommitTree(store, GitRefsSys.GetCurrentCommit()),
+          CommitTree(store, GitRefsSys.GetBranchCommit(branch)),
+          shared_cache::SharedCache::ForStore(store).get());
+      trace::Flush();
+      if (!result.Ok()) {
+        auto report = [](const std::vector<std::string> &paths,
+                         const char *what) {
+          if (paths.empty()) {
+            return;
+          }
+          std::cerr << "error: " << what
+                    << " would be overwritten by checkout:\n";
+          for (const auto &path : paths) {
+            std::cerr << '\t' << path << '\n';
+          }
+        };
+        report(result.local_changes, "Your local changes to the following files");
+        report(result.untracked, "The following untracked working tree files");
+        std::cerr << "Please commit your changes or stash them before you "
+                     "switch branches.\nAborting\n";
+        return EXIT_FAILURE;
+      }
+      GitRefsSys.SwitchToBranch(branch);
+    } catch (const std::exception &e) {
+      std::cerr << "fatal: " << e.what() << '\n';
+      return EXIT_FAILURE;
+    }
+  } else if (command == "sparse-checkout") {
+    // sparse-checkout (init | set <dir>... | add <dir>... | list | disable |
+    //                  reapply)
+    // init 只检出根目录下的文件；set 换成给出的目录，add 在现有目录之外再
+    // 加入；disable 恢复完整检出；reapply 在手工修改 info/sparse-checkout
+    // 之后按其内容更新工作区
+    std::string sub = argc > 2 ? argv[2] : "";
+    if (sub != "init" && sub != "set" && sub != "add" && sub != "list" &&
+        sub != "disable" && sub != "reapply") {
+      std::cerr << "usage: sparse-checkout (init | set <dir>... | add <dir>... "
+                   "| list | disable | reapply)\n";
+      return EXIT_FAILURE;
+    }
+    try {
+      std::optional<sparse::Cone> cone = sparse::Cone::Read(".git");
+      if (sub == "list") {
+        if (!cone) {
+          std::cerr << "fatal: this worktree is not sparse\n";
+          return EXIT_FAILURE;
+        }
+        for (const auto &dir : cone->Dirs()) {
+          std::cout << dir << '\n';
+        }
+        return EXIT_SUCCESS;
+      }
+      std::vector<std::string> dirs(argv + 3, argv + argc);
+      if (sub == "init") {
+        cone = cone ? cone : sparse::Cone();
+      } else if (sub == "set") {
+        cone = sparse::Cone(dirs);
+      } else if (sub == "add") {
+        if (!cone) {
+          std::cerr << "fatal: no sparse-checkout to add to\n";
+          return EXIT_FAILURE;
+        }
+        dirs.insert(dirs.end(), cone->Dirs().begin(), cone->Dirs().end());
+        cone = sparse::Cone(dirs);
+      } else if (sub == "disable") {
+        cone.reset();
+      }
+      ObjectStore store;
+      auto result = checkout::ApplySparse(
+          store, ".", CommitTree(store, GitRefsSys.GetCurrentCommit()),
+          cone ? &*cone : nullptr,
+          shared_cache::SharedCache::ForStore(store).get());
+      trace::Flush();
+      if (!result.Ok()) {
+        auto report = [](const std::vector<std::string> &paths,
+                         const char *what) {
+          if (paths.empty()) {
+            return;
+          }
+          std::cerr << "error: " << what
+                    << " would be overwritten by sparse-checkout:\n";
+          for (const auto &path : paths) {
+            std::cerr << '\t' << path << '\n';
+          }
+        };
+        report(result.local_changes, "Your local changes to the following files");
+        report(result.untracked, "The following untracked working tree files");
+        std::cerr << "Aborting\n";
+        return EXIT_FAILURE;
+      }
+      if (cone) {
+        cone->Write(".git");
+      } else {
+        std::filesystem::remove(".git/info/sparse-checkout");
+      }
+      SetSparseConfig(cone.has_value());
+    } catch (const std::exception &e) {
+      std::cerr << "fatal: " << e.what() << '\n';
+      return EXIT_FAILURE;
+    }
+  } else if (command == "status") {
+    // status [-s|--short|--porcelain] [-uno|-unormal|--untracked-files=<mode>]
+    //        [--threads=<n>]
+    bool porcelain = false;
+    status::Options options;
+    for (int i = 2; i < argc; i++) {
+      std::string arg = argv[i];
+      if (arg == "-s" || arg == "--short" || arg == "--porcelain") {
+        porcelain = true;
+      } else if (arg == "-uno" || arg == "--untracked-files=no") {
+        options.untracked = false;
+      } else if (arg == "-u" || arg == "-unormal" ||
+                 arg == "--untracked-files=normal") {
+        options.untracked = true;
+      } else if (arg.starts_with("--threads=")) {
+        int threads = 0;
+        if (!ParseIntOption(arg, INT_MAX, threads)) {
+          return EXIT_FAILURE;
+        }
+        options.threads = threads;
+      } else {
+        std::cerr << "Unknown option for status: " << arg << '\n';
+        return EXIT_FAILURE;
+      }
+    }
+    if (!std::filesystem::exists(".git")) {
+      std::cerr << "fatal: not a git repository\n";
+      return EXIT_FAILURE;
+    }
+    std::vector<status::Entry> entries;
+    std::string head;
+    try {
+      ObjectStore store;
+      head = GitRefsSys.GetCurrentCommit();
+      entries = status::Status(store, ".", CommitTree(store, head), options);
+    } catch (const std::exception &e) {
+      std::cerr << "fatal: " << e.what() << '\n';
+      return EXIT_FAILURE;
+    }
+    // 一次写出，不逐行 flush
+    std::string out;
+    if (porcelain) {
+      for (const auto &entry : entries) {
+        out += status::FormatPorcelain(entry) + '\n';
+      }
+    } else {
+      out = "On branch " + GitRefsSys.GetCurrentBranchName() + '\n';
+      if (head.empty()) {
+        out += "\nNo commits yet\n";
+      }
+      auto label = [](char status) {
+        switch (status) {
+        case 'A':
+          return "new file:   ";
+        case 'D':
+          return "deleted:    ";
+        case 'U':
+          return "both modified:   ";
+        default:
+          return "modified:   ";
+        }
+      };
+      auto section = [&](const char *title, auto &&pick) {
+        std::string lines;
+        for (const auto &entry : entries) {
+          if (char status = pick(entry)) {
+            lines += '\t';
+            lines += status == '?' ? "" : label(status);
+            lines += tree::QuotePath(entry.path) + '\n';
+          }
+        }
+        if (!lines.empty()) {
+          out += std::string(title) + ":\n" + lines + '\n';
+        }
+        return !lines.empty();
+      };
+      bool staged = section("Changes to be committed", [](const auto &e) {
+        return e.staged != ' ' && e.staged != '?' ? e.staged : '\0';
+      });
+      bool unstaged = section("Changes not staged for commit", [](const auto &e) {
+        return e.unstaged != ' ' && e.unstaged != '?' && e.staged != 'U'
+                   ? e.unstaged
+                   : '\0';
+      });
+      bool untracked = section("Untracked files", [](const auto &e) {
+        return e.staged == '?' ? '?' : '\0';
+      });
+      if (!staged && !unstaged) {
+        out += untracked ? "nothing added to commit but untracked files present\n"
+                         : "nothing to commit, working tree clean\n";
+      } else if (!staged) {
+        out += "no changes added to commit\n";
+      }
+    }
+    std::cout << out;
+  } else if (command == "count-objects") {
+    // count-objects [-v]  松散对象个数和占用空间（KiB），与 git 的输出相同；
+    // -v 还输出 pack 的统计，以及从引用可达的对象数 reachable（有位图时
+    // 由位图计算，不遍历历史）
+    bool verbose = argc > 2 && (std::string(argv[2]) == "-v" ||
+                                std::string(argv[2]) == "--verbose");
+    try {
+      ObjectStore store;
+      auto disk_kib = [](const std::filesystem::path &path) -> uint64_t {
+        struct stat st;
+        return stat(path.c_str(), &st) == 0 ? uint64_t(st.st_blocks) * 512 / 1024
+                                            : 0;
+      };
+      size_t loose = 0, packable = 0;
+      uint64_t loose_kib = 0;
+      for (const auto &hash : store.ListLoose()) {
+        loose++;
+        loose_kib += disk_kib(store.LoosePath(hash));
+        if (store.InAnyPack(hash)) {
+          packable++;
+        }
+      }
+      if (!verbose) {
+        std::cout << loose << " objects, " << loose_kib << " kilobytes\n";
+        return EXIT_SUCCESS;
+      }
+      size_t in_pack = 0;
+      uint64_t pack_bytes = 0;
+      for (const auto &packfile : store.Packs()) {
+        in_pack += packfile->Count();
+        pack_bytes += std::filesystem::file_size(packfile->PackPath()) +
+                      std::filesystem::file_size(packfile->IdxPath());
+      }
+      // pack 目录中不属于任何完整 pack 的文件
+      size_t garbage = 0;
+      uint64_t garbage_kib = 0;
+      std::error_code ec;
+      for (const auto &entry : std::filesystem::directory_iterator(store.PackDir(), ec)) {
+        std::filesystem::path path = entry.path();
+        std::filesystem::path idx = std::filesystem::path(path).replace_extension(".idx");
+        std::filesystem::path packpath = std::filesystem::path(path).replace_extension(".pack");
+        std::string ext = path.extension().string();
+        bool known = (ext == ".idx" || ext == ".pack" || ext == ".bitmap" ||
+                      ext == ".keep") &&
+                     std::filesystem::exists(idx) && std::filesystem::exists(packpath);
+        if (!known) {
+          garbage++;
+          garbage_kib += disk_kib(path);
+        }
+      }
+      auto tips = ReachabilityTips(store);
+      size_t reachable = 0;
+      if (auto bitmaps = bitmap::PackBitmap::Open(store)) {
+        reachable = bitmaps->Reachable(tips).Count();
+      } else {
+        reachable = EnumerateReachable(store, tips).size();
+      }
+      std::cout << "count: " << loose << '\n'
+                << "size: " << loose_kib << '\n'
+                << "in-pack: " << in_pack << '\n'
+                << "packs: " << store.Packs().size() << '\n'
+                << "size-pack: " << pack_bytes / 1024 << '\n'
+                << "prune-packable: " << packable << '\n'
+                << "garbage: " << garbage << '\n'
+                << "size-garbage: " << garbage_kib << '\n'
+                << "reachable: " << reachable << '\n';
+    } catch (const std::runtime_error &e) {
+      std::cerr << "fatal: " << e.what() << '\n';
+      return EXIT_FAILURE;
+    }
+  } else if (command == "fsmonitor--daemon") {
+    // fsmonitor--daemon run | start | stop | status
+    std::string sub = argc > 2 ? argv[2] : "status";
+    if (!std::filesystem::exists(".git")) {
+      std::cerr << "fatal: not a git repository\n";
+      return EXIT_FAILURE;
+    }
+    std::string worktree = std::filesystem::current_path().string();
+    if (sub == "stop") {
+      if (!fsmonitor::StopDaemon(".git")) {
+        std::cerr << "fatal: fsmonitor-daemon is not running\n";
+        return EXIT_FAILURE;
+      }
+    } else if (sub == "status") {
+      bool running = fsmonitor::Query(".git", "").has_value();
+      std::cout << "fsmonitor-daemon is " << (running ? "" : "not ")
+                << "watching '" << worktree << "'\n";
+      return running ? EXIT_SUCCESS : EXIT_FAILURE;
+    } else if (sub == "run" || sub == "start") {
+      // start：子进程建好所有 watch 后通过管道通知父进程，父进程随即返回
+      int ready[2] = {-1, -1};
+      if (sub == "start") {
+        if (pipe(ready) != 0) {
+          std::cerr << "fatal: pipe failed: " << strerror(errno) << '\n';
+          return EXIT_FAILURE;
+        }
+        pid_t pid = fork();
+        if (pid < 0) {
+          std::cerr << "fatal: fork failed: " << strerror(errno) << '\n';
+          return EXIT_FAILURE;
+        }
+        if (pid > 0) {
+          close(ready[1]);
+          char c;
+          bool started = read(ready[0], &c, 1) == 1;
+          close(ready[0]);
+          if (!started) {
+            std::cerr << "fatal: fsmonitor-daemon failed to start\n";
+            return EXIT_FAILURE;
+          }
+          std::cout << "fsmonitor-daemon is watching '" << worktree << "'\n";
+          return EXIT_SUCCESS;
+        }
+        close(ready[0]);
+        setsid();
+      }
+      try {
+        fsmonitor::Daemon daemon(".");
+        if (ready[1] >= 0) {
+          // 不再占用调用方的终端或管道
+          int null = open("/dev/null", O_RDWR | O_CLOEXEC);
+          for (int fd = 0; fd <= 2; fd++) {
+            dup2(null, fd);
+          }
+          close(null);
+          (void)!write(ready[1], "1", 1);
+          close(ready[1]);
+        }
+        daemon.Run();
+      } catch (const std::runtime_error &e) {
+        std::cerr << "fatal: " << e.what() << '\n';
+        return EXIT_FAILURE;
+      }
+    } else {
+      std::cerr << "usage: git fsmonitor--daemon (run|start|stop|status)\n";
+      return EXIT_FAILURE;
+    }
   } else {
     std::cerr << "Unknown command " << command << '\n';
     return EXIT_FAILURE;
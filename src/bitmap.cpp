@@ -0,0 +1,562 @@
+#include "bitmap.h"
+#include "byte_util.h"
+#include "durability.h"
+#include "revision.h"
+#include "trace.h"
+#include "tree.h"
+#include <algorithm>
+#include <fcntl.h>
+#include <functional>
+#include <numeric>
+#include <openssl/sha.h>
+#include <stdexcept>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_set>
+
+namespace fs = std::filesystem;
+using byte_util::BinaryToHex;
+using byte_util::GetBE32;
+using byte_util::GetBE64;
+using byte_util::HexToBinary;
+using byte_util::PutBE16;
+using byte_util::PutBE32;
+using byte_util::PutBE64;
+
+namespace bitmap {
+namespace {
+
+constexpr uint16_t kVersion = 1;
+constexpr uint16_t kOptionFullDag = 0x1;
+constexpr uint16_t kOptionHashCache = 0x4;
+constexpr size_t kHeaderSize = 32;
+constexpr size_t kEntryHeaderSize = 6;
+// 按时间顺序遍历历史时，每隔这么多个提交选一个计算位图
+constexpr size_t kSelectInterval = 100;
+// 标记字中连续字个数与原样字个数的上限
+constexpr uint64_t kMaxRunLength = 0xFFFFFFFFu;
+constexpr uint64_t kMaxLiteralWords = 0x7FFFFFFFu;
+
+// EWAH 中 bits 之后的字节数：位数 + 字数 + 字 + 标记字下标
+size_t EwahSize(const unsigned char *data, size_t size) {
+  if (size < 8) {
+    return 0;
+  }
+  size_t words = GetBE32(data + 4);
+  size_t total = 8 + words * 8 + 4;
+  return total <= size ? total : 0;
+}
+
+// 位图中的位按对象在 pack 中的偏移排序
+void PackOrder(const pack::PackFile &pack, std::vector<uint32_t> &order,
+               std::vector<uint32_t> &positions) {
+  order.resize(pack.Count());
+  std::iota(order.begin(), order.end(), 0);
+  std::vector<uint64_t> offsets(pack.Count());
+  for (size_t i = 0; i < pack.Count(); i++) {
+    offsets[i] = pack.OffsetAt(i);
+  }
+  std::sort(order.begin(), order.end(), [&offsets](uint32_t a, uint32_t b) {
+    return offsets[a] < offsets[b];
+  });
+  positions.resize(pack.Count());
+  for (size_t pos = 0; pos < order.size(); pos++) {
+    positions[order[pos]] = pos;
+  }
+}
+
+/**
+ * @brief 把从提交可达的对象加入位图的遍历
+ *
+ * 对象的位由 position 给出；stored 返回提交已有的完整位图，遇到时直接
+ * 或进结果，不再向下走。位已经为1的对象及其下面的对象都已在结果中。
+ */
+class ClosureWalk {
+public:
+  using PositionFn = std::function<uint32_t(
+      const std::string &hash, ObjectType type, const std::string &name)>;
+  using StoredFn = std::function<const Bitmap *(const std::string &hash)>;
+
+  ClosureWalk(const ObjectStore &store, commit_graph::CommitIndex &index,
+              PositionFn position, StoredFn stored)
+      : store_(store), index_(index), position_(std::move(position)),
+        stored_(std::move(stored)) {}
+
+  void Add(const std::string &commit, Bitmap &result) {
+    std::vector<uint32_t> pending = {index_.Lookup(commit)};
+    std::vector<uint32_t> parents;
+    while (!pending.empty()) {
+      uint32_t id = pending.back();
+      pending.pop_back();
+      std::string hash = index_.Hash(id);
+      uint32_t pos = position_(hash, ObjectType::kCommit, "");
+      if (result.Get(pos)) {
+        continue;
+      }
+      if (const Bitmap *stored = stored_(hash)) {
+        result |= *stored;
+        continue;
+      }
+      result.Set(pos);
+      AddTree(index_.Tree(id), "", result);
+      index_.Parents(id, parents);
+      pending.insert(pending.end(), parents.begin(), parents.end());
+    }
+  }
+
+private:
+  void AddTree(const std::string &hash, const std::string &name,
+               Bitmap &result) {
+    uint32_t pos = position_(hash, ObjectType::kTree, name);
+    if (result.Get(pos)) {
+      return;
+    }
+    result.Set(pos);
+    auto object = store_.Read(hash);
+    if (!object || object->type != ObjectType::kTree) {
+      throw std::runtime_error("missing tree " + hash);
+    }
+    tree::TreeParser parser(object->data, hash);
+    tree::TreeEntry entry;
+    while (parser.Next(entry)) {
+      std::string child_name(entry.name);
+      if (entry.IsTree()) {
+        AddTree(entry.Hash(), child_name, result);
+      } else if (entry.mode != tree::kModeGitlink) { // 子模块提交不在本仓库中
+        result.Set(position_(entry.Hash(), ObjectType::kBlob, child_name));
+      }
+    }
+  }
+
+  const ObjectStore &store_;
+  commit_graph::CommitIndex &index_;
+  PositionFn position_;
+  StoredFn stored_;
+};
+
+} // namespace
+
+// ---- Bitmap ----
+
+Bitmap &Bitmap::operator|=(const Bitmap &other) {
+  if (other.words_.size() > words_.size()) {
+    words_.resize(other.words_.size());
+  }
+  for (size_t i = 0; i < other.words_.size(); i++) {
+    words_[i] |= other.words_[i];
+  }
+  return *this;
+}
+
+Bitmap &Bitmap::operator^=(const Bitmap &other) {
+  if (other.words_.size() > words_.size()) {
+    words_.resize(other.words_.size());
+  }
+  for (size_t i = 0; i < other.words_.size(); i++) {
+    words_[i] ^= other.words_[i];
+  }
+  return *this;
+}
+
+void Bitmap::AndNot(const Bitmap &other) {
+  size_t common = std::min(words_.size(), other.words_.size());
+  for (size_t i = 0; i < common; i++) {
+    words_[i] &= ~other.words_[i];
+  }
+}
+
+size_t Bitmap::Count() const {
+  size_t count = 0;
+  for (uint64_t word : words_) {
+    count += std::popcount(word);
+  }
+  return count;
+}
+
+bool Bitmap::operator==(const Bitmap &other) const {
+  const auto &shorter = words_.size() < other.words_.size() ? words_
+                                                            : other.words_;
+  const auto &longer = words_.size() < other.words_.size() ? other.words_
+                                                           : words_;
+  return std::equal(shorter.begin(), shorter.end(), longer.begin()) &&
+         std::all_of(longer.begin() + shorter.size(), longer.end(),
+                     [](uint64_t word) { return word == 0; });
+}
+
+// ---- EWAH ----
+
+void EwahEncode(const Bitmap &bitmap, std::string &out) {
+  const auto &words = bitmap.Words();
+  size_t count = words.size();
+  while (count > 0 && words[count - 1] == 0) {
+    count--;
+  }
+  uint32_t bit_size =
+      count == 0 ? 0 : (count - 1) * 64 + 64 - std::countl_zero(words[count - 1]);
+
+  std::vector<uint64_t> encoded;
+  size_t last_marker = 0;
+  size_t i = 0;
+  do {
+    // 一个标记字：先是一段全0或全1的字，然后是一段原样存放的字
+    uint64_t run_length = 0;
+    bool run_bit = i < count && words[i] == ~uint64_t(0);
+    uint64_t clean = run_bit ? ~uint64_t(0) : 0;
+    while (i < count && words[i] == clean && run_length < kMaxRunLength) {
+      run_length++;
+      i++;
+    }
+    size_t literal_begin = i;
+    while (i < count && words[i] != 0 && words[i] != ~uint64_t(0) &&
+           i - literal_begin < kMaxLiteralWords) {
+      i++;
+    }
+    uint64_t literals = i - literal_begin;
+    last_marker = encoded.size();
+    encoded.push_back(uint64_t(run_bit) | (run_length << 1) | (literals << 33));
+    encoded.insert(encoded.end(), words.begin() + literal_begin,
+                   words.begin() + i);
+  } while (i < count);
+
+  PutBE32(out, bit_size);
+  PutBE32(out, encoded.size());
+  for (uint64_t word : encoded) {
+    PutBE64(out, word);
+  }
+  PutBE32(out, last_marker);
+}
+
+Bitmap EwahDecode(const unsigned char *data, size_t size, size_t &consumed) {
+  consumed = EwahSize(data, size);
+  if (consumed == 0) {
+    throw std::runtime_error("bitmap: truncated EWAH bitmap");
+  }
+  size_t buffer_size = GetBE32(data + 4);
+  const unsigned char *buffer = data + 8;
+  std::vector<uint64_t> words;
+  size_t i = 0;
+  while (i < buffer_size) {
+    uint64_t marker = GetBE64(buffer + i * 8);
+    i++;
+    uint64_t run_length = (marker >> 1) & kMaxRunLength;
+    uint64_t literals = marker >> 33;
+    if (literals > buffer_size - i) {
+      throw std::runtime_error("bitmap: corrupt EWAH bitmap");
+    }
+    words.insert(words.end(), run_length,
+                 (marker & 1) ? ~uint64_t(0) : uint64_t(0));
+    for (uint64_t k = 0; k < literals; k++, i++) {
+      words.push_back(GetBE64(buffer + i * 8));
+    }
+  }
+  return Bitmap(std::move(words));
+}
+
+fs::path BitmapPath(const pack::PackFile &pack) {
+  fs::path path = pack.IdxPath();
+  path.replace_extension(".bitmap");
+  return path;
+}
+
+// ---- 读取 ----
+
+PackBitmap::PackBitmap(const ObjectStore &store, const pack::PackFile &pack)
+    : store_(store), pack_(pack), path_(BitmapPath(pack)), index_(store) {
+  int fd = open(path_.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    throw std::runtime_error("bitmap: cannot open " + path_.string());
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    throw std::runtime_error("bitmap: cannot stat " + path_.string());
+  }
+  size_ = st.st_size;
+  if (size_ < kHeaderSize + 20) {
+    close(fd);
+    throw std::runtime_error("bitmap: file too small " + path_.string());
+  }
+  void *data = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    throw std::runtime_error("bitmap: cannot mmap " + path_.string());
+  }
+  data_ = static_cast<const unsigned char *>(data);
+
+  auto fail = [this](const std::string &what) {
+    munmap(const_cast<unsigned char *>(data_), size_);
+    throw std::runtime_error("bitmap: " + what + " in " + path_.string());
+  };
+  if (memcmp(data_, "BITM", 4) != 0) {
+    fail("bad signature");
+  }
+  uint16_t version = (data_[4] << 8) | data_[5];
+  uint16_t options = (data_[6] << 8) | data_[7];
+  if (version != kVersion) {
+    fail("unsupported version");
+  }
+  if (!(options & kOptionFullDag)) {
+    fail("bitmap is not a full closure");
+  }
+  if (BinaryToHex(data_ + 12) != pack_.Checksum()) {
+    fail("pack checksum mismatch");
+  }
+  size_t count = GetBE32(data_ + 8);
+  size_t end = size_ - 20;
+  size_t offset = kHeaderSize;
+  try {
+    for (auto &type : types_) {
+      size_t consumed;
+      type = EwahDecode(data_ + offset, end - offset, consumed);
+      offset += consumed;
+    }
+  } catch (const std::runtime_error &) {
+    fail("truncated type bitmaps");
+  }
+  entries_.resize(count);
+  for (size_t i = 0; i < count; i++) {
+    if (end - offset < kEntryHeaderSize) {
+      fail("truncated entry");
+    }
+    Entry &entry = entries_[i];
+    entry.idx_pos = GetBE32(data_ + offset);
+    entry.xor_offset = data_[offset + 4];
+    entry.data = offset + kEntryHeaderSize;
+    size_t ewah = EwahSize(data_ + entry.data, end - entry.data);
+    if (ewah == 0) {
+      fail("truncated entry");
+    }
+    if (entry.idx_pos >= pack_.Count() || entry.xor_offset > i) {
+      fail("bad entry");
+    }
+    entry_of_[entry.idx_pos] = i;
+    offset = entry.data + ewah;
+  }
+  if (options & kOptionHashCache) {
+    if (end - offset < pack_.Count() * 4) {
+      fail("truncated hash cache");
+    }
+    hash_cache_ = data_ + offset;
+  }
+  decoded_.resize(count);
+  PackOrder(pack_, pack_order_, positions_);
+}
+
+PackBitmap::~PackBitmap() {
+  munmap(const_cast<unsigned char *>(data_), size_);
+}
+
+std::unique_ptr<PackBitmap> PackBitmap::Open(const ObjectStore &store) {
+  for (const auto &pack : store.Packs()) {
+    if (fs::exists(BitmapPath(*pack))) {
+      return std::make_unique<PackBitmap>(store, *pack);
+    }
+  }
+  return nullptr;
+}
+
+const Bitmap &PackBitmap::Decode(size_t entry) {
+  if (!decoded_[entry]) {
+    size_t consumed;
+    size_t begin = entries_[entry].data;
+    Bitmap bits = EwahDecode(data_ + begin, size_ - 20 - begin, consumed);
+    if (entries_[entry].xor_offset) {
+      bits ^= Decode(entry - entries_[entry].xor_offset);
+    }
+    decoded_[entry] = std::move(bits);
+  }
+  return *decoded_[entry];
+}
+
+const Bitmap *PackBitmap::Stored(const std::string &hash) {
+  auto idx = pack_.FindIndex(hash);
+  if (!idx) {
+    return nullptr;
+  }
+  auto it = entry_of_.find(*idx);
+  return it == entry_of_.end() ? nullptr : &Decode(it->second);
+}
+
+uint32_t PackBitmap::Position(const std::string &hash, ObjectType type,
+                              const std::string &name) {
+  if (auto idx = pack_.FindIndex(hash)) {
+    return positions_[*idx];
+  }
+  auto it = extra_positions_.find(hash);
+  if (it != extra_positions_.end()) {
+    return it->second;
+  }
+  auto header = store_.ReadHeader(hash);
+  if (!header) {
+    throw std::runtime_error("missing object " + hash);
+  }
+  uint32_t pos = pack_.Count() + extra_.size();
+  extra_.push_back({hash, type, header->second, pack::NameHash(name)});
+  extra_positions_.emplace(hash, pos);
+  return pos;
+}
+
+Bitmap PackBitmap::Reachable(const std::vector<std::string> &tips) {
+  TRACE_SPAN("bitmap-reachable");
+  ClosureWalk walk(
+      store_, index_,
+      [this](const std::string &hash, ObjectType type,
+             const std::string &name) { return Position(hash, type, name); },
+      [this](const std::string &hash) { return Stored(hash); });
+  Bitmap result;
+  for (const auto &tip : tips) {
+    walk.Add(tip, result);
+  }
+  TRACE_COUNT("bitmap_extra_objects", extra_.size());
+  return result;
+}
+
+bool PackBitmap::IsWholePack(const Bitmap &bits) const {
+  size_t count = pack_.Count();
+  const auto &words = bits.Words();
+  for (size_t i = count / 64; i < words.size(); i++) {
+    uint64_t beyond = i == count / 64 ? words[i] >> (count % 64) : words[i];
+    if (beyond) {
+      return false;
+    }
+  }
+  return bits.Count() == count;
+}
+
+bool PackBitmap::Contains(const Bitmap &bits, const std::string &hash) const {
+  if (auto idx = pack_.FindIndex(hash)) {
+    return bits.Get(positions_[*idx]);
+  }
+  auto it = extra_positions_.find(hash);
+  return it != extra_positions_.end() && bits.Get(it->second);
+}
+
+std::vector<pack::PackInput> PackBitmap::Objects(const Bitmap &bits) {
+  std::vector<pack::PackInput> objects;
+  objects.reserve(bits.Count());
+  size_t count = pack_.Count();
+  bits.ForEach([&](size_t pos) {
+    if (pos >= count) {
+      objects.push_back(extra_[pos - count]);
+      return;
+    }
+    uint32_t idx = pack_order_[pos];
+    pack::PackInput object;
+    object.hash = pack_.HashAt(idx);
+    int type = 0;
+    while (type < 4 && !types_[type].Get(pos)) {
+      type++;
+    }
+    if (type == 4) {
+      throw std::runtime_error("bitmap: object " + object.hash +
+                               " has no type in " + path_.string());
+    }
+    object.type = static_cast<ObjectType>(type + 1);
+    object.size = pack_.InfoAt(pack_.OffsetAt(idx)).second;
+    object.name_hash = hash_cache_ ? GetBE32(hash_cache_ + idx * 4) : 0;
+    objects.push_back(std::move(object));
+  });
+  return objects;
+}
+
+// ---- 写入 ----
+
+size_t WriteBitmapIndex(const ObjectStore &store, const pack::PackFile &pack,
+                        const std::vector<pack::PackInput> &objects,
+                        const std::vector<std::string> &tips) {
+  TRACE_SPAN("write-bitmap");
+  std::vector<uint32_t> order, positions;
+  PackOrder(pack, order, positions);
+  auto position = [&](const std::string &hash) {
+    auto idx = pack.FindIndex(hash);
+    if (!idx) {
+      throw std::runtime_error("bitmap: object " + hash + " is not in pack " +
+                               pack.Checksum());
+    }
+    return positions[*idx];
+  };
+
+  Bitmap types[4];
+  std::vector<uint32_t> name_hashes(pack.Count());
+  for (const auto &object : objects) {
+    types[static_cast<int>(object.type) - 1].Set(position(object.hash));
+    name_hashes[*pack.FindIndex(object.hash)] = object.name_hash;
+  }
+
+  // 选出要计算位图的提交：全部起点，以及按时间顺序每隔一段的一个提交
+  commit_graph::CommitIndex index(store);
+  revision::RevWalk walk(index);
+  std::unordered_set<uint32_t> tip_ids;
+  for (const auto &tip : tips) {
+    uint32_t id = index.Lookup(tip);
+    if (tip_ids.insert(id).second) {
+      walk.Push(id);
+    }
+  }
+  std::vector<uint32_t> selected;
+  uint32_t id;
+  for (size_t seen = 0; walk.Next(id); seen++) {
+    if (seen % kSelectInterval == 0 || tip_ids.count(id)) {
+      selected.push_back(id);
+    }
+  }
+
+  // 从最旧的提交开始，后面的位图可以直接合并前面的结果
+  std::string entries;
+  std::unordered_map<std::string, size_t> written; // 提交 -> EWAH 在 entries 中的偏移
+  Bitmap scratch;
+  ClosureWalk closure(
+      store, index,
+      [&position](const std::string &hash, ObjectType, const std::string &) {
+        return position(hash);
+      },
+      [&](const std::string &hash) -> const Bitmap * {
+        auto it = written.find(hash);
+        if (it == written.end()) {
+          return nullptr;
+        }
+        size_t consumed;
+        scratch = EwahDecode(
+            reinterpret_cast<const unsigned char *>(entries.data()) +
+                it->second,
+            entries.size() - it->second, consumed);
+        return &scratch;
+      });
+  for (auto it = selected.rbegin(); it != selected.rend(); ++it) {
+    std::string hash = index.Hash(*it);
+    Bitmap bits;
+    closure.Add(hash, bits);
+    PutBE32(entries, *pack.FindIndex(hash));
+    entries.push_back(0); // xor 偏移
+    entries.push_back(0); // 标志
+    written.emplace(hash, entries.size());
+    EwahEncode(bits, entries);
+  }
+  TRACE_COUNT("bitmap_commits", selected.size());
+
+  std::string out = "BITM";
+  PutBE16(out, kVersion);
+  PutBE16(out, kOptionFullDag | kOptionHashCache);
+  PutBE32(out, selected.size());
+  HexToBinary(pack.Checksum(), out);
+  for (const auto &type : types) {
+    EwahEncode(type, out);
+  }
+  out += entries;
+  for (uint32_t name_hash : name_hashes) {
+    PutBE32(out, name_hash);
+  }
+  unsigned char digest[SHA_DIGEST_LENGTH];
+  SHA1(reinterpret_cast<const unsigned char *>(out.data()), out.size(),
+       digest);
+  out.append(reinterpret_cast<char *>(digest), SHA_DIGEST_LENGTH);
+
+  durability::WriteFileAtomically(
+      BitmapPath(pack), out, 0444,
+      durability::ConfiguredFsyncMethod(store.GitDir()));
+  return selected.size();
+}
+
+} // namespace bitmap
@@ -0,0 +1,198 @@
+#pragma once
+
+#include "commit_graph.h"
+#include "object_store.h"
+#include "pack.h"
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * @brief 可达性位图：pack-<hash>.bitmap
+ *
+ * 枚举从一组引用可达的全部对象需要遍历每个提交和每棵 tree，大仓库上要
+ * 几分钟。位图为 pack 中选出的一部分提交各保存一个位图：第 i 位表示 pack
+ * 中按偏移排序的第 i 个对象是否从该提交可达。枚举时从起点向下走，遇到有
+ * 位图的提交直接把位图或进结果，不再遍历它的历史；集合差（want 可达而
+ * have 不可达）就是两个位图按位相减。
+ *
+ * 位图用 EWAH 压缩，文件格式与 Git 的 version 1 相同，git rev-list
+ * --test-bitmap 可以校验：
+ *
+ *   "BITM" <版本 1 (2)> <选项 (2)> <位图数 (4)> <pack 校验和 (20)>
+ *   commit/tree/blob/tag 四个类型位图（EWAH）
+ *   每个提交：<提交在 .idx 中的下标 (4)> <xor 偏移 (1)> <标志 (1)> <EWAH>
+ *   选项含 HASH_CACHE 时：每个对象的路径名哈希 (4)，按 .idx 顺序
+ *   <20字节 SHA-1 校验和>
+ *
+ * xor 偏移不为0时，存的是与前面第 xor 个位图的异或（Git 写出的文件会
+ * 这样压缩，这里只读取、写出时总是0）。
+ *
+ * EWAH 序列化：<位数 (4)> <字数 (4)> <64位字>* <最后一个标记字的下标 (4)>。
+ * 标记字的最低位是连续字的值（全0或全1），第 1-32 位是连续字的个数，
+ * 第 33-63 位是其后原样存放的字的个数。
+ */
+namespace bitmap {
+
+/**
+ * @brief 未压缩的位图，长度随 Set 自动增长
+ */
+class Bitmap {
+public:
+  Bitmap() = default;
+  explicit Bitmap(std::vector<uint64_t> words) : words_(std::move(words)) {}
+
+  void Set(size_t pos) {
+    if (pos / 64 >= words_.size()) {
+      words_.resize(pos / 64 + 1);
+    }
+    words_[pos / 64] |= uint64_t(1) << (pos % 64);
+  }
+  bool Get(size_t pos) const {
+    return pos / 64 < words_.size() &&
+           (words_[pos / 64] >> (pos % 64) & 1) != 0;
+  }
+
+  Bitmap &operator|=(const Bitmap &other);
+  Bitmap &operator^=(const Bitmap &other);
+  // 去掉 other 中也为1的位
+  void AndNot(const Bitmap &other);
+  // 为1的位数
+  size_t Count() const;
+  // 忽略末尾的全0字
+  bool operator==(const Bitmap &other) const;
+
+  // 按从小到大的顺序对每个为1的位调用 fn(pos)
+  template <typename Fn> void ForEach(Fn fn) const {
+    for (size_t i = 0; i < words_.size(); i++) {
+      for (uint64_t word = words_[i]; word; word &= word - 1) {
+        fn(i * 64 + std::countr_zero(word));
+      }
+    }
+  }
+
+  const std::vector<uint64_t> &Words() const { return words_; }
+
+private:
+  std::vector<uint64_t> words_;
+};
+
+// EWAH 压缩后的字节（格式见文件开头），追加到 out
+void EwahEncode(const Bitmap &bitmap, std::string &out);
+
+/**
+ * @brief 解码 data 开头的一个 EWAH 位图
+ * @param consumed 输出读取的字节数
+ * @throws std::runtime_error 数据被截断或格式错误
+ */
+Bitmap EwahDecode(const unsigned char *data, size_t size, size_t &consumed);
+
+// pack 的 .idx 路径换成 .bitmap
+std::filesystem::path BitmapPath(const pack::PackFile &pack);
+
+/**
+ * @brief 读取 .bitmap 并用它枚举可达对象
+ *
+ * 位图只覆盖 pack 中的对象。写出位图之后的新提交（以及它们的 tree 和
+ * blob）不在 pack 中时，从起点向下遍历到有位图的提交为止，遇到的这些
+ * 对象依次分配 pack 对象数之后的位，因此结果总是完整的。
+ *
+ * 每个实例只在一个线程中使用：位图和额外对象都按需解码、缓存在实例中。
+ */
+class PackBitmap {
+public:
+  /**
+   * @throws std::runtime_error 文件无法读取、格式错误或与 pack 不匹配
+   */
+  PackBitmap(const ObjectStore &store, const pack::PackFile &pack);
+  ~PackBitmap();
+  PackBitmap(const PackBitmap &) = delete;
+  PackBitmap &operator=(const PackBitmap &) = delete;
+
+  /**
+   * @brief 打开对象库中第一个带 .bitmap 的 pack 的位图
+   * @return 没有时返回 nullptr
+   * @throws std::runtime_error .bitmap 存在但格式错误
+   */
+  static std::unique_ptr<PackBitmap> Open(const ObjectStore &store);
+
+  const pack::PackFile &Pack() const { return pack_; }
+  // 文件中存有位图的提交数
+  size_t Entries() const { return entries_.size(); }
+
+  /**
+   * @brief 从 tips（提交）可达的全部对象
+   * @throws std::runtime_error 可达对象缺失或损坏
+   */
+  Bitmap Reachable(const std::vector<std::string> &tips);
+
+  // bits 是否恰好是 pack 中的全部对象
+  bool IsWholePack(const Bitmap &bits) const;
+
+  // 对象 hash 是否在 bits 中（bits 由本实例的 Reachable 计算）
+  bool Contains(const Bitmap &bits, const std::string &hash) const;
+
+  /**
+   * @brief 位图中每个对象的哈希、类型、长度和路径名哈希
+   *
+   * 长度从 pack 的对象头（delta 对象只解压 delta 头部）读取，不还原内容。
+   */
+  std::vector<pack::PackInput> Objects(const Bitmap &bits);
+
+private:
+  struct Entry {
+    uint32_t idx_pos = 0;  // 提交在 .idx 中的下标
+    uint8_t xor_offset = 0;
+    size_t data = 0;       // EWAH 在文件中的偏移
+  };
+
+  // 对象的位；不在 pack 中时分配一个额外的位，对象不存在时抛出
+  uint32_t Position(const std::string &hash, ObjectType type,
+                    const std::string &name);
+  // 提交的完整位图，文件中没有时返回 nullptr
+  const Bitmap *Stored(const std::string &hash);
+  const Bitmap &Decode(size_t entry);
+
+  const ObjectStore &store_;
+  const pack::PackFile &pack_;
+  std::filesystem::path path_;
+  const unsigned char *data_ = nullptr;
+  size_t size_ = 0;
+  const unsigned char *hash_cache_ = nullptr; // 没有 HASH_CACHE 时为空
+
+  std::vector<uint32_t> pack_order_; // 位 -> .idx 下标
+  std::vector<uint32_t> positions_;  // .idx 下标 -> 位
+  Bitmap types_[4];                  // commit/tree/blob/tag
+  std::vector<Entry> entries_;
+  std::unordered_map<uint32_t, size_t> entry_of_; // .idx 下标 -> entries_ 下标
+  std::vector<std::optional<Bitmap>> decoded_;
+
+  // 不在 pack 中的对象，第 i 个的位是 pack 对象数 + i
+  std::vector<pack::PackInput> extra_;
+  std::unordered_map<std::string, uint32_t> extra_positions_;
+  commit_graph::CommitIndex index_;
+};
+
+/**
+ * @brief 为包含 tips 全部可达对象的 pack 写出 .bitmap，替换已有文件
+ *
+ * tips 本身以及按时间顺序遍历历史时每隔一段的提交会得到位图。从最旧的
+ * 选中提交开始计算，每个位图遍历到已经计算过位图的祖先为止，再把它们的
+ * 位图或进来，所以总的遍历量与一次完整枚举相近。
+ *
+ * @param objects pack 中的对象（repack 枚举的结果），提供类型和路径名哈希
+ * @param tips 一定要有位图的提交，通常是分支和 HEAD
+ * @return 写出的提交位图数
+ * @throws std::runtime_error 可达对象不在 pack 中或写入失败
+ */
+size_t WriteBitmapIndex(const ObjectStore &store, const pack::PackFile &pack,
+                        const std::vector<pack::PackInput> &objects,
+                        const std::vector<std::string> &tips);
+
+} // namespace bitmap
@@ -0,0 +1,54 @@
+#include "byte_util.h"
+#include <stdexcept>
+
+namespace byte_util {
+namespace {
+
+int HexDigit(char c) {
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  }
+  c |= 0x20; // 大写转小写
+  return c >= 'a' && c <= 'f' ? c - 'a' + 10 : -1;
+}
+
+} // namespace
+
+void BinaryToHex(const unsigned char *digest, char *hex) {
+  static const char digits[] = "0123456789abcdef";
+  for (int i = 0; i < 20; i++) {
+    hex[i * 2] = digits[digest[i] >> 4];
+    hex[i * 2 + 1] = digits[digest[i] & 0x0F];
+  }
+}
+
+std::string BinaryToHex(const unsigned char *digest) {
+  std::string hex(40, '0');
+  BinaryToHex(digest, hex.data());
+  return hex;
+}
+
+bool HexToBinary(std::string_view hex, unsigned char *out) {
+  if (hex.size() != 40) {
+    return false;
+  }
+  for (int i = 0; i < 20; i++) {
+    int high = HexDigit(hex[i * 2]);
+    int low = HexDigit(hex[i * 2 + 1]);
+    if (high < 0 || low < 0) {
+      return false;
+    }
+    out[i] = static_cast<unsigned char>(high << 4 | low);
+  }
+  return true;
+}
+
+void HexToBinary(std::string_view hex, std::string &out) {
+  unsigned char binary[20];
+  if (!HexToBinary(hex, binary)) {
+    throw std::runtime_error("invalid object id '" + std::string(hex) + "'");
+  }
+  out.append(reinterpret_cast<const char *>(binary), sizeof(binary));
+}
+
+} // namespace byte_util
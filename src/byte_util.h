@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+/**
+ * @brief 二进制文件格式共用的字节操作
+ *
+ * pack/idx、位图、commit-graph、index 和 reftable 都以大端存整数、以 20
+ * 字节存 SHA-1。整数读写在头文件中内联，查找 idx 扇出表等热点路径上没有
+ * 函数调用的开销。
+ */
+namespace byte_util {
+
+inline uint32_t GetBE32(const unsigned char *p) {
+  return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) |
+         (uint32_t(p[2]) << 8) | uint32_t(p[3]);
+}
+
+inline uint64_t GetBE64(const unsigned char *p) {
+  return (uint64_t(GetBE32(p)) << 32) | GetBE32(p + 4);
+}
+
+inline void PutBE16(std::string &out, uint16_t value) {
+  out.push_back(static_cast<char>(value >> 8));
+  out.push_back(static_cast<char>(value));
+}
+
+inline void PutBE32(std::string &out, uint32_t value) {
+  out.push_back(static_cast<char>(value >> 24));
+  out.push_back(static_cast<char>(value >> 16));
+  out.push_back(static_cast<char>(value >> 8));
+  out.push_back(static_cast<char>(value));
+}
+
+inline void PutBE64(std::string &out, uint64_t value) {
+  PutBE32(out, value >> 32);
+  PutBE32(out, value & 0xFFFFFFFFu);
+}
+
+// 20 字节的 SHA-1 写成 hex 处的 40 个小写十六进制字符（不加结尾的 '\0'）
+void BinaryToHex(const unsigned char *digest, char *hex);
+
+std::string BinaryToHex(const unsigned char *digest);
+
+/**
+ * @brief 40 字符十六进制哈希（大小写均可）转成 out 处的 20 字节
+ * @return 长度不是 40 或含有非十六进制字符时返回 false
+ */
+bool HexToBinary(std::string_view hex, unsigned char *out);
+
+/**
+ * @brief 同上，20 字节追加到 out 末尾
+ * @throws std::runtime_error 不是合法的十六进制哈希
+ */
+void HexToBinary(std::string_view hex, std::string &out);
+
+} // namespace byte_util
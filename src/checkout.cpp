@@ -0,0 +1,453 @@
+#include "checkout.h"
+#include "../include/clone_gadget.h"
+#include "dircache.h"
+#include "sparse.h"
+#include "trace.h"
+#include "tree.h"
+#include <algorithm>
+#include <cerrno>
+#include <fcntl.h>
+#include <optional>
+#include <stdexcept>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace fs = std::filesystem;
+
+namespace checkout {
+namespace {
+
+constexpr uint32_t kModeExecutable = 0100755;
+constexpr uint32_t kModeSymlink = 0120000;
+
+std::string BlobHash(const std::string &content) {
+  return compute_sha1("blob " + std::to_string(content.size()) + '\0' +
+                      content);
+}
+
+bool ReadFile(const fs::path &path, size_t size, std::string &out) {
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return false;
+  }
+  out.resize(size);
+  size_t done = 0;
+  while (done < size) {
+    ssize_t n = read(fd, out.data() + done, size - done);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      break;
+    }
+    done += n;
+  }
+  close(fd);
+  out.resize(done);
+  return true;
+}
+
+// 工作区中的文件（st 为其 lstat 结果）是否与 (hash, mode) 的内容相同
+bool SameContent(const fs::path &path, const struct stat &st,
+                 const std::string &hash, uint32_t mode) {
+  if (mode == tree::kModeGitlink) {
+    // 子模块的内容不在本仓库中，只要求是目录
+    return S_ISDIR(st.st_mode);
+  }
+  std::string content;
+  if (mode == kModeSymlink) {
+    if (!S_ISLNK(st.st_mode)) {
+      return false;
+    }
+    content.resize(st.st_size);
+    ssize_t n = readlink(path.c_str(), content.data(), content.size());
+    if (n != ssize_t(content.size())) {
+      return false;
+    }
+  } else {
+    bool executable = st.st_mode & S_IXUSR;
+    if (!S_ISREG(st.st_mode) || executable != (mode == kModeExecutable) ||
+        !ReadFile(path, st.st_size, content)) {
+      return false;
+    }
+  }
+  return BlobHash(content) == hash;
+}
+
+// 目录下的文件是否全部是要删除的已跟踪文件（rel 为目录相对工作区的路径）
+bool OnlyRemovedFiles(const fs::path &dir, const std::string &rel,
+                      const std::unordered_set<std::string> &removed) {
+  std::error_code ec;
+  for (fs::recursive_directory_iterator it(dir, ec), end; !ec && it != end;
+       it.increment(ec)) {
+    if (!it->is_directory(ec) || it->is_symlink(ec)) {
+      std::string path =
+          rel + '/' + fs::relative(it->path(), dir).generic_string();
+      if (!removed.count(path)) {
+        return false;
+      }
+    }
+  }
+  return !ec;
+}
+
+void WriteEntry(const ObjectStore &store, const fs::path &path,
+                const std::string &hash, uint32_t mode,
+                const shared_cache::SharedCache *cache) {
+  if (mode == tree::kModeGitlink) {
+    fs::create_directories(path);
+    return;
+  }
+  if (cache && mode != kModeSymlink) {
+    cache->Materialize(store, hash, mode == kModeExecutable, path);
+    return;
+  }
+  auto blob = store.Read(hash);
+  if (!blob) {
+    throw std::runtime_error("missing blob object " + hash);
+  }
+  if (mode == kModeSymlink) {
+    if (symlink(blob->data.c_str(), path.c_str()) != 0) {
+      throw std::runtime_error("cannot create symlink " + path.string() +
+                               ": " + strerror(errno));
+    }
+    return;
+  }
+  int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC,
+                mode == kModeExecutable ? 0777 : 0666);
+  if (fd < 0) {
+    throw std::runtime_error("cannot create " + path.string() + ": " +
+                             strerror(errno));
+  }
+  const std::string &data = blob->data;
+  size_t done = 0;
+  while (done < data.size()) {
+    ssize_t n = write(fd, data.data() + done, data.size() - done);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      close(fd);
+      throw std::runtime_error("write failed: " + path.string());
+    }
+    done += n;
+  }
+  close(fd);
+}
+
+// 删除 path 之后，把变空的上级目录也删掉，直到工作区根目录
+void PruneEmptyParents(const fs::path &worktree, const std::string &rel) {
+  size_t slash = rel.rfind('/');
+  while (slash != std::string::npos && slash > 0) {
+    if (rmdir((worktree / rel.substr(0, slash)).c_str()) != 0) {
+      return;
+    }
+    slash = rel.rfind('/', slash - 1);
+  }
+}
+
+// 稀疏检出时不进入 cone 之外的子树，它们作为一项（稀疏目录）出现
+tree::DiffOptions WalkOptions(const sparse::Cone *cone) {
+  tree::DiffOptions options;
+  options.recursive = true;
+  if (cone) {
+    options.descend = [cone](const std::string &dir) {
+      bool inside = cone->Classify(dir) != sparse::Scope::kOutside;
+      if (!inside) {
+        TRACE_COUNT("checkout_sparse_dirs", 1);
+      }
+      return inside;
+    };
+  }
+  return options;
+}
+
+// 不进入的子树的改动：只更新 index 中的稀疏目录，不碰工作区
+bool IsSparseDir(const tree::Change &change) {
+  return change.old_mode == tree::kModeTree || change.new_mode == tree::kModeTree;
+}
+
+std::string IndexPath(const tree::Change &change) {
+  return IsSparseDir(change) ? change.path + '/' : change.path;
+}
+
+dircache::IndexEntry SparseDirEntry(const tree::Change &change) {
+  dircache::IndexEntry entry;
+  entry.mode = tree::kModeTree;
+  entry.hash = change.new_hash;
+  entry.path = change.path + '/';
+  entry.skip_worktree = true;
+  return entry;
+}
+
+// 部分克隆中要写出、但本地还没有的 blob 一次取回
+void FetchMissingBlobs(const ObjectStore &store,
+                       const std::vector<tree::Change> &changes,
+                       const shared_cache::SharedCache *cache) {
+  std::vector<std::string> missing;
+  for (const auto &change : changes) {
+    if (change.new_mode != 0 && !IsSparseDir(change) &&
+        change.new_mode != tree::kModeGitlink &&
+        !(cache && fs::exists(cache->BlobPath(change.new_hash))) &&
+        !store.Contains(change.new_hash)) {
+      missing.push_back(change.new_hash);
+    }
+  }
+  if (!missing.empty()) {
+    TRACE_COUNT("checkout_fetched", missing.size());
+    fetch_missing_objects(store.GitDir(), missing);
+  }
+}
+
+/**
+ * @brief 按 changes 更新工作区和 index
+ *
+ * changes 按 index 中的路径顺序排列（稀疏目录视为以 '/' 结尾）。index
+ * 还不存在时按 new_tree 生成完整的 index。
+ */
+CheckoutResult Apply(const ObjectStore &store, const fs::path &worktree,
+                     dircache::Index &index,
+                     const std::vector<tree::Change> &changes,
+                     const std::string &new_tree, const sparse::Cone *cone,
+                     const shared_cache::SharedCache *cache) {
+  fs::path index_path = store.GitDir() / "index";
+
+  // 先检查全部路径，有冲突时不动工作区
+  CheckoutResult result;
+  std::unordered_set<std::string> removed;
+  for (const auto &change : changes) {
+    if (change.old_mode != 0 && !IsSparseDir(change)) {
+      removed.insert(change.path);
+    }
+  }
+  // 新路径的上级位置上是未跟踪的文件（或符号链接）时不能建目录；每个
+  // 上级只检查一次
+  std::unordered_set<std::string> checked_parents;
+  auto check_parents = [&](const std::string &rel) {
+    for (size_t slash = rel.find('/'); slash != std::string::npos;
+         slash = rel.find('/', slash + 1)) {
+      std::string parent = rel.substr(0, slash);
+      if (!checked_parents.insert(parent).second) {
+        continue;
+      }
+      struct stat st;
+      if (lstat((worktree / parent).c_str(), &st) != 0) {
+        return; // 不存在，之后新建
+      }
+      if (!S_ISDIR(st.st_mode)) {
+        if (!removed.count(parent)) {
+          result.untracked.push_back(parent);
+        }
+        return;
+      }
+    }
+  };
+  for (const auto &change : changes) {
+    if (IsSparseDir(change)) {
+      continue;
+    }
+    if (change.new_mode != 0) {
+      check_parents(change.path);
+    }
+    fs::path path = worktree / change.path;
+    struct stat st;
+    if (lstat(path.c_str(), &st) != 0) {
+      continue; // 已经不存在（或上级是要删除的文件），没有内容会丢失
+    }
+    if (change.old_mode != 0) {
+      const dircache::IndexEntry *entry = index.Find(change.path);
+      bool clean = entry && entry->hash == change.old_hash &&
+                   entry->mode == change.old_mode && index.StatClean(*entry, st);
+      if (!clean &&
+          !SameContent(path, st, change.old_hash, change.old_mode)) {
+        result.local_changes.push_back(change.path);
+      }
+    } else if (S_ISDIR(st.st_mode) && change.new_mode != tree::kModeGitlink) {
+      // 文件的位置上是目录：其中只有要删除的已跟踪文件时可以替换
+      if (!OnlyRemovedFiles(path, change.path, removed)) {
+        result.untracked.push_back(change.path);
+      }
+    } else if (!SameContent(path, st, change.new_hash, change.new_mode)) {
+      result.untracked.push_back(change.path);
+    }
+  }
+  if (!result.Ok()) {
+    return result;
+  }
+  FetchMissingBlobs(store, changes, cache);
+
+  // 删除旧文件，再写出新文件：文件与目录互换时，旧的一方先让出位置
+  for (const auto &change : changes) {
+    if (change.old_mode == 0 || IsSparseDir(change)) {
+      continue;
+    }
+    fs::path path = worktree / change.path;
+    if (change.old_mode == tree::kModeGitlink) {
+      rmdir(path.c_str()); // 非空的子模块目录保留
+    } else if (unlink(path.c_str()) != 0 && errno != ENOENT &&
+               errno != ENOTDIR) {
+      throw std::runtime_error("cannot remove " + path.string() + ": " +
+                               strerror(errno));
+    }
+    if (change.new_mode == 0) {
+      PruneEmptyParents(worktree, change.path);
+      result.removed++;
+      TRACE_COUNT("checkout_removed", 1);
+    }
+  }
+  std::vector<dircache::IndexEntry> updated;
+  for (const auto &change : changes) {
+    if (change.new_mode == 0) {
+      continue;
+    }
+    if (IsSparseDir(change)) {
+      updated.push_back(SparseDirEntry(change));
+      continue;
+    }
+    fs::path path = worktree / change.path;
+    struct stat st;
+    if (lstat(path.c_str(), &st) == 0) {
+      // 已检查过：与新内容相同的未跟踪文件，或只剩空目录的旧目录
+      if (S_ISDIR(st.st_mode) && change.new_mode != tree::kModeGitlink) {
+        fs::remove_all(path);
+      } else if (!S_ISDIR(st.st_mode)) {
+        unlink(path.c_str());
+      }
+    } else {
+      fs::create_directories(path.parent_path());
+    }
+    WriteEntry(store, path, change.new_hash, change.new_mode, cache);
+    result.written++;
+    TRACE_COUNT("checkout_files", 1);
+
+    dircache::IndexEntry entry;
+    if (lstat(path.c_str(), &st) == 0) {
+      entry.stat = dircache::StatData::From(st);
+    }
+    entry.mode = change.new_mode;
+    entry.hash = change.new_hash;
+    entry.path = change.path;
+    updated.push_back(std::move(entry));
+  }
+
+  // 更新 index：没有改动的条目原样保留（包括 stat 信息）
+  if (changes.empty() && index.Exists()) {
+    return result;
+  }
+  if (index.Exists()) {
+    std::vector<std::string> paths;
+    paths.reserve(changes.size());
+    for (const auto &change : changes) {
+      paths.push_back(IndexPath(change));
+    }
+    index.Update(paths, std::move(updated));
+  } else {
+    std::vector<dircache::IndexEntry> entries;
+    std::unordered_map<std::string, dircache::IndexEntry *> written;
+    for (auto &entry : updated) {
+      written[entry.path] = &entry;
+    }
+    tree::DiffTrees(store, "", new_tree, WalkOptions(cone),
+                    [&](const tree::Change &change) {
+                      auto it = written.find(IndexPath(change));
+                      if (it != written.end()) {
+                        entries.push_back(std::move(*it->second));
+                        return;
+                      }
+                      if (IsSparseDir(change)) {
+                        entries.push_back(SparseDirEntry(change));
+                        return;
+                      }
+                      dircache::IndexEntry entry;
+                      entry.mode = change.new_mode;
+                      entry.hash = change.new_hash;
+                      entry.path = change.path;
+                      entries.push_back(std::move(entry));
+                    });
+    index.SetEntries(std::move(entries));
+  }
+  index.Write(index_path);
+  return result;
+}
+
+CheckoutResult Checkout(const ObjectStore &store, const fs::path &worktree,
+                        dircache::Index &index, const std::string &old_tree,
+                        const std::string &new_tree, const sparse::Cone *cone,
+                        const shared_cache::SharedCache *cache) {
+  std::vector<tree::Change> changes;
+  tree::DiffTrees(store, old_tree, new_tree, WalkOptions(cone),
+                  [&](const tree::Change &change) { changes.push_back(change); });
+  return Apply(store, worktree, index, changes, new_tree, cone, cache);
+}
+
+} // namespace
+
+CheckoutResult CheckoutTree(const ObjectStore &store, const fs::path &worktree,
+                            const std::string &old_tree,
+                            const std::string &new_tree,
+                            const shared_cache::SharedCache *cache) {
+  TRACE_SPAN("checkout");
+  dircache::Index index = dircache::Index::Read(store.GitDir() / "index");
+  std::optional<sparse::Cone> cone = sparse::Cone::Read(store.GitDir());
+  return Checkout(store, worktree, index, old_tree, new_tree,
+                  cone ? &*cone : nullptr, cache);
+}
+
+CheckoutResult ApplySparse(const ObjectStore &store, const fs::path &worktree,
+                           const std::string &tree, const sparse::Cone *cone,
+                           const shared_cache::SharedCache *cache) {
+  TRACE_SPAN("sparse-checkout");
+  dircache::Index index = dircache::Index::Read(store.GitDir() / "index");
+  if (!index.Exists()) {
+    return Checkout(store, worktree, index, "", tree, cone, cache);
+  }
+
+  // tree 现在检出的样子（index 中的稀疏目录不进入）和新 cone 下的样子
+  std::vector<tree::Change> before;
+  tree::DiffOptions current;
+  current.recursive = true;
+  current.descend = [&index](const std::string &dir) {
+    return !index.Find(dir + '/');
+  };
+  tree::DiffTrees(store, "", tree, current,
+                  [&](const tree::Change &change) { before.push_back(change); });
+  std::vector<tree::Change> after;
+  tree::DiffTrees(store, "", tree, WalkOptions(cone),
+                  [&](const tree::Change &change) { after.push_back(change); });
+
+  // 两边按 index 路径合并：只在旧的一边的删除，只在新的一边的写出。
+  // 被 git 展开成逐个文件的稀疏目录（带 skip-worktree 的文件条目）不在
+  // 工作区中，留在 cone 内时也要写出
+  auto skipped = [&index](const tree::Change &change) {
+    const dircache::IndexEntry *entry = index.Find(change.path);
+    return !IsSparseDir(change) && entry && entry->skip_worktree;
+  };
+  std::vector<tree::Change> changes;
+  auto a = before.begin();
+  auto b = after.begin();
+  while (a != before.end() || b != after.end()) {
+    int cmp = a == before.end()  ? 1
+              : b == after.end() ? -1
+                                 : IndexPath(*a).compare(IndexPath(*b));
+    if (cmp < 0) {
+      tree::Change change = std::move(*a++);
+      std::swap(change.old_mode, change.new_mode);
+      std::swap(change.old_hash, change.new_hash);
+      change.status = 'D';
+      changes.push_back(std::move(change));
+    } else if (cmp > 0) {
+      changes.push_back(std::move(*b++));
+    } else {
+      if (skipped(*a++) && !IsSparseDir(*b)) {
+        changes.push_back(*b);
+      }
+      ++b;
+    }
+  }
+  return Apply(store, worktree, index, changes, tree, cone, cache);
+}
+
+} // namespace checkout
@@ -0,0 +1,77 @@
+#pragma once
+
+#include "object_store.h"
+#include "shared_cache.h"
+#include "sparse.h"
+#include <cstddef>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+/**
+ * @brief 按 tree 的差异更新工作区
+ *
+ * 从 old_tree 切换到 new_tree 时，先用 diff-tree 的同步遍历找出改动的路径
+ * （两边哈希相同的子树不会被读取），只删除、新建或重写这些文件，其余文件
+ * 不碰，所以开销与改动的多少成正比，而不是与工作区的大小成正比。
+ *
+ * 写入之前先检查所有要动的路径：
+ * - 已跟踪的文件：index 中的 stat 信息没变就认为未改动，否则比较内容；
+ *   内容与 old_tree 不同的文件不会被覆盖或删除
+ * - 新文件的位置上已有未跟踪的文件：内容与 new_tree 相同时直接接管，
+ *   否则不会被覆盖
+ * 只要有一个路径不能动，整个工作区保持不变。
+ *
+ * 完成后 index（见 dircache.h）中改动的条目换成新文件的 stat 信息，其余
+ * 条目保留；仓库还没有 index 时按 new_tree 生成完整的 index，未写出的
+ * 文件没有 stat 信息，下次比较内容。
+ *
+ * 给出共享缓存（见 shared_cache.h）时，普通文件从缓存的 blobs/ 复制、
+ * reflink 或硬链接，不再逐个解压对象。
+ *
+ * 稀疏检出（见 sparse.h）时只比较和写出 cone 之内的路径，cone 之外的子树
+ * 不读取，只更新 index 中对应的稀疏目录。部分克隆的仓库中要写出的 blob
+ * 本地没有时，写出之前一次从远程取回（见 fetch_missing_objects）。
+ */
+namespace checkout {
+
+struct CheckoutResult {
+  std::vector<std::string> local_changes; // 有本地改动、会被覆盖或删除的文件
+  std::vector<std::string> untracked;     // 会被覆盖的未跟踪文件
+  size_t removed = 0;                     // 删除的文件数
+  size_t written = 0;                     // 新建或重写的文件数
+
+  bool Ok() const { return local_changes.empty() && untracked.empty(); }
+};
+
+/**
+ * @brief 把工作区从 old_tree 更新到 new_tree，并更新 store.GitDir()/index
+ * @param worktree 工作区根目录
+ * @param old_tree 工作区当前对应的 tree，空字符串表示空树（如新克隆）
+ * @param cache 共享缓存，可以为空
+ * @return Ok() 为 false 时没有改动任何文件，冲突的路径在结果中
+ * @throws std::runtime_error 对象缺失或文件写入失败
+ */
+CheckoutResult CheckoutTree(const ObjectStore &store,
+                            const std::filesystem::path &worktree,
+                            const std::string &old_tree,
+                            const std::string &new_tree,
+                            const shared_cache::SharedCache *cache = nullptr);
+
+/**
+ * @brief 把工作区从 index 现在的稀疏范围改为 cone（sparse-checkout set）
+ *
+ * 工作区对应 tree：离开 cone 的文件删除（有本地改动时什么都不做），进入
+ * cone 的文件写出，index 中相应地换成稀疏目录或其中的文件。不读写
+ * info/sparse-checkout，调用方在成功后自行写入。
+ *
+ * @param cone 为空表示完整检出（sparse-checkout disable）
+ * @return 同 CheckoutTree
+ * @throws std::runtime_error 对象缺失或文件写入失败
+ */
+CheckoutResult ApplySparse(const ObjectStore &store,
+                           const std::filesystem::path &worktree,
+                           const std::string &tree, const sparse::Cone *cone,
+                           const shared_cache::SharedCache *cache = nullptr);
+
+} // namespace checkout
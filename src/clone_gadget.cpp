@@ -1,4 +1,30 @@
 #include "../include/clone_gadget.h"
+#include "byte_util.h"
+#include "checkout.h"
+#include "commit_graph.h"
+#include "config.h"
+#include "delta.h"
+#include "dircache.h"
+#include "durability.h"
+#include "fsmonitor.h"
+#include "ignore.h"
+#include "ingest.h"
+#include "object_store.h"
+#include "refs.h"
+#include "shared_cache.h"
+#include "sparse.h"
+#include "trace.h"
+#include "tree.h"
+#include <fcntl.h>
+#include <functional>
+#include <map>
+#include <memory>
+#include <openssl/evp.h>
+#include <optional>
+#include <set>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 // Function implementations
 void compressFile(const std::string data, uLong *bound, unsigned char *dest) {
@@ -16,57 +42,345 @@ std::string sha_file(std::string data) {
   return ss.str();
 }
 
-std::string hash_object(std::string file) {
-  // Read file contents
-  std::ifstream t(file);
-  std::stringstream data;
-  data << t.rdbuf();
-  // Create blob content string
-  std::string content =
-      "blob " + std::to_string(data.str().length()) + '\0' + data.str();
-  // Calculate SHA1 hash
-  std::string buffer = sha_file(content);
-  // Compress blob content
-  uLong bound = compressBound(content.size());
-  unsigned char compressedData[bound];
-  compressFile(content, &bound, compressedData);
-  // Write compressed data to .git/objects
-  std::string dir = ".git/objects/" + buffer.substr(0, 2);
-  std::filesystem::create_directory(dir);
-  std::string objectPath = dir + "/" + buffer.substr(2);
-  std::ofstream objectFile(objectPath, std::ios::binary);
-  objectFile.write((char *)compressedData, bound);
-  objectFile.close();
-  return buffer;
+// 流式 hash-object 每次读入的块大小，也是压缩输出缓冲区的大小
+static const size_t kHashChunk = 64 << 10;
+// 不小于这个大小的文件 mmap 后直接计算，更小的用一次 pread 读入。mmap 的
+// 建立、缺页和 munmap 的开销对小文件比复制还大
+static const size_t kMmapThreshold = 1 << 20;
+
+namespace {
+
+// hash-object 复用的 deflate 流
+class BlobDeflater {
+public:
+  BlobDeflater() {
+    // 与 Git 的 core.looseCompression 默认值相同，用最快的压缩级别：大文件
+    // 的耗时主要在 deflate 上
+    if (deflateInit(&stream_, Z_BEST_SPEED) != Z_OK) {
+      throw std::runtime_error("deflateInit failed while compressing.");
+    }
+  }
+  ~BlobDeflater() { deflateEnd(&stream_); }
+  BlobDeflater(const BlobDeflater &) = delete;
+  BlobDeflater &operator=(const BlobDeflater &) = delete;
+
+  z_stream &Reset() {
+    deflateReset(&stream_);
+    return stream_;
+  }
+
+private:
+  z_stream stream_{};
+};
+
+} // namespace
+
+/**
+ * @brief 把 size 字节的内容作为 blob 计算哈希，write 时同时写入对象库
+ *
+ * 内容由 next 分块给出（让 data 指向下一块并返回其长度，没有更多内容时
+ * 返回 0），每块同时送入 SHA-1 和 deflate，内存占用与内容大小无关。压缩
+ * 结果放得进一个缓冲区时（绝大多数文件）算完哈希直接写出对象；否则写满
+ * 的缓冲区依次追加到临时文件，最后按哈希 rename 成对象。
+ * @throws std::runtime_error 读取失败、内容长度与 size 不符或写入失败
+ */
+static std::string
+hash_blob(size_t size, const std::string &name, bool write_object,
+          const std::function<size_t(const char *&)> &next) {
+  std::optional<durability::ObjectTransaction> transaction;
+  if (write_object) {
+    transaction.emplace(".git");
+  }
+  char header[32];
+  int header_size = snprintf(header, sizeof(header), "blob %zu", size) + 1;
+  TRACE_COUNT("hashed_bytes", header_size + size);
+
+  // 与 deflate 流一样每个线程复用一个 SHA-1 上下文
+  static thread_local std::unique_ptr<EVP_MD_CTX, decltype(&EVP_MD_CTX_free)>
+      sha(EVP_MD_CTX_new(), EVP_MD_CTX_free);
+  if (!sha || EVP_DigestInit_ex(sha.get(), EVP_sha1(), nullptr) != 1) {
+    throw std::runtime_error("cannot initialize SHA-1");
+  }
+  EVP_DigestUpdate(sha.get(), header, header_size);
+  // deflateInit 每次都要申请几百 KB 的内部状态，小文件的耗时主要在这里；
+  // 每个线程复用一个流
+  static thread_local BlobDeflater deflater;
+  z_stream &zs = deflater.Reset();
+  unsigned char out[kHashChunk];
+  zs.next_out = out;
+  zs.avail_out = sizeof(out);
+  int temp_fd = -1;
+  std::string temp;
+
+  // 把输出缓冲区中已有的压缩数据追加到临时文件
+  auto spill = [&] {
+    if (temp_fd < 0) {
+      temp_fd = transaction->CreateTemp(temp);
+      TRACE_COUNT("hash_object_streamed", 1);
+    }
+    size_t used = sizeof(out) - zs.avail_out;
+    for (size_t done = 0; done < used;) {
+      ssize_t n = write(temp_fd, out + done, used - done);
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+      if (n <= 0) {
+        throw std::runtime_error("cannot write " + temp + ": " +
+                                 strerror(errno));
+      }
+      done += n;
+    }
+    zs.next_out = out;
+    zs.avail_out = sizeof(out);
+  };
+  auto compress_chunk = [&](const void *data, size_t length, int flush) {
+    if (!write_object) {
+      return;
+    }
+    zs.next_in = static_cast<Bytef *>(const_cast<void *>(data));
+    zs.avail_in = length;
+    for (;;) {
+      int ret = deflate(&zs, flush);
+      if (ret == Z_STREAM_ERROR) {
+        throw std::runtime_error("Exception during zlib compression: " +
+                                 std::to_string(ret));
+      }
+      // 输出缓冲区没满说明输入已经全部消耗（Z_FINISH 时流已结束）
+      if (zs.avail_out != 0) {
+        return;
+      }
+      spill();
+    }
+  };
+
+  std::string hash;
+  try {
+    compress_chunk(header, header_size, Z_NO_FLUSH);
+    size_t remaining = size;
+    const char *data;
+    for (size_t n; (n = next(data)) > 0;) {
+      if (n > remaining) {
+        remaining = SIZE_MAX;
+        break;
+      }
+      remaining -= n;
+      EVP_DigestUpdate(sha.get(), data, n);
+      compress_chunk(data, n, Z_NO_FLUSH);
+    }
+    if (remaining != 0) {
+      throw std::runtime_error(name + " changed while hashing");
+    }
+    compress_chunk(nullptr, 0, Z_FINISH);
+
+    unsigned char digest[SHA_DIGEST_LENGTH];
+    EVP_DigestFinal_ex(sha.get(), digest, nullptr);
+    hash = byte_util::BinaryToHex(digest);
+    if (!write_object) {
+      return hash;
+    }
+    if (temp_fd < 0) {
+      transaction->Write(hash, out, sizeof(out) - zs.avail_out);
+    } else {
+      spill();
+      int done_fd = temp_fd;
+      temp_fd = -1;
+      transaction->AddTemp(done_fd, temp, hash);
+    }
+  } catch (...) {
+    if (temp_fd >= 0) {
+      durability::ObjectTransaction::DiscardTemp(temp_fd, temp);
+    }
+    throw;
+  }
+  transaction->Commit();
+  return hash;
 }
 
-std::string write_tree(const std::string dir_path) {
-  namespace fs = std::filesystem;
-  std::vector<std::pair<std::string, std::string>> entries;
-  std::string mode;
-  std::string sha1;
-  for (const auto &entry : fs::directory_iterator(dir_path)) {
-    std::string name = entry.path().filename().string();
-    if (name == ".git")
-      continue;
-    if (entry.is_directory()) {
-      mode = "40000";
-      sha1 = write_tree(entry.path().string());
-    } else if (entry.is_regular_file()) {
-      mode = "100644";
-      sha1 = hash_object(entry.path().string());
+// 把内存中的 size 字节分块交给 hash_blob：每块先后送入 SHA-1 和 deflate，
+// 两次读取都在缓存中。expected 是文件大小，与 size 不同时报告文件被修改
+static std::string hash_blob_memory(const char *base, size_t size,
+                                    size_t expected, const std::string &name,
+                                    bool write_object) {
+  size_t offset = 0;
+  return hash_blob(expected, name, write_object, [&](const char *&data) {
+    size_t n = std::min(kHashChunk, size - offset);
+    data = base + offset;
+    offset += n;
+    return n;
+  });
+}
+
+std::string hash_object(std::string file, bool write_object) {
+  int fd = open(file.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    throw std::runtime_error("cannot open " + file + ": " + strerror(errno));
+  }
+  struct stat st;
+  std::string hash;
+  try {
+    if (fstat(fd, &st) != 0) {
+      throw std::runtime_error("cannot stat " + file + ": " + strerror(errno));
+    }
+    size_t size = st.st_size;
+    if (size >= kMmapThreshold) {
+      // 直接在页缓存上计算，不再复制到用户态缓冲区。与 Git 相同，计算期间
+      // 文件被截短时访问映射会收到 SIGBUS
+      void *mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (mapped == MAP_FAILED) {
+        throw std::runtime_error("cannot mmap " + file + ": " +
+                                 strerror(errno));
+      }
+      madvise(mapped, size, MADV_SEQUENTIAL);
+      madvise(mapped, size, MADV_HUGEPAGE);
+      TRACE_COUNT("hash_object_mmap", 1);
+      try {
+        hash = hash_blob_memory(static_cast<const char *>(mapped), size, size,
+                                file, write_object);
+      } catch (...) {
+        munmap(mapped, size);
+        throw;
+      }
+      munmap(mapped, size);
+    } else {
+      // 小文件一次 pread 读入线程复用的缓冲区；多读一个字节，读到了说明
+      // 文件在 fstat 之后变长了
+      static thread_local std::vector<char> buffer;
+      if (buffer.size() < size + 1) {
+        buffer.resize(size + 1);
+      }
+      size_t got = 0;
+      while (got <= size) {
+        ssize_t n = pread(fd, buffer.data() + got, size + 1 - got, got);
+        if (n < 0 && errno == EINTR) {
+          continue;
+        }
+        if (n < 0) {
+          throw std::runtime_error("cannot read " + file + ": " +
+                                   strerror(errno));
+        }
+        if (n == 0) {
+          break;
+        }
+        got += n;
+      }
+      hash = hash_blob_memory(buffer.data(), got, size, file, write_object);
+    }
+  } catch (...) {
+    close(fd);
+    throw;
+  }
+  close(fd);
+  return hash;
+}
+
+std::string hash_blob_buffer(const std::string &content, bool write_object) {
+  return hash_blob_memory(content.data(), content.size(), content.size(),
+                          "<stdin>", write_object);
+}
+
+// 上次 write-tree 的结果：查询守护进程用的令牌和根 tree（见 fsmonitor.h），
+// 之后是 "exclude <SHA-1>"（info/exclude）、"sparse <SHA-1>"（index 中的
+// 稀疏目录）和每个 .gitignore 的 "<SHA-1> <目录>"。排除规则变了的目录之下
+// 不能沿用上次的 tree，稀疏目录变了时整个不能沿用
+static const char kWriteTreeCache[] = ".git/fsmonitor--write-tree";
+
+// 没有条目的 tree。与 Git 相同，空目录（包括其中的文件都被排除的目录）
+// 不写进父 tree
+static const char kEmptyTree[] = "4b825dc642cb6eb9a060e54bf8d69288fbee4904";
+
+namespace {
+
+/**
+ * @brief write-tree 中已跟踪的路径：与 Git 相同，已跟踪的路径不受排除规则
+ *        影响
+ *
+ * 取 index 中的条目，没有 index 时取 HEAD 的 tree。第一次遇到被排除的
+ * 路径时才读取，没有排除规则的仓库不付出代价。
+ */
+class TrackedPaths {
+public:
+  bool Contains(const std::string &path) {
+    Load();
+    return paths_.count(path) != 0;
+  }
+
+  // dir 之下是否有已跟踪的路径（包括稀疏目录）
+  bool HasUnder(const std::string &dir) {
+    Load();
+    auto it = paths_.lower_bound(dir + '/');
+    return it != paths_.end() && it->starts_with(dir + '/');
+  }
+
+private:
+  void Load() {
+    if (loaded_) {
+      return;
     }
-    if (!sha1.empty()) {
-      std::string binary_sha;
-      for (size_t i = 0; i < sha1.length(); i += 2) {
-        std::string byte_string = sha1.substr(i, 2);
-        char byte = static_cast<char>(std::stoi(byte_string, nullptr, 16));
-        binary_sha.push_back(byte);
+    loaded_ = true;
+    dircache::Index index = dircache::Index::Read(".git/index", false);
+    if (index.Exists()) {
+      for (const auto &entry : index.Entries()) {
+        paths_.insert(entry.path); // 稀疏目录以 '/' 结尾
       }
-      std::string entry_data = mode + " " + name + '\0' + binary_sha;
-      entries.push_back({name, entry_data});
+      return;
+    }
+    std::string head = MiniGitRef().GetCurrentCommit();
+    if (head.size() != 40) {
+      return; // 还没有提交
     }
+    ObjectStore store(".git");
+    auto commit = store.Read(head);
+    if (!commit || commit->type != ObjectType::kCommit) {
+      return;
+    }
+    commit_graph::CommitHeader header;
+    commit_graph::ParseCommitHeader(head, commit->data, header);
+    tree::DiffOptions options;
+    options.recursive = true;
+    tree::DiffTrees(store, "", std::string(header.tree), options,
+                    [this](const tree::Change &change) {
+                      paths_.insert(change.path);
+                    });
+  }
+
+  bool loaded_ = false;
+  std::set<std::string> paths_;
+};
+
+// write-tree 遍历的上下文；changes 为空时完整遍历
+struct TreeWalk {
+  durability::ObjectTransaction &transaction;
+  ignore::Matcher &matcher;
+  // 已跟踪的路径，为空时不检查（只遍历子目录时路径与 index 对不上）
+  TrackedPaths *tracked = nullptr;
+  // 在被排除的目录之下：只保留已跟踪的路径
+  bool ignored = false;
+  const ObjectStore *store = nullptr;
+  const fsmonitor::Changes *changes = nullptr;
+  // 目录 -> 其中 .gitignore 的 SHA-1：上次的记录和这次的结果
+  const std::map<std::string, std::string> *old_rules = nullptr;
+  std::map<std::string, std::string> *rules = nullptr;
+  // 稀疏检出时 index 中不在工作区的条目：稀疏目录（不含末尾的 '/'）或
+  // 带 skip-worktree 的文件 -> "<mode> <SHA-1>"
+  const std::map<std::string, std::string> *sparse = nullptr;
+};
+
+} // namespace
+
+// tree 中的一个条目："<mode> <名字>\0<20字节哈希>"
+static std::string tree_entry(const std::string &mode, const std::string &name,
+                              const std::string &sha1) {
+  std::string entry = mode + " " + name + '\0';
+  for (size_t i = 0; i < sha1.length(); i += 2) {
+    entry.push_back(static_cast<char>(std::stoi(sha1.substr(i, 2), nullptr, 16)));
   }
+  return entry;
+}
+
+// 排序条目，写出 tree 对象并返回其哈希
+static std::string
+write_tree_object(durability::ObjectTransaction &transaction,
+                  std::vector<std::pair<std::string, std::string>> &entries) {
   sort(entries.begin(), entries.end());
   std::string tree_content;
   for (auto &it : entries) {
@@ -83,9 +397,6 @@ std::string write_tree(const std::string dir_path) {
        << static_cast<int>(hash[i]);
     tree_sha += ss.str();
   }
-  std::string tree_dir = ".git/objects/" + tree_sha.substr(0, 2);
-  std::filesystem::create_directory(tree_dir);
-  std::string tree_filepath = tree_dir + "/" + tree_sha.substr(2);
   z_stream zs;
   memset(&zs, 0, sizeof(zs));
   if (deflateInit(&zs, Z_BEST_COMPRESSION) != Z_OK) {
@@ -110,9 +421,260 @@ std::string write_tree(const std::string dir_path) {
     throw(std::runtime_error("Exception during zlib compression: " +
                              std::to_string(ret)));
   }
-  std::ofstream outfile(tree_filepath, std::ios::binary);
-  outfile.write(outstring.c_str(), outstring.size());
-  outfile.close();
+  transaction.Write(tree_sha, outstring.data(), outstring.size());
+  return tree_sha;
+}
+
+
+/**
+ * @brief 写出 dir_path 的 tree
+ * @param rel 相对于工作区根目录的路径，根目录为空字符串
+ * @param cached 上次 write-tree 时这个目录的 tree，没有时为空
+ *
+ * 有守护进程的查询结果时，其下没有任何改动的目录直接沿用 cached；目录
+ * 本身没变、只是子目录有改动时，文件条目从 cached 中取，只重新计算子目录，
+ * 不列目录也不读文件。
+ */
+static std::string write_tree_dir(const TreeWalk &parent_walk,
+                                  const std::string &dir_path,
+                                  const std::string &rel,
+                                  const std::string &cached) {
+  namespace fs = std::filesystem;
+  auto child = [&](const std::string &name) {
+    return rel.empty() ? name : rel + "/" + name;
+  };
+  if (parent_walk.changes && !cached.empty() &&
+      !parent_walk.changes->TouchedUnder(rel) &&
+      parent_walk.store->Contains(cached)) {
+    TRACE_COUNT("write_tree_reused", 1);
+    return cached;
+  }
+
+  // 这一层的 .gitignore 与上次不同时，其下整个子树完整遍历
+  const std::string &digest = parent_walk.matcher.Push(rel);
+  struct PopRules {
+    ignore::Matcher &matcher;
+    ~PopRules() { matcher.Pop(); }
+  } pop_rules{parent_walk.matcher};
+  auto old_digest = parent_walk.old_rules->find(rel);
+  bool rules_changed =
+      digest != (old_digest == parent_walk.old_rules->end() ? ""
+                                                            : old_digest->second);
+  if (digest.empty()) {
+    parent_walk.rules->erase(rel);
+  } else {
+    (*parent_walk.rules)[rel] = digest;
+  }
+  TreeWalk walk = parent_walk;
+  if (rules_changed) {
+    walk.changes = nullptr;
+  }
+
+  std::vector<std::pair<std::string, std::string>> entries;
+  std::optional<GitObject> cached_tree;
+  if (walk.changes && !cached.empty()) {
+    cached_tree = walk.store->Read(cached);
+    if (cached_tree && cached_tree->type != ObjectType::kTree) {
+      cached_tree.reset();
+    }
+  }
+  // 不在工作区中的条目取 index 中的 tree 或 blob；只含这些条目的目录在
+  // 工作区中也不存在，同样要写出
+  std::map<std::string, std::string> sparse_children;
+  if (walk.sparse) {
+    std::string prefix = rel.empty() ? "" : rel + "/";
+    for (auto it = walk.sparse->lower_bound(prefix);
+         it != walk.sparse->end() && it->first.starts_with(prefix); ++it) {
+      std::string name = it->first.substr(prefix.size());
+      name = name.substr(0, name.find('/'));
+      sparse_children.emplace(name, name.size() == it->first.size() - prefix.size()
+                                        ? it->second
+                                        : "");
+    }
+  }
+
+  tree::TreeEntry entry;
+  if (cached_tree && !walk.changes->Touched(rel)) {
+    tree::TreeParser parser(cached_tree->data, cached);
+    while (parser.Next(entry)) {
+      std::string name(entry.name);
+      std::string sha1 = entry.Hash();
+      auto sparse = sparse_children.find(name);
+      if (sparse != sparse_children.end() && !sparse->second.empty()) {
+        sha1 = sparse->second.substr(sparse->second.find(' ') + 1);
+      } else if (entry.IsTree()) {
+        sha1 = write_tree_dir(walk, dir_path + "/" + name, child(name), sha1);
+        if (sha1 == kEmptyTree) {
+          continue;
+        }
+      }
+      char mode[8];
+      snprintf(mode, sizeof(mode), "%o", entry.mode);
+      entries.push_back({name, tree_entry(mode, name, sha1)});
+    }
+    return write_tree_object(walk.transaction, entries);
+  }
+
+  // 改动过的目录重新列出；子目录仍可能沿用上次的 tree
+  std::unordered_map<std::string, std::string> cached_dirs;
+  if (cached_tree) {
+    tree::TreeParser parser(cached_tree->data, cached);
+    while (parser.Next(entry)) {
+      if (entry.IsTree()) {
+        cached_dirs.emplace(entry.name, entry.Hash());
+      }
+    }
+  }
+  std::string mode;
+  std::string sha1;
+  std::error_code error;
+  fs::directory_iterator listing(dir_path, error);
+  if (error && sparse_children.empty()) {
+    throw fs::filesystem_error("cannot list directory", dir_path, error);
+  }
+  for (const auto &dir_entry : listing) {
+    std::string name = dir_entry.path().filename().string();
+    if (name == ".git")
+      continue;
+    sha1.clear();
+    bool is_dir = dir_entry.is_directory();
+    auto sparse = sparse_children.find(name);
+    if (sparse != sparse_children.end() && !sparse->second.empty()) {
+      continue; // 以 index 为准，下面取 index 中的条目
+    }
+    bool ignored = false;
+    if (sparse != sparse_children.end() && is_dir) {
+      sparse_children.erase(sparse);
+    } else if (walk.ignored || walk.matcher.Ignored(child(name), is_dir)) {
+      // 被排除的路径只在已跟踪（或其下有已跟踪的文件）时保留；其余被排除
+      // 的目录不再进入
+      if (!walk.tracked || !(is_dir ? walk.tracked->HasUnder(child(name))
+                                    : walk.tracked->Contains(child(name)))) {
+        TRACE_COUNT("write_tree_ignored", 1);
+        continue;
+      }
+      ignored = true;
+    }
+    if (is_dir) {
+      mode = "40000";
+      auto it = cached_dirs.find(name);
+      TreeWalk sub = walk;
+      sub.ignored = walk.ignored || ignored;
+      sha1 = write_tree_dir(sub, dir_entry.path().string(), child(name),
+                            it == cached_dirs.end() ? "" : it->second);
+    } else if (dir_entry.is_regular_file()) {
+      mode = "100644";
+      sha1 = hash_object(dir_entry.path().string());
+    }
+    if (!sha1.empty() && sha1 != kEmptyTree) {
+      entries.push_back({name, tree_entry(mode, name, sha1)});
+    }
+  }
+  for (const auto &[name, indexed] : sparse_children) {
+    mode = "40000";
+    if (indexed.empty()) {
+      auto it = cached_dirs.find(name);
+      sha1 = write_tree_dir(walk, dir_path + "/" + name, child(name),
+                            it == cached_dirs.end() ? "" : it->second);
+    } else {
+      mode = indexed.substr(0, indexed.find(' '));
+      sha1 = indexed.substr(mode.size() + 1);
+    }
+    if (sha1 != kEmptyTree) {
+      entries.push_back({name, tree_entry(mode, name, sha1)});
+    }
+  }
+  return write_tree_object(walk.transaction, entries);
+}
+
+std::string write_tree(const std::string dir_path) {
+  // 整棵树的对象在一个事务中写出
+  durability::ObjectTransaction transaction(".git");
+  ignore::Matcher matcher(dir_path);
+  std::map<std::string, std::string> old_rules;
+  std::map<std::string, std::string> rules;
+  TreeWalk walk{transaction, matcher};
+  TrackedPaths tracked;
+  if (dir_path == ".") {
+    walk.tracked = &tracked;
+  }
+  walk.old_rules = &old_rules;
+  walk.rules = &rules;
+  std::optional<ObjectStore> store;
+  std::optional<fsmonitor::Changes> changes;
+  std::string cached;
+  // 稀疏检出时不在工作区中的目录和文件从 index 中取
+  std::map<std::string, std::string> sparse;
+  std::string sparse_digest;
+  if (dir_path == "." && std::filesystem::exists(".git/info/sparse-checkout")) {
+    std::string listed;
+    for (const auto &entry :
+         dircache::Index::Read(".git/index", false).Entries()) {
+      if (entry.skip_worktree && entry.stage == 0) {
+        char mode[8];
+        snprintf(mode, sizeof(mode), "%o", entry.mode);
+        std::string indexed = std::string(mode) + ' ' + std::string(entry.hash);
+        std::string path = entry.IsSparseDir()
+                               ? entry.path.substr(0, entry.path.size() - 1)
+                               : entry.path;
+        listed += indexed + ' ' + path + '\n';
+        sparse.emplace_hint(sparse.end(), std::move(path), std::move(indexed));
+      }
+    }
+    if (!sparse.empty()) {
+      walk.sparse = &sparse;
+      sparse_digest = compute_sha1(listed);
+    }
+  }
+  if (dir_path == ".") {
+    std::string token;
+    std::string exclude;
+    std::string sparse_line;
+    std::ifstream cache(kWriteTreeCache);
+    if (!std::getline(cache, token) || !std::getline(cache, cached) ||
+        !std::getline(cache, exclude) || exclude.rfind("exclude ", 0) != 0 ||
+        exclude.substr(8) != matcher.ExcludeDigest() ||
+        !std::getline(cache, sparse_line) ||
+        sparse_line != "sparse " + sparse_digest) {
+      cached.clear();
+    }
+    for (std::string line; std::getline(cache, line);) {
+      if (line.size() >= 41 && line[40] == ' ') {
+        old_rules[line.substr(41)] = line.substr(0, 40);
+      }
+    }
+    changes = fsmonitor::Query(".git", token);
+    if (changes) {
+      store.emplace(".git");
+      walk.store = &*store;
+      walk.changes = &*changes;
+    }
+    if (!changes || changes->everything) {
+      cached.clear();
+    }
+    if (cached.empty()) {
+      old_rules.clear();
+    }
+    // 不会再进入的目录保留上次的记录
+    rules = old_rules;
+  }
+  std::string tree_sha = write_tree_dir(walk, dir_path, "", cached);
+  transaction.Commit();
+  if (changes) {
+    // 先写临时文件再改名，失败时下次完整遍历
+    std::string temp = std::string(kWriteTreeCache) + ".lock";
+    {
+      std::ofstream out(temp);
+      out << changes->token << '\n' << tree_sha << '\n'
+          << "exclude " << matcher.ExcludeDigest() << '\n'
+          << "sparse " << sparse_digest << '\n';
+      for (const auto &[dir, digest] : rules) {
+        out << digest << ' ' << dir << '\n';
+      }
+    }
+    std::error_code ec;
+    std::filesystem::rename(temp, kWriteTreeCache, ec);
+  }
   return tree_sha;
 }
 
@@ -175,21 +737,14 @@ auto commit_tree(std::string treeSha, std::string parSha, std::string comMsg)
   // 输出提交哈希到标准输出（供调用者使用）
   std::cout << commit_sha;
 
-  // 获取对象存储路径（前2字符作为目录，剩余38字符作为文件名）
-  auto [folderpath, filepath] = object_path_from_sha(commit_sha);
-
-  // 创建对象存储目录（如果不存在）
-  std::filesystem::create_directories(folderpath);
-
   // 压缩提交对象内容
   uLong bound = compressBound(commit.size());
   unsigned char compressedData[bound];
   compressFile(commit, &bound, compressedData);
 
-  // 将压缩后的对象写入到对象数据库
-  std::ofstream output_file(filepath, std::ios::binary);
-  output_file.write((char *)compressedData, bound);
-  output_file.close();
+  // 将压缩后的对象写入到对象数据库（按 core.fsyncMethod 落盘后才返回，
+  // 调用方随后更新分支）
+  durability::WriteLooseObject(".git", commit_sha, compressedData, bound);
   return commit_sha;
 }
 
@@ -333,43 +888,14 @@ int compress(FILE *input, FILE *output) {
  * @param hash Git对象的SHA-1哈希值（40字符十六进制字符串）
  * @param content 待压缩和存储的对象内容
  * @param dir 目标目录路径（可选参数，默认为当前目录）
+ * @throws std::runtime_error 写入失败
  */
 void compress_and_store(const std::string &hash, const std::string &content,
                         std::string dir) {
-  // 将内容字符串转换为内存文件流，用于压缩处理
-  FILE *input = fmemopen((void *)content.c_str(), content.length(), "rb");
-
-  // 从哈希值中提取前2个字符作为文件夹名（Git对象存储的目录结构）
-  std::string hash_folder = hash.substr(0, 2);
-
-  // 构建完整的对象存储路径：dir/.git/objects/hash_folder/
-  std::string object_path = dir + "/.git/objects/" + hash_folder + '/';
-
-  // 检查对象目录是否存在，如果不存在则创建
-  if (!std::filesystem::exists(object_path)) {
-    std::filesystem::create_directories(object_path);
-  }
-
-  // 构建完整的对象文件路径：dir/.git/objects/hash_folder/hash_remaining
-  std::string object_file_path = object_path + hash.substr(2);
-
-  // 检查对象文件是否已存在，避免重复存储
-  if (!std::filesystem::exists(object_file_path)) {
-    // 以二进制写入模式打开对象文件
-    FILE *output = fopen(object_file_path.c_str(), "wb");
-
-    // 调用压缩函数将输入内容压缩到输出文件
-    if (compress(input, output) != EXIT_SUCCESS) {
-      std::cerr << "Failed to compress data.\n";
-      return;
-    }
-
-    // 关闭输出文件流
-    fclose(output);
-  }
-
-  // 关闭输入文件流
-  fclose(input);
+  // 已存在的对象不会重写；按 core.fsyncMethod 落盘
+  std::string compressed = compress_string(content);
+  durability::WriteLooseObject(dir + "/.git", hash, compressed.data(),
+                               compressed.size());
 }
 
 /**
@@ -381,24 +907,17 @@ void compress_and_store(const std::string &hash, const std::string &content,
  * https://pastebin.com/9rbJ8MYE
  */
 int read_length(const std::string &pack, int *pos) {
-  int length = 0;
-  // 提取当前字节的低4位作为长度的初始值
-  length |= pack[*pos] & 0x0F;
-
-  // 检查最高位是否为1，如果是则需要继续读取后续字节
-  if (pack[*pos] & 0x80) {
-    (*pos)++; // 移动到下一个字节
-
-    // 循环读取直到遇到最高位为0的字节
-    while (pack[*pos] & 0x80) {
-      length <<= 7;                // 左移7位为新的数据腾出空间
-      length |= pack[*pos] & 0x7F; // 提取7位有效数据并合并
-      (*pos)++;                    // 继续移动到下一个字节
-    }
-
-    // 处理最后一个字节（最高位为0）
-    length <<= 7;         // 最后一次左移
-    length |= pack[*pos]; // 提取完整的8位数据
+  // 首字节的低4位是长度的最低4位，之后每个字节提供更高的7位（小端序）
+  unsigned char byte = pack[*pos];
+  int length = byte & 0x0F;
+  int shift = 4;
+
+  // 最高位为1表示还有后续字节
+  while (byte & 0x80) {
+    (*pos)++;
+    byte = pack[*pos];
+    length |= (byte & 0x7F) << shift;
+    shift += 7;
   }
 
   (*pos)++; // 移动到下一个要解析的位置
@@ -443,98 +962,19 @@ COPY 0-11 + ADD "very " + COPY 11-14
  * @param delta_contents delta压缩指令数据
  * @param base_contents 基础对象的完整内容
  * @return 重建后的完整对象内容字符串
+ * @throws std::runtime_error delta非法、COPY越界或与基础对象长度不匹配
  * @note 实现Git pack协议中的delta解压缩算法，支持复制和添加两种指令
  */
 std::string apply_delta(const std::string &delta_contents,
                         const std::string &base_contents) {
-  std::string reconstructed_object;
-  int current_position_in_delta = 0;
-
-  // 跳过delta头部两个长度字段（基础对象长度和目标对象长度）
-  read_length(delta_contents, &current_position_in_delta);
-  read_length(delta_contents, &current_position_in_delta);
-
-  // 逐指令处理delta数据
-  while (current_position_in_delta < delta_contents.length()) {
-    // 读取指令字节并后移位置
-    unsigned char current_instruction =
-        delta_contents[current_position_in_delta++];
-
-    if (current_instruction & 0x80) {     // 最高位为1：COPY指令
-      int copy_offset = 0;                // 从基础对象的复制起始位置
-      int copy_size = 0;                  // 复制的数据长度
-      int bytes_processed_for_offset = 0; // 已处理的偏移量字节数
-
-      /*
-      // 下面解析偏移量的逻辑类似于:
-      copy_offset <<= 8;
-      int index_in_offset = 4; // 因为offset在COPY指令数据流中的
-      // 起点是第2个字节(即delta_contents[1])
-      // 终点是第5个字节(即delta_contents[4])，共4个字节
-      // Git delta包使用小端序存储字节(x86/64的内存架构是这样)
-      // 所以我们得先读高位再读低位才能拼出正确的 copy_offset
-      for (auto bit 依次为 b3 b2 b1 b0) {
-        if (bit == 1) { // 也就是说该bit被设置了
-          copy_offset += delta_contents[index_in_offset--];
-        }
-      }
-      */
-      // 解析偏移量(共4个字节)（可选，由指令字节的位3-0控制，注意，b3到b0是4个bit）
-      for (int i = 3; i >= 0; i--) {
-        copy_offset <<= 8;                    // 左移为新的字节腾出空间
-        if (current_instruction & (1 << i)) { // 检查对应位是否设置
-          copy_offset += static_cast<unsigned char>(
-              delta_contents[current_position_in_delta + i]);
-          bytes_processed_for_offset++;
-        }
-      }
-      /*
-      // 下面解析长度的逻辑类似于:
-      copy_size <<= 8;
-      int index_in_size = 7; // 因为"长度字节"在COPY指令数据流中的
-      // 起点是第6个字节(即delta_contents[5])
-      // 终点是第8个字节(即delta_contents[7])，共3个字节
-      // Git delta包使用小端序存储字节(x86/64的内存架构是这样)
-      // 所以我们得先读高位再读低位才能拼出正确的 copy_size
-      for (auto bit 依次为 b6 b5 b4) {
-        if (bit == 1) { // 也就是说该bit被设置了
-          copy_size += delta_contents[index_in_size--];
-        }
-      }
-      */
-      // 解析长度(共3个字节)（可选，由指令字节的位6-4控制）
-      int bytes_processed_for_size = 0;
-      for (int i = 6; i >= 4; i--) {
-        copy_size <<= 8;                      // 左移为新的字节腾出空间
-        if (current_instruction & (1 << i)) { // 检查对应位是否设置
-          // 注意：长度参数紧跟在偏移量参数之后
-          copy_size += static_cast<unsigned char>(
-              delta_contents[current_position_in_delta + i -
-                             (4 - bytes_processed_for_offset)]);
-          bytes_processed_for_size++;
-        }
-      }
-
-      // 特殊处理：如果复制长度为0，则默认为1MB
-      if (copy_size == 0) {
-        copy_size = 0x100000;
-      }
-
-      // 从基础对象复制指定范围的数据到重建对象
-      reconstructed_object += base_contents.substr(copy_offset, copy_size);
-
-      // 前移位置跳过已处理的参数数据
-      current_position_in_delta +=
-          bytes_processed_for_size + bytes_processed_for_offset;
-
-    } else { // 最高位为0：ADD指令
-      // 直接从delta数据中添加新内容
-      int add_size = current_instruction & 0x7F; // 提取低7位作为添加长度
-      reconstructed_object +=
-          delta_contents.substr(current_position_in_delta, add_size);
-      current_position_in_delta += add_size; // 前移位置
-    }
+  // 空的delta没有任何指令，重建结果为空对象
+  if (delta_contents.empty()) {
+    return {};
   }
+  // 先从delta头部读出目标长度，一次性分配好输出空间，
+  // 指令的解析与边界检查见 delta.cpp 中的 apply_delta_into()
+  std::string reconstructed_object;
+  apply_delta_to(delta_contents, base_contents, reconstructed_object);
   return reconstructed_object;
 }
 
@@ -688,11 +1128,7 @@ size_t write_callback(void *received_data, size_t element_size,
   std::string received_text((char *)received_data, total_size);
   std::string *master_hash = (std::string *)userdata;
 
-  // 调试输出
-  std::cerr << "Debug: received_text length: " << received_text.length()
-            << std::endl;
-  std::cerr << "Debug: received_text: " << received_text.substr(0, 200)
-            << std::endl;
+  TRACE_COUNT("negotiation_bytes", total_size);
 
   // Git 协议响应格式：每行以4字符的长度开头
   // 我们需要解析这种格式来找到哈希值
@@ -724,8 +1160,7 @@ size_t write_callback(void *received_data, size_t element_size,
       size_t space_pos = line.find(' ');
       if (space_pos != std::string::npos && space_pos >= 40) {
         *master_hash = line.substr(0, 40);
-        std::cerr << "Debug: found master hash from HEAD: " << *master_hash
-                  << std::endl;
+        TRACE_INSTANT("found master hash from HEAD", *master_hash);
         break;
       }
     }
@@ -734,7 +1169,7 @@ size_t write_callback(void *received_data, size_t element_size,
     size_t hash_pos = line.find("refs/heads/master");
     if (hash_pos != std::string::npos && hash_pos >= 41) {
       *master_hash = line.substr(hash_pos - 41, 40);
-      std::cerr << "Debug: found master hash: " << *master_hash << std::endl;
+      TRACE_INSTANT("found master hash", *master_hash);
       break;
     }
 
@@ -751,6 +1186,121 @@ size_t pack_data_callback(void *received_data, size_t element_size,
   return element_size * num_element;
 }
 
+std::string fetch_remote_head(const std::string &url) {
+  CURL *handle = curl_easy_init();
+  if (!handle) {
+    std::cerr << "Failed to initialize curl.\n";
+    return "";
+  }
+  // 获取远程仓库的info/refs信息，包含分支和对象引用
+  curl_easy_setopt(handle, CURLOPT_URL,
+                   (url + "/info/refs?service=git-upload-pack")
+                       .c_str()); // 告诉curl要去访问哪个网址。
+
+  // 设置回调函数处理响应数据，提取master分支的哈希值
+  std::string packhash;
+  curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION, write_callback);
+  curl_easy_setopt(handle, CURLOPT_WRITEDATA, (void *)&packhash);
+  {
+    TRACE_SPAN("negotiation");
+    curl_easy_perform(handle); // 执行HTTP请求
+  }
+  curl_easy_cleanup(handle);
+  return packhash;
+}
+
+std::string fetch_pack(const std::string &url, const std::string &want,
+                       const std::vector<std::string> &haves) {
+  return fetch_pack(url, std::vector<std::string>{want}, haves, "");
+}
+
+// "<4位十六进制长度><payload>"
+static std::string pkt_line(const std::string &payload) {
+  char length[5];
+  snprintf(length, sizeof(length), "%04zx", payload.size() + 4);
+  return length + payload;
+}
+
+std::string fetch_pack(const std::string &url,
+                       const std::vector<std::string> &wants,
+                       const std::vector<std::string> &haves,
+                       const std::string &filter) {
+  CURL *handle = curl_easy_init();
+  if (!handle) {
+    std::cerr << "Failed to initialize curl.\n";
+    return "";
+  }
+  // 通过git-upload-pack服务下载pack文件数据
+  curl_easy_setopt(
+      handle, CURLOPT_URL,
+      (url + "/git-upload-pack").c_str()); // 告诉curl要去访问哪个网址。
+
+  // 构建Git协议请求数据：使用正确的Git协议格式
+  // 我要下载哈希值为 want 的对象及其所有依赖对象，也就是master分支指向的
+  // 完整仓库内容；have 行之后服务器不再发送从这些提交可达的对象。
+  // 过滤条件需要在第一个 want 行上请求 filter 能力
+  std::string postdata;
+  for (size_t i = 0; i < wants.size(); i++) {
+    postdata += pkt_line("want " + wants[i] +
+                         (i == 0 && !filter.empty() ? " filter" : "") + "\n");
+  }
+  if (!filter.empty()) {
+    postdata += pkt_line("filter " + filter + "\n");
+  }
+  postdata += "0000";
+  for (const auto &have : haves) {
+    postdata += "0032have " + have + "\n";
+  }
+  postdata += "0009done\n";
+  curl_easy_setopt(handle, CURLOPT_POSTFIELDS,
+                   postdata.c_str()); // 告诉curl要发送什么POST数据给服务器。
+
+  // 设置pack文件数据的接收回调
+  std::string pack;
+  curl_easy_setopt(handle, CURLOPT_WRITEDATA,
+                   (void *)&pack); // 告诉curl把接收到的数据放在 pack 里
+  curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION,
+                   pack_data_callback); // 告诉curl，一旦服务器发来数据，就用
+                                        // pack_data_callback()
+                                        // 这个函数来处理服务器发来的数据
+
+  // 设置HTTP请求头，指定Git上传包请求的内容类型
+  struct curl_slist *headers = NULL;
+  headers = curl_slist_append(
+      headers, "Content-Type: application/x-git-upload-pack-request");
+  headers = curl_slist_append(headers,
+                              "Accept: application/x-git-upload-pack-result");
+  curl_easy_setopt(handle, CURLOPT_HTTPHEADER, headers);
+
+  // 设置超时；只有设置了 GIT_CURL_VERBOSE 时才输出 curl 的详细调试信息
+  curl_easy_setopt(handle, CURLOPT_TIMEOUT, 30L);
+  curl_easy_setopt(handle, CURLOPT_CONNECTTIMEOUT, 10L);
+  curl_easy_setopt(handle, CURLOPT_VERBOSE,
+                   getenv("GIT_CURL_VERBOSE") ? 1L : 0L);
+  curl_easy_setopt(handle, CURLOPT_NOPROGRESS, 1L);
+
+  // 只记录请求的规模，请求体可能有成千上万行 have
+  TRACE_COUNT("negotiation_wants", wants.size());
+  TRACE_COUNT("negotiation_haves", haves.size());
+  TRACE_COUNT("upload_pack_request_bytes", postdata.size());
+  // 执行pack文件下载请求
+  CURLcode res;
+  {
+    TRACE_SPAN("download");
+    res = curl_easy_perform(handle);
+  }
+  if (res != CURLE_OK) {
+    std::cerr << "Pack download failed: " << curl_easy_strerror(res) << '\n';
+  }
+
+  // 清理资源：释放curl句柄和HTTP头链表
+  curl_easy_cleanup(handle);
+  curl_slist_free_all(headers);
+
+  TRACE_COUNT("download_bytes", pack.length());
+  return pack;
+}
+
 /**
  * @brief 通过HTTP协议与Git远程仓库通信，获取pack文件和分支信息
  * @param url 远程Git仓库的URL地址
@@ -758,82 +1308,8 @@ size_t pack_data_callback(void *received_data, size_t element_size,
  * @note 实现Git智能HTTP协议，先获取info/refs再下载pack文件
  */
 std::pair<std::string, std::string> curl_request(const std::string &url) {
-  // 初始化libcurl句柄
-  CURL *handle = curl_easy_init();
-  if (handle) {
-    // 第一步：获取远程仓库的info/refs信息，包含分支和对象引用
-    curl_easy_setopt(handle, CURLOPT_URL,
-                     (url + "/info/refs?service=git-upload-pack")
-                         .c_str()); // 告诉curl要去访问哪个网址。
-
-    // 设置回调函数处理响应数据，提取master分支的哈希值
-    std::string packhash;
-    curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION, write_callback);
-    curl_easy_setopt(handle, CURLOPT_WRITEDATA, (void *)&packhash);
-    curl_easy_perform(handle); // 执行HTTP请求
-
-    // 重置curl句柄，准备下一个请求
-    curl_easy_reset(handle);
-
-    // 第二步：通过git-upload-pack服务下载pack文件数据
-    curl_easy_setopt(
-        handle, CURLOPT_URL,
-        (url + "/git-upload-pack").c_str()); // 告诉curl要去访问哪个网址。
-
-    // 构建Git协议请求数据：使用正确的Git协议格式
-    std::string postdata =
-        "0032want " + packhash +
-        "\n00000009done\n"; // 告诉curl接下来要发起的请求是什么，我要下载哈希值为
-                            // packhash
-                            // 的对象及其所有依赖对象，也就是master分支指向的完整仓库内容
-    curl_easy_setopt(handle, CURLOPT_POSTFIELDS,
-                     postdata.c_str()); // 告诉curl要发送什么POST数据给服务器。
-
-    // 设置pack文件数据的接收回调
-    std::string pack;
-    curl_easy_setopt(handle, CURLOPT_WRITEDATA,
-                     (void *)&pack); // 告诉curl把接收到的数据放在 pack 里
-    curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION,
-                     pack_data_callback); // 告诉curl，一旦服务器发来数据，就用
-                                          // pack_data_callback()
-                                          // 这个函数来处理服务器发来的数据
-
-    // 设置HTTP请求头，指定Git上传包请求的内容类型
-    struct curl_slist *headers = NULL;
-    headers = curl_slist_append(
-        headers, "Content-Type: application/x-git-upload-pack-request");
-    headers = curl_slist_append(headers,
-                                "Accept: application/x-git-upload-pack-result");
-    curl_easy_setopt(handle, CURLOPT_HTTPHEADER, headers);
-
-    // 设置超时和详细调试
-    curl_easy_setopt(handle, CURLOPT_TIMEOUT, 30L);
-    curl_easy_setopt(handle, CURLOPT_CONNECTTIMEOUT, 10L);
-    curl_easy_setopt(handle, CURLOPT_VERBOSE, 1L);
-    curl_easy_setopt(handle, CURLOPT_NOPROGRESS, 1L);
-
-    std::cerr << "Debug: starting pack file download..." << std::endl;
-    std::cerr << "Debug: POST data: " << postdata << std::endl;
-    // 执行pack文件下载请求
-    CURLcode res = curl_easy_perform(handle);
-    std::cerr << "Debug: curl result: " << curl_easy_strerror(res) << std::endl;
-    std::cerr << "Debug: pack file download completed" << std::endl;
-
-    // 清理资源：释放curl句柄和HTTP头链表
-    curl_easy_cleanup(handle);
-    curl_slist_free_all(headers);
-
-    // 调试输出
-    std::cerr << "Debug: packhash length: " << packhash.length() << std::endl;
-    std::cerr << "Debug: packhash content: " << packhash << std::endl;
-    std::cerr << "Debug: pack length: " << pack.length() << std::endl;
-
-    // 返回pack文件数据和master分支哈希
-    return {pack, packhash};
-  } else {
-    std::cerr << "Failed to initialize curl.\n";
-    return {};
-  }
+  std::string packhash = fetch_remote_head(url);
+  return {fetch_pack(url, packhash, {}), packhash};
 }
 
 int decompress(FILE *input, FILE *output) {
@@ -891,17 +1367,20 @@ int cat_file_for_clone(const char *file_path, const std::string &dir,
                        FILE *dest, bool print_out = false) {
   try {
     std::string blob_sha = file_path;
-    std::string blob_path = dir + "/.git/objects/" + blob_sha.insert(2, "/");
     if (print_out)
-      std::cout << "blob path: " << blob_path << std::endl;
-    FILE *blob_file = fopen(blob_path.c_str(), "rb");
-    if (blob_file == NULL) {
+      std::cout << "blob: " << blob_sha << std::endl;
+    // 对象可能是松散的，也可能已经被 repack 进了 pack
+    auto blob = ObjectStore(dir + "/.git").Read(blob_sha);
+    if (!blob) {
       std::cerr << "Invalid object hash.\n";
       return EXIT_FAILURE;
     }
-    decompress(blob_file, dest);
-    fclose(blob_file);
-  } catch (const std::filesystem::filesystem_error &e) {
+    if (fwrite(blob->data.data(), 1, blob->data.size(), dest) !=
+        blob->data.size()) {
+      std::cerr << "Failed to write to output file.\n";
+      return EXIT_FAILURE;
+    }
+  } catch (const std::runtime_error &e) {
     std::cerr << e.what() << '\n';
     return EXIT_FAILURE;
   }
@@ -917,96 +1396,238 @@ int cat_file_for_clone(const char *file_path, const std::string &dir,
  */
 void restore_tree(const std::string &tree_hash, const std::string &dir,
                   const std::string &proj_dir) {
-  // 构建Git对象文件路径：proj_dir/.git/objects/xx/xxxxxx...（前2字符作为目录，剩余38字符作为文件名）
-  std::string object_path = proj_dir + "/.git/objects/" +
-                            tree_hash.substr(0, 2) + '/' + tree_hash.substr(2);
+  // 整棵树共用一个对象库，pack 只需打开一次
+  ObjectStore store(proj_dir + "/.git");
+  restore_tree(store, tree_hash, dir);
+}
 
-  // 以二进制模式打开tree对象文件
-  std::ifstream master_tree(object_path);
+// rel 为 dir 相对于恢复的根目录的路径，根目录为空字符串
+static void restore_subtree(const ObjectStore &store,
+                            const std::string &tree_hash,
+                            const std::string &dir, const std::string &rel,
+                            const sparse::Cone *cone) {
+  // 通过对象库读取tree对象（松散对象或pack中的对象），内容已去掉"tree <size>\0"头
+  auto object = store.Read(tree_hash);
+  if (!object) {
+    throw std::runtime_error("missing tree object " + tree_hash);
+  }
+  std::string tree_contents = std::move(object->data);
 
-  // 创建字符串流用于读取文件全部内容
-  std::ostringstream buffer;
-  buffer << master_tree.rdbuf();
+  // 遍历tree对象中的每个条目（文件或子目录）
+  tree::TreeParser parser(tree_contents, tree_hash);
+  tree::TreeEntry entry;
+  while (parser.Next(entry)) {
+    std::string path = dir + '/' + std::string(entry.name);
+    if (entry.IsTree()) {
+      // cone 之外的子树跳过，不读取其 tree 对象
+      std::string child =
+          rel.empty() ? std::string(entry.name) : rel + '/' + std::string(entry.name);
+      if (cone && cone->Classify(child) == sparse::Scope::kOutside) {
+        continue;
+      }
+      // 创建子目录后递归恢复其中的文件和子目录
+      std::filesystem::create_directory(path);
+      restore_subtree(store, entry.Hash(), path, child, cone);
+    } else if (entry.mode == tree::kModeGitlink) {
+      // 子模块提交不在本仓库中，与 git 一样只留下空目录
+      std::filesystem::create_directory(path);
+    } else {
+      // 从对象库中读取blob内容，以二进制写入模式创建文件
+      std::string blob_hash = entry.Hash();
+      auto blob = store.Read(blob_hash);
+      if (!blob) {
+        throw std::runtime_error("missing blob object " + blob_hash);
+      }
+      std::ofstream new_file(path, std::ios::binary);
+      new_file.write(blob->data.data(), blob->data.size());
+      TRACE_COUNT("checkout_files", 1);
+    }
+  }
+}
 
-  // 使用zlib解压缩tree对象内容（Git对象都是压缩存储的）
-  std::string tree_contents = decompress_string(buffer.str());
+void restore_tree(const ObjectStore &store, const std::string &tree_hash,
+                  const std::string &dir, const sparse::Cone *cone) {
+  restore_subtree(store, tree_hash, dir, "", cone);
+}
 
-  // 跳过tree对象头信息（格式为"tree <size>\0"），只保留实际的条目数据
-  tree_contents = tree_contents.substr(tree_contents.find('\0') + 1);
+/**
+ * @brief 解析pack数据中的全部对象并以松散对象形式存入本地对象库
+ * @param pack 以"PACK"开头的完整pack数据
+ * @param dir 本地仓库根目录（包含.git目录）
+ * @param packhash 远程master分支指向的提交哈希
+ * @return master提交对象的内容（从'\0'开始），pack中没有该提交时为空
+ * @throws std::invalid_argument 遇到暂不支持的OFS_DELTA对象
+ * @throws std::runtime_error pack被截断、对象损坏或长度与对象头不符
+ */
+std::string unpack_objects(const std::string &pack, const std::string &dir,
+                           const std::string &packhash) {
+  // 解析pack文件头，提取对象数量（4字节大端序）
+  int num_objects = 0;
+  for (int i = 8; i < 12; i++) {
+    num_objects = num_objects << 8;
+    num_objects = num_objects | (unsigned char)pack[i]; // 这也算一种复制操作
+  }
 
-  // 遍历tree对象中的每个条目（文件或子目录）
-  int pos = 0;
-  while (pos < tree_contents.length()) {
-    // 检查当前条目是否为目录（模式为"40000"表示目录）
-    if (tree_contents.find("40000", pos) == pos) {
-      pos += 6; // 跳过模式字符串"40000"和后面的空格（共6个字符）
+  // 处理Git pack文件中的所有对象
+  int object_type;
+  int current_position = 12; // 跳过pack文件头（12字节）
+  std::string master_commit_contents;
 
-      // 提取目录路径名（从当前位置到下一个空字符之间的内容）
-      std::string path =
-          tree_contents.substr(pos, tree_contents.find('\0', pos) - pos);
-      pos += path.length() + 1; // 跳过路径字符串和结束空字符
+  TRACE_SPAN("unpack");
+  TRACE_COUNT("pack_objects", num_objects);
+  ObjectStore store(dir + "/.git"); // 用于读取 REF_DELTA 的基础对象
 
-      // 提取子tree对象的20字节二进制SHA-1哈希值，并转换为40字符十六进制字符串
-      std::string next_hash = digest_to_hash(tree_contents.substr(pos, 20));
+  // 每个对象的缓冲区都从 arena 中按对象头里的长度分配，处理完一个对象整体
+  // 回收；zlib 流也在对象之间复用。松散对象攒成批写出（见 ingest.h）
+  ingest::Arena arena;
+  ingest::Inflater inflater;
+  ingest::LooseObjectWriter writer(dir);
+  char object_hash[41] = {};
 
-      // 在目标目录中创建子目录
-      std::filesystem::create_directory(dir + '/' + path);
+  // 遍历pack文件中的所有Git对象
+  for (int object_index = 0; object_index < num_objects; object_index++) {
+    arena.Reset();
+    if (static_cast<size_t>(current_position) >= pack.size()) {
+      throw std::runtime_error("pack truncated at object " +
+                               std::to_string(object_index));
+    }
+    // 也就是说，如果我只是想知道对象的类型和长度，那么完整对象和引用delta对象的解析方法是一样的？
+    // https://pastebin.com/LZTk8pxR
+    // 从对象数据的第一个字节提取对象类型（高3位）
+    object_type = (pack[current_position] & 112) >> 4; // 112是二进制11100000
 
-      // 递归调用restore_tree处理子目录，恢复其中的文件和子目录
-      restore_tree(next_hash, dir + '/' + path, proj_dir);
+    // 读取对象的长度（变长编码）
+    int object_length = read_length(pack, &current_position);
 
-      pos += 20; // 跳过20字节的哈希值，继续处理下一个条目
-    } else {
-      // 处理文件条目（模式为"100644"表示普通文件）
-      pos += 7; // 跳过模式字符串"100644"和后面的空格（共7个字符）
+    // 完整对象（含 "<类型> <长度>\0" 头）在 arena 中的位置
+    char *object = nullptr;
+    size_t object_size = 0;
 
-      // 提取文件名（从当前位置到下一个空字符之间的内容）
-      std::string path =
-          tree_contents.substr(pos, tree_contents.find('\0', pos) - pos);
-      pos += path.length() + 1; // 跳过文件名和结束空字符
+    // 根据对象类型进行不同的处理逻辑
+    if (object_type == 6) { // 偏移量delta对象（暂不支持）
+      throw std::invalid_argument("Offset deltas not implemented.\n");
+    } else if (object_type ==
+               7) { // 处理引用delta对象，也就是基于 SHA-1 的 Delta 对象
+      /*
+      [ Pack 中的 Delta 对象 ]
+      +--------+---------------------+----------------+
+      | 类型头  | 基础对象哈希/SHA-1   | Delta 的元数据和指令流    |
+      +--------+---------------------+----------------+
+      | 0x72   | 20字节              | base_len + target_len + 指令序列    |
+      +--------+---------------------+----------------+
+                ^
+                |
+                current_position 目前指向这里
+      */
+      // 提取基础对象的20字节SHA-1哈希以方便后续打开基础对象文件
+      // 注意，这一步读取的digest是二进制的，需要用 digest_to_hash() 转成16进制
+      // 才能在.git/object里找到对应文件
+      std::string hash = digest_to_hash(pack.substr(current_position, 20));
+      current_position += 20;
 
-      // 提取blob对象的20字节二进制SHA-1哈希值，并转换为40字符十六进制字符串
-      std::string blob_hash = digest_to_hash(tree_contents.substr(pos, 20));
+      TRACE_COUNT("ref_delta_objects", 1);
+      TRACE_COUNT("base_object_reads", 1);
 
-      // 以二进制写入模式创建新文件
-      FILE *new_file = fopen((dir + '/' + path).c_str(), "wb");
+      // 从本地对象库中读取基础对象内容
+      std::optional<GitObject> base;
+      {
+        TRACE_PHASE("delta_base_read");
+        // 基础对象通常就在本 pack 中靠前的位置，可能还在写入队列或
+        // 隔离目录里
+        GitObject queued;
+        if (writer.ReadQueued(hash, queued)) {
+          base = std::move(queued);
+          TRACE_COUNT("ingest_queued_base_reads", 1);
+        } else {
+          base = store.Read(hash);
+        }
+        if (!base) {
+          throw std::runtime_error("missing delta base " + hash);
+        }
+        // 对象库返回的内容已经去掉了 "blob 123\0" 这样的类型前缀
+      }
 
-      // 调用cat_file_for_clone函数从Git对象库中读取blob内容并写入文件
-      cat_file_for_clone(blob_hash.c_str(), proj_dir, new_file, false);
+      // 解压delta数据；对象头中的长度就是delta数据的长度
+      char *delta = arena.Allocate(object_length);
+      {
+        TRACE_PHASE("inflate");
+        current_position += inflater.Inflate(
+            pack.data() + current_position, pack.size() - current_position,
+            delta, object_length);
+      }
+      // apply_delta() 的实现是最难的部分，前面的逻辑只能算给鱼刮鱼鳞之类的小菜
+      // 这一步才是烹饪硬菜
+      {
+        TRACE_PHASE("delta_resolve");
+        DeltaHeader header = parse_delta_header(delta, object_length);
+        // 重建对象的完整格式（类型+长度+内容），内容直接写在对象头之后
+        char prefix[32];
+        size_t prefix_size =
+            snprintf(prefix, sizeof(prefix), "%s %zu",
+                     ObjectTypeName(base->type), header.target_size) + 1;
+        object_size = prefix_size + header.target_size;
+        object = arena.Allocate(object_size);
+        memcpy(object, prefix, prefix_size);
+        apply_delta_into(delta, object_length, base->data.data(),
+                         base->data.size(), object + prefix_size,
+                         header.target_size);
+      }
+    } else { // 标准Git对象处理（commit=1, tree=2, blob=其他）
+      // 根据对象类型构建对象头信息，解压的内容直接写在对象头之后
+      const char *object_type_str = (object_type == 1)   ? "commit"
+                                    : (object_type == 2) ? "tree"
+                                                         : "blob";
+      char prefix[32];
+      size_t prefix_size = snprintf(prefix, sizeof(prefix), "%s %d",
+                                    object_type_str, object_length) +
+                           1;
+      object_size = prefix_size + object_length;
+      object = arena.Allocate(object_size);
+      memcpy(object, prefix, prefix_size);
+      {
+        TRACE_PHASE("inflate");
+        current_position += inflater.Inflate(
+            pack.data() + current_position, pack.size() - current_position,
+            object + prefix_size, object_length);
+      }
+      TRACE_COUNT("inflated_bytes", object_size);
+    }
 
-      // 关闭文件句柄
-      fclose(new_file);
+    // 计算对象哈希并存储到本地对象库
+    {
+      TRACE_PHASE("store");
+      unsigned char digest[20];
+      SHA1(reinterpret_cast<const unsigned char *>(object), object_size,
+           digest);
+      byte_util::BinaryToHex(digest, object_hash);
+      writer.Write(object_hash, object, object_size);
+    }
 
-      pos += 20; // 跳过20字节的哈希值，继续处理下一个条目
+    // 如果当前对象是master分支的commit，保存其内容
+    if (packhash.compare(0, std::string::npos, object_hash, 40) == 0) {
+      const char *nul =
+          static_cast<const char *>(memchr(object, '\0', object_size));
+      master_commit_contents.assign(nul, object + object_size - nul);
     }
   }
+
+  // 全部对象落盘并出现在 objects 目录中之后，调用方才写引用
+  writer.Commit();
+  TRACE_COUNT("ingest_arena_allocations", arena.Allocations());
+  TRACE_COUNT("ingest_arena_block_allocations", arena.BlockAllocations());
+  TRACE_COUNT("ingest_arena_peak_bytes", arena.Capacity());
+  // 阶段结束：一次性释放全部对象缓冲区
+  arena.Release();
+  trace::Flush();
+  return master_commit_contents;
 }
 
 /**
- * @brief Git克隆功能的主函数，实现从远程仓库克隆到本地目录
- * @param url 远程Git仓库的URL地址
- * @param dir 本地目标目录路径
- * @return 执行成功返回EXIT_SUCCESS，失败返回EXIT_FAILURE
+ * @brief 从 upload-pack 的响应中找到 pack 数据，解析其中的对象存入 dir
+ * @return 响应中没有合法的 pack 时返回 false
  */
-int clone(std::string url, std::string dir) {
-  std::cerr << "Debug: clone() started with url=" << url << ", dir=" << dir
-            << std::endl;
-
-  // 创建目标目录并初始化Git仓库
-  std::filesystem::create_directory(dir);
-  if (git_init(dir) != true) {
-    std::cerr << "Failed to initialize git repository.\n";
-    return EXIT_FAILURE;
-  }
-
-  std::cerr << "Debug: git_init completed, calling curl_request..."
-            << std::endl;
-
-  // 通过HTTP请求获取远程仓库的pack文件和master分支哈希
-  auto [pack, packhash] = curl_request(url);
-
-  std::cerr << "Debug: curl_request completed" << std::endl;
-
+static bool ingest_pack(std::string pack, const std::string &dir,
+                        const std::string &packhash) {
   /*
   [ curl_request() 返回的 pack 数据结构 ]
   +----------------------+--------------------------+------------------+
@@ -1034,49 +1655,32 @@ int clone(std::string url, std::string dir) {
   // 检查pack数据是否足够长
   if (pack.length() < 40) {
     std::cerr << "Invalid pack data: too short\n";
-    return EXIT_FAILURE;
-  }
-
-  std::cerr << "Debug: pack first 50 bytes: ";
-  for (size_t i = 0; i < std::min((size_t)50, pack.length()); i++) {
-    std::cerr << std::hex << (unsigned char)pack[i] << " ";
+    return false;
   }
-  std::cerr << std::endl;
 
   // Git pack 文件通常以 "PACK" 开头，我们需要找到真正的 pack 数据开始位置
   size_t pack_start = pack.find("PACK");
   if (pack_start == std::string::npos) {
     std::cerr << "Could not find PACK header in response\n";
-    return EXIT_FAILURE;
+    return false;
   }
 
-  std::cerr << "Debug: found PACK at position: " << pack_start << std::endl;
-
   std::string actual_pack_data;
 
   if (pack_start > 0) {
     // 跳过头部，直接使用从 PACK 开始的数据
     actual_pack_data = pack.substr(pack_start);
-    std::cerr << "Debug: skipping " << pack_start << " bytes of header"
-              << std::endl;
   } else {
     actual_pack_data = pack;
   }
 
   pack = actual_pack_data;
 
-  std::cerr << "Debug: pack after extracting PACK data, length: "
-            << pack.length() << std::endl;
-  std::cerr << "Debug: pack first 20 bytes: ";
-  for (size_t i = 0; i < std::min((size_t)20, pack.length()); i++) {
-    std::cerr << std::hex << (unsigned char)pack[i] << " ";
-  }
-  std::cerr << std::endl;
 
   // 检查 pack 数据是否以 PACK 开头
   if (pack.length() < 4 || pack.substr(0, 4) != "PACK") {
     std::cerr << "Error: pack data does not start with PACK" << std::endl;
-    return EXIT_FAILURE;
+    return false;
   }
 
   /*
@@ -1093,145 +1697,157 @@ int clone(std::string url, std::string dir) {
                                                                       |
                                                                       你要解析文件头在这里
   */
-  // 解析pack文件头，提取对象数量（4字节大端序）
-  int num_objects = 0;
-  for (int i = 8; i < 12; i++) {
-    num_objects = num_objects << 8;
-    num_objects = num_objects | (unsigned char)pack[i]; // 这也算一种复制操作
-  }
+  // 解析pack中的所有对象并写入本地对象库
+  unpack_objects(pack, dir, packhash);
+  return true;
+}
 
-  // 处理Git pack文件中的所有对象
-  int object_type;
-  int current_position = 12; // 跳过pack文件头（12字节）
-  std::string master_commit_contents;
+size_t fetch_missing_objects(const std::filesystem::path &git_dir,
+                             const std::vector<std::string> &hashes) {
+  Config config(git_dir);
+  std::optional<std::string> url = config.Get("remote.origin.url");
+  if (hashes.empty() || !url || !config.GetBool("remote.origin.promisor", false)) {
+    return 0;
+  }
+  TRACE_SPAN("promisor-fetch");
+  TRACE_COUNT("promisor_objects", hashes.size());
+  std::string pack = fetch_pack(*url, hashes, {}, "");
+  std::string dir = std::filesystem::absolute(git_dir).parent_path().string();
+  if (!ingest_pack(pack, dir, "")) {
+    throw std::runtime_error("cannot fetch missing objects from " + *url);
+  }
+  return hashes.size();
+}
 
-  std::cerr << "Debug: num_objects = " << num_objects << std::endl;
-  std::cerr << "Debug: current_position starts at: " << current_position
-            << std::endl;
+// 使用共享缓存时最多发送的 have 数
+static const size_t kMaxSharedCacheHaves = 32;
 
-  // 遍历pack文件中的所有Git对象
-  for (int object_index = 0; object_index < num_objects; object_index++) {
-    std::cerr << "Debug: processing object " << object_index << " at position "
-              << current_position << std::endl;
+/**
+ * @brief Git克隆功能的主函数，实现从远程仓库克隆到本地目录
+ * @param url 远程Git仓库的URL地址
+ * @param dir 本地目标目录路径
+ * @return 执行成功返回EXIT_SUCCESS，失败返回EXIT_FAILURE
+ */
+int clone(std::string url, std::string dir, std::string shared_cache) {
+  return clone(url, dir, shared_cache, {});
+}
 
-    // 也就是说，如果我只是想知道对象的类型和长度，那么完整对象和引用delta对象的解析方法是一样的？
-    // https://pastebin.com/LZTk8pxR
-    // 从对象数据的第一个字节提取对象类型（高3位）
-    object_type = (pack[current_position] & 112) >> 4; // 112是二进制11100000
+int clone(std::string url, std::string dir, std::string shared_cache,
+          const CloneOptions &options) {
+  TRACE_SPAN("clone");
+  if (!options.filter.empty() && options.filter != "blob:none") {
+    std::cerr << "Unsupported filter '" << options.filter << "'\n";
+    return EXIT_FAILURE;
+  }
+  std::optional<sparse::Cone> cone;
+  if (options.sparse) {
+    try {
+      cone.emplace(options.sparse_dirs);
+    } catch (const std::runtime_error &e) {
+      std::cerr << e.what() << '\n';
+      return EXIT_FAILURE;
+    }
+  }
 
-    // 读取对象的长度（变长编码）
-    int object_length = read_length(pack, &current_position);
+  // 创建目标目录并初始化Git仓库
+  std::filesystem::create_directory(dir);
+  if (git_init(dir) != true) {
+    std::cerr << "Failed to initialize git repository.\n";
+    return EXIT_FAILURE;
+  }
 
-    std::cerr << "Debug: object_type = " << object_type
-              << ", object_length = " << object_length << std::endl;
-    std::cerr << "Debug: after reading length, current_position = "
-              << current_position << std::endl;
+  // 共享缓存：克隆的对象目录通过 alternates 引用缓存
+  std::unique_ptr<shared_cache::SharedCache> cache;
+  try {
+    cache = shared_cache::SharedCache::Open(shared_cache);
+  } catch (const std::exception &e) {
+    std::cerr << "Cannot use shared cache: " << e.what() << '\n';
+    return EXIT_FAILURE;
+  }
+  // 缓存中的提交必须带着全部对象，部分克隆的结果不能放进去
+  if (cache && !options.filter.empty()) {
+    std::cerr << "--filter cannot be used with a shared cache\n";
+    return EXIT_FAILURE;
+  }
+  if (!options.filter.empty() || cone) {
+    // 与 git 相同的配置：部分克隆缺少的对象以后从 origin 取回；
+    // index.sparse 让 git 保留 index 中的稀疏目录，不展开成逐个文件
+    std::ofstream config(dir + "/.git/config");
+    config << "[core]\n\trepositoryformatversion = "
+           << (options.filter.empty() ? 0 : 1) << '\n';
+    if (cone) {
+      config << "\tsparseCheckout = true\n\tsparseCheckoutCone = true\n"
+             << "[index]\n\tsparse = true\n";
+    }
+    if (!options.filter.empty()) {
+      config << "[remote \"origin\"]\n\turl = " << url
+             << "\n\tpromisor = true\n\tpartialclonefilter = "
+             << options.filter << "\n[extensions]\n\tpartialclone = origin\n";
+    }
+  }
 
-    // 根据对象类型进行不同的处理逻辑
-    if (object_type == 6) { // 偏移量delta对象（暂不支持）
-      throw std::invalid_argument("Offset deltas not implemented.\n");
-    } else if (object_type ==
-               7) { // 处理引用delta对象，也就是基于 SHA-1 的 Delta 对象
-      /*
-      [ Pack 中的 Delta 对象 ]
-      +--------+---------------------+----------------+
-      | 类型头  | 基础对象哈希/SHA-1   | Delta 的元数据和指令流    |
-      +--------+---------------------+----------------+
-      | 0x72   | 20字节              | base_len + target_len + 指令序列    |
-      +--------+---------------------+----------------+
-                ^
-                |
-                current_position 目前指向这里
-      */
-      // 提取基础对象的20字节SHA-1哈希以方便后续打开基础对象文件
-      // 注意，这一步读取的digest是二进制的，需要用 digest_to_hash() 转成16进制
-      // 才能在.git/object里找到对应文件
-      std::string digest = pack.substr(current_position, 20);
-      std::string hash = digest_to_hash(digest);
-      current_position += 20;
+  // 通过HTTP请求获取远程仓库的pack文件和master分支哈希
+  std::string pack, packhash;
+  if (cache) {
+    cache->AttachTo(dir + "/.git");
+    packhash = fetch_remote_head(url);
+    std::vector<std::string> tips = cache->Tips();
+    if (std::find(tips.begin(), tips.end(), packhash) != tips.end()) {
+      // master 的全部对象都已在缓存中，不需要下载
+      TRACE_INSTANT("shared cache hit", packhash);
+    } else {
+      // 最近写入的完整提交作为 have，服务器只发送缺少的对象
+      size_t count = std::min(tips.size(), kMaxSharedCacheHaves);
+      pack = fetch_pack(url, packhash,
+                        std::vector<std::string>(tips.rbegin(),
+                                                 tips.rbegin() + count));
+    }
+  } else if (!options.filter.empty()) {
+    packhash = fetch_remote_head(url);
+    if (!packhash.empty()) {
+      pack = fetch_pack(url, {packhash}, {}, options.filter);
+    }
+  } else {
+    std::tie(pack, packhash) = curl_request(url);
+  }
+  if (packhash.empty()) {
+    std::cerr << "Could not find remote HEAD\n";
+    return EXIT_FAILURE;
+  }
+  if ((!cache || !pack.empty()) && !ingest_pack(pack, dir, packhash)) {
+    return EXIT_FAILURE;
+  }
 
-      std::cerr << "Debug: REF_DELTA object, base hash = " << hash << std::endl;
+  // 下载的对象移入共享缓存，之后 master 提交才算完整
+  if (cache) {
+    cache->Absorb(dir + "/.git/objects");
+  }
+  ObjectStore store(dir + "/.git");
+  auto commit = store.Read(packhash);
+  if (!commit || commit->type != ObjectType::kCommit) {
+    std::cerr << "Missing master commit " << packhash << '\n';
+    return EXIT_FAILURE;
+  }
+  if (cache) {
+    cache->AddTip(packhash);
+  }
 
-      // 从本地对象库中读取基础对象内容
-      std::ifstream file(dir + "/.git/objects/" + hash.insert(2, "/"));
-      std::stringstream buffer;
-      buffer << file.rdbuf();
-      std::string file_contents = buffer.str();
-      std::string base_object_contents = decompress_string(file_contents);
-      /*
-      [ 解压后的基础对象（如 Blob） ]
-      +----------------+------+----------------+
-      | "blob 123\0"   |      | 实际文件内容     |
-      +----------------+------+----------------+
-       ↑          ↑
-       类型前缀    终止符'\0'
-       */
-      // 提取并移除基础对象的类型前缀
-      std::string object_type_extracted =
-          base_object_contents.substr(0, base_object_contents.find(" "));
-      base_object_contents =
-          base_object_contents.substr(base_object_contents.find('\0') + 1);
-
-      // 应用delta数据到基础对象，重建完整对象
-      std::string delta_contents =
-          decompress_string(pack.substr(current_position));
-      // apply_delta() 的实现是最难的部分，前面的逻辑只能算给鱼刮鱼鳞之类的小菜
-      // 这一步才是烹饪硬菜
-      std::string reconstructed_contents =
-          apply_delta(delta_contents, base_object_contents);
-
-      // 重建对象的完整格式（类型+长度+内容）
-      reconstructed_contents = object_type_extracted + ' ' +
-                               std::to_string(reconstructed_contents.length()) +
-                               '\0' + reconstructed_contents;
-
-      // 计算重建对象的哈希并存储到本地对象库
-      std::string object_hash = sha_file(reconstructed_contents);
-      compress_and_store(object_hash.c_str(), reconstructed_contents, dir);
-
-      // 跳过已处理的delta数据
-      std::string compressed_delta = compress_string(delta_contents);
-      current_position += compressed_delta.length();
-
-      // 如果当前对象是master分支的commit，保存其内容
-      if (hash.compare(packhash) == 0) {
-        master_commit_contents =
-            reconstructed_contents.substr(reconstructed_contents.find('\0'));
-      }
-    } else { // 标准Git对象处理（commit=1, tree=2, blob=其他）
-      std::cerr << "Debug: standard object, trying to decompress from position "
-                << current_position << std::endl;
-
-      // 解压缩对象数据内容
-      std::string object_contents =
-          decompress_string(pack.substr(current_position));
-      current_position += compress_string(object_contents).length();
-
-      // 根据对象类型构建对象头信息
-      std::string object_type_str = (object_type == 1)   ? "commit "
-                                    : (object_type == 2) ? "tree "
-                                                         : "blob ";
-      object_contents = object_type_str +
-                        std::to_string(object_contents.length()) + '\0' +
-                        object_contents;
-
-      // 计算对象哈希并存储到本地对象库
-      std::string object_hash = compute_sha1(object_contents, false);
-      std::string compressed_object = compress_string(object_contents);
-      compress_and_store(object_hash.c_str(), object_contents, dir);
-
-      // 如果当前对象是master分支的commit，保存其内容
-      if (object_hash.compare(packhash) == 0) {
-        master_commit_contents =
-            object_contents.substr(object_contents.find('\0'));
-      }
+  // 从master commit中提取tree哈希并恢复整个文件树结构，同时写出 index，
+  // 之后的 checkout 可以凭 stat 信息判断文件是否被改过。稀疏检出时只写出
+  // cone 之内的文件，部分克隆在写出前取回其中的 blob
+  commit_graph::CommitHeader header;
+  commit_graph::ParseCommitHeader(packhash, commit->data, header);
+  try {
+    if (cone) {
+      cone->Write(dir + "/.git");
     }
+    checkout::CheckoutTree(store, dir, "", std::string(header.tree),
+                           cache.get());
+  } catch (const std::runtime_error &e) {
+    std::cerr << e.what() << '\n';
+    return EXIT_FAILURE;
   }
-
-  // 从master commit中提取tree哈希并恢复整个文件树结构
-  std::string tree_hash = master_commit_contents.substr(
-      master_commit_contents.find("tree") + 5, 40);
-  restore_tree(tree_hash, dir, dir);
+  trace::Flush();
 
   // 创建master分支引用，指向master commit
   std::filesystem::create_directories(dir + "/.git/refs/heads");
@@ -0,0 +1,582 @@
+#include "commit_graph.h"
+#include "byte_util.h"
+#include "durability.h"
+#include "trace.h"
+#include <algorithm>
+#include <fcntl.h>
+#include <openssl/sha.h>
+#include <queue>
+#include <stdexcept>
+#include <string.h>
+#include <string_view>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+using byte_util::BinaryToHex;
+using byte_util::GetBE32;
+using byte_util::GetBE64;
+using byte_util::HexToBinary;
+using byte_util::PutBE32;
+using byte_util::PutBE64;
+
+namespace commit_graph {
+namespace {
+
+constexpr uint32_t kChunkOidFanout = 0x4f494446; // "OIDF"
+constexpr uint32_t kChunkOidLookup = 0x4f49444c; // "OIDL"
+constexpr uint32_t kChunkCommitData = 0x43444154; // "CDAT"
+constexpr uint32_t kChunkExtraEdges = 0x45444745; // "EDGE"
+constexpr size_t kHeaderSize = 8;
+constexpr size_t kChunkEntrySize = 12;
+constexpr size_t kCommitDataSize = 36;
+constexpr uint32_t kEdgeFlag = 0x80000000;
+
+} // namespace
+
+fs::path GraphPath(const fs::path &git_dir) {
+  return git_dir / "objects/info/commit-graph";
+}
+
+void ParseCommitHeader(const std::string &hash, std::string_view data,
+                       CommitHeader &header) {
+  header = {};
+  size_t pos = 0;
+  while (pos < data.size() && data[pos] != '\n') {
+    size_t eol = data.find('\n', pos);
+    if (eol == std::string_view::npos) {
+      eol = data.size();
+    }
+    std::string_view line = data.substr(pos, eol - pos);
+    if (line.starts_with("tree ")) {
+      header.tree = line.substr(5);
+    } else if (line.starts_with("parent ")) {
+      header.parents.push_back(line.substr(7));
+    } else if (line.starts_with("author ")) {
+      header.author = line.substr(7);
+    } else if (line.starts_with("committer ")) {
+      header.committer = line.substr(10);
+      // <name> <<email>> <秒数> <时区>
+      size_t gt = header.committer.rfind('>');
+      if (gt != std::string_view::npos) {
+        header.time = std::strtoll(
+            std::string(header.committer.substr(gt + 1)).c_str(), nullptr, 10);
+      }
+    }
+    pos = eol + 1;
+  }
+  if (pos < data.size()) {
+    header.message = data.substr(pos + 1);
+  }
+  if (header.tree.size() != 40) {
+    throw std::runtime_error("corrupt commit " + hash);
+  }
+}
+
+// ---- 读取 ----
+
+CommitGraph::CommitGraph(const fs::path &path) : path_(path) {
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    throw std::runtime_error("commit-graph: cannot open " + path.string());
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    throw std::runtime_error("commit-graph: cannot stat " + path.string());
+  }
+  size_ = st.st_size;
+  if (size_ < kHeaderSize + kChunkEntrySize + 20) {
+    close(fd);
+    throw std::runtime_error("commit-graph: file too small " + path.string());
+  }
+  void *data = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    throw std::runtime_error("commit-graph: cannot mmap " + path.string());
+  }
+  data_ = static_cast<const unsigned char *>(data);
+
+  auto fail = [this](const std::string &what) {
+    munmap(const_cast<unsigned char *>(data_), size_);
+    throw std::runtime_error("commit-graph: " + what + " in " +
+                             path_.string());
+  };
+  if (memcmp(data_, "CGPH", 4) != 0) {
+    fail("bad signature");
+  }
+  if (data_[4] != 1 || data_[5] != 1) {
+    fail("unsupported version");
+  }
+  if (data_[7] != 0) {
+    fail("split commit-graph not supported");
+  }
+  size_t chunks = data_[6];
+  size_t table_end = kHeaderSize + (chunks + 1) * kChunkEntrySize;
+  size_t data_end = size_ - 20;
+  if (table_end > data_end) {
+    fail("truncated chunk table");
+  }
+  size_t fanout_size = 0, oids_size = 0, cdat_size = 0, edges_size = 0;
+  for (size_t i = 0; i < chunks; i++) {
+    const unsigned char *entry = data_ + kHeaderSize + i * kChunkEntrySize;
+    uint32_t id = GetBE32(entry);
+    uint64_t begin = GetBE64(entry + 4);
+    uint64_t end = GetBE64(entry + 4 + kChunkEntrySize);
+    if (begin < table_end || begin > end || end > data_end) {
+      fail("bad chunk offset");
+    }
+    const unsigned char *chunk = data_ + begin;
+    size_t chunk_size = end - begin;
+    switch (id) {
+    case kChunkOidFanout:
+      fanout_ = chunk;
+      fanout_size = chunk_size;
+      break;
+    case kChunkOidLookup:
+      oids_ = chunk;
+      oids_size = chunk_size;
+      break;
+    case kChunkCommitData:
+      cdat_ = chunk;
+      cdat_size = chunk_size;
+      break;
+    case kChunkExtraEdges:
+      edges_ = chunk;
+      edges_size = chunk_size;
+      break;
+    default:
+      break; // 不认识的 chunk（如 GDA2、BIDX）忽略
+    }
+  }
+  if (!fanout_ || !oids_ || !cdat_) {
+    fail("missing required chunk");
+  }
+  if (fanout_size != 256 * 4) {
+    fail("bad fanout size");
+  }
+  count_ = GetBE32(fanout_ + 255 * 4);
+  if (oids_size != size_t(count_) * 20 ||
+      cdat_size != size_t(count_) * kCommitDataSize || edges_size % 4 != 0) {
+    fail("chunk size does not match commit count");
+  }
+  edge_count_ = edges_size / 4;
+}
+
+CommitGraph::~CommitGraph() {
+  munmap(const_cast<unsigned char *>(data_), size_);
+}
+
+std::unique_ptr<CommitGraph> CommitGraph::Open(const fs::path &git_dir) {
+  fs::path path = GraphPath(git_dir);
+  if (!fs::exists(path)) {
+    return nullptr;
+  }
+  return std::make_unique<CommitGraph>(path);
+}
+
+std::optional<uint32_t> CommitGraph::Find(const std::string &hash) const {
+  unsigned char binary[20];
+  if (!HexToBinary(hash, binary)) {
+    return std::nullopt;
+  }
+  uint32_t lo = binary[0] ? GetBE32(fanout_ + (binary[0] - 1) * 4) : 0;
+  uint32_t hi = GetBE32(fanout_ + binary[0] * 4);
+  while (lo < hi) {
+    uint32_t mid = lo + (hi - lo) / 2;
+    int cmp = memcmp(oids_ + size_t(mid) * 20, binary, 20);
+    if (cmp == 0) {
+      return mid;
+    }
+    if (cmp < 0) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return std::nullopt;
+}
+
+std::string CommitGraph::HashAt(uint32_t pos) const {
+  return BinaryToHex(oids_ + size_t(pos) * 20);
+}
+
+std::string CommitGraph::TreeAt(uint32_t pos) const {
+  return BinaryToHex(cdat_ + size_t(pos) * kCommitDataSize);
+}
+
+void CommitGraph::ParentsAt(uint32_t pos,
+                            std::vector<uint32_t> &parents) const {
+  const unsigned char *entry = cdat_ + size_t(pos) * kCommitDataSize;
+  auto add = [&](uint32_t parent) {
+    if (parent >= count_) {
+      throw std::runtime_error("commit-graph: invalid parent position in " +
+                               path_.string());
+    }
+    parents.push_back(parent);
+  };
+  uint32_t first = GetBE32(entry + 20);
+  uint32_t second = GetBE32(entry + 24);
+  if (first == kParentNone) {
+    return;
+  }
+  add(first);
+  if (second == kParentNone) {
+    return;
+  }
+  if (!(second & kEdgeFlag)) {
+    add(second);
+    return;
+  }
+  // 章鱼合并：其余父提交在 EDGE 中，最后一个带最高位
+  for (size_t i = second & ~kEdgeFlag;; i++) {
+    if (i >= edge_count_) {
+      throw std::runtime_error("commit-graph: truncated edge list in " +
+                               path_.string());
+    }
+    uint32_t edge = GetBE32(edges_ + i * 4);
+    add(edge & ~kEdgeFlag);
+    if (edge & kEdgeFlag) {
+      break;
+    }
+  }
+}
+
+uint32_t CommitGraph::GenerationAt(uint32_t pos) const {
+  return GetBE32(cdat_ + size_t(pos) * kCommitDataSize + 28) >> 2;
+}
+
+int64_t CommitGraph::TimeAt(uint32_t pos) const {
+  const unsigned char *p = cdat_ + size_t(pos) * kCommitDataSize + 28;
+  return (int64_t(GetBE32(p) & 0x3) << 32) | GetBE32(p + 4);
+}
+
+std::string CommitGraph::Checksum() const {
+  return BinaryToHex(data_ + size_ - 20);
+}
+
+// ---- 编号与查询 ----
+
+CommitIndex::CommitIndex(const ObjectStore &store)
+    : store_(store), graph_(CommitGraph::Open(store.GitDir())) {
+  graph_count_ = graph_ ? graph_->Count() : 0;
+}
+
+uint32_t CommitIndex::Lookup(const std::string &hash) {
+  if (graph_) {
+    if (auto pos = graph_->Find(hash)) {
+      return *pos;
+    }
+  }
+  auto it = parsed_ids_.find(hash);
+  if (it != parsed_ids_.end()) {
+    return it->second;
+  }
+  auto object = store_.Read(hash);
+  if (!object) {
+    throw std::runtime_error("missing object " + hash);
+  }
+  if (object->type != ObjectType::kCommit) {
+    throw std::runtime_error("object " + hash + " is a " +
+                             ObjectTypeName(object->type) +
+                             ", expected commit");
+  }
+  CommitHeader header;
+  ParseCommitHeader(hash, object->data, header);
+  uint32_t id = graph_count_ + parsed_count_;
+  Parsed &commit = parsed_.At(parsed_count_++);
+  commit.hash = hash;
+  commit.tree = header.tree;
+  commit.time = header.time;
+  commit.parent_hashes.assign(header.parents.begin(), header.parents.end());
+  parsed_ids_.emplace(hash, id);
+  return id;
+}
+
+std::string CommitIndex::Hash(uint32_t id) const {
+  return id < graph_count_ ? graph_->HashAt(id)
+                           : parsed_.Peek(id - graph_count_)->hash;
+}
+
+std::string CommitIndex::Tree(uint32_t id) const {
+  return id < graph_count_ ? graph_->TreeAt(id)
+                           : parsed_.Peek(id - graph_count_)->tree;
+}
+
+int64_t CommitIndex::Time(uint32_t id) const {
+  return id < graph_count_ ? graph_->TimeAt(id)
+                           : parsed_.Peek(id - graph_count_)->time;
+}
+
+uint32_t CommitIndex::Generation(uint32_t id) const {
+  return id < graph_count_ ? graph_->GenerationAt(id) : kGenerationInfinity;
+}
+
+void CommitIndex::Parents(uint32_t id, std::vector<uint32_t> &parents) {
+  parents.clear();
+  if (id < graph_count_) {
+    graph_->ParentsAt(id, parents);
+    return;
+  }
+  Parsed &commit = parsed_.At(id - graph_count_);
+  if (!commit.resolved) {
+    for (const auto &parent : commit.parent_hashes) {
+      commit.parents.push_back(Lookup(parent));
+    }
+    commit.resolved = true;
+  }
+  parents = commit.parents;
+}
+
+// ---- 写入 ----
+
+size_t Write(const ObjectStore &store, const std::vector<std::string> &tips) {
+  TRACE_SPAN("commit-graph-write");
+  CommitIndex index(store);
+
+  // 收集可达提交及其父提交（编号）
+  std::vector<uint32_t> commits;
+  CommitSlab<char> seen;
+  std::vector<uint32_t> parents;
+  std::unordered_map<uint32_t, std::vector<uint32_t>> parent_lists;
+  std::vector<uint32_t> pending;
+  for (const auto &tip : tips) {
+    pending.push_back(index.Lookup(tip));
+  }
+  while (!pending.empty()) {
+    uint32_t id = pending.back();
+    pending.pop_back();
+    char &visited = seen.At(id);
+    if (visited) {
+      continue;
+    }
+    visited = 1;
+    commits.push_back(id);
+    index.Parents(id, parents);
+    pending.insert(pending.end(), parents.begin(), parents.end());
+    parent_lists.emplace(id, parents);
+  }
+  TRACE_COUNT("commit_graph_commits", commits.size());
+
+  // 按哈希排序得到新位置
+  std::vector<std::pair<std::string, uint32_t>> sorted;
+  sorted.reserve(commits.size());
+  for (uint32_t id : commits) {
+    unsigned char binary[20];
+    HexToBinary(index.Hash(id), binary);
+    sorted.emplace_back(std::string(reinterpret_cast<char *>(binary), 20), id);
+  }
+  std::sort(sorted.begin(), sorted.end());
+  std::unordered_map<uint32_t, uint32_t> position;
+  position.reserve(sorted.size());
+  for (uint32_t pos = 0; pos < sorted.size(); pos++) {
+    position.emplace(sorted[pos].second, pos);
+  }
+
+  // 代数：父提交都算出之后才能计算子提交，用显式栈避免深历史递归过深
+  std::vector<uint32_t> generation(sorted.size(), 0);
+  for (uint32_t start = 0; start < sorted.size(); start++) {
+    if (generation[start]) {
+      continue;
+    }
+    std::vector<uint32_t> stack = {start};
+    while (!stack.empty()) {
+      uint32_t pos = stack.back();
+      uint32_t max_parent = 0;
+      bool ready = true;
+      for (uint32_t parent : parent_lists.at(sorted[pos].second)) {
+        uint32_t parent_pos = position.at(parent);
+        if (!generation[parent_pos]) {
+          stack.push_back(parent_pos);
+          ready = false;
+        } else {
+          max_parent = std::max(max_parent, generation[parent_pos]);
+        }
+      }
+      if (ready) {
+        generation[pos] = std::min(max_parent + 1, kGenerationMax);
+        stack.pop_back();
+      }
+    }
+  }
+
+  std::string fanout, oids, cdat, edges;
+  uint32_t counts[256] = {0};
+  for (const auto &[binary, id] : sorted) {
+    counts[static_cast<unsigned char>(binary[0])]++;
+    oids += binary;
+  }
+  uint32_t total = 0;
+  for (uint32_t count : counts) {
+    total += count;
+    PutBE32(fanout, total);
+  }
+  for (uint32_t pos = 0; pos < sorted.size(); pos++) {
+    uint32_t id = sorted[pos].second;
+    unsigned char tree[20];
+    HexToBinary(index.Tree(id), tree);
+    cdat.append(reinterpret_cast<char *>(tree), 20);
+    const auto &list = parent_lists.at(id);
+    PutBE32(cdat, list.empty() ? kParentNone : position.at(list[0]));
+    if (list.size() <= 2) {
+      PutBE32(cdat, list.size() < 2 ? kParentNone : position.at(list[1]));
+    } else {
+      PutBE32(cdat, kEdgeFlag | static_cast<uint32_t>(edges.size() / 4));
+      for (size_t i = 1; i < list.size(); i++) {
+        uint32_t edge = position.at(list[i]);
+        PutBE32(edges, i + 1 == list.size() ? edge | kEdgeFlag : edge);
+      }
+    }
+    uint64_t time = static_cast<uint64_t>(index.Time(id)) & 0x3FFFFFFFFull;
+    PutBE64(cdat, (uint64_t(generation[pos]) << 34) | time);
+  }
+
+  std::vector<std::pair<uint32_t, const std::string *>> chunks = {
+      {kChunkOidFanout, &fanout},
+      {kChunkOidLookup, &oids},
+      {kChunkCommitData, &cdat}};
+  if (!edges.empty()) {
+    chunks.push_back({kChunkExtraEdges, &edges});
+  }
+  std::string out = "CGPH";
+  out.push_back(1); // 版本
+  out.push_back(1); // SHA-1
+  out.push_back(static_cast<char>(chunks.size()));
+  out.push_back(0); // 没有 base graph
+  uint64_t offset = kHeaderSize + (chunks.size() + 1) * kChunkEntrySize;
+  for (const auto &[id, chunk] : chunks) {
+    PutBE32(out, id);
+    PutBE64(out, offset);
+    offset += chunk->size();
+  }
+  PutBE32(out, 0);
+  PutBE64(out, offset);
+  for (const auto &chunk : chunks) {
+    out += *chunk.second;
+  }
+  unsigned char digest[SHA_DIGEST_LENGTH];
+  SHA1(reinterpret_cast<const unsigned char *>(out.data()), out.size(), digest);
+  out.append(reinterpret_cast<char *>(digest), SHA_DIGEST_LENGTH);
+
+  durability::WriteFileAtomically(
+      GraphPath(store.GitDir()), out, 0444,
+      durability::ConfiguredFsyncMethod(store.GitDir()));
+  return sorted.size();
+}
+
+// ---- 祖先查询 ----
+
+bool IsAncestor(CommitIndex &index, uint32_t ancestor, uint32_t descendant) {
+  uint32_t cutoff = index.Generation(ancestor);
+  CommitSlab<char> seen;
+  std::vector<uint32_t> pending = {descendant};
+  std::vector<uint32_t> parents;
+  while (!pending.empty()) {
+    uint32_t id = pending.back();
+    pending.pop_back();
+    if (id == ancestor) {
+      return true;
+    }
+    char &visited = seen.At(id);
+    if (visited) {
+      continue;
+    }
+    visited = 1;
+    // 代数不大于 ancestor 的其他提交不可能到达它；两者都不在
+    // commit-graph 中时代数都是无穷大，不能据此剪枝
+    uint32_t generation = index.Generation(id);
+    if (generation != kGenerationInfinity && generation <= cutoff) {
+      continue;
+    }
+    index.Parents(id, parents);
+    pending.insert(pending.end(), parents.begin(), parents.end());
+  }
+  return false;
+}
+
+std::vector<uint32_t> MergeBases(CommitIndex &index, uint32_t a, uint32_t b) {
+  if (a == b) {
+    return {a};
+  }
+  enum : uint8_t { kFromA = 1, kFromB = 2, kStale = 4, kResult = 8 };
+  struct Item {
+    uint32_t generation;
+    int64_t time;
+    uint32_t id;
+    bool operator<(const Item &other) const {
+      if (generation != other.generation) {
+        return generation < other.generation;
+      }
+      return time < other.time;
+    }
+  };
+  CommitSlab<uint8_t> flags;
+  CommitSlab<uint32_t> queued; // 每个提交在队列中的项数
+  size_t nonstale = 0;         // 队列中未过时提交的项数
+  std::priority_queue<Item> queue;
+  auto push = [&](uint32_t id) {
+    queue.push({index.Generation(id), index.Time(id), id});
+    queued.At(id)++;
+    if (!(flags.At(id) & kStale)) {
+      nonstale++;
+    }
+  };
+  auto mark = [&](uint32_t id, uint8_t mask) {
+    if ((mask & kStale) && !(flags.At(id) & kStale)) {
+      nonstale -= queued.At(id);
+    }
+    flags.At(id) |= mask;
+  };
+
+  mark(a, kFromA);
+  mark(b, kFromB);
+  push(a);
+  push(b);
+  std::vector<uint32_t> results;
+  std::vector<uint32_t> parents;
+  while (nonstale) {
+    Item item = queue.top();
+    queue.pop();
+    uint32_t id = item.id;
+    queued.At(id)--;
+    if (!(flags.At(id) & kStale)) {
+      nonstale--;
+    }
+    uint8_t paint = flags.At(id) & (kFromA | kFromB | kStale);
+    if (paint == (kFromA | kFromB)) {
+      if (!(flags.At(id) & kResult)) {
+        flags.At(id) |= kResult;
+        results.push_back(id);
+      }
+      paint |= kStale;
+    }
+    index.Parents(id, parents);
+    for (uint32_t parent : parents) {
+      if ((flags.At(parent) & paint) == paint) {
+        continue;
+      }
+      mark(parent, paint);
+      push(parent);
+    }
+  }
+
+  // 去掉过时的候选，以及是其他候选祖先的候选
+  std::erase_if(results, [&](uint32_t id) { return flags.At(id) & kStale; });
+  std::vector<uint32_t> bases;
+  for (uint32_t candidate : results) {
+    bool redundant = false;
+    for (uint32_t other : results) {
+      if (other != candidate && IsAncestor(index, candidate, other)) {
+        redundant = true;
+        break;
+      }
+    }
+    if (!redundant) {
+      bases.push_back(candidate);
+    }
+  }
+  return bases;
+}
+
+} // namespace commit_graph
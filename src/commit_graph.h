@@ -0,0 +1,225 @@
+#pragma once
+
+#include "object_store.h"
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * @brief commit-graph：.git/objects/info/commit-graph
+ *
+ * 历史遍历如果每次都解压提交对象再解析文本头部，代价与提交数成正比。
+ * commit-graph 把每个提交的根 tree、父提交、代数和提交时间存成定长的表，
+ * 读取时直接 mmap，父提交用表中的位置（整数）表示。文件格式与 Git 的
+ * version 1 相同，git commit-graph verify 可以校验：
+ *
+ *   "CGPH" <版本 1> <哈希版本 1> <chunk 数> <base graph 数 0>
+ *   chunk 目录：(<4字节 ID> <8字节偏移>)*，最后一项 ID 为 0、偏移为数据结尾
+ *   OIDF  256 个累计计数（按哈希第一字节），与 .idx 的 fanout 相同
+ *   OIDL  按哈希排序的 20 字节提交哈希
+ *   CDAT  每个提交 36 字节：根 tree 哈希、第一/第二个父提交的位置、
+ *         代数（高30位）和提交时间（低34位）
+ *   EDGE  多于两个父提交时，第二个位置最高位为1，低31位是本 chunk 的下标，
+ *         从那里开始依次是其余父提交的位置，最后一个的最高位为1
+ *   <20字节 SHA-1 校验和>
+ *
+ * 代数（generation）是提交到根提交的最长路径长度加1：父提交的代数一定
+ * 小于子提交，因此代数不大于 X 的提交不可能以 X 为祖先，祖先判断和
+ * merge-base 可以在遇到这样的提交时停止，而不必走到根提交。
+ */
+namespace commit_graph {
+
+// CDAT 中表示没有该父提交
+constexpr uint32_t kParentNone = 0x70000000;
+// 代数只有30位，更深的提交都记为这个值
+constexpr uint32_t kGenerationMax = 0x3FFFFFFF;
+// 不在 commit-graph 中的提交（写入之后的新提交）的代数，比任何记录的代数都大
+constexpr uint32_t kGenerationInfinity = 0xFFFFFFFF;
+
+// <git_dir>/objects/info/commit-graph
+std::filesystem::path GraphPath(const std::filesystem::path &git_dir);
+
+// 提交对象的头部，字符串字段都是指向对象内容的视图，提交说明不复制
+struct CommitHeader {
+  std::string_view tree;
+  std::vector<std::string_view> parents;
+  std::string_view author;    // "<name> <<email>> <秒数> <时区>"
+  std::string_view committer; // 同上
+  std::string_view message;   // 头部之后空行以后的全部内容
+  int64_t time = 0;           // committer 的时间
+};
+
+/**
+ * @brief 解析提交对象的头部，遇到空行停止，不扫描提交说明
+ * @param hash 只用于错误信息
+ * @throws std::runtime_error 缺少合法的 tree 行
+ */
+void ParseCommitHeader(const std::string &hash, std::string_view data,
+                       CommitHeader &header);
+
+/**
+ * @brief 只读的 commit-graph 文件
+ *
+ * 位置（pos）是提交在 OIDL 中的下标，即按哈希排序的序号。
+ */
+class CommitGraph {
+public:
+  /**
+   * @throws std::runtime_error 文件无法读取或格式错误
+   */
+  explicit CommitGraph(const std::filesystem::path &path);
+  ~CommitGraph();
+  CommitGraph(const CommitGraph &) = delete;
+  CommitGraph &operator=(const CommitGraph &) = delete;
+
+  /**
+   * @brief 打开 git_dir 中的 commit-graph
+   * @return 文件不存在时返回 nullptr
+   * @throws std::runtime_error 文件存在但格式错误
+   */
+  static std::unique_ptr<CommitGraph> Open(const std::filesystem::path &git_dir);
+
+  uint32_t Count() const { return count_; }
+  std::optional<uint32_t> Find(const std::string &hash) const;
+
+  std::string HashAt(uint32_t pos) const;
+  std::string TreeAt(uint32_t pos) const;
+  /**
+   * @brief 把父提交的位置按提交中的顺序追加到 parents
+   * @throws std::runtime_error 位置越界或 EDGE 数据损坏
+   */
+  void ParentsAt(uint32_t pos, std::vector<uint32_t> &parents) const;
+  uint32_t GenerationAt(uint32_t pos) const;
+  int64_t TimeAt(uint32_t pos) const;
+
+  // 文件末尾的校验和（40字符十六进制）
+  std::string Checksum() const;
+
+private:
+  std::filesystem::path path_;
+  const unsigned char *data_ = nullptr;
+  size_t size_ = 0;
+  uint32_t count_ = 0;
+  const unsigned char *fanout_ = nullptr;
+  const unsigned char *oids_ = nullptr;
+  const unsigned char *cdat_ = nullptr;
+  const unsigned char *edges_ = nullptr;
+  size_t edge_count_ = 0;
+};
+
+/**
+ * @brief 以提交编号（见 CommitIndex）为下标的附加数据
+ *
+ * 按固定大小的块分配，块一旦分配就不再移动，所以 At() 返回的引用在之后
+ * 访问更大编号时仍然有效（std::vector 扩容会使引用失效）；相邻编号的数据
+ * 在同一块中连续存放。没有访问过的编号对应值初始化的 T。
+ */
+template <typename T, size_t kSlabSize = 1024> class CommitSlab {
+public:
+  T &At(uint32_t id) {
+    size_t slab = id / kSlabSize;
+    if (slab >= slabs_.size()) {
+      slabs_.resize(slab + 1);
+    }
+    if (!slabs_[slab]) {
+      slabs_[slab] = std::make_unique<T[]>(kSlabSize);
+    }
+    return slabs_[slab][id % kSlabSize];
+  }
+
+  // 所在的块还没有分配时返回 nullptr，不分配
+  const T *Peek(uint32_t id) const {
+    size_t slab = id / kSlabSize;
+    if (slab >= slabs_.size() || !slabs_[slab]) {
+      return nullptr;
+    }
+    return &slabs_[slab][id % kSlabSize];
+  }
+
+private:
+  std::vector<std::unique_ptr<T[]>> slabs_;
+};
+
+/**
+ * @brief 提交的祖先关系查询
+ *
+ * 每个提交有一个编号：在 commit-graph 中的提交就是它的位置，数据直接读取
+ * mmap 的表；不在其中的提交解析对象后缓存，编号从 commit-graph 的提交数
+ * 开始分配。没有 commit-graph 文件时全部提交都走解析路径，结果相同，
+ * 只是更慢。
+ */
+class CommitIndex {
+public:
+  explicit CommitIndex(const ObjectStore &store);
+
+  const CommitGraph *Graph() const { return graph_.get(); }
+
+  /**
+   * @brief 取得提交的编号
+   * @throws std::runtime_error 对象不存在或不是提交
+   */
+  uint32_t Lookup(const std::string &hash);
+
+  // 已分配的编号个数，编号都小于它
+  size_t Size() const { return graph_count_ + parsed_count_; }
+
+  std::string Hash(uint32_t id) const;
+  std::string Tree(uint32_t id) const;
+  int64_t Time(uint32_t id) const;
+  // 不在 commit-graph 中的提交为 kGenerationInfinity
+  uint32_t Generation(uint32_t id) const;
+
+  /**
+   * @brief 父提交的编号，按提交中的顺序写入 parents（先清空）
+   * @throws std::runtime_error 父提交缺失或损坏
+   */
+  void Parents(uint32_t id, std::vector<uint32_t> &parents);
+
+private:
+  struct Parsed {
+    std::string hash;
+    std::string tree;
+    int64_t time = 0;
+    std::vector<std::string> parent_hashes;
+    std::vector<uint32_t> parents;
+    bool resolved = false; // parents 是否已经由 parent_hashes 查出
+  };
+
+  const ObjectStore &store_;
+  std::unique_ptr<CommitGraph> graph_;
+  uint32_t graph_count_ = 0;
+  CommitSlab<Parsed> parsed_; // 下标为编号减去 graph_count_
+  uint32_t parsed_count_ = 0;
+  std::unordered_map<std::string, uint32_t> parsed_ids_;
+};
+
+/**
+ * @brief 把从 tips 可达的全部提交写入 commit-graph，替换已有文件
+ *
+ * 已在旧 commit-graph 中的提交直接复制其数据，只有之后的新提交需要解析。
+ * @return 写入的提交数
+ * @throws std::runtime_error 可达提交缺失或损坏、写入失败
+ */
+size_t Write(const ObjectStore &store, const std::vector<std::string> &tips);
+
+/**
+ * @brief ancestor 是否是 descendant 本身或其祖先
+ *
+ * 从 descendant 向下遍历，跳过代数不大于 ancestor 的提交。
+ */
+bool IsAncestor(CommitIndex &index, uint32_t ancestor, uint32_t descendant);
+
+/**
+ * @brief a 和 b 的最佳共同祖先（不是其他共同祖先的祖先），没有时为空
+ *
+ * 按代数从大到小同时从两边向下着色，两种颜色相遇的提交是候选，其祖先
+ * 被标记为过时；所有待处理的提交都过时后停止。
+ */
+std::vector<uint32_t> MergeBases(CommitIndex &index, uint32_t a, uint32_t b);
+
+} // namespace commit_graph
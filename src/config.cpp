@@ -0,0 +1,245 @@
+#include "config.h"
+#include "durability.h"
+#include <algorithm>
+#include <cctype>
+#include <fstream>
+#include <stdexcept>
+#include <vector>
+
+namespace {
+
+std::string Lower(std::string text) {
+  std::transform(text.begin(), text.end(), text.begin(),
+                 [](unsigned char c) { return std::tolower(c); });
+  return text;
+}
+
+std::string Trim(const std::string &text) {
+  size_t begin = text.find_first_not_of(" \t\r");
+  if (begin == std::string::npos) {
+    return "";
+  }
+  size_t end = text.find_last_not_of(" \t\r");
+  return text.substr(begin, end - begin + 1);
+}
+
+// 去掉值两端的引号和行尾注释，处理 \" \\ \n \t 转义；引号外两端的空白
+// 被去掉，引号内的保留
+std::string ParseValue(const std::string &raw) {
+  std::string value;
+  size_t keep = 0; // 最后一个引号内字符或非空白字符之后的长度
+  bool quoted = false;
+  for (size_t i = 0; i < raw.size(); i++) {
+    char c = raw[i];
+    if (c == '"') {
+      quoted = !quoted;
+      continue;
+    }
+    bool space = c == ' ' || c == '\t' || c == '\r';
+    if (c == '\\' && i + 1 < raw.size()) {
+      char next = raw[++i];
+      value.push_back(next == 'n' ? '\n' : next == 't' ? '\t' : next);
+      space = false;
+    } else if ((c == '#' || c == ';') && !quoted) {
+      break;
+    } else if (space && !quoted && value.empty()) {
+      continue;
+    } else {
+      value.push_back(c);
+    }
+    if (quoted || !space) {
+      keep = value.size();
+    }
+  }
+  value.resize(keep);
+  return value;
+}
+
+// 写回时转义 ParseValue 处理的字符；两端有空白或含注释符时加引号
+std::string FormatValue(const std::string &value) {
+  std::string escaped;
+  for (char c : value) {
+    if (c == '\\' || c == '"') {
+      escaped.push_back('\\');
+      escaped.push_back(c);
+    } else if (c == '\n') {
+      escaped += "\\n";
+    } else if (c == '\t') {
+      escaped += "\\t";
+    } else {
+      escaped.push_back(c);
+    }
+  }
+  bool quote = value.find_first_of("#;") != std::string::npos ||
+               (!value.empty() && (std::isspace((unsigned char)value.front()) ||
+                                   std::isspace((unsigned char)value.back())));
+  return quote ? '"' + escaped + '"' : escaped;
+}
+
+// 解析 "[section]" 或 "[section "sub"]"，返回 "section" 或 "section.sub"
+std::string ParseSection(const std::string &line) {
+  size_t close = line.rfind(']');
+  std::string header =
+      line.substr(1, close == std::string::npos ? std::string::npos : close - 1);
+  size_t quote = header.find('"');
+  if (quote == std::string::npos) {
+    return Lower(Trim(header));
+  }
+  std::string sub = header.substr(quote + 1);
+  sub = sub.substr(0, sub.rfind('"'));
+  return Lower(Trim(header.substr(0, quote))) + "." + sub;
+}
+
+// 规范化键名：节名和键名转小写，子节名保持原样
+std::string NormalizeKey(const std::string &key) {
+  size_t first = key.find('.');
+  size_t last = key.rfind('.');
+  if (first == std::string::npos) {
+    return Lower(key);
+  }
+  return Lower(key.substr(0, first)) + key.substr(first, last - first) +
+         Lower(key.substr(last));
+}
+
+} // namespace
+
+Config::Config(const std::filesystem::path &git_dir) : git_dir_(git_dir) {
+  std::ifstream file(git_dir / "config");
+  std::string section;
+  std::string line;
+  while (std::getline(file, line)) {
+    line = Trim(line);
+    if (line.empty() || line[0] == '#' || line[0] == ';') {
+      continue;
+    }
+    if (line[0] == '[') {
+      section = ParseSection(line);
+      continue;
+    }
+    size_t eq = line.find('=');
+    std::string name = Lower(Trim(line.substr(0, eq)));
+    std::string value =
+        eq == std::string::npos ? "true" : ParseValue(line.substr(eq + 1));
+    values_[section + "." + name] = value;
+  }
+}
+
+std::optional<std::string> Config::Get(const std::string &key) const {
+  auto it = values_.find(NormalizeKey(key));
+  if (it == values_.end()) {
+    return std::nullopt;
+  }
+  return it->second;
+}
+
+void Config::Set(const std::string &key, const std::string &value) {
+  Rewrite(key, value);
+}
+
+void Config::Unset(const std::string &key) { Rewrite(key, std::nullopt); }
+
+void Config::Rewrite(const std::string &key,
+                     const std::optional<std::string> &value) {
+  size_t first = key.find('.');
+  size_t last = key.rfind('.');
+  if (first == std::string::npos || first == 0 || last + 1 == key.size()) {
+    throw std::invalid_argument("key does not contain a section: " + key);
+  }
+  std::string normalized = NormalizeKey(key);
+  std::string target = normalized.substr(0, normalized.rfind('.'));
+  std::string name = normalized.substr(normalized.rfind('.') + 1);
+
+  // 去掉旧值，记下最后一个旧值的位置和该节最后一行之后的位置
+  std::ifstream in(git_dir_ / "config");
+  std::vector<std::string> lines;
+  size_t match_at = std::string::npos;
+  size_t section_end = std::string::npos;
+  std::string section;
+  for (std::string line; std::getline(in, line);) {
+    std::string text = Trim(line);
+    if (!text.empty() && text[0] == '[') {
+      section = ParseSection(text);
+    } else if (section == target && !text.empty() && text[0] != '#' &&
+               text[0] != ';' &&
+               Lower(Trim(text.substr(0, text.find('=')))) == name) {
+      match_at = lines.size();
+      continue;
+    }
+    lines.push_back(line);
+    if (section == target) {
+      section_end = lines.size();
+    }
+  }
+  if (!value && match_at == std::string::npos) {
+    return; // 没有要删除的值
+  }
+  if (value) {
+    std::string entry = "\t" + key.substr(last + 1) + " = " + FormatValue(*value);
+    size_t insert_at = match_at != std::string::npos ? match_at : section_end;
+    if (insert_at == std::string::npos) {
+      std::string header = key.substr(0, first);
+      if (first != last) {
+        header += " \"" + key.substr(first + 1, last - first - 1) + "\"";
+      }
+      lines.push_back("[" + header + "]");
+      lines.push_back(entry);
+    } else {
+      lines.insert(lines.begin() + insert_at, entry);
+    }
+  }
+
+  std::string content;
+  for (const auto &line : lines) {
+    content += line + '\n';
+  }
+  durability::WriteFileAtomically(git_dir_ / "config", content, 0644,
+                                  durability::ConfiguredFsyncMethod(git_dir_));
+  if (value) {
+    values_[normalized] = *value;
+  } else {
+    values_.erase(normalized);
+  }
+}
+
+int64_t ParseConfigInt(const std::string &value) {
+  size_t used = 0;
+  int64_t number = 0;
+  try {
+    number = std::stoll(value, &used);
+  } catch (const std::exception &) {
+    throw std::invalid_argument("bad numeric config value '" + value + "'");
+  }
+  std::string suffix = Lower(value.substr(used));
+  if (suffix == "k") {
+    number <<= 10;
+  } else if (suffix == "m") {
+    number <<= 20;
+  } else if (suffix == "g") {
+    number <<= 30;
+  } else if (!suffix.empty()) {
+    throw std::invalid_argument("bad numeric config value '" + value + "'");
+  }
+  return number;
+}
+
+int64_t Config::GetInt(const std::string &key, int64_t default_value) const {
+  auto value = Get(key);
+  return value ? ParseConfigInt(*value) : default_value;
+}
+
+bool Config::GetBool(const std::string &key, bool default_value) const {
+  auto value = Get(key);
+  if (!value) {
+    return default_value;
+  }
+  std::string lower = Lower(*value);
+  if (lower == "true" || lower == "yes" || lower == "on" || lower == "1") {
+    return true;
+  }
+  if (lower == "false" || lower == "no" || lower == "off" || lower == "0" ||
+      lower.empty()) {
+    return false;
+  }
+  throw std::invalid_argument("bad boolean config value '" + *value +
+                              "' for " + key);
+}
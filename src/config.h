@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <optional>
+#include <string>
+
+/**
+ * @brief 仓库配置（.git/config，与 Git 的格式相同）
+ *
+ *   [pack]
+ *       threads = 8
+ *       windowMemory = 256m
+ *   [remote "origin"]
+ *       url = https://example.com/repo.git
+ *
+ * 键名写作 "section.key" 或 "section.subsection.key"。节名和键名不区分
+ * 大小写，子节名区分大小写。同一个键出现多次时最后一次生效。
+ * 文件不存在时所有键都视为未设置。
+ *
+ * Set/Unset 按行改写文件，保留其它行（包括注释）不变，并通过
+ * durability::WriteFileAtomically 整体替换，读者不会看到写了一半的配置。
+ */
+class Config {
+public:
+  explicit Config(const std::filesystem::path &git_dir = ".git");
+
+  std::optional<std::string> Get(const std::string &key) const;
+
+  /**
+   * @brief 读取整数，支持 k/m/g 后缀（1024 进制）
+   * @throws std::invalid_argument 值不是合法的整数
+   */
+  int64_t GetInt(const std::string &key, int64_t default_value) const;
+
+  // true/yes/on/1 与 false/no/off/0，只写键名不写值表示 true
+  bool GetBool(const std::string &key, bool default_value) const;
+
+  /**
+   * @brief 设置键的值，对应 git config <key> <value>
+   *
+   * 键已存在时在原位置替换（出现多次时只保留最后一处），否则追加到该节
+   * 末尾，节不存在时在文件末尾新建。
+   * @throws std::invalid_argument 键名不含节名
+   * @throws std::runtime_error 写入失败
+   */
+  void Set(const std::string &key, const std::string &value);
+
+  /**
+   * @brief 删除键的所有值，对应 git config --unset-all <key>
+   * @throws std::runtime_error 写入失败
+   */
+  void Unset(const std::string &key);
+
+private:
+  void Rewrite(const std::string &key, const std::optional<std::string> &value);
+
+  std::filesystem::path git_dir_;
+  std::map<std::string, std::string> values_;
+};
+
+/**
+ * @brief 解析带 k/m/g 后缀的整数，例如 "256m"
+ * @throws std::invalid_argument 格式错误
+ */
+int64_t ParseConfigInt(const std::string &value);
@@ -0,0 +1,280 @@
+#include "delta.h"
+#include <algorithm>
+#include <stdexcept>
+#include <string.h>
+
+namespace {
+
+// 读取 delta 头部的变长整数
+size_t read_delta_size(const unsigned char *data, size_t size, size_t &pos) {
+  size_t value = 0;
+  int shift = 0;
+  while (true) {
+    if (pos >= size) {
+      throw std::runtime_error("delta: truncated header");
+    }
+    if (shift > 56) {
+      throw std::runtime_error("delta: header size overflow");
+    }
+    unsigned char byte = data[pos++];
+    value |= static_cast<size_t>(byte & 0x7F) << shift;
+    if (!(byte & 0x80)) {
+      return value;
+    }
+    shift += 7;
+  }
+}
+
+constexpr uint32_t kHashMultiplier = 0x01000193;
+constexpr size_t kMaxChain = 64;          // 每个桶最多比较的候选块数
+constexpr size_t kMaxCopySize = 0xFFFFFF; // COPY 长度最多3字节
+
+uint32_t window_hash(const unsigned char *p) {
+  uint32_t hash = 0;
+  for (size_t i = 0; i < DeltaIndex::kWindow; i++) {
+    hash = hash * kHashMultiplier + p[i];
+  }
+  return hash;
+}
+
+// kHashMultiplier^(kWindow-1)，用于滚动时移出窗口最左边的字节
+uint32_t outgoing_factor() {
+  uint32_t factor = 1;
+  for (size_t i = 1; i < DeltaIndex::kWindow; i++) {
+    factor *= kHashMultiplier;
+  }
+  return factor;
+}
+
+void put_delta_size(std::string &out, size_t size) {
+  while (size >= 0x80) {
+    out.push_back(static_cast<char>((size & 0x7F) | 0x80));
+    size >>= 7;
+  }
+  out.push_back(static_cast<char>(size));
+}
+
+// 把 [data, data+size) 写成若干条 ADD 指令（每条最多127字节）
+void put_add(std::string &out, const char *data, size_t size) {
+  while (size > 0) {
+    size_t chunk = size < 0x7F ? size : 0x7F;
+    out.push_back(static_cast<char>(chunk));
+    out.append(data, chunk);
+    data += chunk;
+    size -= chunk;
+  }
+}
+
+// COPY 指令只写出非零的偏移量和长度字节
+void put_copy(std::string &out, size_t offset, size_t size) {
+  size_t op_pos = out.size();
+  unsigned char op = 0x80;
+  out.push_back(0);
+  for (int i = 0; i < 4; i++) {
+    unsigned char byte = (offset >> (i * 8)) & 0xFF;
+    if (byte) {
+      op |= 1 << i;
+      out.push_back(static_cast<char>(byte));
+    }
+  }
+  for (int i = 0; i < 3; i++) {
+    unsigned char byte = (size >> (i * 8)) & 0xFF;
+    if (byte) {
+      op |= 0x10 << i;
+      out.push_back(static_cast<char>(byte));
+    }
+  }
+  out[op_pos] = static_cast<char>(op);
+}
+
+} // namespace
+
+DeltaHeader parse_delta_header(const char *delta, size_t delta_size) {
+  const auto *data = reinterpret_cast<const unsigned char *>(delta);
+  DeltaHeader header;
+  size_t pos = 0;
+  header.base_size = read_delta_size(data, delta_size, pos);
+  header.target_size = read_delta_size(data, delta_size, pos);
+  header.instructions = pos;
+  return header;
+}
+
+size_t apply_delta_into(const char *delta, size_t delta_size, const char *base,
+                        size_t base_size, char *out, size_t out_capacity) {
+  const auto *data = reinterpret_cast<const unsigned char *>(delta);
+  DeltaHeader header = parse_delta_header(delta, delta_size);
+  if (header.base_size != base_size) {
+    throw std::runtime_error("delta: base size mismatch (expected " +
+                             std::to_string(header.base_size) + ", got " +
+                             std::to_string(base_size) + ")");
+  }
+  if (header.target_size > out_capacity) {
+    throw std::runtime_error("delta: output buffer too small");
+  }
+
+  size_t pos = header.instructions;
+  size_t written = 0;
+  while (pos < delta_size) {
+    unsigned char instruction = data[pos++];
+    if (instruction & 0x80) { // COPY：偏移量 b0-b3，长度 b4-b6，均为小端序
+      size_t copy_offset = 0;
+      size_t copy_size = 0;
+      for (int i = 0; i < 4; i++) {
+        if (instruction & (1 << i)) {
+          if (pos >= delta_size) {
+            throw std::runtime_error("delta: truncated copy offset");
+          }
+          copy_offset |= static_cast<size_t>(data[pos++]) << (i * 8);
+        }
+      }
+      for (int i = 0; i < 3; i++) {
+        if (instruction & (0x10 << i)) {
+          if (pos >= delta_size) {
+            throw std::runtime_error("delta: truncated copy size");
+          }
+          copy_size |= static_cast<size_t>(data[pos++]) << (i * 8);
+        }
+      }
+      // 长度为0表示 0x10000 字节
+      if (copy_size == 0) {
+        copy_size = 0x10000;
+      }
+      if (copy_offset > base_size || copy_size > base_size - copy_offset) {
+        throw std::runtime_error("delta: copy out of base bounds");
+      }
+      if (copy_size > header.target_size - written) {
+        throw std::runtime_error("delta: copy exceeds target size");
+      }
+      memcpy(out + written, base + copy_offset, copy_size);
+      written += copy_size;
+    } else if (instruction != 0) { // ADD：低7位为紧随其后的字面数据长度
+      size_t add_size = instruction;
+      if (add_size > delta_size - pos) {
+        throw std::runtime_error("delta: truncated add data");
+      }
+      if (add_size > header.target_size - written) {
+        throw std::runtime_error("delta: add exceeds target size");
+      }
+      memcpy(out + written, delta + pos, add_size);
+      written += add_size;
+      pos += add_size;
+    } else {
+      throw std::runtime_error("delta: reserved instruction 0");
+    }
+  }
+  if (written != header.target_size) {
+    throw std::runtime_error("delta: result size mismatch");
+  }
+  return written;
+}
+
+void apply_delta_to(const std::string &delta, const std::string &base,
+                    std::string &out) {
+  DeltaHeader header = parse_delta_header(delta.data(), delta.size());
+  out.resize(header.target_size); // 已有容量足够时不会重新分配
+  apply_delta_into(delta.data(), delta.size(), base.data(), base.size(),
+                   out.data(), out.size());
+}
+
+DeltaIndex::DeltaIndex(const char *base, size_t base_size)
+    : base_(base), base_size_(base_size) {
+  if (base_size > UINT32_MAX) {
+    throw std::runtime_error("delta: base object too large");
+  }
+  size_t blocks = base_size / kWindow;
+  uint32_t buckets = 16;
+  while (buckets < blocks) {
+    buckets <<= 1;
+  }
+  mask_ = buckets - 1;
+  heads_.assign(buckets, 0);
+  next_.assign(blocks, 0);
+  const auto *data = reinterpret_cast<const unsigned char *>(base);
+  // 倒序插入，使链表头部是偏移最小的块
+  for (size_t block = blocks; block-- > 0;) {
+    uint32_t bucket = window_hash(data + block * kWindow) & mask_;
+    next_[block] = heads_[bucket];
+    heads_[bucket] = block + 1;
+  }
+}
+
+std::string DeltaIndex::CreateDelta(const char *target, size_t target_size,
+                                    size_t max_delta_size) const {
+  const auto *base = reinterpret_cast<const unsigned char *>(base_);
+  const auto *data = reinterpret_cast<const unsigned char *>(target);
+  static const uint32_t out_factor = outgoing_factor();
+
+  std::string out;
+  put_delta_size(out, base_size_);
+  put_delta_size(out, target_size);
+
+  size_t literal_start = 0; // 尚未输出的字面数据起点
+  size_t pos = 0;
+  bool have_hash = false;
+  uint32_t hash = 0;
+  while (pos + kWindow <= target_size && !next_.empty()) {
+    if (!have_hash) {
+      hash = window_hash(data + pos);
+      have_hash = true;
+    }
+    size_t best_offset = 0;
+    size_t best_size = 0;
+    size_t chain = 0;
+    for (uint32_t entry = heads_[hash & mask_]; entry && chain < kMaxChain;
+         entry = next_[entry - 1], chain++) {
+      size_t offset = static_cast<size_t>(entry - 1) * kWindow;
+      size_t limit = std::min(base_size_ - offset, target_size - pos);
+      limit = std::min(limit, kMaxCopySize);
+      size_t size = 0;
+      while (size < limit && base[offset + size] == data[pos + size]) {
+        size++;
+      }
+      if (size > best_size) {
+        best_size = size;
+        best_offset = offset;
+      }
+    }
+
+    if (best_size < kWindow) {
+      // 未命中：当前字节并入字面数据，窗口右移一字节
+      if (pos + kWindow < target_size) {
+        hash = (hash - data[pos] * out_factor) * kHashMultiplier +
+               data[pos + kWindow];
+      } else {
+        have_hash = false;
+      }
+      pos++;
+      if (max_delta_size && out.size() + (pos - literal_start) > max_delta_size) {
+        return {};
+      }
+      continue;
+    }
+
+    // 命中：向前吞并与基础对象相同的字面数据
+    while (pos > literal_start && best_offset > 0 &&
+           best_size < kMaxCopySize &&
+           base[best_offset - 1] == data[pos - 1]) {
+      pos--;
+      best_offset--;
+      best_size++;
+    }
+    put_add(out, target + literal_start, pos - literal_start);
+    put_copy(out, best_offset, best_size);
+    pos += best_size;
+    literal_start = pos;
+    have_hash = false;
+    if (max_delta_size && out.size() > max_delta_size) {
+      return {};
+    }
+  }
+  put_add(out, target + literal_start, target_size - literal_start);
+  if (max_delta_size && out.size() > max_delta_size) {
+    return {};
+  }
+  return out;
+}
+
+std::string create_delta(const std::string &base, const std::string &target,
+                         size_t max_delta_size) {
+  return DeltaIndex(base).CreateDelta(target, max_delta_size);
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Git delta 引擎
+ *
+ * delta 数据由头部的两个变长整数（基础对象长度、目标对象长度，每字节7位，
+ * 小端序）和随后的 COPY/ADD 指令流组成，详见 clone_gadget.cpp 中
+ * apply_delta() 上方的格式说明。
+ *
+ * 与逐条 append 的实现相比，这里：
+ * - 先读出目标长度，一次性准备好输出缓冲区；
+ * - COPY 指令直接 memcpy 到输出缓冲区；
+ * - 所有偏移量和长度都会与基础对象、delta 数据和目标长度做边界检查，
+ *   非法的 delta 会抛出 std::runtime_error，而不是越界读写。
+ */
+struct DeltaHeader {
+  size_t base_size = 0;
+  size_t target_size = 0;
+  size_t instructions = 0; // 第一条指令在 delta 数据中的偏移
+};
+
+/**
+ * @brief 解析 delta 头部
+ * @throws std::runtime_error 头部被截断或长度溢出
+ */
+DeltaHeader parse_delta_header(const char *delta, size_t delta_size);
+
+/**
+ * @brief 把 delta 应用到基础对象，结果写入调用者提供的缓冲区
+ * @param out 输出缓冲区（例如 arena 中的一块内存），至少 out_capacity 字节
+ * @param out_capacity 缓冲区大小，必须不小于 delta 头中的目标长度
+ * @return 写入的字节数（等于目标长度）
+ * @throws std::runtime_error delta 非法、越界或与基础对象长度不匹配
+ */
+size_t apply_delta_into(const char *delta, size_t delta_size, const char *base,
+                        size_t base_size, char *out, size_t out_capacity);
+
+/**
+ * @brief 把 delta 应用到基础对象，结果写入 out
+ * @note out 的已有容量会被复用，长 delta 链上交替使用两个 string 即可避免
+ *       每一环都重新分配内存
+ */
+void apply_delta_to(const std::string &delta, const std::string &base,
+                    std::string &out);
+
+/**
+ * @brief 基础对象的滚动哈希索引，用于生成 delta
+ *
+ * 把基础对象按 kWindow 字节切块，每块的多项式哈希记入哈希表。生成 delta 时
+ * 在目标对象上滑动同样大小的窗口、逐字节滚动更新哈希，命中后逐字节确认并
+ * 向前后扩展匹配，输出 COPY；未命中的字节累积成 ADD。
+ *
+ * 一个索引可以与多个目标对象比较（repack 的滑动窗口中每个候选基础对象只
+ * 建一次索引）。索引只保存指针，基础对象必须比索引活得久。
+ */
+class DeltaIndex {
+public:
+  static constexpr size_t kWindow = 16;
+
+  DeltaIndex(const char *base, size_t base_size);
+  explicit DeltaIndex(const std::string &base)
+      : DeltaIndex(base.data(), base.size()) {}
+
+  /**
+   * @brief 生成把基础对象变为 target 的 delta
+   * @param max_delta_size 大于0时，delta 超过此长度立即放弃并返回空字符串
+   * @return delta 数据；放弃时为空字符串
+   */
+  std::string CreateDelta(const char *target, size_t target_size,
+                          size_t max_delta_size = 0) const;
+  std::string CreateDelta(const std::string &target,
+                          size_t max_delta_size = 0) const {
+    return CreateDelta(target.data(), target.size(), max_delta_size);
+  }
+
+  size_t BaseSize() const { return base_size_; }
+  // 索引本身占用的内存（不含基础对象）
+  size_t MemoryUsage() const {
+    return (heads_.size() + next_.size()) * sizeof(uint32_t);
+  }
+
+private:
+  const char *base_;
+  size_t base_size_;
+  uint32_t mask_ = 0;
+  std::vector<uint32_t> heads_; // 哈希桶 -> 第一个块编号+1（0表示空）
+  std::vector<uint32_t> next_;  // 同一桶内的下一个块编号+1
+};
+
+// 一次性生成 delta 的便捷接口
+std::string create_delta(const std::string &base, const std::string &target,
+                         size_t max_delta_size = 0);
@@ -0,0 +1,280 @@
+#include "dircache.h"
+#include "byte_util.h"
+#include "durability.h"
+#include <algorithm>
+#include <cerrno>
+#include <fcntl.h>
+#include <iterator>
+#include <openssl/sha.h>
+#include <sys/mman.h>
+#include <stdexcept>
+#include <string.h>
+#include <string_view>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+using byte_util::BinaryToHex;
+using byte_util::GetBE32;
+using byte_util::HexToBinary;
+using byte_util::PutBE16;
+using byte_util::PutBE32;
+using durability::WriteAll;
+
+namespace dircache {
+namespace {
+
+constexpr size_t kHeaderSize = 12;
+// 条目中路径之前的固定部分：10 个 4 字节字段、哈希和标志
+constexpr size_t kEntryFixedSize = 62;
+constexpr uint16_t kFlagExtended = 0x4000;
+// version 3 的扩展标志
+constexpr uint16_t kFlagSkipWorktree = 0x4000;
+constexpr uint16_t kNameMask = 0x0FFF;
+
+} // namespace
+
+StatData StatData::From(const struct stat &st) {
+  StatData data;
+  data.ctime_sec = st.st_ctim.tv_sec;
+  data.ctime_nsec = st.st_ctim.tv_nsec;
+  data.mtime_sec = st.st_mtim.tv_sec;
+  data.mtime_nsec = st.st_mtim.tv_nsec;
+  data.dev = st.st_dev;
+  data.ino = st.st_ino;
+  data.uid = st.st_uid;
+  data.gid = st.st_gid;
+  data.size = st.st_size;
+  return data;
+}
+
+Hash &Hash::operator=(std::string_view hex) {
+  if (hex.size() > sizeof(hex_)) {
+    throw std::runtime_error("index: bad hash " + std::string(hex));
+  }
+  memcpy(hex_, hex.data(), hex.size());
+  size_ = hex.size();
+  return *this;
+}
+
+Index Index::Read(const fs::path &path, bool verify_checksum) {
+  Index index;
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    if (errno == ENOENT) {
+      return index;
+    }
+    throw std::runtime_error("index: cannot open " + path.string());
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    throw std::runtime_error("index: cannot stat " + path.string());
+  }
+  index.exists_ = true;
+  index.mtime_sec_ = st.st_mtim.tv_sec;
+  index.mtime_nsec_ = st.st_mtim.tv_nsec;
+  // 映射整个文件，省去读入缓冲区的复制（大仓库的 index 有几十 MB）
+  size_t size = st.st_size;
+  void *map = size ? mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0)
+                   : MAP_FAILED;
+  close(fd);
+  if (map == MAP_FAILED && size) {
+    throw std::runtime_error("index: cannot map " + path.string());
+  }
+  struct Unmap {
+    void *map;
+    size_t size;
+    ~Unmap() {
+      if (map != MAP_FAILED) {
+        munmap(map, size);
+      }
+    }
+  } unmap{map, size};
+  std::string_view data(
+      map == MAP_FAILED ? "" : static_cast<const char *>(map), size);
+
+  auto fail = [&](const std::string &what) {
+    throw std::runtime_error("index: " + what + " in " + path.string());
+  };
+  const auto *p = reinterpret_cast<const unsigned char *>(data.data());
+  if (data.size() < kHeaderSize + 20 || memcmp(p, "DIRC", 4) != 0) {
+    fail("bad signature");
+  }
+  uint32_t version = GetBE32(p + 4);
+  if (version != 2 && version != 3) {
+    fail("unsupported version " + std::to_string(version));
+  }
+  size_t end = data.size() - 20;
+  if (verify_checksum) {
+    unsigned char digest[SHA_DIGEST_LENGTH];
+    SHA1(p, end, digest);
+    if (memcmp(digest, p + end, SHA_DIGEST_LENGTH) != 0) {
+      fail("checksum mismatch");
+    }
+  }
+  index.checksum_ = BinaryToHex(p + end);
+
+  uint32_t count = GetBE32(p + 8);
+  index.entries_.reserve(count);
+  size_t offset = kHeaderSize;
+  for (uint32_t i = 0; i < count; i++) {
+    if (offset + kEntryFixedSize > end) {
+      fail("truncated entry");
+    }
+    const unsigned char *e = p + offset;
+    IndexEntry entry;
+    entry.stat.ctime_sec = GetBE32(e);
+    entry.stat.ctime_nsec = GetBE32(e + 4);
+    entry.stat.mtime_sec = GetBE32(e + 8);
+    entry.stat.mtime_nsec = GetBE32(e + 12);
+    entry.stat.dev = GetBE32(e + 16);
+    entry.stat.ino = GetBE32(e + 20);
+    entry.mode = GetBE32(e + 24);
+    entry.stat.uid = GetBE32(e + 28);
+    entry.stat.gid = GetBE32(e + 32);
+    entry.stat.size = GetBE32(e + 36);
+    char hex[40];
+    BinaryToHex(e + 40, hex);
+    entry.hash = std::string_view(hex, sizeof(hex));
+    uint16_t flags = (e[60] << 8) | e[61];
+    entry.stage = (flags >> 12) & 0x3;
+    size_t name_start = kEntryFixedSize;
+    if (flags & kFlagExtended) {
+      if (version < 3) {
+        fail("extended flags in version 2");
+      }
+      uint16_t extended = (e[62] << 8) | e[63];
+      entry.skip_worktree = extended & kFlagSkipWorktree;
+      name_start += 2;
+    }
+    // 名字长度不小于 0xFFF 时标志中存的是 0xFFF，以 '\0' 为准
+    const void *nul = offset + name_start <= end
+                          ? memchr(e + name_start, '\0', end - offset - name_start)
+                          : nullptr;
+    if (!nul) {
+      fail("truncated entry");
+    }
+    size_t name_length = static_cast<const unsigned char *>(nul) - e - name_start;
+    entry.path.assign(reinterpret_cast<const char *>(e) + name_start,
+                      name_length);
+    // 条目长度补齐到 8 的倍数，至少有一个 '\0'
+    offset += (name_start + name_length + 8) & ~size_t(7);
+    index.entries_.push_back(std::move(entry));
+  }
+  if (offset > end) {
+    fail("truncated entry");
+  }
+  return index;
+}
+
+void Index::Write(const fs::path &path) {
+  bool extended = false;
+  bool sparse_dirs = false;
+  for (const auto &entry : entries_) {
+    extended |= entry.skip_worktree;
+    sparse_dirs |= entry.IsSparseDir();
+  }
+  std::string out = "DIRC";
+  PutBE32(out, extended ? 3 : 2);
+  PutBE32(out, entries_.size());
+  for (const auto &entry : entries_) {
+    size_t start = out.size();
+    const StatData &stat = entry.stat;
+    for (uint32_t value : {stat.ctime_sec, stat.ctime_nsec, stat.mtime_sec,
+                           stat.mtime_nsec, stat.dev, stat.ino, entry.mode,
+                           stat.uid, stat.gid, stat.size}) {
+      PutBE32(out, value);
+    }
+    HexToBinary(entry.hash.View(), out);
+    PutBE16(out, uint16_t(entry.stage << 12) |
+                     (entry.skip_worktree ? kFlagExtended : 0) |
+                     uint16_t(std::min<size_t>(entry.path.size(), kNameMask)));
+    if (entry.skip_worktree) {
+      PutBE16(out, kFlagSkipWorktree);
+    }
+    out += entry.path;
+    out.append(8 - (out.size() - start) % 8, '\0');
+  }
+  if (sparse_dirs) {
+    // 空的 "sdir" 扩展告诉 Git 其中有稀疏目录
+    out += "sdir";
+    PutBE32(out, 0);
+  }
+  unsigned char digest[SHA_DIGEST_LENGTH];
+  SHA1(reinterpret_cast<const unsigned char *>(out.data()), out.size(),
+       digest);
+  out.append(reinterpret_cast<char *>(digest), SHA_DIGEST_LENGTH);
+
+  // 与 git 相同用 index.lock 互斥，写完后改名，读者不会看到写了一半的文件
+  fs::path lock = path.string() + ".lock";
+  int fd = open(lock.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0666);
+  if (fd < 0) {
+    throw std::runtime_error("index: unable to create '" + lock.string() +
+                             "': " + strerror(errno));
+  }
+  if (!WriteAll(fd, out.data(), out.size())) {
+    close(fd);
+    fs::remove(lock);
+    throw std::runtime_error("index: write failed");
+  }
+  close(fd);
+  fs::rename(lock, path);
+  checksum_ = BinaryToHex(digest);
+}
+
+void Index::Update(const std::vector<std::string> &paths,
+                   std::vector<IndexEntry> updated) {
+  std::vector<IndexEntry> merged;
+  merged.reserve(entries_.size() + updated.size());
+  auto removed = paths.begin();
+  auto added = updated.begin();
+  for (auto &entry : entries_) {
+    while (removed != paths.end() && *removed < entry.path) {
+      ++removed;
+    }
+    if (removed != paths.end() && *removed == entry.path) {
+      continue;
+    }
+    for (; added != updated.end() && added->path < entry.path; ++added) {
+      merged.push_back(std::move(*added));
+    }
+    merged.push_back(std::move(entry));
+  }
+  std::move(added, updated.end(), std::back_inserter(merged));
+  entries_ = std::move(merged);
+}
+
+const IndexEntry *Index::Find(const std::string &path) const {
+  auto it = std::lower_bound(
+      entries_.begin(), entries_.end(), path,
+      [](const IndexEntry &entry, const std::string &key) {
+        return entry.path < key;
+      });
+  for (; it != entries_.end() && it->path == path; ++it) {
+    if (it->stage == 0) {
+      return &*it;
+    }
+  }
+  return nullptr;
+}
+
+bool Index::StatClean(const IndexEntry &entry, const struct stat &st) const {
+  if (entry.stat == StatData() || !(entry.stat == StatData::From(st))) {
+    return false;
+  }
+  uint32_t type = st.st_mode & S_IFMT;
+  if (S_ISREG(st.st_mode)) {
+    bool executable = st.st_mode & S_IXUSR;
+    if (entry.mode != (executable ? 0100755u : 0100644u)) {
+      return false;
+    }
+  } else if (type != (entry.mode & S_IFMT)) {
+    return false;
+  }
+  // 与 index 文件同时或之后修改的文件，stat 相同也不能确定内容未变
+  return entry.stat.mtime_sec < mtime_sec_ ||
+         (entry.stat.mtime_sec == mtime_sec_ &&
+          entry.stat.mtime_nsec < mtime_nsec_);
+}
+
+} // namespace dircache
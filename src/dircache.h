@@ -0,0 +1,156 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <sys/stat.h>
+#include <vector>
+
+/**
+ * @brief 暂存区（index）：.git/index
+ *
+ * 为工作区中的每个文件记录 blob 哈希、mode 以及写出时的 stat 信息。下次
+ * 需要判断文件是否被改过时，先比较 lstat 的结果：mtime、ctime、大小、inode
+ * 等都没变就认为内容没变，不必读取和哈希文件。
+ *
+ * 文件格式与 Git 的 version 2 相同（也能读 version 3），git status 可以直接
+ * 使用（Git 源码中称为 dircache，文件头就是 "DIRC"）：
+ *
+ *   "DIRC" <版本 (4)> <条目数 (4)>
+ *   每个条目：ctime 秒/纳秒、mtime 秒/纳秒、dev、ino、mode、uid、gid、大小
+ *            （各 4 字节）<20字节哈希> <标志 (2)> <路径> 1-8 个 '\0' 补齐到 8 的倍数
+ *   扩展（读取时跳过；有稀疏目录时写出 "sdir"，否则没有）
+ *   <20字节 SHA-1 校验和>
+ *
+ * 条目按路径的字节序排列。有 skip-worktree 标志的条目需要 version 3 的
+ * 扩展标志，这时按 version 3 写出。
+ *
+ * 稀疏检出（见 sparse.h）时，整个不检出的目录是一个条目（Git 的 sparse
+ * index）：路径以 '/' 结尾，mode 为 040000，哈希是目录的 tree，带
+ * skip-worktree 标志。其中的文件不单独出现在 index 中。
+ *
+ * 文件在 index 写出的同一秒内被修改时，stat 可能与记录完全相同（"racy"）。
+ * 因此 mtime 不早于 index 文件本身 mtime 的条目不能只凭 stat 判断，需要
+ * 比较内容。
+ */
+namespace dircache {
+
+// lstat 结果中用于判断文件是否改动的部分，各字段按 Git 的格式截断为 32 位
+struct StatData {
+  uint32_t ctime_sec = 0;
+  uint32_t ctime_nsec = 0;
+  uint32_t mtime_sec = 0;
+  uint32_t mtime_nsec = 0;
+  uint32_t dev = 0;
+  uint32_t ino = 0;
+  uint32_t uid = 0;
+  uint32_t gid = 0;
+  uint32_t size = 0;
+
+  static StatData From(const struct stat &st);
+  bool operator==(const StatData &other) const = default;
+};
+
+/**
+ * @brief 条目中的十六进制哈希，字符直接存在条目内
+ *
+ * 40 个字符超出 std::string 的短字符串长度，读取几十万个条目的 index 时
+ * 每个条目都要多分配一次内存。可以与 std::string 互相赋值和比较。
+ */
+class Hash {
+public:
+  Hash() = default;
+  Hash(std::string_view hex) { *this = hex; }
+  Hash(const std::string &hex) : Hash(std::string_view(hex)) {}
+
+  // @throws std::runtime_error 超过 40 个字符
+  Hash &operator=(std::string_view hex);
+  Hash &operator=(const std::string &hex) { return *this = std::string_view(hex); }
+
+  std::string_view View() const { return {hex_, size_}; }
+  operator std::string() const { return std::string(View()); }
+  bool empty() const { return size_ == 0; }
+
+  bool operator==(const Hash &other) const { return View() == other.View(); }
+  bool operator==(const std::string &other) const { return View() == other; }
+
+private:
+  char hex_[40] = {};
+  uint8_t size_ = 0;
+};
+
+struct IndexEntry {
+  StatData stat;         // 全为0表示没有记录，总是需要比较内容
+  uint32_t mode = 0;     // 0100644、0100755、0120000 或 0160000
+  Hash hash;             // 40 字符十六进制 blob 哈希
+  std::string path;      // 相对于工作区根目录，以 '/' 分隔
+  uint16_t stage = 0;    // 合并冲突时的阶段，正常为0
+  bool skip_worktree = false; // 不在工作区中（稀疏检出），不与工作区比较
+
+  // 稀疏目录：path 以 '/' 结尾，hash 是 tree
+  bool IsSparseDir() const { return mode == 040000; }
+};
+
+class Index {
+public:
+  Index() = default;
+
+  /**
+   * @brief 读取 index 文件
+   * @param verify_checksum 为 false 时不重新计算末尾的 SHA-1（与 git 相同，
+   *        只读的命令不验证，几十 MB 的 index 可以省下几十毫秒）
+   * @return 文件不存在时返回空的 index，Exists() 为 false
+   * @throws std::runtime_error 格式错误、校验和不符或版本不支持
+   */
+  static Index Read(const std::filesystem::path &path,
+                    bool verify_checksum = true);
+
+  /**
+   * @brief 写出 index：先写 <path>.lock，再改名替换；之后 Checksum() 是
+   *        新文件的校验和
+   * @throws std::runtime_error 锁文件已存在或写入失败
+   */
+  void Write(const std::filesystem::path &path);
+
+  // 读取时文件是否存在
+  bool Exists() const { return exists_; }
+
+  // 文件末尾的 SHA-1（40 字符十六进制），内容相同的 index 校验和相同；
+  // 文件不存在时为空
+  const std::string &Checksum() const { return checksum_; }
+
+  const std::vector<IndexEntry> &Entries() const { return entries_; }
+
+  // 替换全部条目，entries 必须已按路径排序
+  void SetEntries(std::vector<IndexEntry> entries) {
+    entries_ = std::move(entries);
+  }
+
+  /**
+   * @brief 删除 paths 中路径的全部条目，再加入 updated 中的条目
+   *
+   * 两者都必须已按路径排序；一次线性合并，其余条目原样移动，不复制。
+   */
+  void Update(const std::vector<std::string> &paths,
+              std::vector<IndexEntry> updated);
+
+  // 按路径二分查找阶段0的条目，没有时返回 nullptr
+  const IndexEntry *Find(const std::string &path) const;
+
+  /**
+   * @brief 仅凭 stat 信息判断 entry 对应的文件是否未改动
+   * @return false 表示需要比较内容（可能改过，也可能只是 racy）
+   */
+  bool StatClean(const IndexEntry &entry, const struct stat &st) const;
+
+private:
+  std::vector<IndexEntry> entries_;
+  bool exists_ = false;
+  std::string checksum_;
+  // 读取时 index 文件的 mtime，用于识别 racy 条目
+  uint32_t mtime_sec_ = 0;
+  uint32_t mtime_nsec_ = 0;
+};
+
+} // namespace dircache
@@ -0,0 +1,383 @@
+#include "durability.h"
+#include "config.h"
+#include "trace.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdexcept>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+namespace durability {
+
+namespace {
+
+// 各仓库最外层的事务（所有线程共用）
+std::mutex transactions_mutex;
+std::vector<ObjectTransaction *> transactions;
+
+std::string Key(const fs::path &objects_dir) {
+  return fs::absolute(objects_dir).lexically_normal().string();
+}
+
+int HexValue(char c) { return c <= '9' ? c - '0' : c - 'a' + 10; }
+
+int OpenDirectory(const fs::path &path) {
+  return open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+}
+
+} // namespace
+
+FsyncMethod ParseFsyncMethod(const std::string &value) {
+  if (value == "none") {
+    return FsyncMethod::kNone;
+  }
+  if (value == "fsync") {
+    return FsyncMethod::kFsync;
+  }
+  if (value == "batch") {
+    return FsyncMethod::kBatch;
+  }
+  throw std::invalid_argument("invalid core.fsyncMethod: " + value);
+}
+
+FsyncMethod ConfiguredFsyncMethod(const fs::path &git_dir) {
+  if (const char *method = getenv("MINIGIT_FSYNC_METHOD")) {
+    return ParseFsyncMethod(method);
+  }
+  auto method = Config(git_dir).Get("core.fsyncMethod");
+  return method ? ParseFsyncMethod(*method) : FsyncMethod::kNone;
+}
+
+ObjectTransaction::ObjectTransaction(const fs::path &git_dir)
+    : objects_dir_(git_dir / "objects") {
+  key_ = Key(objects_dir_);
+  std::lock_guard<std::mutex> lock(transactions_mutex);
+  for (ObjectTransaction *transaction : transactions) {
+    if (transaction->key_ == key_) {
+      outer_ = transaction;
+      return;
+    }
+  }
+  method_ = ConfiguredFsyncMethod(git_dir);
+  if (mkdir(objects_dir_.c_str(), 0777) != 0 && errno != EEXIST) {
+    throw std::runtime_error("cannot create " + objects_dir_.string() + ": " +
+                             strerror(errno));
+  }
+  objects_fd_ = OpenDirectory(objects_dir_);
+  if (objects_fd_ < 0) {
+    throw std::runtime_error("cannot open " + objects_dir_.string() + ": " +
+                             strerror(errno));
+  }
+  transactions.push_back(this);
+}
+
+ObjectTransaction::~ObjectTransaction() {
+  if (outer_) {
+    return;
+  }
+  RemoveQuarantine();
+  close(objects_fd_);
+  std::lock_guard<std::mutex> lock(transactions_mutex);
+  transactions.erase(
+      std::find(transactions.begin(), transactions.end(), this));
+}
+
+ObjectTransaction *ObjectTransaction::Current(const fs::path &git_dir) {
+  std::lock_guard<std::mutex> lock(transactions_mutex);
+  if (transactions.empty()) {
+    return nullptr;
+  }
+  std::string key = Key(git_dir / "objects");
+  for (ObjectTransaction *transaction : transactions) {
+    if (transaction->key_ == key) {
+      return transaction;
+    }
+  }
+  return nullptr;
+}
+
+int ObjectTransaction::StagingFd() {
+  ObjectTransaction *root = Root();
+  if (root->method_ == FsyncMethod::kNone) {
+    return root->objects_fd_;
+  }
+  std::lock_guard<std::mutex> lock(root->mutex_);
+  if (root->quarantine_fd_ < 0) {
+    std::string name =
+        (root->objects_dir_ / ("incoming-" + std::to_string(getpid()) +
+                               "-XXXXXX"))
+            .string();
+    if (!mkdtemp(name.data())) {
+      throw std::runtime_error("cannot create " + name + ": " +
+                               strerror(errno));
+    }
+    root->quarantine_dir_ = name;
+    root->quarantine_fd_ = OpenDirectory(name);
+    if (root->quarantine_fd_ < 0) {
+      throw std::runtime_error("cannot open " + name + ": " + strerror(errno));
+    }
+  }
+  return root->quarantine_fd_;
+}
+
+void ObjectTransaction::MakeDir(int fd, bool *created, const char *path) {
+  int prefix = HexValue(path[0]) * 16 + HexValue(path[1]);
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (created[prefix]) {
+    return;
+  }
+  char name[3] = {path[0], path[1], '\0'};
+  if (mkdirat(fd, name, 0777) != 0 && errno != EEXIST) {
+    throw std::runtime_error("cannot create " + objects_dir_.string() + "/" +
+                             name + ": " + strerror(errno));
+  }
+  created[prefix] = true;
+}
+
+void ObjectTransaction::MakeStagingDir(const char *path) {
+  ObjectTransaction *root = Root();
+  int fd = StagingFd();
+  root->MakeDir(fd,
+                fd == root->objects_fd_ ? root->object_dirs_
+                                        : root->quarantine_dirs_,
+                path);
+}
+
+void ObjectTransaction::Staged(const char *path) {
+  ObjectTransaction *root = Root();
+  if (root->method_ == FsyncMethod::kFsync) {
+    root->Publish(path);
+  } else if (root->method_ == FsyncMethod::kBatch) {
+    std::lock_guard<std::mutex> lock(root->mutex_);
+    root->staged_.emplace_back();
+    memcpy(root->staged_.back().data(), path, 42);
+  }
+}
+
+void ObjectTransaction::Publish(const char *path) {
+  ObjectTransaction *root = Root();
+  root->MakeDir(root->objects_fd_, root->object_dirs_, path);
+  // 已有同名对象时保留原来的文件（内容相同），丢弃新写的这份
+  if (renameat2(root->quarantine_fd_, path, root->objects_fd_, path,
+                RENAME_NOREPLACE) == 0) {
+    return;
+  }
+  if (errno == EEXIST) {
+    unlinkat(root->quarantine_fd_, path, 0);
+    return;
+  }
+  throw std::runtime_error("cannot move object " + std::string(path) +
+                           " into " + root->objects_dir_.string() + ": " +
+                           strerror(errno));
+}
+
+void ObjectTransaction::Write(const std::string &hash, const void *data,
+                              size_t size) {
+  ObjectTransaction *root = Root();
+  char path[42];
+  snprintf(path, sizeof(path), "%.2s/%.38s", hash.c_str(), hash.c_str() + 2);
+  if (root->method_ != FsyncMethod::kNone &&
+      faccessat(root->objects_fd_, path, F_OK, 0) == 0) {
+    return;
+  }
+  MakeStagingDir(path);
+  int staging = StagingFd();
+  int fd = openat(staging, path, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0444);
+  if (fd < 0 && errno == EEXIST) {
+    return;
+  }
+  bool ok = fd >= 0 && WriteAll(fd, data, size);
+  if (ok && root->method_ == FsyncMethod::kFsync) {
+    ok = fsync(fd) == 0;
+    TRACE_COUNT("fsync_objects", 1);
+  }
+  int saved_errno = errno;
+  if (fd >= 0 && close(fd) != 0 && ok) {
+    ok = false;
+    saved_errno = errno;
+  }
+  if (!ok) {
+    if (fd >= 0) {
+      unlinkat(staging, path, 0);
+    }
+    throw std::runtime_error("cannot write object " + hash + ": " +
+                             strerror(saved_errno));
+  }
+  Staged(path);
+}
+
+int ObjectTransaction::CreateTemp(std::string &temp) {
+  ObjectTransaction *root = Root();
+  int staging = StagingFd();
+  const fs::path &dir = staging == root->objects_fd_ ? root->objects_dir_
+                                                     : root->quarantine_dir_;
+  temp = (dir / "tmp_obj_XXXXXX").string();
+  int fd = mkostemp(temp.data(), O_CLOEXEC);
+  if (fd < 0) {
+    throw std::runtime_error("cannot create " + temp + ": " + strerror(errno));
+  }
+  return fd;
+}
+
+void ObjectTransaction::AddTemp(int fd, const std::string &temp,
+                                const std::string &hash) {
+  ObjectTransaction *root = Root();
+  bool ok = fchmod(fd, 0444) == 0;
+  if (ok && root->method_ == FsyncMethod::kFsync) {
+    ok = fsync(fd) == 0;
+    TRACE_COUNT("fsync_objects", 1);
+  }
+  int saved_errno = errno;
+  if (close(fd) != 0 && ok) {
+    ok = false;
+    saved_errno = errno;
+  }
+  if (!ok) {
+    unlink(temp.c_str());
+    throw std::runtime_error("cannot write object " + hash + ": " +
+                             strerror(saved_errno));
+  }
+  char path[42];
+  snprintf(path, sizeof(path), "%.2s/%.38s", hash.c_str(), hash.c_str() + 2);
+  MakeStagingDir(path);
+  if (renameat2(AT_FDCWD, temp.c_str(), StagingFd(), path, RENAME_NOREPLACE) !=
+      0) {
+    saved_errno = errno;
+    unlink(temp.c_str());
+    if (saved_errno == EEXIST) {
+      return;
+    }
+    throw std::runtime_error("cannot move " + temp + " to object " + hash +
+                             ": " + strerror(saved_errno));
+  }
+  Staged(path);
+}
+
+void ObjectTransaction::DiscardTemp(int fd, const std::string &temp) {
+  close(fd);
+  unlink(temp.c_str());
+}
+
+std::optional<GitObject> ObjectTransaction::ReadStaged(const std::string &hash) {
+  ObjectTransaction *root = Root();
+  if (root->method_ != FsyncMethod::kBatch) {
+    return std::nullopt;
+  }
+  const ObjectStore *store;
+  {
+    std::lock_guard<std::mutex> lock(root->mutex_);
+    if (root->quarantine_fd_ < 0) {
+      return std::nullopt;
+    }
+    if (!root->quarantine_store_) {
+      root->quarantine_store_ =
+          ObjectStore::ForObjectsDir(root->quarantine_dir_);
+    }
+    store = root->quarantine_store_.get();
+  }
+  return store->Read(hash);
+}
+
+void ObjectTransaction::Commit() {
+  if (outer_ || method_ != FsyncMethod::kBatch) {
+    return;
+  }
+  std::vector<std::array<char, 42>> staged;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    staged.swap(staged_);
+  }
+  if (staged.empty()) {
+    return;
+  }
+  // 一次 syncfs 让这些对象全部落盘，之后的 rename 只移动已经完整的文件
+  TRACE_SPAN("fsync-batch");
+  if (syncfs(quarantine_fd_) != 0) {
+    throw std::runtime_error("cannot sync " + quarantine_dir_.string() + ": " +
+                             strerror(errno));
+  }
+  TRACE_COUNT("fsync_batch_syncs", 1);
+  TRACE_COUNT("fsync_batch_objects", staged.size());
+  for (const auto &path : staged) {
+    Publish(path.data());
+  }
+}
+
+void ObjectTransaction::RemoveQuarantine() {
+  if (quarantine_fd_ < 0) {
+    return;
+  }
+  close(quarantine_fd_);
+  quarantine_fd_ = -1;
+  quarantine_store_.reset();
+  std::error_code ec;
+  fs::remove_all(quarantine_dir_, ec);
+  std::fill(std::begin(quarantine_dirs_), std::end(quarantine_dirs_), false);
+}
+
+void WriteLooseObject(const fs::path &git_dir, const std::string &hash,
+                      const void *data, size_t size) {
+  if (ObjectTransaction *transaction = ObjectTransaction::Current(git_dir)) {
+    transaction->Write(hash, data, size);
+    return;
+  }
+  ObjectTransaction transaction(git_dir);
+  transaction.Write(hash, data, size);
+  transaction.Commit();
+}
+
+bool WriteAll(int fd, const void *data, size_t size) {
+  const char *bytes = static_cast<const char *>(data);
+  for (size_t done = 0; done < size;) {
+    ssize_t n = write(fd, bytes + done, size - done);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    done += n;
+  }
+  return true;
+}
+
+void WriteFileAtomically(const fs::path &path, const std::string &data,
+                         mode_t mode, FsyncMethod method) {
+  fs::path dir = path.parent_path();
+  fs::create_directories(dir);
+  std::string tmp =
+      (dir / ("tmp_" + path.filename().string() + "_XXXXXX")).string();
+  int fd = mkostemp(tmp.data(), O_CLOEXEC);
+  if (fd < 0) {
+    throw std::runtime_error("cannot create temporary file in " +
+                             dir.string() + ": " + strerror(errno));
+  }
+  bool ok = WriteAll(fd, data.data(), data.size()) && fchmod(fd, mode) == 0;
+  if (ok && method != FsyncMethod::kNone) {
+    ok = fsync(fd) == 0;
+  }
+  int saved_errno = errno;
+  if (close(fd) != 0 && ok) {
+    ok = false;
+    saved_errno = errno;
+  }
+  if (ok && rename(tmp.c_str(), path.c_str()) != 0) {
+    ok = false;
+    saved_errno = errno;
+  }
+  if (!ok) {
+    unlink(tmp.c_str());
+    throw std::runtime_error("cannot write " + path.string() + ": " +
+                             strerror(saved_errno));
+  }
+}
+
+} // namespace durability
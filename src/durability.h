@@ -0,0 +1,184 @@
+#pragma once
+
+#include "object_store.h"
+#include <array>
+#include <cstddef>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <sys/types.h>
+#include <vector>
+
+/**
+ * @brief 对象写入的持久化（对应 Git 的 core.fsyncMethod）
+ *
+ * 松散对象原来直接写到最终路径、从不 fsync，断电后可能留下长度为 0 或
+ * 内容不完整的对象，而引用已经指向它。.git/config 中的 core.fsyncMethod
+ * （或环境变量 MINIGIT_FSYNC_METHOD，优先）选择：
+ *
+ * - none（默认）：直接写最终路径，不 fsync，与原来的行为相同
+ * - fsync：每个对象先写到临时目录，fsync 之后再 rename 到最终路径
+ * - batch：事务中的对象都写到隔离目录（objects/incoming-*），不逐个
+ *   fsync；Commit() 时对隔离目录所在的文件系统做一次 syncfs，再把对象
+ *   逐个 rename 到 objects 目录。调用方在 Commit() 之后才更新引用
+ *
+ * 两种持久化方式下，最终路径上只会出现已经落盘的完整对象。rename 本身
+ * 不再单独 fsync 目录：之后的引用更新在日志型文件系统上按顺序提交，不会
+ * 先于 rename 落盘。
+ */
+namespace durability {
+
+enum class FsyncMethod {
+  kNone,
+  kFsync,
+  kBatch,
+};
+
+/**
+ * @brief 解析 "none" / "fsync" / "batch"
+ * @throws std::invalid_argument 其它值
+ */
+FsyncMethod ParseFsyncMethod(const std::string &value);
+
+/**
+ * @brief MINIGIT_FSYNC_METHOD 或 core.fsyncMethod 指定的方式，都未设置时为
+ *        kNone
+ * @throws std::invalid_argument 值不合法
+ */
+FsyncMethod ConfiguredFsyncMethod(const std::filesystem::path &git_dir = ".git");
+
+/**
+ * @brief 一组对象写入：write-tree、commit-tree 或克隆解包的全部对象
+ *
+ * 同一进程中（包括其它线程）对同一仓库在外层事务存在期间创建的事务只是
+ * 外层事务的别名，Commit() 什么也不做，只有最外层的 Commit() 生效。
+ * 没有 Commit() 就销毁的事务丢弃隔离目录中的对象（none 和 fsync 方式下
+ * 已经写出的对象保留）。
+ *
+ * 写入和 Commit() 可以在不同线程中同时进行：Commit() 只处理在它之前
+ * Staged() 的对象，之后的留给下一次 Commit()。
+ */
+class ObjectTransaction {
+public:
+  /**
+   * @throws std::runtime_error 无法创建或打开 objects 目录
+   * @throws std::invalid_argument 配置的 fsync 方式不合法
+   */
+  explicit ObjectTransaction(const std::filesystem::path &git_dir = ".git");
+  ~ObjectTransaction();
+  ObjectTransaction(const ObjectTransaction &) = delete;
+  ObjectTransaction &operator=(const ObjectTransaction &) = delete;
+
+  FsyncMethod Method() const { return Root()->method_; }
+
+  /**
+   * @brief 写入一个压缩好的对象，已存在的对象不重写
+   * @param hash 40 字符十六进制哈希
+   * @throws std::runtime_error 写入失败
+   */
+  void Write(const std::string &hash, const void *data, size_t size);
+
+  /**
+   * @brief 新对象应写入的目录：none 时是 objects 目录，否则是隔离目录
+   *
+   * 供批量写入者（ingest::LooseObjectWriter）以 openat 使用，写完的对象
+   * 要交给 Staged()。
+   */
+  int StagingFd();
+
+  // 在 StagingFd() 中建好扇出目录（path 的前两个字符），每个只建一次
+  void MakeStagingDir(const char *path);
+
+  /**
+   * @brief 暂存目录中的 "xx/yyyy..." 已经完整写出：fsync 方式下（文件已
+   *        fsync）立即移到 objects 目录，batch 方式下记下等 Commit()，none
+   *        时什么也不做
+   * @throws std::runtime_error rename 失败
+   */
+  void Staged(const char *path);
+
+  /**
+   * @brief 在暂存目录中创建临时文件，供写完才知道哈希的流式写入使用
+   * @param temp 返回临时文件的路径
+   * @return 可写的文件描述符
+   * @throws std::runtime_error 创建失败
+   */
+  int CreateTemp(std::string &temp);
+
+  /**
+   * @brief 关闭 CreateTemp() 的文件并把它作为对象 hash 存入；对象已存在时
+   *        丢弃临时文件
+   * @throws std::runtime_error fsync、关闭或 rename 失败（临时文件已删除）
+   */
+  void AddTemp(int fd, const std::string &temp, const std::string &hash);
+
+  // 关闭并删除 CreateTemp() 的文件（出错时使用）
+  static void DiscardTemp(int fd, const std::string &temp);
+
+  // 读取还在隔离目录中（尚未 Commit）的对象
+  std::optional<GitObject> ReadStaged(const std::string &hash);
+
+  /**
+   * @brief 让已经 Staged() 的对象全部落盘并出现在 objects 目录中；可以多次
+   *        调用
+   * @throws std::runtime_error syncfs 或 rename 失败
+   */
+  void Commit();
+
+  // 该仓库最外层的事务，没有时返回 nullptr
+  static ObjectTransaction *Current(const std::filesystem::path &git_dir);
+
+private:
+  ObjectTransaction *Root() { return outer_ ? outer_ : this; }
+  const ObjectTransaction *Root() const { return outer_ ? outer_ : this; }
+  void MakeDir(int fd, bool *created, const char *path);
+  void Publish(const char *path);
+  void RemoveQuarantine();
+
+  ObjectTransaction *outer_ = nullptr;
+  std::string key_; // 规范化的绝对 objects 路径
+  FsyncMethod method_ = FsyncMethod::kNone;
+  std::filesystem::path objects_dir_;
+  int objects_fd_ = -1;
+  bool object_dirs_[256] = {};
+  std::filesystem::path quarantine_dir_;
+  int quarantine_fd_ = -1;
+  bool quarantine_dirs_[256] = {};
+  std::unique_ptr<ObjectStore> quarantine_store_;
+  std::vector<std::array<char, 42>> staged_; // batch：等待 Commit() 的对象
+  std::mutex mutex_; // 保护隔离目录的创建、扇出目录标记和 staged_
+};
+
+/**
+ * @brief 把压缩好的松散对象写入 <git_dir>/objects
+ *
+ * 有当前事务时交给事务，否则按配置的方式单独写出并落盘（batch 方式下
+ * 等价于只含一个对象的事务）。
+ * @throws std::runtime_error 写入失败
+ */
+void WriteLooseObject(const std::filesystem::path &git_dir,
+                      const std::string &hash, const void *data, size_t size);
+
+/**
+ * @brief 把 size 字节全部写入 fd，被信号打断或只写了一部分时继续
+ * @return 写入失败时返回 false，errno 说明原因
+ */
+bool WriteAll(int fd, const void *data, size_t size);
+
+/**
+ * @brief 整体替换一个文件：在同一目录中写 tmp_ 开头的临时文件，再 rename
+ *        为 path，读者只会看到完整的旧文件或新文件
+ *
+ * 用于 commit-graph、位图和共享缓存中的小文件；并发写同一个文件时后者
+ * 覆盖前者。
+ * @param mode 新文件的权限
+ * @param method 不是 kNone 时 rename 之前先 fsync 临时文件
+ * @throws std::runtime_error 无法创建、写入或改名（临时文件已删除）
+ */
+void WriteFileAtomically(const std::filesystem::path &path,
+                         const std::string &data, mode_t mode,
+                         FsyncMethod method = FsyncMethod::kNone);
+
+} // namespace durability
@@ -0,0 +1,483 @@
+#include "fsmonitor.h"
+#include "trace.h"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <dirent.h>
+#include <fcntl.h>
+#include <iostream>
+#include <poll.h>
+#include <stdexcept>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+namespace fsmonitor {
+
+namespace {
+
+constexpr uint32_t kWatchMask = IN_CREATE | IN_DELETE | IN_MODIFY | IN_ATTRIB |
+                                IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF |
+                                IN_MOVE_SELF | IN_ONLYDIR | IN_DONT_FOLLOW |
+                                IN_EXCL_UNLINK;
+constexpr char kCookiePrefix[] = "fsmonitor-cookie-";
+// 等待 cookie 事件的最长时间，超时后回复 "/"
+constexpr int kCookieTimeoutMs = 1000;
+// 客户端等待回复的最长时间
+constexpr int kClientTimeoutSec = 5;
+constexpr char kEverything[] = "/";
+
+bool MakeAddress(const fs::path &path, sockaddr_un &address) {
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  const std::string &name = path.native();
+  if (name.size() >= sizeof(address.sun_path)) {
+    return false;
+  }
+  memcpy(address.sun_path, name.c_str(), name.size() + 1);
+  return true;
+}
+
+void SetTimeout(int fd, int seconds) {
+  timeval timeout{seconds, 0};
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+}
+
+// 连接 git_dir 的守护进程，失败时返回 -1
+int Connect(const fs::path &git_dir) {
+  sockaddr_un address;
+  if (!MakeAddress(SocketPath(git_dir), address)) {
+    return -1;
+  }
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    return -1;
+  }
+  if (connect(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) !=
+      0) {
+    close(fd);
+    return -1;
+  }
+  SetTimeout(fd, kClientTimeoutSec);
+  return fd;
+}
+
+bool SendAll(int fd, const std::string &data) {
+  for (size_t done = 0; done < data.size();) {
+    ssize_t n = send(fd, data.data() + done, data.size() - done, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    done += n;
+  }
+  return true;
+}
+
+// 读到对方关闭连接为止
+bool ReceiveAll(int fd, std::string &data) {
+  char buffer[65536];
+  for (;;) {
+    ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n < 0) {
+      return false;
+    }
+    if (n == 0) {
+      return true;
+    }
+    data.append(buffer, n);
+  }
+}
+
+std::string Join(const std::string &dir, const std::string &name) {
+  return dir.empty() ? name : dir + "/" + name;
+}
+
+} // namespace
+
+bool Changes::Touched(const std::string &dir) const {
+  return everything || std::binary_search(dirs.begin(), dirs.end(), dir);
+}
+
+bool Changes::TouchedUnder(const std::string &dir) const {
+  if (everything || (dir.empty() && !dirs.empty()) || Touched(dir)) {
+    return true;
+  }
+  // "a-b" 排在 "a" 和 "a/x" 之间，子目录要从 "a/" 开始找
+  std::string prefix = dir + "/";
+  auto it = std::lower_bound(dirs.begin(), dirs.end(), prefix);
+  return it != dirs.end() && it->starts_with(prefix);
+}
+
+fs::path SocketPath(const fs::path &git_dir) {
+  return git_dir / "fsmonitor--daemon.ipc";
+}
+
+std::optional<Changes> Query(const fs::path &git_dir, const std::string &token) {
+  TRACE_SPAN("fsmonitor-query");
+  int fd = Connect(git_dir);
+  if (fd < 0) {
+    return std::nullopt;
+  }
+  std::string reply;
+  bool ok = SendAll(fd, "query " + token + "\n") && ReceiveAll(fd, reply);
+  close(fd);
+  if (!ok || reply.empty() || reply.back() != '\0') {
+    return std::nullopt;
+  }
+  Changes changes;
+  size_t end = reply.find('\0');
+  changes.token = reply.substr(0, end);
+  for (size_t pos = end + 1; pos < reply.size(); pos = end + 1) {
+    end = reply.find('\0', pos);
+    changes.dirs.push_back(reply.substr(pos, end - pos));
+  }
+  if (changes.dirs.size() == 1 && changes.dirs[0] == kEverything) {
+    changes.everything = true;
+    changes.dirs.clear();
+  }
+  std::sort(changes.dirs.begin(), changes.dirs.end());
+  TRACE_COUNT("fsmonitor_dirty_dirs", changes.dirs.size());
+  return changes;
+}
+
+bool StopDaemon(const fs::path &git_dir) {
+  int fd = Connect(git_dir);
+  if (fd < 0) {
+    return false;
+  }
+  std::string reply;
+  // 守护进程处理完请求后关闭连接
+  SendAll(fd, "stop\n");
+  ReceiveAll(fd, reply);
+  close(fd);
+  return true;
+}
+
+Daemon::Daemon(const fs::path &worktree)
+    : worktree_(fs::absolute(worktree).lexically_normal()),
+      git_dir_(worktree_ / ".git"), socket_path_(SocketPath(git_dir_)) {
+  if (int fd = Connect(git_dir_); fd >= 0) {
+    close(fd);
+    throw std::runtime_error("fsmonitor daemon is already running for " +
+                             worktree_.string());
+  }
+  try {
+    inotify_fd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotify_fd_ < 0) {
+      throw std::runtime_error(std::string("cannot create inotify instance: ") +
+                               strerror(errno));
+    }
+    // .git 本身只用来收 cookie 事件，其中的改动不是工作区的改动
+    git_wd_ = inotify_add_watch(inotify_fd_, git_dir_.c_str(),
+                                IN_CREATE | IN_ONLYDIR);
+    if (git_wd_ < 0) {
+      throw std::runtime_error("cannot watch " + git_dir_.string() + ": " +
+                               strerror(errno));
+    }
+    AddTree("");
+    // 启动之前的改动没有记录，启动前的令牌一律视为无效
+    dirty_.clear();
+    reset_seq_ = ++seq_;
+
+    sockaddr_un address;
+    if (!MakeAddress(socket_path_, address)) {
+      throw std::runtime_error("socket path too long: " +
+                               socket_path_.string());
+    }
+    listen_fd_ = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listen_fd_ < 0) {
+      throw std::runtime_error(std::string("cannot create socket: ") +
+                               strerror(errno));
+    }
+    // 连不上的套接字文件是上一个守护进程留下的
+    unlink(socket_path_.c_str());
+    if (bind(listen_fd_, reinterpret_cast<sockaddr *>(&address),
+             sizeof(address)) != 0 ||
+        listen(listen_fd_, 16) != 0) {
+      throw std::runtime_error("cannot listen on " + socket_path_.string() +
+                               ": " + strerror(errno));
+    }
+    bound_ = true;
+    wake_fd_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (wake_fd_ < 0) {
+      throw std::runtime_error(std::string("cannot create eventfd: ") +
+                               strerror(errno));
+    }
+  } catch (...) {
+    Close();
+    throw;
+  }
+  auto now = std::chrono::system_clock::now().time_since_epoch();
+  instance_ = std::to_string(getpid()) + "-" +
+              std::to_string(
+                  std::chrono::duration_cast<std::chrono::nanoseconds>(now)
+                      .count());
+}
+
+Daemon::~Daemon() { Close(); }
+
+void Daemon::Close() {
+  if (bound_) {
+    unlink(socket_path_.c_str());
+    bound_ = false;
+  }
+  for (int *fd : {&inotify_fd_, &listen_fd_, &wake_fd_}) {
+    if (*fd >= 0) {
+      close(*fd);
+      *fd = -1;
+    }
+  }
+}
+
+void Daemon::Run() {
+  TRACE_SPAN("fsmonitor-daemon");
+  while (!stop_) {
+    pollfd fds[3] = {{inotify_fd_, POLLIN, 0},
+                     {listen_fd_, POLLIN, 0},
+                     {wake_fd_, POLLIN, 0}};
+    if (poll(fds, 3, -1) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      throw std::runtime_error(std::string("poll failed: ") + strerror(errno));
+    }
+    if (fds[0].revents) {
+      ReadEvents(0);
+    }
+    if (fds[1].revents) {
+      int client = accept4(listen_fd_, nullptr, nullptr, SOCK_CLOEXEC);
+      if (client >= 0) {
+        Serve(client);
+        close(client);
+      }
+    }
+    if (fds[2].revents) {
+      stop_ = true;
+    }
+  }
+}
+
+void Daemon::Stop() {
+  uint64_t one = 1;
+  (void)!write(wake_fd_, &one, sizeof(one));
+}
+
+void Daemon::Serve(int client) {
+  SetTimeout(client, 1);
+  std::string request;
+  char c;
+  while (request.size() < 4096) {
+    ssize_t n = recv(client, &c, 1, 0);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0 || c == '\n') {
+      break;
+    }
+    request.push_back(c);
+  }
+  if (request == "stop") {
+    stop_ = true;
+  } else if (request.starts_with("query ")) {
+    SendAll(client, Answer(request.substr(6)));
+  }
+}
+
+std::string Daemon::Token() const {
+  return instance_ + ":" + std::to_string(seq_);
+}
+
+std::string Daemon::Answer(const std::string &token) {
+  TRACE_SPAN("fsmonitor-answer");
+  // cookie 事件排在查询之前发生的所有事件之后，读到它时这些事件都已处理
+  std::string cookie =
+      kCookiePrefix + std::to_string(getpid()) + "-" + std::to_string(++cookies_);
+  fs::path cookie_path = git_dir_ / cookie;
+  bool synced = false;
+  int fd = open(cookie_path.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC,
+                0600);
+  if (fd >= 0) {
+    close(fd);
+    auto deadline = std::chrono::steady_clock::now() +
+                    std::chrono::milliseconds(kCookieTimeoutMs);
+    while (seen_cookie_ != cookie) {
+      auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+                      deadline - std::chrono::steady_clock::now())
+                      .count();
+      if (left <= 0 || !ReadEvents(static_cast<int>(left))) {
+        break;
+      }
+    }
+    synced = seen_cookie_ == cookie;
+    unlink(cookie_path.c_str());
+  }
+
+  std::string reply = Token();
+  reply.push_back('\0');
+  size_t colon = token.rfind(':');
+  uint64_t since = 0;
+  bool valid = synced && !incomplete_ && colon != std::string::npos &&
+               token.compare(0, colon, instance_) == 0;
+  if (valid) {
+    try {
+      since = std::stoull(token.substr(colon + 1));
+    } catch (const std::exception &) {
+      valid = false;
+    }
+  }
+  if (!valid || since < reset_seq_ || since > seq_) {
+    reply += kEverything;
+    reply.push_back('\0');
+    return reply;
+  }
+  for (const auto &[dir, seq] : dirty_) {
+    if (seq > since) {
+      reply += dir;
+      reply.push_back('\0');
+    }
+  }
+  return reply;
+}
+
+void Daemon::Mark(const std::string &dir) { dirty_[dir] = ++seq_; }
+
+void Daemon::AddTree(const std::string &dir) {
+  fs::path path = dir.empty() ? worktree_ : worktree_ / dir;
+  int wd = inotify_add_watch(inotify_fd_, path.c_str(), kWatchMask);
+  if (wd < 0) {
+    // 目录已经被删除或换成了文件，之后会收到相应的事件
+    if (errno == ENOENT || errno == ENOTDIR) {
+      return;
+    }
+    if (!incomplete_) {
+      std::cerr << "warning: cannot watch " << path.string() << ": "
+                << strerror(errno) << "; every query will report all paths\n";
+    }
+    incomplete_ = true;
+    return;
+  }
+  watches_[wd] = dir;
+  Mark(dir);
+  // 先加 watch 再列目录：加 watch 之前已经建好的子目录在这里找到，之后
+  // 建的会产生事件
+  DIR *handle = opendir(path.c_str());
+  if (!handle) {
+    return;
+  }
+  std::vector<std::string> subdirs;
+  while (dirent *entry = readdir(handle)) {
+    std::string name = entry->d_name;
+    if (name == "." || name == ".." || name == ".git") {
+      continue;
+    }
+    bool is_dir = entry->d_type == DT_DIR;
+    if (entry->d_type == DT_UNKNOWN) {
+      struct stat st;
+      is_dir = fstatat(dirfd(handle), entry->d_name, &st,
+                       AT_SYMLINK_NOFOLLOW) == 0 &&
+               S_ISDIR(st.st_mode);
+    }
+    if (is_dir) {
+      subdirs.push_back(Join(dir, name));
+    }
+  }
+  closedir(handle);
+  for (const std::string &subdir : subdirs) {
+    AddTree(subdir);
+  }
+}
+
+void Daemon::RemoveTree(const std::string &dir) {
+  std::string prefix = dir + "/";
+  for (auto it = watches_.begin(); it != watches_.end();) {
+    if (it->second == dir || it->second.starts_with(prefix)) {
+      inotify_rm_watch(inotify_fd_, it->first);
+      it = watches_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+void Daemon::Reset() {
+  // 丢失的事件中可能有新建的目录，重新遍历一次补上 watch
+  TRACE_COUNT("fsmonitor_overflows", 1);
+  AddTree("");
+  dirty_.clear();
+  reset_seq_ = ++seq_;
+}
+
+bool Daemon::ReadEvents(int timeout_ms) {
+  pollfd fd = {inotify_fd_, POLLIN, 0};
+  if (poll(&fd, 1, timeout_ms) <= 0) {
+    return false;
+  }
+  alignas(inotify_event) char buffer[65536];
+  for (;;) {
+    ssize_t n = read(inotify_fd_, buffer, sizeof(buffer));
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return true;
+    }
+    for (char *p = buffer; p < buffer + n;) {
+      const inotify_event *event = reinterpret_cast<inotify_event *>(p);
+      p += sizeof(inotify_event) + event->len;
+      std::string name = event->len ? event->name : "";
+      if (event->mask & IN_Q_OVERFLOW) {
+        Reset();
+        continue;
+      }
+      if (event->wd == git_wd_) {
+        if ((event->mask & IN_CREATE) && name.starts_with(kCookiePrefix)) {
+          seen_cookie_ = name;
+        }
+        continue;
+      }
+      auto it = watches_.find(event->wd);
+      if (it == watches_.end()) {
+        continue;
+      }
+      std::string dir = it->second;
+      if (event->mask & IN_IGNORED) {
+        watches_.erase(it);
+        continue;
+      }
+      TRACE_COUNT("fsmonitor_events", 1);
+      if (name.empty()) {
+        // 目录自身被删除或移走
+        Mark(dir);
+        continue;
+      }
+      if (name == ".git") {
+        continue;
+      }
+      Mark(dir);
+      if (event->mask & IN_ISDIR) {
+        std::string child = Join(dir, name);
+        if (event->mask & (IN_CREATE | IN_MOVED_TO)) {
+          AddTree(child);
+        } else if (event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+          RemoveTree(child);
+          Mark(child);
+        }
+      }
+    }
+  }
+}
+
+} // namespace fsmonitor
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * @brief 文件系统监视守护进程（对应 git fsmonitor--daemon）
+ *
+ * write-tree 等命令每次都要遍历整个工作区，大仓库中仅目录遍历就要几秒。
+ * 守护进程用 inotify 监视工作区中的每个目录（不含 .git），记下内容可能
+ * 改变过的目录：目录中的条目被创建、删除、改名，或其中的文件被修改、改了
+ * 权限。新建或移入的目录连同其下所有目录都算作改变过。
+ *
+ * 命令通过 .git/fsmonitor--daemon.ipc（Unix 套接字）查询：
+ *
+ *   请求：query <令牌>\n
+ *   回复：<新令牌>\0 <目录>\0 <目录>\0 ...
+ *
+ * 回复中是自上一个令牌以来改变过的目录（相对于工作区根目录，根目录是
+ * 空字符串），唯一的一项 "/" 表示无法确定、调用方需要完整遍历：令牌为空、
+ * 来自另一个守护进程实例，或者 inotify 队列溢出过。调用方保存新令牌，下次
+ * 查询时带上。请求 "stop\n" 让守护进程退出。
+ *
+ * 回复之前守护进程在 .git 中创建一个 cookie 文件，等到读到它的 inotify
+ * 事件再回复：内核按顺序投递事件，查询之前完成的修改都已经处理过了。
+ *
+ * 需要 fanotify 的整个文件系统监视要求 CAP_SYS_ADMIN，这里只用 inotify：
+ * 每个目录一个 watch，受 fs.inotify.max_user_watches 限制，超出时所有查询
+ * 都回复 "/"。
+ */
+namespace fsmonitor {
+
+// 一次查询的结果
+struct Changes {
+  std::string token;             // 下次查询时使用
+  bool everything = false;       // 需要完整遍历
+  std::vector<std::string> dirs; // 改变过的目录，已排序
+
+  // dir 本身改变过
+  bool Touched(const std::string &dir) const;
+  // dir 或其下的任何目录改变过（everything 时总是 true）
+  bool TouchedUnder(const std::string &dir) const;
+};
+
+// git_dir 中套接字的路径
+std::filesystem::path SocketPath(const std::filesystem::path &git_dir);
+
+/**
+ * @brief 向 git_dir 的守护进程查询 token 之后的改动
+ * @return 没有守护进程或通信失败时返回 std::nullopt（调用方完整遍历）
+ */
+std::optional<Changes> Query(const std::filesystem::path &git_dir,
+                             const std::string &token);
+
+/**
+ * @brief 让 git_dir 的守护进程退出
+ * @return 没有守护进程时返回 false
+ */
+bool StopDaemon(const std::filesystem::path &git_dir);
+
+class Daemon {
+public:
+  /**
+   * @brief 监视 worktree（其 .git 中放套接字），建好所有 watch 后返回
+   * @throws std::runtime_error 已经有守护进程在运行，或无法创建 inotify
+   *         实例、套接字
+   */
+  explicit Daemon(const std::filesystem::path &worktree);
+  ~Daemon();
+  Daemon(const Daemon &) = delete;
+  Daemon &operator=(const Daemon &) = delete;
+
+  // 处理事件和查询，直到收到 "stop" 或 Stop()
+  void Run();
+
+  // 可以在其它线程中调用
+  void Stop();
+
+private:
+  void AddTree(const std::string &dir);
+  void RemoveTree(const std::string &dir);
+  void Mark(const std::string &dir);
+  // 读取并处理当前所有 inotify 事件，timeout_ms 内没有事件时返回 false
+  bool ReadEvents(int timeout_ms);
+  void Reset();
+  void Serve(int client);
+  std::string Answer(const std::string &token);
+  std::string Token() const;
+  void Close();
+
+  std::filesystem::path worktree_;
+  std::filesystem::path git_dir_;
+  std::filesystem::path socket_path_;
+  int inotify_fd_ = -1;
+  int listen_fd_ = -1;
+  int wake_fd_ = -1;
+  int git_wd_ = -1;
+  std::unordered_map<int, std::string> watches_; // wd -> 目录
+  std::unordered_map<std::string, uint64_t> dirty_; // 目录 -> 最后改变的序号
+  std::string instance_;
+  uint64_t seq_ = 0;
+  uint64_t reset_seq_ = 0;  // 早于它的令牌一律回复 "/"
+  bool incomplete_ = false; // 有目录没能加上 watch
+  uint64_t cookies_ = 0;
+  std::string seen_cookie_;
+  bool bound_ = false; // 套接字文件是这个实例创建的
+  bool stop_ = false;
+};
+
+} // namespace fsmonitor
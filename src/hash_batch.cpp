@@ -0,0 +1,223 @@
+#include "hash_batch.h"
+#include "../include/clone_gadget.h"
+#include "durability.h"
+#include "trace.h"
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace hash_batch {
+namespace {
+
+// 同时在处理或等待输出的输入最多这么多个（每个线程），内容模式下还受
+// kMaxPendingBytes 限制
+constexpr size_t kJobsPerThread = 64;
+constexpr size_t kMaxPendingBytes = 64 << 20;
+// 攒到这么多输出时不等待也先写出
+constexpr size_t kOutputFlushBytes = 64 << 10;
+
+struct Job {
+  std::string input; // 路径或内容
+  std::string hash;
+  std::string error;
+  bool done = false;
+};
+
+// 读取一条输入；输入结束时返回 false
+bool ReadInput(std::istream &in, Input type, std::string &input) {
+  std::string line;
+  if (!std::getline(in, line)) {
+    return false;
+  }
+  if (type == Input::kPaths) {
+    input = std::move(line);
+    return true;
+  }
+  if (line.empty() ||
+      line.find_first_not_of("0123456789") != std::string::npos) {
+    throw std::runtime_error("bad content length: " + line);
+  }
+  input.resize(std::stoull(line));
+  if (!in.read(input.data(), input.size())) {
+    throw std::runtime_error("content truncated, expected " + line +
+                             " bytes");
+  }
+  return true;
+}
+
+} // namespace
+
+bool Run(std::istream &in, std::ostream &out, std::ostream &err,
+         const Options &options) {
+  TRACE_SPAN("hash-object-batch");
+  unsigned threads = options.threads
+                         ? options.threads
+                         : std::max(1u, std::thread::hardware_concurrency());
+  const size_t max_jobs = threads * kJobsPerThread;
+
+  // 工作线程中 hash_object 创建的事务都是它的别名
+  std::optional<durability::ObjectTransaction> transaction;
+  if (options.write_objects) {
+    transaction.emplace(".git");
+  }
+
+  std::mutex mutex;
+  std::condition_variable job_ready; // 有新输入或输入结束
+  std::condition_variable job_done;  // 有结果完成
+  std::condition_variable space;     // 有结果输出，可以继续读入
+  std::deque<Job> jobs;              // 还没输出的输入，按输入顺序
+  size_t first = 0;                  // jobs.front() 的序号
+  size_t next = 0;                   // 下一个还没被领取的序号
+  size_t pending_bytes = 0;
+  bool eof = false;
+  bool failed = false;
+  std::string error;
+  // 记下第一个错误，调用时持有锁
+  auto fail = [&](const std::string &message) {
+    if (!failed) {
+      failed = true;
+      error = message;
+    }
+  };
+
+  auto worker = [&] {
+    std::unique_lock<std::mutex> lock(mutex);
+    for (;;) {
+      job_ready.wait(lock,
+                     [&] { return failed || eof || next < first + jobs.size(); });
+      if (failed || next == first + jobs.size()) {
+        return;
+      }
+      // deque 两端插入删除不会让其它元素的引用失效；这个输入完成之前
+      // 不会被输出线程删除
+      Job &job = jobs[next++ - first];
+      lock.unlock();
+      std::string hash, job_error;
+      try {
+        hash = options.input == Input::kPaths
+                   ? hash_object(job.input, options.write_objects)
+                   : hash_blob_buffer(job.input, options.write_objects);
+      } catch (const std::exception &e) {
+        job_error = e.what();
+      }
+      lock.lock();
+      job.hash = std::move(hash);
+      job.error = std::move(job_error);
+      job.done = true;
+      job_done.notify_one();
+    }
+  };
+
+  auto printer = [&] {
+    std::string output;
+    std::unique_lock<std::mutex> lock(mutex);
+    // 不持有锁时调用。先提交事务再写出：调用方读到哈希时对象已经可见
+    auto emit = [&] {
+      if (output.empty()) {
+        return;
+      }
+      try {
+        if (transaction) {
+          transaction->Commit();
+        }
+      } catch (const std::exception &e) {
+        std::lock_guard<std::mutex> guard(mutex);
+        fail(e.what());
+        output.clear();
+        return;
+      }
+      out << output;
+      out.flush();
+      output.clear();
+    };
+    for (;;) {
+      while (!failed && !jobs.empty() && jobs.front().done) {
+        Job &job = jobs.front();
+        if (!job.error.empty()) {
+          fail(job.error);
+          break;
+        }
+        output += job.hash;
+        output += '\n';
+        pending_bytes -= job.input.size();
+        jobs.pop_front();
+        first++;
+        space.notify_one();
+        if (output.size() >= kOutputFlushBytes) {
+          lock.unlock();
+          emit();
+          lock.lock();
+        }
+      }
+      if (failed || (jobs.empty() && eof)) {
+        break;
+      }
+      lock.unlock();
+      emit();
+      lock.lock();
+      job_done.wait(lock, [&] {
+        return failed || (!jobs.empty() && jobs.front().done) ||
+               (jobs.empty() && eof);
+      });
+    }
+    job_ready.notify_all();
+    space.notify_all();
+    lock.unlock();
+    emit();
+    // 出错时立刻报告，不等输入结束（读线程可能还阻塞在读取上）
+    lock.lock();
+    if (failed) {
+      err << "fatal: " << error << '\n';
+      err.flush();
+    }
+  };
+
+  std::vector<std::thread> pool;
+  for (unsigned i = 0; i < threads; i++) {
+    pool.emplace_back(worker);
+  }
+  std::thread output_thread(printer);
+
+  for (;;) {
+    Job job;
+    try {
+      if (!ReadInput(in, options.input, job.input)) {
+        break;
+      }
+    } catch (const std::exception &e) {
+      std::lock_guard<std::mutex> lock(mutex);
+      fail(e.what());
+      break;
+    }
+    std::unique_lock<std::mutex> lock(mutex);
+    space.wait(lock, [&] {
+      return failed || jobs.empty() ||
+             (jobs.size() < max_jobs && pending_bytes < kMaxPendingBytes);
+    });
+    if (failed) {
+      break;
+    }
+    pending_bytes += job.input.size();
+    jobs.push_back(std::move(job));
+    job_ready.notify_one();
+    TRACE_COUNT("hash_batch_inputs", 1);
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    eof = true;
+  }
+  job_ready.notify_all();
+  job_done.notify_all();
+  for (auto &thread : pool) {
+    thread.join();
+  }
+  output_thread.join();
+  return !failed;
+}
+
+} // namespace hash_batch
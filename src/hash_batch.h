@@ -0,0 +1,40 @@
+#pragma once
+
+#include <istream>
+#include <ostream>
+
+/**
+ * @brief hash-object 的批量模式：一个进程处理任意多个输入
+ *
+ * 从输入流读取路径（--stdin-paths，每行一个）或内容（--batch，每条是一行
+ * 十进制长度加上这么多字节的内容），每个输入输出一行哈希，顺序与输入
+ * 相同。输入由一个线程读取，几个工作线程同时计算哈希和写对象，每个线程
+ * 复用自己的 zlib 流；输出线程按输入顺序输出已经完成的结果。
+ *
+ * 输出线程每次要等待之前（下一个结果还没算完或输入暂时没有更多内容）
+ * 把已经攒下的输出写出并 flush，交互使用（写一个路径、读一行哈希）不会
+ * 卡住。写入对象时整个批次共用一个对象写入事务，写出哈希之前先提交，
+ * 调用方读到的哈希对应的对象已经落盘并且可以读取（见 durability.h）。
+ */
+namespace hash_batch {
+
+enum class Input {
+  kPaths,    // 每行一个文件路径
+  kContents, // "<长度>\n<内容>"
+};
+
+struct Options {
+  Input input = Input::kPaths;
+  bool write_objects = false; // -w
+  unsigned threads = 0;       // 0：CPU 核数
+};
+
+/**
+ * @brief 处理 in 中的全部输入，哈希逐行写到 out
+ * @return 全部成功时返回 true；遇到错误时在 err 输出 "fatal: ..." 并停止，
+ *         之前的结果都已输出
+ */
+bool Run(std::istream &in, std::ostream &out, std::ostream &err,
+         const Options &options);
+
+} // namespace hash_batch
@@ -0,0 +1,685 @@
+#include "http_server.h"
+#include "trace.h"
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cctype>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <optional>
+#include <stdexcept>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <zlib.h>
+
+namespace {
+
+// epoll 事件中 data.u64 的取值：0 和 1 保留给监听套接字和 eventfd
+constexpr uint64_t kListenId = 0;
+constexpr uint64_t kWakeId = 1;
+
+constexpr size_t kMaxHeaderSize = 64 << 10;
+constexpr size_t kMaxBodySize = 64 << 20;
+// 每次 sendfile 的最大长度，避免一个连接长时间占用事件循环
+constexpr size_t kSendfileChunk = 1 << 20;
+
+enum class ParseStatus { kIncomplete, kComplete, kBad, kTooLarge };
+
+std::string Lower(std::string text) {
+  std::transform(text.begin(), text.end(), text.begin(),
+                 [](unsigned char c) { return std::tolower(c); });
+  return text;
+}
+
+std::string Trim(const std::string &text) {
+  size_t begin = text.find_first_not_of(" \t");
+  if (begin == std::string::npos) {
+    return "";
+  }
+  size_t end = text.find_last_not_of(" \t");
+  return text.substr(begin, end - begin + 1);
+}
+
+const char *ReasonPhrase(int status) {
+  switch (status) {
+  case 200:
+    return "OK";
+  case 400:
+    return "Bad Request";
+  case 403:
+    return "Forbidden";
+  case 404:
+    return "Not Found";
+  case 405:
+    return "Method Not Allowed";
+  case 413:
+    return "Payload Too Large";
+  case 431:
+    return "Request Header Fields Too Large";
+  default:
+    return status >= 500 ? "Internal Server Error" : "Unknown";
+  }
+}
+
+// 解压 Content-Encoding: gzip 的请求体
+bool Gunzip(const std::string &input, std::string &output) {
+  z_stream stream;
+  memset(&stream, 0, sizeof(stream));
+  if (inflateInit2(&stream, 16 + MAX_WBITS) != Z_OK) {
+    return false;
+  }
+  stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(input.data()));
+  stream.avail_in = input.size();
+  char buffer[64 << 10];
+  int status = Z_OK;
+  while (status == Z_OK) {
+    stream.next_out = reinterpret_cast<Bytef *>(buffer);
+    stream.avail_out = sizeof(buffer);
+    status = inflate(&stream, Z_NO_FLUSH);
+    output.append(buffer, sizeof(buffer) - stream.avail_out);
+    if (output.size() > kMaxBodySize) {
+      status = Z_MEM_ERROR;
+    }
+  }
+  inflateEnd(&stream);
+  return status == Z_STREAM_END;
+}
+
+// 解析请求行和头部（不含结尾的空行）
+ParseStatus ParseHead(const std::string &head, HttpRequest &request,
+                      bool &keep_alive) {
+  size_t line_end = std::min(head.find("\r\n"), head.size());
+  std::string request_line = head.substr(0, line_end);
+  size_t sp1 = request_line.find(' ');
+  size_t sp2 = request_line.rfind(' ');
+  if (sp1 == std::string::npos || sp1 == sp2) {
+    return ParseStatus::kBad;
+  }
+  request.method = request_line.substr(0, sp1);
+  std::string target = request_line.substr(sp1 + 1, sp2 - sp1 - 1);
+  std::string version = request_line.substr(sp2 + 1);
+  if (!version.starts_with("HTTP/1.")) {
+    return ParseStatus::kBad;
+  }
+  size_t question = target.find('?');
+  request.path = target.substr(0, question);
+  if (question != std::string::npos) {
+    request.query = target.substr(question + 1);
+  }
+
+  size_t pos = line_end + 2;
+  while (pos < head.size()) {
+    size_t eol = std::min(head.find("\r\n", pos), head.size());
+    std::string line = head.substr(pos, eol - pos);
+    size_t colon = line.find(':');
+    if (colon == std::string::npos) {
+      return ParseStatus::kBad;
+    }
+    request.headers[Lower(Trim(line.substr(0, colon)))] =
+        Trim(line.substr(colon + 1));
+    pos = eol + 2;
+  }
+
+  std::string connection = Lower(request.Header("connection"));
+  keep_alive = version == "HTTP/1.1" ? connection != "close"
+                                     : connection == "keep-alive";
+  return ParseStatus::kComplete;
+}
+
+/**
+ * @brief 一个连接上的增量请求解析器
+ *
+ * 每次 recv 之后调用 Parse()，已经解析的字节从 input 中移除（请求体移入
+ * Request().body），状态保存在解析器中，因此每个字节只检查一次；大请求体
+ * 分成很多次到达时不会反复从头查找头部结尾或重新解码 chunk。
+ */
+class RequestParser {
+public:
+  /**
+   * @brief 解析 input 中新到的数据
+   * @return kComplete 时用 Take() 取走请求，input 中剩下的是下一个请求
+   */
+  ParseStatus Parse(std::string &input) {
+    while (true) {
+      switch (stage_) {
+      case Stage::kHead: {
+        // 分隔符可能跨越两次 recv，从上次检查位置之前 3 个字节开始找
+        size_t header_end =
+            input.find("\r\n\r\n", scanned_ < 3 ? 0 : scanned_ - 3);
+        if (header_end == std::string::npos) {
+          scanned_ = input.size();
+          return input.size() > kMaxHeaderSize ? ParseStatus::kTooLarge
+                                               : ParseStatus::kIncomplete;
+        }
+        ParseStatus status =
+            ParseHead(input.substr(0, header_end), request_, keep_alive_);
+        if (status != ParseStatus::kComplete) {
+          return status;
+        }
+        Consume(input, header_end + 4);
+        if (Lower(request_.Header("transfer-encoding")).find("chunked") !=
+            std::string::npos) {
+          stage_ = Stage::kChunkSize;
+          break;
+        }
+        try {
+          std::string value = request_.Header("content-length");
+          remaining_ = value.empty() ? 0 : std::stoull(value);
+        } catch (const std::exception &) {
+          return ParseStatus::kBad;
+        }
+        if (remaining_ > kMaxBodySize) {
+          return ParseStatus::kTooLarge;
+        }
+        request_.body.reserve(remaining_);
+        stage_ = Stage::kBody;
+        break;
+      }
+      case Stage::kBody:
+      case Stage::kChunkData: {
+        size_t size = std::min<uint64_t>(remaining_, input.size());
+        request_.body.append(input, 0, size);
+        input.erase(0, size);
+        remaining_ -= size;
+        if (remaining_ > 0) {
+          return ParseStatus::kIncomplete;
+        }
+        if (stage_ == Stage::kBody) {
+          return Finish();
+        }
+        stage_ = Stage::kChunkEnd;
+        break;
+      }
+      case Stage::kChunkEnd:
+        // chunk 数据后的 \r\n
+        if (input.size() < 2) {
+          return ParseStatus::kIncomplete;
+        }
+        input.erase(0, 2);
+        stage_ = Stage::kChunkSize;
+        break;
+      case Stage::kChunkSize:
+      case Stage::kTrailer: {
+        auto line = NextLine(input);
+        if (!line) {
+          return input.size() > kMaxHeaderSize ? ParseStatus::kTooLarge
+                                               : ParseStatus::kIncomplete;
+        }
+        if (stage_ == Stage::kTrailer) {
+          // 可能跟着若干 trailer 行，以空行结束
+          if (line->empty()) {
+            return Finish();
+          }
+          break;
+        }
+        try {
+          remaining_ = std::stoull(*line, nullptr, 16);
+        } catch (const std::exception &) {
+          return ParseStatus::kBad;
+        }
+        if (request_.body.size() + remaining_ > kMaxBodySize) {
+          return ParseStatus::kTooLarge;
+        }
+        stage_ = remaining_ == 0 ? Stage::kTrailer : Stage::kChunkData;
+        break;
+      }
+      }
+    }
+  }
+
+  // 已完整的请求；解析器回到初始状态
+  HttpRequest Take() {
+    HttpRequest request = std::move(request_);
+    *this = RequestParser();
+    return request;
+  }
+
+  // 解析出错后丢弃已解析的部分
+  void Reset() { *this = RequestParser(); }
+
+  // 头部已解析出的内容（出错时用来区分 431 和 413）
+  const HttpRequest &Request() const { return request_; }
+  bool KeepAlive() const { return keep_alive_; }
+
+  // 头部已完整、请求体还没收齐，且客户端在等待 100 Continue
+  bool ExpectContinue() const {
+    return stage_ != Stage::kHead &&
+           Lower(request_.Header("expect")) == "100-continue";
+  }
+
+private:
+  enum class Stage { kHead, kBody, kChunkSize, kChunkData, kChunkEnd, kTrailer };
+
+  void Consume(std::string &input, size_t size) {
+    input.erase(0, size);
+    scanned_ = 0;
+  }
+
+  // 取出 input 开头以 \r\n 结尾的一行；不完整时记下检查到的位置
+  std::optional<std::string> NextLine(std::string &input) {
+    size_t eol = input.find("\r\n", scanned_ < 1 ? 0 : scanned_ - 1);
+    if (eol == std::string::npos) {
+      scanned_ = input.size();
+      return std::nullopt;
+    }
+    std::string line = input.substr(0, eol);
+    Consume(input, eol + 2);
+    return line;
+  }
+
+  ParseStatus Finish() {
+    stage_ = Stage::kHead;
+    if (Lower(request_.Header("content-encoding")) == "gzip") {
+      std::string decoded;
+      if (!Gunzip(request_.body, decoded)) {
+        return ParseStatus::kBad;
+      }
+      request_.body = std::move(decoded);
+    }
+    return ParseStatus::kComplete;
+  }
+
+  Stage stage_ = Stage::kHead;
+  size_t scanned_ = 0;     // input 中已找过分隔符的长度
+  uint64_t remaining_ = 0; // 请求体或当前 chunk 还差的字节数
+  HttpRequest request_;
+  bool keep_alive_ = true;
+};
+
+} // namespace
+
+std::string HttpRequest::Header(const std::string &name) const {
+  auto it = headers.find(name);
+  return it == headers.end() ? "" : it->second;
+}
+
+struct HttpServer::Connection {
+  uint64_t id;
+  int fd;
+  uint32_t events = 0;
+  std::string input;           // 尚未解析的请求数据
+  RequestParser parser;
+  std::string output;          // 待发送的数据
+  size_t output_pos = 0;       // output 中已发送的字节数
+  std::unique_ptr<BodyStream> stream;
+  int file_fd = -1;            // 当前段中待 sendfile 的文件部分
+  off_t file_offset = 0;
+  uint64_t file_remaining = 0;
+  bool busy = false;           // 请求正在工作线程中处理
+  bool responding = false;     // 正在发送响应
+  bool keep_alive = true;
+  bool sent_continue = false;
+};
+
+HttpServer::HttpServer(Handler handler, int workers)
+    : handler_(std::move(handler)), next_id_(kWakeId + 1) {
+  if (workers <= 0) {
+    workers = std::max(2u, std::thread::hardware_concurrency());
+  }
+  workers_ = workers;
+  epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+  event_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (epoll_fd_ < 0 || event_fd_ < 0) {
+    throw std::runtime_error(std::string("http: epoll setup failed: ") +
+                             strerror(errno));
+  }
+  epoll_event event{};
+  event.events = EPOLLIN;
+  event.data.u64 = kWakeId;
+  epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, event_fd_, &event);
+}
+
+HttpServer::~HttpServer() {
+  Stop();
+  for (auto &thread : threads_) {
+    thread.join();
+  }
+  for (auto &[id, conn] : connections_) {
+    close(conn->fd);
+  }
+  if (listen_fd_ >= 0) {
+    close(listen_fd_);
+  }
+  close(event_fd_);
+  close(epoll_fd_);
+}
+
+void HttpServer::Listen(const std::string &host, uint16_t port) {
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  if (inet_pton(AF_INET, host.c_str(), &addr.sin_addr) != 1) {
+    throw std::runtime_error("http: invalid listen address " + host);
+  }
+  listen_fd_ = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  int one = 1;
+  setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  if (listen_fd_ < 0 ||
+      bind(listen_fd_, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0 ||
+      listen(listen_fd_, SOMAXCONN) != 0) {
+    throw std::runtime_error("http: cannot listen on " + host + ":" +
+                             std::to_string(port) + ": " + strerror(errno));
+  }
+  socklen_t len = sizeof(addr);
+  getsockname(listen_fd_, reinterpret_cast<sockaddr *>(&addr), &len);
+  port_ = ntohs(addr.sin_port);
+
+  epoll_event event{};
+  event.events = EPOLLIN;
+  event.data.u64 = kListenId;
+  epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, listen_fd_, &event);
+}
+
+void HttpServer::Run() {
+  for (int i = 0; i < workers_; i++) {
+    threads_.emplace_back(&HttpServer::WorkerLoop, this);
+  }
+  epoll_event events[64];
+  while (!stopping_) {
+    int n = epoll_wait(epoll_fd_, events, 64, -1);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      throw std::runtime_error(std::string("http: epoll_wait failed: ") +
+                               strerror(errno));
+    }
+    for (int i = 0; i < n; i++) {
+      uint64_t id = events[i].data.u64;
+      if (id == kListenId) {
+        Accept();
+        continue;
+      }
+      if (id == kWakeId) {
+        uint64_t count;
+        while (read(event_fd_, &count, sizeof(count)) > 0) {
+        }
+        DeliverResponses();
+        continue;
+      }
+      // 同一批事件中连接可能已经被关闭
+      auto it = connections_.find(id);
+      if (it == connections_.end()) {
+        continue;
+      }
+      Connection &conn = *it->second;
+      uint32_t ready = events[i].events;
+      if ((ready & (EPOLLERR | EPOLLHUP)) && !(ready & EPOLLIN)) {
+        CloseConnection(conn);
+        continue;
+      }
+      if (ready & EPOLLIN) {
+        OnReadable(conn);
+        if (!connections_.count(id)) {
+          continue;
+        }
+      }
+      if (ready & EPOLLOUT) {
+        Flush(conn);
+      }
+    }
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    jobs_.clear();
+  }
+  jobs_ready_.notify_all();
+  for (auto &thread : threads_) {
+    thread.join();
+  }
+  threads_.clear();
+}
+
+void HttpServer::Stop() {
+  stopping_ = true;
+  jobs_ready_.notify_all();
+  uint64_t one = 1;
+  [[maybe_unused]] ssize_t n = write(event_fd_, &one, sizeof(one));
+}
+
+void HttpServer::Accept() {
+  while (true) {
+    int fd = accept4(listen_fd_, nullptr, nullptr,
+                     SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0) {
+      return; // EAGAIN：已经没有待接受的连接
+    }
+    auto conn = std::make_unique<Connection>();
+    conn->id = next_id_++;
+    conn->fd = fd;
+    epoll_event event{};
+    event.events = EPOLLIN;
+    event.data.u64 = conn->id;
+    epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &event);
+    conn->events = EPOLLIN;
+    TRACE_COUNT("http_connections", 1);
+    connections_[conn->id] = std::move(conn);
+  }
+}
+
+void HttpServer::OnReadable(Connection &conn) {
+  char buffer[64 << 10];
+  while (true) {
+    ssize_t n = recv(conn.fd, buffer, sizeof(buffer), 0);
+    if (n > 0) {
+      conn.input.append(buffer, n);
+      continue;
+    }
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      break;
+    }
+    // 对端关闭或出错
+    CloseConnection(conn);
+    return;
+  }
+  ProcessInput(conn);
+}
+
+void HttpServer::ProcessInput(Connection &conn) {
+  if (conn.busy || conn.responding ||
+      conn.output_pos < conn.output.size()) {
+    return; // 上一个请求的响应还没发完，流水线请求留在 input 中
+  }
+  ParseStatus status = conn.parser.Parse(conn.input);
+  switch (status) {
+  case ParseStatus::kIncomplete:
+    if (conn.parser.ExpectContinue() && !conn.sent_continue) {
+      conn.sent_continue = true;
+      conn.output = "HTTP/1.1 100 Continue\r\n\r\n";
+      conn.output_pos = 0;
+      Flush(conn);
+    }
+    return;
+  case ParseStatus::kBad:
+    SendError(conn, 400, "malformed request\n");
+    return;
+  case ParseStatus::kTooLarge:
+    SendError(conn, conn.parser.Request().method.empty() ? 431 : 413,
+              "request too large\n");
+    return;
+  case ParseStatus::kComplete:
+    break;
+  }
+  conn.keep_alive = conn.parser.KeepAlive();
+  HttpRequest request = conn.parser.Take();
+  conn.sent_continue = false;
+  conn.busy = true;
+  SetEvents(conn, 0); // 处理期间不再读取
+  TRACE_COUNT("http_requests", 1);
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    jobs_.emplace_back(conn.id, std::move(request));
+  }
+  jobs_ready_.notify_one();
+}
+
+void HttpServer::SendError(Connection &conn, int status,
+                           const std::string &message) {
+  HttpResponse response;
+  response.status = status;
+  response.body = message;
+  conn.keep_alive = false;
+  conn.input.clear();
+  conn.parser.Reset();
+  StartResponse(conn, std::move(response));
+}
+
+void HttpServer::StartResponse(Connection &conn, HttpResponse response) {
+  uint64_t length = response.body.size() +
+                    (response.stream ? response.stream->Size() : 0);
+  std::string head = "HTTP/1.1 " + std::to_string(response.status) + " " +
+                     ReasonPhrase(response.status) + "\r\n";
+  head += "Content-Type: " + response.content_type + "\r\n";
+  head += "Content-Length: " + std::to_string(length) + "\r\n";
+  head += "Cache-Control: no-cache\r\n";
+  for (const auto &[name, value] : response.headers) {
+    head += name + ": " + value + "\r\n";
+  }
+  head += conn.keep_alive ? "Connection: keep-alive\r\n\r\n"
+                          : "Connection: close\r\n\r\n";
+  conn.output = head + response.body;
+  conn.output_pos = 0;
+  conn.stream = std::move(response.stream);
+  conn.busy = false;
+  conn.responding = true;
+  Flush(conn);
+}
+
+void HttpServer::Flush(Connection &conn) {
+  while (true) {
+    ssize_t n;
+    if (conn.output_pos < conn.output.size()) {
+      // 后面紧跟文件数据时用 MSG_MORE，让帧头和数据合并成完整的 TCP 段
+      n = send(conn.fd, conn.output.data() + conn.output_pos,
+               conn.output.size() - conn.output_pos,
+               MSG_NOSIGNAL | (conn.file_remaining ? MSG_MORE : 0));
+      if (n > 0) {
+        conn.output_pos += n;
+      }
+    } else if (conn.file_remaining > 0) {
+      n = sendfile(conn.fd, conn.file_fd, &conn.file_offset,
+                   std::min<uint64_t>(conn.file_remaining, kSendfileChunk));
+      if (n > 0) {
+        conn.file_remaining -= n;
+      } else if (n == 0) {
+        CloseConnection(conn); // 文件比声明的短
+        return;
+      }
+    } else {
+      conn.output.clear();
+      conn.output_pos = 0;
+      if (!conn.stream) {
+        break;
+      }
+      BodyChunk chunk;
+      try {
+        if (!conn.stream->Next(chunk)) {
+          conn.stream.reset();
+          continue;
+        }
+      } catch (const std::exception &e) {
+        // 响应头已经发出，只能断开连接让客户端发现数据不完整
+        TRACE_INSTANT("http stream error", e.what());
+        CloseConnection(conn);
+        return;
+      }
+      conn.output = std::move(chunk.data);
+      conn.file_fd = chunk.fd;
+      conn.file_offset = chunk.offset;
+      conn.file_remaining = chunk.fd >= 0 ? chunk.length : 0;
+      continue;
+    }
+    if (n > 0) {
+      TRACE_COUNT("http_sent_bytes", n);
+      continue;
+    }
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      SetEvents(conn, EPOLLOUT);
+      return;
+    }
+    CloseConnection(conn);
+    return;
+  }
+  // 发完的可能只是 100 Continue，此时继续读取请求体
+  bool finished = conn.responding;
+  conn.responding = false;
+  if (finished && !conn.keep_alive) {
+    CloseConnection(conn);
+    return;
+  }
+  SetEvents(conn, EPOLLIN);
+  if (!conn.input.empty()) {
+    ProcessInput(conn);
+  }
+}
+
+void HttpServer::DeliverResponses() {
+  std::vector<std::pair<uint64_t, HttpResponse>> done;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    done.swap(done_);
+  }
+  for (auto &[id, response] : done) {
+    auto it = connections_.find(id);
+    if (it == connections_.end()) {
+      continue; // 客户端已经断开，response 析构时释放资源
+    }
+    StartResponse(*it->second, std::move(response));
+  }
+}
+
+void HttpServer::SetEvents(Connection &conn, uint32_t events) {
+  if (conn.events == events) {
+    return;
+  }
+  epoll_event event{};
+  event.events = events;
+  event.data.u64 = conn.id;
+  epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, conn.fd, &event);
+  conn.events = events;
+}
+
+void HttpServer::CloseConnection(Connection &conn) {
+  epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, conn.fd, nullptr);
+  close(conn.fd);
+  connections_.erase(conn.id); // conn 在此之后失效
+}
+
+void HttpServer::WorkerLoop() {
+  while (true) {
+    std::pair<uint64_t, HttpRequest> job;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      jobs_ready_.wait(lock, [this] { return stopping_ || !jobs_.empty(); });
+      if (stopping_) {
+        return;
+      }
+      job = std::move(jobs_.front());
+      jobs_.pop_front();
+    }
+    TRACE_INSTANT("http request", job.second.method + " " + job.second.path);
+    HttpResponse response;
+    try {
+      response = handler_(job.second);
+    } catch (const std::exception &e) {
+      response = HttpResponse();
+      response.status = 500;
+      response.body = std::string(e.what()) + "\n";
+    }
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      done_.emplace_back(job.first, std::move(response));
+    }
+    uint64_t one = 1;
+    [[maybe_unused]] ssize_t n = write(event_fd_, &one, sizeof(one));
+  }
+}
@@ -0,0 +1,124 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+struct HttpRequest {
+  std::string method;
+  std::string path;  // 不含查询串
+  std::string query; // '?' 之后的部分
+  std::map<std::string, std::string> headers; // 头部名为小写
+  std::string body; // 已去掉 chunked 分块和 gzip 压缩
+
+  // 头部不存在时返回空字符串
+  std::string Header(const std::string &name) const;
+};
+
+// 响应体中的一段：先发送内存中的 data，再发送文件 fd 中 [offset, offset+length)
+struct BodyChunk {
+  std::string data;
+  int fd = -1; // 由 BodyStream 持有，服务器只用 sendfile 读取
+  uint64_t offset = 0;
+  uint64_t length = 0;
+};
+
+/**
+ * @brief 响应体的流式数据源
+ *
+ * 服务器在套接字可写、且上一段已经发送完时才调用 Next，因此大文件不需要
+ * 整个放进内存。文件中的数据用 sendfile 从页缓存直接发往套接字，不经过
+ * 用户态。
+ */
+class BodyStream {
+public:
+  virtual ~BodyStream() = default;
+  // 总长度，用于 Content-Length
+  virtual uint64_t Size() const = 0;
+  // 取下一段数据；已经没有数据时返回 false
+  virtual bool Next(BodyChunk &chunk) = 0;
+};
+
+struct HttpResponse {
+  int status = 200;
+  std::string content_type = "text/plain";
+  std::vector<std::pair<std::string, std::string>> headers;
+  std::string body;                   // 先发送
+  std::unique_ptr<BodyStream> stream; // 随后发送，可以为空
+};
+
+/**
+ * @brief 基于 epoll 的 HTTP/1.1 服务器
+ *
+ * 一个线程运行事件循环，负责所有连接的接受、读取请求和发送响应，套接字
+ * 都是非阻塞的，因此慢速客户端不会拖住其他连接。完整读到一个请求后，
+ * 交给工作线程池调用 handler（例如生成 pack），结果通过 eventfd 通知
+ * 事件循环，再由事件循环在套接字可写时分段发送（文件部分使用 sendfile）。
+ *
+ * 支持 keep-alive、chunked 请求体、gzip 压缩的请求体以及
+ * Expect: 100-continue。
+ */
+class HttpServer {
+public:
+  // 在工作线程中调用；抛出的异常转换为 500 响应
+  using Handler = std::function<HttpResponse(HttpRequest &request)>;
+
+  // workers 为 0 时使用 CPU 核数（至少2个）
+  explicit HttpServer(Handler handler, int workers = 0);
+  ~HttpServer();
+  HttpServer(const HttpServer &) = delete;
+  HttpServer &operator=(const HttpServer &) = delete;
+
+  /**
+   * @brief 监听 host:port，port 为 0 时由系统分配（见 Port()）
+   * @throws std::runtime_error 地址无效或绑定失败
+   */
+  void Listen(const std::string &host, uint16_t port);
+  uint16_t Port() const { return port_; }
+
+  // 运行事件循环，直到 Stop() 被调用
+  void Run();
+  // 线程安全，可以在其他线程中调用
+  void Stop();
+
+private:
+  struct Connection;
+
+  void Accept();
+  void OnReadable(Connection &conn);
+  void ProcessInput(Connection &conn);
+  void Flush(Connection &conn);
+  void DeliverResponses();
+  void SendError(Connection &conn, int status, const std::string &message);
+  void StartResponse(Connection &conn, HttpResponse response);
+  void SetEvents(Connection &conn, uint32_t events);
+  void CloseConnection(Connection &conn);
+  void WorkerLoop();
+
+  Handler handler_;
+  int workers_;
+  int listen_fd_ = -1;
+  int epoll_fd_ = -1;
+  int event_fd_ = -1; // 工作线程完成请求或 Stop() 时唤醒事件循环
+  uint16_t port_ = 0;
+  std::atomic<bool> stopping_{false};
+
+  uint64_t next_id_;
+  std::unordered_map<uint64_t, std::unique_ptr<Connection>> connections_;
+
+  std::mutex mutex_;
+  std::condition_variable jobs_ready_;
+  std::deque<std::pair<uint64_t, HttpRequest>> jobs_;
+  std::vector<std::pair<uint64_t, HttpResponse>> done_;
+  std::vector<std::thread> threads_;
+};
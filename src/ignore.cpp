@@ -0,0 +1,316 @@
+#include "ignore.h"
+#include "../include/clone_gadget.h"
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+namespace ignore {
+namespace {
+
+constexpr char kWildcards[] = "*?[\\";
+
+// [...] 中的 POSIX 字符类名，如 "alpha"
+bool InClass(std::string_view name, unsigned char c) {
+  if (name == "alnum") return isalnum(c);
+  if (name == "alpha") return isalpha(c);
+  if (name == "blank") return c == ' ' || c == '\t';
+  if (name == "cntrl") return iscntrl(c);
+  if (name == "digit") return isdigit(c);
+  if (name == "graph") return isgraph(c);
+  if (name == "lower") return islower(c);
+  if (name == "print") return isprint(c);
+  if (name == "punct") return ispunct(c);
+  if (name == "space") return isspace(c);
+  if (name == "upper") return isupper(c);
+  if (name == "xdigit") return isxdigit(c);
+  return false;
+}
+
+// 匹配 p 处的 [...]，成功时 p 移到 ']' 之后；没有 ']' 时不匹配
+bool MatchBracket(std::string_view pattern, size_t &p, unsigned char c) {
+  size_t i = p + 1;
+  bool negate = i < pattern.size() && (pattern[i] == '!' || pattern[i] == '^');
+  i += negate;
+  bool matched = false;
+  for (bool first = true; i < pattern.size(); first = false) {
+    char ch = pattern[i];
+    if (ch == ']' && !first) {
+      p = i + 1;
+      return matched != negate && c != '/';
+    }
+    if (ch == '[' && i + 1 < pattern.size() && pattern[i + 1] == ':') {
+      size_t end = pattern.find(":]", i + 2);
+      if (end != std::string_view::npos) {
+        matched |= InClass(pattern.substr(i + 2, end - i - 2), c);
+        i = end + 2;
+        continue;
+      }
+    }
+    if (ch == '\\' && i + 1 < pattern.size()) {
+      ch = pattern[++i];
+    }
+    unsigned char low = ch;
+    unsigned char high = ch;
+    if (i + 2 < pattern.size() && pattern[i + 1] == '-' && pattern[i + 2] != ']') {
+      i += 2;
+      if (pattern[i] == '\\' && i + 1 < pattern.size()) {
+        i++;
+      }
+      high = pattern[i];
+    }
+    matched |= low <= c && c <= high;
+    i++;
+  }
+  return false;
+}
+
+bool Match(std::string_view pattern, size_t p, std::string_view text, size_t t) {
+  while (p < pattern.size()) {
+    char c = pattern[p];
+    if (c == '*') {
+      size_t stars = p;
+      while (p < pattern.size() && pattern[p] == '*') {
+        p++;
+      }
+      // 完整路径段的 "**"：跨越 '/'
+      if (p - stars >= 2 && (stars == 0 || pattern[stars - 1] == '/') &&
+          (p == pattern.size() || pattern[p] == '/')) {
+        if (p == pattern.size()) {
+          return true;
+        }
+        // "**/"：零或多级目录
+        for (size_t s = t;;) {
+          if (Match(pattern, p + 1, text, s)) {
+            return true;
+          }
+          size_t slash = text.find('/', s);
+          if (slash == std::string_view::npos) {
+            return false;
+          }
+          s = slash + 1;
+        }
+      }
+      if (p == pattern.size()) {
+        return text.find('/', t) == std::string_view::npos;
+      }
+      for (size_t s = t;; s++) {
+        if (Match(pattern, p, text, s)) {
+          return true;
+        }
+        if (s == text.size() || text[s] == '/') {
+          return false;
+        }
+      }
+    }
+    if (t == text.size()) {
+      return false;
+    }
+    if (c == '?') {
+      if (text[t] == '/') {
+        return false;
+      }
+    } else if (c == '[') {
+      if (!MatchBracket(pattern, p, text[t])) {
+        return false;
+      }
+      t++;
+      continue;
+    } else {
+      if (c == '\\' && p + 1 < pattern.size()) {
+        c = pattern[++p];
+      }
+      if (c != text[t]) {
+        return false;
+      }
+    }
+    p++;
+    t++;
+  }
+  return t == text.size();
+}
+
+// 读取整个文件，不存在时返回 false
+bool ReadFile(const fs::path &path, std::string &content) {
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return false;
+  }
+  char buffer[16384];
+  for (;;) {
+    ssize_t n = read(fd, buffer, sizeof(buffer));
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      break;
+    }
+    content.append(buffer, n);
+  }
+  close(fd);
+  return true;
+}
+
+} // namespace
+
+bool WildMatch(std::string_view pattern, std::string_view text) {
+  return Match(pattern, 0, text, 0);
+}
+
+PatternList::PatternList(std::string_view content, std::string base)
+    : base_(std::move(base)) {
+  while (!content.empty()) {
+    size_t newline = content.find('\n');
+    std::string_view line = content.substr(0, newline);
+    content.remove_prefix(newline == std::string_view::npos ? content.size()
+                                                             : newline + 1);
+    if (!line.empty() && line.back() == '\r') {
+      line.remove_suffix(1);
+    }
+    // 末尾的空格忽略，"\ " 除外
+    while (!line.empty() && line.back() == ' ' &&
+           !(line.size() >= 2 && line[line.size() - 2] == '\\')) {
+      line.remove_suffix(1);
+    }
+    if (line.empty() || line[0] == '#') {
+      continue;
+    }
+    Pattern pattern;
+    if (line[0] == '!') {
+      pattern.negative = true;
+      line.remove_prefix(1);
+    }
+    if (!line.empty() && line.back() == '/') {
+      pattern.dir_only = true;
+      line.remove_suffix(1);
+    }
+    pattern.basename = line.find('/') == std::string_view::npos;
+    if (!line.empty() && line[0] == '/') {
+      line.remove_prefix(1);
+    }
+    if (line.empty()) {
+      continue;
+    }
+    pattern.text = line;
+    pattern.literal = std::min(line.find_first_of(kWildcards), line.size());
+
+    int index = patterns_.size();
+    if (pattern.literal == line.size()) {
+      (pattern.basename ? names_ : paths_)[pattern.text].push_back(index);
+    } else if (pattern.basename && line.size() > 2 && line[0] == '*' &&
+               line[1] == '.' &&
+               line.find_first_of(kWildcards, 1) == std::string_view::npos) {
+      suffixes_[pattern.text.substr(1)].push_back(index);
+    } else {
+      globs_.push_back(index);
+    }
+    patterns_.push_back(std::move(pattern));
+  }
+}
+
+int PatternList::Last(const std::vector<int> &indices, bool is_dir) const {
+  for (auto it = indices.rbegin(); it != indices.rend(); ++it) {
+    if (is_dir || !patterns_[*it].dir_only) {
+      return *it;
+    }
+  }
+  return -1;
+}
+
+Result PatternList::Match(std::string_view path, bool is_dir) const {
+  std::string_view rel = base_.empty() ? path : path.substr(base_.size() + 1);
+  size_t slash = rel.rfind('/');
+  std::string_view name =
+      slash == std::string_view::npos ? rel : rel.substr(slash + 1);
+  int best = -1;
+  if (auto it = names_.find(name); it != names_.end()) {
+    best = std::max(best, Last(it->second, is_dir));
+  }
+  if (auto it = paths_.find(rel); it != paths_.end()) {
+    best = std::max(best, Last(it->second, is_dir));
+  }
+  if (!suffixes_.empty()) {
+    for (size_t dot = name.find('.'); dot != std::string_view::npos;
+         dot = name.find('.', dot + 1)) {
+      if (auto it = suffixes_.find(name.substr(dot)); it != suffixes_.end()) {
+        best = std::max(best, Last(it->second, is_dir));
+      }
+    }
+  }
+  // 后面的规则优先：比已经找到的更早的规则不必再试
+  for (auto it = globs_.rbegin(); it != globs_.rend() && *it > best; ++it) {
+    const Pattern &pattern = patterns_[*it];
+    std::string_view target = pattern.basename ? name : rel;
+    if ((pattern.dir_only && !is_dir) ||
+        target.substr(0, pattern.literal) !=
+            std::string_view(pattern.text).substr(0, pattern.literal)) {
+      continue;
+    }
+    if (WildMatch(pattern.text, target)) {
+      best = *it;
+      break;
+    }
+  }
+  if (best < 0) {
+    return Result::kNone;
+  }
+  return patterns_[best].negative ? Result::kIncluded : Result::kIgnored;
+}
+
+Matcher::Matcher(fs::path worktree) : worktree_(std::move(worktree)) {
+  std::string content;
+  if (ReadFile(worktree_ / ".git/info/exclude", content)) {
+    exclude_ = PatternList(content, "");
+    exclude_digest_ = compute_sha1(content);
+  }
+}
+
+const std::string &Matcher::Push(const std::string &dir) {
+  Level level;
+  level.dir = dir;
+  std::string content;
+  if (ReadFile(worktree_ / dir / ".gitignore", content)) {
+    level.digest = compute_sha1(content);
+    level.patterns = PatternList(content, dir);
+  }
+  levels_.push_back(std::move(level));
+  return levels_.back().digest;
+}
+
+size_t Matcher::PushPath(const std::string &dir) {
+  size_t pushed = 0;
+  if (levels_.empty()) {
+    Push("");
+    pushed++;
+  }
+  std::string top = levels_.back().dir;
+  for (size_t pos = top.empty() ? 0 : top.size() + 1; pos < dir.size();) {
+    size_t end = std::min(dir.find('/', pos), dir.size());
+    Push(dir.substr(0, end));
+    pushed++;
+    pos = end + 1;
+  }
+  return pushed;
+}
+
+void Matcher::Pop(size_t levels) {
+  levels_.resize(levels_.size() - levels);
+}
+
+bool Matcher::Ignored(std::string_view path, bool is_dir) const {
+  for (auto it = levels_.rbegin(); it != levels_.rend(); ++it) {
+    if (it->patterns.Empty()) {
+      continue;
+    }
+    Result result = it->patterns.Match(path, is_dir);
+    if (result != Result::kNone) {
+      return result == Result::kIgnored;
+    }
+  }
+  return exclude_.Match(path, is_dir) == Result::kIgnored;
+}
+
+} // namespace ignore
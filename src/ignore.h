@@ -0,0 +1,129 @@
+#pragma once
+
+#include <filesystem>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * @brief .gitignore 规则
+ *
+ * 与 Git 相同的来源和优先级：路径所在目录及其各级父目录中的 .gitignore，
+ * 越深的越优先，最后是 .git/info/exclude。同一个文件中后面的规则优先，
+ * "!" 开头的规则把之前排除的路径重新包含进来。被排除的目录不再深入，其中
+ * 的文件无法再被包含（遍历时调用方直接跳过整个目录）。
+ *
+ * 规则的写法（gitignore(5)）：
+ *
+ * - 不含 '/' 的规则与任意深度的名字匹配；含 '/'（末尾的除外）的规则相对于
+ *   .gitignore 所在目录匹配整个路径，开头的 '/' 只表示这一点
+ * - 末尾的 '/' 表示只匹配目录
+ * - '*'、'?'、'[...]' 不匹配 '/'；开头或两个 '/' 之间的 "**" 匹配零或多级
+ *   目录，末尾的斜杠加两个星号匹配其下的一切
+ *
+ * 每个文件的规则编译一次：不含通配符的规则放进以名字或路径为键的散列表，
+ * "*.ext" 形式的按后缀查找，其余的先比较通配符之前的字面前缀，相同时才做
+ * 通配符匹配。一次查询只需几次散列查找，不随规则数增长。
+ */
+namespace ignore {
+
+enum class Result {
+  kNone,     // 没有规则匹配
+  kIgnored,  // 最后匹配的规则排除它
+  kIncluded, // 最后匹配的规则是 "!"
+};
+
+// 一个 .gitignore（或 info/exclude）编译后的规则
+class PatternList {
+public:
+  PatternList() = default;
+
+  // base：规则所在的目录，相对于工作区根目录，根目录为空字符串
+  PatternList(std::string_view content, std::string base);
+
+  bool Empty() const { return patterns_.empty(); }
+
+  // path 相对于工作区根目录，必须位于 base 之下
+  Result Match(std::string_view path, bool is_dir) const;
+
+private:
+  struct Pattern {
+    std::string text;   // 去掉 "!"、开头和末尾的 '/' 之后
+    size_t literal = 0; // 第一个通配符之前的字符数
+    bool negative = false;
+    bool dir_only = false;
+    bool basename = false; // 不含 '/'，与名字匹配
+  };
+
+  // indices 中（升序）最后一个适用于 is_dir 的规则，没有时为 -1
+  int Last(const std::vector<int> &indices, bool is_dir) const;
+
+  // 可以直接用 std::string_view 查找
+  struct Hash {
+    using is_transparent = void;
+    size_t operator()(std::string_view text) const {
+      return std::hash<std::string_view>()(text);
+    }
+  };
+  using Index =
+      std::unordered_map<std::string, std::vector<int>, Hash, std::equal_to<>>;
+
+  std::string base_;
+  std::vector<Pattern> patterns_;
+  Index names_;          // 字面名字
+  Index paths_;          // 字面路径
+  Index suffixes_;       // "*.ext"
+  std::vector<int> globs_; // 其余
+};
+
+/**
+ * @brief 遍历工作区时使用的规则栈
+ *
+ * 进入目录时 Push（读取其中的 .gitignore），离开时 Pop。Ignored() 按
+ * 栈中从深到浅的顺序查找，最后查 info/exclude。
+ */
+class Matcher {
+public:
+  // 读取 worktree/.git/info/exclude；栈为空，调用方从 Push("") 开始
+  explicit Matcher(std::filesystem::path worktree);
+
+  /**
+   * @brief 进入目录 dir（相对于工作区根目录），读取其中的 .gitignore
+   * @return 该 .gitignore 内容的 SHA-1，没有时为空字符串。调用方可以和上次
+   *         的记录比较，判断这一层的规则是否变过
+   */
+  const std::string &Push(const std::string &dir);
+
+  // 从栈顶所在目录逐级进入其下的 dir，返回进入的层数（之后 Pop 同样次数）
+  size_t PushPath(const std::string &dir);
+
+  void Pop(size_t levels = 1);
+
+  // path 是否被排除（不检查父目录：被排除的目录调用方本来就不会进入）
+  bool Ignored(std::string_view path, bool is_dir) const;
+
+  // info/exclude 内容的 SHA-1，没有时为空字符串
+  const std::string &ExcludeDigest() const { return exclude_digest_; }
+
+private:
+  struct Level {
+    std::string dir;
+    std::string digest;
+    PatternList patterns;
+  };
+
+  std::filesystem::path worktree_;
+  PatternList exclude_;
+  std::string exclude_digest_;
+  std::vector<Level> levels_;
+};
+
+/**
+ * @brief Git 的 wildmatch（路径模式）：'*'、'?'、'[...]' 不匹配 '/'，
+ *        "**" 作为完整的路径段时匹配任意多级
+ */
+bool WildMatch(std::string_view pattern, std::string_view text);
+
+} // namespace ignore
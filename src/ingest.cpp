@@ -0,0 +1,396 @@
+#include "ingest.h"
+#include "trace.h"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <fcntl.h>
+#include <mutex>
+#include <stdexcept>
+#include <string.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+
+namespace ingest {
+namespace {
+
+constexpr size_t kAlignment = 16;
+
+size_t AlignUp(size_t size) {
+  return (size + kAlignment - 1) & ~(kAlignment - 1);
+}
+
+} // namespace
+
+void Arena::AddBlock(size_t size) {
+  Block block;
+  block.data.reset(new char[size]);
+  block.size = size;
+  blocks_.push_back(std::move(block));
+  capacity_ += size;
+  used_ = 0;
+  block_allocations_++;
+}
+
+char *Arena::Allocate(size_t size) {
+  size = AlignUp(std::max<size_t>(size, 1));
+  allocations_++;
+  if (blocks_.empty() || blocks_.back().size - used_ < size) {
+    AddBlock(std::max(size, block_size_));
+  }
+  char *result = blocks_.back().data.get() + used_;
+  used_ += size;
+  return result;
+}
+
+void Arena::Reset() {
+  if (blocks_.size() > 1) {
+    size_t total = capacity_;
+    blocks_.clear();
+    capacity_ = 0;
+    AddBlock(total);
+  }
+  used_ = 0;
+}
+
+void Arena::Release() {
+  blocks_.clear();
+  blocks_.shrink_to_fit();
+  capacity_ = 0;
+  used_ = 0;
+}
+
+Inflater::Inflater() {
+  if (inflateInit(&stream_) != Z_OK) {
+    throw std::runtime_error("inflateInit failed");
+  }
+}
+
+Inflater::~Inflater() { inflateEnd(&stream_); }
+
+size_t Inflater::Inflate(const char *in, size_t in_size, char *out,
+                         size_t out_size) {
+  inflateReset(&stream_);
+  stream_.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(in));
+  stream_.avail_in = static_cast<uInt>(in_size);
+  stream_.next_out = reinterpret_cast<Bytef *>(out);
+  stream_.avail_out = static_cast<uInt>(out_size);
+  int status = inflate(&stream_, Z_FINISH);
+  if (status != Z_STREAM_END) {
+    // 输出空间用完而流未结束，说明实际长度大于对象头中的长度
+    throw std::runtime_error(
+        status == Z_BUF_ERROR && stream_.avail_out == 0
+            ? "pack object larger than its header says"
+            : std::string("corrupt pack object: ") +
+                  (stream_.msg ? stream_.msg : "truncated zlib stream"));
+  }
+  if (stream_.total_out != out_size) {
+    throw std::runtime_error("pack object smaller than its header says");
+  }
+  return stream_.total_in;
+}
+
+WriteMode DefaultWriteMode() {
+  const char *mode = getenv("MINIGIT_OBJECT_WRITER");
+  if (mode && strcmp(mode, "threads") == 0) {
+    return WriteMode::kThreads;
+  }
+  return WriteMode::kUring;
+}
+
+LooseObjectWriter::LooseObjectWriter(const std::string &dir, WriteMode mode)
+    : objects_dir_(dir + "/.git/objects"), transaction_(dir + "/.git") {
+  if (deflateInit(&stream_, Z_DEFAULT_COMPRESSION) != Z_OK) {
+    throw std::runtime_error("deflateInit failed");
+  }
+  fsync_ = transaction_.Method() == durability::FsyncMethod::kFsync;
+  if (mode == WriteMode::kUring) {
+    // 一批的 open 一次提交，write、fsync（fsync 方式）和 close 一起提交
+    uring_ = IoUring::Create((fsync_ ? 3 : 2) * kBatchObjects,
+                             {IORING_OP_OPENAT, IORING_OP_WRITE,
+                              IORING_OP_FSYNC, IORING_OP_CLOSE});
+  }
+  pending_.reserve(kBatchObjects);
+}
+
+LooseObjectWriter::~LooseObjectWriter() {
+  try {
+    Flush();
+  } catch (const std::exception &) {
+  }
+  deflateEnd(&stream_);
+}
+
+void LooseObjectWriter::Write(const char *hash, const char *data,
+                              size_t size) {
+  deflateReset(&stream_);
+  size_t bound = deflateBound(&stream_, size);
+  if (batch_.size() < batch_used_ + bound) {
+    batch_.resize(std::max(batch_used_ + bound, 2 * batch_.size()));
+    TRACE_COUNT("ingest_deflate_buffer_grows", 1);
+  }
+  stream_.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data));
+  stream_.avail_in = static_cast<uInt>(size);
+  stream_.next_out = batch_.data() + batch_used_;
+  stream_.avail_out = static_cast<uInt>(bound);
+  if (deflate(&stream_, Z_FINISH) != Z_STREAM_END) {
+    throw std::runtime_error(std::string("cannot compress object ") +
+                             std::string(hash, 40));
+  }
+
+  Pending object;
+  object.path[0] = hash[0];
+  object.path[1] = hash[1];
+  object.path[2] = '/';
+  memcpy(object.path + 3, hash + 2, 38);
+  object.path[41] = '\0';
+  object.offset = batch_used_;
+  object.size = stream_.total_out;
+  object.raw_size = size;
+  pending_.push_back(object);
+  batch_used_ += object.size;
+
+  if (pending_.size() >= kBatchObjects || batch_used_ >= kBatchBytes) {
+    Flush();
+  }
+}
+
+bool LooseObjectWriter::ReadQueued(const std::string &hash,
+                                   GitObject &object) {
+  if (hash.size() != 40) {
+    return false;
+  }
+  // 一批最多 kBatchObjects 个对象，从新到旧线性查找即可；delta 的基础
+  // 对象通常就在附近
+  for (auto it = pending_.rbegin(); it != pending_.rend(); ++it) {
+    if (it->path[0] != hash[0] || it->path[1] != hash[1] ||
+        memcmp(it->path + 3, hash.data() + 2, 38) != 0) {
+      continue;
+    }
+    std::string raw(it->raw_size, '\0');
+    uLongf raw_size = raw.size();
+    if (uncompress(reinterpret_cast<Bytef *>(raw.data()), &raw_size,
+                   batch_.data() + it->offset, it->size) != Z_OK ||
+        raw_size != raw.size()) {
+      throw std::runtime_error("cannot read queued object " + hash);
+    }
+    size_t space = raw.find(' ');
+    size_t nul = raw.find('\0');
+    auto type = ParseObjectType(raw.substr(0, space));
+    if (space == std::string::npos || nul == std::string::npos || !type) {
+      throw std::runtime_error("bad queued object " + hash);
+    }
+    object.type = *type;
+    object.data = raw.substr(nul + 1);
+    return true;
+  }
+  // batch 方式下之前几批的对象还在隔离目录中
+  if (auto staged = transaction_.ReadStaged(hash)) {
+    object = std::move(*staged);
+    return true;
+  }
+  return false;
+}
+
+void LooseObjectWriter::Flush() {
+  if (pending_.empty()) {
+    return;
+  }
+  // 本批用到的扇出目录中还没建的，每个只建一次
+  for (const Pending &object : pending_) {
+    transaction_.MakeStagingDir(object.path);
+  }
+  TRACE_COUNT("loose_write_batches", 1);
+  TRACE_COUNT("loose_objects_queued", pending_.size());
+  std::vector<char> created(pending_.size(), 0);
+  if (uring_) {
+    FlushWithUring(created);
+  } else {
+    FlushWithThreads(created);
+  }
+  // fsync 方式下本批新写的对象都已落盘，移到 objects 目录；batch 方式下
+  // 记下等 Commit()
+  for (size_t i = 0; i < pending_.size(); i++) {
+    if (created[i]) {
+      transaction_.Staged(pending_[i].path);
+    }
+  }
+  pending_.clear();
+  batch_used_ = 0;
+}
+
+void LooseObjectWriter::Commit() {
+  Flush();
+  transaction_.Commit();
+}
+
+void LooseObjectWriter::FlushWithUring(std::vector<char> &created) {
+  int dir_fd = transaction_.StagingFd();
+  // 第一轮：全部 openat；已存在的对象得到 EEXIST，跳过
+  std::vector<int> fds(pending_.size(), -1);
+  for (size_t i = 0; i < pending_.size(); i++) {
+    io_uring_sqe *sqe = uring_->NextSqe();
+    sqe->opcode = IORING_OP_OPENAT;
+    sqe->fd = dir_fd;
+    sqe->addr = reinterpret_cast<uint64_t>(pending_[i].path);
+    sqe->open_flags = O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC;
+    sqe->len = 0444;
+    sqe->user_data = i;
+  }
+  std::string error;
+  uring_->SubmitAndWait([&](uint64_t i, int res) {
+    if (res >= 0) {
+      fds[i] = res;
+    } else if (res != -EEXIST && error.empty()) {
+      error = "cannot create " + objects_dir_ + "/" + pending_[i].path + ": " +
+              strerror(-res);
+    }
+  });
+
+  // 第二轮：每个新文件一个 write、一个 fsync（fsync 方式）和一个 close。
+  // 同一批内的请求没有先后顺序，所以用 IOSQE_IO_LINK 把它们链起来
+  std::vector<int> written(pending_.size(), -1);
+  std::vector<int> synced(pending_.size(), 0);
+  size_t opened = 0;
+  for (size_t i = 0; i < pending_.size(); i++) {
+    if (fds[i] < 0) {
+      continue;
+    }
+    opened++;
+    io_uring_sqe *write_sqe = uring_->NextSqe();
+    write_sqe->opcode = IORING_OP_WRITE;
+    write_sqe->fd = fds[i];
+    write_sqe->addr =
+        reinterpret_cast<uint64_t>(batch_.data() + pending_[i].offset);
+    write_sqe->len = static_cast<uint32_t>(pending_[i].size);
+    write_sqe->off = 0;
+    write_sqe->flags = IOSQE_IO_LINK;
+    write_sqe->user_data = 3 * i;
+    if (fsync_) {
+      io_uring_sqe *fsync_sqe = uring_->NextSqe();
+      fsync_sqe->opcode = IORING_OP_FSYNC;
+      fsync_sqe->fd = fds[i];
+      fsync_sqe->flags = IOSQE_IO_LINK;
+      fsync_sqe->user_data = 3 * i + 1;
+    }
+    io_uring_sqe *close_sqe = uring_->NextSqe();
+    close_sqe->opcode = IORING_OP_CLOSE;
+    close_sqe->fd = fds[i];
+    close_sqe->user_data = 3 * i + 2;
+  }
+  std::vector<size_t> unclosed;
+  if (opened > 0) {
+    uring_->SubmitAndWait([&](uint64_t data, int res) {
+      size_t i = data / 3;
+      if (data % 3 == 0) {
+        written[i] = res;
+      } else if (data % 3 == 1) {
+        synced[i] = res;
+      } else if (res == -ECANCELED) {
+        // 写入不完整或 fsync 失败时链被打断，close 被取消，之后自己关闭
+        unclosed.push_back(i);
+      }
+    });
+  }
+  for (size_t i : unclosed) {
+    close(fds[i]);
+  }
+  TRACE_COUNT("loose_objects_written", opened);
+  TRACE_COUNT("loose_write_uring_submits", opened > 0 ? 2 : 1);
+  if (fsync_) {
+    TRACE_COUNT("fsync_objects", opened);
+  }
+
+  for (size_t i = 0; i < pending_.size(); i++) {
+    if (fds[i] < 0) {
+      continue;
+    }
+    if (written[i] == static_cast<int>(pending_[i].size) && synced[i] >= 0) {
+      created[i] = 1;
+      continue;
+    }
+    // 写入失败或不完整：删掉半个对象，不留下损坏的文件
+    unlinkat(dir_fd, pending_[i].path, 0);
+    if (error.empty()) {
+      error = "cannot write " + objects_dir_ + "/" + pending_[i].path +
+              (written[i] < 0   ? std::string(": ") + strerror(-written[i])
+               : synced[i] < 0 ? std::string(": ") + strerror(-synced[i])
+                               : std::string(": short write"));
+    }
+  }
+  if (!error.empty()) {
+    throw std::runtime_error(error);
+  }
+}
+
+void LooseObjectWriter::FlushWithThreads(std::vector<char> &created) {
+  int dir_fd = transaction_.StagingFd();
+  size_t threads = std::min<size_t>(
+      std::max(1u, std::thread::hardware_concurrency()), 8);
+  threads = std::min(threads, (pending_.size() + 15) / 16);
+  std::atomic<size_t> next{0};
+  std::atomic<size_t> written{0};
+  std::mutex error_mutex;
+  std::string error;
+  auto worker = [&] {
+    for (size_t i; (i = next.fetch_add(1)) < pending_.size();) {
+      const Pending &object = pending_[i];
+      int fd = openat(dir_fd, object.path,
+                      O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0444);
+      if (fd < 0 && errno == EEXIST) {
+        continue;
+      }
+      bool ok = fd >= 0;
+      const unsigned char *data = batch_.data() + object.offset;
+      for (size_t done = 0; ok && done < object.size;) {
+        ssize_t n = write(fd, data + done, object.size - done);
+        if (n < 0 && errno == EINTR) {
+          continue;
+        }
+        ok = n > 0;
+        done += ok ? n : 0;
+      }
+      if (ok && fsync_) {
+        ok = fsync(fd) == 0;
+      }
+      int saved_errno = errno;
+      if (fd >= 0) {
+        close(fd);
+      }
+      if (ok) {
+        created[i] = 1;
+        written++;
+        continue;
+      }
+      if (fd >= 0) {
+        unlinkat(dir_fd, object.path, 0);
+      }
+      std::lock_guard<std::mutex> lock(error_mutex);
+      if (error.empty()) {
+        error = "cannot write " + objects_dir_ + "/" + object.path + ": " +
+                strerror(saved_errno);
+      }
+    }
+  };
+  if (threads <= 1) {
+    worker();
+  } else {
+    std::vector<std::thread> pool;
+    for (size_t t = 0; t < threads; t++) {
+      pool.emplace_back(worker);
+    }
+    for (auto &thread : pool) {
+      thread.join();
+    }
+  }
+  TRACE_COUNT("loose_objects_written", written.load());
+  if (fsync_) {
+    TRACE_COUNT("fsync_objects", written.load());
+  }
+  if (!error.empty()) {
+    throw std::runtime_error(error);
+  }
+}
+
+} // namespace ingest
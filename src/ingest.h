@@ -0,0 +1,195 @@
+#pragma once
+
+#include "durability.h"
+#include "object_store.h"
+#include "uring.h"
+#include <cstddef>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <vector>
+#include <zlib.h>
+
+/**
+ * @brief 克隆时解包对象（ingest）用的缓冲区与流
+ *
+ * 原来每个对象都要经过好几个新分配的 std::string：截取 pack 剩余部分、
+ * 解压结果、拼接对象头、为了求压缩长度再压缩一遍，分配器在 profile 中
+ * 占了大头。这里的做法是：
+ *
+ * - Arena：按块申请内存的单调分配器。每个对象的缓冲区按 pack 对象头中的
+ *   长度一次分配好，处理完一个对象调用 Reset() 整体回收，块留给下一个
+ *   对象；一个阶段（整个 pack）结束时 Release() 一次性释放。
+ * - Inflater / LooseObjectWriter：zlib 流在对象之间复用（inflateReset /
+ *   deflateReset），不再为每个对象重新申请 zlib 的内部状态。
+ *
+ * 稳定状态下处理一个非 delta 对象不需要任何堆分配。
+ */
+namespace ingest {
+
+class Arena {
+public:
+  static constexpr size_t kDefaultBlockSize = 1 << 20;
+
+  explicit Arena(size_t block_size = kDefaultBlockSize)
+      : block_size_(block_size) {}
+  Arena(const Arena &) = delete;
+  Arena &operator=(const Arena &) = delete;
+
+  // 分配 size 字节（16 字节对齐），在 Reset/Release 之前一直有效
+  char *Allocate(size_t size);
+
+  /**
+   * @brief 回收全部分配，保留内存
+   *
+   * 用到了多个块时合并成一个足够大的块，之后同样大小的一轮分配只用一个块。
+   */
+  void Reset();
+
+  // 释放全部内存
+  void Release();
+
+  size_t Capacity() const { return capacity_; }
+  // 向系统申请块的次数
+  size_t BlockAllocations() const { return block_allocations_; }
+  // Allocate 的调用次数
+  size_t Allocations() const { return allocations_; }
+
+private:
+  struct Block {
+    std::unique_ptr<char[]> data;
+    size_t size = 0;
+  };
+
+  void AddBlock(size_t size);
+
+  std::vector<Block> blocks_;
+  size_t block_size_;
+  size_t used_ = 0; // 最后一个块中已用的字节数
+  size_t capacity_ = 0;
+  size_t block_allocations_ = 0;
+  size_t allocations_ = 0;
+};
+
+/**
+ * @brief 可复用的 zlib 解压流
+ */
+class Inflater {
+public:
+  Inflater();
+  ~Inflater();
+  Inflater(const Inflater &) = delete;
+  Inflater &operator=(const Inflater &) = delete;
+
+  /**
+   * @brief 从 in 解压一个完整的 zlib 流到 out
+   * @param out_size 解压后的长度（pack 对象头中的长度），必须完全一致
+   * @return 流在 in 中占用的字节数，即下一个对象的偏移
+   * @throws std::runtime_error 数据损坏、被截断或长度与 out_size 不符
+   */
+  size_t Inflate(const char *in, size_t in_size, char *out, size_t out_size);
+
+private:
+  z_stream stream_{};
+};
+
+// 松散对象的写入方式
+enum class WriteMode {
+  kUring,   // io_uring 批量提交 open/write/close，不可用时退回 kThreads
+  kThreads, // 线程池中用普通的系统调用
+};
+
+/**
+ * @brief 环境变量 MINIGIT_OBJECT_WRITER（"uring"/"threads"）指定的方式，
+ *        默认 kUring
+ */
+WriteMode DefaultWriteMode();
+
+/**
+ * @brief 把对象压缩写入 <dir>/.git/objects/xx/yyyy...
+ *
+ * Write() 只在调用线程上压缩，压缩结果进入队列；攒满一批（kBatchObjects
+ * 个对象或 kBatchBytes 字节）或调用 Flush() 时一次写出：
+ *
+ * - io_uring：所有 openat 一次提交，再把所有 write 和 close 一次提交，
+ *   一批对象只需要两次 io_uring_enter
+ * - 线程池：几个线程分担一批对象的 open/write/close
+ *
+ * 扇出目录（objects/xx）在第一次用到时建好并记下，之后不再检查；写对象
+ * 本身不做任何 exists/stat。对象文件以 O_EXCL 创建，已存在的对象不会被
+ * 重写。Flush() 返回之前，队列中的对象不在磁盘上，读取刚写入的
+ * 对象前必须先 Flush()。
+ *
+ * 持久化按 core.fsyncMethod（见 durability.h）：fsync 方式下对象先写到
+ * 隔离目录，write 之后链上 fsync，一批写完后 rename 到 objects 目录；
+ * batch 方式下对象留在隔离目录中，Commit() 时一次 syncfs 之后才移过去。
+ */
+class LooseObjectWriter {
+public:
+  static constexpr size_t kBatchObjects = 256;
+  static constexpr size_t kBatchBytes = 8 << 20;
+
+  explicit LooseObjectWriter(const std::string &dir,
+                             WriteMode mode = DefaultWriteMode());
+  // 尽量写出队列中剩下的对象，失败时不抛异常；需要知道结果时先调用 Flush()。
+  // batch 方式下没有 Commit() 的对象被丢弃
+  ~LooseObjectWriter();
+  LooseObjectWriter(const LooseObjectWriter &) = delete;
+  LooseObjectWriter &operator=(const LooseObjectWriter &) = delete;
+
+  /**
+   * @brief 压缩一个对象并放入队列，队列满时写出整批
+   * @param hash 40 字符十六进制哈希
+   * @param data 含 "<类型> <长度>\0" 头的完整对象
+   * @throws std::runtime_error 压缩或写出失败
+   */
+  void Write(const char *hash, const char *data, size_t size);
+
+  /**
+   * @brief 从队列或隔离目录中读取还不在 objects 目录中的对象（例如
+   *        delta 的基础对象）
+   * @return 对象不在其中时返回 false
+   */
+  bool ReadQueued(const std::string &hash, GitObject &object);
+
+  /**
+   * @brief 写出队列中的全部对象
+   * @throws std::runtime_error 创建或写入文件失败
+   */
+  void Flush();
+
+  /**
+   * @brief 写出队列中的全部对象，并提交写入事务（batch 方式下此时才落盘
+   *        并出现在 objects 目录中）
+   * @throws std::runtime_error 写入、syncfs 或 rename 失败
+   */
+  void Commit();
+
+  // 实际使用的方式（kUring 不可用时为 kThreads）
+  WriteMode Mode() const {
+    return uring_ ? WriteMode::kUring : WriteMode::kThreads;
+  }
+
+private:
+  struct Pending {
+    char path[42]; // "xx/yyyy..."，相对于 objects 目录
+    size_t offset; // 压缩数据在 batch_ 中的位置
+    size_t size;
+    size_t raw_size; // 压缩前的长度
+  };
+
+  // created[i] 标记本批中新写出的对象
+  void FlushWithUring(std::vector<char> &created);
+  void FlushWithThreads(std::vector<char> &created);
+
+  std::string objects_dir_;
+  durability::ObjectTransaction transaction_;
+  bool fsync_ = false;
+  z_stream stream_{};
+  std::unique_ptr<IoUring> uring_;
+  std::vector<Pending> pending_;
+  std::vector<unsigned char> batch_; // 本批全部对象的压缩数据
+  size_t batch_used_ = 0;
+};
+
+} // namespace ingest
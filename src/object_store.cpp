@@ -0,0 +1,275 @@
+#include "object_store.h"
+#include "../include/clone_gadget.h"
+#include "pack.h"
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <zlib.h>
+
+namespace fs = std::filesystem;
+
+const char *ObjectTypeName(ObjectType type) {
+  switch (type) {
+  case ObjectType::kCommit:
+    return "commit";
+  case ObjectType::kTree:
+    return "tree";
+  case ObjectType::kBlob:
+    return "blob";
+  case ObjectType::kTag:
+    return "tag";
+  }
+  return "unknown";
+}
+
+std::optional<ObjectType> ParseObjectType(const std::string &name) {
+  if (name == "commit") {
+    return ObjectType::kCommit;
+  }
+  if (name == "tree") {
+    return ObjectType::kTree;
+  }
+  if (name == "blob") {
+    return ObjectType::kBlob;
+  }
+  if (name == "tag") {
+    return ObjectType::kTag;
+  }
+  return std::nullopt;
+}
+
+namespace {
+
+// 解析 "<类型> <长度>\0"，返回类型、长度和内容起始位置
+std::optional<std::pair<ObjectType, size_t>>
+ParseLooseHeader(const std::string &raw, size_t &body) {
+  size_t space = raw.find(' ');
+  size_t nul = raw.find('\0');
+  if (space == std::string::npos || nul == std::string::npos || space > nul) {
+    return std::nullopt;
+  }
+  auto type = ParseObjectType(raw.substr(0, space));
+  if (!type) {
+    return std::nullopt;
+  }
+  size_t size = 0;
+  try {
+    size = std::stoull(raw.substr(space + 1, nul - space - 1));
+  } catch (const std::exception &) {
+    return std::nullopt;
+  }
+  body = nul + 1;
+  return std::make_pair(*type, size);
+}
+
+// 与 Git 相同，alternates 最多嵌套这么多层
+constexpr int kMaxAlternateDepth = 5;
+
+bool IsHex(const std::string &text) {
+  return text.find_first_not_of("0123456789abcdef") == std::string::npos;
+}
+
+} // namespace
+
+ObjectStore::ObjectStore(fs::path git_dir)
+    : git_dir_(std::move(git_dir)), objects_dir_(git_dir_ / "objects") {
+  ReloadPacks();
+  LoadAlternates(0);
+}
+
+ObjectStore::ObjectStore(fs::path objects_dir, int depth)
+    : objects_dir_(std::move(objects_dir)) {
+  ReloadPacks();
+  LoadAlternates(depth);
+}
+
+std::unique_ptr<ObjectStore> ObjectStore::ForObjectsDir(fs::path objects_dir) {
+  return std::unique_ptr<ObjectStore>(new ObjectStore(std::move(objects_dir), 0));
+}
+
+void ObjectStore::LoadAlternates(int depth) {
+  std::ifstream file(objects_dir_ / "info/alternates");
+  std::string line;
+  while (std::getline(file, line)) {
+    if (line.empty() || line[0] == '#') {
+      continue;
+    }
+    if (depth >= kMaxAlternateDepth) {
+      std::cerr << "warning: ignoring alternate object stores, nesting too "
+                   "deep\n";
+      return;
+    }
+    fs::path path = line;
+    if (path.is_relative()) {
+      path = objects_dir_ / path;
+    }
+    std::error_code ec;
+    if (!fs::is_directory(path, ec)) {
+      std::cerr << "warning: ignoring alternate object store " << path
+                << ": not a directory\n";
+      continue;
+    }
+    alternates_.push_back(
+        std::unique_ptr<ObjectStore>(new ObjectStore(path, depth + 1)));
+  }
+}
+
+ObjectStore::~ObjectStore() = default;
+
+void ObjectStore::ReloadPacks() {
+  packs_.clear();
+  std::error_code ec;
+  if (!fs::is_directory(PackDir(), ec)) {
+    return;
+  }
+  std::vector<fs::path> idx_files;
+  for (const auto &entry : fs::directory_iterator(PackDir(), ec)) {
+    const fs::path &path = entry.path();
+    if (path.extension() == ".idx" &&
+        path.filename().string().starts_with("pack-")) {
+      idx_files.push_back(path);
+    }
+  }
+  std::sort(idx_files.begin(), idx_files.end());
+  for (const auto &path : idx_files) {
+    try {
+      packs_.push_back(std::make_unique<pack::PackFile>(path));
+    } catch (const std::runtime_error &e) {
+      std::cerr << "warning: ignoring pack " << path << ": " << e.what()
+                << '\n';
+    }
+  }
+}
+
+fs::path ObjectStore::LoosePath(const std::string &hash) const {
+  return objects_dir_ / hash.substr(0, 2) / hash.substr(2);
+}
+
+bool ObjectStore::HasLoose(const std::string &hash) const {
+  std::error_code ec;
+  return hash.size() == 40 && fs::exists(LoosePath(hash), ec);
+}
+
+bool ObjectStore::InAnyPack(const std::string &hash) const {
+  for (const auto &pack : packs_) {
+    if (pack->Find(hash)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool ObjectStore::Contains(const std::string &hash) const {
+  if (HasLoose(hash) || InAnyPack(hash)) {
+    return true;
+  }
+  for (const auto &alternate : alternates_) {
+    if (alternate->Contains(hash)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+std::optional<GitObject> ObjectStore::ReadLoose(const std::string &hash) const {
+  std::ifstream file(LoosePath(hash), std::ios::binary);
+  if (!file.is_open()) {
+    return std::nullopt;
+  }
+  std::stringstream buffer;
+  buffer << file.rdbuf();
+  std::string raw = decompress_string(buffer.str());
+  size_t body = 0;
+  auto header = ParseLooseHeader(raw, body);
+  if (!header || raw.size() - body != header->second) {
+    throw std::runtime_error("corrupt loose object " + hash);
+  }
+  return GitObject{header->first, raw.substr(body)};
+}
+
+std::optional<GitObject> ObjectStore::Read(const std::string &hash) const {
+  if (hash.size() != 40 || !IsHex(hash)) {
+    return std::nullopt;
+  }
+  if (auto object = ReadLoose(hash)) {
+    return object;
+  }
+  for (const auto &pack : packs_) {
+    if (auto offset = pack->Find(hash)) {
+      return pack->ReadAt(*offset, [this](const std::string &base) {
+        return Read(base);
+      });
+    }
+  }
+  for (const auto &alternate : alternates_) {
+    if (auto object = alternate->Read(hash)) {
+      return object;
+    }
+  }
+  return std::nullopt;
+}
+
+std::optional<std::pair<ObjectType, size_t>>
+ObjectStore::ReadHeader(const std::string &hash) const {
+  if (hash.size() != 40 || !IsHex(hash)) {
+    return std::nullopt;
+  }
+  std::ifstream file(LoosePath(hash), std::ios::binary);
+  if (file.is_open()) {
+    // 头部很短，只解压开头一小段
+    char in[256];
+    file.read(in, sizeof(in));
+    char out[64];
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    if (inflateInit(&stream) != Z_OK) {
+      throw std::runtime_error("inflateInit failed while reading " + hash);
+    }
+    stream.next_in = reinterpret_cast<Bytef *>(in);
+    stream.avail_in = file.gcount();
+    stream.next_out = reinterpret_cast<Bytef *>(out);
+    stream.avail_out = sizeof(out);
+    inflate(&stream, Z_SYNC_FLUSH);
+    std::string raw(out, stream.total_out);
+    inflateEnd(&stream);
+    size_t body = 0;
+    auto header = ParseLooseHeader(raw, body);
+    if (!header) {
+      throw std::runtime_error("corrupt loose object " + hash);
+    }
+    return header;
+  }
+  for (const auto &pack : packs_) {
+    if (auto offset = pack->Find(hash)) {
+      return pack->InfoAt(*offset, [this](const std::string &base) {
+        return Read(base);
+      });
+    }
+  }
+  for (const auto &alternate : alternates_) {
+    if (auto header = alternate->ReadHeader(hash)) {
+      return header;
+    }
+  }
+  return std::nullopt;
+}
+
+std::vector<std::string> ObjectStore::ListLoose() const {
+  std::vector<std::string> hashes;
+  std::error_code ec;
+  for (const auto &dir : fs::directory_iterator(objects_dir_, ec)) {
+    std::string prefix = dir.path().filename().string();
+    if (prefix.size() != 2 || !IsHex(prefix) || !dir.is_directory()) {
+      continue;
+    }
+    for (const auto &file : fs::directory_iterator(dir.path(), ec)) {
+      std::string rest = file.path().filename().string();
+      if (rest.size() == 38 && IsHex(rest)) {
+        hashes.push_back(prefix + rest);
+      }
+    }
+  }
+  std::sort(hashes.begin(), hashes.end());
+  return hashes;
+}
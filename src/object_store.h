@@ -0,0 +1,109 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace pack {
+class PackFile;
+}
+
+// 对象类型，取值与 pack 文件中的类型编码一致
+enum class ObjectType : uint8_t {
+  kCommit = 1,
+  kTree = 2,
+  kBlob = 3,
+  kTag = 4,
+};
+
+// "commit"/"tree"/"blob"/"tag"
+const char *ObjectTypeName(ObjectType type);
+
+// 解析松散对象头中的类型名，无法识别时返回 std::nullopt
+std::optional<ObjectType> ParseObjectType(const std::string &name);
+
+struct GitObject {
+  ObjectType type = ObjectType::kBlob;
+  std::string data; // 不含 "<类型> <长度>\0" 头部
+};
+
+/**
+ * @brief 对象库：统一读取松散对象和 pack 中的对象
+ *
+ * 查找顺序为先松散对象（.git/objects/xx/yyyy...），再依次查找
+ * .git/objects/pack/ 下每个有 .idx 的 pack。所有读取对象的代码都应经过这里，
+ * 这样 repack/gc 把松散对象打包并删除后，cat-file、ls-tree、checkout 等
+ * 命令仍然可以正常工作。
+ *
+ * 本地找不到时再依次查找 .git/objects/info/alternates 中列出的对象目录
+ * （与 Git 相同：每行一个路径，相对路径相对于本仓库的 objects 目录，'#'
+ * 开头的行是注释；备用库自己的 alternates 也会被读取，最多嵌套 5 层）。
+ * 备用库只用于读取：HasLoose、InAnyPack、ListLoose、Packs 只涉及本地对象。
+ */
+class ObjectStore {
+public:
+  explicit ObjectStore(std::filesystem::path git_dir = ".git");
+  ~ObjectStore();
+  ObjectStore(const ObjectStore &) = delete;
+  ObjectStore &operator=(const ObjectStore &) = delete;
+
+  // 只有对象目录、不属于任何仓库的库（例如写入事务的隔离目录）
+  static std::unique_ptr<ObjectStore>
+  ForObjectsDir(std::filesystem::path objects_dir);
+
+  /**
+   * @brief 读取完整对象
+   * @param hash 40字符十六进制哈希
+   * @return 对象不存在时返回 std::nullopt
+   * @throws std::runtime_error 对象存在但已损坏
+   */
+  std::optional<GitObject> Read(const std::string &hash) const;
+
+  /**
+   * @brief 只读取对象类型和长度，不解压完整内容
+   * @return 对象不存在时返回 std::nullopt
+   */
+  std::optional<std::pair<ObjectType, size_t>>
+  ReadHeader(const std::string &hash) const;
+
+  // 本地或任一备用库中是否有该对象
+  bool Contains(const std::string &hash) const;
+  bool HasLoose(const std::string &hash) const;
+  bool InAnyPack(const std::string &hash) const;
+
+  // 列出所有松散对象的哈希
+  std::vector<std::string> ListLoose() const;
+
+  std::filesystem::path LoosePath(const std::string &hash) const;
+  std::filesystem::path PackDir() const { return objects_dir_ / "pack"; }
+  const std::filesystem::path &ObjectsDir() const { return objects_dir_; }
+  const std::filesystem::path &GitDir() const { return git_dir_; }
+
+  // 从 alternates 加载的备用库（按文件中的顺序）
+  const std::vector<std::unique_ptr<ObjectStore>> &Alternates() const {
+    return alternates_;
+  }
+
+  // 已加载的 pack（按文件名排序）
+  const std::vector<std::unique_ptr<pack::PackFile>> &Packs() const {
+    return packs_;
+  }
+
+  // 重新扫描 pack 目录（repack 写入或删除 pack 之后调用）
+  void ReloadPacks();
+
+private:
+  // 备用库：只有对象目录，没有 git_dir
+  ObjectStore(std::filesystem::path objects_dir, int depth);
+  void LoadAlternates(int depth);
+  std::optional<GitObject> ReadLoose(const std::string &hash) const;
+
+  std::filesystem::path git_dir_;
+  std::filesystem::path objects_dir_;
+  std::vector<std::unique_ptr<pack::PackFile>> packs_;
+  std::vector<std::unique_ptr<ObjectStore>> alternates_;
+};
@@ -0,0 +1,1099 @@
+#include "pack.h"
+#include "byte_util.h"
+#include "delta.h"
+#include "trace.h"
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <exception>
+#include <thread>
+#include <fcntl.h>
+#include <memory>
+#include <numeric>
+#include <openssl/evp.h>
+#include <stdexcept>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+namespace fs = std::filesystem;
+using byte_util::BinaryToHex;
+using byte_util::GetBE32;
+using byte_util::HexToBinary;
+using byte_util::PutBE32;
+
+namespace pack {
+namespace {
+
+constexpr unsigned char kIdxMagic[4] = {0xFF, 't', 'O', 'c'};
+constexpr size_t kIdxHeaderSize = 8 + 256 * 4;
+constexpr size_t kPackHeaderSize = 12;
+constexpr size_t kWriteBufferSize = 1 << 20;
+// 原样复制时，达到这个大小的数据块才使用 copy_file_range
+constexpr size_t kCopyRangeMin = 64 << 10;
+
+// 以只读方式映射整个文件
+const unsigned char *MapFile(const fs::path &path, size_t &size) {
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    throw std::runtime_error("pack: cannot open " + path.string());
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size == 0) {
+    close(fd);
+    throw std::runtime_error("pack: cannot stat " + path.string());
+  }
+  size = st.st_size;
+  void *data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    throw std::runtime_error("pack: cannot mmap " + path.string());
+  }
+  return static_cast<const unsigned char *>(data);
+}
+
+// pack 对象头：1TTTSSSS 之后每字节7位长度
+void PutObjectHeader(std::string &out, int type, size_t size) {
+  unsigned char byte = static_cast<unsigned char>((type << 4) | (size & 0x0F));
+  size >>= 4;
+  while (size) {
+    out.push_back(static_cast<char>(byte | 0x80));
+    byte = size & 0x7F;
+    size >>= 7;
+  }
+  out.push_back(static_cast<char>(byte));
+}
+
+// OFS_DELTA 的负偏移：大端，除最后一字节外每字节最高位为1，且每多一字节先减1
+void PutOfsDeltaOffset(std::string &out, uint64_t offset) {
+  unsigned char buf[16];
+  size_t pos = sizeof(buf) - 1;
+  buf[pos] = offset & 0x7F;
+  while (offset >>= 7) {
+    buf[--pos] = 0x80 | (--offset & 0x7F);
+  }
+  out.append(reinterpret_cast<const char *>(buf + pos), sizeof(buf) - pos);
+}
+
+/**
+ * @brief 带 SHA-1 和缓冲的顺序写入器
+ */
+class HashingWriter {
+public:
+  explicit HashingWriter(int fd) : fd_(fd) {
+    if (!ctx_ || EVP_DigestInit_ex(ctx_.get(), EVP_sha1(), nullptr) != 1) {
+      throw std::runtime_error("pack: cannot initialize SHA-1");
+    }
+    buffer_.reserve(kWriteBufferSize);
+  }
+
+  void Write(const std::string &data) {
+    EVP_DigestUpdate(ctx_.get(), data.data(), data.size());
+    offset_ += data.size();
+    buffer_ += data;
+    if (buffer_.size() >= kWriteBufferSize) {
+      Flush();
+    }
+  }
+
+  /**
+   * @brief 写入从已有 pack 原样复制的字节
+   *
+   * SHA-1 直接在 mmap 的源数据上增量计算；较大的数据块用 copy_file_range
+   * 在内核中复制，不经过用户态缓冲区。src_fd 为 -1 或内核不支持时退回普通
+   * 写入。
+   */
+  void Copy(const unsigned char *data, size_t size, int src_fd,
+            uint64_t src_offset) {
+    EVP_DigestUpdate(ctx_.get(), data, size);
+    offset_ += size;
+    if (src_fd < 0 || size < kCopyRangeMin) {
+      buffer_.append(reinterpret_cast<const char *>(data), size);
+      if (buffer_.size() >= kWriteBufferSize) {
+        Flush();
+      }
+      return;
+    }
+    Flush();
+    loff_t in = src_offset;
+    size_t done = 0;
+    while (done < size) {
+      ssize_t n = copy_file_range(src_fd, &in, fd_, nullptr, size - done, 0);
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+      if (n <= 0) {
+        // EXDEV、ENOSYS 等：源和目标不在同一文件系统或内核太旧
+        buffer_.append(reinterpret_cast<const char *>(data) + done,
+                       size - done);
+        Flush();
+        return;
+      }
+      done += n;
+    }
+  }
+
+  // 写出 SHA-1 并返回其二进制值
+  std::string Finish() {
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    EVP_DigestFinal_ex(ctx_.get(), digest, nullptr);
+    std::string checksum(reinterpret_cast<char *>(digest), 20);
+    buffer_ += checksum;
+    offset_ += checksum.size();
+    Flush();
+    return checksum;
+  }
+
+  uint64_t Offset() const { return offset_; }
+
+private:
+  void Flush() {
+    size_t done = 0;
+    while (done < buffer_.size()) {
+      ssize_t n = write(fd_, buffer_.data() + done, buffer_.size() - done);
+      if (n < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        throw std::runtime_error(std::string("pack: write failed: ") +
+                                 strerror(errno));
+      }
+      done += n;
+    }
+    buffer_.clear();
+  }
+
+  int fd_;
+  std::unique_ptr<EVP_MD_CTX, decltype(&EVP_MD_CTX_free)> ctx_{
+      EVP_MD_CTX_new(), EVP_MD_CTX_free};
+  std::string buffer_;
+  uint64_t offset_ = 0;
+};
+
+// 在 dir 中创建临时文件，返回文件描述符和路径
+int CreateTempFile(const fs::path &dir, const char *prefix, fs::path &path) {
+  std::string pattern = (dir / prefix).string() + "XXXXXX";
+  int fd = mkstemp(pattern.data());
+  if (fd < 0) {
+    throw std::runtime_error("pack: cannot create temporary file in " +
+                             dir.string());
+  }
+  path = pattern;
+  return fd;
+}
+
+struct IdxEntry {
+  std::string binary_hash;
+  uint64_t offset;
+  uint32_t crc32;
+};
+
+// 写出 .idx（version 2），entries 会被按哈希排序
+void WriteIdx(const fs::path &path, std::vector<IdxEntry> &entries,
+              const std::string &pack_checksum) {
+  std::sort(entries.begin(), entries.end(),
+            [](const IdxEntry &a, const IdxEntry &b) {
+              return a.binary_hash < b.binary_hash;
+            });
+  std::string out(reinterpret_cast<const char *>(kIdxMagic), 4);
+  PutBE32(out, 2);
+  uint32_t fanout[256] = {0};
+  for (const auto &entry : entries) {
+    fanout[static_cast<unsigned char>(entry.binary_hash[0])]++;
+  }
+  uint32_t total = 0;
+  for (uint32_t count : fanout) {
+    total += count;
+    PutBE32(out, total);
+  }
+  for (const auto &entry : entries) {
+    out += entry.binary_hash;
+  }
+  for (const auto &entry : entries) {
+    PutBE32(out, entry.crc32);
+  }
+  std::string large_offsets;
+  uint32_t large_count = 0;
+  for (const auto &entry : entries) {
+    if (entry.offset < 0x80000000u) {
+      PutBE32(out, static_cast<uint32_t>(entry.offset));
+    } else {
+      PutBE32(out, 0x80000000u | large_count++);
+      PutBE32(large_offsets, entry.offset >> 32);
+      PutBE32(large_offsets, entry.offset & 0xFFFFFFFFu);
+    }
+  }
+  out += large_offsets;
+  out += pack_checksum;
+
+  int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+  if (fd < 0) {
+    throw std::runtime_error("pack: cannot create " + path.string());
+  }
+  HashingWriter writer(fd);
+  writer.Write(out);
+  writer.Finish();
+  close(fd);
+}
+
+} // namespace
+
+// ---- 读取 ----
+
+PackFile::PackFile(const fs::path &idx_path) : idx_path_(idx_path) {
+  pack_path_ = idx_path;
+  pack_path_.replace_extension(".pack");
+  idx_ = MapFile(idx_path_, idx_size_);
+  try {
+    if (idx_size_ < kIdxHeaderSize + 40 || memcmp(idx_, kIdxMagic, 4) != 0 ||
+        GetBE32(idx_ + 4) != 2) {
+      throw std::runtime_error("pack: unsupported index " + idx_path_.string());
+    }
+    count_ = GetBE32(idx_ + 8 + 255 * 4);
+    if (idx_size_ < kIdxHeaderSize + count_ * 28 + 40) {
+      throw std::runtime_error("pack: truncated index " + idx_path_.string());
+    }
+    pack_ = MapFile(pack_path_, pack_size_);
+    if (pack_size_ < kPackHeaderSize + 20 || memcmp(pack_, "PACK", 4) != 0 ||
+        GetBE32(pack_ + 4) != 2 || GetBE32(pack_ + 8) != count_) {
+      throw std::runtime_error("pack: bad pack header " + pack_path_.string());
+    }
+  } catch (...) {
+    if (pack_) {
+      munmap(const_cast<unsigned char *>(pack_), pack_size_);
+    }
+    munmap(const_cast<unsigned char *>(idx_), idx_size_);
+    throw;
+  }
+}
+
+PackFile::~PackFile() {
+  munmap(const_cast<unsigned char *>(pack_), pack_size_);
+  munmap(const_cast<unsigned char *>(idx_), idx_size_);
+}
+
+std::string PackFile::HashAt(size_t i) const {
+  return BinaryToHex(idx_ + kIdxHeaderSize + i * 20);
+}
+
+uint32_t PackFile::Crc32At(size_t i) const {
+  return GetBE32(idx_ + kIdxHeaderSize + count_ * 20 + i * 4);
+}
+
+uint64_t PackFile::OffsetAt(size_t i) const {
+  const unsigned char *offsets = idx_ + kIdxHeaderSize + count_ * 24;
+  uint32_t offset = GetBE32(offsets + i * 4);
+  if (!(offset & 0x80000000u)) {
+    return offset;
+  }
+  const unsigned char *large = offsets + count_ * 4 + (offset & 0x7FFFFFFFu) * 8;
+  if (large + 8 > idx_ + idx_size_ - 40) {
+    throw std::runtime_error("pack: corrupt large offset in " +
+                             idx_path_.string());
+  }
+  return (uint64_t(GetBE32(large)) << 32) | GetBE32(large + 4);
+}
+
+std::optional<uint64_t> PackFile::Find(const std::string &hash) const {
+  auto index = FindIndex(hash);
+  if (!index) {
+    return std::nullopt;
+  }
+  return OffsetAt(*index);
+}
+
+std::optional<size_t> PackFile::FindIndex(const std::string &hash) const {
+  unsigned char binary[20];
+  if (!HexToBinary(hash, binary)) {
+    return std::nullopt;
+  }
+  unsigned char first = binary[0];
+  size_t lo = first ? GetBE32(idx_ + 8 + (first - 1) * 4) : 0;
+  size_t hi = GetBE32(idx_ + 8 + first * 4);
+  const unsigned char *hashes = idx_ + kIdxHeaderSize;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    int cmp = memcmp(hashes + mid * 20, binary, 20);
+    if (cmp == 0) {
+      return mid;
+    }
+    if (cmp < 0) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return std::nullopt;
+}
+
+std::string PackFile::Checksum() const {
+  return BinaryToHex(pack_ + pack_size_ - 20);
+}
+
+PackFile::EntryHeader PackFile::ParseHeader(uint64_t offset) const {
+  const size_t end = pack_size_ - 20;
+  if (offset < kPackHeaderSize || offset >= end) {
+    throw std::runtime_error("pack: object offset out of range");
+  }
+  EntryHeader header;
+  size_t pos = offset;
+  unsigned char byte = pack_[pos++];
+  header.type = (byte >> 4) & 0x07;
+  header.size = byte & 0x0F;
+  int shift = 4;
+  while (byte & 0x80) {
+    if (pos >= end || shift > 57) {
+      throw std::runtime_error("pack: corrupt object header");
+    }
+    byte = pack_[pos++];
+    header.size |= static_cast<size_t>(byte & 0x7F) << shift;
+    shift += 7;
+  }
+  if (header.type == kOfsDelta) {
+    if (pos >= end) {
+      throw std::runtime_error("pack: truncated delta offset");
+    }
+    byte = pack_[pos++];
+    uint64_t distance = byte & 0x7F;
+    while (byte & 0x80) {
+      if (pos >= end || distance >> 56) {
+        throw std::runtime_error("pack: corrupt delta offset");
+      }
+      byte = pack_[pos++];
+      distance = ((distance + 1) << 7) | (byte & 0x7F);
+    }
+    if (distance == 0 || distance > offset) {
+      throw std::runtime_error("pack: delta base offset out of range");
+    }
+    header.base = offset - distance;
+  } else if (header.type == kRefDelta) {
+    if (pos + 20 > end) {
+      throw std::runtime_error("pack: truncated delta base id");
+    }
+    header.base_ref = BinaryToHex(pack_ + pos);
+    pos += 20;
+  } else if (header.type < 1 || header.type > 4) {
+    throw std::runtime_error("pack: unknown object type " +
+                             std::to_string(header.type));
+  }
+  header.data = pos;
+  return header;
+}
+
+PackFile::RawEntry PackFile::RawAt(size_t i) const {
+  std::call_once(sorted_offsets_once_, [this] {
+    sorted_offsets_.reserve(count_);
+    for (size_t j = 0; j < count_; j++) {
+      sorted_offsets_.push_back(OffsetAt(j));
+    }
+    std::sort(sorted_offsets_.begin(), sorted_offsets_.end());
+  });
+  RawEntry raw;
+  raw.offset = OffsetAt(i);
+  EntryHeader header = ParseHeader(raw.offset);
+  raw.type = header.type;
+  raw.size = header.size;
+  raw.data = header.data;
+  raw.base = header.base;
+  raw.base_ref = std::move(header.base_ref);
+  auto next = std::upper_bound(sorted_offsets_.begin(), sorted_offsets_.end(),
+                               raw.offset);
+  raw.end = next == sorted_offsets_.end() ? pack_size_ - 20 : *next;
+  if (raw.end <= raw.data) {
+    throw std::runtime_error("pack: corrupt object at offset " +
+                             std::to_string(raw.offset));
+  }
+  // 原样复制前先校验，避免把损坏的数据传播到新 pack
+  raw.crc32 = crc32(0, pack_ + raw.offset, raw.end - raw.offset);
+  if (raw.crc32 != Crc32At(i)) {
+    throw std::runtime_error("pack: CRC mismatch for object " + HashAt(i) +
+                             " in " + pack_path_.string());
+  }
+  return raw;
+}
+
+// 解压 offset 处的 zlib 数据；解压后的长度必须正好为 size
+std::string PackFile::Inflate(size_t offset, size_t size) const {
+  std::string out(size, '\0');
+  z_stream stream;
+  memset(&stream, 0, sizeof(stream));
+  if (inflateInit(&stream) != Z_OK) {
+    throw std::runtime_error("pack: inflateInit failed");
+  }
+  stream.next_in = const_cast<Bytef *>(pack_ + offset);
+  stream.avail_in = pack_size_ - 20 - offset;
+  stream.next_out = reinterpret_cast<Bytef *>(out.data());
+  stream.avail_out = size;
+  // 预留1字节，用于发现实际数据比头部声明的更长
+  char overflow;
+  int status = inflate(&stream, Z_FINISH);
+  if (status == Z_BUF_ERROR && stream.avail_out == 0) {
+    stream.next_out = reinterpret_cast<Bytef *>(&overflow);
+    stream.avail_out = 1;
+    status = inflate(&stream, Z_FINISH);
+  }
+  size_t produced = stream.total_out;
+  inflateEnd(&stream);
+  if (status != Z_STREAM_END || produced != size) {
+    throw std::runtime_error("pack: corrupt zlib data at offset " +
+                             std::to_string(offset));
+  }
+  TRACE_COUNT("pack_inflated_bytes", size);
+  return out;
+}
+
+GitObject PackFile::ResolveRef(const std::string &hash,
+                               const BaseResolver &resolve) const {
+  if (auto offset = Find(hash)) {
+    return ReadBase(*offset, resolve);
+  }
+  if (resolve) {
+    if (auto object = resolve(hash)) {
+      return std::move(*object);
+    }
+  }
+  throw std::runtime_error("pack: missing delta base " + hash);
+}
+
+GitObject PackFile::ReadBase(uint64_t offset,
+                             const BaseResolver &resolve) const {
+  {
+    std::lock_guard<std::mutex> lock(cache_mutex_);
+    auto it = cache_.find(offset);
+    if (it != cache_.end()) {
+      cache_lru_.splice(cache_lru_.begin(), cache_lru_, it->second);
+      TRACE_COUNT("pack_base_cache_hits", 1);
+      return it->second->second;
+    }
+  }
+  GitObject object = ReadAt(offset, resolve);
+  std::lock_guard<std::mutex> lock(cache_mutex_);
+  if (object.data.size() <= kBaseCacheLimit / 4 && !cache_.count(offset)) {
+    cache_lru_.emplace_front(offset, object);
+    cache_[offset] = cache_lru_.begin();
+    cache_bytes_ += object.data.size();
+    while (cache_bytes_ > kBaseCacheLimit) {
+      cache_bytes_ -= cache_lru_.back().second.data.size();
+      cache_.erase(cache_lru_.back().first);
+      cache_lru_.pop_back();
+    }
+  }
+  return object;
+}
+
+GitObject PackFile::ReadAt(uint64_t offset, const BaseResolver &resolve) const {
+  EntryHeader header = ParseHeader(offset);
+  if (header.type != kOfsDelta && header.type != kRefDelta) {
+    return {static_cast<ObjectType>(header.type),
+            Inflate(header.data, header.size)};
+  }
+  GitObject base = header.type == kOfsDelta
+                       ? ReadBase(header.base, resolve)
+                       : ResolveRef(header.base_ref, resolve);
+  std::string delta = Inflate(header.data, header.size);
+  GitObject object{base.type, {}};
+  apply_delta_to(delta, base.data, object.data);
+  return object;
+}
+
+std::pair<ObjectType, size_t>
+PackFile::InfoAt(uint64_t offset, const BaseResolver &resolve) const {
+  EntryHeader header = ParseHeader(offset);
+  if (header.type != kOfsDelta && header.type != kRefDelta) {
+    return {static_cast<ObjectType>(header.type), header.size};
+  }
+  // 目标长度在 delta 头部，只需解压开头的几十个字节
+  unsigned char buf[32];
+  z_stream stream;
+  memset(&stream, 0, sizeof(stream));
+  if (inflateInit(&stream) != Z_OK) {
+    throw std::runtime_error("pack: inflateInit failed");
+  }
+  stream.next_in = const_cast<Bytef *>(pack_ + header.data);
+  stream.avail_in = pack_size_ - 20 - header.data;
+  stream.next_out = buf;
+  stream.avail_out = sizeof(buf);
+  int status = inflate(&stream, Z_SYNC_FLUSH);
+  size_t produced = stream.total_out;
+  inflateEnd(&stream);
+  if (status != Z_OK && status != Z_STREAM_END && status != Z_BUF_ERROR) {
+    throw std::runtime_error("pack: corrupt delta at offset " +
+                             std::to_string(offset));
+  }
+  DeltaHeader delta =
+      parse_delta_header(reinterpret_cast<const char *>(buf), produced);
+
+  ObjectType type;
+  if (header.type == kOfsDelta) {
+    type = InfoAt(header.base, resolve).first;
+  } else if (auto base = Find(header.base_ref)) {
+    type = InfoAt(*base, resolve).first;
+  } else {
+    type = ResolveRef(header.base_ref, resolve).type;
+  }
+  return {type, delta.target_size};
+}
+
+// ---- 写入 ----
+
+uint32_t NameHash(const std::string &path) {
+  uint32_t hash = 0;
+  for (unsigned char c : path) {
+    if (isspace(c)) {
+      continue;
+    }
+    hash = (hash >> 2) + (static_cast<uint32_t>(c) << 24);
+  }
+  return hash;
+}
+
+namespace {
+
+// 滑动窗口中的一个候选基础对象
+struct WindowSlot {
+  size_t entry;
+  std::string data;                  // 复用的对象第一次作为基础对象时才读取
+  std::unique_ptr<DeltaIndex> index; // 第一次作为基础对象时才建立
+
+  size_t Memory() const {
+    return data.size() + (index ? index->MemoryUsage() : 0);
+  }
+};
+
+// 一个对象的 delta 搜索结果
+struct DeltaChoice {
+  ptrdiff_t base = -1;    // 基础对象在排序后列表中的下标，-1 表示存完整对象
+  int depth = 0;          // 在 delta 链中的深度
+  size_t delta_size = 0;  // 解压后的 delta 长度
+  std::string compressed; // 已压缩的 delta
+  const PackFile *reuse = nullptr; // 非空时从该 pack 原样复制 raw
+  PackFile::RawEntry raw;
+};
+
+/**
+ * @brief 复用同一个 zlib 上下文的压缩器
+ *
+ * 每个线程持有一个，逐个对象 deflateReset 而不是反复 deflateInit/deflateEnd。
+ */
+class Deflater {
+public:
+  Deflater() {
+    memset(&stream_, 0, sizeof(stream_));
+    if (deflateInit(&stream_, Z_DEFAULT_COMPRESSION) != Z_OK) {
+      throw std::runtime_error("pack: deflateInit failed");
+    }
+  }
+  ~Deflater() { deflateEnd(&stream_); }
+  Deflater(const Deflater &) = delete;
+  Deflater &operator=(const Deflater &) = delete;
+
+  std::string Compress(const std::string &data) {
+    deflateReset(&stream_);
+    std::string out(deflateBound(&stream_, data.size()), '\0');
+    stream_.next_in =
+        reinterpret_cast<Bytef *>(const_cast<char *>(data.data()));
+    stream_.avail_in = data.size();
+    stream_.next_out = reinterpret_cast<Bytef *>(out.data());
+    stream_.avail_out = out.size();
+    if (deflate(&stream_, Z_FINISH) != Z_STREAM_END) {
+      throw std::runtime_error("pack: deflate failed");
+    }
+    out.resize(stream_.total_out);
+    return out;
+  }
+
+private:
+  z_stream stream_;
+};
+
+/**
+ * @brief 在排序后列表的 [begin, end) 段上运行滑动窗口 delta 搜索
+ *
+ * 每个对象与窗口内同类型的候选对象生成 delta，取最小且不超过原长度一半的
+ * 结果，压缩后存入 choices[i]。窗口内对象数不超过 window；所有线程的窗口
+ * 中对象和索引占用的内存合计记在 memory_in_use 中，超过 window_memory 时
+ * 从本窗口最旧的候选开始丢弃（至少保留一个候选）。
+ */
+void SearchDeltas(const std::vector<PackInput> &objects, size_t begin,
+                  size_t end, const ObjectLoader &load,
+                  const PackWriteOptions &options,
+                  std::vector<DeltaChoice> &choices, Deflater &deflater,
+                  std::atomic<size_t> &memory_in_use) {
+  std::deque<WindowSlot> window;
+  size_t window_memory = 0; // 本窗口占用的部分，结束时从 memory_in_use 减去
+  struct Release {
+    std::atomic<size_t> &in_use;
+    size_t &bytes;
+    ~Release() { in_use -= bytes; }
+  } release{memory_in_use, window_memory};
+  auto charge = [&](size_t bytes) {
+    window_memory += bytes;
+    memory_in_use += bytes;
+  };
+  auto shrink_window = [&]() {
+    while (window.size() > static_cast<size_t>(options.window) ||
+           (options.window_memory && memory_in_use > options.window_memory &&
+            window.size() > 1)) {
+      size_t bytes = window.front().Memory();
+      window_memory -= bytes;
+      memory_in_use -= bytes;
+      window.pop_front();
+    }
+  };
+  for (size_t i = begin; i < end; i++) {
+    if (choices[i].reuse) {
+      // 原样复用的对象不再搜索 delta；完整对象仍可作为后面对象的基础，
+      // 但只有真正被比较时才读取内容
+      if (options.window > 0 && choices[i].depth < options.depth) {
+        window.push_back({i, std::string(), nullptr});
+        shrink_window();
+      }
+      continue;
+    }
+    GitObject object = load(objects[i].hash);
+    if (object.type != objects[i].type) {
+      throw std::runtime_error("pack: object " + objects[i].hash +
+                               " changed type");
+    }
+    const std::string &data = object.data;
+
+    std::string best_delta;
+    const WindowSlot *best_base = nullptr;
+    {
+      TRACE_PHASE("delta_search");
+      for (auto it = window.rbegin(); it != window.rend(); ++it) {
+        WindowSlot &slot = *it;
+        if (objects[slot.entry].type != object.type ||
+            choices[slot.entry].depth >= options.depth) {
+          continue;
+        }
+        // delta 至少要比原对象省一半，否则不值得
+        size_t max_size = best_base ? best_delta.size() - 1
+                                    : (data.size() > 40 ? data.size() / 2 - 20
+                                                        : 0);
+        size_t base_size = objects[slot.entry].size;
+        if (max_size == 0 || data.size() < base_size / 32) {
+          continue;
+        }
+        size_t diff = base_size > data.size() ? base_size - data.size()
+                                              : data.size() - base_size;
+        if (diff >= max_size) {
+          continue;
+        }
+        if (choices[slot.entry].reuse && slot.data.empty() && base_size) {
+          slot.data = load(objects[slot.entry].hash).data;
+          charge(slot.data.size());
+        }
+        if (!slot.index) {
+          slot.index = std::make_unique<DeltaIndex>(slot.data);
+          charge(slot.index->MemoryUsage());
+        }
+        std::string delta = slot.index->CreateDelta(data, max_size);
+        if (!delta.empty()) {
+          best_delta = std::move(delta);
+          best_base = &slot;
+        }
+      }
+    }
+    if (best_base) {
+      DeltaChoice &choice = choices[i];
+      choice.base = best_base->entry;
+      choice.depth = choices[best_base->entry].depth + 1;
+      choice.delta_size = best_delta.size();
+      choice.compressed = deflater.Compress(best_delta);
+    }
+
+    if (options.window > 0) {
+      charge(data.size());
+      window.push_back({i, std::move(object.data), nullptr});
+      shrink_window();
+    }
+  }
+}
+
+/**
+ * @brief 把排序后的列表切成若干段，供线程池逐段领取
+ *
+ * 段的数量是线程数的几倍，先做完的线程可以继续领取剩下的段；
+ * 段边界不会拆开同类型、同路径名哈希的一组对象。
+ */
+std::vector<std::pair<size_t, size_t>>
+SplitSegments(const std::vector<PackInput> &objects, int threads) {
+  std::vector<std::pair<size_t, size_t>> segments;
+  size_t n = objects.size();
+  if (threads <= 1) {
+    segments.emplace_back(0, n);
+    return segments;
+  }
+  size_t target = std::max<size_t>(n / (threads * 4), 256);
+  size_t begin = 0;
+  while (begin < n) {
+    size_t end = std::min(n, begin + target);
+    while (end < n && objects[end].type == objects[end - 1].type &&
+           objects[end].name_hash == objects[end - 1].name_hash) {
+      end++;
+    }
+    segments.emplace_back(begin, end);
+    begin = end;
+  }
+  return segments;
+}
+
+int ResolveThreads(int requested) {
+  if (requested > 0) {
+    return requested;
+  }
+  unsigned cores = std::thread::hardware_concurrency();
+  return cores ? static_cast<int>(cores) : 1;
+}
+
+} // namespace
+
+namespace {
+
+// 去重后按 (类型, 路径名哈希, 长度降序) 排序，相似的对象相邻
+void SortForDelta(std::vector<PackInput> &objects) {
+  std::sort(objects.begin(), objects.end(),
+            [](const PackInput &a, const PackInput &b) { return a.hash < b.hash; });
+  objects.erase(std::unique(objects.begin(), objects.end(),
+                            [](const PackInput &a, const PackInput &b) {
+                              return a.hash == b.hash;
+                            }),
+                objects.end());
+  std::stable_sort(objects.begin(), objects.end(),
+                   [](const PackInput &a, const PackInput &b) {
+                     if (a.type != b.type) {
+                       return a.type < b.type;
+                     }
+                     if (a.name_hash != b.name_hash) {
+                       return a.name_hash < b.name_hash;
+                     }
+                     return a.size > b.size;
+                   });
+}
+
+/**
+ * @brief 找出可以从 options.reuse 中原样复制的对象
+ *
+ * 每个对象取第一个包含它的 pack。delta 对象只有在基础对象也在本次输出中、
+ * 并且同样从这个 pack 复制时才复用（同一个 pack 内的 delta 关系不会成环）；
+ * 否则按普通对象重新处理。复用的 delta 深度记为 depth 上限，不再被用作新
+ * delta 的基础对象，因为它在原 pack 中的链长未知。
+ */
+std::vector<DeltaChoice> PlanReuse(const std::vector<PackInput> &objects,
+                                   const PackWriteOptions &options) {
+  std::vector<DeltaChoice> choices(objects.size());
+  if (options.reuse.empty()) {
+    return choices;
+  }
+  TRACE_SPAN("plan-reuse");
+  std::unordered_map<std::string, size_t> by_hash;
+  std::unordered_map<const PackFile *, std::unordered_map<uint64_t, size_t>>
+      by_offset;
+  for (size_t i = 0; i < objects.size(); i++) {
+    by_hash.emplace(objects[i].hash, i);
+    for (const PackFile *packfile : options.reuse) {
+      auto index = packfile->FindIndex(objects[i].hash);
+      if (!index) {
+        continue;
+      }
+      DeltaChoice &choice = choices[i];
+      choice.reuse = packfile;
+      choice.raw = packfile->RawAt(*index);
+      if (choice.raw.type < kOfsDelta &&
+          choice.raw.type != static_cast<int>(objects[i].type)) {
+        throw std::runtime_error("pack: object " + objects[i].hash +
+                                 " has a different type in " +
+                                 packfile->PackPath().string());
+      }
+      by_offset[packfile].emplace(choice.raw.offset, i);
+      break;
+    }
+  }
+  for (size_t i = 0; i < objects.size(); i++) {
+    DeltaChoice &choice = choices[i];
+    if (!choice.reuse || choice.raw.type < kOfsDelta) {
+      continue;
+    }
+    ptrdiff_t base = -1;
+    if (choice.raw.type == kOfsDelta) {
+      const auto &offsets = by_offset[choice.reuse];
+      auto it = offsets.find(choice.raw.base);
+      if (it != offsets.end()) {
+        base = it->second;
+      }
+    } else {
+      auto it = by_hash.find(choice.raw.base_ref);
+      if (it != by_hash.end() && choices[it->second].reuse == choice.reuse) {
+        base = it->second;
+      }
+    }
+    if (base < 0) {
+      choice.reuse = nullptr;
+      continue;
+    }
+    choice.base = base;
+    choice.depth = options.depth;
+    choice.delta_size = choice.raw.size;
+  }
+  return choices;
+}
+
+// 第一阶段：多线程 delta 搜索，结果按排序后的下标存放
+void ChooseDeltas(const std::vector<PackInput> &objects,
+                  const ObjectLoader &load, const PackWriteOptions &options,
+                  std::vector<DeltaChoice> &choices) {
+  TRACE_SPAN("delta-search");
+  auto segments = SplitSegments(objects, ResolveThreads(options.threads));
+  int threads = std::min<int>(ResolveThreads(options.threads),
+                              segments.size());
+  TRACE_COUNT("pack_threads", threads);
+  std::atomic<size_t> next_segment{0};
+  std::atomic<size_t> memory_in_use{0}; // 所有线程的窗口共用 window_memory
+  std::atomic<bool> failed{false};
+  std::exception_ptr error;
+  std::mutex error_mutex;
+  auto worker = [&]() {
+    Deflater deflater;
+    while (!failed) {
+      size_t index = next_segment.fetch_add(1);
+      if (index >= segments.size()) {
+        return;
+      }
+      try {
+        SearchDeltas(objects, segments[index].first, segments[index].second,
+                     load, options, choices, deflater, memory_in_use);
+      } catch (...) {
+        std::lock_guard<std::mutex> lock(error_mutex);
+        if (!error) {
+          error = std::current_exception();
+        }
+        failed = true;
+      }
+    }
+  };
+  if (threads <= 1) {
+    worker();
+  } else {
+    std::vector<std::thread> pool;
+    for (int i = 0; i < threads; i++) {
+      pool.emplace_back(worker);
+    }
+    for (auto &thread : pool) {
+      thread.join();
+    }
+  }
+  if (error) {
+    std::rethrow_exception(error);
+  }
+}
+
+/**
+ * @brief 写出顺序：基本按排序顺序，但基础对象必须在 delta 之前
+ *
+ * 新生成的 delta 的基础对象总在前面；复用的 delta 来自原 pack 的顺序，
+ * 基础对象可能排在后面，此时先写基础对象。
+ */
+std::vector<size_t> WriteOrder(const std::vector<DeltaChoice> &choices) {
+  std::vector<size_t> order;
+  order.reserve(choices.size());
+  std::vector<bool> placed(choices.size(), false);
+  std::vector<size_t> chain;
+  for (size_t i = 0; i < choices.size(); i++) {
+    chain.clear();
+    for (size_t k = i; !placed[k];) {
+      placed[k] = true;
+      chain.push_back(k);
+      if (choices[k].base < 0) {
+        break;
+      }
+      k = choices[k].base;
+    }
+    order.insert(order.end(), chain.rbegin(), chain.rend());
+  }
+  return order;
+}
+
+/**
+ * @brief 第二阶段：按排序顺序把对象写入 fd，基础对象总在前面
+ *
+ * options.ofs_delta 为 false 时 delta 以 REF_DELTA（20字节基础对象哈希）
+ * 写出。idx_entries 非空时记录每个对象的偏移和 CRC32。
+ * @return pack 校验和（20字节二进制）
+ */
+std::string WriteEntries(int fd, const std::vector<PackInput> &objects,
+                         std::vector<DeltaChoice> &choices,
+                         const ObjectLoader &load,
+                         const PackWriteOptions &options,
+                         PackWriteResult &result,
+                         std::vector<IdxEntry> *idx_entries) {
+  HashingWriter writer(fd);
+  std::string header("PACK\0\0\0\2", 8);
+  PutBE32(header, objects.size());
+  writer.Write(header);
+
+  // copy_file_range 需要源 pack 的文件描述符，用到时才打开
+  std::unordered_map<const PackFile *, int> source_fds;
+  struct CloseSources {
+    std::unordered_map<const PackFile *, int> &fds;
+    ~CloseSources() {
+      for (const auto &[packfile, source_fd] : fds) {
+        if (source_fd >= 0) {
+          close(source_fd);
+        }
+      }
+    }
+  } close_sources{source_fds};
+  auto source_fd = [&source_fds](const PackFile *packfile) {
+    auto [it, inserted] = source_fds.emplace(packfile, -1);
+    if (inserted) {
+      it->second = open(packfile->PackPath().c_str(), O_RDONLY | O_CLOEXEC);
+    }
+    return it->second;
+  };
+
+  Deflater deflater;
+  std::vector<uint64_t> offsets(objects.size());
+  for (size_t i : WriteOrder(choices)) {
+    std::string entry;
+    offsets[i] = writer.Offset();
+    DeltaChoice &choice = choices[i];
+    uint32_t crc = 0;
+    if (choice.reuse) {
+      // 完整对象连同对象头原样复制；delta 只需改写对象头中的基础对象引用
+      const PackFile::RawEntry &raw = choice.raw;
+      uint64_t copy_from = raw.offset;
+      if (choice.base >= 0) {
+        if (options.ofs_delta) {
+          PutObjectHeader(entry, kOfsDelta, raw.size);
+          PutOfsDeltaOffset(entry, offsets[i] - offsets[choice.base]);
+        } else {
+          PutObjectHeader(entry, kRefDelta, raw.size);
+          HexToBinary(objects[choice.base].hash, entry);
+        }
+        copy_from = raw.data;
+        writer.Write(entry);
+        result.deltas++;
+      }
+      const unsigned char *data = choice.reuse->Data() + copy_from;
+      size_t size = raw.end - copy_from;
+      writer.Copy(data, size, source_fd(choice.reuse), copy_from);
+      if (idx_entries) {
+        crc = choice.base >= 0
+                  ? crc32(crc32(0, reinterpret_cast<const Bytef *>(
+                                       entry.data()),
+                                entry.size()),
+                          data, size)
+                  : raw.crc32;
+      }
+      result.reused++;
+    } else {
+      if (choice.base >= 0) {
+        if (options.ofs_delta) {
+          PutObjectHeader(entry, kOfsDelta, choice.delta_size);
+          PutOfsDeltaOffset(entry, offsets[i] - offsets[choice.base]);
+        } else {
+          PutObjectHeader(entry, kRefDelta, choice.delta_size);
+          HexToBinary(objects[choice.base].hash, entry);
+        }
+        entry += choice.compressed;
+        std::string().swap(choice.compressed);
+        result.deltas++;
+      } else {
+        GitObject object = load(objects[i].hash);
+        PutObjectHeader(entry, static_cast<int>(object.type),
+                        object.data.size());
+        entry += deflater.Compress(object.data);
+      }
+      writer.Write(entry);
+      if (idx_entries) {
+        crc = crc32(0, reinterpret_cast<const Bytef *>(entry.data()),
+                    entry.size());
+      }
+    }
+    if (idx_entries) {
+      std::string binary;
+      HexToBinary(objects[i].hash, binary);
+      idx_entries->push_back({std::move(binary), offsets[i], crc});
+    }
+  }
+  result.objects = objects.size();
+  TRACE_COUNT("pack_reused_objects", result.reused);
+  return writer.Finish();
+}
+
+} // namespace
+
+PackWriteResult WritePack(const fs::path &pack_dir,
+                          std::vector<PackInput> objects,
+                          const ObjectLoader &load,
+                          const PackWriteOptions &options) {
+  TRACE_SPAN("write-pack");
+  fs::create_directories(pack_dir);
+  SortForDelta(objects);
+  std::vector<DeltaChoice> choices = PlanReuse(objects, options);
+  ChooseDeltas(objects, load, options, choices);
+
+  fs::path tmp_pack;
+  int fd = CreateTempFile(pack_dir, "tmp_pack_", tmp_pack);
+  PackWriteResult result;
+  std::vector<IdxEntry> idx_entries;
+  idx_entries.reserve(objects.size());
+  std::string checksum;
+  try {
+    checksum = WriteEntries(fd, objects, choices, load, options, result,
+                            &idx_entries);
+    if (fsync(fd) != 0) {
+      throw std::runtime_error("pack: fsync failed");
+    }
+    close(fd);
+  } catch (...) {
+    close(fd);
+    fs::remove(tmp_pack);
+    throw;
+  }
+
+  result.checksum = BinaryToHex(reinterpret_cast<const unsigned char *>(
+      checksum.data()));
+  result.pack_path = pack_dir / ("pack-" + result.checksum + ".pack");
+  result.idx_path = pack_dir / ("pack-" + result.checksum + ".idx");
+  TRACE_COUNT("pack_written_objects", result.objects);
+  TRACE_COUNT("pack_written_deltas", result.deltas);
+
+  // 先放好 .pack 再放 .idx：读者通过 .idx 发现 pack
+  fs::path tmp_idx;
+  close(CreateTempFile(pack_dir, "tmp_idx_", tmp_idx));
+  try {
+    WriteIdx(tmp_idx, idx_entries, checksum);
+    chmod(tmp_pack.c_str(), 0444);
+    chmod(tmp_idx.c_str(), 0444);
+    fs::rename(tmp_pack, result.pack_path);
+    fs::rename(tmp_idx, result.idx_path);
+  } catch (...) {
+    fs::remove(tmp_pack);
+    fs::remove(tmp_idx);
+    throw;
+  }
+  return result;
+}
+
+PackWriteResult WritePackStream(int fd, std::vector<PackInput> objects,
+                                const ObjectLoader &load,
+                                const PackWriteOptions &options) {
+  TRACE_SPAN("write-pack-stream");
+  SortForDelta(objects);
+  std::vector<DeltaChoice> choices = PlanReuse(objects, options);
+  ChooseDeltas(objects, load, options, choices);
+  PackWriteResult result;
+  std::string checksum =
+      WriteEntries(fd, objects, choices, load, options, result, nullptr);
+  result.checksum = BinaryToHex(reinterpret_cast<const unsigned char *>(
+      checksum.data()));
+  TRACE_COUNT("pack_written_objects", result.objects);
+  TRACE_COUNT("pack_written_deltas", result.deltas);
+  return result;
+}
+
+} // namespace pack
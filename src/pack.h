@@ -0,0 +1,219 @@
+#pragma once
+
+#include "object_store.h"
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * @brief pack 文件（version 2）与 pack 索引（.idx version 2）的读写
+ *
+ * [ .pack ]
+ * +------------------------+---------------------------+-------------+
+ * | "PACK" 版本(4) 对象数(4) | 对象 1..N                  | SHA-1 (20B) |
+ * +------------------------+---------------------------+-------------+
+ *
+ * 每个对象以变长头开始：首字节 1TTTSSSS（类型3位 + 长度低4位），之后每字节
+ * 7位长度，最高位为1表示还有后续字节。随后是 zlib 压缩的数据：
+ * - 类型 1-4：完整对象内容
+ * - 类型 6 (OFS_DELTA)：先是基础对象相对本对象的负偏移（大端变长，每多一字节
+ *   先加1），然后是压缩后的 delta
+ * - 类型 7 (REF_DELTA)：先是20字节基础对象哈希，然后是压缩后的 delta
+ *
+ * [ .idx ]
+ * +--------------+-------------+--------------+----------+-----------+
+ * | "\377tOc" v2 | fanout[256] | 有序哈希 N×20 | CRC32 N×4 | 偏移 N×4  |
+ * +--------------+-------------+--------------+----------+-----------+
+ * | 64位偏移表（偏移最高位为1时使用）| pack 校验和 | idx 校验和      |
+ * +-------------------------------+------------+-----------------+
+ *
+ * fanout[b] 是首字节 <= b 的对象个数，查找时先用首字节缩小范围再二分。
+ */
+namespace pack {
+
+constexpr int kOfsDelta = 6;
+constexpr int kRefDelta = 7;
+
+// 解析 REF_DELTA 基础对象的回调（基础对象不在同一个 pack 中时使用）
+using BaseResolver =
+    std::function<std::optional<GitObject>(const std::string &hash)>;
+
+/**
+ * @brief 只读的 pack + idx，两者都通过 mmap 访问
+ *
+ * 还原 delta 链时，被用作基础对象的结果会放进一个按字节数限制的 LRU 缓存，
+ * 顺序读取同一条链上的多个对象时不必每次都从链头重新解压。
+ */
+class PackFile {
+public:
+  // idx_path 为 .idx 文件路径，对应的 .pack 必须位于同一目录
+  explicit PackFile(const std::filesystem::path &idx_path);
+  ~PackFile();
+  PackFile(const PackFile &) = delete;
+  PackFile &operator=(const PackFile &) = delete;
+
+  size_t Count() const { return count_; }
+  // 第 i 个对象（按哈希排序）的哈希、偏移和 CRC32
+  std::string HashAt(size_t i) const;
+  uint64_t OffsetAt(size_t i) const;
+  uint32_t Crc32At(size_t i) const;
+
+  // 查找对象在 pack 中的偏移
+  std::optional<uint64_t> Find(const std::string &hash) const;
+  // 查找对象在 idx 中的下标（即 HashAt/OffsetAt/Crc32At 的 i）
+  std::optional<size_t> FindIndex(const std::string &hash) const;
+
+  // 一个对象在 pack 中未解压的原始字节，用于原样复制到新 pack
+  struct RawEntry {
+    int type = 0;         // 1-4、kOfsDelta 或 kRefDelta
+    size_t size = 0;      // 解压后的长度，delta 对象为 delta 本身的长度
+    uint64_t offset = 0;  // 对象头起点
+    uint64_t data = 0;    // 压缩数据起点
+    uint64_t end = 0;     // 下一个对象的起点
+    uint64_t base = 0;    // OFS_DELTA 基础对象偏移
+    std::string base_ref; // REF_DELTA 基础对象哈希
+    uint32_t crc32 = 0;   // [offset, end) 的 CRC32
+  };
+
+  /**
+   * @brief 定位第 i 个对象的原始字节，并用 idx 中的 CRC32 校验
+   * @throws std::runtime_error 对象头损坏或 CRC32 不符
+   */
+  RawEntry RawAt(size_t i) const;
+
+  // mmap 的 pack 内容，RawEntry 中的偏移相对于此
+  const unsigned char *Data() const { return pack_; }
+
+  /**
+   * @brief 读取并还原 offset 处的对象
+   * @throws std::runtime_error pack 损坏或 REF_DELTA 基础对象不存在
+   */
+  GitObject ReadAt(uint64_t offset, const BaseResolver &resolve = {}) const;
+
+  // 只读取类型和长度；delta 对象只解压 delta 头部
+  std::pair<ObjectType, size_t>
+  InfoAt(uint64_t offset, const BaseResolver &resolve = {}) const;
+
+  const std::filesystem::path &PackPath() const { return pack_path_; }
+  const std::filesystem::path &IdxPath() const { return idx_path_; }
+  // pack 校验和（40字符十六进制），即文件名中的 <hash>
+  std::string Checksum() const;
+
+private:
+  struct EntryHeader {
+    int type = 0;
+    size_t size = 0;
+    size_t data = 0;      // 压缩数据的起始偏移
+    uint64_t base = 0;    // OFS_DELTA 基础对象偏移
+    std::string base_ref; // REF_DELTA 基础对象哈希
+  };
+  EntryHeader ParseHeader(uint64_t offset) const;
+  std::string Inflate(size_t offset, size_t size) const;
+  GitObject ReadBase(uint64_t offset, const BaseResolver &resolve) const;
+  GitObject ResolveRef(const std::string &hash,
+                       const BaseResolver &resolve) const;
+
+  std::filesystem::path idx_path_;
+  std::filesystem::path pack_path_;
+  const unsigned char *idx_ = nullptr;
+  size_t idx_size_ = 0;
+  const unsigned char *pack_ = nullptr;
+  size_t pack_size_ = 0;
+  size_t count_ = 0;
+
+  // delta 基础对象缓存：偏移 -> 对象，按最近使用排序
+  static constexpr size_t kBaseCacheLimit = 32 << 20;
+  mutable std::mutex cache_mutex_;
+  mutable std::list<std::pair<uint64_t, GitObject>> cache_lru_;
+  mutable std::unordered_map<
+      uint64_t, std::list<std::pair<uint64_t, GitObject>>::iterator>
+      cache_;
+  mutable size_t cache_bytes_ = 0;
+
+  // 按偏移排序的对象起点，第一次调用 RawAt 时建立，用于确定对象的结束位置
+  mutable std::once_flag sorted_offsets_once_;
+  mutable std::vector<uint64_t> sorted_offsets_;
+};
+
+// 待写入 pack 的对象
+struct PackInput {
+  std::string hash;
+  ObjectType type = ObjectType::kBlob;
+  size_t size = 0;
+  uint32_t name_hash = 0; // 见 NameHash()，用于把同名文件排在一起
+};
+
+struct PackWriteOptions {
+  int window = 10;          // 每个对象与前面多少个候选对象尝试 delta
+  int depth = 50;           // delta 链的最大长度
+  int threads = 0;          // delta 搜索线程数，0 表示使用全部 CPU
+  size_t window_memory = 0; // 所有线程窗口内对象合计的内存上限，0 表示不限
+  bool ofs_delta = true;    // false 时 delta 用 REF_DELTA 引用基础对象
+
+  /**
+   * 可以原样复用其中数据的已有 pack。对象在其中之一时直接复制压缩后的
+   * 字节，不解压也不重新搜索 delta；delta 对象的基础对象也在本次输出中、
+   * 并且来自同一个 pack 时，连同 delta 一起复用（改写 OFS_DELTA 偏移）。
+   */
+  std::vector<const PackFile *> reuse;
+};
+
+struct PackWriteResult {
+  std::string checksum; // 40字符十六进制
+  std::filesystem::path pack_path; // WritePackStream 不设置
+  std::filesystem::path idx_path;
+  size_t objects = 0;
+  size_t deltas = 0;
+  size_t reused = 0; // 从 options.reuse 原样复制的对象数
+};
+
+// 读取待写入对象的完整内容
+using ObjectLoader = std::function<GitObject(const std::string &hash)>;
+
+/**
+ * @brief 路径名哈希：最后几个字符权重最大，使同名、同扩展名的文件相邻
+ */
+uint32_t NameHash(const std::string &path);
+
+/**
+ * @brief 选择 delta 基础对象并写出 pack-<checksum>.pack/.idx
+ *
+ * 对象按 (类型, 路径名哈希, 长度降序) 排序后，用大小为 window 的滑动窗口
+ * 寻找基础对象：每个对象与窗口内同类型的候选对象生成 delta（见 DeltaIndex），
+ * 取最小且不超过原长度一半的结果。
+ *
+ * delta 搜索是 repack 的主要开销：排序后的列表被切成多段，由 threads 个
+ * 线程各自维护窗口并行搜索，找到的 delta 在工作线程中压缩后暂存。随后按
+ * 排序顺序写出，基础对象总是排在前面，因此可以使用 OFS_DELTA。
+ *
+ * 先写入临时文件，完成后依次重命名 .pack 和 .idx，读者只会看到完整的 pack。
+ * 见 PackWriteOptions::reuse：已在 pack 中的对象直接复制压缩后的字节，
+ * 大块数据用 copy_file_range 复制，校验和在 mmap 的数据上增量计算。
+ *
+ * @param pack_dir 通常为 .git/objects/pack
+ * @throws std::runtime_error 写入失败
+ */
+PackWriteResult WritePack(const std::filesystem::path &pack_dir,
+                          std::vector<PackInput> objects,
+                          const ObjectLoader &load,
+                          const PackWriteOptions &options = {});
+
+/**
+ * @brief 与 WritePack 相同的 delta 选择，但只把 pack 数据顺序写入 fd
+ *
+ * 不生成 .idx，也不创建文件，用于 upload-pack 把 pack 发给客户端。
+ * 不支持 ofs-delta 的客户端应把 options.ofs_delta 设为 false。
+ *
+ * @throws std::runtime_error 写入失败或对象缺失
+ */
+PackWriteResult WritePackStream(int fd, std::vector<PackInput> objects,
+                                const ObjectLoader &load,
+                                const PackWriteOptions &options = {});
+
+} // namespace pack
@@ -0,0 +1,379 @@
+#include "reflog.h"
+#include "durability.h"
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <fcntl.h>
+#include <fstream>
+#include <stdexcept>
+#include <string.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+const std::string kNullHash(40, '0');
+// 锁被其他进程占用时重试的最长时间
+constexpr std::chrono::milliseconds kLockTimeout(1000);
+
+// 与 commit_tree() 使用相同的默认身份，可通过环境变量覆盖
+std::string ReflogIdentity() {
+  const char *name = getenv("GIT_COMMITTER_NAME");
+  const char *email = getenv("GIT_COMMITTER_EMAIL");
+  return std::string(name ? name : "XXX YYY") + " <" +
+         (email ? email : "xxx.yyy@gmail.com") + ">";
+}
+
+void PutOffset(char *out, uint64_t offset) {
+  for (int i = 7; i >= 0; i--) {
+    out[i] = static_cast<char>(offset & 0xFF);
+    offset >>= 8;
+  }
+}
+
+uint64_t GetOffset(const unsigned char *in) {
+  uint64_t offset = 0;
+  for (int i = 0; i < 8; i++) {
+    offset = (offset << 8) | in[i];
+  }
+  return offset;
+}
+
+// 以 O_APPEND 打开文件，父目录不存在时创建后重试
+int OpenForAppend(const fs::path &path) {
+  int fd = open(path.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+  if (fd < 0 && errno == ENOENT) {
+    fs::create_directories(path.parent_path());
+    fd = open(path.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+  }
+  if (fd < 0) {
+    throw std::runtime_error("Failed to open " + path.string() + ": " +
+                             strerror(errno));
+  }
+  return fd;
+}
+
+void WriteOrThrow(int fd, const char *data, size_t size,
+                  const fs::path &path) {
+  if (!durability::WriteAll(fd, data, size)) {
+    close(fd);
+    throw std::runtime_error("Short write to " + path.string());
+  }
+}
+
+/**
+ * @brief 日志的锁文件 <日志>.lock，与 reftable 的 tables.list.lock 一样以
+ *        O_CREAT|O_EXCL 创建
+ *
+ * 追加、重建索引和 expire 都持有它，同一个引用的日志和索引同时只有一个
+ * 写者。锁被占用时在 kLockTimeout 内重试，超时后报错。
+ */
+class LogLock {
+public:
+  explicit LogLock(const fs::path &log_path)
+      : path_(log_path.string() + ".lock") {
+    auto deadline = std::chrono::steady_clock::now() + kLockTimeout;
+    for (;;) {
+      int fd = open(path_.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC,
+                    0644);
+      if (fd >= 0) {
+        close(fd);
+        return;
+      }
+      int error = errno;
+      if (error == ENOENT) {
+        fs::create_directories(path_.parent_path());
+        continue;
+      }
+      if (error != EEXIST || std::chrono::steady_clock::now() >= deadline) {
+        throw std::runtime_error("Unable to lock " + path_.string() + ": " +
+                                 strerror(error));
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  }
+  ~LogLock() { unlink(path_.c_str()); }
+  LogLock(const LogLock &) = delete;
+  LogLock &operator=(const LogLock &) = delete;
+
+private:
+  fs::path path_;
+};
+
+off_t FileSize(const fs::path &path) {
+  struct stat st;
+  if (stat(path.c_str(), &st) != 0) {
+    return -1;
+  }
+  return st.st_size;
+}
+
+// 读取 [begin, end) 范围内的数据
+std::string ReadRange(int fd, off_t begin, off_t end) {
+  std::string data(end - begin, '\0');
+  ssize_t n = pread(fd, data.data(), data.size(), begin);
+  data.resize(n > 0 ? n : 0);
+  return data;
+}
+
+} // namespace
+
+std::optional<ReflogEntry> ParseReflogLine(const std::string &line) {
+  // <old> <new> <ident> <ts> <tz>\t<msg>
+  size_t tab = line.find('\t');
+  std::string head = line.substr(0, tab);
+  if (head.size() < 82 || head[40] != ' ' || head[81] != ' ') {
+    return std::nullopt;
+  }
+  size_t tz_space = head.rfind(' ');
+  size_t ts_space = head.rfind(' ', tz_space - 1);
+  if (tz_space == std::string::npos || ts_space == std::string::npos ||
+      ts_space < 82) {
+    return std::nullopt;
+  }
+  ReflogEntry entry;
+  entry.old_hash = head.substr(0, 40);
+  entry.new_hash = head.substr(41, 40);
+  entry.identity = head.substr(82, ts_space - 82);
+  entry.timestamp = strtoll(head.c_str() + ts_space + 1, nullptr, 10);
+  entry.timezone = head.substr(tz_space + 1);
+  if (tab != std::string::npos) {
+    entry.message = line.substr(tab + 1);
+  }
+  while (!entry.message.empty() && entry.message.back() == '\n') {
+    entry.message.pop_back();
+  }
+  return entry;
+}
+
+void Reflog::Append(const std::string &ref, const std::string &old_hash,
+                    const std::string &new_hash,
+                    const std::string &message) const {
+  std::string line = (old_hash.empty() ? kNullHash : old_hash) + ' ' +
+                     new_hash + ' ' + ReflogIdentity() + ' ' +
+                     std::to_string(time(nullptr)) + " +0000\t" + message +
+                     '\n';
+
+  fs::path log_path = LogPath(ref);
+  LogLock lock(log_path);
+  // 持有锁时没有其他写者；先让索引覆盖已有的行（例如其他工具写入的），
+  // 追加的索引记录才会与本行对应
+  if (!IndexIsCurrent(ref)) {
+    RebuildIndex(ref);
+  }
+  int log_fd = OpenForAppend(log_path);
+  WriteOrThrow(log_fd, line.data(), line.size(), log_path);
+  // O_APPEND 写入后文件偏移位于本行末尾，据此得到本行的起始位置
+  off_t end = lseek(log_fd, 0, SEEK_CUR);
+  close(log_fd);
+
+  char record[8];
+  PutOffset(record, end - line.size());
+  fs::path index_path = IndexPath(ref);
+  int index_fd = OpenForAppend(index_path);
+  WriteOrThrow(index_fd, record, sizeof(record), index_path);
+  close(index_fd);
+}
+
+bool Reflog::Exists(const std::string &ref) const {
+  return fs::is_regular_file(LogPath(ref));
+}
+
+bool Reflog::IndexIsCurrent(const std::string &ref) const {
+  off_t log_size = FileSize(LogPath(ref));
+  off_t index_size = FileSize(IndexPath(ref));
+  if (log_size <= 0) {
+    return index_size <= 0;
+  }
+  if (index_size <= 0 || index_size % 8 != 0) {
+    return false;
+  }
+  // 最后一条索引应指向日志的最后一行
+  int index_fd = open(IndexPath(ref).c_str(), O_RDONLY | O_CLOEXEC);
+  unsigned char last[8];
+  bool ok = pread(index_fd, last, 8, index_size - 8) == 8;
+  close(index_fd);
+  if (!ok) {
+    return false;
+  }
+  off_t last_offset = GetOffset(last);
+  int log_fd = open(LogPath(ref).c_str(), O_RDONLY | O_CLOEXEC);
+  std::string tail = ReadRange(log_fd, last_offset, log_size);
+  close(log_fd);
+  return !tail.empty() && tail.find('\n') == tail.size() - 1;
+}
+
+void Reflog::RebuildIndex(const std::string &ref) const {
+  // 流式扫描一次日志；临时文件受日志锁保护，引用名不能以 .lock 结尾，
+  // 不会与其他引用的索引冲突
+  std::ifstream log(LogPath(ref), std::ios::binary);
+  fs::path tmp = IndexPath(ref).string() + ".lock";
+  fs::create_directories(tmp.parent_path());
+  std::ofstream index(tmp, std::ios::binary | std::ios::trunc);
+  std::string line;
+  uint64_t offset = 0;
+  char record[8];
+  while (std::getline(log, line)) {
+    PutOffset(record, offset);
+    index.write(record, sizeof(record));
+    offset += line.size() + 1;
+  }
+  index.close();
+  if (!index) {
+    fs::remove(tmp);
+    throw std::runtime_error("Failed to rebuild reflog index for " + ref);
+  }
+  fs::rename(tmp, IndexPath(ref));
+}
+
+void Reflog::EnsureIndex(const std::string &ref) const {
+  if (IndexIsCurrent(ref)) {
+    return;
+  }
+  // 索引缺失或过期（例如日志由其他工具写入）：加锁后再检查一次，避免与
+  // 正在追加或 expire 的进程同时改写索引
+  LogLock lock(LogPath(ref));
+  if (!IndexIsCurrent(ref)) {
+    RebuildIndex(ref);
+  }
+}
+
+size_t Reflog::Count(const std::string &ref) const {
+  EnsureIndex(ref);
+  off_t index_size = FileSize(IndexPath(ref));
+  return index_size > 0 ? index_size / 8 : 0;
+}
+
+std::optional<ReflogEntry> Reflog::Lookup(const std::string &ref,
+                                          size_t n) const {
+  size_t count = Count(ref);
+  if (n >= count) {
+    return std::nullopt;
+  }
+  // 读取目标行及下一行的起始偏移
+  size_t position = count - 1 - n;
+  int index_fd = open(IndexPath(ref).c_str(), O_RDONLY | O_CLOEXEC);
+  unsigned char offsets[16];
+  ssize_t got = pread(index_fd, offsets, n == 0 ? 8 : 16, position * 8);
+  close(index_fd);
+  if (got < 8) {
+    return std::nullopt;
+  }
+  off_t begin = GetOffset(offsets);
+  off_t end = n == 0 ? FileSize(LogPath(ref)) : GetOffset(offsets + 8);
+
+  int log_fd = open(LogPath(ref).c_str(), O_RDONLY | O_CLOEXEC);
+  std::string line = ReadRange(log_fd, begin, end);
+  close(log_fd);
+  return ParseReflogLine(line);
+}
+
+size_t Reflog::Expire(const std::string &ref, time_t cutoff) const {
+  if (!Exists(ref)) {
+    return 0;
+  }
+  fs::path log_path = LogPath(ref);
+  fs::path index_path = IndexPath(ref);
+  LogLock lock(log_path);
+  // 新日志写到以 '.' 开头的临时文件：引用名的路径分量不能以 '.' 开头，
+  // 不会与其他日志冲突，ListRefs 也会跳过它
+  fs::path log_tmp =
+      log_path.parent_path() / ("." + log_path.filename().string() + ".new");
+  fs::path index_tmp = index_path.string() + ".lock";
+  fs::create_directories(index_tmp.parent_path());
+
+  // 逐行读取，保留的行直接写入新日志，同时生成新索引
+  std::ifstream log(log_path, std::ios::binary);
+  std::ofstream new_log(log_tmp, std::ios::binary | std::ios::trunc);
+  std::ofstream new_index(index_tmp, std::ios::binary | std::ios::trunc);
+  if (!new_log || !new_index) {
+    throw std::runtime_error("Failed to rewrite reflog for " + ref);
+  }
+  std::string line;
+  uint64_t offset = 0;
+  size_t removed = 0;
+  char record[8];
+  while (std::getline(log, line)) {
+    auto entry = ParseReflogLine(line);
+    if (!entry || entry->timestamp < cutoff) {
+      removed++;
+      continue;
+    }
+    PutOffset(record, offset);
+    new_index.write(record, sizeof(record));
+    new_log << line << '\n';
+    offset += line.size() + 1;
+  }
+  new_log.close();
+  new_index.close();
+  if (!new_log || !new_index) {
+    fs::remove(log_tmp);
+    fs::remove(index_tmp);
+    throw std::runtime_error("Failed to rewrite reflog for " + ref);
+  }
+  // 先删除旧索引再替换日志：在两次改名之间崩溃时只会缺少索引，下次读取
+  // 时重建，不会留下与日志不一致的索引
+  fs::remove(index_path);
+  fs::rename(log_tmp, log_path);
+  fs::rename(index_tmp, index_path);
+  return removed;
+}
+
+std::vector<std::string> Reflog::ListRefs() const {
+  std::vector<std::string> refs;
+  fs::path logs = git_dir_ / "logs";
+  if (!fs::exists(logs)) {
+    return refs;
+  }
+  for (auto it = fs::recursive_directory_iterator(logs);
+       it != fs::recursive_directory_iterator(); ++it) {
+    std::string name = it->path().filename().string();
+    if (name.starts_with(".") || name.ends_with(".lock")) {
+      continue; // expire 的临时文件和锁文件
+    }
+    if (it->is_regular_file()) {
+      refs.push_back(fs::relative(it->path(), logs).generic_string());
+    }
+  }
+  return refs;
+}
+
+std::optional<std::pair<std::string, size_t>>
+ParseReflogSpec(const std::string &spec) {
+  size_t at = spec.find("@{");
+  if (at == std::string::npos || spec.back() != '}') {
+    return std::nullopt;
+  }
+  std::string number = spec.substr(at + 2, spec.size() - at - 3);
+  // 位数有上限，std::stoul 不会越界；这么多条记录的日志也不存在
+  if (number.empty() || number.size() > 9 ||
+      number.find_first_not_of("0123456789") != std::string::npos) {
+    return std::nullopt;
+  }
+  return std::make_pair(spec.substr(0, at), std::stoul(number));
+}
+
+time_t ParseExpireTime(const std::string &value) {
+  time_t now = time(nullptr);
+  if (value == "now" || value == "all") {
+    return now + 1;
+  }
+  if (value == "never" || value == "false") {
+    return 0;
+  }
+  if (value.ends_with(".days.ago") || value.ends_with(".days")) {
+    std::string days = value.substr(0, value.find('.'));
+    if (!days.empty() &&
+        days.find_first_not_of("0123456789") == std::string::npos) {
+      return now - std::stol(days) * 24 * 60 * 60;
+    }
+  }
+  if (!value.empty() &&
+      value.find_first_not_of("0123456789") == std::string::npos) {
+    return std::stol(value);
+  }
+  throw std::invalid_argument("Invalid expire time: " + value);
+}
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <cstddef>
+#include <ctime>
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+/**
+ * @brief 引用日志（reflog）
+ *
+ * 记录 HEAD 和每个分支的移动历史，存放在.git/logs/<引用名>：
+ *
+ * [ 日志行格式（与 Git 相同） ]
+ * <旧哈希> <新哈希> <姓名> <<邮箱>> <时间戳> <时区>\t<消息>\n
+ *
+ * 为了让 branch@{N} 不必扫描整个日志，每个日志另外维护一个定长索引
+ * .git/reflog-index/<引用名>：依次存放每一行在日志中的起始偏移（8字节
+ * 大端序）。索引不放在 logs 下，因为 Git 把其中的每个文件都当作 reflog。
+ *
+ * 追加一条记录只需对日志和索引各做一次 O_APPEND write()，与日志长度无关。
+ * 追加、重建索引和 expire 都持有锁文件 .git/logs/<引用名>.lock，日志和索引
+ * 不会被两个进程交错改写。
+ */
+struct ReflogEntry {
+  std::string old_hash;
+  std::string new_hash;
+  std::string identity; // "姓名 <邮箱>"
+  time_t timestamp = 0;
+  std::string timezone;
+  std::string message;
+};
+
+class Reflog {
+public:
+  explicit Reflog(std::filesystem::path git_dir = ".git")
+      : git_dir_(std::move(git_dir)) {}
+
+  /**
+   * @brief 追加一条引用移动记录
+   * @param ref 引用名，如 "HEAD" 或 "refs/heads/main"
+   * @param old_hash 移动前的哈希，空字符串表示新建
+   * @param new_hash 移动后的哈希
+   * @param message 记录说明，如 "commit: fix bug"
+   * @throw std::runtime_error 日志被其他进程锁住超时、日志文件无法打开或
+   *        写入不完整
+   */
+  void Append(const std::string &ref, const std::string &old_hash,
+              const std::string &new_hash, const std::string &message) const;
+
+  // 引用是否有日志
+  bool Exists(const std::string &ref) const;
+
+  // 日志中的记录条数（读取索引大小，O(1)）
+  size_t Count(const std::string &ref) const;
+
+  /**
+   * @brief 读取 ref@{n}：第 n 新的记录（n=0 为最新）
+   * @return 记录不存在时返回 std::nullopt
+   * @note 通过索引定位，只读取目标行
+   */
+  std::optional<ReflogEntry> Lookup(const std::string &ref, size_t n) const;
+
+  /**
+   * @brief 流式地删除时间早于 cutoff 的记录，同时重建索引
+   * @return 删除的记录条数
+   * @throw std::runtime_error 日志被其他进程锁住超时或无法改写
+   */
+  size_t Expire(const std::string &ref, time_t cutoff) const;
+
+  // 列出所有存在日志的引用名
+  std::vector<std::string> ListRefs() const;
+
+private:
+  std::filesystem::path LogPath(const std::string &ref) const {
+    return git_dir_ / "logs" / ref;
+  }
+  std::filesystem::path IndexPath(const std::string &ref) const {
+    return git_dir_ / "reflog-index" / ref;
+  }
+  // 索引是否恰好覆盖日志的全部行
+  bool IndexIsCurrent(const std::string &ref) const;
+  // 扫描日志重写索引，调用者持有日志锁
+  void RebuildIndex(const std::string &ref) const;
+  // 确保索引覆盖了日志的全部内容，必要时加锁重建
+  void EnsureIndex(const std::string &ref) const;
+
+  std::filesystem::path git_dir_;
+};
+
+/**
+ * @brief 解析一行日志
+ * @return 格式错误时返回 std::nullopt
+ */
+std::optional<ReflogEntry> ParseReflogLine(const std::string &line);
+
+/**
+ * @brief 解析 "<name>@{<n>}" 形式的修订名
+ * @return (name, n)，不是该形式时返回 std::nullopt；"@{n}" 的 name 为空
+ */
+std::optional<std::pair<std::string, size_t>>
+ParseReflogSpec(const std::string &spec);
+
+/**
+ * @brief 解析 reflog expire 的 --expire 参数
+ * @param value "now"/"all"、"never"、"<N>.days.ago" 或 Unix 时间戳
+ * @return 截止时间，早于它的记录会被删除
+ * @throw std::invalid_argument 无法识别的格式
+ */
+time_t ParseExpireTime(const std::string &value);
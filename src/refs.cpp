@@ -1,4 +1,7 @@
 #include "refs.h"
+#include "reflog.h"
+#include "reftable.h"
+#include <algorithm>
 #include <filesystem>
 #include <fstream>
 #include <iostream>
@@ -6,13 +9,32 @@
 #include <stdexcept>
 #include <string>
 namespace fs = std::filesystem;
+/**
+ * @brief 根据仓库中已有的存储格式选择引用后端
+ *
+ * 存在.git/reftable目录时使用 reftable，否则使用传统的文件存储。
+ */
+MiniGitRef::MiniGitRef() {
+  if (fs::exists(".git/reftable/tables.list")) {
+    backend_ = std::make_unique<ReftableRefBackend>();
+  } else {
+    backend_ = std::make_unique<FilesRefBackend>();
+  }
+}
+
 /**
  * @brief 初始化Git引用系统
+ * @param format 引用存储格式，默认为每个引用一个文件
  */
-void MiniGitRef::Init() {
+void MiniGitRef::Init(RefFormat format) {
   try {
+    if (format == RefFormat::kReftable) {
+      backend_ = std::make_unique<ReftableRefBackend>();
+    } else {
+      backend_ = std::make_unique<FilesRefBackend>();
+    }
     // 创建必要的目录结构
-    fs::create_directories(".git/refs/heads");
+    backend_->Init();
 
     // 创建 HEAD 文件
     std::ofstream head_file(".git/HEAD");
@@ -22,13 +44,6 @@ void MiniGitRef::Init() {
     head_file << "ref: refs/heads/main\n"; // 默认工作在 main 分支上
     head_file.close();
 
-    // 创建 main 分支文件（初始为空，等待第一次提交）
-    std::ofstream main_file(".git/refs/heads/main");
-    if (!main_file) {
-      throw std::runtime_error("Failed to create main branch file");
-    }
-    main_file.close();
-
   } catch (const std::exception &e) {
     std::cerr << "Git initialization failed: " << e.what() << std::endl;
     throw;
@@ -50,7 +65,7 @@ std::string MiniGitRef::GetCurrentCommit() const {
     std::string branch_path = head_content.substr(5); // 去掉 "ref: " 前缀
     // 去除可能的换行符
     branch_path.erase(branch_path.find_last_not_of("\n\r") + 1);
-    return ReadRefFile(".git/" + branch_path);
+    return backend_->ReadRef(branch_path);
   }
   // 如果HEAD直接存储了提交哈希, 则直接返回该哈希
   return head_content;
@@ -64,9 +79,17 @@ void MiniGitRef::SwitchToBranch(const std::string &name) {
   if (!BranchExists(name)) {
     throw std::runtime_error("Branch '" + name + "' does not exist!");
   }
+  std::string from = GetCurrentBranchName();
+  std::string from_commit = GetCurrentCommit();
   std::string branch_ref = "ref: refs/heads/" + name;
   std::ofstream head_file(HEAD_path_);
   head_file << branch_ref << "\n";
+  head_file.close();
+  std::string to_commit = GetBranchCommit(name);
+  if (!to_commit.empty()) {
+    Reflog().Append("HEAD", from_commit, to_commit,
+                    "checkout: moving from " + from + " to " + name);
+  }
   std::cout << "Now working on branch: " << name << std::endl;
 }
 /**
@@ -77,8 +100,7 @@ void MiniGitRef::SwitchToBranch(const std::string &name) {
  * @return false
  */
 bool MiniGitRef::BranchExists(const std::string &name) const {
-  fs::path branch_path = ".git/refs/heads/" + name;
-  return fs::exists(branch_path);
+  return backend_->RefExists("refs/heads/" + name);
 }
 /**
  * @brief 列出所有分支
@@ -87,17 +109,21 @@ bool MiniGitRef::BranchExists(const std::string &name) const {
  */
 std::vector<std::string> MiniGitRef::ListAllBranches() const {
   std::vector<std::string> branches;
-  fs::path refs_heads_path = ".git/refs/heads";
-  if (!fs::exists(refs_heads_path)) {
-    return branches; // 目录不存在，返回空列表
-  }
-  for (const auto &entry : fs::directory_iterator(refs_heads_path)) {
-    if (entry.is_regular_file()) { // 只处理文件，跳过子目录
-      branches.push_back(entry.path().filename().string());
-    }
+  for (const auto &ref : backend_->ListRefs("refs/heads/")) {
+    branches.push_back(ref.substr(11)); // 11 = strlen("refs/heads/")
   }
   return branches;
 }
+
+/**
+ * @brief 读取指定分支指向的提交哈希
+ *
+ * @param name 分支名称
+ * @return std::string 提交哈希，分支不存在或尚无提交时返回空字符串
+ */
+std::string MiniGitRef::GetBranchCommit(const std::string &name) const {
+  return backend_->ReadRef("refs/heads/" + name);
+}
 /**
  * @brief 更新分支引用的提交哈希
  *
@@ -106,54 +132,48 @@ std::vector<std::string> MiniGitRef::ListAllBranches() const {
  *
  * @param branch_name 要更新的分支名称
  * @param new_hash 新的提交哈希值（40字符SHA-1）
+ * @param reflog_msg 写入 reflog 的说明；分支是当前分支时也记录到 HEAD 的日志
  * @return true 更新成功
  * @return false 更新失败
  * @throw std::runtime_error 分支不存在或哈希格式无效
  */
 bool MiniGitRef::UpdateBranch(const std::string &branch_name,
-                              const std::string &new_hash) {
-  if (!BranchExists(branch_name)) {
+                              const std::string &new_hash,
+                              const std::string &reflog_msg) {
+  // HEAD 指向的分支在第一次提交前可能还不存在（未诞生的分支）
+  if (!BranchExists(branch_name) && branch_name != GetCurrentBranchName()) {
     throw std::runtime_error("Branch '" + branch_name + "' does not exist!");
   }
   // 基本哈希格式验证（可选）
   if (new_hash.empty() || new_hash.length() != 40) {
     throw std::runtime_error("Invalid commit hash format");
   }
-  std::ofstream branch_file(".git/refs/heads/" + branch_name);
-  if (!branch_file) {
-    return false; // 文件打开失败
+  std::string ref = "refs/heads/" + branch_name;
+  try {
+    std::string old_hash = backend_->ReadRef(ref);
+    backend_->WriteRefs({{ref, new_hash}});
+    Reflog reflog;
+    reflog.Append(ref, old_hash, new_hash, reflog_msg);
+    if (branch_name == GetCurrentBranchName()) {
+      reflog.Append("HEAD", old_hash, new_hash, reflog_msg);
+    }
+  } catch (const std::exception &e) {
+    std::cerr << e.what() << '\n';
+    return false;
   }
-  branch_file << new_hash << "\n";
-  return branch_file.good(); // 检查写入是否成功
+  return true;
 }
 /**
- * @brief 读取Git引用文件内容
+ * @brief 读取Git引用文件的第一行
  *
- * 解析Git引用文件，返回其中存储的对象哈希值。
- * 支持直接哈希和符号引用(对于符号引用，仅支持HEAD)两种格式：
- * - 直接哈希：直接返回文件中的哈希值
- * - 符号引用：解析引用链，返回最终指向的哈希值
+ * 仅用于直接存放在文件中的引用（如HEAD）。分支引用的读取交给 RefBackend，
+ * 以便支持非文件的存储格式。HEAD中的符号引用由调用者解析。
  *
- * @param path 引用文件路径（如".git/refs/heads/main"）
- * @return std::string 引用的对象哈希值，失败时返回空字符串
- * @example 输入: ".git/refs/heads/main" 输出: "a1b2c3d4e5f6..."
- * @note 支持HEAD文件的特殊处理，能正确解析"ref: refs/heads/branch"格式
+ * @param path 引用文件路径（如".git/HEAD"）
+ * @return std::string 文件第一行内容，失败时返回空字符串
+ * @example 输入: ".git/HEAD" 输出: "ref: refs/heads/main"
  */
 auto MiniGitRef::ReadRefFile(const std::string &path) const -> std::string {
-  if (path == HEAD_path_) {
-    std::ifstream head_file(HEAD_path_);
-    std::string head_content;
-    std::getline(head_file, head_content);
-    if (head_content.starts_with("ref: ")) {
-      std::string branch_path = head_content.substr(5);
-      std::string full_branch_path = ".git/" + branch_path;
-      std::ifstream branch_file(full_branch_path);
-      std::string commit_hash;
-      std::getline(branch_file, commit_hash);
-      return commit_hash;
-    }
-    return head_content;
-  }
   std::ifstream ref_file(path);
   std::string content;
   std::getline(ref_file, content);
@@ -212,14 +232,69 @@ std::string MiniGitRef::CreateBranch(const std::string &name) {
     throw std::runtime_error(
         "Cannot create branch: HEAD does not point to a valid commit");
   }
-  std::ofstream new_branch_file(".git/refs/heads/" + name);
-  if (!new_branch_file) {
-    throw std::runtime_error("Failed to create branch file for '" + name + "'");
+  backend_->WriteRefs({{"refs/heads/" + name, current_commit}});
+  Reflog().Append("refs/heads/" + name, "", current_commit,
+                  "branch: Created from HEAD");
+  return current_commit;
+}
+
+/**
+ * @brief 创建引用目录
+ *
+ * 与 reftable 后端一样不创建 main 分支：HEAD 指向的 main 在第一次提交前
+ * 是未诞生的分支，不出现在分支列表中。
+ */
+void FilesRefBackend::Init() {
+  fs::create_directories(git_dir_ / "refs/heads");
+}
+
+std::string FilesRefBackend::ReadRef(const std::string &name) const {
+  std::ifstream ref_file(git_dir_ / name);
+  std::string content;
+  std::getline(ref_file, content);
+  return content;
+}
+
+bool FilesRefBackend::RefExists(const std::string &name) const {
+  return fs::is_regular_file(git_dir_ / name);
+}
+
+void FilesRefBackend::WriteRefs(
+    const std::vector<std::pair<std::string, std::string>> &updates) {
+  for (const auto &[name, hash] : updates) {
+    fs::path ref_path = git_dir_ / name;
+    if (hash.empty()) {
+      fs::remove(ref_path);
+      continue;
+    }
+    fs::create_directories(ref_path.parent_path());
+    std::ofstream ref_file(ref_path);
+    if (!ref_file) {
+      throw std::runtime_error("Failed to open ref file " + ref_path.string());
+    }
+    ref_file << hash << "\n";
+    if (!ref_file.good()) {
+      throw std::runtime_error("Failed to write ref file " + ref_path.string());
+    }
   }
-  new_branch_file << current_commit << "\n";
-  if (!new_branch_file.good()) {
-    throw std::runtime_error("Failed to write commit hash to branch '" + name +
-                             "'");
+}
+
+std::vector<std::string>
+FilesRefBackend::ListRefs(const std::string &prefix) const {
+  std::vector<std::string> refs;
+  fs::path refs_path = git_dir_ / "refs";
+  if (!fs::exists(refs_path)) {
+    return refs; // 目录不存在，返回空列表
   }
-  return current_commit;
+  for (const auto &entry : fs::recursive_directory_iterator(refs_path)) {
+    if (!entry.is_regular_file()) { // 只处理文件，跳过子目录
+      continue;
+    }
+    std::string name = fs::relative(entry.path(), git_dir_).generic_string();
+    if (name.starts_with(prefix)) {
+      refs.push_back(name);
+    }
+  }
+  std::sort(refs.begin(), refs.end());
+  return refs;
 }
@@ -1,8 +1,68 @@
+#pragma once
+
 #include <filesystem>
 #include <fstream>
+#include <memory>
 #include <string>
 #include <unordered_set>
+#include <utility>
 #include <vector>
+
+/**
+ * @brief 引用存储后端接口
+ *
+ * 只负责 "引用名 → 提交哈希" 的持久化，HEAD 的符号引用仍由 MiniGitRef
+ * 直接管理。引用名使用完整路径形式，如 "refs/heads/main"。
+ *
+ * 目前有两种实现：
+ * - FilesRefBackend：每个引用一个文件（.git/refs/heads/<name>）
+ * - ReftableRefBackend：基于块的有序表堆栈（.git/reftable/，见 reftable.h）
+ */
+class RefBackend {
+public:
+  virtual ~RefBackend() = default;
+
+  // 创建后端所需的目录结构
+  virtual void Init() = 0;
+
+  // 读取引用，不存在时返回空字符串
+  virtual std::string ReadRef(const std::string &name) const = 0;
+  virtual bool RefExists(const std::string &name) const = 0;
+
+  /**
+   * @brief 批量写入引用
+   * @param updates (引用名, 新哈希) 列表，哈希为空字符串表示删除该引用
+   */
+  virtual void
+  WriteRefs(const std::vector<std::pair<std::string, std::string>> &updates) = 0;
+
+  // 按字典序列出所有以 prefix 开头的引用名
+  virtual std::vector<std::string>
+  ListRefs(const std::string &prefix) const = 0;
+};
+
+/**
+ * @brief 传统的 "一个引用一个文件" 存储
+ */
+class FilesRefBackend : public RefBackend {
+public:
+  explicit FilesRefBackend(std::filesystem::path git_dir = ".git")
+      : git_dir_(std::move(git_dir)) {}
+
+  void Init() override;
+  std::string ReadRef(const std::string &name) const override;
+  bool RefExists(const std::string &name) const override;
+  void WriteRefs(
+      const std::vector<std::pair<std::string, std::string>> &updates) override;
+  std::vector<std::string> ListRefs(const std::string &prefix) const override;
+
+private:
+  std::filesystem::path git_dir_;
+};
+
+// 引用存储格式，在 init 时选择
+enum class RefFormat { kFiles, kReftable };
+
 /**
  * @brief Git引用系统核心实现
  *
@@ -14,27 +74,31 @@
  *
  * 2. 分支引用存储
  *    功能：记录每个分支的最新位置
- *    表现：.git/refs/heads/目录下的文件
+ *    表现：由 RefBackend 决定，默认是.git/refs/heads/目录下的文件
  *    示例：
  *    main文件内容：a1b2c3...（40字符哈希）
  *    develop文件内容：d4e5f6...
+ *    使用 reftable 格式时，所有分支存放在.git/reftable/下的有序表中。
  *
  * 3. 引用解析
  *    功能：将符号引用转换为具体提交哈希
- *    流程：HEAD → "ref: refs/heads/main" → 读取 main 文件 → "a1b2c3..." →
+ *    流程：HEAD → "ref: refs/heads/main" → 读取 main 引用 → "a1b2c3..." →
  * 找到提交！
  *
  * 4. 引用更新
  *    功能：移动分支"指针"到新提交
- *    操作：修改分支文件的内容
- *    示例：main文件从 a1b2c3...改为 d4e5f6...
+ *    操作：通过后端写入新的哈希，并在.git/logs/下追加 reflog（见 reflog.h）
+ *    示例：main从 a1b2c3...改为 d4e5f6...
  *
  * 该实现中不包含 tag系统 的实现
  */
 class MiniGitRef {
 public:
+  // 根据磁盘上的仓库状态选择引用存储后端
+  MiniGitRef();
+
   // 初始化
-  void Init(); // 返回 bool 或抛异常
+  void Init(RefFormat format = RefFormat::kFiles); // 返回 bool 或抛异常
 
   // HEAD 管理
   std::string GetCurrentCommit() const; // const 修饰
@@ -45,16 +109,20 @@ public:
   void SwitchToBranch(const std::string &name);      // 明确动词前缀
   bool BranchExists(const std::string &name) const;
   std::vector<std::string> ListAllBranches() const;
+  std::string GetBranchCommit(const std::string &name) const;
 
-  // 引用更新
-  bool UpdateCurrentBranch(const std::string &new_hash) {
-    return UpdateBranch(GetCurrentBranchName(), new_hash);
+  // 引用更新（同时写入 reflog）
+  bool UpdateCurrentBranch(const std::string &new_hash,
+                           const std::string &reflog_msg = "update-ref") {
+    return UpdateBranch(GetCurrentBranchName(), new_hash, reflog_msg);
   }
 
 private:
   // 辅助函数
   bool UpdateBranch(const std::string &branch_name,
-                    const std::string &new_hash);
+                    const std::string &new_hash,
+                    const std::string &reflog_msg);
   auto ReadRefFile(const std::string &path) const -> std::string;
   std::filesystem::path HEAD_path_ = ".git/HEAD";
-};
\ No newline at end of file
+  std::unique_ptr<RefBackend> backend_;
+};
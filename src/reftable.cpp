@@ -0,0 +1,595 @@
+#include "reftable.h"
+#include "byte_util.h"
+#include <algorithm>
+#include <fcntl.h>
+#include <fstream>
+#include <iomanip>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+namespace fs = std::filesystem;
+using byte_util::BinaryToHex;
+using byte_util::HexToBinary;
+
+namespace reftable {
+namespace {
+
+constexpr char kMagic[4] = {'R', 'E', 'F', 'T'};
+constexpr uint8_t kVersion = 1;
+constexpr size_t kHeaderSize = 24;
+constexpr size_t kFooterSize = kHeaderSize + 8 + 4; // 文件头副本 + index偏移 + CRC32
+constexpr size_t kBlockHeaderSize = 4;              // 类型(1) + 块长度(3)
+constexpr int kRestartInterval = 16;
+
+void PutBE(std::string &out, uint64_t value, int bytes) {
+  for (int i = bytes - 1; i >= 0; i--) {
+    out.push_back(static_cast<char>((value >> (i * 8)) & 0xFF));
+  }
+}
+
+uint64_t GetBE(const unsigned char *p, int bytes) {
+  uint64_t value = 0;
+  for (int i = 0; i < bytes; i++) {
+    value = (value << 8) | p[i];
+  }
+  return value;
+}
+
+// 每字节7位有效数据，最高位为1表示还有后续字节
+void PutVarint(std::string &out, uint64_t value) {
+  while (value >= 0x80) {
+    out.push_back(static_cast<char>((value & 0x7F) | 0x80));
+    value >>= 7;
+  }
+  out.push_back(static_cast<char>(value));
+}
+
+uint64_t GetVarint(const unsigned char *data, size_t end, size_t &pos) {
+  uint64_t value = 0;
+  int shift = 0;
+  while (true) {
+    if (pos >= end || shift > 63) {
+      throw std::runtime_error("reftable: truncated varint");
+    }
+    unsigned char byte = data[pos++];
+    value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+    if (!(byte & 0x80)) {
+      return value;
+    }
+    shift += 7;
+  }
+}
+
+std::string EncodeHeader(uint32_t block_size, uint64_t min_idx,
+                         uint64_t max_idx) {
+  std::string header(kMagic, 4);
+  header.push_back(static_cast<char>(kVersion));
+  PutBE(header, block_size, 3);
+  PutBE(header, min_idx, 8);
+  PutBE(header, max_idx, 8);
+  return header;
+}
+
+size_t CommonPrefix(const std::string &a, const std::string &b) {
+  size_t n = std::min(a.size(), b.size());
+  size_t i = 0;
+  while (i < n && a[i] == b[i]) {
+    i++;
+  }
+  return i;
+}
+
+/**
+ * @brief 块编码器：负责前缀压缩和重启点
+ */
+class BlockWriter {
+public:
+  explicit BlockWriter(char type) : type_(type) {}
+
+  // value 为已编码好的记录值（不含键）
+  void Add(const std::string &key, uint8_t value_type,
+           const std::string &value) {
+    size_t prefix = 0;
+    if (count_ % kRestartInterval == 0) {
+      restarts_.push_back(kBlockHeaderSize + records_.size());
+    } else {
+      prefix = CommonPrefix(last_key_, key);
+    }
+    PutVarint(records_, prefix);
+    PutVarint(records_, ((key.size() - prefix) << 3) | value_type);
+    records_.append(key, prefix, std::string::npos);
+    records_ += value;
+    last_key_ = key;
+    count_++;
+  }
+
+  size_t EstimatedSize() const {
+    return kBlockHeaderSize + records_.size() + restarts_.size() * 3 + 2;
+  }
+  bool Empty() const { return count_ == 0; }
+  const std::string &LastKey() const { return last_key_; }
+
+  std::string Finish() {
+    std::string block;
+    block.push_back(type_);
+    PutBE(block, EstimatedSize(), 3);
+    block += records_;
+    for (uint32_t restart : restarts_) {
+      PutBE(block, restart, 3);
+    }
+    PutBE(block, restarts_.size(), 2);
+    return block;
+  }
+
+private:
+  char type_;
+  std::string records_;
+  std::vector<uint32_t> restarts_;
+  std::string last_key_;
+  int count_ = 0;
+};
+
+std::string RandomSuffix() {
+  static std::mt19937 rng(std::random_device{}());
+  std::ostringstream oss;
+  oss << std::hex << std::setw(8) << std::setfill('0') << rng();
+  return oss.str();
+}
+
+} // namespace
+
+void WriteTable(const fs::path &path, const std::vector<RefRecord> &records,
+                uint64_t min_update_index, uint64_t max_update_index,
+                uint32_t block_size) {
+  std::string out = EncodeHeader(block_size, min_update_index, max_update_index);
+
+  // 依次填充 ref 块，记录每个块的末键用于生成 index 块
+  std::vector<std::pair<std::string, uint64_t>> block_index;
+  BlockWriter block('r');
+  uint64_t block_offset = out.size();
+  auto flush_block = [&]() {
+    block_index.push_back({block.LastKey(), block_offset});
+    out += block.Finish();
+    block = BlockWriter('r');
+    block_offset = out.size();
+  };
+
+  const std::string *prev_name = nullptr;
+  for (const auto &record : records) {
+    if (prev_name && *prev_name >= record.name) {
+      throw std::runtime_error("reftable: records must be sorted and unique");
+    }
+    prev_name = &record.name;
+
+    std::string value;
+    PutVarint(value, record.update_index - min_update_index);
+    if (record.type == kObjectId) {
+      HexToBinary(record.hash, value);
+    }
+    if (!block.Empty() && block.EstimatedSize() + record.name.size() +
+                                  value.size() + 16 >
+                              block_size) {
+      flush_block();
+    }
+    block.Add(record.name, record.type, value);
+  }
+  if (!block.Empty()) {
+    flush_block();
+  }
+
+  // 只有一个块时不需要 index，直接从文件头后开始读
+  uint64_t index_offset = 0;
+  if (block_index.size() > 1) {
+    index_offset = out.size();
+    BlockWriter index('i');
+    for (const auto &[last_key, offset] : block_index) {
+      std::string value;
+      PutVarint(value, offset);
+      index.Add(last_key, 0, value);
+    }
+    out += index.Finish();
+  }
+
+  std::string footer =
+      EncodeHeader(block_size, min_update_index, max_update_index);
+  PutBE(footer, index_offset, 8);
+  uLong crc = crc32(0L, reinterpret_cast<const Bytef *>(footer.data()),
+                    footer.size());
+  PutBE(footer, crc, 4);
+  out += footer;
+
+  fs::path tmp = path.string() + ".tmp";
+  {
+    std::ofstream file(tmp, std::ios::binary);
+    if (!file) {
+      throw std::runtime_error("reftable: cannot create " + tmp.string());
+    }
+    file.write(out.data(), out.size());
+    if (!file.good()) {
+      throw std::runtime_error("reftable: failed to write " + tmp.string());
+    }
+  }
+  fs::rename(tmp, path);
+}
+
+Table::Table(const fs::path &path) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    throw std::runtime_error("reftable: cannot open " + path.string());
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size < (off_t)(kHeaderSize + kFooterSize)) {
+    close(fd);
+    throw std::runtime_error("reftable: table too small " + path.string());
+  }
+  size_ = st.st_size;
+  void *mapped = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (mapped == MAP_FAILED) {
+    throw std::runtime_error("reftable: mmap failed for " + path.string());
+  }
+  data_ = static_cast<const unsigned char *>(mapped);
+
+  const unsigned char *footer = data_ + size_ - kFooterSize;
+  uLong crc = crc32(0L, footer, kFooterSize - 4);
+  if (memcmp(data_, kMagic, 4) != 0 || memcmp(footer, data_, kHeaderSize) != 0 ||
+      GetBE(footer + kFooterSize - 4, 4) != crc) {
+    munmap(mapped, size_);
+    throw std::runtime_error("reftable: corrupt table " + path.string());
+  }
+  block_size_ = GetBE(data_ + 5, 3);
+  min_update_index_ = GetBE(data_ + 8, 8);
+  max_update_index_ = GetBE(data_ + 16, 8);
+  index_offset_ = GetBE(footer + kHeaderSize, 8);
+  ref_end_ = index_offset_ ? index_offset_ : size_ - kFooterSize;
+}
+
+Table::~Table() {
+  if (data_) {
+    munmap(const_cast<unsigned char *>(data_), size_);
+  }
+}
+
+Table::Block Table::ReadBlock(size_t offset) const {
+  if (offset + kBlockHeaderSize > size_ - kFooterSize) {
+    throw std::runtime_error("reftable: block offset out of range");
+  }
+  Block block;
+  block.type = static_cast<char>(data_[offset]);
+  size_t length = GetBE(data_ + offset + 1, 3);
+  if (offset + length > size_ - kFooterSize || length < kBlockHeaderSize + 2) {
+    throw std::runtime_error("reftable: block length out of range");
+  }
+  size_t end = offset + length;
+  size_t restart_count = GetBE(data_ + end - 2, 2);
+  block.records_end = end - 2 - restart_count * 3;
+  block.begin = offset + kBlockHeaderSize;
+  block.restarts.reserve(restart_count);
+  for (size_t i = 0; i < restart_count; i++) {
+    block.restarts.push_back(
+        offset + GetBE(data_ + block.records_end + i * 3, 3));
+  }
+  return block;
+}
+
+namespace {
+
+struct DecodedRecord {
+  std::string key;
+  uint8_t type = 0;
+  uint64_t update_index = 0; // ref 块：更新号；index 块：目标块偏移
+  const unsigned char *oid = nullptr;
+};
+
+// 解码 pos 处的一条记录，key 中需保留上一条记录的键用于前缀还原
+size_t DecodeRecord(const unsigned char *data, size_t end, size_t pos,
+                    char block_type, DecodedRecord &rec) {
+  uint64_t prefix = GetVarint(data, end, pos);
+  uint64_t suffix_and_type = GetVarint(data, end, pos);
+  uint64_t suffix = suffix_and_type >> 3;
+  rec.type = suffix_and_type & 0x7;
+  if (prefix > rec.key.size() || pos + suffix > end) {
+    throw std::runtime_error("reftable: corrupt record");
+  }
+  rec.key.resize(prefix);
+  rec.key.append(reinterpret_cast<const char *>(data + pos), suffix);
+  pos += suffix;
+  rec.update_index = GetVarint(data, end, pos);
+  rec.oid = nullptr;
+  if (block_type == 'r' && rec.type == kObjectId) {
+    if (pos + 20 > end) {
+      throw std::runtime_error("reftable: truncated object id");
+    }
+    rec.oid = data + pos;
+    pos += 20;
+  }
+  return pos;
+}
+
+} // namespace
+
+bool Table::SeekInBlock(const Block &block, const std::string &name,
+                        RefRecord &out) const {
+  // 在重启点上二分：找到最后一个键 <= name 的重启点
+  size_t lo = 0, hi = block.restarts.size();
+  while (hi - lo > 1) {
+    size_t mid = (lo + hi) / 2;
+    DecodedRecord probe;
+    DecodeRecord(data_, block.records_end, block.restarts[mid], block.type,
+                 probe);
+    if (probe.key <= name) {
+      lo = mid;
+    } else {
+      hi = mid;
+    }
+  }
+
+  // 从该重启点开始顺序扫描（最多 kRestartInterval 条）
+  DecodedRecord rec;
+  size_t pos = block.restarts.empty() ? block.begin : block.restarts[lo];
+  while (pos < block.records_end) {
+    pos = DecodeRecord(data_, block.records_end, pos, block.type, rec);
+    if (rec.key >= name) {
+      out.name = rec.key;
+      out.type = static_cast<ValueType>(rec.type);
+      out.update_index = rec.update_index;
+      out.hash = rec.oid ? BinaryToHex(rec.oid) : "";
+      return rec.key == name;
+    }
+  }
+  out.name.clear();
+  return false;
+}
+
+std::optional<RefRecord> Table::Find(const std::string &name) const {
+  size_t block_offset = kHeaderSize;
+  if (index_offset_) {
+    Block index = ReadBlock(index_offset_);
+    RefRecord entry;
+    SeekInBlock(index, name, entry);
+    if (entry.name.empty()) {
+      return std::nullopt; // name 大于表中所有键
+    }
+    block_offset = entry.update_index;
+  }
+  if (block_offset >= ref_end_) {
+    return std::nullopt; // 空表
+  }
+  RefRecord record;
+  if (!SeekInBlock(ReadBlock(block_offset), name, record)) {
+    return std::nullopt;
+  }
+  record.update_index += min_update_index_;
+  return record;
+}
+
+std::vector<RefRecord> Table::ReadAll() const {
+  std::vector<RefRecord> records;
+  size_t offset = kHeaderSize;
+  while (offset < ref_end_) {
+    Block block = ReadBlock(offset);
+    DecodedRecord rec;
+    size_t pos = block.begin;
+    while (pos < block.records_end) {
+      pos = DecodeRecord(data_, block.records_end, pos, block.type, rec);
+      records.push_back({rec.key, rec.update_index + min_update_index_,
+                         static_cast<ValueType>(rec.type),
+                         rec.oid ? BinaryToHex(rec.oid) : ""});
+    }
+    offset += GetBE(data_ + offset + 1, 3);
+  }
+  return records;
+}
+
+Stack::Stack(fs::path reftable_dir) : dir_(std::move(reftable_dir)) {
+  if (fs::exists(dir_ / "tables.list")) {
+    Reload();
+  }
+}
+
+void Stack::Init() {
+  fs::create_directories(dir_);
+  std::ofstream list(dir_ / "tables.list");
+  if (!list) {
+    throw std::runtime_error("Failed to create " +
+                             (dir_ / "tables.list").string());
+  }
+  names_.clear();
+  tables_.clear();
+}
+
+std::vector<std::string> Stack::ReadTablesList() const {
+  std::vector<std::string> names;
+  std::ifstream list(dir_ / "tables.list");
+  std::string line;
+  while (std::getline(list, line)) {
+    if (!line.empty()) {
+      names.push_back(line);
+    }
+  }
+  return names;
+}
+
+void Stack::Reload() {
+  names_ = ReadTablesList();
+  tables_.clear();
+  for (const auto &name : names_) {
+    tables_.push_back(std::make_unique<Table>(dir_ / name));
+  }
+}
+
+std::optional<std::string> Stack::Read(const std::string &name) const {
+  for (auto it = tables_.rbegin(); it != tables_.rend(); ++it) {
+    if (auto record = (*it)->Find(name)) {
+      if (record->type == kDeletion) {
+        return std::nullopt;
+      }
+      return record->hash;
+    }
+  }
+  return std::nullopt;
+}
+
+std::vector<std::string> Stack::List(const std::string &prefix) const {
+  // 从旧到新叠加，后写入的记录覆盖先前的记录
+  std::map<std::string, ValueType> merged;
+  for (const auto &table : tables_) {
+    for (const auto &record : table->ReadAll()) {
+      if (record.name.starts_with(prefix)) {
+        merged[record.name] = record.type;
+      }
+    }
+  }
+  std::vector<std::string> names;
+  for (const auto &[name, type] : merged) {
+    if (type != kDeletion) {
+      names.push_back(name);
+    }
+  }
+  return names;
+}
+
+std::string Stack::NewTableName(uint64_t min_idx, uint64_t max_idx) const {
+  std::ostringstream oss;
+  oss << "0x" << std::hex << std::setw(12) << std::setfill('0') << min_idx
+      << "-0x" << std::setw(12) << max_idx << '-' << RandomSuffix() << ".ref";
+  return oss.str();
+}
+
+void Stack::WriteTablesList(const std::vector<std::string> &names) {
+  // 调用者已持有 tables.list.lock，先写临时文件再原子地重命名
+  fs::path tmp = dir_ / ("tables.list." + RandomSuffix());
+  {
+    std::ofstream out(tmp, std::ios::trunc);
+    for (const auto &name : names) {
+      out << name << '\n';
+    }
+    if (!out.good()) {
+      throw std::runtime_error("reftable: failed to write tables.list");
+    }
+  }
+  fs::rename(tmp, dir_ / "tables.list");
+}
+
+std::string Stack::Compact(size_t first) {
+  std::map<std::string, RefRecord> merged;
+  for (size_t i = first; i < tables_.size(); i++) {
+    for (auto &record : tables_[i]->ReadAll()) {
+      merged[record.name] = std::move(record);
+    }
+  }
+  std::vector<RefRecord> records;
+  records.reserve(merged.size());
+  for (auto &[name, record] : merged) {
+    // 合并到最底层时，墓碑记录已没有需要遮盖的旧值
+    if (first == 0 && record.type == kDeletion) {
+      continue;
+    }
+    records.push_back(std::move(record));
+  }
+  uint64_t min_idx = tables_[first]->MinUpdateIndex();
+  uint64_t max_idx = tables_.back()->MaxUpdateIndex();
+  std::string name = NewTableName(min_idx, max_idx);
+  WriteTable(dir_ / name, records, min_idx, max_idx);
+  return name;
+}
+
+void Stack::AutoCompact() {
+  // 保持表大小的几何序列：每个表至少是其上方所有表之和的2倍
+  if (tables_.size() < 2) {
+    return;
+  }
+  size_t first = tables_.size() - 1;
+  size_t sum = tables_[first]->Size();
+  while (first > 0 && tables_[first - 1]->Size() < 2 * sum) {
+    first--;
+    sum += tables_[first]->Size();
+  }
+  if (first == tables_.size() - 1) {
+    return;
+  }
+  std::string merged = Compact(first);
+  std::vector<std::string> obsolete(names_.begin() + first, names_.end());
+  names_.resize(first);
+  names_.push_back(merged);
+  WriteTablesList(names_);
+  for (const auto &name : obsolete) {
+    fs::remove(dir_ / name);
+  }
+  Reload();
+}
+
+namespace {
+
+// tables.list.lock 的持有者，析构时释放
+class ListLock {
+public:
+  explicit ListLock(const fs::path &dir) : path_(dir / "tables.list.lock") {
+    int fd = open(path_.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644);
+    if (fd < 0) {
+      throw std::runtime_error("reftable: unable to lock " + path_.string() +
+                               ": " + strerror(errno));
+    }
+    close(fd);
+  }
+  ~ListLock() { fs::remove(path_); }
+
+private:
+  fs::path path_;
+};
+
+} // namespace
+
+void Stack::Add(
+    const std::vector<std::pair<std::string, std::string>> &updates) {
+  if (updates.empty()) {
+    return;
+  }
+  ListLock lock(dir_);
+  Reload(); // 其他进程可能已在我们读取之后追加了新表
+
+  // 同一引用多次出现时以最后一次为准
+  std::map<std::string, std::string> sorted;
+  for (const auto &[name, hash] : updates) {
+    sorted[name] = hash;
+  }
+  uint64_t update_index = tables_.empty() ? 1 : tables_.back()->MaxUpdateIndex() + 1;
+  std::vector<RefRecord> records;
+  records.reserve(sorted.size());
+  for (const auto &[name, hash] : sorted) {
+    records.push_back(
+        {name, update_index, hash.empty() ? kDeletion : kObjectId, hash});
+  }
+
+  std::string table_name = NewTableName(update_index, update_index);
+  WriteTable(dir_ / table_name, records, update_index, update_index);
+  names_.push_back(table_name);
+  WriteTablesList(names_);
+  tables_.push_back(std::make_unique<Table>(dir_ / table_name));
+
+  AutoCompact();
+}
+
+void Stack::CompactAll() {
+  if (tables_.size() < 2) {
+    return;
+  }
+  ListLock lock(dir_);
+  Reload();
+  std::string merged = Compact(0);
+  std::vector<std::string> obsolete = names_;
+  names_ = {merged};
+  WriteTablesList(names_);
+  for (const auto &name : obsolete) {
+    fs::remove(dir_ / name);
+  }
+  Reload();
+}
+
+} // namespace reftable
@@ -0,0 +1,172 @@
+#pragma once
+
+#include "refs.h"
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+/**
+ * @brief reftable 引用存储格式
+ *
+ * 面向拥有海量引用、频繁更新的仓库。所有引用存放在
+ * .git/reftable/ 下的一组只读有序表中，tables.list 按从旧到新的顺序记录它们：
+ *
+ * [ 单个 .ref 表文件 ]
+ * +---------------+------------------+-------------+----------------+
+ * | 文件头 (24B)   | ref 块 1..N       | index 块     | 文件尾 (36B)    |
+ * +---------------+------------------+-------------+----------------+
+ * | "REFT" 版本    | 按引用名排序的记录 | 每个块的末键 | 文件头副本      |
+ * | 块大小 更新号  | + 重启点数组      | → 块偏移    | index偏移 CRC32 |
+ * +---------------+------------------+-------------+----------------+
+ *
+ * [ 块内记录（前缀压缩） ]
+ * varint(与前一个键的公共前缀长度) varint(后缀长度<<3 | 值类型) 后缀
+ * varint(update_index - min_update_index) 值
+ *
+ * 每隔 kRestartInterval 条记录放一个重启点（公共前缀长度为0），
+ * 查找时先在 index 块、再在块内的重启点上二分，因此单表查找是对数复杂度。
+ *
+ * 写入只生成一个包含本次改动引用的新表并追加到 tables.list（O(改动数)），
+ * 之后按几何序列规则自动合并较小的表，使表的数量保持在 O(log n)。
+ */
+namespace reftable {
+
+// 记录值类型
+enum ValueType : uint8_t {
+  kDeletion = 0, // 墓碑记录：引用已被删除
+  kObjectId = 1, // 值为20字节二进制对象哈希
+};
+
+struct RefRecord {
+  std::string name;
+  uint64_t update_index = 0;
+  ValueType type = kDeletion;
+  std::string hash; // 40字符十六进制，删除记录为空
+};
+
+/**
+ * @brief 将一批有序记录写成一个 .ref 表文件
+ * @param path 目标文件路径
+ * @param records 已按引用名排序且不重复的记录
+ * @param block_size 单个 ref 块的目标大小（字节）
+ * @throw std::runtime_error 记录未排序或写入失败
+ */
+void WriteTable(const std::filesystem::path &path,
+                const std::vector<RefRecord> &records,
+                uint64_t min_update_index, uint64_t max_update_index,
+                uint32_t block_size = 4096);
+
+/**
+ * @brief 只读的 .ref 表，通过 mmap 访问
+ */
+class Table {
+public:
+  explicit Table(const std::filesystem::path &path);
+  ~Table();
+  Table(const Table &) = delete;
+  Table &operator=(const Table &) = delete;
+
+  // 二分查找单个引用（包含墓碑记录），找不到返回 std::nullopt
+  std::optional<RefRecord> Find(const std::string &name) const;
+
+  // 按顺序遍历所有记录
+  std::vector<RefRecord> ReadAll() const;
+
+  uint64_t MinUpdateIndex() const { return min_update_index_; }
+  uint64_t MaxUpdateIndex() const { return max_update_index_; }
+  size_t Size() const { return size_; }
+
+private:
+  struct Block {
+    char type;
+    size_t begin;         // 第一条记录的位置
+    size_t records_end;   // 重启点数组的起始位置
+    std::vector<uint32_t> restarts;
+  };
+  Block ReadBlock(size_t offset) const;
+  // 在块内查找第一个 >= name 的记录，找到精确匹配时返回 true
+  bool SeekInBlock(const Block &block, const std::string &name,
+                   RefRecord &out) const;
+
+  const unsigned char *data_ = nullptr;
+  size_t size_ = 0;
+  uint32_t block_size_ = 0;
+  uint64_t min_update_index_ = 0;
+  uint64_t max_update_index_ = 0;
+  uint64_t index_offset_ = 0;
+  size_t ref_end_ = 0; // ref 块区域的结束位置
+};
+
+/**
+ * @brief 由多个表叠加而成的引用数据库
+ *
+ * 查找从最新的表开始，第一个命中的记录生效（墓碑记录表示不存在）。
+ */
+class Stack {
+public:
+  explicit Stack(std::filesystem::path reftable_dir);
+
+  // 创建空的 tables.list
+  void Init();
+
+  std::optional<std::string> Read(const std::string &name) const;
+  std::vector<std::string> List(const std::string &prefix) const;
+
+  /**
+   * @brief 以一个新表追加本次改动，必要时自动合并
+   * @param updates (引用名, 哈希)，哈希为空表示删除
+   * @throw std::runtime_error 无法获取 tables.list.lock 或写入失败
+   */
+  void Add(const std::vector<std::pair<std::string, std::string>> &updates);
+
+  // 将全部表合并为一个（同时丢弃墓碑记录）
+  void CompactAll();
+
+  size_t TableCount() const { return tables_.size(); }
+
+private:
+  void Reload();
+  std::vector<std::string> ReadTablesList() const;
+  void WriteTablesList(const std::vector<std::string> &names);
+  std::string NewTableName(uint64_t min_idx, uint64_t max_idx) const;
+  // 将 [first, tables_.size()) 的表合并为一个新表，返回其文件名
+  std::string Compact(size_t first);
+  void AutoCompact();
+
+  std::filesystem::path dir_;
+  std::vector<std::string> names_;
+  std::vector<std::unique_ptr<Table>> tables_;
+};
+
+} // namespace reftable
+
+/**
+ * @brief MiniGitRef 使用的 reftable 后端
+ */
+class ReftableRefBackend : public RefBackend {
+public:
+  explicit ReftableRefBackend(std::filesystem::path git_dir = ".git")
+      : stack_(git_dir / "reftable") {}
+
+  void Init() override { stack_.Init(); }
+  std::string ReadRef(const std::string &name) const override {
+    return stack_.Read(name).value_or("");
+  }
+  bool RefExists(const std::string &name) const override {
+    return stack_.Read(name).has_value();
+  }
+  void WriteRefs(const std::vector<std::pair<std::string, std::string>>
+                     &updates) override {
+    stack_.Add(updates);
+  }
+  std::vector<std::string> ListRefs(const std::string &prefix) const override {
+    return stack_.List(prefix);
+  }
+
+private:
+  reftable::Stack stack_;
+};
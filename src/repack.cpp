@@ -0,0 +1,397 @@
+#include "repack.h"
+#include "../include/clone_gadget.h"
+#include "bitmap.h"
+#include "commit_graph.h"
+#include "config.h"
+#include "dircache.h"
+#include "durability.h"
+#include "reflog.h"
+#include "refs.h"
+#include "trace.h"
+#include "tree.h"
+#include <filesystem>
+#include <iostream>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unordered_set>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+GitObject ReadRequired(const ObjectStore &store, const std::string &hash,
+                       ObjectType expected) {
+  auto object = store.Read(hash);
+  if (!object) {
+    throw std::runtime_error("missing object " + hash);
+  }
+  if (object->type != expected) {
+    throw std::runtime_error("object " + hash + " is a " +
+                             ObjectTypeName(object->type) + ", expected " +
+                             ObjectTypeName(expected));
+  }
+  return std::move(*object);
+}
+
+/**
+ * @brief 可达对象遍历的状态
+ */
+class ReachableWalker {
+public:
+  ReachableWalker(const ObjectStore &store, bool skip_missing_blobs)
+      : store_(store), skip_missing_blobs_(skip_missing_blobs) {}
+
+  // 任意类型的起点：提交、tree 或 blob
+  void AddObject(const std::string &hash) {
+    auto header = store_.ReadHeader(hash);
+    if (!header) {
+      throw std::runtime_error("missing object " + hash);
+    }
+    switch (header->first) {
+    case ObjectType::kCommit:
+      AddCommit(hash);
+      break;
+    case ObjectType::kTree:
+      AddTree(hash, "");
+      break;
+    case ObjectType::kBlob:
+      if (seen_.insert(hash).second) {
+        out_.push_back({hash, ObjectType::kBlob, header->second, 0});
+      }
+      break;
+    default:
+      throw std::runtime_error("object " + hash + " is a " +
+                               ObjectTypeName(header->first));
+    }
+  }
+
+  void AddCommit(const std::string &hash) {
+    std::vector<std::string> pending = {hash};
+    while (!pending.empty()) {
+      std::string commit = std::move(pending.back());
+      pending.pop_back();
+      if (!seen_.insert(commit).second) {
+        continue;
+      }
+      GitObject object = ReadRequired(store_, commit, ObjectType::kCommit);
+      out_.push_back({commit, ObjectType::kCommit, object.data.size(), 0});
+      // 提交头部：tree <hash>\n(parent <hash>\n)*...
+      size_t pos = 0;
+      while (pos < object.data.size() && object.data[pos] != '\n') {
+        size_t eol = object.data.find('\n', pos);
+        std::string line = object.data.substr(pos, eol - pos);
+        if (line.starts_with("tree ")) {
+          AddTree(line.substr(5), "");
+        } else if (line.starts_with("parent ")) {
+          pending.push_back(line.substr(7));
+        }
+        if (eol == std::string::npos) {
+          break;
+        }
+        pos = eol + 1;
+      }
+    }
+  }
+
+  std::vector<pack::PackInput> Take() { return std::move(out_); }
+
+private:
+  void AddTree(const std::string &hash, const std::string &path) {
+    if (!seen_.insert(hash).second) {
+      return;
+    }
+    GitObject object = ReadRequired(store_, hash, ObjectType::kTree);
+    out_.push_back({hash, ObjectType::kTree, object.data.size(),
+                    pack::NameHash(path)});
+    tree::TreeParser parser(object.data, hash);
+    tree::TreeEntry entry;
+    while (parser.Next(entry)) {
+      std::string name(entry.name);
+      std::string child = entry.Hash();
+      if (entry.IsTree()) {
+        AddTree(child, name);
+      } else if (entry.mode == tree::kModeGitlink) {
+        continue; // 子模块提交不在本仓库中
+      } else if (seen_.insert(child).second) {
+        auto header = store_.ReadHeader(child);
+        if (!header && skip_missing_blobs_) {
+          continue; // 部分克隆中被过滤掉的 blob
+        }
+        if (!header) {
+          throw std::runtime_error("missing object " + child);
+        }
+        out_.push_back(
+            {child, ObjectType::kBlob, header->second, pack::NameHash(name)});
+      }
+    }
+  }
+
+  const ObjectStore &store_;
+  bool skip_missing_blobs_;
+  std::unordered_set<std::string> seen_;
+  std::vector<pack::PackInput> out_;
+};
+
+// 删除不再需要的 pack（除 keep 以外的全部）
+size_t RemoveOldPacks(const ObjectStore &store, const std::string &keep) {
+  size_t removed = 0;
+  for (const auto &pack : store.Packs()) {
+    if (pack->Checksum() == keep) {
+      continue;
+    }
+    fs::path idx = pack->IdxPath();
+    // 先删 .idx，读者不会再发现这个 pack
+    fs::remove(idx);
+    fs::remove(pack->PackPath());
+    fs::remove(bitmap::BitmapPath(*pack));
+    removed++;
+  }
+  return removed;
+}
+
+// 删除已经在 pack 中的松散对象
+size_t PrunePacked(const ObjectStore &store) {
+  size_t removed = 0;
+  for (const auto &hash : store.ListLoose()) {
+    if (store.InAnyPack(hash)) {
+      fs::path path = store.LoosePath(hash);
+      fs::remove(path);
+      std::error_code ec;
+      fs::remove(path.parent_path(), ec); // 目录非空时失败，忽略
+      removed++;
+    }
+  }
+  return removed;
+}
+
+bool OlderThan(const fs::path &path, time_t cutoff) {
+  struct stat st;
+  return stat(path.c_str(), &st) == 0 && st.st_mtime < cutoff;
+}
+
+// 旧 pack（keep 以外）中不可达的对象写成松散对象，修改时间取 pack 的，
+// 之后与其他松散对象一样按 --prune 的时间删除。早于 cutoff 的 pack 不写出
+size_t UnpackUnreachable(const ObjectStore &store, const std::string &keep,
+                         const std::unordered_set<std::string> &reachable,
+                         time_t cutoff) {
+  std::vector<std::pair<std::string, struct timespec>> unpacked;
+  durability::ObjectTransaction transaction(store.GitDir());
+  for (const auto &pack : store.Packs()) {
+    struct stat st;
+    if (pack->Checksum() == keep || stat(pack->PackPath().c_str(), &st) != 0 ||
+        st.st_mtime < cutoff) {
+      continue;
+    }
+    for (size_t i = 0; i < pack->Count(); i++) {
+      std::string hash = pack->HashAt(i);
+      if (reachable.count(hash) || store.HasLoose(hash)) {
+        continue;
+      }
+      GitObject object = *store.Read(hash);
+      std::string compressed =
+          compress_string(std::string(ObjectTypeName(object.type)) + ' ' +
+                          std::to_string(object.data.size()) + '\0' +
+                          object.data);
+      durability::WriteLooseObject(store.GitDir(), hash, compressed.data(),
+                                   compressed.size());
+      unpacked.emplace_back(std::move(hash), st.st_mtim);
+    }
+  }
+  transaction.Commit();
+  for (const auto &[hash, mtime] : unpacked) {
+    struct timespec times[2] = {mtime, mtime};
+    utimensat(AT_FDCWD, store.LoosePath(hash).c_str(), times, 0);
+  }
+  return unpacked.size();
+}
+
+} // namespace
+
+std::vector<std::string> ReachabilityTips(const ObjectStore &store,
+                                          bool include_reflog) {
+  MiniGitRef refs;
+  std::vector<std::string> tips;
+  for (const auto &branch : refs.ListAllBranches()) {
+    std::string hash = refs.GetBranchCommit(branch);
+    if (!hash.empty()) {
+      tips.push_back(hash);
+    }
+  }
+  std::string head = refs.GetCurrentCommit();
+  if (!head.empty()) {
+    tips.push_back(head);
+  }
+  if (!include_reflog) {
+    return tips;
+  }
+  // reflog 中的提交也要保留，否则 branch@{n} 会指向被删除的对象
+  Reflog reflog(store.GitDir());
+  for (const auto &ref : reflog.ListRefs()) {
+    size_t count = reflog.Count(ref);
+    for (size_t i = 0; i < count; i++) {
+      auto entry = reflog.Lookup(ref, i);
+      if (entry && store.Contains(entry->new_hash)) {
+        tips.push_back(entry->new_hash);
+      }
+    }
+  }
+  return tips;
+}
+
+std::vector<std::string> IndexObjects(const ObjectStore &store) {
+  std::vector<std::string> objects;
+  for (const auto &entry :
+       dircache::Index::Read(store.GitDir() / "index", false).Entries()) {
+    if (entry.mode != tree::kModeGitlink) {
+      objects.push_back(entry.hash);
+    }
+  }
+  return objects;
+}
+
+bool IsPartialClone(const ObjectStore &store) {
+  Config config(store.GitDir());
+  std::string remote =
+      "remote." + config.Get("extensions.partialclone").value_or("origin");
+  return config.GetBool(remote + ".promisor", false) ||
+         config.Get(remote + ".partialclonefilter").has_value();
+}
+
+std::vector<pack::PackInput>
+EnumerateReachable(const ObjectStore &store,
+                   const std::vector<std::string> &tips,
+                   bool skip_missing_blobs) {
+  TRACE_SPAN("enumerate-objects");
+  ReachableWalker walker(store, skip_missing_blobs);
+  for (const auto &tip : tips) {
+    walker.AddObject(tip);
+  }
+  auto objects = walker.Take();
+  TRACE_COUNT("reachable_objects", objects.size());
+  return objects;
+}
+
+RepackResult Repack(const RepackOptions &options) {
+  TRACE_SPAN("repack");
+  ObjectStore store;
+  auto tips = ReachabilityTips(store);
+  // 暂存而还没有提交的对象也要保留；部分克隆中稀疏检出以外的条目可能
+  // 没有 blob
+  bool partial_clone = IsPartialClone(store);
+  for (auto &hash : IndexObjects(store)) {
+    if (!partial_clone || store.Contains(hash)) {
+      tips.push_back(std::move(hash));
+    }
+  }
+  auto objects = EnumerateReachable(store, tips, partial_clone);
+  std::unordered_set<std::string> reachable;
+  if (options.unpack_unreachable) {
+    for (const auto &object : objects) {
+      reachable.insert(object.hash);
+    }
+  }
+  // 只打包本仓库的对象，alternates 中的留在原处（git repack -l）
+  bool has_alternate_objects = false;
+  std::erase_if(objects, [&](const pack::PackInput &object) {
+    if (store.InAnyPack(object.hash)) {
+      return !options.all;
+    }
+    if (store.HasLoose(object.hash)) {
+      return false;
+    }
+    has_alternate_objects = true;
+    return true;
+  });
+
+  RepackResult result;
+  if (!objects.empty()) {
+    // 已在旧 pack 中的对象（以及它们的 delta）直接复制，不重新压缩
+    pack::PackWriteOptions pack_options = options.pack;
+    for (const auto &packfile : store.Packs()) {
+      pack_options.reuse.push_back(packfile.get());
+    }
+    // 位图要求 pack 包含全部可达对象，部分克隆缺少 blob
+    bool write_bitmap = options.write_bitmap && options.all &&
+                        !has_alternate_objects && !partial_clone;
+    // 位图需要对象的类型和路径名哈希，WritePack 会取走 objects
+    std::vector<pack::PackInput> bitmap_objects;
+    if (write_bitmap) {
+      bitmap_objects = objects;
+    }
+    auto written = pack::WritePack(
+        store.PackDir(), std::move(objects),
+        [&store](const std::string &hash) {
+          auto object = store.Read(hash);
+          if (!object) {
+            throw std::runtime_error("missing object " + hash);
+          }
+          return std::move(*object);
+        },
+        pack_options);
+    result.pack_checksum = written.checksum;
+    result.objects = written.objects;
+    result.deltas = written.deltas;
+    result.reused = written.reused;
+    if (write_bitmap) {
+      pack::PackFile packfile(written.idx_path);
+      // reflog 中的提交也在 pack 中，但只为分支和 HEAD 选取位图
+      result.bitmaps = bitmap::WriteBitmapIndex(
+          store, packfile, bitmap_objects, ReachabilityTips(store, false));
+    }
+  }
+
+  if (options.remove_redundant) {
+    store.ReloadPacks();
+    // 没有写出新 pack 时旧 pack 都要保留（空的校验和会让它们全部算作旧的）
+    if (options.all && !result.pack_checksum.empty()) {
+      if (options.unpack_unreachable) {
+        result.unpacked = UnpackUnreachable(store, result.pack_checksum,
+                                            reachable, options.unpack_cutoff);
+      }
+      result.removed_packs = RemoveOldPacks(store, result.pack_checksum);
+      store.ReloadPacks();
+    }
+    result.removed_loose = PrunePacked(store);
+  }
+  return result;
+}
+
+RepackResult Gc(const RepackOptions &options, time_t prune_cutoff,
+                size_t &pruned) {
+  TRACE_SPAN("gc");
+  RepackOptions repack = options;
+  repack.all = true;
+  repack.remove_redundant = true;
+  repack.unpack_unreachable = true;
+  repack.unpack_cutoff = prune_cutoff;
+  RepackResult result = Repack(repack);
+
+  // 此时所有可达对象都在新 pack 中，剩下的松散对象（包括刚从旧 pack 中
+  // 写出的）都是不可达的
+  ObjectStore store;
+  pruned = 0;
+  for (const auto &hash : store.ListLoose()) {
+    fs::path path = store.LoosePath(hash);
+    if (OlderThan(path, prune_cutoff)) {
+      fs::remove(path);
+      std::error_code ec;
+      fs::remove(path.parent_path(), ec);
+      pruned++;
+    }
+  }
+  // 清理中断的 repack 留下的临时文件
+  std::error_code ec;
+  for (const auto &entry : fs::directory_iterator(store.PackDir(), ec)) {
+    if (entry.path().filename().string().starts_with("tmp_") &&
+        OlderThan(entry.path(), prune_cutoff)) {
+      fs::remove(entry.path());
+    }
+  }
+  // 与 git gc 一样顺便重写 commit-graph，让之后的历史遍历不必解析提交
+  auto tips = ReachabilityTips(store);
+  if (!tips.empty()) {
+    commit_graph::Write(store, tips);
+  }
+  return result;
+}
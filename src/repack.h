@@ -0,0 +1,102 @@
+#pragma once
+
+#include "object_store.h"
+#include "pack.h"
+#include <ctime>
+#include <string>
+#include <vector>
+
+/**
+ * @brief repack / gc：把松散对象收进 pack 并清理
+ *
+ * repack 从所有分支、HEAD 和 reflog 中记录的提交以及 index 中的条目出发，
+ * 遍历可达的 commit/tree/blob，交给 pack::WritePack 生成带 delta 压缩的
+ * pack：
+ *
+ *   repack          只打包还没有进入任何 pack 的可达对象（增量）
+ *   repack -a       把全部可达对象打包进一个新 pack
+ *   repack -A       同 -a，但配合 -d 删除旧 pack 之前，其中不可达的对象
+ *                   写成松散对象（修改时间取 pack 的），不会立即丢失
+ *   repack -d       完成后删除已在 pack 中的松散对象；配合 -a 时也删除旧 pack
+ *   repack -a -b    同时为新 pack 写出可达性位图（见 bitmap.h）
+ *
+ * 与 git repack -l 一样只打包本仓库自己的对象：经 objects/info/alternates
+ * 找到的对象（如共享缓存，见 shared_cache.h）照常遍历，但不复制进新 pack，
+ * 此时也不写位图。部分克隆（见 IsPartialClone）中本地没有的 blob 由远程
+ * 保证可以取回，遍历时跳过。
+ *
+ * gc 等价于 repack -A -d，再删除早于 --prune 时间的不可达松散对象，
+ * 最后重写 commit-graph（见 commit_graph.h）。旧 pack 中不可达的对象因此
+ * 与松散对象一样，过了 --prune 的时间才删除（--prune=now 时直接丢弃）。
+ */
+struct RepackOptions {
+  bool all = false;              // -a
+  bool remove_redundant = false; // -d
+  bool write_bitmap = false;     // -b，只在 -a 时生效（位图要求 pack 包含全部可达对象）
+  // -A：旧 pack 中不可达的对象写成松散对象再删除旧 pack；修改时间早于
+  // unpack_cutoff 的 pack 中的对象不写出
+  bool unpack_unreachable = false;
+  time_t unpack_cutoff = 0;
+  pack::PackWriteOptions pack;
+};
+
+struct RepackResult {
+  std::string pack_checksum; // 没有需要打包的对象时为空
+  size_t objects = 0;
+  size_t deltas = 0;
+  size_t reused = 0; // 从旧 pack 原样复制的对象数
+  size_t bitmaps = 0; // 写出位图的提交数
+  size_t removed_loose = 0;
+  size_t removed_packs = 0;
+  size_t unpacked = 0; // -A 写成松散对象的不可达对象数
+};
+
+/**
+ * @brief 收集遍历的起点：全部分支、HEAD 以及 reflog 中出现过的提交
+ * @param include_reflog 为 false 时只返回分支和 HEAD
+ * @note 依赖当前目录下的 .git（与 MiniGitRef 相同）；reflog 中已不存在的
+ *       对象会被跳过
+ */
+std::vector<std::string> ReachabilityTips(const ObjectStore &store,
+                                          bool include_reflog = true);
+
+/**
+ * @brief index 中的对象：暂存的 blob 和稀疏目录的 tree（子模块条目除外）
+ *
+ * 这些对象可能还没有被任何提交引用，repack/gc 同样要保留。
+ */
+std::vector<std::string> IndexObjects(const ObjectStore &store);
+
+/**
+ * @brief 是否是部分克隆：extensions.partialclone 指定的远程（默认 origin）
+ *        设置了 promisor 或 partialclonefilter
+ *
+ * 克隆时被过滤掉的 blob 可以随时从这个远程取回，不算缺失。
+ */
+bool IsPartialClone(const ObjectStore &store);
+
+/**
+ * @brief 从 tips 出发遍历所有可达对象
+ * @param tips 提交，也可以是 tree 或 blob（如 IndexObjects 的结果）
+ * @param skip_missing_blobs 为 true 时跳过本地没有的 blob（部分克隆）
+ * @return 每个对象的哈希、类型、长度和路径名哈希（blob/tree 取其所在路径名）
+ * @throws std::runtime_error 可达对象缺失或损坏
+ */
+std::vector<pack::PackInput>
+EnumerateReachable(const ObjectStore &store,
+                   const std::vector<std::string> &tips,
+                   bool skip_missing_blobs = false);
+
+/**
+ * @brief 对当前目录下的仓库执行 repack
+ */
+RepackResult Repack(const RepackOptions &options);
+
+/**
+ * @brief repack -A -d，然后删除修改时间早于 prune_cutoff 的不可达松散对象
+ * @param prune_cutoff 也用作 unpack_cutoff：更早写出的旧 pack 中不可达的
+ *        对象直接丢弃
+ * @param pruned 输出删除的不可达对象个数
+ */
+RepackResult Gc(const RepackOptions &options, time_t prune_cutoff,
+                size_t &pruned);
@@ -0,0 +1,154 @@
+#include "revision.h"
+#include "trace.h"
+#include <stdexcept>
+
+namespace revision {
+
+RevWalk::RevWalk(commit_graph::CommitIndex &index, RevWalkOptions options)
+    : index_(index), options_(options) {}
+
+void RevWalk::Push(uint32_t id) { tips_.push_back(id); }
+
+void RevWalk::Hide(uint32_t id) { hidden_.push_back(id); }
+
+void RevWalk::ReadParents(uint32_t id) {
+  index_.Parents(id, parents_);
+  if (options_.first_parent && parents_.size() > 1) {
+    parents_.resize(1);
+  }
+}
+
+void RevWalk::Enqueue(uint32_t id) {
+  uint8_t &flags = flags_.At(id);
+  if (flags & kQueued) {
+    return;
+  }
+  // 限定之后只输出确认需要的提交
+  if (!hidden_.empty() && ((flags & kHidden) || !(flags & kInteresting))) {
+    return;
+  }
+  flags |= kQueued;
+  queue_.push({index_.Time(id), sequence_++, id});
+}
+
+bool RevWalk::Next(uint32_t &id) {
+  if (!started_) {
+    started_ = true;
+    if (!hidden_.empty()) {
+      Limit();
+    }
+    for (uint32_t tip : tips_) {
+      Enqueue(tip);
+    }
+  }
+  if (output_ >= options_.max_count || queue_.empty()) {
+    return false;
+  }
+  Item item = queue_.top();
+  queue_.pop();
+  ReadParents(item.id);
+  for (uint32_t parent : parents_) {
+    Enqueue(parent);
+  }
+  output_++;
+  id = item.id;
+  return true;
+}
+
+void RevWalk::Limit() {
+  TRACE_SPAN("rev-walk-limit");
+  // 按代数从大到小：取出一个提交时，所有可能到达它的提交都已经处理过，
+  // 它是否被排除已经确定
+  struct Item {
+    uint32_t generation;
+    int64_t time;
+    uint32_t id;
+    bool operator<(const Item &other) const {
+      if (generation != other.generation) {
+        return generation < other.generation;
+      }
+      return time < other.time;
+    }
+  };
+  std::priority_queue<Item> queue;
+  size_t interesting = 0; // 队列中没有被排除的提交数
+  auto push = [&](uint32_t id) {
+    uint8_t &flags = flags_.At(id);
+    if (flags & kLimitSeen) {
+      return;
+    }
+    flags |= kLimitSeen | kLimitQueued;
+    queue.push({index_.Generation(id), index_.Time(id), id});
+    if (!(flags & kHidden)) {
+      interesting++;
+    }
+  };
+  auto hide = [&](uint32_t id) {
+    uint8_t &flags = flags_.At(id);
+    if (flags & kHidden) {
+      return;
+    }
+    flags |= kHidden;
+    if (flags & kLimitQueued) {
+      interesting--;
+    } else if (flags & kLimitSeen) {
+      // 已经当作需要输出的提交处理过（不在 commit-graph 中、时间又相同的
+      // 提交之间顺序不确定），重新放进队列把排除标记传给它的祖先
+      flags &= ~(kLimitSeen | kInteresting);
+    }
+  };
+
+  for (uint32_t id : hidden_) {
+    hide(id);
+    push(id);
+  }
+  for (uint32_t id : tips_) {
+    push(id);
+  }
+  // 不在 commit-graph 中的提交代数都是无穷大，它们之间只能按时间排序，
+  // 所以要把这部分处理完才能确定结果
+  while (!queue.empty() &&
+         (interesting ||
+          queue.top().generation == commit_graph::kGenerationInfinity)) {
+    uint32_t id = queue.top().id;
+    queue.pop();
+    uint8_t &flags = flags_.At(id);
+    flags &= ~kLimitQueued;
+    if (flags & kHidden) {
+      // 排除标记沿所有父提交传播，与 --first-parent 无关
+      index_.Parents(id, parents_);
+      for (uint32_t parent : parents_) {
+        hide(parent);
+        push(parent);
+      }
+    } else {
+      interesting--;
+      flags |= kInteresting;
+      ReadParents(id);
+      for (uint32_t parent : parents_) {
+        push(parent);
+      }
+    }
+  }
+}
+
+CommitCache::CommitCache(const ObjectStore &store,
+                         commit_graph::CommitIndex &index)
+    : store_(store), index_(index) {}
+
+const commit_graph::CommitHeader &CommitCache::Get(uint32_t id) {
+  Entry &entry = entries_.At(id);
+  if (!entry.parsed) {
+    std::string hash = index_.Hash(id);
+    auto object = store_.Read(hash);
+    if (!object || object->type != ObjectType::kCommit) {
+      throw std::runtime_error("missing commit " + hash);
+    }
+    entry.data = std::move(object->data);
+    commit_graph::ParseCommitHeader(hash, entry.data, entry.header);
+    entry.parsed = true;
+  }
+  return entry.header;
+}
+
+} // namespace revision
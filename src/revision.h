@@ -0,0 +1,116 @@
+#pragma once
+
+#include "commit_graph.h"
+#include "object_store.h"
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <queue>
+#include <string>
+#include <vector>
+
+/**
+ * @brief 历史遍历（rev-list / log）
+ *
+ * RevWalk 用按提交时间排序的优先队列遍历：每次取出最新的提交输出，再把它的
+ * 父提交放进队列。提交在被取出时才读取父提交，所以 --max-count 只处理输出
+ * 附近的一小段历史，不必先走完整个历史。父提交、时间和代数来自
+ * CommitIndex（有 commit-graph 时不解压提交对象），log 需要的作者和提交
+ * 说明由 CommitCache 在输出时才解析。
+ *
+ * 有排除的起点时（A..B 中的 A），先按代数从大到小同时从两边向下走，把 A
+ * 可达的提交标记为排除，直到队列里只剩被排除的提交；然后再按时间顺序从 B
+ * 输出没有被排除的提交。
+ */
+namespace revision {
+
+struct RevWalkOptions {
+  size_t max_count = std::numeric_limits<size_t>::max(); // --max-count
+  bool first_parent = false; // --first-parent：只沿第一个父提交向下
+};
+
+class RevWalk {
+public:
+  explicit RevWalk(commit_graph::CommitIndex &index,
+                   RevWalkOptions options = {});
+
+  // 输出从 id 可达的提交；必须在第一次 Next 之前调用
+  void Push(uint32_t id);
+  // 排除从 id 可达的提交（A..B 中的 A、^A）；必须在第一次 Next 之前调用
+  void Hide(uint32_t id);
+
+  /**
+   * @brief 取出下一个要输出的提交
+   * @return 遍历结束或已经输出了 max_count 个提交时返回 false
+   * @throws std::runtime_error 提交缺失或损坏
+   */
+  bool Next(uint32_t &id);
+
+private:
+  enum : uint8_t {
+    kQueued = 1,      // 已经放进输出队列
+    kHidden = 2,      // 从排除的起点可达
+    kLimitSeen = 4,   // 限定阶段已经放进过队列
+    kLimitQueued = 8, // 限定阶段还在队列中
+    kInteresting = 16 // 限定阶段确认需要输出
+  };
+
+  // 按时间从新到旧，时间相同时先放进队列的在前
+  struct Item {
+    int64_t time;
+    uint64_t sequence;
+    uint32_t id;
+    bool operator<(const Item &other) const {
+      if (time != other.time) {
+        return time < other.time;
+      }
+      return sequence > other.sequence;
+    }
+  };
+
+  void Limit();
+  void Enqueue(uint32_t id);
+  // 只沿第一个父提交时截掉其余父提交
+  void ReadParents(uint32_t id);
+
+  commit_graph::CommitIndex &index_;
+  RevWalkOptions options_;
+  commit_graph::CommitSlab<uint8_t> flags_;
+  std::vector<uint32_t> tips_;
+  std::vector<uint32_t> hidden_;
+  std::priority_queue<Item> queue_;
+  uint64_t sequence_ = 0;
+  size_t output_ = 0;
+  bool started_ = false;
+  std::vector<uint32_t> parents_;
+};
+
+/**
+ * @brief 按编号缓存解析后的提交（log 输出作者、日期和提交说明用）
+ *
+ * 每个提交只解压一次，对象内容保存在 CommitSlab 中，CommitHeader 的视图
+ * 直接指向这份内容，提交说明不复制。slab 中的元素不会移动，返回的引用在
+ * 缓存存在期间一直有效。
+ */
+class CommitCache {
+public:
+  CommitCache(const ObjectStore &store, commit_graph::CommitIndex &index);
+
+  /**
+   * @throws std::runtime_error 提交对象缺失或损坏
+   */
+  const commit_graph::CommitHeader &Get(uint32_t id);
+
+private:
+  struct Entry {
+    bool parsed = false;
+    std::string data;
+    commit_graph::CommitHeader header;
+  };
+
+  const ObjectStore &store_;
+  commit_graph::CommitIndex &index_;
+  commit_graph::CommitSlab<Entry> entries_;
+};
+
+} // namespace revision
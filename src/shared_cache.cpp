@@ -0,0 +1,230 @@
+#include "shared_cache.h"
+#include "durability.h"
+#include "trace.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <fcntl.h>
+#include <fstream>
+#include <linux/fs.h>
+#include <stdexcept>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_set>
+
+namespace fs = std::filesystem;
+
+namespace shared_cache {
+namespace {
+
+bool IsHex(const std::string &text) {
+  return text.find_first_not_of("0123456789abcdef") == std::string::npos;
+}
+
+// 复制 src 的内容到新文件 dest：可以时用 reflink，否则逐块复制
+void CloneFile(const fs::path &src, const fs::path &dest, bool executable,
+               bool reflink) {
+  int in = open(src.c_str(), O_RDONLY | O_CLOEXEC);
+  if (in < 0) {
+    throw std::runtime_error("shared cache: cannot open " + src.string());
+  }
+  int out = open(dest.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC,
+                 executable ? 0777 : 0666);
+  if (out < 0) {
+    close(in);
+    throw std::runtime_error("cannot create " + dest.string() + ": " +
+                             strerror(errno));
+  }
+  bool ok = reflink && ioctl(out, FICLONE, in) == 0;
+  if (ok) {
+    TRACE_COUNT("shared_cache_reflinks", 1);
+  } else {
+    ok = true;
+    char buffer[65536];
+    while (ok) {
+      ssize_t n = read(in, buffer, sizeof(buffer));
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+      if (n <= 0) {
+        ok = n == 0;
+        break;
+      }
+      ok = durability::WriteAll(out, buffer, n);
+    }
+    TRACE_COUNT("shared_cache_copies", 1);
+  }
+  close(in);
+  close(out);
+  if (!ok) {
+    throw std::runtime_error("write failed: " + dest.string());
+  }
+}
+
+LinkMode EnvironmentLinkMode() {
+  const char *link = getenv("MINIGIT_SHARED_CACHE_LINK");
+  return link && *link ? ParseLinkMode(link) : LinkMode::kReflink;
+}
+
+} // namespace
+
+LinkMode ParseLinkMode(const std::string &name) {
+  if (name == "copy") {
+    return LinkMode::kCopy;
+  }
+  if (name == "reflink") {
+    return LinkMode::kReflink;
+  }
+  if (name == "hardlink") {
+    return LinkMode::kHardlink;
+  }
+  throw std::invalid_argument("unknown link mode '" + name +
+                              "' (expected copy, reflink or hardlink)");
+}
+
+SharedCache::SharedCache(fs::path root, LinkMode link_mode)
+    : root_(fs::absolute(root).lexically_normal()), link_mode_(link_mode) {
+  fs::create_directories(root_ / "objects/info");
+  fs::create_directories(root_ / "objects/pack");
+  fs::create_directories(root_ / "blobs");
+}
+
+std::unique_ptr<SharedCache> SharedCache::Open(const std::string &root) {
+  const char *env = getenv("MINIGIT_SHARED_CACHE");
+  std::string dir = root.empty() && env ? env : root;
+  if (dir.empty()) {
+    return nullptr;
+  }
+  return std::make_unique<SharedCache>(dir, EnvironmentLinkMode());
+}
+
+std::unique_ptr<SharedCache> SharedCache::ForStore(const ObjectStore &store) {
+  for (const auto &alternate : store.Alternates()) {
+    fs::path objects = alternate->ObjectsDir().lexically_normal();
+    if (!objects.has_filename()) {
+      objects = objects.parent_path();
+    }
+    std::error_code ec;
+    if (objects.filename() == "objects" &&
+        fs::is_directory(objects.parent_path() / "blobs", ec)) {
+      return std::make_unique<SharedCache>(objects.parent_path(),
+                                           EnvironmentLinkMode());
+    }
+  }
+  return nullptr;
+}
+
+void SharedCache::AttachTo(const fs::path &git_dir) const {
+  fs::path info = git_dir / "objects/info";
+  fs::create_directories(info);
+  std::string line = ObjectsDir().string();
+  std::ifstream existing(info / "alternates");
+  for (std::string current; std::getline(existing, current);) {
+    if (current == line) {
+      return;
+    }
+  }
+  std::ofstream(info / "alternates", std::ios::app) << line << '\n';
+}
+
+std::vector<std::string> SharedCache::Tips() const {
+  std::vector<std::string> lines;
+  std::ifstream file(root_ / "tips");
+  for (std::string line; std::getline(file, line);) {
+    if (line.size() == 40 && IsHex(line)) {
+      lines.push_back(line);
+    }
+  }
+  // 重复的只保留最后一次
+  std::vector<std::string> tips;
+  std::unordered_set<std::string> seen;
+  for (auto it = lines.rbegin(); it != lines.rend(); ++it) {
+    if (seen.insert(*it).second) {
+      tips.push_back(*it);
+    }
+  }
+  std::reverse(tips.begin(), tips.end());
+  return tips;
+}
+
+void SharedCache::AddTip(const std::string &commit) const {
+  // O_APPEND 的单次短写入是原子的，并发克隆不会交错
+  int fd = open((root_ / "tips").c_str(),
+                O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0666);
+  if (fd < 0) {
+    throw std::runtime_error("shared cache: cannot open " +
+                             (root_ / "tips").string());
+  }
+  std::string line = commit + '\n';
+  bool ok = durability::WriteAll(fd, line.data(), line.size());
+  close(fd);
+  if (!ok) {
+    throw std::runtime_error("shared cache: cannot record tip " + commit);
+  }
+}
+
+size_t SharedCache::Absorb(const fs::path &objects_dir) const {
+  size_t moved = 0;
+  std::error_code ec;
+  for (const auto &dir : fs::directory_iterator(objects_dir, ec)) {
+    std::string prefix = dir.path().filename().string();
+    if (prefix.size() != 2 || !IsHex(prefix) || !dir.is_directory()) {
+      continue;
+    }
+    fs::path target_dir = ObjectsDir() / prefix;
+    fs::create_directories(target_dir);
+    for (const auto &file : fs::directory_iterator(dir.path(), ec)) {
+      std::string rest = file.path().filename().string();
+      if (rest.size() != 38 || !IsHex(rest)) {
+        continue;
+      }
+      fs::path target = target_dir / rest;
+      if (fs::exists(target)) {
+        fs::remove(file.path());
+        continue;
+      }
+      if (rename(file.path().c_str(), target.c_str()) != 0) {
+        if (errno != EXDEV) {
+          throw std::runtime_error("shared cache: cannot move " +
+                                   file.path().string());
+        }
+        // 缓存在另一个文件系统上：复制后再删除
+        std::ifstream in(file.path(), std::ios::binary);
+        std::string data((std::istreambuf_iterator<char>(in)),
+                         std::istreambuf_iterator<char>());
+        durability::WriteFileAtomically(target, data, 0444);
+        fs::remove(file.path());
+      }
+      moved++;
+    }
+    fs::remove(dir.path(), ec); // 目录空了才会成功
+  }
+  TRACE_COUNT("shared_cache_absorbed", moved);
+  return moved;
+}
+
+void SharedCache::Materialize(const ObjectStore &store, const std::string &hash,
+                              bool executable, const fs::path &dest) const {
+  fs::path blob = BlobPath(hash);
+  std::error_code ec;
+  if (!fs::exists(blob, ec)) {
+    auto object = store.Read(hash);
+    if (!object) {
+      throw std::runtime_error("missing blob object " + hash);
+    }
+    durability::WriteFileAtomically(blob, object->data, 0444);
+    TRACE_COUNT("shared_cache_blob_misses", 1);
+  } else {
+    TRACE_COUNT("shared_cache_blob_hits", 1);
+  }
+  if (link_mode_ == LinkMode::kHardlink && !executable &&
+      link(blob.c_str(), dest.c_str()) == 0) {
+    TRACE_COUNT("shared_cache_hardlinks", 1);
+    return;
+  }
+  CloneFile(blob, dest, executable, link_mode_ != LinkMode::kCopy);
+}
+
+} // namespace shared_cache
@@ -0,0 +1,103 @@
+#pragma once
+
+#include "object_store.h"
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+/**
+ * @brief 同一台机器上多个克隆共享的对象缓存
+ *
+ * CI 机器一天内多次克隆同一个仓库，每次都重新下载、解压全部对象。共享
+ * 缓存是一个目录：
+ *
+ *   <cache>/objects/           对象库，克隆通过 .git/objects/info/alternates
+ *                              引用它（与 git clone --reference 相同）
+ *   <cache>/blobs/xx/yyyy...   blob 解压后的内容，按哈希存放，只读
+ *   <cache>/tips               完整的提交：其全部可达对象都已在缓存中，
+ *                              每行一个
+ *
+ * 克隆时先读 tips：远程的 HEAD 已经是完整提交时不需要下载；否则把 tips
+ * 作为 have 发给服务器，只下载缺少的对象。下载的对象移入缓存，克隆自己
+ * 的对象目录保持为空。
+ *
+ * checkout 写文件时从 blobs/ 复制：默认用 reflink（FICLONE，写时复制，
+ * 不支持时退回普通复制）；hardlink 模式直接硬链接到缓存文件，最快但工作区
+ * 文件与缓存共享 inode，只适合不修改工作区的场景（可执行文件仍然复制，
+ * 以免改变缓存文件的权限）。
+ *
+ * 多个进程可以同时使用同一个缓存：对象和 blob 都先写临时文件再改名，
+ * tips 以追加方式写入，且只在对象全部移入之后写入。
+ */
+namespace shared_cache {
+
+enum class LinkMode { kCopy, kReflink, kHardlink };
+
+/**
+ * @brief 解析 "copy"/"reflink"/"hardlink"
+ * @throws std::invalid_argument 无法识别
+ */
+LinkMode ParseLinkMode(const std::string &name);
+
+class SharedCache {
+public:
+  // 目录不存在时创建
+  explicit SharedCache(std::filesystem::path root,
+                       LinkMode link_mode = LinkMode::kReflink);
+
+  /**
+   * @brief 打开 root 处的缓存，root 为空时取环境变量 MINIGIT_SHARED_CACHE；
+   *        链接方式取自 MINIGIT_SHARED_CACHE_LINK（默认 reflink）
+   * @return 两者都为空时返回 nullptr
+   * @throws std::invalid_argument 链接方式无法识别
+   */
+  static std::unique_ptr<SharedCache> Open(const std::string &root = "");
+
+  /**
+   * @brief 仓库的 alternates 中属于共享缓存（有 blobs/ 目录）的第一个
+   * @return 没有时返回 nullptr
+   */
+  static std::unique_ptr<SharedCache> ForStore(const ObjectStore &store);
+
+  const std::filesystem::path &Root() const { return root_; }
+  std::filesystem::path ObjectsDir() const { return root_ / "objects"; }
+  LinkMode Mode() const { return link_mode_; }
+
+  // 让 git_dir 的对象库引用缓存（写入 objects/info/alternates）
+  void AttachTo(const std::filesystem::path &git_dir) const;
+
+  // 完整的提交，较新写入的在后
+  std::vector<std::string> Tips() const;
+
+  // 记录一个完整提交；调用前其全部可达对象必须已在缓存中
+  void AddTip(const std::string &commit) const;
+
+  /**
+   * @brief 把 objects_dir 中的松散对象移入缓存，缓存已有的直接删除
+   * @return 移入的对象数
+   */
+  size_t Absorb(const std::filesystem::path &objects_dir) const;
+
+  /**
+   * @brief 在 dest 创建内容为 blob hash 的文件
+   *
+   * 缓存中还没有这个 blob 时先从 store 读出写入 blobs/。
+   * @param executable 为 true 时不硬链接，文件带可执行权限
+   * @throws std::runtime_error blob 缺失或写入失败
+   */
+  void Materialize(const ObjectStore &store, const std::string &hash,
+                   bool executable, const std::filesystem::path &dest) const;
+
+  std::filesystem::path BlobPath(const std::string &hash) const {
+    return root_ / "blobs" / hash.substr(0, 2) / hash.substr(2);
+  }
+
+private:
+  std::filesystem::path root_;
+  LinkMode link_mode_;
+};
+
+} // namespace shared_cache
@@ -0,0 +1,201 @@
+#include "sparse.h"
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+namespace sparse {
+namespace {
+
+// 规则文件的格式（与 git 相同）。开头两行表示根目录下的文件检出、子目录
+// 不检出；每个父目录写成一对 "/<目录>/" 与 "!/<目录>/*/"，完整检出的目录
+// 只写 "/<目录>/"。目录名中的通配符用 '\' 转义
+constexpr char kRootFiles[] = "/*";
+constexpr char kNoRootDirs[] = "!/*/";
+
+std::string Escape(std::string_view dir) {
+  std::string out;
+  for (char c : dir) {
+    if (c == '*' || c == '?' || c == '[' || c == '\\') {
+      out.push_back('\\');
+    }
+    out.push_back(c);
+  }
+  return out;
+}
+
+std::string Unescape(std::string_view pattern) {
+  std::string out;
+  for (size_t i = 0; i < pattern.size(); i++) {
+    if (pattern[i] == '\\' && i + 1 < pattern.size()) {
+      i++;
+    }
+    out.push_back(pattern[i]);
+  }
+  return out;
+}
+
+// 去掉首尾的 '/'，检查路径段
+std::string Normalize(std::string_view dir) {
+  while (!dir.empty() && dir.front() == '/') {
+    dir.remove_prefix(1);
+  }
+  while (!dir.empty() && dir.back() == '/') {
+    dir.remove_suffix(1);
+  }
+  for (size_t pos = 0; pos <= dir.size();) {
+    size_t end = std::min(dir.find('/', pos), dir.size());
+    std::string_view part = dir.substr(pos, end - pos);
+    if (part.empty() || part == "." || part == "..") {
+      throw std::runtime_error("sparse-checkout: invalid directory '" +
+                               std::string(dir) + "'");
+    }
+    pos = end + 1;
+  }
+  return std::string(dir);
+}
+
+} // namespace
+
+Cone::Cone(std::vector<std::string> dirs) {
+  for (auto &dir : dirs) {
+    dir = Normalize(dir);
+  }
+  std::sort(dirs.begin(), dirs.end());
+  dirs.erase(std::unique(dirs.begin(), dirs.end()), dirs.end());
+  for (auto &dir : dirs) {
+    recursive_.insert(dir);
+  }
+  // 已经在另一个 cone 目录之下的目录不必单独列出
+  for (auto &dir : dirs) {
+    bool nested = false;
+    for (size_t slash = dir.find('/'); !nested && slash != std::string::npos;
+         slash = dir.find('/', slash + 1)) {
+      nested = recursive_.count(std::string_view(dir).substr(0, slash)) > 0;
+    }
+    if (!nested) {
+      dirs_.push_back(std::move(dir));
+    }
+  }
+  recursive_.clear();
+  for (const auto &dir : dirs_) {
+    recursive_.insert(dir);
+    for (size_t slash = dir.find('/'); slash != std::string::npos;
+         slash = dir.find('/', slash + 1)) {
+      parents_.insert(dir.substr(0, slash));
+    }
+  }
+}
+
+std::optional<Cone> Cone::Read(const fs::path &git_dir) {
+  std::ifstream file(git_dir / "info/sparse-checkout", std::ios::binary);
+  if (!file) {
+    return std::nullopt;
+  }
+  std::stringstream content;
+  content << file.rdbuf();
+  return Parse(content.str());
+}
+
+std::optional<Cone> Cone::Parse(std::string_view content) {
+  bool root_files = false;
+  bool no_root_dirs = false;
+  std::vector<std::string> listed;
+  Set parents;
+  while (!content.empty()) {
+    size_t newline = content.find('\n');
+    std::string_view line = content.substr(0, newline);
+    content.remove_prefix(newline == std::string_view::npos ? content.size()
+                                                             : newline + 1);
+    if (!line.empty() && line.back() == '\r') {
+      line.remove_suffix(1);
+    }
+    if (line.empty() || line[0] == '#') {
+      continue;
+    }
+    if (line == kRootFiles) {
+      root_files = true;
+    } else if (line == kNoRootDirs) {
+      no_root_dirs = true;
+    } else if (line.size() > 5 && line.starts_with("!/") &&
+               line.ends_with("/*/")) {
+      parents.insert(Unescape(line.substr(2, line.size() - 5)));
+    } else if (line.size() > 2 && line[0] == '/' && line.back() == '/' &&
+               line[1] != '!') {
+      listed.push_back(Unescape(line.substr(1, line.size() - 2)));
+    } else {
+      throw std::runtime_error("sparse-checkout: not a cone-mode pattern '" +
+                               std::string(line) + "'");
+    }
+  }
+  if (!root_files) {
+    throw std::runtime_error("sparse-checkout: cone-mode patterns must start "
+                             "with '/*'");
+  }
+  if (!no_root_dirs) {
+    return std::nullopt; // 只有 "/*"：全部检出
+  }
+  std::vector<std::string> dirs;
+  for (auto &dir : listed) {
+    if (!parents.count(dir)) {
+      dirs.push_back(std::move(dir));
+    }
+  }
+  return Cone(std::move(dirs));
+}
+
+std::string Cone::Serialize() const {
+  std::string out = std::string(kRootFiles) + "\n" + kNoRootDirs + "\n";
+  std::vector<std::string> parents(parents_.begin(), parents_.end());
+  std::sort(parents.begin(), parents.end());
+  for (const auto &dir : parents) {
+    std::string escaped = Escape(dir);
+    out += "/" + escaped + "/\n!/" + escaped + "/*/\n";
+  }
+  for (const auto &dir : dirs_) {
+    out += "/" + Escape(dir) + "/\n";
+  }
+  return out;
+}
+
+void Cone::Write(const fs::path &git_dir) const {
+  fs::create_directories(git_dir / "info");
+  fs::path path = git_dir / "info/sparse-checkout";
+  fs::path temp = path.string() + ".tmp-" + std::to_string(getpid());
+  {
+    std::ofstream out(temp, std::ios::binary | std::ios::trunc);
+    out << Serialize();
+    if (!out.flush()) {
+      fs::remove(temp);
+      throw std::runtime_error("sparse-checkout: cannot write " +
+                               path.string());
+    }
+  }
+  fs::rename(temp, path);
+}
+
+Scope Cone::Classify(std::string_view dir) const {
+  if (dir.empty()) {
+    return Scope::kParent;
+  }
+  for (size_t slash = dir.find('/');; slash = dir.find('/', slash + 1)) {
+    if (recursive_.count(dir.substr(0, slash))) {
+      return Scope::kInside;
+    }
+    if (slash == std::string_view::npos) {
+      break;
+    }
+  }
+  return parents_.count(dir) ? Scope::kParent : Scope::kOutside;
+}
+
+bool Cone::Contains(std::string_view path) const {
+  size_t slash = path.rfind('/');
+  return slash == std::string_view::npos ||
+         Classify(path.substr(0, slash)) != Scope::kOutside;
+}
+
+} // namespace sparse
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <filesystem>
+#include <functional>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_set>
+#include <vector>
+
+/**
+ * @brief 稀疏检出（cone 模式）
+ *
+ * 只检出工作区的一部分：根目录下的文件总是检出；给出的每个目录（"cone"）
+ * 连同其下的一切都检出；这些目录的各级父目录中只检出直接位于其中的文件。
+ * 其余目录整个不检出，遍历 tree 时在这里停下，连 tree 对象都不读，所以
+ * 检出的开销只与 cone 的大小有关。
+ *
+ * 规则保存在 .git/info/sparse-checkout，格式与 git sparse-checkout 的
+ * cone 模式相同（见 sparse.cpp）。文件不存在时完整检出。
+ *
+ * 不检出的目录在 index 中是一个条目（见 dircache.h 的稀疏目录），记录其
+ * tree 哈希，write-tree 把它原样写回父 tree。
+ */
+namespace sparse {
+
+enum class Scope {
+  kOutside, // 不检出
+  kParent,  // 只检出直接位于其中的文件，子目录分别判断
+  kInside,  // 整个子树都检出
+};
+
+class Cone {
+public:
+  /**
+   * @param dirs 完整检出的目录，相对于工作区根目录；为空时只检出根目录
+   *        下的文件。嵌套的目录只保留外层的
+   * @throws std::runtime_error 目录为空或含有 "." 或 ".." 路径段
+   */
+  explicit Cone(std::vector<std::string> dirs = {});
+
+  /**
+   * @brief 读取 git_dir/info/sparse-checkout
+   * @return 文件不存在或规则匹配全部路径（git sparse-checkout disable
+   *         之后的内容）时返回 std::nullopt
+   * @throws std::runtime_error 不是 cone 模式的规则
+   */
+  static std::optional<Cone> Read(const std::filesystem::path &git_dir);
+
+  // 同上，从文件内容解析
+  static std::optional<Cone> Parse(std::string_view content);
+
+  // cone 模式的规则文件内容
+  std::string Serialize() const;
+
+  // 写入 git_dir/info/sparse-checkout（先写临时文件再改名）
+  void Write(const std::filesystem::path &git_dir) const;
+
+  // 按路径排序的 cone 目录
+  const std::vector<std::string> &Dirs() const { return dirs_; }
+
+  // 目录 dir（相对于工作区根目录，根目录为空字符串）是否检出
+  Scope Classify(std::string_view dir) const;
+
+  // 文件 path 是否检出
+  bool Contains(std::string_view path) const;
+
+private:
+  struct Hash {
+    using is_transparent = void;
+    size_t operator()(std::string_view text) const {
+      return std::hash<std::string_view>()(text);
+    }
+  };
+  using Set = std::unordered_set<std::string, Hash, std::equal_to<>>;
+
+  std::vector<std::string> dirs_;
+  Set recursive_; // dirs_ 中的目录
+  Set parents_;   // 它们的各级父目录（不含根目录）
+};
+
+} // namespace sparse
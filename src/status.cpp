@@ -0,0 +1,798 @@
+#include "status.h"
+#include "../include/clone_gadget.h"
+#include "dircache.h"
+#include "durability.h"
+#include "fsmonitor.h"
+#include "ignore.h"
+#include "trace.h"
+#include "tree.h"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <dirent.h>
+#include <fcntl.h>
+#include <map>
+#include <optional>
+#include <stdexcept>
+#include <string.h>
+#include <string_view>
+#include <sys/stat.h>
+#include <thread>
+#include <time.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+namespace status {
+namespace {
+
+constexpr char kCacheHeader[] = "minigit-status-cache 2";
+// 每个线程任务至少这么多条目，任务在目录边界处切分
+constexpr size_t kEntriesPerTask = 512;
+constexpr uint32_t kModeSymlink = 0120000;
+constexpr uint32_t kModeExecutable = 0100755;
+
+// 一个目录上次列出的结果
+struct DirCache {
+  int64_t mtime_sec = -1; // -1：列出时 mtime 太新（racy），只能凭守护进程使用
+  int64_t mtime_nsec = 0;
+  uint32_t tracked = 0;   // 其中已跟踪的名字数（文件和含已跟踪文件的子目录）
+  std::string ignore;     // 其中 .gitignore 的 SHA-1，没有时为空
+  std::vector<std::string> names; // 未被排除的未跟踪名字，目录以 '/' 结尾
+};
+
+struct Cache {
+  std::string head_tree;
+  std::string index_checksum;
+  std::string token; // 文件系统监视守护进程的令牌
+  std::string exclude; // info/exclude 的 SHA-1
+  std::vector<Entry> staged;
+  std::vector<Entry> unstaged; // 守护进程可用时下次重新检查这些条目
+  // 有序：一个目录之下的所有目录是连续的一段
+  std::map<std::string, DirCache> dirs;
+};
+
+// 以 '\0' 分隔的字段
+class FieldReader {
+public:
+  explicit FieldReader(const std::string &data) : data_(data) {}
+
+  bool Next(std::string &field) {
+    size_t end = data_.find('\0', pos_);
+    if (end == std::string::npos) {
+      return false;
+    }
+    field.assign(data_, pos_, end - pos_);
+    pos_ = end + 1;
+    return true;
+  }
+
+  bool NextNumber(int64_t &value) {
+    std::string field;
+    if (!Next(field) || field.empty()) {
+      return false;
+    }
+    char *end;
+    value = strtoll(field.c_str(), &end, 10);
+    return *end == '\0';
+  }
+
+  bool NextEntries(std::vector<Entry> &entries) {
+    int64_t count;
+    if (!NextNumber(count) || count < 0) {
+      return false;
+    }
+    std::string field;
+    for (int64_t i = 0; i < count; i++) {
+      if (!Next(field) || field.size() < 2) {
+        return false;
+      }
+      entries.push_back({field[0], field[1], field.substr(2)});
+    }
+    return true;
+  }
+
+  bool AtEnd() const { return pos_ == data_.size(); }
+
+private:
+  const std::string &data_;
+  size_t pos_ = 0;
+};
+
+void PutField(std::string &out, const std::string &field) {
+  out += field;
+  out.push_back('\0');
+}
+
+void PutEntries(std::string &out, const std::vector<Entry> &entries) {
+  PutField(out, std::to_string(entries.size()));
+  for (const auto &entry : entries) {
+    out.push_back(entry.staged);
+    out.push_back(entry.unstaged);
+    PutField(out, entry.path);
+  }
+}
+
+bool ReadWhole(const fs::path &path, std::string &data) {
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return false;
+  }
+  char buffer[65536];
+  for (;;) {
+    ssize_t n = read(fd, buffer, sizeof(buffer));
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      close(fd);
+      return n == 0;
+    }
+    data.append(buffer, n);
+  }
+}
+
+// 读取缓存，不存在或格式不对时返回空缓存
+Cache ReadCache(const std::string &data) {
+  Cache cache;
+  FieldReader reader(data);
+  std::string field;
+  int64_t count;
+  if (!reader.Next(field) || field != kCacheHeader ||
+      !reader.Next(cache.head_tree) || !reader.Next(cache.index_checksum) ||
+      !reader.Next(cache.token) || !reader.Next(cache.exclude) ||
+      !reader.NextEntries(cache.staged) ||
+      !reader.NextEntries(cache.unstaged) || !reader.NextNumber(count)) {
+    return {};
+  }
+  for (int64_t i = 0; i < count; i++) {
+    std::string dir;
+    DirCache entry;
+    int64_t tracked, names;
+    if (!reader.Next(dir) || !reader.NextNumber(entry.mtime_sec) ||
+        !reader.NextNumber(entry.mtime_nsec) || !reader.NextNumber(tracked) ||
+        !reader.Next(entry.ignore) || !reader.NextNumber(names)) {
+      return {};
+    }
+    entry.tracked = tracked;
+    entry.names.resize(names);
+    for (auto &name : entry.names) {
+      if (!reader.Next(name)) {
+        return {};
+      }
+    }
+    cache.dirs.emplace_hint(cache.dirs.end(), std::move(dir), std::move(entry));
+  }
+  return reader.AtEnd() ? std::move(cache) : Cache();
+}
+
+std::string SerializeCache(const Cache &cache) {
+  std::string out;
+  PutField(out, kCacheHeader);
+  PutField(out, cache.head_tree);
+  PutField(out, cache.index_checksum);
+  PutField(out, cache.token);
+  PutField(out, cache.exclude);
+  PutEntries(out, cache.staged);
+  PutEntries(out, cache.unstaged);
+  // 按目录排序，内容相同时文件也相同，不必重写
+  PutField(out, std::to_string(cache.dirs.size()));
+  for (const auto &[dir, entry] : cache.dirs) {
+    PutField(out, dir);
+    PutField(out, std::to_string(entry.mtime_sec));
+    PutField(out, std::to_string(entry.mtime_nsec));
+    PutField(out, std::to_string(entry.tracked));
+    PutField(out, entry.ignore);
+    PutField(out, std::to_string(entry.names.size()));
+    for (const auto &name : entry.names) {
+      PutField(out, name);
+    }
+  }
+  return out;
+}
+
+// 先写临时文件再改名；失败时下次没有缓存可用，不影响结果
+void WriteCache(const fs::path &path, const std::string &data) {
+  fs::path temp = path.string() + ".tmp-" + std::to_string(getpid());
+  int fd = open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+  if (fd < 0) {
+    return;
+  }
+  bool ok = durability::WriteAll(fd, data.data(), data.size());
+  ok = close(fd) == 0 && ok;
+  if (!ok || rename(temp.c_str(), path.c_str()) != 0) {
+    unlink(temp.c_str());
+  }
+}
+
+std::string_view Parent(std::string_view path) {
+  size_t slash = path.rfind('/');
+  return slash == std::string_view::npos ? std::string_view()
+                                         : path.substr(0, slash);
+}
+
+// entries[k] 的路径以 prefix 开头时，返回这一段之后的第一个下标
+size_t BlockEnd(const std::vector<dircache::IndexEntry> &entries, size_t k,
+                size_t hi, std::string_view prefix) {
+  return std::partition_point(entries.begin() + k, entries.begin() + hi,
+                              [&](const dircache::IndexEntry &entry) {
+                                return entry.path.starts_with(prefix);
+                              }) -
+         entries.begin();
+}
+
+// 对 entries[lo, hi)（路径都以 dir_prefix 开头）中直接位于该目录的文件调用
+// on_file(下标, 名字)，对每个子目录调用 on_child(名字, 子目录的 lo, hi)。
+// 子目录的条目用二分查找整段跳过
+template <typename OnFile, typename OnChild>
+void ForEachChild(const std::vector<dircache::IndexEntry> &entries, size_t lo,
+                  size_t hi, size_t prefix_size, OnFile &&on_file,
+                  OnChild &&on_child) {
+  for (size_t k = lo; k < hi;) {
+    std::string_view rest = std::string_view(entries[k].path).substr(prefix_size);
+    size_t slash = rest.find('/');
+    if (slash == std::string_view::npos) {
+      on_file(k, rest);
+      k++;
+      continue;
+    }
+    size_t end = BlockEnd(entries, k + 1, hi,
+                          std::string_view(entries[k].path)
+                              .substr(0, prefix_size + slash + 1));
+    on_child(rest.substr(0, slash), k, end);
+    k = end;
+  }
+}
+
+// HEAD 与 index 的差异，按路径排序
+std::vector<Entry> DiffHead(const ObjectStore &store,
+                            const std::string &head_tree,
+                            const dircache::Index &index) {
+  TRACE_SPAN("status-staged");
+  struct HeadEntry {
+    std::string path;
+    uint32_t mode;
+    std::string hash;
+  };
+  std::vector<HeadEntry> head;
+  tree::DiffOptions options;
+  options.recursive = true;
+  // index 中的稀疏目录与 HEAD 中的子树整体比较，不展开
+  options.descend = [&index](const std::string &dir) {
+    return !index.Find(dir + '/');
+  };
+  tree::DiffTrees(store, "", head_tree, options, [&](const tree::Change &c) {
+    head.push_back({c.new_mode == tree::kModeTree ? c.path + '/' : c.path,
+                    c.new_mode, c.new_hash});
+  });
+  // write-tree 写出的 tree 不一定是 Git 的顺序，按路径重新排序
+  std::sort(head.begin(), head.end(),
+            [](const HeadEntry &a, const HeadEntry &b) { return a.path < b.path; });
+
+  std::vector<Entry> staged;
+  const auto &entries = index.Entries();
+  size_t h = 0;
+  for (size_t i = 0; i < entries.size();) {
+    const auto &entry = entries[i];
+    for (; h < head.size() && head[h].path < entry.path; h++) {
+      staged.push_back({'D', ' ', head[h].path});
+    }
+    bool in_head = h < head.size() && head[h].path == entry.path;
+    if (entry.stage != 0) {
+      // 冲突：同一路径的各个阶段只报告一次
+      staged.push_back({'U', 'U', entry.path});
+      for (; i < entries.size() && entries[i].path == entry.path; i++) {
+      }
+    } else {
+      if (!in_head) {
+        staged.push_back({'A', ' ', entry.path});
+      } else if (head[h].hash != entry.hash || head[h].mode != entry.mode) {
+        staged.push_back({'M', ' ', entry.path});
+      }
+      i++;
+    }
+    h += in_head;
+  }
+  for (; h < head.size(); h++) {
+    staged.push_back({'D', ' ', head[h].path});
+  }
+  return staged;
+}
+
+// index 条目对应的工作区文件的状态：' ' 未改动、'M' 修改、'D' 删除。内容
+// 未变但 stat 变了时 refresh 为 true，stat 是新的 stat 信息
+char CheckEntry(const dircache::Index &index, const dircache::IndexEntry &entry,
+                const std::string &path, bool &refresh,
+                dircache::StatData &stat) {
+  struct stat st;
+  if (lstat(path.c_str(), &st) != 0) {
+    return 'D';
+  }
+  if (entry.mode == tree::kModeGitlink) {
+    return S_ISDIR(st.st_mode) ? ' ' : 'D';
+  }
+  if (S_ISDIR(st.st_mode)) {
+    return 'D';
+  }
+  if (index.StatClean(entry, st)) {
+    return ' ';
+  }
+  TRACE_COUNT("status_hashed", 1);
+  std::string hash;
+  try {
+    if (entry.mode == kModeSymlink) {
+      if (!S_ISLNK(st.st_mode)) {
+        return 'M';
+      }
+      std::string target(st.st_size, '\0');
+      if (readlink(path.c_str(), target.data(), target.size()) != st.st_size) {
+        return 'M';
+      }
+      hash = hash_blob_buffer(target, false);
+    } else {
+      bool executable = st.st_mode & S_IXUSR;
+      if (!S_ISREG(st.st_mode) || executable != (entry.mode == kModeExecutable)) {
+        return 'M';
+      }
+      hash = hash_object(path, false);
+    }
+  } catch (const std::exception &) {
+    return 'M';
+  }
+  if (hash != entry.hash) {
+    return 'M';
+  }
+  refresh = true;
+  stat = dircache::StatData::From(st);
+  return ' ';
+}
+
+// 列出未跟踪的文件，同时生成新的目录缓存
+class UntrackedWalk {
+public:
+  // same_index：index 与写缓存时相同，守护进程报告没改动的整个子树可以
+  // 直接沿用缓存
+  UntrackedWalk(const std::vector<dircache::IndexEntry> &entries,
+                const fs::path &worktree, const std::string &prefix,
+                Cache &old, const fsmonitor::Changes *changes, bool same_index)
+      : entries_(entries), prefix_(prefix), old_(old), changes_(changes),
+        same_index_(same_index), matcher_(worktree) {
+    timespec now;
+    clock_gettime(CLOCK_REALTIME_COARSE, &now);
+    start_ = now;
+  }
+
+  // info/exclude 变过时缓存的目录列表都不能用
+  void Run() {
+    Walk("", 0, entries_.size(), matcher_.ExcludeDigest() != old_.exclude,
+         false);
+  }
+
+  std::vector<std::string> &Untracked() { return untracked_; }
+  std::map<std::string, DirCache> &Dirs() { return dirs_; }
+  const std::string &ExcludeDigest() const { return matcher_.ExcludeDigest(); }
+
+private:
+  /**
+   * @brief dir 下的 index 条目是 [lo, hi)
+   * @param rules_changed dir 的某个父目录的 .gitignore 与缓存时不同
+   * @param ignored dir 被排除（因为其中有已跟踪的文件才进入），其中的未
+   *        跟踪文件都不报告
+   */
+  void Walk(const std::string &dir, size_t lo, size_t hi, bool rules_changed,
+            bool ignored) {
+    std::string dir_prefix = dir.empty() ? "" : dir + "/";
+    if (!rules_changed && same_index_ && changes_ &&
+        !changes_->TouchedUnder(dir) && ReuseSubtree(dir, dir_prefix)) {
+      return;
+    }
+    const std::string &digest = matcher_.Push(dir);
+    struct PopRules {
+      ignore::Matcher &matcher;
+      ~PopRules() { matcher.Pop(); }
+    } pop_rules{matcher_};
+
+    std::vector<std::string_view> files;
+    struct Child {
+      std::string_view name;
+      size_t lo, hi;
+    };
+    std::vector<Child> children;
+    ForEachChild(
+        entries_, lo, hi, dir_prefix.size(),
+        [&](size_t, std::string_view name) { files.push_back(name); },
+        [&](std::string_view name, size_t begin, size_t end) {
+          children.push_back({name, begin, end});
+        });
+    files.erase(std::unique(files.begin(), files.end()), files.end());
+    uint32_t tracked = files.size() + children.size();
+    // 按路径排序时 "a-b/" 在 "a/" 之前，子目录名要单独排序
+    std::vector<std::string_view> child_names;
+    for (const auto &child : children) {
+      child_names.push_back(child.name);
+    }
+    std::sort(child_names.begin(), child_names.end());
+
+    std::string path = prefix_ + dir;
+    const std::vector<std::string> *names = nullptr;
+    DirCache fresh;
+    auto old = old_.dirs.find(dir);
+    rules_changed = rules_changed ||
+                    (old != old_.dirs.end() && old->second.ignore != digest);
+    if (old != old_.dirs.end() && old->second.tracked == tracked &&
+        !rules_changed) {
+      if (changes_ && !changes_->Touched(dir)) {
+        names = &old->second.names;
+      } else if (struct stat st; old->second.mtime_sec >= 0 &&
+                                 lstat(path.c_str(), &st) == 0 &&
+                                 st.st_mtim.tv_sec == old->second.mtime_sec &&
+                                 st.st_mtim.tv_nsec == old->second.mtime_nsec) {
+        names = &old->second.names;
+      }
+    }
+    if (names) {
+      TRACE_COUNT("status_dirs_cached", 1);
+      names = &(dirs_[dir] = std::move(old->second)).names;
+    } else {
+      if (!List(path, dir_prefix, files, child_names, ignored, fresh)) {
+        return; // 目录已不存在，其中的条目报告为删除
+      }
+      fresh.tracked = tracked;
+      fresh.ignore = digest;
+      names = &(dirs_[dir] = std::move(fresh)).names;
+    }
+
+    Report(dir, *names);
+    for (const auto &child : children) {
+      std::string child_dir = dir_prefix + std::string(child.name);
+      Walk(child_dir, child.lo, child.hi, rules_changed,
+           ignored || matcher_.Ignored(child_dir, true));
+    }
+  }
+
+  // 报告 dir 中的未跟踪名字；未跟踪的目录中没有未被排除的文件时不报告
+  void Report(const std::string &dir, const std::vector<std::string> &names) {
+    std::string dir_prefix = dir.empty() ? "" : dir + "/";
+    size_t pushed = 0;
+    bool entered = false;
+    for (const auto &name : names) {
+      if (name.back() == '/' && !entered) {
+        // 沿用缓存的子树时规则栈还在上层，需要逐级进入
+        pushed = matcher_.PushPath(dir);
+        entered = true;
+      }
+      if (name.back() != '/' ||
+          HasContent(dir_prefix + name.substr(0, name.size() - 1))) {
+        untracked_.push_back(dir_prefix + name);
+      }
+    }
+    matcher_.Pop(pushed);
+  }
+
+  // 把缓存中 dir 及其下所有目录的结果原样搬过来，缓存中没有 dir 时返回 false
+  bool ReuseSubtree(const std::string &dir, const std::string &dir_prefix) {
+    auto it = old_.dirs.find(dir);
+    if (it == old_.dirs.end()) {
+      return false;
+    }
+    // 以 dir_prefix 开头的键紧跟在 dir 之后（'/' 之前的字符排在更前面，
+    // 例如 "a-b" 在 "a" 和 "a/x" 之间，要跳过）
+    auto begin = dir.empty() ? old_.dirs.begin() : old_.dirs.lower_bound(dir_prefix);
+    auto end = dir.empty() ? old_.dirs.end()
+                           : old_.dirs.lower_bound(dir + char('/' + 1));
+    TRACE_COUNT("status_dirs_cached", 1);
+    Report(dir, it->second.names);
+    dirs_[dir] = std::move(it->second);
+    for (auto sub = begin; sub != end; ++sub) {
+      if (sub->first != dir) {
+        TRACE_COUNT("status_dirs_cached", 1);
+        Report(sub->first, sub->second.names);
+        dirs_.emplace_hint(dirs_.end(), sub->first, std::move(sub->second));
+      }
+    }
+    return true;
+  }
+
+  bool List(const std::string &path, const std::string &dir_prefix,
+            const std::vector<std::string_view> &files,
+            const std::vector<std::string_view> &children, bool ignored,
+            DirCache &fresh) {
+    TRACE_COUNT("status_dirs_listed", 1);
+    DIR *handle = opendir(path.c_str());
+    if (!handle) {
+      return false;
+    }
+    // 先取 mtime 再列出：列出期间的改动会让下次的 mtime 不同
+    struct stat st;
+    if (fstat(dirfd(handle), &st) == 0 && !Racy(st.st_mtim)) {
+      fresh.mtime_sec = st.st_mtim.tv_sec;
+      fresh.mtime_nsec = st.st_mtim.tv_nsec;
+    }
+    // 被排除的目录只记下 mtime
+    for (dirent *entry; !ignored && (entry = readdir(handle));) {
+      std::string_view name = entry->d_name;
+      if (name == "." || name == ".." || name == ".git") {
+        continue;
+      }
+      bool is_dir = IsDir(handle, entry);
+      if (is_dir ? std::binary_search(children.begin(), children.end(), name)
+                 : std::binary_search(files.begin(), files.end(), name)) {
+        continue;
+      }
+      if (matcher_.Ignored(dir_prefix + std::string(name), is_dir)) {
+        continue;
+      }
+      fresh.names.push_back(is_dir ? std::string(name) + "/"
+                                   : std::string(name));
+    }
+    closedir(handle);
+    std::sort(fresh.names.begin(), fresh.names.end());
+    return true;
+  }
+
+  static bool IsDir(DIR *handle, const dirent *entry) {
+    if (entry->d_type != DT_UNKNOWN) {
+      return entry->d_type == DT_DIR;
+    }
+    struct stat child;
+    return fstatat(dirfd(handle), entry->d_name, &child, AT_SYMLINK_NOFOLLOW) ==
+               0 &&
+           S_ISDIR(child.st_mode);
+  }
+
+  // 与这次遍历开始时处于同一时钟周期的 mtime：之后的改动可能不改变 mtime
+  bool Racy(const timespec &mtime) const {
+    return mtime.tv_sec > start_.tv_sec ||
+           (mtime.tv_sec == start_.tv_sec && mtime.tv_nsec >= start_.tv_nsec);
+  }
+
+  // 未跟踪的目录 dir 中是否有未被排除的文件（空目录不报告，与 git 相同）
+  bool HasContent(const std::string &dir) {
+    DIR *handle = opendir((prefix_ + dir).c_str());
+    if (!handle) {
+      return false;
+    }
+    matcher_.Push(dir);
+    bool found = false;
+    std::vector<std::string> subdirs;
+    while (dirent *entry = readdir(handle)) {
+      std::string_view name = entry->d_name;
+      if (name == "." || name == "..") {
+        continue;
+      }
+      // 嵌套的仓库也算作内容
+      if (name == ".git") {
+        found = true;
+        break;
+      }
+      bool is_dir = IsDir(handle, entry);
+      std::string child = dir + "/" + std::string(name);
+      if (matcher_.Ignored(child, is_dir)) {
+        continue;
+      }
+      if (!is_dir) {
+        found = true;
+        break;
+      }
+      subdirs.push_back(std::move(child));
+    }
+    closedir(handle);
+    for (size_t i = 0; !found && i < subdirs.size(); i++) {
+      found = HasContent(subdirs[i]);
+    }
+    matcher_.Pop();
+    return found;
+  }
+
+  const std::vector<dircache::IndexEntry> &entries_;
+  const std::string &prefix_;
+  Cache &old_;
+  const fsmonitor::Changes *changes_;
+  bool same_index_;
+  ignore::Matcher matcher_;
+  timespec start_;
+  std::vector<std::string> untracked_;
+  std::map<std::string, DirCache> dirs_;
+};
+
+} // namespace
+
+std::vector<Entry> Status(const ObjectStore &store, const fs::path &worktree,
+                          const std::string &head_tree,
+                          const Options &options) {
+  TRACE_SPAN("status");
+  fs::path index_path = store.GitDir() / "index";
+  fs::path cache_path = store.GitDir() / "status-cache";
+  dircache::Index index = dircache::Index::Read(index_path, false);
+  std::string cache_data;
+  ReadWhole(cache_path, cache_data);
+  Cache old = ReadCache(cache_data);
+  Cache cache;
+  cache.head_tree = head_tree;
+  cache.index_checksum = index.Checksum();
+
+  // 守护进程给出的改动只有在 index 也没变时才能用来跳过条目
+  std::optional<fsmonitor::Changes> changes =
+      fsmonitor::Query(store.GitDir(), old.token);
+  const fsmonitor::Changes *monitor = nullptr;
+  if (changes) {
+    cache.token = changes->token;
+    if (!changes->everything && !old.token.empty()) {
+      monitor = &*changes;
+    }
+  }
+  bool same_index = !old.index_checksum.empty() &&
+                    old.index_checksum == index.Checksum();
+
+  if (same_index && old.head_tree == head_tree) {
+    cache.staged = std::move(old.staged);
+  } else {
+    cache.staged = DiffHead(store, head_tree, index);
+  }
+
+  // index 与工作区：需要检查的条目（下标），按路径有序
+  const auto &entries = index.Entries();
+  std::vector<size_t> candidates;
+  if (monitor && same_index) {
+    // 改变过的目录中的文件（二分查找定位）和上次有改动的条目
+    for (const auto &dir : monitor->dirs) {
+      std::string dir_prefix = dir.empty() ? "" : dir + "/";
+      size_t lo = std::partition_point(entries.begin(), entries.end(),
+                                       [&](const dircache::IndexEntry &entry) {
+                                         return entry.path < dir_prefix;
+                                       }) -
+                  entries.begin();
+      size_t hi = BlockEnd(entries, lo, entries.size(), dir_prefix);
+      ForEachChild(
+          entries, lo, hi, dir_prefix.size(),
+          [&](size_t k, std::string_view) {
+            if (entries[k].stage == 0 && !entries[k].skip_worktree) {
+              candidates.push_back(k);
+            }
+          },
+          [](std::string_view, size_t, size_t) {});
+    }
+    for (const auto &entry : old.unstaged) {
+      if (const auto *found = index.Find(entry.path);
+          found && !found->skip_worktree) {
+        candidates.push_back(found - entries.data());
+      }
+    }
+    std::sort(candidates.begin(), candidates.end());
+    candidates.erase(std::unique(candidates.begin(), candidates.end()),
+                     candidates.end());
+  } else {
+    candidates.reserve(entries.size());
+    for (size_t i = 0; i < entries.size(); i++) {
+      // 稀疏检出时不在工作区中的条目不比较
+      if (entries[i].stage == 0 && !entries[i].skip_worktree) {
+        candidates.push_back(i);
+      }
+    }
+  }
+  TRACE_COUNT("status_checked", candidates.size());
+
+  std::string prefix = worktree.string() + "/";
+  std::vector<char> results(candidates.size(), ' ');
+  std::vector<char> refreshed(candidates.size(), 0);
+  std::vector<dircache::StatData> stats(candidates.size());
+  // 在目录边界处切分，同一目录的条目由同一个线程 lstat
+  std::vector<std::pair<size_t, size_t>> tasks;
+  for (size_t begin = 0, i = 1; i <= candidates.size(); i++) {
+    if (i == candidates.size() ||
+        (i - begin >= kEntriesPerTask &&
+         Parent(entries[candidates[i]].path) !=
+             Parent(entries[candidates[i - 1]].path))) {
+      tasks.push_back({begin, i});
+      begin = i;
+    }
+  }
+  std::atomic<size_t> next_task{0};
+  auto work = [&] {
+    std::string path;
+    for (size_t t; (t = next_task++) < tasks.size();) {
+      for (size_t k = tasks[t].first; k < tasks[t].second; k++) {
+        const auto &entry = entries[candidates[k]];
+        path.assign(prefix).append(entry.path);
+        bool refresh = false;
+        results[k] = CheckEntry(index, entry, path, refresh, stats[k]);
+        refreshed[k] = refresh;
+      }
+    }
+  };
+  {
+    TRACE_SPAN("status-lstat");
+    unsigned threads = options.threads
+                           ? options.threads
+                           : std::max(1u, std::thread::hardware_concurrency());
+    threads = std::min<size_t>(threads, tasks.size());
+    std::vector<std::thread> pool;
+    for (unsigned i = 1; i < threads; i++) {
+      pool.emplace_back(work);
+    }
+    work();
+    for (auto &thread : pool) {
+      thread.join();
+    }
+  }
+  for (size_t k = 0; k < candidates.size(); k++) {
+    if (results[k] != ' ') {
+      cache.unstaged.push_back({' ', results[k], entries[candidates[k]].path});
+    }
+  }
+
+  // 内容没变的条目换上新的 stat 信息写回 index
+  if (std::find(refreshed.begin(), refreshed.end(), 1) != refreshed.end()) {
+    std::vector<dircache::IndexEntry> updated = entries;
+    for (size_t k = 0; k < candidates.size(); k++) {
+      if (refreshed[k]) {
+        updated[candidates[k]].stat = stats[k];
+      }
+    }
+    index.SetEntries(std::move(updated));
+    try {
+      index.Write(index_path);
+      cache.index_checksum = index.Checksum();
+      TRACE_COUNT("status_refreshed", 1);
+    } catch (const std::exception &) {
+      // 其它进程持有 index.lock，下次再更新
+    }
+  }
+
+  std::vector<std::string> untracked;
+  if (options.untracked) {
+    TRACE_SPAN("status-untracked");
+    UntrackedWalk walk(index.Entries(), worktree, prefix, old, monitor,
+                       same_index);
+    walk.Run();
+    untracked = std::move(walk.Untracked());
+    cache.dirs = std::move(walk.Dirs());
+    cache.exclude = walk.ExcludeDigest();
+    std::sort(untracked.begin(), untracked.end());
+  } else {
+    // 没有重新列出目录：保留上次的令牌，下次仍能得到这期间所有改过的目录。
+    // 目录缓存与 index 对应，index 变了就丢弃
+    cache.token = old.token;
+    if (same_index) {
+      cache.exclude = old.exclude;
+      cache.dirs = std::move(old.dirs);
+    }
+  }
+
+  // 合并已暂存和未暂存的改动
+  std::vector<Entry> result;
+  auto staged = cache.staged.begin();
+  auto unstaged = cache.unstaged.begin();
+  while (staged != cache.staged.end() || unstaged != cache.unstaged.end()) {
+    if (unstaged == cache.unstaged.end() ||
+        (staged != cache.staged.end() && staged->path < unstaged->path)) {
+      result.push_back(*staged++);
+    } else if (staged == cache.staged.end() || unstaged->path < staged->path) {
+      result.push_back(*unstaged++);
+    } else {
+      result.push_back({staged->staged, unstaged->unstaged, staged->path});
+      ++staged;
+      ++unstaged;
+    }
+  }
+  for (auto &path : untracked) {
+    result.push_back({'?', '?', std::move(path)});
+  }
+
+  std::string data = SerializeCache(cache);
+  if (data != cache_data) {
+    WriteCache(cache_path, data);
+  }
+  return result;
+}
+
+std::string FormatPorcelain(const Entry &entry) {
+  // 与 git 相同，porcelain 格式中含空格的路径也加引号
+  std::string path = tree::QuotePath(entry.path);
+  if (path.front() != '"' && path.find(' ') != std::string::npos) {
+    path = '"' + path + '"';
+  }
+  return std::string{entry.staged, entry.unstaged, ' '} + path;
+}
+
+} // namespace status
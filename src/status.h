@@ -0,0 +1,62 @@
+#pragma once
+
+#include "object_store.h"
+#include <filesystem>
+#include <string>
+#include <vector>
+
+/**
+ * @brief 工作区状态（git status）
+ *
+ * 三方比较：HEAD 的 tree 与 index（已暂存的改动），index 与工作区（未暂存
+ * 的改动），以及工作区中 index 没有记录的文件（未跟踪）。
+ *
+ * - index 与工作区：每个条目 lstat 一次，stat 信息与 index 中记录的相同就
+ *   认为未改动（见 dircache.h），否则比较内容。条目按所在目录分成若干段，
+ *   由几个线程同时 lstat。内容没变、只是 stat 变了的条目顺便写回 index，
+ *   下次不必再读文件（拿不到 index.lock 时跳过）。稀疏检出时不在工作区中
+ *   的条目不比较，稀疏目录与 HEAD 中的子树只比较 tree 哈希
+ * - 未跟踪文件：逐个目录列出，不在 index 中的文件报告出来；其下没有任何
+ *   已跟踪文件的目录作为一项（"dir/"）报告，不再深入
+ * - 被 .gitignore 或 .git/info/exclude 排除的未跟踪文件和目录不报告（见
+ *   ignore.h），只有被排除的文件的目录也不报告
+ *
+ * .git/status-cache 保存上一次的结果：
+ *
+ * - HEAD tree 和 index 校验和都没变时，直接沿用上次已暂存的改动
+ * - 每个目录的 mtime 和其中未跟踪的名字：目录的 mtime 没变说明其中没有
+ *   增删或改名，不必再列出（只 stat 目录本身）
+ * - 每个目录 .gitignore 的 SHA-1 和 info/exclude 的 SHA-1：规则变了的目录
+ *   即使 mtime 没变也重新列出
+ * - 有文件系统监视守护进程（见 fsmonitor.h）且 index 没变时，只 lstat 改变过
+ *   的目录中的条目和上次有改动的条目，没改变过的目录连 stat 也不做
+ */
+namespace status {
+
+struct Entry {
+  char staged = ' ';   // HEAD 与 index：A 新增、M 修改、D 删除、U 冲突
+  char unstaged = ' '; // index 与工作区：M 修改、D 删除；未跟踪时两者都是 '?'
+  std::string path;    // 未跟踪的目录以 '/' 结尾
+};
+
+struct Options {
+  bool untracked = true; // -uno 时为 false
+  unsigned threads = 0;  // lstat 的线程数，0：CPU 核数
+};
+
+/**
+ * @brief 比较 head_tree、store.GitDir()/index 和 worktree
+ * @param head_tree 空字符串表示还没有提交
+ * @return 已跟踪的改动按路径排序，之后是按路径排序的未跟踪文件（与
+ *         git status --porcelain 的顺序相同）
+ * @throws std::runtime_error index 损坏或对象缺失
+ */
+std::vector<Entry> Status(const ObjectStore &store,
+                          const std::filesystem::path &worktree,
+                          const std::string &head_tree,
+                          const Options &options = {});
+
+// git status --porcelain 的一行（不含换行）："XY <路径>"
+std::string FormatPorcelain(const Entry &entry);
+
+} // namespace status
@@ -0,0 +1,173 @@
+#include "trace.h"
+
+#ifndef MINIGIT_DISABLE_TRACE
+
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <mutex>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace trace {
+namespace {
+
+/**
+ * @brief 跟踪输出文件的唯一持有者
+ *
+ * 事件以 JSON 数组的形式逐条追加，进程退出时输出剩余计数器并补上 ']'。
+ */
+class Tracer {
+public:
+  static Tracer &Instance() {
+    static Tracer tracer;
+    return tracer;
+  }
+
+  bool enabled() const { return out_ != nullptr; }
+
+  void Write(const std::string &event) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    fputs(first_ ? "[\n" : ",\n", out_);
+    first_ = false;
+    fputs(event.c_str(), out_);
+  }
+
+  void Count(const char *name, int64_t delta) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    counters_[name] += delta;
+  }
+
+  void AddPhaseTime(const char *name, int64_t nanos) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    phases_[name] += nanos;
+  }
+
+  ~Tracer() {
+    if (!out_) {
+      return;
+    }
+    // 析构期间不能再经过 Instance()，直接输出本对象的累加值
+    FlushTotals();
+    fputs(first_ ? "[]\n" : "\n]\n", out_);
+    fclose(out_);
+  }
+
+private:
+  Tracer() {
+    const char *path = getenv("MINIGIT_TRACE");
+    if (path && *path) {
+      out_ = fopen(path, "w");
+      if (!out_) {
+        fprintf(stderr, "warning: cannot open trace file %s\n", path);
+      }
+    }
+  }
+
+  friend void trace::Flush();
+
+  // 输出累加的计数器和阶段耗时，并清零
+  void FlushTotals();
+
+  FILE *out_ = nullptr;
+  bool first_ = true;
+  std::mutex mutex_;
+  std::map<std::string, int64_t> counters_;
+  std::map<std::string, int64_t> phases_;
+};
+
+long ThreadId() { return syscall(SYS_gettid); }
+
+// 转义 JSON 字符串中的特殊字符
+std::string Escape(const std::string &text) {
+  std::string escaped;
+  escaped.reserve(text.size());
+  for (unsigned char c : text) {
+    if (c == '"' || c == '\\') {
+      escaped.push_back('\\');
+      escaped.push_back(c);
+    } else if (c < 0x20) {
+      char buf[8];
+      snprintf(buf, sizeof(buf), "\\u%04x", c);
+      escaped += buf;
+    } else {
+      escaped.push_back(c);
+    }
+  }
+  return escaped;
+}
+
+std::string EventPrefix(const char *name, char phase, int64_t ts) {
+  return "{\"name\":\"" + Escape(name) + "\",\"cat\":\"git\",\"ph\":\"" +
+         phase + "\",\"ts\":" + std::to_string(ts) +
+         ",\"pid\":" + std::to_string(getpid()) +
+         ",\"tid\":" + std::to_string(ThreadId());
+}
+
+void Tracer::FlushTotals() {
+  std::map<std::string, int64_t> counters, phases;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    counters.swap(counters_);
+    phases.swap(phases_);
+  }
+  int64_t now = NowMicros();
+  for (const auto &[name, value] : counters) {
+    Write(EventPrefix(name.c_str(), 'C', now) + ",\"args\":{\"value\":" +
+          std::to_string(value) + "}}");
+  }
+  for (const auto &[name, nanos] : phases) {
+    Write(EventPrefix((name + "_ms").c_str(), 'C', now) +
+          ",\"args\":{\"value\":" + std::to_string(nanos / 1e6) + "}}");
+  }
+}
+
+} // namespace
+
+bool Enabled() {
+  static const bool enabled = Tracer::Instance().enabled();
+  return enabled;
+}
+
+int64_t NowMicros() {
+  static const auto origin = std::chrono::steady_clock::now();
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now() - origin)
+      .count();
+}
+
+void EmitSpan(const char *name, int64_t start_us, int64_t dur_us) {
+  if (!Enabled()) {
+    return;
+  }
+  Tracer::Instance().Write(EventPrefix(name, 'X', start_us) +
+                           ",\"dur\":" + std::to_string(dur_us) + "}");
+}
+
+void EmitInstant(const char *name, const std::string &detail) {
+  if (!Enabled()) {
+    return;
+  }
+  Tracer::Instance().Write(EventPrefix(name, 'i', NowMicros()) +
+                           ",\"s\":\"t\",\"args\":{\"detail\":\"" +
+                           Escape(detail) + "\"}}");
+}
+
+void Count(const char *name, int64_t delta) {
+  Tracer::Instance().Count(name, delta);
+}
+
+void AddPhaseTime(const char *name, int64_t nanos) {
+  Tracer::Instance().AddPhaseTime(name, nanos);
+}
+
+void Flush() {
+  if (!Enabled()) {
+    return;
+  }
+  Tracer::Instance().FlushTotals();
+}
+
+} // namespace trace
+
+#endif // MINIGIT_DISABLE_TRACE
@@ -0,0 +1,139 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+/**
+ * @brief 轻量级跟踪与分阶段计时
+ *
+ * 设置环境变量 MINIGIT_TRACE=<文件路径> 后，程序把 Chrome trace-event 格式
+ * （JSON 数组）写入该文件，可直接用 chrome://tracing 或 Perfetto 打开：
+ *
+ *   MINIGIT_TRACE=/tmp/clone.json ./git clone <url> <dir>
+ *
+ * 未设置时所有接口只做一次布尔判断；编译时定义 MINIGIT_DISABLE_TRACE
+ * 则整个子系统被编译掉。
+ *
+ * 事件类型：
+ * - Span：一段有起止时间的阶段（协商、下载、checkout 等），"ph":"X"
+ * - Counter：累加的计数器（字节数、对象数、缓存命中），"ph":"C"
+ * - Phase：对每个对象都会执行的短操作（解压、delta 还原、存储），只累加耗时，
+ *   在 Flush 时以计数器的形式输出，避免为每个对象写一条事件
+ * - Instant：单点事件，附带一个字符串参数，"ph":"i"
+ */
+namespace trace {
+
+#ifndef MINIGIT_DISABLE_TRACE
+
+// 是否开启了跟踪（第一次调用时读取环境变量）
+bool Enabled();
+
+// 当前时间（微秒，相对于进程内第一次调用）
+int64_t NowMicros();
+
+void EmitSpan(const char *name, int64_t start_us, int64_t dur_us);
+void EmitInstant(const char *name, const std::string &detail);
+
+// 累加计数器，Flush 时输出
+void Count(const char *name, int64_t delta);
+
+// 累加某个阶段的耗时（纳秒）
+void AddPhaseTime(const char *name, int64_t nanos);
+
+// 输出所有累加的计数器和阶段耗时，并清零
+void Flush();
+
+/**
+ * @brief RAII 阶段：构造时记录开始时间，析构时输出一条完整事件
+ */
+class Span {
+public:
+  explicit Span(const char *name)
+      : name_(name), start_(Enabled() ? NowMicros() : -1) {}
+  ~Span() {
+    if (start_ >= 0) {
+      EmitSpan(name_, start_, NowMicros() - start_);
+    }
+  }
+  Span(const Span &) = delete;
+  Span &operator=(const Span &) = delete;
+
+private:
+  const char *name_;
+  int64_t start_;
+};
+
+/**
+ * @brief RAII 计时器：把作用域内的耗时累加到指定阶段
+ */
+class PhaseTimer {
+public:
+  explicit PhaseTimer(const char *name) : name_(name), enabled_(Enabled()) {
+    if (enabled_) {
+      start_ = std::chrono::steady_clock::now();
+    }
+  }
+  ~PhaseTimer() {
+    if (enabled_) {
+      AddPhaseTime(name_, std::chrono::duration_cast<std::chrono::nanoseconds>(
+                              std::chrono::steady_clock::now() - start_)
+                              .count());
+    }
+  }
+  PhaseTimer(const PhaseTimer &) = delete;
+  PhaseTimer &operator=(const PhaseTimer &) = delete;
+
+private:
+  const char *name_;
+  bool enabled_;
+  std::chrono::steady_clock::time_point start_;
+};
+
+#else // MINIGIT_DISABLE_TRACE
+
+inline bool Enabled() { return false; }
+inline int64_t NowMicros() { return 0; }
+inline void EmitSpan(const char *, int64_t, int64_t) {}
+inline void EmitInstant(const char *, const std::string &) {}
+inline void Count(const char *, int64_t) {}
+inline void AddPhaseTime(const char *, int64_t) {}
+inline void Flush() {}
+
+class Span {
+public:
+  explicit Span(const char *) {}
+};
+
+class PhaseTimer {
+public:
+  explicit PhaseTimer(const char *) {}
+};
+
+#endif // MINIGIT_DISABLE_TRACE
+
+} // namespace trace
+
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+
+// 在当前作用域内记录一个阶段
+#define TRACE_SPAN(name) trace::Span TRACE_CONCAT(trace_span_, __LINE__)(name)
+
+// 把当前作用域的耗时累加到一个按对象执行的阶段
+#define TRACE_PHASE(name)                                                      \
+  trace::PhaseTimer TRACE_CONCAT(trace_phase_, __LINE__)(name)
+
+// 累加计数器；未开启跟踪时不计算 delta 表达式
+#define TRACE_COUNT(name, delta)                                               \
+  do {                                                                         \
+    if (trace::Enabled())                                                      \
+      trace::Count(name, delta);                                               \
+  } while (0)
+
+// 单点事件；未开启跟踪时不构造 detail 字符串
+#define TRACE_INSTANT(name, detail)                                            \
+  do {                                                                         \
+    if (trace::Enabled())                                                      \
+      trace::EmitInstant(name, detail);                                        \
+  } while (0)
@@ -0,0 +1,205 @@
+#include "tree.h"
+#include "byte_util.h"
+#include "trace.h"
+#include <algorithm>
+#include <cstdio>
+#include <stdexcept>
+#include <string.h>
+
+namespace tree {
+namespace {
+
+constexpr uint32_t kModeTypeMask = 0170000;
+const std::string kZeroHash(40, '0');
+
+std::string ReadTree(const ObjectStore &store, const std::string &hash) {
+  auto object = store.Read(hash);
+  if (!object) {
+    throw std::runtime_error("missing tree " + hash);
+  }
+  if (object->type != ObjectType::kTree) {
+    throw std::runtime_error("object " + hash + " is a " +
+                             ObjectTypeName(object->type) + ", expected tree");
+  }
+  return std::move(object->data);
+}
+
+// 两棵树同步前进的比较，recursive 时进入改动过的子树
+class Differ {
+public:
+  Differ(const ObjectStore &store, const DiffOptions &options,
+         const std::function<void(const Change &)> &emit)
+      : store_(store), options_(options), emit_(emit) {}
+
+  void Walk(const std::string &old_tree, const std::string &new_tree,
+            const std::string &prefix) {
+    std::string old_data = old_tree.empty() ? "" : ReadTree(store_, old_tree);
+    std::string new_data = new_tree.empty() ? "" : ReadTree(store_, new_tree);
+    TRACE_COUNT("diff_trees_read", !old_tree.empty() + !new_tree.empty());
+    TreeParser old_parser(old_data, old_tree);
+    TreeParser new_parser(new_data, new_tree);
+    TreeEntry a, b;
+    bool has_a = old_parser.Next(a);
+    bool has_b = new_parser.Next(b);
+    while (has_a || has_b) {
+      int cmp = !has_a ? 1 : !has_b ? -1 : CompareEntries(a, b);
+      if (cmp < 0) {
+        Removed(a, prefix);
+        has_a = old_parser.Next(a);
+      } else if (cmp > 0) {
+        Added(b, prefix);
+        has_b = new_parser.Next(b);
+      } else {
+        // 哈希相同的子树内容一定相同，不必读取
+        if (a.mode != b.mode || memcmp(a.oid, b.oid, 20) != 0) {
+          Modified(a, b, prefix);
+        }
+        has_a = old_parser.Next(a);
+        has_b = new_parser.Next(b);
+      }
+    }
+  }
+
+private:
+  bool Descend(const TreeEntry &entry, const std::string &path) const {
+    return options_.recursive && entry.IsTree() &&
+           (!options_.descend || options_.descend(path));
+  }
+
+  void Removed(const TreeEntry &entry, const std::string &prefix) {
+    std::string path = prefix + std::string(entry.name);
+    if (Descend(entry, path)) {
+      Walk(entry.Hash(), "", path + '/');
+      return;
+    }
+    emit_({'D', entry.mode, 0, entry.Hash(), kZeroHash, path});
+  }
+
+  void Added(const TreeEntry &entry, const std::string &prefix) {
+    std::string path = prefix + std::string(entry.name);
+    if (Descend(entry, path)) {
+      Walk("", entry.Hash(), path + '/');
+      return;
+    }
+    emit_({'A', 0, entry.mode, kZeroHash, entry.Hash(), path});
+  }
+
+  void Modified(const TreeEntry &a, const TreeEntry &b,
+                const std::string &prefix) {
+    std::string path = prefix + std::string(a.name);
+    if (Descend(a, path)) {
+      Walk(a.Hash(), b.Hash(), path + '/');
+      return;
+    }
+    char status =
+        (a.mode & kModeTypeMask) == (b.mode & kModeTypeMask) ? 'M' : 'T';
+    emit_({status, a.mode, b.mode, a.Hash(), b.Hash(), path});
+  }
+
+  const ObjectStore &store_;
+  const DiffOptions &options_;
+  const std::function<void(const Change &)> &emit_;
+};
+
+} // namespace
+
+std::string TreeEntry::Hash() const { return byte_util::BinaryToHex(oid); }
+
+TreeParser::TreeParser(std::string_view data, std::string hash)
+    : data_(data), hash_(std::move(hash)) {}
+
+bool TreeParser::Next(TreeEntry &entry) {
+  if (pos_ >= data_.size()) {
+    return false;
+  }
+  size_t space = data_.find(' ', pos_);
+  size_t nul = space == std::string_view::npos ? space
+                                               : data_.find('\0', space + 1);
+  if (space == std::string_view::npos || nul == std::string_view::npos ||
+      space == pos_ || space - pos_ > 7 || nul == space + 1 ||
+      nul + 21 > data_.size()) {
+    throw std::runtime_error("corrupt tree " + hash_);
+  }
+  uint32_t mode = 0;
+  for (size_t i = pos_; i < space; i++) {
+    if (data_[i] < '0' || data_[i] > '7') {
+      throw std::runtime_error("corrupt tree " + hash_);
+    }
+    mode = mode * 8 + (data_[i] - '0');
+  }
+  entry.mode = mode;
+  entry.name = data_.substr(space + 1, nul - space - 1);
+  entry.oid = reinterpret_cast<const unsigned char *>(data_.data()) + nul + 1;
+  pos_ = nul + 21;
+  return true;
+}
+
+int CompareEntries(const TreeEntry &a, const TreeEntry &b) {
+  size_t common = std::min(a.name.size(), b.name.size());
+  int cmp = memcmp(a.name.data(), b.name.data(), common);
+  if (cmp != 0) {
+    return cmp;
+  }
+  unsigned char next_a = a.name.size() > common ? a.name[common]
+                         : a.IsTree()           ? '/'
+                                                : '\0';
+  unsigned char next_b = b.name.size() > common ? b.name[common]
+                         : b.IsTree()           ? '/'
+                                                : '\0';
+  return int(next_a) - int(next_b);
+}
+
+void DiffTrees(const ObjectStore &store, const std::string &old_tree,
+               const std::string &new_tree, const DiffOptions &options,
+               const std::function<void(const Change &)> &emit) {
+  TRACE_SPAN("diff-tree");
+  if (old_tree == new_tree) {
+    return;
+  }
+  Differ(store, options, emit).Walk(old_tree, new_tree, "");
+}
+
+std::string QuotePath(const std::string &path) {
+  auto special = [](unsigned char c) {
+    return c < 0x20 || c == '"' || c == '\\' || c >= 0x7f;
+  };
+  if (std::none_of(path.begin(), path.end(), special)) {
+    return path;
+  }
+  std::string out = "\"";
+  for (unsigned char c : path) {
+    if (!special(c)) {
+      out.push_back(c);
+      continue;
+    }
+    out.push_back('\\');
+    switch (c) {
+    case '\a': out.push_back('a'); break;
+    case '\b': out.push_back('b'); break;
+    case '\t': out.push_back('t'); break;
+    case '\n': out.push_back('n'); break;
+    case '\v': out.push_back('v'); break;
+    case '\f': out.push_back('f'); break;
+    case '\r': out.push_back('r'); break;
+    case '"': out.push_back('"'); break;
+    case '\\': out.push_back('\\'); break;
+    default: {
+      char octal[4];
+      snprintf(octal, sizeof(octal), "%03o", c);
+      out += octal;
+    }
+    }
+  }
+  out.push_back('"');
+  return out;
+}
+
+std::string FormatRaw(const Change &change) {
+  char modes[32];
+  snprintf(modes, sizeof(modes), ":%06o %06o ", change.old_mode,
+           change.new_mode);
+  return modes + change.old_hash + ' ' + change.new_hash + ' ' +
+         change.status + '\t' + QuotePath(change.path);
+}
+
+} // namespace tree
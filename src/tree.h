@@ -0,0 +1,101 @@
+#pragma once
+
+#include "object_store.h"
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+
+/**
+ * @brief tree 对象的条目解析与两棵树的比较（diff-tree）
+ *
+ * tree 对象的内容是按名字排序的条目序列：
+ *
+ *   <八进制 mode> <名字>\0<20字节哈希>
+ *
+ * 排序时目录名视为后面多一个 '/'（"a.txt" < "a/" < "a0"），所以同一个名字
+ * 的文件和目录是两个不同的位置。两棵树按这个顺序同步前进，每一步只比较
+ * 两边的当前条目：哈希和 mode 都相同的条目（包括整棵子树）直接跳过，
+ * 不读取其内容，因此比较的开销与改动的多少成正比，而不是与树的大小成正比。
+ */
+namespace tree {
+
+constexpr uint32_t kModeTree = 040000;
+constexpr uint32_t kModeGitlink = 0160000;
+
+struct TreeEntry {
+  uint32_t mode = 0;      // 解析后的 mode，如 0100644、040000
+  std::string_view name;  // 指向 tree 内容的视图
+  const unsigned char *oid = nullptr; // 20 字节二进制哈希，同样指向 tree 内容
+
+  bool IsTree() const { return mode == kModeTree; }
+  // 40 字符十六进制哈希
+  std::string Hash() const;
+};
+
+/**
+ * @brief 依次取出 tree 内容中的条目，不复制名字和哈希
+ */
+class TreeParser {
+public:
+  // hash 只用于错误信息；data 必须在解析期间保持有效
+  TreeParser(std::string_view data, std::string hash = "");
+
+  /**
+   * @brief 取出下一个条目
+   * @return 没有更多条目时返回 false
+   * @throws std::runtime_error 条目格式错误
+   */
+  bool Next(TreeEntry &entry);
+
+private:
+  std::string_view data_;
+  size_t pos_ = 0;
+  std::string hash_;
+};
+
+/**
+ * @brief 按 tree 中的顺序比较两个条目的名字（目录名视为以 '/' 结尾）
+ * @return 负数、0、正数分别表示 a 在前、同一位置、b 在前
+ */
+int CompareEntries(const TreeEntry &a, const TreeEntry &b);
+
+// diff-tree 输出的一项改动
+struct Change {
+  char status = 'M';     // A 新增、D 删除、M 修改、T 类型改变（如文件与符号链接）
+  uint32_t old_mode = 0; // 不存在的一侧为0
+  uint32_t new_mode = 0;
+  std::string old_hash;  // 不存在的一侧为 40 个 '0'
+  std::string new_hash;
+  std::string path;      // 相对于比较的根
+};
+
+struct DiffOptions {
+  bool recursive = false; // -r：进入子树，只输出文件；否则子树作为一项输出
+  // recursive 时对每个要进入的子树（路径不含末尾的 '/'）调用，返回 false
+  // 的子树不读取，与非 recursive 时一样作为一项输出。为空时都进入
+  std::function<bool(const std::string &dir)> descend;
+};
+
+/**
+ * @brief 比较两棵树，按路径顺序对每项改动调用 emit
+ * @param old_tree、new_tree 为空字符串时表示空树
+ * @throws std::runtime_error tree 对象缺失或损坏
+ */
+void DiffTrees(const ObjectStore &store, const std::string &old_tree,
+               const std::string &new_tree, const DiffOptions &options,
+               const std::function<void(const Change &)> &emit);
+
+/**
+ * @brief 与 git 的 core.quotePath 相同：含控制字符、'"'、'\\' 或非 ASCII
+ *        字节的路径加上双引号，这些字节写成 C 风格转义或三位八进制
+ */
+std::string QuotePath(const std::string &path);
+
+/**
+ * @brief git diff-tree 的 raw 格式（路径经过 QuotePath）：
+ *        ":<旧mode> <新mode> <旧哈希> <新哈希> <状态>\t<路径>"
+ */
+std::string FormatRaw(const Change &change);
+
+} // namespace tree
@@ -0,0 +1,528 @@
+#include "upload_pack.h"
+#include "bitmap.h"
+#include "object_store.h"
+#include "refs.h"
+#include "repack.h"
+#include "trace.h"
+#include <algorithm>
+#include <fcntl.h>
+#include <optional>
+#include <stdexcept>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_set>
+
+namespace fs = std::filesystem;
+
+namespace upload_pack {
+namespace {
+
+constexpr const char *kCapabilities =
+    "multi_ack_detailed side-band-64k ofs-delta filter agent=minigit/1.0";
+
+// side-band 每帧可携带的数据：长度前缀4字节 + 通道号1字节
+constexpr size_t kSidebandData = kMaxPktLine - 5;
+
+bool IsHexHash(const std::string &text) {
+  return text.size() == 40 &&
+         text.find_first_not_of("0123456789abcdef") == std::string::npos;
+}
+
+// 在临时目录中创建一个已经删除了目录项的文件，关闭后自动释放
+int CreateAnonymousFile() {
+  std::string path =
+      (fs::temp_directory_path() / "minigit-upload-XXXXXX").string();
+  int fd = mkstemp(path.data());
+  if (fd < 0) {
+    throw std::runtime_error(std::string("upload-pack: mkstemp failed: ") +
+                             strerror(errno));
+  }
+  unlink(path.c_str());
+  return fd;
+}
+
+// 所需对象恰好组成一个已有 pack 时返回该 pack
+const pack::PackFile *
+FindReusablePack(const ObjectStore &store,
+                 const std::vector<pack::PackInput> &objects) {
+  for (const auto &packfile : store.Packs()) {
+    if (packfile->Count() != objects.size()) {
+      continue;
+    }
+    bool all = std::all_of(objects.begin(), objects.end(),
+                           [&packfile](const pack::PackInput &object) {
+                             return packfile->Find(object.hash).has_value();
+                           });
+    if (all) {
+      return packfile.get();
+    }
+  }
+  return nullptr;
+}
+
+// 公布的引用（哈希，引用名）：HEAD 在前，之后是各分支
+std::vector<std::pair<std::string, std::string>>
+AdvertisedRefs(const MiniGitRef &refs) {
+  std::vector<std::pair<std::string, std::string>> advertised;
+  std::string head = refs.GetCurrentCommit();
+  if (!head.empty()) {
+    advertised.emplace_back(head, "HEAD");
+  }
+  for (const auto &branch : refs.ListAllBranches()) {
+    std::string hash = refs.GetBranchCommit(branch);
+    if (!hash.empty()) {
+      advertised.emplace_back(hash, "refs/heads/" + branch);
+    }
+  }
+  return advertised;
+}
+
+/**
+ * @brief 检查 want 是否从公布的引用可达
+ *
+ * 公布的提交本身直接通过；其他对象（较早的提交、部分克隆补取的 blob）
+ * 需要全部可达对象，有位图时用位图计算，否则遍历一次。只在第一次遇到
+ * 这样的 want 时计算。
+ */
+class ReachableFromRefs {
+public:
+  ReachableFromRefs(const ObjectStore &store, bitmap::PackBitmap *bitmaps)
+      : store_(store), bitmaps_(bitmaps) {
+    for (auto &[hash, name] : AdvertisedRefs(MiniGitRef())) {
+      if (tips_.insert(hash).second) {
+        tip_list_.push_back(hash);
+      }
+    }
+  }
+
+  bool Contains(const std::string &hash) {
+    if (tips_.count(hash)) {
+      return true;
+    }
+    if (bitmaps_) {
+      if (!bits_) {
+        bits_ = bitmaps_->Reachable(tip_list_);
+      }
+      return bitmaps_->Contains(*bits_, hash);
+    }
+    if (!objects_) {
+      objects_.emplace();
+      for (auto &object : EnumerateReachable(store_, tip_list_)) {
+        objects_->insert(std::move(object.hash));
+      }
+    }
+    return objects_->count(hash) > 0;
+  }
+
+private:
+  const ObjectStore &store_;
+  bitmap::PackBitmap *bitmaps_;
+  std::unordered_set<std::string> tips_;
+  std::vector<std::string> tip_list_;
+  std::optional<bitmap::Bitmap> bits_;
+  std::optional<std::unordered_set<std::string>> objects_;
+};
+
+/**
+ * @brief pack 数据的响应体：文件部分交给服务器用 sendfile 发送，
+ *        side-band 时在每段数据前插入帧头
+ */
+class PackBodyStream : public BodyStream {
+public:
+  PackBodyStream(int fd, uint64_t offset, uint64_t size, bool sideband)
+      : fd_(fd), offset_(offset), remaining_(size), size_(size),
+        sideband_(sideband) {}
+  ~PackBodyStream() override { close(fd_); }
+
+  uint64_t Size() const override {
+    return sideband_ ? SidebandSize(size_) : size_;
+  }
+
+  bool Next(BodyChunk &chunk) override {
+    if (remaining_ == 0) {
+      if (sideband_ && !flushed_) {
+        flushed_ = true;
+        chunk.data = "0000";
+        return true;
+      }
+      return false;
+    }
+    uint64_t length =
+        sideband_ ? std::min<uint64_t>(remaining_, kSidebandData) : remaining_;
+    if (sideband_) {
+      chunk.data = SidebandHeader(length);
+    }
+    chunk.fd = fd_;
+    chunk.offset = offset_;
+    chunk.length = length;
+    offset_ += length;
+    remaining_ -= length;
+    return true;
+  }
+
+private:
+  int fd_;
+  uint64_t offset_;
+  uint64_t remaining_;
+  uint64_t size_;
+  bool sideband_;
+  bool flushed_ = false;
+};
+
+HttpResponse TextResponse(int status, const std::string &message) {
+  HttpResponse response;
+  response.status = status;
+  response.body = message + "\n";
+  return response;
+}
+
+} // namespace
+
+std::string PktLine(std::string_view payload) {
+  static const char kHex[] = "0123456789abcdef";
+  size_t length = payload.size() + 4;
+  if (length > kMaxPktLine) {
+    throw std::runtime_error("upload-pack: pkt-line too long");
+  }
+  std::string line(4, '0');
+  for (int i = 3; i >= 0; i--) {
+    line[i] = kHex[length & 0xF];
+    length >>= 4;
+  }
+  line.append(payload);
+  return line;
+}
+
+bool NextPktLine(std::string_view &input, std::string &payload) {
+  if (input.size() < 4) {
+    throw std::runtime_error("upload-pack: truncated pkt-line");
+  }
+  size_t length = 0;
+  for (int i = 0; i < 4; i++) {
+    char c = input[i];
+    int digit = c >= '0' && c <= '9'   ? c - '0'
+                : c >= 'a' && c <= 'f' ? c - 'a' + 10
+                : c >= 'A' && c <= 'F' ? c - 'A' + 10
+                                       : -1;
+    if (digit < 0) {
+      throw std::runtime_error("upload-pack: bad pkt-line length");
+    }
+    length = length * 16 + digit;
+  }
+  if (length == 0) {
+    input.remove_prefix(4);
+    payload.clear();
+    return false;
+  }
+  if (length < 4 || length > input.size()) {
+    throw std::runtime_error("upload-pack: truncated pkt-line");
+  }
+  payload.assign(input.substr(4, length - 4));
+  input.remove_prefix(length);
+  return true;
+}
+
+UploadRequest ParseUploadRequest(std::string_view body) {
+  UploadRequest request;
+  std::string line;
+  while (!body.empty()) {
+    if (!NextPktLine(body, line)) {
+      continue; // want 列表与 have 列表之间的 flush
+    }
+    if (!line.empty() && line.back() == '\n') {
+      line.pop_back();
+    }
+    if (line.starts_with("want ")) {
+      std::string hash = line.substr(5, 40);
+      if (!IsHexHash(hash)) {
+        throw std::runtime_error("upload-pack: bad want line '" + line + "'");
+      }
+      if (request.wants.empty()) {
+        size_t pos = 45;
+        while (pos < line.size()) {
+          size_t end = line.find(' ', pos + 1);
+          std::string cap = line.substr(pos + 1, end - pos - 1);
+          if (!cap.empty()) {
+            request.capabilities.insert(cap);
+          }
+          pos = end;
+        }
+      }
+      request.wants.push_back(hash);
+    } else if (line.starts_with("have ")) {
+      std::string hash = line.substr(5, 40);
+      if (!IsHexHash(hash)) {
+        throw std::runtime_error("upload-pack: bad have line '" + line + "'");
+      }
+      request.haves.push_back(hash);
+    } else if (line == "done") {
+      request.done = true;
+    } else if (line.starts_with("filter ")) {
+      request.filter = line.substr(7);
+    } else if (!line.starts_with("deepen") && !line.starts_with("shallow")) {
+      throw std::runtime_error("upload-pack: unexpected line '" + line + "'");
+    }
+  }
+  return request;
+}
+
+uint64_t SidebandSize(uint64_t pack_size) {
+  uint64_t frames = (pack_size + kSidebandData - 1) / kSidebandData;
+  return pack_size + frames * 5 + 4;
+}
+
+std::string SidebandHeader(size_t length) {
+  static const char kHex[] = "0123456789abcdef";
+  if (length == 0 || length > kSidebandData) {
+    throw std::runtime_error("upload-pack: bad side-band frame length");
+  }
+  size_t pkt_length = length + 5;
+  std::string header(5, '\1');
+  for (int i = 3; i >= 0; i--) {
+    header[i] = kHex[pkt_length & 0xF];
+    pkt_length >>= 4;
+  }
+  return header;
+}
+
+UploadPack::UploadPack(fs::path git_dir, pack::PackWriteOptions options)
+    : git_dir_(std::move(git_dir)), options_(options) {}
+
+std::string UploadPack::AdvertiseRefs() const {
+  MiniGitRef refs;
+  auto advertised = AdvertisedRefs(refs);
+  std::string capabilities = kCapabilities;
+  if (!advertised.empty() && advertised[0].second == "HEAD") {
+    capabilities = "symref=HEAD:refs/heads/" + refs.GetCurrentBranchName() +
+                   " " + capabilities;
+  }
+  if (advertised.empty()) {
+    // 空仓库也要发送能力列表
+    advertised.emplace_back(std::string(40, '0'), "capabilities^{}");
+  }
+
+  std::string body = PktLine("# service=git-upload-pack\n") + "0000";
+  for (size_t i = 0; i < advertised.size(); i++) {
+    std::string line = advertised[i].first + " " + advertised[i].second;
+    if (i == 0) {
+      line += '\0' + capabilities;
+    }
+    body += PktLine(line + "\n");
+  }
+  body += "0000";
+  TRACE_COUNT("advertised_refs", advertised.size());
+  return body;
+}
+
+UploadResult UploadPack::Process(const UploadRequest &request) const {
+  TRACE_SPAN("upload-pack");
+  ObjectStore store(git_dir_);
+  if (request.wants.empty()) {
+    throw std::runtime_error("upload-pack: no want lines");
+  }
+  if (!request.filter.empty() && request.filter != "blob:none") {
+    throw std::runtime_error("upload-pack: unsupported filter '" +
+                             request.filter + "'");
+  }
+  // 只接受从公布的引用可达的提交和 blob（部分克隆的客户端补取缺少的文件
+  // 内容）；其他对象即使存在也不发送
+  auto bitmaps = bitmap::PackBitmap::Open(store);
+  ReachableFromRefs reachable(store, bitmaps.get());
+  std::vector<std::string> wants;
+  std::vector<pack::PackInput> wanted_blobs;
+  for (const auto &want : request.wants) {
+    auto header = store.ReadHeader(want);
+    if (!header || (header->first != ObjectType::kCommit &&
+                    header->first != ObjectType::kBlob) ||
+        !reachable.Contains(want)) {
+      throw std::runtime_error("upload-pack: not our ref " + want);
+    }
+    if (header->first == ObjectType::kCommit) {
+      wants.push_back(want);
+    } else {
+      wanted_blobs.push_back({want, ObjectType::kBlob, header->second});
+    }
+  }
+  TRACE_COUNT("upload_pack_wanted_blobs", wanted_blobs.size());
+  // 客户端已有、且本地也存在的提交
+  std::vector<std::string> common;
+  for (const auto &have : request.haves) {
+    auto header = store.ReadHeader(have);
+    if (header && header->first == ObjectType::kCommit) {
+      common.push_back(have);
+    }
+  }
+  TRACE_COUNT("upload_pack_common", common.size());
+
+  UploadResult result;
+  bool multi_ack = request.capabilities.count("multi_ack_detailed") > 0;
+  if (!request.done) {
+    // 还在协商：告诉客户端哪些 have 是共同的。找到共同提交就宣布 ready，
+    // 客户端随即发送 done；剩余的差异由 pack 覆盖，只是可能多发一些对象
+    if (multi_ack) {
+      for (const auto &hash : common) {
+        result.negotiation += PktLine("ACK " + hash + " common\n");
+      }
+      if (!common.empty()) {
+        result.negotiation += PktLine("ACK " + common.back() + " ready\n");
+      }
+      result.negotiation += PktLine("NAK\n");
+    } else {
+      result.negotiation += common.empty()
+                                ? PktLine("NAK\n")
+                                : PktLine("ACK " + common.front() + "\n");
+    }
+    return result;
+  }
+  result.negotiation += common.empty()
+                            ? PktLine("NAK\n")
+                            : PktLine("ACK " + common.back() + "\n");
+
+  result.send_pack = true;
+  result.sideband = request.capabilities.count("side-band-64k") > 0;
+  bool ofs_delta = request.capabilities.count("ofs-delta") > 0;
+
+  // 已有 pack 只用 OFS_DELTA，因此只有支持 ofs-delta 的客户端才能直接复用
+  std::vector<pack::PackInput> objects;
+  const pack::PackFile *reusable = nullptr;
+  // 只有完整的对象集合才可能与已有 pack 相同
+  bool whole = request.filter.empty() && wanted_blobs.empty();
+  bitmap::Bitmap bits;
+  if (wants.empty()) {
+    // 只补取 blob
+  } else if (bitmaps) {
+    // 有位图时集合差就是两个位图相减，不必遍历全部历史
+    bits = bitmaps->Reachable(wants);
+    if (!common.empty()) {
+      bits.AndNot(bitmaps->Reachable(common));
+    }
+    result.objects = bits.Count();
+    if (whole && ofs_delta && bitmaps->IsWholePack(bits)) {
+      reusable = &bitmaps->Pack();
+    } else {
+      objects = bitmaps->Objects(bits);
+    }
+  } else {
+    objects = EnumerateReachable(store, wants);
+    if (!common.empty()) {
+      std::unordered_set<std::string> have_objects;
+      for (auto &object : EnumerateReachable(store, common)) {
+        have_objects.insert(std::move(object.hash));
+      }
+      std::erase_if(objects, [&have_objects](const pack::PackInput &object) {
+        return have_objects.count(object.hash) > 0;
+      });
+    }
+    result.objects = objects.size();
+    reusable = whole && ofs_delta ? FindReusablePack(store, objects) : nullptr;
+  }
+  if (!whole) {
+    // filter blob:none：只发送提交和 tree
+    if (!request.filter.empty()) {
+      std::erase_if(objects, [](const pack::PackInput &object) {
+        return object.type == ObjectType::kBlob;
+      });
+    }
+    objects.insert(objects.end(), wanted_blobs.begin(), wanted_blobs.end());
+    result.objects = objects.size();
+  }
+  TRACE_COUNT("upload_pack_objects", result.objects);
+
+  if (const pack::PackFile *packfile = reusable) {
+    int fd = open(packfile->PackPath().c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd >= 0 && fstat(fd, &st) == 0) {
+      result.pack_fd = fd;
+      result.pack_size = st.st_size;
+      result.reused = true;
+      TRACE_INSTANT("upload-pack reuse", packfile->Checksum());
+      return result;
+    }
+    if (fd >= 0) {
+      close(fd);
+    }
+    if (bitmaps && objects.empty()) {
+      objects = bitmaps->Objects(bits);
+    }
+  }
+
+  // 其余情况逐个对象复用已有 pack 中的数据，只有松散对象需要压缩
+  pack::PackWriteOptions options = options_;
+  options.ofs_delta = ofs_delta;
+  for (const auto &packfile : store.Packs()) {
+    options.reuse.push_back(packfile.get());
+  }
+  int fd = CreateAnonymousFile();
+  try {
+    pack::WritePackStream(
+        fd, objects,
+        [&store](const std::string &hash) {
+          auto object = store.Read(hash);
+          if (!object) {
+            throw std::runtime_error("upload-pack: missing object " + hash);
+          }
+          return std::move(*object);
+        },
+        options);
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+      throw std::runtime_error("upload-pack: fstat failed");
+    }
+    result.pack_fd = fd;
+    result.pack_size = st.st_size;
+  } catch (...) {
+    close(fd);
+    throw;
+  }
+  return result;
+}
+
+HttpServer::Handler HttpHandler(fs::path git_dir,
+                                pack::PackWriteOptions options) {
+  return [git_dir, options](HttpRequest &request) {
+    UploadPack upload(git_dir, options);
+    if (request.path.ends_with("/info/refs")) {
+      if (request.method != "GET") {
+        return TextResponse(405, "method not allowed");
+      }
+      if (request.query.find("service=git-upload-pack") == std::string::npos) {
+        // 没有 service 参数的是 dumb HTTP 客户端，receive-pack 是 push
+        return TextResponse(403, "only smart HTTP upload-pack is served");
+      }
+      HttpResponse response;
+      response.content_type = "application/x-git-upload-pack-advertisement";
+      response.body = upload.AdvertiseRefs();
+      return response;
+    }
+    if (request.path.ends_with("/git-receive-pack")) {
+      return TextResponse(403, "this server is read-only");
+    }
+    if (!request.path.ends_with("/git-upload-pack")) {
+      return TextResponse(404, "not found");
+    }
+    if (request.method != "POST") {
+      return TextResponse(405, "method not allowed");
+    }
+
+    HttpResponse response;
+    response.content_type = "application/x-git-upload-pack-result";
+    UploadResult result;
+    try {
+      result = upload.Process(ParseUploadRequest(request.body));
+    } catch (const std::runtime_error &e) {
+      // 协议层面的错误以 ERR 行告诉客户端
+      response.body = PktLine(std::string("ERR ") + e.what() + "\n");
+      return response;
+    }
+    response.body = std::move(result.negotiation);
+    if (result.send_pack) {
+      response.stream = std::make_unique<PackBodyStream>(
+          result.pack_fd, result.pack_offset, result.pack_size,
+          result.sideband);
+    }
+    return response;
+  };
+}
+
+} // namespace upload_pack
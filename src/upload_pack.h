@@ -0,0 +1,140 @@
+#pragma once
+
+#include "http_server.h"
+#include "pack.h"
+#include <cstdint>
+#include <filesystem>
+#include <set>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * @brief 服务端 upload-pack（Git 智能 HTTP 协议 v0，无状态 RPC）
+ *
+ * 客户端先 GET /info/refs?service=git-upload-pack 获取引用列表：
+ *
+ *   001e# service=git-upload-pack\n
+ *   0000
+ *   <hash> HEAD\0<能力列表>\n      ← 第一行带上能力
+ *   <hash> refs/heads/main\n
+ *   0000
+ *
+ * 然后 POST /git-upload-pack 发送协商请求，每一行都是 pkt-line：
+ *
+ *   want <hash> <客户端选择的能力>\n    ← 只有第一个 want 带能力
+ *   want <hash>\n
+ *   0000
+ *   have <hash>\n                       ← 客户端已有的提交，可以没有
+ *   done\n                              ← 没有 done 时只回复协商结果
+ *
+ * 无状态 RPC 下每个请求都携带全部 want 和已确认的 have。服务端使用
+ * multi_ack_detailed：对本地存在的 have 回复 "ACK <hash> common"，
+ * 找到共同提交后再回复 "ACK <hash> ready" 让客户端结束协商，最后以 NAK 结束。
+ * 收到 done 后回复最后一个共同提交的 ACK（或 NAK），紧接着发送 pack：
+ * 只包含从 want 可达、但从共同提交不可达的对象。仓库的 pack 带有可达性
+ * 位图（repack -a -b）时，这个集合由位图相减得到（见 bitmap.h）。
+ *
+ * 客户端请求了 side-band-64k 时，pack 数据被切成带通道号 1 的 pkt-line，
+ * 最后以 0000 结束。
+ *
+ * 部分克隆：want 列表之后的 "filter blob:none" 让 pack 中只有提交和 tree；
+ * 之后客户端可以直接 want 缺少的 blob，pack 中只有这些 blob。
+ */
+namespace upload_pack {
+
+// 每个 pkt-line 的最大长度（含4字节长度前缀）
+constexpr size_t kMaxPktLine = 65520;
+
+// "<4位十六进制长度><payload>"
+std::string PktLine(std::string_view payload);
+
+/**
+ * @brief 从 input 开头取出一个 pkt-line 并前移 input
+ * @param payload 输出内容（不含长度前缀）
+ * @return flush-pkt（0000）时返回 false
+ * @throws std::runtime_error 长度前缀非法或数据被截断
+ */
+bool NextPktLine(std::string_view &input, std::string &payload);
+
+struct UploadRequest {
+  std::vector<std::string> wants;
+  std::vector<std::string> haves;
+  std::set<std::string> capabilities;
+  std::string filter; // "filter <条件>" 行，目前只支持 "blob:none"
+  bool done = false;
+};
+
+/**
+ * @brief 解析 POST /git-upload-pack 的请求体
+ * @throws std::runtime_error 格式错误或哈希非法
+ */
+UploadRequest ParseUploadRequest(std::string_view body);
+
+// 协商结果以及要发送的 pack
+struct UploadResult {
+  std::string negotiation; // ACK/NAK 等 pkt-line
+  bool send_pack = false;  // 收到 done 后为 true
+  bool sideband = false;   // pack 数据需要按 side-band-64k 分帧
+  int pack_fd = -1;        // 只读的 pack 数据，由调用者关闭
+  uint64_t pack_offset = 0;
+  uint64_t pack_size = 0;
+  size_t objects = 0;
+  bool reused = false; // 直接发送了仓库中已有的 pack 文件
+};
+
+// pack 数据经过 side-band-64k 分帧（含结尾的 0000）后的长度
+uint64_t SidebandSize(uint64_t pack_size);
+
+/**
+ * @brief side-band 通道 1 的帧头（pkt-line 长度 + 通道号），后面紧跟
+ *        length 字节 pack 数据
+ * @param length 1 到 kMaxPktLine - 5
+ */
+std::string SidebandHeader(size_t length);
+
+/**
+ * @brief 以 git_dir 所在仓库为数据源的 upload-pack
+ *
+ * 每个请求构造一个实例即可；引用通过 MiniGitRef 读取，因此 git_dir 应为
+ * 当前目录下的 .git。
+ */
+class UploadPack {
+public:
+  explicit UploadPack(std::filesystem::path git_dir = ".git",
+                      pack::PackWriteOptions options = {});
+
+  // GET /info/refs?service=git-upload-pack 的完整响应体
+  std::string AdvertiseRefs() const;
+
+  /**
+   * @brief 处理一次协商请求
+   *
+   * 需要的对象恰好是某个已有 pack 的全部对象、且客户端支持 ofs-delta 时，
+   * 直接发送该 pack 文件；否则用 pack::WritePackStream 生成到临时文件，
+   * 已在 pack 中的对象原样复制（见 PackWriteOptions::reuse），不支持
+   * ofs-delta 的客户端得到改写成 REF_DELTA 的 delta。
+   *
+   * want 只能是从公布的引用（HEAD 和各分支）可达的提交或 blob，其他对象
+   * 即使存在也以 "not our ref" 拒绝。
+   *
+   * @throws std::runtime_error want 的对象不可达或不存在，或生成 pack 失败
+   */
+  UploadResult Process(const UploadRequest &request) const;
+
+private:
+  std::filesystem::path git_dir_;
+  pack::PackWriteOptions options_;
+};
+
+/**
+ * @brief 智能 HTTP 的请求处理函数，交给 HttpServer 使用
+ *
+ * 服务 git_dir 所在的一个仓库，URL 中 info/refs 和 git-upload-pack 之前的
+ * 路径被忽略，因此 http://host:port/ 与 http://host:port/repo.git 都可以克隆。
+ * 只读：receive-pack（push）返回 403。
+ */
+HttpServer::Handler HttpHandler(std::filesystem::path git_dir,
+                                pack::PackWriteOptions options = {});
+
+} // namespace upload_pack
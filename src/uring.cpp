@@ -0,0 +1,157 @@
+#include "uring.h"
+#include <algorithm>
+#include <cerrno>
+#include <stdexcept>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+
+int Setup(unsigned entries, io_uring_params *params) {
+  return static_cast<int>(syscall(__NR_io_uring_setup, entries, params));
+}
+
+int Enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+  return static_cast<int>(syscall(__NR_io_uring_enter, fd, to_submit,
+                                  min_complete, flags, nullptr, 0));
+}
+
+int Register(int fd, unsigned opcode, void *arg, unsigned count) {
+  return static_cast<int>(
+      syscall(__NR_io_uring_register, fd, opcode, arg, count));
+}
+
+template <typename T> T *At(void *base, uint32_t offset) {
+  return reinterpret_cast<T *>(static_cast<char *>(base) + offset);
+}
+
+} // namespace
+
+std::unique_ptr<IoUring> IoUring::Create(unsigned entries,
+                                         std::initializer_list<uint8_t> ops) {
+  io_uring_params params{};
+  int fd = Setup(entries, &params);
+  if (fd < 0) {
+    return nullptr;
+  }
+  std::unique_ptr<IoUring> ring(new IoUring());
+  ring->fd_ = fd;
+
+  // 确认需要的操作都被支持（IORING_OP_OPENAT 等需要 5.6 以上的内核）
+  size_t probe_size = sizeof(io_uring_probe) + 256 * sizeof(io_uring_probe_op);
+  std::vector<char> probe_buffer(probe_size, 0);
+  auto *probe = reinterpret_cast<io_uring_probe *>(probe_buffer.data());
+  if (Register(fd, IORING_REGISTER_PROBE, probe, 256) < 0) {
+    return nullptr;
+  }
+  for (uint8_t op : ops) {
+    if (op > probe->last_op ||
+        !(probe->ops[op].flags & IO_URING_OP_SUPPORTED)) {
+      return nullptr;
+    }
+  }
+
+  ring->sq_ring_size_ =
+      params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  ring->cq_ring_size_ =
+      params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+  bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+  if (single_mmap) {
+    ring->sq_ring_size_ = ring->cq_ring_size_ =
+        std::max(ring->sq_ring_size_, ring->cq_ring_size_);
+  }
+  ring->sq_ring_ = mmap(nullptr, ring->sq_ring_size_, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+  if (ring->sq_ring_ == MAP_FAILED) {
+    ring->sq_ring_ = nullptr;
+    return nullptr;
+  }
+  if (single_mmap) {
+    ring->cq_ring_ = ring->sq_ring_;
+  } else {
+    ring->cq_ring_ = mmap(nullptr, ring->cq_ring_size_, PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    if (ring->cq_ring_ == MAP_FAILED) {
+      ring->cq_ring_ = nullptr;
+      return nullptr;
+    }
+  }
+  ring->sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+  void *sqes = mmap(nullptr, ring->sqes_size_, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+  if (sqes == MAP_FAILED) {
+    return nullptr;
+  }
+  ring->sqes_ = static_cast<io_uring_sqe *>(sqes);
+
+  ring->sq_head_ = At<unsigned>(ring->sq_ring_, params.sq_off.head);
+  ring->sq_tail_ = At<unsigned>(ring->sq_ring_, params.sq_off.tail);
+  ring->sq_array_ = At<unsigned>(ring->sq_ring_, params.sq_off.array);
+  ring->sq_mask_ = *At<unsigned>(ring->sq_ring_, params.sq_off.ring_mask);
+  ring->sq_entries_ = params.sq_entries;
+  ring->cq_head_ = At<unsigned>(ring->cq_ring_, params.cq_off.head);
+  ring->cq_tail_ = At<unsigned>(ring->cq_ring_, params.cq_off.tail);
+  ring->cq_mask_ = *At<unsigned>(ring->cq_ring_, params.cq_off.ring_mask);
+  ring->cqes_ = At<io_uring_cqe>(ring->cq_ring_, params.cq_off.cqes);
+  return ring;
+}
+
+IoUring::~IoUring() {
+  if (sqes_) {
+    munmap(sqes_, sqes_size_);
+  }
+  if (cq_ring_ && cq_ring_ != sq_ring_) {
+    munmap(cq_ring_, cq_ring_size_);
+  }
+  if (sq_ring_) {
+    munmap(sq_ring_, sq_ring_size_);
+  }
+  if (fd_ >= 0) {
+    close(fd_);
+  }
+}
+
+io_uring_sqe *IoUring::NextSqe() {
+  if (pending_ == sq_entries_) {
+    return nullptr;
+  }
+  // 只有本线程写 tail，不需要原子读
+  unsigned index = (*sq_tail_ + pending_) & sq_mask_;
+  io_uring_sqe *sqe = &sqes_[index];
+  memset(sqe, 0, sizeof(*sqe));
+  sq_array_[index] = index;
+  pending_++;
+  return sqe;
+}
+
+void IoUring::SubmitAndWait(
+    const std::function<void(uint64_t, int)> &on_complete) {
+  unsigned to_submit = pending_;
+  unsigned remaining = pending_;
+  pending_ = 0;
+  __atomic_store_n(sq_tail_, *sq_tail_ + to_submit, __ATOMIC_RELEASE);
+
+  while (remaining > 0) {
+    int ret = Enter(fd_, to_submit, remaining, IORING_ENTER_GETEVENTS);
+    if (ret < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      throw std::runtime_error(std::string("io_uring_enter: ") +
+                               strerror(errno));
+    }
+    to_submit -= std::min<unsigned>(to_submit, ret);
+
+    unsigned head = *cq_head_;
+    unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+    for (; head != tail; head++) {
+      const io_uring_cqe &cqe = cqes_[head & cq_mask_];
+      on_complete(cqe.user_data, cqe.res);
+      remaining--;
+    }
+    __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+  }
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <linux/io_uring.h>
+#include <memory>
+
+/**
+ * @brief io_uring 的最小封装，直接使用系统调用，不依赖 liburing
+ *
+ * 用法：多次 NextSqe() 填好请求，再调用 SubmitAndWait() 一次提交并等待
+ * 全部完成。一批请求只需要一两次 io_uring_enter，而不是每个操作一次
+ * 系统调用。同一批内的请求可能以任意顺序执行。
+ *
+ * 内核不支持 io_uring、被禁用（/proc/sys/kernel/io_uring_disabled）或被
+ * seccomp 拦截时 Create() 返回 nullptr，调用方应退回普通的系统调用。
+ */
+class IoUring {
+public:
+  /**
+   * @param entries 一批最多的请求数
+   * @param ops 需要用到的操作（IORING_OP_*），有一个不支持就返回 nullptr
+   */
+  static std::unique_ptr<IoUring> Create(unsigned entries,
+                                         std::initializer_list<uint8_t> ops);
+  ~IoUring();
+  IoUring(const IoUring &) = delete;
+  IoUring &operator=(const IoUring &) = delete;
+
+  // 一批最多的请求数
+  unsigned Capacity() const { return sq_entries_; }
+
+  // 取一个清零的 SQE；本批已满时返回 nullptr
+  io_uring_sqe *NextSqe();
+
+  /**
+   * @brief 提交本批全部请求并等待完成，对每个完成事件调用
+   *        on_complete(user_data, res)
+   * @throws std::runtime_error io_uring_enter 失败
+   */
+  void SubmitAndWait(const std::function<void(uint64_t, int)> &on_complete);
+
+private:
+  IoUring() = default;
+
+  int fd_ = -1;
+  void *sq_ring_ = nullptr;
+  void *cq_ring_ = nullptr;
+  size_t sq_ring_size_ = 0;
+  size_t cq_ring_size_ = 0;
+  io_uring_sqe *sqes_ = nullptr;
+  size_t sqes_size_ = 0;
+
+  unsigned *sq_head_ = nullptr;
+  unsigned *sq_tail_ = nullptr;
+  unsigned *sq_array_ = nullptr;
+  unsigned sq_mask_ = 0;
+  unsigned sq_entries_ = 0;
+  unsigned *cq_head_ = nullptr;
+  unsigned *cq_tail_ = nullptr;
+  unsigned cq_mask_ = 0;
+  io_uring_cqe *cqes_ = nullptr;
+
+  unsigned pending_ = 0; // 已取出、尚未提交的 SQE 数
+};
@@ -1,6 +1,7 @@
 #include <gtest/gtest.h>
 #include <string>
 #include "../include/clone_gadget.h"
+#include "../src/delta.h"
 
 // 测试 apply_delta 函数的测试夹具类
 // 
@@ -24,13 +25,57 @@ protected:
         // 这里可以添加资源清理代码
     }
 
+    // 辅助函数：写入 delta 头部使用的变长整数（每字节7位，小端序）
+    static void putSize(std::string& delta, size_t size) {
+        while (size >= 0x80) {
+            delta.push_back(static_cast<char>((size & 0x7F) | 0x80));
+            size >>= 7;
+        }
+        delta.push_back(static_cast<char>(size));
+    }
+
+    // 辅助函数：写入只带1字节偏移和1字节长度的 COPY 指令
+    static void putCopy(std::string& delta, unsigned char offset,
+                        unsigned char size) {
+        delta.push_back(static_cast<char>(0x91)); // b0：偏移量1字节，b4：长度1字节
+        delta.push_back(static_cast<char>(offset));
+        delta.push_back(static_cast<char>(size));
+    }
+
     // 辅助函数：创建简单的 delta 数据
     // 注意：这些成员函数可以在 TEST_F 中直接调用，因为 TEST_F 会自动创建类实例
+    // 生成方式：COPY 公共前缀 + ADD 中间不同的部分 + COPY 公共后缀
     std::string createSimpleDelta(const std::string& base_content, 
                                   const std::string& target_content) {
-        // 这里可以添加创建 delta 数据的逻辑
-        // 例如：根据基础内容和目标内容的差异生成 delta 数据
-        return "";
+        size_t prefix = 0;
+        while (prefix < base_content.size() && prefix < target_content.size() &&
+               prefix < 255 && base_content[prefix] == target_content[prefix]) {
+            prefix++;
+        }
+        size_t suffix = 0;
+        while (suffix < base_content.size() - prefix &&
+               suffix < target_content.size() - prefix && suffix < 255 &&
+               base_content[base_content.size() - 1 - suffix] ==
+                   target_content[target_content.size() - 1 - suffix]) {
+            suffix++;
+        }
+        std::string delta;
+        putSize(delta, base_content.size());
+        putSize(delta, target_content.size());
+        if (prefix > 0) {
+            putCopy(delta, 0, prefix);
+        }
+        std::string middle =
+            target_content.substr(prefix, target_content.size() - prefix - suffix);
+        for (size_t i = 0; i < middle.size(); i += 127) {
+            std::string chunk = middle.substr(i, 127);
+            delta.push_back(static_cast<char>(chunk.size()));
+            delta += chunk;
+        }
+        if (suffix > 0) {
+            putCopy(delta, base_content.size() - suffix, suffix);
+        }
+        return delta;
     }
 
     // 辅助函数：验证重建的内容是否正确
@@ -106,14 +151,16 @@ TEST_F(ApplyDeltaTest, SimpleCopyInstruction) {
     // 创建包含 COPY 指令的 delta 数据
     // COPY 指令格式：1xxxxxxx + 偏移量 + 长度
     std::string delta_contents;
-    delta_contents.push_back(0x80); // COPY 指令，无偏移量和长度参数
+    putSize(delta_contents, 11); // base_len
+    putSize(delta_contents, 11); // target_len
+    delta_contents.push_back(0x90); // COPY 指令，省略偏移量（即0），长度1字节
+    delta_contents.push_back(0x0B); // 长度 11
     
     // Act
     std::string result = apply_delta(delta_contents, base_contents);
     
     // Assert
-    // 根据实现，可能需要调整期望值
-    EXPECT_TRUE(result.empty() || result == base_contents);
+    EXPECT_EQ(result, base_contents);
 }
 
 // 复杂场景测试：COPY 和 ADD 指令组合
@@ -123,9 +170,11 @@ TEST_F(ApplyDeltaTest, CopyAndAddInstructions) {
     
     // 创建包含 COPY 和 ADD 指令的 delta 数据
     std::string delta_contents;
+    putSize(delta_contents, 11); // base_len
+    putSize(delta_contents, 9);  // target_len
     
     // 先 COPY "Hello"
-    delta_contents.push_back(0x83); // COPY 指令，包含偏移量和长度
+    delta_contents.push_back(0x91); // COPY 指令，包含偏移量和长度
     delta_contents.push_back(0x00); // 偏移量 0
     delta_contents.push_back(0x05); // 长度 5
     
@@ -147,12 +196,14 @@ TEST_F(ApplyDeltaTest, CopyOutOfBounds) {
     
     // 创建尝试 COPY 超出范围的数据
     std::string delta_contents;
-    delta_contents.push_back(0x83); // COPY 指令
+    putSize(delta_contents, 5);     // base_len
+    putSize(delta_contents, 255);   // target_len
+    delta_contents.push_back(0x91); // COPY 指令
     delta_contents.push_back(0x00); // 偏移量 0
     delta_contents.push_back(0xFF); // 长度 255 (超出基础内容)
     
     // Act & Assert
-    // 应该抛出异常或返回空字符串，具体取决于实现
+    // 越界的 COPY 必须抛出异常，不能读取基础内容之外的内存
     EXPECT_THROW({
         apply_delta(delta_contents, base_contents);
     }, std::exception);
@@ -177,8 +228,10 @@ TEST_F(ApplyDeltaTest, LargeFileDelta) {
     std::string delta_contents;
     
     // 创建修改大文件的 delta
-    delta_contents.push_back(0x82); // COPY 指令，有偏移量
-    delta_contents.push_back(0x00); // 偏移量 0
+    putSize(delta_contents, large_base.size()); // base_len
+    putSize(delta_contents, 0x80);              // target_len
+    delta_contents.push_back(0x92); // COPY 指令，偏移量第2字节 + 长度1字节
+    delta_contents.push_back(0x01); // 偏移量 0x100
     delta_contents.push_back(0x80); // 长度 0x80
     
     // Act
@@ -195,9 +248,8 @@ TEST_F(ApplyDeltaTest, RealGitDeltaScenario) {
     std::string base_content = "line1\nline2\nline3\n";
     std::string target_content = "line1\nmodified line2\nline3\n";
     
-    // 这里应该创建真实的 Git delta 数据
-    // 由于创建真实的 delta 比较复杂，这里用简化的版本
-    std::string delta_contents;
+    // 用夹具类的辅助函数创建 delta：COPY "line1\n" + ADD + COPY "line2\nline3\n"
+    std::string delta_contents = createSimpleDelta(base_content, target_content);
     
     // Act
     std::string result = apply_delta(delta_contents, base_content);
@@ -229,9 +281,6 @@ TEST_F(ApplyDeltaTest, DemonstrateFixtureUsage) {
     bool is_correct = verifyReconstructedContent(target_content, result);
     EXPECT_TRUE(is_correct);
     
-    // 注意：在这个简单的例子中，createSimpleDelta 返回空字符串，
-    // 所以 result 会是空字符串，验证会失败
-    // 这演示了测试夹具的使用方式，实际使用时需要完善辅助函数
 }
 
 // 参数验证测试：确保函数参数处理正确
@@ -239,23 +288,84 @@ TEST_F(ApplyDeltaTest, ParameterValidation) {
     // Test nullptr 或空字符串处理
     EXPECT_NO_THROW({
         apply_delta("", "");
-        apply_delta("delta", "");
         apply_delta("", "base");
     });
+    // "delta" 的头部声明基础长度为 100，与空的基础内容不符
+    EXPECT_THROW(apply_delta("delta", ""), std::runtime_error);
 }
 
 // 内存管理测试：确保没有内存泄漏
 TEST_F(ApplyDeltaTest, MemoryManagement) {
     // 多次调用函数，检查是否有内存问题
+    std::string delta = createSimpleDelta("base", "base case");
     for (int i = 0; i < 1000; ++i) {
-        std::string result = apply_delta("delta", "base");
+        std::string result = apply_delta(delta, "base");
         // 如果函数有内存泄漏，这里可能会崩溃或占用过多内存
+        ASSERT_EQ(result, "base case");
     }
     
     // 如果没有崩溃，说明内存管理基本正确
     EXPECT_TRUE(true);
 }
 
+// 边界条件测试：长度为0的 COPY 表示 0x10000 字节
+TEST_F(ApplyDeltaTest, CopySizeZeroMeans64K) {
+    std::string base(0x10000 + 10, 'x');
+    base[0x10000 - 1] = 'y';
+    std::string delta;
+    putSize(delta, base.size());
+    putSize(delta, 0x10000);
+    delta.push_back(static_cast<char>(0x80)); // 偏移量和长度都省略
+    
+    std::string result = apply_delta(delta, base);
+    
+    ASSERT_EQ(result.size(), 0x10000u);
+    EXPECT_EQ(result.back(), 'y');
+}
+
+// 边界条件测试：头部声明的基础长度与实际不符
+TEST_F(ApplyDeltaTest, BaseSizeMismatch) {
+    std::string delta = createSimpleDelta("Hello World", "Hello C++ World");
+    EXPECT_THROW(apply_delta(delta, "Hello"), std::runtime_error);
+}
+
+// 边界条件测试：ADD 指令的数据被截断
+TEST_F(ApplyDeltaTest, TruncatedAddData) {
+    std::string delta;
+    putSize(delta, 0);
+    putSize(delta, 10);
+    delta.push_back(0x0A);
+    delta += "short";
+    EXPECT_THROW(apply_delta(delta, ""), std::runtime_error);
+}
+
+// 边界条件测试：指令产生的数据超过头部声明的目标长度
+TEST_F(ApplyDeltaTest, OutputExceedsTargetSize) {
+    std::string delta;
+    putSize(delta, 11);
+    putSize(delta, 3);
+    putCopy(delta, 0, 5);
+    EXPECT_THROW(apply_delta(delta, "Hello World"), std::runtime_error);
+}
+
+// 直接写入调用者提供的缓冲区（例如 arena）
+TEST_F(ApplyDeltaTest, ApplyIntoCallerBuffer) {
+    std::string base = "Hello World";
+    std::string delta = createSimpleDelta(base, "Hello C++ World");
+    DeltaHeader header = parse_delta_header(delta.data(), delta.size());
+    ASSERT_EQ(header.target_size, 15u);
+    
+    char arena[64];
+    size_t written = apply_delta_into(delta.data(), delta.size(), base.data(),
+                                      base.size(), arena, sizeof(arena));
+    EXPECT_EQ(std::string(arena, written), "Hello C++ World");
+    
+    // 缓冲区不足时拒绝写入
+    EXPECT_THROW(apply_delta_into(delta.data(), delta.size(), base.data(),
+                                  base.size(), arena, 8),
+                 std::runtime_error);
+}
+
 // 主函数，用于运行所有测试
 int main(int argc, char **argv) {
     ::testing::InitGoogleTest(&argc, argv);
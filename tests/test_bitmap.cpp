@@ -0,0 +1,268 @@
+#include <gtest/gtest.h>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <random>
+#include <set>
+#include <string>
+#include <unistd.h>
+#include <vector>
+#include "../include/clone_gadget.h"
+#include "../src/bitmap.h"
+#include "../src/object_store.h"
+#include "../src/refs.h"
+#include "../src/repack.h"
+#include "../src/upload_pack.h"
+#include "test_util.h"
+
+namespace fs = std::filesystem;
+
+// 仓库历史是一条主线和若干分支、合并
+class BitmapTest : public TempRepoTest {
+protected:
+    BitmapTest() : TempRepoTest("bitmap") {}
+
+    void SetUp() override {
+        TempRepoTest::SetUp();
+        MiniGitRef().Init();
+    }
+
+    // 改动工作区中的几个文件后提交，返回提交哈希；不更新引用
+    std::string Commit(const std::vector<std::string> &parents) {
+        int i = counter_++;
+        std::ofstream("f" + std::to_string(i % 7) + ".txt", std::ios::app)
+            << "line " << i << "\n";
+        fs::create_directories("d" + std::to_string(i % 5));
+        std::ofstream("d" + std::to_string(i % 5) + "/x") << i;
+        std::string hash = TempRepoTest::Commit(write_tree("."), parents,
+                                                1600000000 + i,
+                                                "c" + std::to_string(i) + "\n");
+        commits_.push_back(hash);
+        return hash;
+    }
+
+    // main 上 length 个提交，每隔 30 个开一个分支，其中一半再合并回 main
+    void BuildHistory(int length) {
+        MiniGitRef refs;
+        std::string head = Commit({});
+        refs.UpdateCurrentBranch(head);
+        std::vector<std::string> pending_merges;
+        for (int i = 1; i < length; i++) {
+            std::vector<std::string> parents = {head};
+            if (!pending_merges.empty() && i % 7 == 0) {
+                parents.push_back(pending_merges.back());
+                pending_merges.pop_back();
+            }
+            head = Commit(parents);
+            refs.UpdateCurrentBranch(head);
+            if (i % 30 == 0) {
+                std::string name = "topic" + std::to_string(i);
+                refs.CreateBranch(name);
+                std::string side = head;
+                for (int k = 0; k < 3; k++) {
+                    side = Commit({side});
+                }
+                refs.SwitchToBranch(name);
+                refs.UpdateCurrentBranch(side);
+                refs.SwitchToBranch("main");
+                if (i % 60 == 0) {
+                    pending_merges.push_back(side);
+                }
+            }
+        }
+    }
+
+    static std::set<std::string> Hashes(const std::vector<pack::PackInput> &objects) {
+        std::set<std::string> out;
+        for (const auto &object : objects) {
+            out.insert(object.hash);
+        }
+        return out;
+    }
+
+    int counter_ = 0;
+    std::vector<std::string> commits_;
+};
+
+// EWAH 编码与 Git 相同，解码得到原位图
+TEST_F(BitmapTest, EwahRoundTrip) {
+    bitmap::Bitmap single;
+    single.Set(0);
+    std::string encoded;
+    bitmap::EwahEncode(single, encoded);
+    // 位数 1、两个字（标记字：0 个连续字、1 个原样字；原样字 1）、标记字下标 0
+    EXPECT_EQ(encoded, std::string("\0\0\0\1\0\0\0\2"
+                                   "\0\0\0\2\0\0\0\0"
+                                   "\0\0\0\0\0\0\0\1"
+                                   "\0\0\0\0",
+                                   28));
+
+    std::mt19937_64 rng(1);
+    for (int round = 0; round < 200; round++) {
+        bitmap::Bitmap bits;
+        size_t size = rng() % 5000;
+        size_t pos = 0;
+        while (pos < size) {
+            // 交替出现长段的 0、长段的 1 和随机位
+            size_t run = 1 + rng() % 300;
+            int kind = rng() % 3;
+            for (size_t k = 0; k < run && pos < size; k++, pos++) {
+                if (kind == 1 || (kind == 2 && rng() % 2)) {
+                    bits.Set(pos);
+                }
+            }
+        }
+        std::string data = "prefix";
+        bitmap::EwahEncode(bits, data);
+        data += "suffix";
+        size_t consumed = 0;
+        bitmap::Bitmap decoded = bitmap::EwahDecode(
+            reinterpret_cast<const unsigned char *>(data.data()) + 6,
+            data.size() - 6, consumed);
+        EXPECT_EQ(consumed, data.size() - 12);
+        EXPECT_TRUE(decoded == bits);
+        EXPECT_EQ(decoded.Count(), bits.Count());
+    }
+
+    std::string truncated;
+    bitmap::EwahEncode(single, truncated);
+    size_t consumed;
+    EXPECT_THROW(bitmap::EwahDecode(
+                     reinterpret_cast<const unsigned char *>(truncated.data()),
+                     truncated.size() - 1, consumed),
+                 std::runtime_error);
+}
+
+// 位图枚举的结果与完整遍历相同，包括写出位图之后的新提交
+TEST_F(BitmapTest, ReachableMatchesEnumeration) {
+    BuildHistory(250);
+    RepackOptions options;
+    options.all = options.remove_redundant = options.write_bitmap = true;
+    RepackResult repacked = Repack(options);
+    ASSERT_FALSE(repacked.pack_checksum.empty());
+    // 分支和 HEAD，加上主线上每隔一段的提交
+    EXPECT_GT(repacked.bitmaps, 8u);
+    EXPECT_LT(repacked.bitmaps, 30u);
+
+    // 位图之后的新提交只以松散对象存在
+    MiniGitRef refs;
+    std::string head = refs.GetCurrentCommit();
+    for (int i = 0; i < 3; i++) {
+        head = Commit({head});
+    }
+    refs.UpdateCurrentBranch(head);
+
+    ObjectStore store;
+    auto bitmaps = bitmap::PackBitmap::Open(store);
+    ASSERT_NE(bitmaps, nullptr);
+    EXPECT_EQ(bitmaps->Entries(), repacked.bitmaps);
+
+    auto tips = ReachabilityTips(store);
+    auto expected = EnumerateReachable(store, tips);
+    bitmap::Bitmap all = bitmaps->Reachable(tips);
+    EXPECT_EQ(all.Count(), expected.size());
+    EXPECT_FALSE(bitmaps->IsWholePack(all));
+    auto objects = bitmaps->Objects(all);
+    EXPECT_EQ(Hashes(objects), Hashes(expected));
+    std::map<std::string, pack::PackInput> by_hash;
+    for (const auto &object : expected) {
+        by_hash[object.hash] = object;
+    }
+    for (const auto &object : objects) {
+        const auto &want = by_hash[object.hash];
+        EXPECT_EQ(object.type, want.type) << object.hash;
+        EXPECT_EQ(object.size, want.size) << object.hash;
+        EXPECT_EQ(object.name_hash, want.name_hash) << object.hash;
+    }
+
+    // 任意两个提交的集合差
+    std::mt19937 pick(3);
+    for (int round = 0; round < 20; round++) {
+        std::string want = commits_[pick() % commits_.size()];
+        std::string have = commits_[pick() % commits_.size()];
+        auto have_objects = Hashes(EnumerateReachable(store, {have}));
+        std::set<std::string> difference;
+        for (const auto &hash : Hashes(EnumerateReachable(store, {want}))) {
+            if (!have_objects.count(hash)) {
+                difference.insert(hash);
+            }
+        }
+        bitmap::Bitmap bits = bitmaps->Reachable({want});
+        bits.AndNot(bitmaps->Reachable({have}));
+        EXPECT_EQ(Hashes(bitmaps->Objects(bits)), difference);
+    }
+}
+
+// upload-pack 用位图计算 want 与 have 的差，克隆时直接发送整个 pack
+TEST_F(BitmapTest, UploadPackUsesBitmap) {
+    BuildHistory(120);
+    upload_pack::UploadRequest request;
+    request.wants = {MiniGitRef().GetCurrentCommit()};
+    request.haves = {commits_[40]};
+    request.done = true;
+    request.capabilities = {"ofs-delta"};
+    auto walked = upload_pack::UploadPack().Process(request);
+    close(walked.pack_fd);
+
+    RepackOptions options;
+    options.all = options.remove_redundant = options.write_bitmap = true;
+    RepackResult repacked = Repack(options);
+    ASSERT_TRUE(fs::exists(".git/objects/pack/pack-" + repacked.pack_checksum +
+                           ".bitmap"));
+    auto fetched = upload_pack::UploadPack().Process(request);
+    EXPECT_EQ(fetched.objects, walked.objects);
+    EXPECT_FALSE(fetched.reused);
+    close(fetched.pack_fd);
+
+    // 克隆全部分支：所需对象就是整个 pack
+    request.wants = ReachabilityTips(ObjectStore(), false);
+    request.haves.clear();
+    auto cloned = upload_pack::UploadPack().Process(request);
+    EXPECT_TRUE(cloned.reused);
+    EXPECT_EQ(cloned.objects, repacked.objects);
+    close(cloned.pack_fd);
+
+    // 不带 -b 的 repack -a 删除旧 pack 时一起删除它的位图
+    std::string more = Commit({MiniGitRef().GetCurrentCommit()});
+    MiniGitRef().UpdateCurrentBranch(more);
+    options.write_bitmap = false;
+    Repack(options);
+    ObjectStore store;
+    EXPECT_EQ(bitmap::PackBitmap::Open(store), nullptr);
+}
+
+// 与 pack 不匹配或被截断的位图文件被拒绝
+TEST_F(BitmapTest, RejectsBadFile) {
+    BuildHistory(40);
+    RepackOptions options;
+    options.all = options.remove_redundant = options.write_bitmap = true;
+    RepackResult repacked = Repack(options);
+    fs::path path =
+        ".git/objects/pack/pack-" + repacked.pack_checksum + ".bitmap";
+    std::string data;
+    {
+        std::ifstream file(path, std::ios::binary);
+        data.assign(std::istreambuf_iterator<char>(file),
+                    std::istreambuf_iterator<char>());
+    }
+    auto rewrite = [&](const std::string &content) {
+        fs::permissions(path, fs::perms::owner_write, fs::perm_options::add);
+        std::ofstream(path, std::ios::binary | std::ios::trunc) << content;
+    };
+
+    std::string wrong_pack = data;
+    wrong_pack[12] ^= 1;
+    rewrite(wrong_pack);
+    {
+        ObjectStore store;
+        EXPECT_THROW(bitmap::PackBitmap::Open(store), std::runtime_error);
+    }
+    rewrite(data.substr(0, 60));
+    {
+        ObjectStore store;
+        EXPECT_THROW(bitmap::PackBitmap::Open(store), std::runtime_error);
+    }
+    rewrite(data);
+    ObjectStore store;
+    EXPECT_NE(bitmap::PackBitmap::Open(store), nullptr);
+}
@@ -0,0 +1,208 @@
+#include <gtest/gtest.h>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+#include "../include/clone_gadget.h"
+#include "../src/checkout.h"
+#include "../src/dircache.h"
+#include "../src/object_store.h"
+#include "test_util.h"
+
+namespace fs = std::filesystem;
+
+class CheckoutTest : public TempRepoTest {
+protected:
+    CheckoutTest() : TempRepoTest("checkout") {}
+
+    static checkout::CheckoutResult Checkout(const std::string &old_tree,
+                                             const std::string &new_tree) {
+        ObjectStore store;
+        return checkout::CheckoutTree(store, ".", old_tree, new_tree);
+    }
+
+    // 两个分支：base 与 topic 只差几个文件
+    void BuildTrees() {
+        std::string one = Blob("one\n");
+        std::string two = Blob("two\n");
+        std::string keep = Tree({{"100644", "keep.txt", one}});
+        std::string lib_old = Tree({{"100644", "a.txt", one},
+                                    {"40000", "deep", keep}});
+        std::string lib_new = Tree({{"100644", "a.txt", two},
+                                    {"40000", "deep", keep}});
+        std::string gone = Tree({{"100644", "only.txt", one}});
+        base_ = Tree({{"40000", "gone", gone},
+                      {"40000", "lib", lib_old},
+                      {"100644", "run.sh", one},
+                      {"100644", "swap", one},
+                      {"100644", "unchanged.txt", one}});
+        topic_ = Tree({{"40000", "lib", lib_new},
+                       {"120000", "link", Blob("unchanged.txt")},
+                       {"100755", "run.sh", one},
+                       {"40000", "swap", keep},
+                       {"100644", "unchanged.txt", one}});
+    }
+
+    std::string base_;
+    std::string topic_;
+};
+
+// index 的读写与 Git 的 version 2 格式一致，损坏时报错
+TEST_F(CheckoutTest, IndexRoundTrip) {
+    EXPECT_FALSE(dircache::Index::Read(".git/index").Exists());
+
+    std::vector<dircache::IndexEntry> entries(3);
+    entries[0].path = "a.txt";
+    entries[0].mode = 0100644;
+    entries[0].hash = std::string(40, 'a');
+    entries[0].stat.mtime_sec = 1700000000;
+    entries[0].stat.size = 12;
+    entries[1].path = "dir/" + std::string(5000, 'n'); // 超过标志中的长度上限
+    entries[1].mode = 0100755;
+    entries[1].hash = std::string(40, 'b');
+    entries[2].path = "link";
+    entries[2].mode = 0120000;
+    entries[2].hash = std::string(40, 'c');
+    dircache::Index index;
+    index.SetEntries(entries);
+    index.Write(".git/index");
+    EXPECT_FALSE(fs::exists(".git/index.lock"));
+    // 头 12 字节 + 每个条目补齐到 8 的倍数 + 校验和
+    EXPECT_EQ(fs::file_size(".git/index"), 12u + 72 + 5072 + 72 + 20);
+
+    auto read = dircache::Index::Read(".git/index");
+    ASSERT_TRUE(read.Exists());
+    ASSERT_EQ(read.Entries().size(), 3u);
+    for (size_t i = 0; i < 3; i++) {
+        EXPECT_EQ(read.Entries()[i].path, entries[i].path);
+        EXPECT_EQ(read.Entries()[i].mode, entries[i].mode);
+        EXPECT_EQ(read.Entries()[i].hash, entries[i].hash);
+        EXPECT_TRUE(read.Entries()[i].stat == entries[i].stat);
+    }
+    ASSERT_NE(read.Find("link"), nullptr);
+    EXPECT_EQ(read.Find("link")->hash, entries[2].hash);
+    EXPECT_EQ(read.Find("dir"), nullptr);
+
+    // 删除和加入一次完成，结果仍按路径排序
+    dircache::IndexEntry added;
+    added.path = "b.txt";
+    added.hash = std::string(40, 'd');
+    read.Update({"a.txt", "link"}, {added});
+    ASSERT_EQ(read.Entries().size(), 2u);
+    EXPECT_EQ(read.Entries()[0].path, "b.txt");
+    EXPECT_EQ(read.Entries()[1].path, entries[1].path);
+
+    // 其他进程持有锁时不能写
+    std::ofstream(".git/index.lock") << "";
+    EXPECT_THROW(read.Write(".git/index"), std::runtime_error);
+    fs::remove(".git/index.lock");
+
+    std::string data = ReadFile(".git/index");
+    data[20] ^= 1;
+    std::ofstream(".git/index", std::ios::binary | std::ios::trunc) << data;
+    EXPECT_THROW(dircache::Index::Read(".git/index"), std::runtime_error);
+}
+
+// 切换分支只改动有差异的路径，其余文件不被重写
+TEST_F(CheckoutTest, SwitchesOnlyChangedPaths) {
+    BuildTrees();
+    auto cloned = Checkout("", base_);
+    ASSERT_TRUE(cloned.Ok());
+    EXPECT_EQ(cloned.written, 6u);
+    EXPECT_EQ(dircache::Index::Read(".git/index").Entries().size(), 6u);
+
+    struct stat before;
+    ASSERT_EQ(stat("lib/deep/keep.txt", &before), 0);
+    auto result = Checkout(base_, topic_);
+    ASSERT_TRUE(result.Ok());
+    EXPECT_EQ(result.removed, 2u);  // gone/only.txt 和文件 swap
+    EXPECT_EQ(result.written, 4u);  // lib/a.txt、link、run.sh、swap/keep.txt
+    struct stat after;
+    ASSERT_EQ(stat("lib/deep/keep.txt", &after), 0);
+    EXPECT_EQ(after.st_ino, before.st_ino);
+    EXPECT_EQ(after.st_mtim.tv_nsec, before.st_mtim.tv_nsec);
+
+    EXPECT_EQ(ReadFile("lib/a.txt"), "two\n");
+    EXPECT_FALSE(fs::exists("gone")); // 变空的目录一起删除
+    EXPECT_TRUE(fs::is_directory("swap"));
+    EXPECT_EQ(ReadFile("swap/keep.txt"), "one\n");
+    EXPECT_TRUE(fs::is_symlink("link"));
+    EXPECT_EQ(fs::read_symlink("link"), "unchanged.txt");
+    EXPECT_NE(fs::status("run.sh").permissions() & fs::perms::owner_exec,
+              fs::perms::none);
+
+    auto index = dircache::Index::Read(".git/index");
+    std::vector<std::string> paths;
+    for (const auto &entry : index.Entries()) {
+        paths.push_back(entry.path);
+    }
+    EXPECT_EQ(paths, (std::vector<std::string>{"lib/a.txt", "lib/deep/keep.txt",
+                                               "link", "run.sh", "swap/keep.txt",
+                                               "unchanged.txt"}));
+    EXPECT_EQ(index.Find("run.sh")->mode, 0100755u);
+
+    // 切回去得到原来的工作区
+    ASSERT_TRUE(Checkout(topic_, base_).Ok());
+    EXPECT_EQ(ReadFile("swap"), "one\n");
+    EXPECT_EQ(ReadFile("gone/only.txt"), "one\n");
+    EXPECT_FALSE(fs::exists("link"));
+    EXPECT_EQ(ReadFile("lib/a.txt"), "one\n");
+}
+
+// 本地改动和未跟踪文件会被覆盖时，整个工作区保持不变
+TEST_F(CheckoutTest, RefusesToOverwriteLocalChanges) {
+    BuildTrees();
+    ASSERT_TRUE(Checkout("", base_).Ok());
+    std::ofstream("lib/a.txt") << "edited\n";
+    std::ofstream("unchanged.txt") << "edited too\n"; // 不在差异中，不影响切换
+    std::ofstream("link") << "untracked\n";
+
+    auto result = Checkout(base_, topic_);
+    EXPECT_FALSE(result.Ok());
+    EXPECT_EQ(result.local_changes, std::vector<std::string>{"lib/a.txt"});
+    EXPECT_EQ(result.untracked, std::vector<std::string>{"link"});
+    EXPECT_EQ(result.written, 0u);
+    EXPECT_EQ(ReadFile("lib/a.txt"), "edited\n");
+    EXPECT_EQ(ReadFile("swap"), "one\n");
+    EXPECT_TRUE(fs::exists("gone/only.txt"));
+
+    // 内容与目标相同的未跟踪文件直接接管；改回原内容的文件可以覆盖
+    fs::remove("link");
+    fs::create_symlink("unchanged.txt", "link");
+    std::ofstream("lib/a.txt") << "one\n";
+    result = Checkout(base_, topic_);
+    ASSERT_TRUE(result.Ok());
+    EXPECT_EQ(ReadFile("lib/a.txt"), "two\n");
+    EXPECT_EQ(ReadFile("unchanged.txt"), "edited too\n");
+
+    // 文件位置上的目录中有未跟踪文件时不删除
+    std::ofstream("swap/extra") << "mine\n";
+    result = Checkout(topic_, base_);
+    EXPECT_EQ(result.untracked, std::vector<std::string>{"swap"});
+    EXPECT_TRUE(fs::exists("swap/keep.txt"));
+}
+
+// 新文件的上级位置上是未跟踪的文件时同样不动工作区
+TEST_F(CheckoutTest, RefusesUntrackedFileInPlaceOfParent) {
+    std::string one = Blob("one\n");
+    std::string main = Tree({{"100644", "gone", one}});
+    std::string feat = Tree({{"40000", "a", Tree({{"100644", "b", one}})}});
+    ASSERT_TRUE(Checkout("", main).Ok());
+    std::ofstream("a") << "untracked\n";
+
+    auto result = Checkout(main, feat);
+    EXPECT_FALSE(result.Ok());
+    EXPECT_EQ(result.untracked, std::vector<std::string>{"a"});
+    EXPECT_EQ(ReadFile("gone"), "one\n");
+    EXPECT_EQ(ReadFile("a"), "untracked\n");
+
+    // 上级位置上是要删除的已跟踪文件时可以替换
+    std::string file_a = Tree({{"100644", "a", one}});
+    fs::remove("a");
+    fs::remove(".git/index");
+    ASSERT_TRUE(Checkout("", file_a).Ok());
+    ASSERT_TRUE(Checkout(file_a, feat).Ok());
+    EXPECT_EQ(ReadFile("a/b"), "one\n");
+}
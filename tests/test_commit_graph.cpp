@@ -0,0 +1,220 @@
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <unistd.h>
+#include <vector>
+#include "../include/clone_gadget.h"
+#include "../src/commit_graph.h"
+#include "../src/object_store.h"
+#include "../src/refs.h"
+#include "../src/revision.h"
+#include "test_util.h"
+
+namespace fs = std::filesystem;
+
+class CommitGraphTest : public TempRepoTest {
+protected:
+    CommitGraphTest() : TempRepoTest("graph") {}
+
+    void SetUp() override {
+        TempRepoTest::SetUp();
+        tree_ = Store("tree", "");
+    }
+
+    std::vector<std::string> Hashes(commit_graph::CommitIndex &index,
+                                    const std::vector<uint32_t> &ids) {
+        std::vector<std::string> hashes;
+        for (uint32_t id : ids) {
+            hashes.push_back(index.Hash(id));
+        }
+        return hashes;
+    }
+
+    // 从 tips 可达的全部提交，按 rev-list 的顺序
+    std::vector<uint32_t> Walk(commit_graph::CommitIndex &index,
+                               const std::vector<uint32_t> &tips) {
+        revision::RevWalk walk(index);
+        for (uint32_t tip : tips) {
+            walk.Push(tip);
+        }
+        std::vector<uint32_t> ids;
+        uint32_t id;
+        while (walk.Next(id)) {
+            ids.push_back(id);
+        }
+        return ids;
+    }
+
+    std::string tree_;
+};
+
+// 写出的文件可以读回每个提交的 tree、父提交（含章鱼合并）、代数和时间
+TEST_F(CommitGraphTest, WriteAndReadBack) {
+    std::string root = Commit(tree_, {}, 1000, "root");
+    std::string a = Commit(tree_, {root}, 1100, "a");
+    std::string b = Commit(tree_, {root}, 1200, "b");
+    std::string c = Commit(tree_, {root}, 1300, "c");
+    std::string octopus = Commit(tree_, {a, b, c}, 1400, "octopus");
+    std::string tip = Commit(tree_, {octopus, a}, 1500, "tip");
+
+    ObjectStore store;
+    EXPECT_EQ(commit_graph::CommitGraph::Open(".git"), nullptr);
+    EXPECT_EQ(commit_graph::Write(store, {tip}), 6u);
+
+    auto graph = commit_graph::CommitGraph::Open(".git");
+    ASSERT_NE(graph, nullptr);
+    ASSERT_EQ(graph->Count(), 6u);
+    for (uint32_t pos = 1; pos < graph->Count(); pos++) {
+        EXPECT_LT(graph->HashAt(pos - 1), graph->HashAt(pos));
+    }
+    EXPECT_FALSE(graph->Find(std::string(40, '0')).has_value());
+    EXPECT_FALSE(graph->Find("not a hash").has_value());
+
+    auto pos = [&](const std::string &hash) { return *graph->Find(hash); };
+    std::vector<uint32_t> parents;
+    graph->ParentsAt(pos(octopus), parents);
+    EXPECT_EQ(parents, (std::vector<uint32_t>{pos(a), pos(b), pos(c)}));
+    parents.clear();
+    graph->ParentsAt(pos(tip), parents);
+    EXPECT_EQ(parents, (std::vector<uint32_t>{pos(octopus), pos(a)}));
+    parents.clear();
+    graph->ParentsAt(pos(root), parents);
+    EXPECT_TRUE(parents.empty());
+
+    EXPECT_EQ(graph->GenerationAt(pos(root)), 1u);
+    EXPECT_EQ(graph->GenerationAt(pos(b)), 2u);
+    EXPECT_EQ(graph->GenerationAt(pos(octopus)), 3u);
+    EXPECT_EQ(graph->GenerationAt(pos(tip)), 4u);
+    EXPECT_EQ(graph->TimeAt(pos(c)), 1300);
+    EXPECT_EQ(graph->TreeAt(pos(tip)), tree_);
+
+    // 提交图与直接解析对象的结果一致
+    commit_graph::CommitIndex index(store);
+    ASSERT_NE(index.Graph(), nullptr);
+    fs::path saved = commit_graph::GraphPath(".git");
+    fs::rename(saved, "graph.bak");
+    commit_graph::CommitIndex parsed(store);
+    EXPECT_EQ(parsed.Graph(), nullptr);
+    for (const auto &hash : {root, a, b, c, octopus, tip}) {
+        uint32_t x = index.Lookup(hash);
+        uint32_t y = parsed.Lookup(hash);
+        EXPECT_EQ(index.Hash(x), parsed.Hash(y));
+        EXPECT_EQ(index.Tree(x), parsed.Tree(y));
+        EXPECT_EQ(index.Time(x), parsed.Time(y));
+        EXPECT_EQ(parsed.Generation(y), commit_graph::kGenerationInfinity);
+        std::vector<uint32_t> px, py;
+        index.Parents(x, px);
+        parsed.Parents(y, py);
+        EXPECT_EQ(Hashes(index, px), Hashes(parsed, py));
+    }
+    fs::rename("graph.bak", saved);
+
+    EXPECT_THROW(index.Lookup(tree_), std::runtime_error);
+    EXPECT_THROW(index.Lookup(std::string(40, 'f')), std::runtime_error);
+}
+
+// 祖先判断和 merge-base 在有无 commit-graph、以及图之后又有新提交时结果相同
+TEST_F(CommitGraphTest, AncestryAndMergeBase) {
+    //   root - m1 - m2 ------- x1 (merge m2, f2)   main
+    //              \         /
+    //               f1 - f2 - f3                   feature
+    std::string root = Commit(tree_, {}, 1000, "root");
+    std::string m1 = Commit(tree_, {root}, 1001, "m1");
+    std::string m2 = Commit(tree_, {m1}, 1002, "m2");
+    std::string f1 = Commit(tree_, {m1}, 1003, "f1");
+    std::string f2 = Commit(tree_, {f1}, 1004, "f2");
+    std::string x1 = Commit(tree_, {m2, f2}, 1005, "x1");
+    std::string f3 = Commit(tree_, {f2}, 1006, "f3");
+    // 交叉合并：y1 与 y2 的最佳共同祖先有两个（x1 和 f3）
+    std::string y1 = Commit(tree_, {x1, f3}, 1007, "y1");
+    std::string y2 = Commit(tree_, {f3, x1}, 1008, "y2");
+    std::string other = Commit(tree_, {}, 1009, "unrelated root");
+
+    auto check = [&](const char *label) {
+        SCOPED_TRACE(label);
+        ObjectStore store;
+        commit_graph::CommitIndex index(store);
+        auto id = [&](const std::string &hash) { return index.Lookup(hash); };
+        EXPECT_TRUE(commit_graph::IsAncestor(index, id(root), id(y2)));
+        EXPECT_TRUE(commit_graph::IsAncestor(index, id(f2), id(x1)));
+        EXPECT_TRUE(commit_graph::IsAncestor(index, id(x1), id(x1)));
+        EXPECT_FALSE(commit_graph::IsAncestor(index, id(f3), id(x1)));
+        EXPECT_FALSE(commit_graph::IsAncestor(index, id(x1), id(f2)));
+        EXPECT_FALSE(commit_graph::IsAncestor(index, id(other), id(y1)));
+
+        auto bases = [&](const std::string &a, const std::string &b) {
+            auto result =
+                Hashes(index, commit_graph::MergeBases(index, id(a), id(b)));
+            std::sort(result.begin(), result.end());
+            return result;
+        };
+        EXPECT_EQ(bases(m2, f3), std::vector<std::string>{m1});
+        EXPECT_EQ(bases(x1, f3), std::vector<std::string>{f2});
+        EXPECT_EQ(bases(root, f3), std::vector<std::string>{root});
+        EXPECT_EQ(bases(y2, y2), std::vector<std::string>{y2});
+        EXPECT_TRUE(bases(other, y1).empty());
+        std::vector<std::string> criss_cross = {x1, f3};
+        std::sort(criss_cross.begin(), criss_cross.end());
+        EXPECT_EQ(bases(y1, y2), criss_cross);
+
+        EXPECT_EQ(Hashes(index, Walk(index, {id(y1)})),
+                  (std::vector<std::string>{y1, f3, x1, f2, f1, m2, m1, root}));
+    };
+
+    check("no commit-graph");
+    ObjectStore store;
+    // 只包含到 x1 为止的提交，f3 之后的提交不在图中
+    commit_graph::Write(store, {x1});
+    check("partial commit-graph");
+    commit_graph::Write(store, {y1, y2, other});
+    check("full commit-graph");
+}
+
+// 很长的线性历史不会因递归而溢出栈，代数等于深度
+TEST_F(CommitGraphTest, DeepHistory) {
+    std::vector<std::string> chain = {Commit(tree_, {}, 0, "0")};
+    for (int i = 1; i < 3000; i++) {
+        chain.push_back(Commit(tree_, {chain.back()}, i, std::to_string(i)));
+    }
+    ObjectStore store;
+    EXPECT_EQ(commit_graph::Write(store, {chain.back()}), chain.size());
+
+    commit_graph::CommitIndex index(store);
+    ASSERT_NE(index.Graph(), nullptr);
+    uint32_t tip = index.Lookup(chain.back());
+    EXPECT_EQ(index.Generation(tip), chain.size());
+    EXPECT_TRUE(commit_graph::IsAncestor(index, index.Lookup(chain[0]), tip));
+    EXPECT_EQ(commit_graph::MergeBases(index, index.Lookup(chain[100]), tip),
+              std::vector<uint32_t>{index.Lookup(chain[100])});
+    EXPECT_EQ(Walk(index, {tip}).size(), chain.size());
+    // 索引中没有新分配编号：全部查询都来自 commit-graph
+    EXPECT_EQ(index.Size(), chain.size());
+}
+
+// 损坏的文件被拒绝，而不是读出错误的父提交
+TEST_F(CommitGraphTest, RejectsCorruptFile) {
+    std::string root = Commit(tree_, {}, 1000, "root");
+    std::string tip = Commit(tree_, {root}, 1001, "tip");
+    ObjectStore store;
+    commit_graph::Write(store, {tip});
+    fs::path path = commit_graph::GraphPath(".git");
+    fs::permissions(path, fs::perms::owner_write, fs::perm_options::add);
+
+    std::string data;
+    {
+        std::ifstream in(path, std::ios::binary);
+        data.assign(std::istreambuf_iterator<char>(in), {});
+    }
+    auto rewrite = [&](const std::string &content) {
+        std::ofstream(path, std::ios::binary | std::ios::trunc) << content;
+    };
+    rewrite("XGPH" + data.substr(4));
+    EXPECT_THROW(commit_graph::CommitGraph::Open(".git"), std::runtime_error);
+    rewrite(data.substr(0, 40));
+    EXPECT_THROW(commit_graph::CommitGraph::Open(".git"), std::runtime_error);
+    rewrite(data);
+    EXPECT_NE(commit_graph::CommitGraph::Open(".git"), nullptr);
+}
@@ -0,0 +1,137 @@
+#include <gtest/gtest.h>
+#include <filesystem>
+#include <string>
+#include <unistd.h>
+#include <vector>
+#include "../include/clone_gadget.h"
+#include "../src/object_store.h"
+#include "../src/tree.h"
+#include "test_util.h"
+
+namespace fs = std::filesystem;
+
+class DiffTreeTest : public TempRepoTest {
+protected:
+    DiffTreeTest() : TempRepoTest("diff_tree") {}
+
+    static std::vector<std::string> Diff(const std::string &old_tree,
+                                         const std::string &new_tree,
+                                         bool recursive) {
+        ObjectStore store;
+        tree::DiffOptions options;
+        options.recursive = recursive;
+        std::vector<std::string> lines;
+        tree::DiffTrees(store, old_tree, new_tree, options,
+                        [&](const tree::Change &change) {
+                            lines.push_back(change.status + std::string(" ") +
+                                            change.path);
+                        });
+        return lines;
+    }
+};
+
+// 解析器逐条返回条目；目录名按带 '/' 的顺序排列
+TEST_F(DiffTreeTest, ParsesEntriesInTreeOrder) {
+    std::string blob = Blob("x\n");
+    std::string sub = Tree({{"100644", "f", blob}});
+    std::string root = Tree({{"100644", "a.txt", blob},
+                             {"40000", "a", sub},
+                             {"100755", "a0", blob},
+                             {"120000", "link", blob}});
+    ObjectStore store;
+    auto object = store.Read(root);
+    ASSERT_TRUE(object);
+    tree::TreeParser parser(object->data, root);
+    std::vector<tree::TreeEntry> entries;
+    tree::TreeEntry entry;
+    while (parser.Next(entry)) {
+        entries.push_back(entry);
+    }
+    ASSERT_EQ(entries.size(), 4u);
+    EXPECT_EQ(entries[0].name, "a.txt");
+    EXPECT_EQ(entries[0].mode, 0100644u);
+    EXPECT_EQ(entries[0].Hash(), blob);
+    EXPECT_TRUE(entries[1].IsTree());
+    EXPECT_EQ(entries[1].Hash(), sub);
+    EXPECT_EQ(entries[2].mode, 0100755u);
+    EXPECT_EQ(entries[3].mode, 0120000u);
+    for (size_t i = 1; i < entries.size(); i++) {
+        EXPECT_LT(tree::CompareEntries(entries[i - 1], entries[i]), 0) << i;
+        EXPECT_GT(tree::CompareEntries(entries[i], entries[i - 1]), 0) << i;
+    }
+    EXPECT_EQ(tree::CompareEntries(entries[1], entries[1]), 0);
+
+    // 同名的文件和目录不是同一个位置
+    tree::TreeEntry file = entries[1];
+    file.mode = 0100644;
+    EXPECT_NE(tree::CompareEntries(file, entries[1]), 0);
+
+    std::string corrupt = object->data.substr(0, object->data.size() - 5);
+    tree::TreeParser bad(corrupt, "bad");
+    EXPECT_THROW(
+        {
+            while (bad.Next(entry)) {
+            }
+        },
+        std::runtime_error);
+}
+
+// 新增、删除、修改和类型改变；-r 时进入子树只输出文件
+TEST_F(DiffTreeTest, ReportsChanges) {
+    std::string one = Blob("one\n");
+    std::string two = Blob("two\n");
+    std::string sub_old = Tree({{"100644", "keep", one}, {"100644", "x", one}});
+    std::string sub_new = Tree({{"100644", "keep", one}, {"100644", "x", two}});
+    std::string old_tree = Tree({{"100644", "a.txt", one},
+                                 {"40000", "dir", sub_old},
+                                 {"100644", "gone", one},
+                                 {"100644", "link", one},
+                                 {"100644", "mode", one}});
+    std::string new_tree = Tree({{"100644", "a.txt", one},
+                                 {"40000", "dir", sub_new},
+                                 {"40000", "gone", sub_new},
+                                 {"120000", "link", one},
+                                 {"100755", "mode", one},
+                                 {"100644", "new", two}});
+
+    EXPECT_EQ(Diff(old_tree, new_tree, false),
+              (std::vector<std::string>{"M dir", "D gone", "A gone", "T link",
+                                        "M mode", "A new"}));
+    EXPECT_EQ(Diff(old_tree, new_tree, true),
+              (std::vector<std::string>{"M dir/x", "D gone", "A gone/keep",
+                                        "A gone/x", "T link", "M mode", "A new"}));
+    EXPECT_TRUE(Diff(old_tree, old_tree, true).empty());
+    EXPECT_EQ(Diff("", sub_old, true),
+              (std::vector<std::string>{"A keep", "A x"}));
+
+    ObjectStore store;
+    std::vector<tree::Change> changes;
+    tree::DiffTrees(store, sub_old, sub_new, {},
+                    [&](const tree::Change &change) { changes.push_back(change); });
+    ASSERT_EQ(changes.size(), 1u);
+    EXPECT_EQ(tree::FormatRaw(changes[0]),
+              ":100644 100644 " + one + " " + two + " M\tx");
+    changes[0].path = "caf\xc3\xa9 \"q\"";
+    EXPECT_EQ(tree::FormatRaw(changes[0]),
+              ":100644 100644 " + one + " " + two +
+                  " M\t\"caf\\303\\251 \\\"q\\\"\"");
+}
+
+// 哈希相同的子树不被读取：删掉它的对象后比较仍然成功
+TEST_F(DiffTreeTest, SkipsUnchangedSubtrees) {
+    std::string blob = Blob("content\n");
+    std::string deep = Tree({{"100644", "leaf", blob}});
+    std::string shared = Tree({{"40000", "deep", deep}, {"100644", "f", blob}});
+    std::string old_tree = Tree({{"40000", "shared", shared},
+                                 {"100644", "top", blob}});
+    std::string new_tree = Tree({{"40000", "shared", shared},
+                                 {"100644", "top", Blob("changed\n")}});
+    ObjectStore store;
+    ASSERT_TRUE(fs::remove(store.LoosePath(shared)));
+    ASSERT_FALSE(store.Read(shared));
+
+    EXPECT_EQ(Diff(old_tree, new_tree, true),
+              (std::vector<std::string>{"M top"}));
+    // 需要进入缺失的子树时报错
+    EXPECT_THROW(Diff("", new_tree, true), std::runtime_error);
+}
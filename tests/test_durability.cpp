@@ -0,0 +1,191 @@
+#include <gtest/gtest.h>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+#include "../include/clone_gadget.h"
+#include "../src/durability.h"
+#include "../src/ingest.h"
+#include "../src/object_store.h"
+#include "test_util.h"
+
+namespace fs = std::filesystem;
+
+class DurabilityTest : public TempRepoTest {
+protected:
+    DurabilityTest() : TempRepoTest("durability") {}
+
+    void SetUp() override {
+        unsetenv("MINIGIT_FSYNC_METHOD");
+        TempRepoTest::SetUp();
+    }
+
+    void TearDown() override {
+        unsetenv("MINIGIT_FSYNC_METHOD");
+        TempRepoTest::TearDown();
+    }
+
+    static void SetMethod(const std::string &method) {
+        std::ofstream(".git/config") << "[core]\n\tfsyncMethod = " << method << "\n";
+    }
+
+    static std::string Blob(const std::string &content, std::string &raw) {
+        raw = "blob " + std::to_string(content.size()) + '\0' + content;
+        return compute_sha1(raw);
+    }
+
+    // objects 目录中残留的隔离目录
+    static int Quarantines() {
+        int count = 0;
+        for (const auto &entry : fs::directory_iterator(".git/objects")) {
+            count += entry.path().filename().string().starts_with("incoming-");
+        }
+        return count;
+    }
+};
+
+// 配置和环境变量选择方式，环境变量优先；非法的值报错
+TEST_F(DurabilityTest, ReadsConfiguredMethod) {
+    using durability::FsyncMethod;
+    EXPECT_EQ(durability::ConfiguredFsyncMethod(), FsyncMethod::kNone);
+    SetMethod("batch");
+    EXPECT_EQ(durability::ConfiguredFsyncMethod(), FsyncMethod::kBatch);
+    setenv("MINIGIT_FSYNC_METHOD", "fsync", 1);
+    EXPECT_EQ(durability::ConfiguredFsyncMethod(), FsyncMethod::kFsync);
+    setenv("MINIGIT_FSYNC_METHOD", "always", 1);
+    EXPECT_THROW(durability::ConfiguredFsyncMethod(), std::invalid_argument);
+}
+
+// batch：对象在最外层事务提交之前不出现在 objects 目录中，嵌套的事务
+// 提交不生效；没有提交的事务丢弃对象
+TEST_F(DurabilityTest, BatchPublishesOnOuterCommit) {
+    SetMethod("batch");
+    std::string first_raw, second_raw;
+    std::string first = Blob("first", first_raw);
+    std::string second = Blob("second", second_raw);
+    {
+        durability::ObjectTransaction outer;
+        compress_and_store(first, first_raw);
+        {
+            durability::ObjectTransaction inner;
+            compress_and_store(second, second_raw);
+            inner.Commit();
+        }
+        EXPECT_FALSE(ObjectStore().Contains(first));
+        EXPECT_FALSE(ObjectStore().Contains(second));
+        EXPECT_EQ(Quarantines(), 1);
+        auto staged = outer.ReadStaged(second);
+        ASSERT_TRUE(staged);
+        EXPECT_EQ(staged->data, "second");
+        outer.Commit();
+    }
+    ObjectStore store;
+    ASSERT_TRUE(store.Read(first));
+    EXPECT_EQ(store.Read(second)->data, "second");
+    EXPECT_EQ(Quarantines(), 0);
+
+    std::string third_raw;
+    std::string third = Blob("third", third_raw);
+    {
+        durability::ObjectTransaction transaction;
+        compress_and_store(third, third_raw);
+    }
+    EXPECT_FALSE(ObjectStore().Contains(third));
+    EXPECT_EQ(Quarantines(), 0);
+}
+
+// 事务之外的写入和 write-tree / commit-tree 在各种方式下都立即可见，
+// 已有的对象不重写
+TEST_F(DurabilityTest, WritesObjectsInEveryMode) {
+    for (std::string method : {"none", "fsync", "batch"}) {
+        SetMethod(method);
+        fs::remove_all(".git/objects");
+        fs::create_directories("sub");
+        std::ofstream("a.txt") << "a\n";
+        std::ofstream("sub/b.txt") << method << "\n";
+
+        std::string raw;
+        std::string blob = Blob(method, raw);
+        compress_and_store(blob, raw);
+        compress_and_store(blob, raw);
+        std::string tree = write_tree(".");
+        testing::internal::CaptureStdout();
+        std::string commit = commit_tree(tree, "", "message");
+        testing::internal::GetCapturedStdout();
+
+        ObjectStore store;
+        EXPECT_EQ(store.Read(blob)->data, method) << method;
+        auto tree_object = store.Read(tree);
+        ASSERT_TRUE(tree_object) << method;
+        EXPECT_EQ(tree_object->type, ObjectType::kTree);
+        ASSERT_TRUE(store.Read(commit)) << method;
+        EXPECT_TRUE(store.Contains(hash_object("a.txt")));
+        EXPECT_EQ(Quarantines(), 0) << method;
+    }
+}
+
+// 批量写入：fsync 方式下每批写完即可见；batch 方式下 Commit() 之前只在
+// 隔离目录中，但仍能作为 delta 基础对象读到
+TEST_F(DurabilityTest, LooseObjectWriterHonorsMethod) {
+    for (auto mode : {ingest::WriteMode::kUring, ingest::WriteMode::kThreads}) {
+        for (std::string method : {"fsync", "batch"}) {
+            SetMethod(method);
+            fs::remove_all(".git/objects");
+            std::vector<std::string> hashes;
+            {
+                ingest::LooseObjectWriter writer(".", mode);
+                for (size_t i = 0; i < ingest::LooseObjectWriter::kBatchObjects + 10; i++) {
+                    std::string raw;
+                    hashes.push_back(Blob(std::to_string(i), raw));
+                    writer.Write(hashes.back().c_str(), raw.data(), raw.size());
+                }
+                EXPECT_EQ(ObjectStore().HasLoose(hashes.front()), method == "fsync");
+                if (method == "batch") {
+                    GitObject object;
+                    ASSERT_TRUE(writer.ReadQueued(hashes.front(), object));
+                    EXPECT_EQ(object.data, "0");
+                }
+                writer.Commit();
+            }
+            ObjectStore store;
+            for (size_t i = 0; i < hashes.size(); i++) {
+                auto object = store.Read(hashes[i]);
+                ASSERT_TRUE(object) << method;
+                EXPECT_EQ(object->data, std::to_string(i));
+            }
+            EXPECT_EQ(Quarantines(), 0);
+        }
+    }
+}
+
+// 整体替换文件：新建或覆盖、权限按 mode，不留下临时文件；目录不可写时报错
+TEST_F(DurabilityTest, WritesFilesAtomically) {
+    using durability::FsyncMethod;
+    durability::WriteFileAtomically(".git/objects/info/graph", "first", 0444);
+    durability::WriteFileAtomically(".git/objects/info/graph", "second", 0444,
+                                    FsyncMethod::kFsync);
+    std::ifstream file(".git/objects/info/graph", std::ios::binary);
+    std::string content((std::istreambuf_iterator<char>(file)),
+                        std::istreambuf_iterator<char>());
+    EXPECT_EQ(content, "second");
+    struct stat st;
+    ASSERT_EQ(stat(".git/objects/info/graph", &st), 0);
+    EXPECT_EQ(st.st_mode & 0777, 0444u);
+    size_t files = 0;
+    for (const auto &entry : fs::directory_iterator(".git/objects/info")) {
+        EXPECT_FALSE(entry.path().filename().string().starts_with("tmp_"));
+        files++;
+    }
+    EXPECT_EQ(files, 1u);
+
+    // 目标是一个目录：rename 失败，临时文件被删除
+    fs::create_directories("dir/target/child");
+    EXPECT_THROW(durability::WriteFileAtomically("dir/target", "x", 0644),
+                 std::runtime_error);
+    EXPECT_EQ(std::distance(fs::directory_iterator("dir"),
+                            fs::directory_iterator()),
+              1);
+}
@@ -0,0 +1,151 @@
+#include <gtest/gtest.h>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include "../include/clone_gadget.h"
+#include "../src/fsmonitor.h"
+#include "test_util.h"
+
+namespace fs = std::filesystem;
+
+// 守护进程在后台线程中运行
+class FsmonitorTest : public TempRepoTest {
+protected:
+    FsmonitorTest() : TempRepoTest("fsmonitor") {}
+
+    void SetUp() override {
+        unsetenv("MINIGIT_FSYNC_METHOD");
+        TempRepoTest::SetUp();
+    }
+
+    void TearDown() override {
+        StopDaemon();
+        TempRepoTest::TearDown();
+    }
+
+    void StartDaemon() {
+        daemon_ = std::make_unique<fsmonitor::Daemon>(".");
+        thread_ = std::thread([this] { daemon_->Run(); });
+    }
+
+    void StopDaemon() {
+        if (daemon_) {
+            daemon_->Stop();
+            thread_.join();
+            daemon_.reset();
+        }
+    }
+
+    // 不使用守护进程的完整遍历
+    static std::string FullWriteTree() {
+        fs::path cache = ".git/fsmonitor--write-tree";
+        fs::path saved = ".git/saved-cache";
+        fs::rename(cache, saved);
+        std::string tree = write_tree(".");
+        fs::rename(saved, cache);
+        return tree;
+    }
+
+    std::unique_ptr<fsmonitor::Daemon> daemon_;
+    std::thread thread_;
+};
+
+// 目录排序中 "a-b" 在 "a" 和 "a/x" 之间，TouchedUnder 仍能找到子目录
+TEST_F(FsmonitorTest, ChangesMatchSubdirectories) {
+    fsmonitor::Changes changes;
+    changes.dirs = {"a-b", "a/x", "c"};
+    EXPECT_TRUE(changes.TouchedUnder(""));
+    EXPECT_TRUE(changes.TouchedUnder("a"));
+    EXPECT_FALSE(changes.Touched("a"));
+    EXPECT_TRUE(changes.Touched("a/x"));
+    EXPECT_FALSE(changes.TouchedUnder("a/y"));
+    EXPECT_FALSE(changes.TouchedUnder("b"));
+    changes.dirs.clear();
+    EXPECT_FALSE(changes.TouchedUnder(""));
+    changes.everything = true;
+    EXPECT_TRUE(changes.TouchedUnder("b"));
+}
+
+// 查询之前完成的修改都在结果中，只报告改过的目录
+TEST_F(FsmonitorTest, ReportsChangedDirectories) {
+    EXPECT_FALSE(fsmonitor::Query(".git", ""));
+    WriteFile("a/b/file", "1");
+    WriteFile("c/file", "2");
+    StartDaemon();
+
+    auto changes = fsmonitor::Query(".git", "");
+    ASSERT_TRUE(changes);
+    EXPECT_TRUE(changes->everything);
+
+    changes = fsmonitor::Query(".git", changes->token);
+    ASSERT_TRUE(changes);
+    EXPECT_FALSE(changes->everything);
+    EXPECT_TRUE(changes->dirs.empty());
+
+    WriteFile("a/b/file", "changed");
+    WriteFile("n/m/file", "new");
+    changes = fsmonitor::Query(".git", changes->token);
+    ASSERT_TRUE(changes);
+    EXPECT_TRUE(changes->Touched("a/b"));
+    EXPECT_TRUE(changes->Touched(""));
+    EXPECT_TRUE(changes->Touched("n"));
+    EXPECT_TRUE(changes->Touched("n/m"));
+    EXPECT_FALSE(changes->TouchedUnder("c"));
+
+    // 移走的目录：两边的父目录和新位置都算改过，旧位置不再被监视
+    fs::rename("n/m", "c/m");
+    changes = fsmonitor::Query(".git", changes->token);
+    ASSERT_TRUE(changes);
+    EXPECT_TRUE(changes->Touched("n"));
+    EXPECT_TRUE(changes->Touched("c"));
+    EXPECT_TRUE(changes->Touched("c/m"));
+    WriteFile("c/m/file", "again");
+    changes = fsmonitor::Query(".git", changes->token);
+    ASSERT_TRUE(changes);
+    EXPECT_EQ(changes->dirs, std::vector<std::string>{"c/m"});
+
+    // 其它实例的令牌无效
+    EXPECT_TRUE(fsmonitor::Query(".git", "0-0:1")->everything);
+    EXPECT_TRUE(fsmonitor::StopDaemon(".git"));
+    thread_.join();
+    daemon_.reset();
+    EXPECT_FALSE(fsmonitor::Query(".git", ""));
+}
+
+// 有守护进程时 write-tree 沿用没改过的子树，结果与完整遍历相同
+TEST_F(FsmonitorTest, WriteTreeMatchesFullWalk) {
+    for (int i = 0; i < 4; i++) {
+        for (int j = 0; j < 3; j++) {
+            WriteFile("d" + std::to_string(i) + "/s" + std::to_string(j) + "/f",
+                      std::to_string(i * 10 + j));
+        }
+    }
+    WriteFile("top", "top");
+    StartDaemon();
+    std::string tree = write_tree(".");
+    EXPECT_EQ(tree, FullWriteTree());
+    EXPECT_EQ(write_tree("."), tree);
+
+    WriteFile("d1/s2/f", "modified");
+    EXPECT_EQ(write_tree("."), FullWriteTree());
+    WriteFile("d2/new/deeper/g", "new");
+    EXPECT_EQ(write_tree("."), FullWriteTree());
+    fs::rename("d2/new", "d0/s0/moved");
+    EXPECT_EQ(write_tree("."), FullWriteTree());
+    fs::remove_all("d3");
+    fs::remove("top");
+    std::string after = write_tree(".");
+    EXPECT_EQ(after, FullWriteTree());
+    EXPECT_NE(after, tree);
+
+    // 守护进程停止后退回完整遍历
+    StopDaemon();
+    WriteFile("d1/s1/f", "offline");
+    std::string offline = write_tree(".");
+    EXPECT_NE(offline, after);
+    EXPECT_EQ(offline, FullWriteTree());
+}
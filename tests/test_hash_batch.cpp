@@ -0,0 +1,140 @@
+#include <gtest/gtest.h>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <unistd.h>
+#include "../include/clone_gadget.h"
+#include "../src/hash_batch.h"
+#include "../src/object_store.h"
+#include "test_util.h"
+
+namespace fs = std::filesystem;
+
+class HashBatchTest : public TempRepoTest {
+protected:
+    HashBatchTest() : TempRepoTest("hash_batch") {}
+
+    void SetUp() override {
+        unsetenv("MINIGIT_FSYNC_METHOD");
+        TempRepoTest::SetUp();
+    }
+
+    void TearDown() override {
+        unsetenv("MINIGIT_FSYNC_METHOD");
+        TempRepoTest::TearDown();
+    }
+
+    static std::string BlobHash(const std::string &content) {
+        return compute_sha1("blob " + std::to_string(content.size()) + '\0' + content);
+    }
+
+    // 第 i 个测试文件的内容，大小各不相同，让各线程完成的顺序被打乱
+    static std::string Content(int i) {
+        return std::string(static_cast<size_t>(i % 7) * 40000 + 1, 'a' + i % 26) +
+               std::to_string(i);
+    }
+
+    // 写出 count 个文件，返回 --stdin-paths 的输入和期望的输出
+    static std::pair<std::string, std::string> MakeFiles(int count) {
+        std::string paths, hashes;
+        fs::create_directories("files");
+        for (int i = 0; i < count; i++) {
+            std::string path = "files/f" + std::to_string(i);
+            std::ofstream(path, std::ios::binary) << Content(i);
+            paths += path + "\n";
+            hashes += BlobHash(Content(i)) + "\n";
+        }
+        return {paths, hashes};
+    }
+
+    static int Leftovers() {
+        int count = 0;
+        for (const auto &entry : fs::directory_iterator(".git/objects")) {
+            count += entry.path().filename().string().size() != 2;
+        }
+        return count;
+    }
+};
+
+// 多线程计算，输出顺序与输入相同；不带 -w 时不写对象
+TEST_F(HashBatchTest, PathsKeepInputOrder) {
+    auto [paths, hashes] = MakeFiles(200);
+    std::istringstream in(paths);
+    std::ostringstream out, err;
+    hash_batch::Options options;
+    options.threads = 4;
+    EXPECT_TRUE(hash_batch::Run(in, out, err, options));
+    EXPECT_EQ(out.str(), hashes);
+    EXPECT_EQ(err.str(), "");
+    EXPECT_TRUE(fs::is_empty(".git/objects"));
+}
+
+// 各种持久化方式下 -w 写出的对象在 Run 返回时都可以读取，没有残留
+TEST_F(HashBatchTest, WritesObjectsInEveryMode) {
+    auto [paths, hashes] = MakeFiles(50);
+    for (std::string method : {"none", "fsync", "batch"}) {
+        setenv("MINIGIT_FSYNC_METHOD", method.c_str(), 1);
+        fs::remove_all(".git/objects");
+        fs::create_directories(".git/objects");
+        std::istringstream in(paths);
+        std::ostringstream out, err;
+        hash_batch::Options options;
+        options.write_objects = true;
+        options.threads = 3;
+        EXPECT_TRUE(hash_batch::Run(in, out, err, options)) << method;
+        EXPECT_EQ(out.str(), hashes) << method;
+        ObjectStore store;
+        for (int i = 0; i < 50; i++) {
+            auto object = store.Read(BlobHash(Content(i)));
+            ASSERT_TRUE(object) << method << " " << i;
+            EXPECT_TRUE(object->data == Content(i)) << method << " " << i;
+        }
+        EXPECT_EQ(Leftovers(), 0) << method;
+    }
+}
+
+// --batch：每条输入是长度行加内容，内容中可以有换行和 NUL
+TEST_F(HashBatchTest, HashesContents) {
+    std::string contents[] = {"", "hello\n", std::string("a\0b\nc", 5),
+                              std::string(100000, 'x')};
+    std::string input, expected;
+    for (const auto &content : contents) {
+        input += std::to_string(content.size()) + "\n" + content;
+        expected += BlobHash(content) + "\n";
+    }
+    std::istringstream in(input);
+    std::ostringstream out, err;
+    hash_batch::Options options;
+    options.input = hash_batch::Input::kContents;
+    options.write_objects = true;
+    EXPECT_TRUE(hash_batch::Run(in, out, err, options));
+    EXPECT_EQ(out.str(), expected);
+    auto object = ObjectStore().Read(BlobHash(contents[2]));
+    ASSERT_TRUE(object);
+    EXPECT_TRUE(object->data == contents[2]);
+}
+
+// 出错时输出之前的结果和 fatal，之后的输入不再处理
+TEST_F(HashBatchTest, StopsAtFirstError) {
+    auto [paths, hashes] = MakeFiles(3);
+    std::istringstream in(paths + "files/missing\nfiles/f0\n");
+    std::ostringstream out, err;
+    hash_batch::Options options;
+    options.threads = 2;
+    EXPECT_FALSE(hash_batch::Run(in, out, err, options));
+    EXPECT_EQ(out.str(), hashes);
+    EXPECT_EQ(err.str().rfind("fatal: ", 0), 0u) << err.str();
+    EXPECT_NE(err.str().find("files/missing"), std::string::npos) << err.str();
+
+    // 长度不合法或内容不完整
+    for (std::string input : {"abc\n", "10\nshort"}) {
+        std::istringstream bad(input);
+        std::ostringstream bad_out, bad_err;
+        options.input = hash_batch::Input::kContents;
+        EXPECT_FALSE(hash_batch::Run(bad, bad_out, bad_err, options)) << input;
+        EXPECT_EQ(bad_out.str(), "");
+        EXPECT_EQ(bad_err.str().rfind("fatal: ", 0), 0u) << bad_err.str();
+    }
+}
@@ -0,0 +1,78 @@
+#include <gtest/gtest.h>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <string>
+#include <unistd.h>
+#include "../include/clone_gadget.h"
+#include "../src/object_store.h"
+#include "test_util.h"
+
+namespace fs = std::filesystem;
+
+class HashObjectTest : public TempRepoTest {
+protected:
+    HashObjectTest() : TempRepoTest("hash_object") {}
+
+    void SetUp() override {
+        unsetenv("MINIGIT_FSYNC_METHOD");
+        TempRepoTest::SetUp();
+    }
+
+    void TearDown() override {
+        unsetenv("MINIGIT_FSYNC_METHOD");
+        TempRepoTest::TearDown();
+    }
+
+    // 几乎不可压缩的内容，压缩结果放不进一个缓冲区，走临时文件
+    static std::string RandomBytes(size_t size) {
+        std::mt19937 rng(7);
+        std::string data(size, '\0');
+        for (auto &c : data) {
+            c = static_cast<char>(rng());
+        }
+        return data;
+    }
+
+    static std::string BlobHash(const std::string &content) {
+        return compute_sha1("blob " + std::to_string(content.size()) + '\0' + content);
+    }
+
+    // objects 目录中残留的临时文件或隔离目录
+    static int Leftovers() {
+        int count = 0;
+        for (const auto &entry : fs::directory_iterator(".git/objects")) {
+            count += entry.path().filename().string().size() != 2;
+        }
+        return count;
+    }
+};
+
+// 小文件、空文件和需要多个块的大文件的哈希与完整计算的一致，内容可读回
+TEST_F(HashObjectTest, StreamsFilesOfAnySize) {
+    for (std::string method : {"none", "fsync", "batch"}) {
+        setenv("MINIGIT_FSYNC_METHOD", method.c_str(), 1);
+        fs::remove_all(".git/objects");
+        for (const std::string &content :
+             {std::string(), std::string("hello\n"), std::string(1 << 20, 'x'),
+              RandomBytes(3 << 20)}) {
+            WriteFile("file.bin", content);
+            std::string hash = hash_object("file.bin");
+            EXPECT_EQ(hash, BlobHash(content)) << method;
+            auto object = ObjectStore().Read(hash);
+            ASSERT_TRUE(object) << method;
+            EXPECT_EQ(object->type, ObjectType::kBlob);
+            EXPECT_TRUE(object->data == content) << method;
+            // 已存在的对象再写一次不出错
+            EXPECT_EQ(hash_object("file.bin"), hash);
+        }
+        EXPECT_EQ(Leftovers(), 0) << method;
+    }
+}
+
+// 文件不存在时报错，不再当作空文件
+TEST_F(HashObjectTest, ReportsMissingFile) {
+    EXPECT_THROW(hash_object("missing.txt"), std::runtime_error);
+    EXPECT_EQ(Leftovers(), 0);
+}
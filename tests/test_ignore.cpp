@@ -0,0 +1,232 @@
+#include <gtest/gtest.h>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+#include "../include/clone_gadget.h"
+#include "../src/checkout.h"
+#include "../src/fsmonitor.h"
+#include "../src/ignore.h"
+#include "../src/object_store.h"
+#include "../src/refs.h"
+#include "../src/status.h"
+#include "test_util.h"
+
+namespace fs = std::filesystem;
+
+class IgnoreTest : public TempRepoTest {
+protected:
+    IgnoreTest() : TempRepoTest("ignore") {}
+
+    void SetUp() override {
+        unsetenv("MINIGIT_FSYNC_METHOD");
+        TempRepoTest::SetUp();
+    }
+
+    void TearDown() override {
+        if (daemon_) {
+            daemon_->Stop();
+            thread_.join();
+        }
+        TempRepoTest::TearDown();
+    }
+
+    // 不使用缓存的完整遍历
+    static std::string FullWriteTree() {
+        fs::path cache = ".git/fsmonitor--write-tree";
+        fs::path saved = ".git/saved-cache";
+        fs::rename(cache, saved);
+        std::string tree = write_tree(".");
+        fs::rename(saved, cache);
+        return tree;
+    }
+
+    std::vector<std::string> Porcelain(const std::string &head) {
+        ObjectStore store;
+        std::vector<std::string> lines;
+        for (const auto &entry : status::Status(store, ".", head)) {
+            lines.push_back(status::FormatPorcelain(entry));
+        }
+        return lines;
+    }
+
+    void StartDaemon() {
+        daemon_ = std::make_unique<fsmonitor::Daemon>(".");
+        thread_ = std::thread([this] { daemon_->Run(); });
+    }
+
+    std::unique_ptr<fsmonitor::Daemon> daemon_;
+    std::thread thread_;
+};
+
+TEST_F(IgnoreTest, WildMatch) {
+    using ignore::WildMatch;
+    EXPECT_TRUE(WildMatch("*.o", "a.o"));
+    EXPECT_FALSE(WildMatch("*.o", "dir/a.o"));
+    EXPECT_TRUE(WildMatch("a?c", "abc"));
+    EXPECT_FALSE(WildMatch("a?c", "a/c"));
+    EXPECT_TRUE(WildMatch("[a-c]x", "bx"));
+    EXPECT_FALSE(WildMatch("[!a-c]x", "bx"));
+    EXPECT_TRUE(WildMatch("[[:digit:]]*", "1abc"));
+    EXPECT_TRUE(WildMatch("\\*", "*"));
+    EXPECT_FALSE(WildMatch("\\*", "a"));
+    EXPECT_TRUE(WildMatch("**/foo", "foo"));
+    EXPECT_TRUE(WildMatch("**/foo", "a/b/foo"));
+    EXPECT_TRUE(WildMatch("a/**", "a/b/c"));
+    EXPECT_TRUE(WildMatch("a/**/b", "a/b"));
+    EXPECT_TRUE(WildMatch("a/**/b", "a/x/y/b"));
+    EXPECT_FALSE(WildMatch("a/**/b", "a/x/y/c"));
+    EXPECT_FALSE(WildMatch("a**b", "a/b"));
+}
+
+// 后面的规则优先；"!" 重新包含；末尾的 '/' 只匹配目录；含 '/' 的规则锚定在
+// .gitignore 所在目录
+TEST_F(IgnoreTest, PatternPrecedence) {
+    ignore::PatternList list("# comment\n"
+                             "*.log\n"
+                             "!keep.log\n"
+                             "build/\n"
+                             "/top\n"
+                             "doc/*.txt\n"
+                             "trailing  \n"
+                             "tmp*\n"
+                             "!tmpkeep\n",
+                             "sub");
+    using ignore::Result;
+    EXPECT_EQ(list.Match("sub/a.log", false), Result::kIgnored);
+    EXPECT_EQ(list.Match("sub/x/a.log", false), Result::kIgnored);
+    EXPECT_EQ(list.Match("sub/x/keep.log", false), Result::kIncluded);
+    EXPECT_EQ(list.Match("sub/build", true), Result::kIgnored);
+    EXPECT_EQ(list.Match("sub/build", false), Result::kNone);
+    EXPECT_EQ(list.Match("sub/top", false), Result::kIgnored);
+    EXPECT_EQ(list.Match("sub/x/top", false), Result::kNone);
+    EXPECT_EQ(list.Match("sub/doc/a.txt", false), Result::kIgnored);
+    EXPECT_EQ(list.Match("sub/x/doc/a.txt", false), Result::kNone);
+    EXPECT_EQ(list.Match("sub/trailing", false), Result::kIgnored);
+    EXPECT_EQ(list.Match("sub/tmp1", false), Result::kIgnored);
+    EXPECT_EQ(list.Match("sub/tmpkeep", false), Result::kIncluded);
+    EXPECT_EQ(list.Match("sub/# comment", false), Result::kNone);
+
+    // 更深的 .gitignore 优先，info/exclude 最后
+    WriteFile(".git/info/exclude", "*.tmp\nshadow\n");
+    WriteFile(".gitignore", "*.log\n");
+    WriteFile("a/.gitignore", "!*.log\n");
+    ignore::Matcher matcher(".");
+    matcher.Push("");
+    EXPECT_TRUE(matcher.Ignored("x.log", false));
+    EXPECT_TRUE(matcher.Ignored("x.tmp", false));
+    EXPECT_EQ(matcher.PushPath("a/b"), 2u);
+    EXPECT_FALSE(matcher.Ignored("a/b/x.log", false));
+    EXPECT_TRUE(matcher.Ignored("a/b/shadow", true));
+    matcher.Pop(2);
+    EXPECT_TRUE(matcher.Ignored("x.log", false));
+}
+
+// write-tree 跳过被排除的文件和目录，结果与没有这些文件时相同
+TEST_F(IgnoreTest, WriteTreeSkipsIgnored) {
+    WriteFile(".gitignore", "*.o\nbuild/\n");
+    WriteFile("src/main.c", "int main;\n");
+    WriteFile("src/.gitignore", "!keep.o\ngen/\n");
+    std::string clean = write_tree(".");
+
+    WriteFile("src/main.o", "obj");
+    WriteFile("src/keep.o", "kept");
+    WriteFile("build/out/bin", "bin");
+    WriteFile("src/gen/x.c", "x");
+    WriteFile("only/a.o", "a");
+    std::string with_junk = write_tree(".");
+    EXPECT_NE(with_junk, clean);
+
+    fs::remove_all("src/main.o");
+    fs::remove_all("build");
+    fs::remove_all("src/gen");
+    fs::remove_all("only");
+    EXPECT_EQ(write_tree("."), with_junk);
+    fs::remove("src/keep.o");
+    EXPECT_EQ(write_tree("."), clean);
+}
+
+// 已跟踪的文件之后匹配了规则也保留，与 git add -A && git write-tree 相同：
+// 没有 index 时以 HEAD 为准，有 index 时以 index 为准
+TEST_F(IgnoreTest, WriteTreeKeepsTrackedFiles) {
+    WriteFile("app.log", "log\n");
+    WriteFile("build/keep", "k\n");
+    WriteFile("src/a.c", "a\n");
+    std::string tree = write_tree(".");
+    MiniGitRef refs;
+    refs.Init();
+    ASSERT_TRUE(refs.UpdateCurrentBranch(commit_tree(tree, "", "initial")));
+
+    WriteFile(".git/info/exclude", "*.log\nbuild/\n");
+    WriteFile("new.log", "n\n");
+    WriteFile("build/junk", "j\n");
+    EXPECT_EQ(write_tree("."), tree);
+
+    ObjectStore store;
+    ASSERT_TRUE(checkout::CheckoutTree(store, ".", "", tree).Ok());
+    ASSERT_TRUE(refs.UpdateCurrentBranch(
+        commit_tree(Store("tree", ""), "", "empty")));
+    EXPECT_EQ(write_tree("."), tree);
+}
+
+// 有守护进程时，.gitignore 或 info/exclude 变了的目录重新遍历
+TEST_F(IgnoreTest, WriteTreeCacheFollowsRules) {
+    WriteFile("a/b/x.c", "x");
+    WriteFile("a/b/y.log", "y");
+    StartDaemon();
+    std::string first = write_tree(".");
+    EXPECT_EQ(write_tree("."), first);
+
+    WriteFile("a/.gitignore", "*.log\n");
+    std::string ignored = write_tree(".");
+    EXPECT_NE(ignored, first);
+    EXPECT_EQ(ignored, FullWriteTree());
+
+    WriteFile(".git/info/exclude", "x.c\n");
+    std::string excluded = write_tree(".");
+    EXPECT_NE(excluded, ignored);
+    EXPECT_EQ(excluded, FullWriteTree());
+
+    fs::remove(".git/info/exclude");
+    fs::remove("a/.gitignore");
+    EXPECT_EQ(write_tree("."), first);
+}
+
+// status 不列出被排除的文件；规则改变后缓存的目录列表不再使用
+TEST_F(IgnoreTest, StatusHidesIgnored) {
+    WriteFile("tracked.log", "t\n");
+    WriteFile("src/a.c", "a\n");
+    std::string head = write_tree(".");
+    ObjectStore store;
+    ASSERT_TRUE(checkout::CheckoutTree(store, ".", "", head).Ok());
+
+    WriteFile("src/a.o", "o");
+    WriteFile("src/new.log", "n");
+    WriteFile("build/out", "b");
+    EXPECT_EQ(Porcelain(head), (std::vector<std::string>{
+                                   "?? build/", "?? src/a.o", "?? src/new.log"}));
+
+    WriteFile(".git/info/exclude", "build\n");
+    EXPECT_EQ(Porcelain(head), (std::vector<std::string>{"?? src/a.o",
+                                                         "?? src/new.log"}));
+    // 已跟踪的文件不受规则影响；.gitignore 自身未跟踪
+    WriteFile("src/.gitignore", "*.o\n*.log\n");
+    WriteFile("tracked.log", "changed\n");
+    EXPECT_EQ(Porcelain(head), (std::vector<std::string>{" M tracked.log",
+                                                         "?? src/.gitignore"}));
+    // 只改内容、目录 mtime 不变时也要发现
+    WriteFile("src/.gitignore", "*.o\n");
+    EXPECT_EQ(Porcelain(head), (std::vector<std::string>{
+                                   " M tracked.log", "?? src/.gitignore",
+                                   "?? src/new.log"}));
+    // 目录中只剩被排除的文件时不报告
+    fs::remove("src/new.log");
+    WriteFile("only/x.o", "x");
+    WriteFile("only/.gitignore", "*.o\n.gitignore\n");
+    EXPECT_EQ(Porcelain(head), (std::vector<std::string>{" M tracked.log",
+                                                         "?? src/.gitignore"}));
+}
@@ -0,0 +1,162 @@
+#include <gtest/gtest.h>
+#include <cstdlib>
+#include <filesystem>
+#include <string>
+#include <unistd.h>
+#include <vector>
+#include "../include/clone_gadget.h"
+#include "../src/delta.h"
+#include "../src/ingest.h"
+#include "../src/object_store.h"
+#include "test_util.h"
+
+namespace fs = std::filesystem;
+
+class IngestTest : public TempRepoTest {
+protected:
+    IngestTest() : TempRepoTest("ingest") {}
+
+    void SetUp() override {
+        // 这里测试的是默认（不 fsync）的写入方式
+        unsetenv("MINIGIT_FSYNC_METHOD");
+        TempRepoTest::SetUp();
+    }
+
+    // pack 对象头：类型 + 变长长度（低4位在首字节）
+    static void PutObjectHeader(std::string &out, int type, size_t size) {
+        unsigned char byte = static_cast<unsigned char>((type << 4) | (size & 0x0F));
+        size >>= 4;
+        while (size) {
+            out.push_back(static_cast<char>(byte | 0x80));
+            byte = size & 0x7F;
+            size >>= 7;
+        }
+        out.push_back(static_cast<char>(byte));
+    }
+
+    static std::string PackHeader(int objects) {
+        std::string pack = "PACK";
+        pack += std::string("\0\0\0\2", 4);
+        for (int i = 3; i >= 0; i--) {
+            pack.push_back(static_cast<char>((objects >> (i * 8)) & 0xFF));
+        }
+        return pack;
+    }
+};
+
+// Reset 回收全部分配；多个块合并为一个，之后同样的一轮分配不再申请内存
+TEST_F(IngestTest, ArenaRecyclesBlocks) {
+    ingest::Arena arena(64);
+    char *first = arena.Allocate(10);
+    char *second = arena.Allocate(10);
+    EXPECT_EQ(second - first, 16); // 16 字节对齐
+    arena.Allocate(100);           // 放不下，新块
+    EXPECT_EQ(arena.BlockAllocations(), 2u);
+    EXPECT_EQ(arena.Capacity(), 64u + 112u);
+
+    arena.Reset();
+    EXPECT_EQ(arena.BlockAllocations(), 3u);
+    for (int round = 0; round < 3; round++) {
+        arena.Allocate(10);
+        arena.Allocate(10);
+        arena.Allocate(100);
+        arena.Reset();
+    }
+    EXPECT_EQ(arena.BlockAllocations(), 3u);
+    EXPECT_EQ(arena.Allocations(), 12u);
+
+    arena.Release();
+    EXPECT_EQ(arena.Capacity(), 0u);
+}
+
+// 解压返回流占用的字节数；长度与对象头不符时报错
+TEST_F(IngestTest, InflaterChecksLength) {
+    std::string data(1000, 'x');
+    std::string stream = compress_string(data) + "trailing";
+    ingest::Inflater inflater;
+    std::string out(data.size(), '\0');
+    EXPECT_EQ(inflater.Inflate(stream.data(), stream.size(), out.data(), out.size()),
+              stream.size() - 8);
+    EXPECT_EQ(out, data);
+
+    std::string small(999, '\0');
+    EXPECT_THROW(inflater.Inflate(stream.data(), stream.size(), small.data(), small.size()),
+                 std::runtime_error);
+    std::string large(1001, '\0');
+    EXPECT_THROW(inflater.Inflate(stream.data(), stream.size(), large.data(), large.size()),
+                 std::runtime_error);
+    EXPECT_THROW(inflater.Inflate(stream.data(), 10, out.data(), out.size()),
+                 std::runtime_error);
+}
+
+// 多字节长度的完整对象和 REF_DELTA 对象都按对象头中的长度解包
+TEST_F(IngestTest, UnpacksObjectsAndDeltas) {
+    std::string base(5000, 'a');
+    for (size_t i = 0; i < base.size(); i += 7) {
+        base[i] = static_cast<char>('a' + i % 26);
+    }
+    std::string target = base.substr(0, 3000) + "changed" + base.substr(3000);
+    std::string delta = DeltaIndex(base).CreateDelta(target);
+    ASSERT_FALSE(delta.empty());
+    std::string base_raw = "blob " + std::to_string(base.size()) + '\0' + base;
+    std::string base_hash = compute_sha1(base_raw);
+    std::string target_raw = "blob " + std::to_string(target.size()) + '\0' + target;
+    std::string target_hash = compute_sha1(target_raw);
+    std::string commit = "tree " + std::string(40, '0') + "\n\nmessage\n";
+    std::string commit_raw = "commit " + std::to_string(commit.size()) + '\0' + commit;
+    std::string commit_hash = compute_sha1(commit_raw);
+
+    std::string pack = PackHeader(3);
+    PutObjectHeader(pack, 3, base.size());
+    pack += compress_string(base);
+    PutObjectHeader(pack, 7, delta.size());
+    byte_util::HexToBinary(base_hash, pack);
+    pack += compress_string(delta);
+    PutObjectHeader(pack, 1, commit.size());
+    pack += compress_string(commit);
+    pack += std::string(20, '\0');
+
+    std::string master = unpack_objects(pack, ".", commit_hash);
+    EXPECT_EQ(master, std::string(1, '\0') + commit);
+    ObjectStore store;
+    auto object = store.Read(target_hash);
+    ASSERT_TRUE(object);
+    EXPECT_EQ(object->data, target);
+    EXPECT_TRUE(store.HasLoose(base_hash));
+
+    // 再次解包时已有的对象不会重写
+    EXPECT_EQ(unpack_objects(pack, ".", commit_hash), master);
+
+    // 截断的 pack 报错
+    EXPECT_THROW(unpack_objects(pack.substr(0, 100), ".", ""), std::runtime_error);
+}
+
+// io_uring 和线程池两种方式写出的对象相同；跨批写入，已有的对象不重写
+TEST_F(IngestTest, WritesLooseObjectsInBatches) {
+    for (auto mode : {ingest::WriteMode::kUring, ingest::WriteMode::kThreads}) {
+        fs::remove_all(".git/objects");
+        std::vector<std::string> hashes;
+        {
+            ingest::LooseObjectWriter writer(".", mode);
+            size_t count = ingest::LooseObjectWriter::kBatchObjects + 10;
+            for (size_t i = 0; i < count; i++) {
+                std::string raw = "blob " + std::to_string(std::to_string(i).size()) +
+                                  '\0' + std::to_string(i);
+                hashes.push_back(compute_sha1(raw));
+                writer.Write(hashes.back().c_str(), raw.data(), raw.size());
+            }
+            // 第一批已经写出，最后 10 个还在队列中
+            EXPECT_TRUE(ObjectStore().HasLoose(hashes.front()));
+            EXPECT_FALSE(ObjectStore().HasLoose(hashes.back()));
+            std::string raw = std::string("blob 1") + '\0' + "0";
+            writer.Write(hashes.front().c_str(), raw.data(), raw.size());
+            writer.Flush();
+        }
+        ObjectStore store;
+        for (size_t i = 0; i < hashes.size(); i++) {
+            auto object = store.Read(hashes[i]);
+            ASSERT_TRUE(object);
+            EXPECT_EQ(object->data, std::to_string(i));
+        }
+    }
+}
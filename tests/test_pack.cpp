@@ -0,0 +1,348 @@
+#include <gtest/gtest.h>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <string>
+#include <unistd.h>
+#include "../include/clone_gadget.h"
+#include "../src/config.h"
+#include "../src/delta.h"
+#include "../src/dircache.h"
+#include "../src/object_store.h"
+#include "../src/pack.h"
+#include "../src/refs.h"
+#include "../src/repack.h"
+#include "test_util.h"
+
+namespace fs = std::filesystem;
+
+static std::string RandomText(size_t size, unsigned seed) {
+    std::mt19937 rng(seed);
+    std::string text(size, ' ');
+    for (auto &c : text) {
+        c = "abcdefgh \n"[rng() % 10];
+    }
+    return text;
+}
+
+class PackTest : public TempRepoTest {
+protected:
+    PackTest() : TempRepoTest("pack") {}
+};
+
+// 滚动哈希生成的 delta 应能还原目标，并且远小于目标
+TEST_F(PackTest, CreateDeltaRoundTrip) {
+    std::string base = RandomText(100000, 1);
+    std::string target = base;
+    target.insert(5000, "inserted text");
+    target.erase(60000, 300);
+    target.replace(90000, 10, "REPLACED!!");
+    target += "tail";
+
+    std::string delta = create_delta(base, target);
+    EXPECT_EQ(apply_delta(delta, base), target);
+    EXPECT_LT(delta.size(), 200u);
+
+    // 完全不同或很短的内容也必须能正确还原
+    std::string other = RandomText(5000, 2);
+    EXPECT_EQ(apply_delta(create_delta(base, other), base), other);
+    EXPECT_EQ(apply_delta(create_delta("short", "tiny"), "short"), "tiny");
+    EXPECT_EQ(apply_delta(create_delta("", "abc"), ""), "abc");
+}
+
+// 超过上限时放弃
+TEST_F(PackTest, CreateDeltaRespectsMaxSize) {
+    std::string base = RandomText(10000, 3);
+    std::string target = RandomText(10000, 4);
+    EXPECT_TRUE(create_delta(base, target, 1000).empty());
+    EXPECT_FALSE(create_delta(base, base, 1000).empty());
+}
+
+// 写出的 pack 可以按哈希读回全部对象，且相似对象被存为 delta
+TEST_F(PackTest, WritePackRoundTrip) {
+    std::map<std::string, GitObject> objects;
+    std::vector<pack::PackInput> inputs;
+    std::string content = RandomText(20000, 5);
+    for (int i = 0; i < 20; i++) {
+        content.replace(i * 700, 5, "v" + std::to_string(i) + "!!");
+        std::string raw = "blob " + std::to_string(content.size()) + '\0' + content;
+        std::string hash = compute_sha1(raw);
+        objects[hash] = {ObjectType::kBlob, content};
+        inputs.push_back({hash, ObjectType::kBlob, content.size(),
+                          pack::NameHash("file.txt")});
+    }
+    auto result = pack::WritePack(
+        ".git/objects/pack", inputs,
+        [&objects](const std::string &hash) { return objects.at(hash); });
+    EXPECT_EQ(result.objects, 20u);
+    EXPECT_GE(result.deltas, 15u);
+    EXPECT_LT(fs::file_size(result.pack_path), 20000u);
+
+    pack::PackFile packfile(result.idx_path);
+    EXPECT_EQ(packfile.Count(), 20u);
+    EXPECT_EQ(packfile.Checksum(), result.checksum);
+    for (const auto &[hash, object] : objects) {
+        auto offset = packfile.Find(hash);
+        ASSERT_TRUE(offset.has_value()) << hash;
+        GitObject read = packfile.ReadAt(*offset);
+        EXPECT_EQ(read.type, ObjectType::kBlob);
+        EXPECT_EQ(read.data, object.data);
+        EXPECT_EQ(packfile.InfoAt(*offset).second, object.data.size());
+    }
+    EXPECT_FALSE(packfile.Find(std::string(40, '0')).has_value());
+}
+
+// repack -a -d 和 gc 之后松散对象被清理，所有对象仍可读取和检出
+TEST_F(PackTest, RepackAndGcKeepObjectsReadable) {
+    MiniGitRef refs;
+    refs.Init();
+    std::string parent;
+    std::string content = RandomText(8000, 6);
+    std::string tree;
+    for (int i = 0; i < 4; i++) {
+        content += "line " + std::to_string(i) + "\n";
+        WriteFile("doc.txt", content);
+        WriteFile("sub/n.txt", std::to_string(i));
+        tree = write_tree(".");
+        parent = commit_tree(tree, parent, "c" + std::to_string(i));
+        refs.UpdateCurrentBranch(parent);
+    }
+    size_t loose_before = ObjectStore().ListLoose().size();
+    ASSERT_GT(loose_before, 0u);
+
+    RepackOptions options;
+    options.all = true;
+    options.remove_redundant = true;
+    RepackResult result = Repack(options);
+    EXPECT_FALSE(result.pack_checksum.empty());
+    EXPECT_GT(result.deltas, 0u);
+
+    // 不可达的松散对象会被 gc 删除
+    WriteFile("../unreachable_" + std::to_string(getpid()), "garbage");
+    std::string garbage =
+        hash_object("../unreachable_" + std::to_string(getpid()));
+    fs::remove("../unreachable_" + std::to_string(getpid()));
+    size_t pruned = 0;
+    Gc(options, time(nullptr) + 1, pruned);
+    EXPECT_EQ(pruned, 1u);
+
+    ObjectStore store;
+    EXPECT_TRUE(store.ListLoose().empty());
+    EXPECT_EQ(store.Packs().size(), 1u);
+    EXPECT_FALSE(store.Contains(garbage));
+    auto commit = store.Read(parent);
+    ASSERT_TRUE(commit.has_value());
+    EXPECT_EQ(commit->type, ObjectType::kCommit);
+
+    fs::create_directory("out");
+    restore_tree(tree, "out", ".");
+    std::ifstream doc("out/doc.txt", std::ios::binary);
+    std::string checked_out((std::istreambuf_iterator<char>(doc)),
+                            std::istreambuf_iterator<char>());
+    EXPECT_EQ(checked_out, content);
+}
+
+// 没有可达对象、不写出新 pack 时，repack -a -d 不删除已有的 pack
+TEST_F(PackTest, RepackWithoutNewPackKeepsOldPacks) {
+    MiniGitRef refs;
+    refs.Init();
+    WriteFile("doc.txt", "content\n");
+    std::string commit = commit_tree(write_tree("."), "", "c0");
+    refs.UpdateCurrentBranch(commit);
+    RepackOptions options;
+    options.all = options.remove_redundant = true;
+    ASSERT_FALSE(Repack(options).pack_checksum.empty());
+
+    fs::remove(".git/refs/heads/main");
+    fs::remove_all(".git/logs");
+    ASSERT_TRUE(ReachabilityTips(ObjectStore()).empty());
+    RepackResult result = Repack(options);
+    EXPECT_TRUE(result.pack_checksum.empty());
+    EXPECT_EQ(result.removed_packs, 0u);
+    ObjectStore store;
+    EXPECT_EQ(store.Packs().size(), 1u);
+    EXPECT_TRUE(store.Contains(commit));
+}
+
+// gc 把旧 pack 中不可达的对象写成松散对象，过了 --prune 的时间才删除；
+// index 中暂存的 blob 总是保留
+TEST_F(PackTest, GcKeepsRecentUnreachableAndIndexObjects) {
+    MiniGitRef refs;
+    refs.Init();
+    WriteFile("doc.txt", "v1\n");
+    std::string tree1 = write_tree(".");
+    std::string c1 = commit_tree(tree1, "", "c1");
+    refs.UpdateCurrentBranch(c1);
+    RepackOptions options;
+    size_t pruned = 0;
+    Gc(options, time(nullptr) + 1, pruned);
+
+    WriteFile("doc.txt", "v2\n");
+    std::string c2 = commit_tree(write_tree("."), "", "c2");
+    refs.UpdateCurrentBranch(c2);
+    fs::remove_all(".git/logs");
+    WriteFile("staged.txt", "staged\n");
+    std::string staged = hash_object("staged.txt");
+    dircache::IndexEntry entry;
+    entry.mode = 0100644;
+    entry.hash = staged;
+    entry.path = "staged.txt";
+    dircache::Index index;
+    index.SetEntries({entry});
+    index.Write(".git/index");
+
+    // 一小时的宽限期内，c1 的对象从旧 pack 中写出为松散对象
+    RepackResult result = Gc(options, time(nullptr) - 3600, pruned);
+    EXPECT_EQ(result.unpacked, 3u);
+    EXPECT_EQ(pruned, 0u);
+    ObjectStore store;
+    EXPECT_EQ(store.Packs().size(), 1u);
+    EXPECT_TRUE(store.HasLoose(c1));
+    EXPECT_TRUE(store.HasLoose(tree1));
+    EXPECT_TRUE(store.InAnyPack(staged));
+
+    // --prune=now 时删除
+    result = Gc(options, time(nullptr) + 1, pruned);
+    EXPECT_EQ(result.unpacked, 0u);
+    EXPECT_EQ(pruned, 3u);
+    store.ReloadPacks();
+    EXPECT_FALSE(store.Contains(c1));
+    EXPECT_FALSE(store.Contains(tree1));
+    EXPECT_TRUE(store.Contains(c2));
+    EXPECT_TRUE(store.Contains(staged));
+}
+
+// 多线程搜索和窗口内存上限不影响正确性
+TEST_F(PackTest, ParallelDeltaSearch) {
+    std::map<std::string, GitObject> objects;
+    std::vector<pack::PackInput> inputs;
+    for (int file = 0; file < 40; file++) {
+        std::string content = RandomText(4000, 100 + file);
+        for (int version = 0; version < 25; version++) {
+            content.replace((version * 97) % 3900, 4, std::to_string(version));
+            std::string raw =
+                "blob " + std::to_string(content.size()) + '\0' + content;
+            std::string hash = compute_sha1(raw);
+            objects[hash] = {ObjectType::kBlob, content};
+            inputs.push_back({hash, ObjectType::kBlob, content.size(),
+                              pack::NameHash("f" + std::to_string(file))});
+        }
+    }
+    auto loader = [&objects](const std::string &hash) {
+        return objects.at(hash);
+    };
+    pack::PackWriteOptions serial;
+    serial.threads = 1;
+    auto one = pack::WritePack(".git/objects/pack", inputs, loader, serial);
+
+    pack::PackWriteOptions parallel;
+    parallel.threads = 4;
+    parallel.window_memory = 16 * 1024; // 只够放下几个候选对象
+    auto four = pack::WritePack(".git/objects/pack", inputs, loader, parallel);
+
+    EXPECT_EQ(one.objects, four.objects);
+    EXPECT_GT(four.deltas, four.objects * 8 / 10);
+    pack::PackFile packfile(four.idx_path);
+    for (const auto &[hash, object] : objects) {
+        auto offset = packfile.Find(hash);
+        ASSERT_TRUE(offset.has_value());
+        EXPECT_EQ(packfile.ReadAt(*offset).data, object.data);
+    }
+}
+
+// 再次 repack 时已在 pack 中的对象和 delta 被原样复制，只压缩新对象
+TEST_F(PackTest, RepackReusesPackedObjects) {
+    MiniGitRef refs;
+    refs.Init();
+    std::string parent;
+    std::string content = RandomText(20000, 7);
+    auto commit = [&](int i) {
+        content.replace(i * 500, 8, "edit " + std::to_string(i) + "!");
+        WriteFile("doc.txt", content);
+        parent = commit_tree(write_tree("."), parent, "c" + std::to_string(i));
+        refs.UpdateCurrentBranch(parent);
+    };
+    for (int i = 0; i < 5; i++) {
+        commit(i);
+    }
+    RepackOptions options;
+    options.all = options.remove_redundant = true;
+    RepackResult first = Repack(options);
+    EXPECT_EQ(first.reused, 0u);
+    ASSERT_GT(first.deltas, 0u);
+
+    commit(5);
+    RepackResult second = Repack(options);
+    EXPECT_EQ(second.reused, first.objects);
+    EXPECT_EQ(second.objects, first.objects + 3);
+    EXPECT_GE(second.deltas, first.deltas);
+
+    // 新 idx 中的 CRC32 与复制（及改写对象头）后的数据一致
+    ObjectStore store;
+    ASSERT_EQ(store.Packs().size(), 1u);
+    const pack::PackFile &packfile = *store.Packs()[0];
+    for (size_t i = 0; i < packfile.Count(); i++) {
+        EXPECT_NO_THROW(packfile.RawAt(i));
+    }
+    auto head = store.Read(parent);
+    ASSERT_TRUE(head.has_value());
+    fs::create_directory("out");
+    restore_tree(head->data.substr(5, 40), "out", ".");
+    std::ifstream doc("out/doc.txt", std::ios::binary);
+    EXPECT_EQ(std::string((std::istreambuf_iterator<char>(doc)),
+                          std::istreambuf_iterator<char>()),
+              content);
+
+    // 损坏的数据不会被复制到新 pack
+    fs::path pack_path = packfile.PackPath();
+    fs::permissions(pack_path, fs::perms::owner_write, fs::perm_options::add);
+    {
+        std::fstream file(pack_path,
+                          std::ios::in | std::ios::out | std::ios::binary);
+        file.seekp(fs::file_size(pack_path) / 2);
+        file.put('\xff');
+    }
+    EXPECT_THROW(Repack(options), std::runtime_error);
+}
+
+// pack.* 配置项从 .git/config 读取
+TEST_F(PackTest, PackConfig) {
+    WriteFile(".git/config", "[core]\n\tbare = false\n"
+                             "[pack]\n\tthreads = 3 ; comment\n"
+                             "\twindowMemory = 256m\n"
+                             "[remote \"Origin\"]\n\turl = \"x y\"\n");
+    Config config;
+    EXPECT_EQ(config.GetInt("pack.threads", 0), 3);
+    EXPECT_EQ(config.GetInt("pack.windowmemory", 0), 256 << 20);
+    EXPECT_EQ(config.GetInt("pack.depth", 50), 50);
+    EXPECT_FALSE(config.GetBool("core.bare", true));
+    EXPECT_EQ(config.Get("remote.Origin.url").value_or(""), "x y");
+    EXPECT_FALSE(config.Get("remote.origin.url").has_value());
+}
+
+// Set/Unset 按行改写 .git/config，保留其它行，重新读取得到相同的值
+TEST_F(PackTest, ConfigSetAndUnset) {
+    WriteFile(".git/config", "# top\n[core]\n\tbare = false\n"
+                             "\tsparseCheckout = false\n"
+                             "[pack]\n\tthreads = 3\n");
+    Config config;
+    config.Set("core.sparseCheckout", "true");
+    config.Set("core.sparseCheckoutCone", "true");
+    config.Set("remote.Origin.url", " a#b ");
+    config.Unset("pack.threads");
+    config.Unset("pack.missing");
+    EXPECT_EQ(ReadFile(".git/config"),
+              "# top\n[core]\n\tbare = false\n"
+              "\tsparseCheckout = true\n\tsparseCheckoutCone = true\n"
+              "[pack]\n"
+              "[remote \"Origin\"]\n\turl = \" a#b \"\n");
+    EXPECT_TRUE(config.GetBool("core.sparsecheckout", false));
+    EXPECT_FALSE(config.Get("pack.threads").has_value());
+
+    Config reread;
+    EXPECT_TRUE(reread.GetBool("core.sparseCheckoutCone", false));
+    EXPECT_FALSE(reread.GetBool("core.bare", true));
+    EXPECT_EQ(reread.Get("remote.Origin.url").value_or(""), " a#b ");
+    EXPECT_FALSE(reread.Get("pack.threads").has_value());
+    EXPECT_THROW(config.Set("nosection", "x"), std::invalid_argument);
+}
@@ -0,0 +1,164 @@
+#include <gtest/gtest.h>
+#include <ctime>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <unistd.h>
+#include <vector>
+#include "../src/reflog.h"
+#include "test_util.h"
+
+namespace fs = std::filesystem;
+
+// 生成第 i 个测试用的40字符哈希
+static std::string FakeHash(int i) {
+    char buf[41];
+    snprintf(buf, sizeof(buf), "%040x", i);
+    return buf;
+}
+
+// 按 Git 的格式拼出一行日志
+static std::string LogLine(int from, int to, time_t timestamp,
+                           const std::string &message) {
+    return FakeHash(from) + ' ' + FakeHash(to) + " A U Thor <a@u.thor> " +
+           std::to_string(timestamp) + " +0000\t" + message + '\n';
+}
+
+class ReflogTest : public TempRepoTest {
+protected:
+    ReflogTest() : TempRepoTest("reflog") {}
+};
+
+// 追加后按 n 查找：n=0 是最新的记录
+TEST_F(ReflogTest, AppendThenLookupAndCount) {
+    Reflog reflog;
+    EXPECT_FALSE(reflog.Exists("refs/heads/main"));
+    EXPECT_EQ(reflog.Count("refs/heads/main"), 0u);
+    EXPECT_FALSE(reflog.Lookup("refs/heads/main", 0).has_value());
+
+    reflog.Append("refs/heads/main", "", FakeHash(1), "commit (initial): one");
+    reflog.Append("refs/heads/main", FakeHash(1), FakeHash(2), "commit: two");
+    reflog.Append("refs/heads/main", FakeHash(2), FakeHash(3), "commit: three");
+
+    EXPECT_TRUE(reflog.Exists("refs/heads/main"));
+    EXPECT_EQ(reflog.Count("refs/heads/main"), 3u);
+    auto newest = reflog.Lookup("refs/heads/main", 0);
+    ASSERT_TRUE(newest.has_value());
+    EXPECT_EQ(newest->old_hash, FakeHash(2));
+    EXPECT_EQ(newest->new_hash, FakeHash(3));
+    EXPECT_EQ(newest->message, "commit: three");
+    auto oldest = reflog.Lookup("refs/heads/main", 2);
+    ASSERT_TRUE(oldest.has_value());
+    EXPECT_EQ(oldest->old_hash, std::string(40, '0'));
+    EXPECT_EQ(oldest->new_hash, FakeHash(1));
+    EXPECT_FALSE(reflog.Lookup("refs/heads/main", 3).has_value());
+    EXPECT_EQ(reflog.ListRefs(), std::vector<std::string>{"refs/heads/main"});
+}
+
+// <name>@{n} 与 @{n} 解析后通过索引找到对应的记录
+TEST_F(ReflogTest, ResolvesReflogSpec) {
+    Reflog reflog;
+    for (int i = 1; i <= 5; i++) {
+        reflog.Append("HEAD", i == 1 ? "" : FakeHash(i - 1), FakeHash(i),
+                      "commit: " + std::to_string(i));
+    }
+
+    auto spec = ParseReflogSpec("main@{2}");
+    ASSERT_TRUE(spec.has_value());
+    EXPECT_EQ(spec->first, "main");
+    EXPECT_EQ(spec->second, 2u);
+
+    spec = ParseReflogSpec("@{1}");
+    ASSERT_TRUE(spec.has_value());
+    EXPECT_EQ(spec->first, "");
+    auto entry = reflog.Lookup("HEAD", spec->second);
+    ASSERT_TRUE(entry.has_value());
+    EXPECT_EQ(entry->new_hash, FakeHash(4));
+
+    EXPECT_FALSE(ParseReflogSpec("main").has_value());
+    EXPECT_FALSE(ParseReflogSpec("main@{}").has_value());
+    EXPECT_FALSE(ParseReflogSpec("main@{-1}").has_value());
+    EXPECT_FALSE(ParseReflogSpec("main@{yesterday}").has_value());
+    EXPECT_FALSE(
+        ParseReflogSpec("main@{99999999999999999999999}").has_value());
+}
+
+// 没有索引（例如由 Git 写入的日志）时第一次读取重建索引
+TEST_F(ReflogTest, RebuildsMissingIndex) {
+    WriteFile(".git/logs/refs/heads/main",
+              LogLine(0, 1, 100, "one") + LogLine(1, 2, 200, "two") +
+                  LogLine(2, 3, 300, "three"));
+
+    Reflog reflog;
+    EXPECT_EQ(reflog.Count("refs/heads/main"), 3u);
+    EXPECT_TRUE(fs::exists(".git/reflog-index/refs/heads/main"));
+    // logs 下只有日志本身，git fsck/reflog 不会把索引当作 reflog
+    EXPECT_EQ(reflog.ListRefs(), std::vector<std::string>{"refs/heads/main"});
+    EXPECT_FALSE(fs::exists(".git/logs/.index"));
+    auto entry = reflog.Lookup("refs/heads/main", 1);
+    ASSERT_TRUE(entry.has_value());
+    EXPECT_EQ(entry->new_hash, FakeHash(2));
+    EXPECT_EQ(entry->timestamp, 200);
+}
+
+// 日志被其他工具追加后索引过期：读取和下一次追加都要补齐索引
+TEST_F(ReflogTest, RebuildsStaleIndex) {
+    Reflog reflog;
+    reflog.Append("refs/heads/main", "", FakeHash(1), "one");
+    std::ofstream(".git/logs/refs/heads/main", std::ios::app)
+        << LogLine(1, 2, 200, "two");
+
+    EXPECT_EQ(reflog.Count("refs/heads/main"), 2u);
+    EXPECT_EQ(reflog.Lookup("refs/heads/main", 0)->message, "two");
+
+    std::ofstream(".git/logs/refs/heads/main", std::ios::app)
+        << LogLine(2, 3, 300, "three");
+    reflog.Append("refs/heads/main", FakeHash(3), FakeHash(4), "four");
+    EXPECT_EQ(reflog.Count("refs/heads/main"), 4u);
+    EXPECT_EQ(reflog.Lookup("refs/heads/main", 0)->message, "four");
+    EXPECT_EQ(reflog.Lookup("refs/heads/main", 1)->message, "three");
+    EXPECT_EQ(reflog.Lookup("refs/heads/main", 3)->message, "one");
+}
+
+// expire 删除早于截止时间的记录，索引随之更新
+TEST_F(ReflogTest, ExpireRemovesOlderEntries) {
+    WriteFile(".git/logs/refs/heads/main",
+              LogLine(0, 1, 100, "one") + LogLine(1, 2, 200, "two") +
+                  LogLine(2, 3, 300, "three") + LogLine(3, 4, 400, "four"));
+
+    Reflog reflog;
+    EXPECT_EQ(reflog.Expire("refs/heads/main", 250), 2u);
+    EXPECT_EQ(reflog.Count("refs/heads/main"), 2u);
+    EXPECT_EQ(reflog.Lookup("refs/heads/main", 0)->message, "four");
+    EXPECT_EQ(reflog.Lookup("refs/heads/main", 1)->message, "three");
+    EXPECT_FALSE(reflog.Lookup("refs/heads/main", 2).has_value());
+    EXPECT_EQ(ReadFile(".git/logs/refs/heads/main"),
+              LogLine(2, 3, 300, "three") + LogLine(3, 4, 400, "four"));
+
+    EXPECT_EQ(reflog.Expire("refs/heads/main", 0), 0u);
+    EXPECT_EQ(reflog.Expire("refs/heads/other", 1000), 0u);
+    // 只剩下日志本身：没有留下锁文件或临时文件
+    EXPECT_EQ(reflog.ListRefs(), std::vector<std::string>{"refs/heads/main"});
+    EXPECT_FALSE(fs::exists(".git/logs/refs/heads/main.lock"));
+    EXPECT_FALSE(fs::exists(".git/logs/refs/heads/.main.new"));
+}
+
+// 其他进程持有锁时追加和 expire 都失败，日志保持不变
+TEST_F(ReflogTest, HonorsLockFile) {
+    Reflog reflog;
+    reflog.Append("refs/heads/main", "", FakeHash(1), "one");
+    std::string before = ReadFile(".git/logs/refs/heads/main");
+    WriteFile(".git/logs/refs/heads/main.lock", "");
+
+    EXPECT_THROW(reflog.Append("refs/heads/main", FakeHash(1), FakeHash(2),
+                               "two"),
+                 std::runtime_error);
+    EXPECT_THROW(reflog.Expire("refs/heads/main", time(nullptr) + 1),
+                 std::runtime_error);
+    EXPECT_EQ(ReadFile(".git/logs/refs/heads/main"), before);
+    EXPECT_TRUE(fs::exists(".git/logs/refs/heads/main.lock"));
+
+    fs::remove(".git/logs/refs/heads/main.lock");
+    reflog.Append("refs/heads/main", FakeHash(1), FakeHash(2), "two");
+    EXPECT_EQ(reflog.Count("refs/heads/main"), 2u);
+}
@@ -0,0 +1,135 @@
+#include <gtest/gtest.h>
+#include <filesystem>
+#include <string>
+#include <unistd.h>
+#include <vector>
+#include "../src/reftable.h"
+#include "test_util.h"
+
+namespace fs = std::filesystem;
+
+// 生成第 i 个测试用的40字符哈希
+static std::string FakeHash(int i) {
+    char buf[41];
+    snprintf(buf, sizeof(buf), "%040x", i);
+    return buf;
+}
+
+class ReftableTest : public TempRepoTest {
+protected:
+    ReftableTest() : TempRepoTest("reftable") {}
+};
+
+// 单表：多个块 + index 块，逐个查找都应命中
+TEST_F(ReftableTest, SingleTableLookup) {
+    std::vector<reftable::RefRecord> records;
+    for (int i = 0; i < 2000; i++) {
+        char name[64];
+        snprintf(name, sizeof(name), "refs/heads/feature/%06d", i);
+        records.push_back({name, 1, reftable::kObjectId, FakeHash(i)});
+    }
+    fs::path path = dir_ / "t.ref";
+    reftable::WriteTable(path, records, 1, 1, 1024);
+
+    reftable::Table table(path);
+    for (int i = 0; i < 2000; i += 7) {
+        auto record = table.Find(records[i].name);
+        ASSERT_TRUE(record.has_value()) << records[i].name;
+        EXPECT_EQ(record->hash, FakeHash(i));
+    }
+    EXPECT_FALSE(table.Find("refs/heads/feature/").has_value());
+    EXPECT_FALSE(table.Find("refs/heads/feature/0000005").has_value());
+    EXPECT_FALSE(table.Find("refs/heads/zzz").has_value());
+    EXPECT_EQ(table.ReadAll().size(), records.size());
+}
+
+// 未排序的记录应被拒绝
+TEST_F(ReftableTest, RejectsUnsortedRecords) {
+    std::vector<reftable::RefRecord> records = {
+        {"refs/heads/b", 1, reftable::kObjectId, FakeHash(1)},
+        {"refs/heads/a", 1, reftable::kObjectId, FakeHash(2)},
+    };
+    EXPECT_THROW(reftable::WriteTable(dir_ / "bad.ref", records, 1, 1),
+                 std::runtime_error);
+}
+
+// 堆栈：新表覆盖旧表，删除产生墓碑记录
+TEST_F(ReftableTest, StackOverridesAndDeletes) {
+    reftable::Stack stack(dir_);
+    stack.Init();
+    stack.Add({{"refs/heads/main", FakeHash(1)}, {"refs/heads/dev", FakeHash(2)}});
+    stack.Add({{"refs/heads/main", FakeHash(3)}});
+    stack.Add({{"refs/heads/dev", ""}});
+
+    EXPECT_EQ(stack.Read("refs/heads/main").value_or(""), FakeHash(3));
+    EXPECT_FALSE(stack.Read("refs/heads/dev").has_value());
+    EXPECT_EQ(stack.List("refs/heads/"),
+              std::vector<std::string>{"refs/heads/main"});
+
+    // 重新打开后内容不变
+    reftable::Stack reopened(dir_);
+    EXPECT_EQ(reopened.Read("refs/heads/main").value_or(""), FakeHash(3));
+    reopened.CompactAll();
+    EXPECT_EQ(reopened.TableCount(), 1u);
+    EXPECT_EQ(reopened.List(""), std::vector<std::string>{"refs/heads/main"});
+}
+
+// 大量小写入后自动合并应使表的数量保持在对数级别
+TEST_F(ReftableTest, AutoCompactionBoundsTableCount) {
+    reftable::Stack stack(dir_);
+    stack.Init();
+    for (int i = 0; i < 256; i++) {
+        stack.Add({{"refs/heads/b" + std::to_string(i), FakeHash(i)}});
+    }
+    EXPECT_LE(stack.TableCount(), 10u);
+    for (int i = 0; i < 256; i += 17) {
+        EXPECT_EQ(stack.Read("refs/heads/b" + std::to_string(i)).value_or(""),
+                  FakeHash(i));
+    }
+    EXPECT_EQ(stack.List("refs/heads/").size(), 256u);
+}
+
+// MiniGitRef 在 reftable 后端上的完整流程
+TEST_F(ReftableTest, MiniGitRefWithReftableBackend) {
+    {
+        MiniGitRef refs;
+        refs.Init(RefFormat::kReftable);
+        EXPECT_EQ(refs.GetCurrentBranchName(), "main");
+        EXPECT_TRUE(refs.UpdateCurrentBranch(FakeHash(42)));
+        EXPECT_EQ(refs.GetCurrentCommit(), FakeHash(42));
+        refs.CreateBranch("topic");
+    }
+    MiniGitRef reopened; // 通过.git/reftable自动识别后端
+    EXPECT_TRUE(reopened.BranchExists("topic"));
+    EXPECT_EQ(reopened.ListAllBranches(),
+              (std::vector<std::string>{"main", "topic"}));
+    EXPECT_FALSE(fs::exists(".git/refs/heads/main"));
+}
+
+// 两种后端初始化后的状态一致：HEAD 指向未诞生的 main，没有任何分支
+TEST_F(ReftableTest, FreshRepositoryMatchesFilesBackend) {
+    struct State {
+        std::string branch;
+        std::string commit;
+        bool main_exists;
+        std::vector<std::string> branches;
+    };
+    auto init = [&](RefFormat format, const std::string &name) {
+        fs::create_directories(dir_ / name / ".git/objects");
+        fs::current_path(dir_ / name);
+        MiniGitRef refs;
+        refs.Init(format);
+        return State{refs.GetCurrentBranchName(), refs.GetCurrentCommit(),
+                     refs.BranchExists("main"), refs.ListAllBranches()};
+    };
+    State files = init(RefFormat::kFiles, "files");
+    State reftable = init(RefFormat::kReftable, "reftable");
+    EXPECT_EQ(files.branch, "main");
+    EXPECT_EQ(reftable.branch, files.branch);
+    EXPECT_EQ(files.commit, "");
+    EXPECT_EQ(reftable.commit, files.commit);
+    EXPECT_FALSE(files.main_exists);
+    EXPECT_EQ(reftable.main_exists, files.main_exists);
+    EXPECT_TRUE(files.branches.empty());
+    EXPECT_EQ(reftable.branches, files.branches);
+}
@@ -0,0 +1,205 @@
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <filesystem>
+#include <map>
+#include <random>
+#include <set>
+#include <string>
+#include <unistd.h>
+#include <vector>
+#include "../include/clone_gadget.h"
+#include "../src/commit_graph.h"
+#include "../src/object_store.h"
+#include "../src/revision.h"
+#include "test_util.h"
+
+namespace fs = std::filesystem;
+
+class RevisionTest : public TempRepoTest {
+protected:
+    RevisionTest() : TempRepoTest("revision") {}
+
+    void SetUp() override {
+        TempRepoTest::SetUp();
+        tree_ = Store("tree", "");
+    }
+
+    // 记下父提交，供 Reachable() 使用
+    std::string Commit(const std::vector<std::string> &parents, int64_t time,
+                       const std::string &message) {
+        std::string hash = TempRepoTest::Commit(tree_, parents, time, message);
+        parents_[hash] = parents;
+        return hash;
+    }
+
+    // 遍历 walk 并返回输出的哈希
+    static std::vector<std::string> Run(commit_graph::CommitIndex &index,
+                                        revision::RevWalk &walk) {
+        std::vector<std::string> out;
+        uint32_t id;
+        while (walk.Next(id)) {
+            out.push_back(index.Hash(id));
+        }
+        return out;
+    }
+
+    std::set<std::string> Reachable(const std::string &tip) {
+        std::set<std::string> seen;
+        std::vector<std::string> pending = {tip};
+        while (!pending.empty()) {
+            std::string hash = pending.back();
+            pending.pop_back();
+            if (seen.insert(hash).second) {
+                for (const auto &parent : parents_[hash]) {
+                    pending.push_back(parent);
+                }
+            }
+        }
+        return seen;
+    }
+
+    std::map<std::string, std::vector<std::string>> parents_;
+    std::string tree_;
+};
+
+// 按时间从新到旧输出；--max-count 只读取输出附近的提交
+TEST_F(RevisionTest, DateOrderAndMaxCount) {
+    std::vector<std::string> chain = {Commit({}, 1000, "root\n")};
+    for (int i = 1; i < 500; i++) {
+        chain.push_back(Commit({chain.back()}, 1000 + 2 * i, "c\n"));
+    }
+    std::string side = Commit({chain[200]}, 1501, "side\n");
+    std::string merge = Commit({chain.back(), side}, 5000, "merge\n");
+
+    ObjectStore store;
+    commit_graph::CommitIndex index(store);
+    revision::RevWalk all(index);
+    all.Push(index.Lookup(merge));
+    auto out = Run(index, all);
+    ASSERT_EQ(out.size(), 502u);
+    EXPECT_EQ(out[0], merge);
+    EXPECT_EQ(out[1], chain[499]);
+    // side 的时间介于 chain[251] 与 chain[250] 之间
+    auto at = [&](const std::string &hash) {
+        return std::find(out.begin(), out.end(), hash) - out.begin();
+    };
+    EXPECT_EQ(at(side), at(chain[251]) + 1);
+    EXPECT_EQ(at(chain[250]), at(side) + 1);
+    EXPECT_EQ(out.back(), chain[0]);
+
+    // 没有 commit-graph 时，只解析了输出的提交和队列中的父提交
+    commit_graph::CommitIndex fresh(store);
+    revision::RevWalkOptions options;
+    options.max_count = 3;
+    revision::RevWalk limited(fresh, options);
+    limited.Push(fresh.Lookup(merge));
+    EXPECT_EQ(Run(fresh, limited),
+              (std::vector<std::string>{merge, chain[499], chain[498]}));
+    EXPECT_LE(fresh.Size(), 5u);
+
+    options.max_count = 0;
+    revision::RevWalk none(fresh, options);
+    none.Push(fresh.Lookup(merge));
+    EXPECT_TRUE(Run(fresh, none).empty());
+
+    revision::RevWalkOptions first_parent;
+    first_parent.first_parent = true;
+    revision::RevWalk main_line(index, first_parent);
+    main_line.Push(index.Lookup(merge));
+    out = Run(index, main_line);
+    EXPECT_EQ(out.size(), 501u);
+    EXPECT_EQ(std::count(out.begin(), out.end(), side), 0);
+}
+
+// A..B 与 --first-parent 的结果与直接计算的集合相同；时间全部相同、
+// 部分提交在 commit-graph 中时也是如此
+TEST_F(RevisionTest, RangesMatchSetDifference) {
+    std::mt19937 rng(42);
+    std::vector<std::string> commits;
+    for (int i = 0; i < 150; i++) {
+        std::vector<std::string> parents;
+        if (i > 0 && rng() % 20 != 0) {
+            int count = 1 + (rng() % 6 == 0) + (rng() % 15 == 0);
+            for (int p = 0; p < count; p++) {
+                // 偏向较近的提交，形成多条长分支
+                int back = 1 + rng() % std::min(i, p == 0 ? 3 : 40);
+                std::string parent = commits[i - back];
+                if (std::find(parents.begin(), parents.end(), parent) ==
+                    parents.end()) {
+                    parents.push_back(parent);
+                }
+            }
+        }
+        // 所有提交时间相同，顺序只能靠代数或者遍历本身保证
+        commits.push_back(Commit(parents, 1600000000, std::to_string(i)));
+    }
+
+    auto check = [&](const char *label) {
+        SCOPED_TRACE(label);
+        ObjectStore store;
+        std::mt19937 pick(7);
+        for (int round = 0; round < 40; round++) {
+            std::string a = commits[pick() % commits.size()];
+            std::string b = commits[pick() % commits.size()];
+            std::set<std::string> hidden = Reachable(a);
+            std::set<std::string> expected;
+            for (const auto &hash : Reachable(b)) {
+                if (!hidden.count(hash)) {
+                    expected.insert(hash);
+                }
+            }
+            std::vector<std::string> first_parent;
+            for (std::string hash = b; !hidden.count(hash);) {
+                first_parent.push_back(hash);
+                if (parents_[hash].empty()) {
+                    break;
+                }
+                hash = parents_[hash][0];
+            }
+
+            commit_graph::CommitIndex index(store);
+            revision::RevWalk walk(index);
+            walk.Hide(index.Lookup(a));
+            walk.Push(index.Lookup(b));
+            auto out = Run(index, walk);
+            EXPECT_EQ(std::set<std::string>(out.begin(), out.end()), expected);
+            EXPECT_EQ(out.size(), expected.size()) << "duplicates";
+
+            revision::RevWalkOptions options;
+            options.first_parent = true;
+            revision::RevWalk chain(index, options);
+            chain.Hide(index.Lookup(a));
+            chain.Push(index.Lookup(b));
+            EXPECT_EQ(Run(index, chain), first_parent);
+        }
+    };
+
+    check("no commit-graph");
+    ObjectStore store;
+    commit_graph::Write(store, {commits[80]});
+    check("partial commit-graph");
+    commit_graph::Write(store, {commits.back()});
+    check("full commit-graph");
+}
+
+// 解析后的提交缓存在 slab 中，提交说明是指向对象内容的视图
+TEST_F(RevisionTest, CommitCache) {
+    std::string root = Commit({}, 1000, "first line\n\nbody\n");
+    std::string merge = Commit({root, Commit({}, 999, "other\n")}, 1001,
+                               "merge\n");
+    ObjectStore store;
+    commit_graph::CommitIndex index(store);
+    revision::CommitCache cache(store, index);
+    const auto &header = cache.Get(index.Lookup(root));
+    EXPECT_EQ(header.tree, tree_);
+    EXPECT_EQ(header.message, "first line\n\nbody\n");
+    EXPECT_EQ(header.author, "A U Thor <author@example.com> 1000 +0000");
+    EXPECT_EQ(header.time, 1000);
+    EXPECT_TRUE(header.parents.empty());
+    // 再次读取得到同一份数据，之后访问其他提交也不会使它失效
+    EXPECT_EQ(&cache.Get(index.Lookup(root)), &header);
+    const auto &merged = cache.Get(index.Lookup(merge));
+    ASSERT_EQ(merged.parents.size(), 2u);
+    EXPECT_EQ(merged.parents[0], root);
+    EXPECT_EQ(header.message, "first line\n\nbody\n");
+}
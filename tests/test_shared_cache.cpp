@@ -0,0 +1,198 @@
+#include <gtest/gtest.h>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include "../include/clone_gadget.h"
+#include "../src/http_server.h"
+#include "../src/object_store.h"
+#include "../src/refs.h"
+#include "../src/repack.h"
+#include "../src/shared_cache.h"
+#include "../src/upload_pack.h"
+#include "test_util.h"
+
+namespace fs = std::filesystem;
+
+// repo/ 是被克隆的仓库，cache/ 是共享缓存
+class SharedCacheTest : public TempRepoTest {
+protected:
+    SharedCacheTest() : TempRepoTest("shared_cache", "repo") {}
+
+    void SetUp() override {
+        TempRepoTest::SetUp();
+        MiniGitRef().Init();
+        unsetenv("MINIGIT_SHARED_CACHE");
+        unsetenv("MINIGIT_SHARED_CACHE_LINK");
+    }
+
+    static size_t CountLoose(const fs::path &objects_dir) {
+        size_t count = 0;
+        for (const auto &entry : fs::recursive_directory_iterator(objects_dir)) {
+            if (entry.is_regular_file() &&
+                entry.path().parent_path().filename().string().size() == 2) {
+                count++;
+            }
+        }
+        return count;
+    }
+
+    // 在 repo/ 中提交当前工作区，返回提交哈希
+    static std::string Commit(const std::string &message) {
+        MiniGitRef refs;
+        std::string tree = write_tree(".");
+        std::string parent = refs.GetCurrentCommit();
+        std::string commit = commit_tree(tree, parent, message);
+        refs.UpdateCurrentBranch(commit);
+        return commit;
+    }
+
+    // 在后台线程运行服务器，测试结束时停止
+    class ServerThread {
+    public:
+        ServerThread()
+            : server_(upload_pack::HttpHandler(".git"), 2) {
+            server_.Listen("127.0.0.1", 0);
+            thread_ = std::thread([this] { server_.Run(); });
+        }
+        ~ServerThread() {
+            server_.Stop();
+            thread_.join();
+        }
+        uint16_t Port() const { return server_.Port(); }
+
+    private:
+        HttpServer server_;
+        std::thread thread_;
+    };
+};
+
+// alternates 中的对象库可以读，自己的对象优先；不存在的目录被忽略
+TEST_F(SharedCacheTest, ReadsThroughAlternates) {
+    WriteFile("a.txt", "shared\n");
+    std::string blob = hash_object("a.txt");
+    shared_cache::SharedCache cache(dir_ / "cache");
+    EXPECT_EQ(cache.Absorb(".git/objects"), 1u);
+    EXPECT_EQ(CountLoose(".git/objects"), 0u);
+    EXPECT_FALSE(ObjectStore().Contains(blob));
+
+    cache.AttachTo(".git");
+    cache.AttachTo(".git"); // 重复调用不会重复写入
+    std::ofstream(".git/objects/info/alternates", std::ios::app)
+        << "# comment\n../../missing/objects\n";
+    EXPECT_EQ(ReadFile(".git/objects/info/alternates"),
+              cache.ObjectsDir().string() + "\n# comment\n../../missing/objects\n");
+
+    ObjectStore store;
+    ASSERT_EQ(store.Alternates().size(), 1u);
+    EXPECT_TRUE(store.Contains(blob));
+    EXPECT_FALSE(store.HasLoose(blob));
+    auto object = store.Read(blob);
+    ASSERT_TRUE(object);
+    EXPECT_EQ(object->data, "shared\n");
+
+    auto found = shared_cache::SharedCache::ForStore(store);
+    ASSERT_TRUE(found);
+    EXPECT_EQ(found->Root(), cache.Root());
+}
+
+// 默认复制（或 reflink）；hardlink 模式与缓存共享 inode，可执行文件仍复制
+TEST_F(SharedCacheTest, MaterializesBlobs) {
+    WriteFile("a.txt", "content\n");
+    std::string blob = hash_object("a.txt");
+    ObjectStore store;
+
+    shared_cache::SharedCache copy(dir_ / "cache", shared_cache::LinkMode::kCopy);
+    copy.Materialize(store, blob, false, "copied");
+    EXPECT_EQ(ReadFile("copied"), "content\n");
+    EXPECT_EQ(ReadFile(copy.BlobPath(blob)), "content\n");
+    struct stat st;
+    ASSERT_EQ(stat("copied", &st), 0);
+    EXPECT_EQ(st.st_nlink, 1u);
+    EXPECT_NE(st.st_mode & S_IWUSR, 0u);
+
+    shared_cache::SharedCache hard(dir_ / "cache",
+                                   shared_cache::LinkMode::kHardlink);
+    hard.Materialize(store, blob, false, "linked");
+    hard.Materialize(store, blob, true, "exec");
+    struct stat linked, cached, exec;
+    ASSERT_EQ(stat("linked", &linked), 0);
+    ASSERT_EQ(stat(hard.BlobPath(blob).c_str(), &cached), 0);
+    ASSERT_EQ(stat("exec", &exec), 0);
+    EXPECT_EQ(linked.st_ino, cached.st_ino);
+    EXPECT_NE(exec.st_ino, cached.st_ino);
+    EXPECT_NE(exec.st_mode & S_IXUSR, 0u);
+    EXPECT_EQ(cached.st_mode & 0777, 0444u);
+
+    EXPECT_THROW(shared_cache::ParseLinkMode("symlink"), std::invalid_argument);
+    EXPECT_EQ(shared_cache::SharedCache::Open(), nullptr);
+    setenv("MINIGIT_SHARED_CACHE_LINK", "hardlink", 1);
+    EXPECT_EQ(shared_cache::SharedCache::Open((dir_ / "cache").string())->Mode(),
+              shared_cache::LinkMode::kHardlink);
+}
+
+// 第一次克隆填充缓存；再次克隆同一提交不下载，新提交只下载缺少的对象
+TEST_F(SharedCacheTest, RepeatCloneUsesCache) {
+    WriteFile("doc.txt", "first\n");
+    WriteFile("sub/n.txt", "1");
+    std::string first = Commit("c1");
+
+    ServerThread server;
+    std::string url = "http://127.0.0.1:" + std::to_string(server.Port());
+    std::string cache_dir = (dir_ / "cache").string();
+    ASSERT_EQ(clone(url, "../one", cache_dir), EXIT_SUCCESS);
+    EXPECT_EQ(ReadFile("../one/doc.txt"), "first\n");
+    EXPECT_EQ(CountLoose("../one/.git/objects"), 0u);
+    shared_cache::SharedCache cache(cache_dir);
+    EXPECT_EQ(cache.Tips(), std::vector<std::string>{first});
+    size_t cached = CountLoose(cache.ObjectsDir());
+    EXPECT_EQ(cached, 5u); // 提交、两个 tree、两个 blob
+
+    // 同一提交：全部来自缓存，缓存没有变化
+    setenv("MINIGIT_SHARED_CACHE", cache_dir.c_str(), 1);
+    ASSERT_EQ(clone(url, "../two"), EXIT_SUCCESS);
+    EXPECT_EQ(ReadFile("../two/sub/n.txt"), "1");
+    EXPECT_EQ(CountLoose(cache.ObjectsDir()), cached);
+    EXPECT_TRUE(ObjectStore("../two/.git").Contains(first));
+
+    // 新提交只改了 doc.txt：下载提交、根 tree 和新 blob
+    WriteFile("doc.txt", "second\n");
+    std::string second = Commit("c2");
+    std::string pack = fetch_pack(url, second, {first});
+    size_t start = pack.find("PACK");
+    ASSERT_NE(start, std::string::npos);
+    EXPECT_EQ(static_cast<unsigned char>(pack[start + 11]), 3u); // 对象数
+    ASSERT_EQ(clone(url, "../three"), EXIT_SUCCESS);
+    EXPECT_EQ(ReadFile("../three/doc.txt"), "second\n");
+    EXPECT_EQ(CountLoose(cache.ObjectsDir()), cached + 3);
+    EXPECT_EQ(cache.Tips(), (std::vector<std::string>{first, second}));
+}
+
+// gc 只打包本仓库的对象，共享缓存中的对象不复制进来，也不写位图
+TEST_F(SharedCacheTest, GcPacksOnlyLocalObjects) {
+    WriteFile("doc.txt", "first\n");
+    std::string first = Commit("c1");
+    shared_cache::SharedCache cache(dir_ / "cache");
+    EXPECT_EQ(cache.Absorb(".git/objects"), 3u);
+    cache.AttachTo(".git");
+    WriteFile("doc.txt", "second\n");
+    std::string second = Commit("c2");
+
+    RepackOptions options;
+    options.write_bitmap = true;
+    size_t pruned = 0;
+    RepackResult result = Gc(options, time(nullptr) + 1, pruned);
+    EXPECT_EQ(result.objects, 3u); // c2、它的 tree 和新 blob
+    EXPECT_EQ(result.bitmaps, 0u);
+    EXPECT_EQ(CountLoose(".git/objects"), 0u);
+    EXPECT_EQ(CountLoose(cache.ObjectsDir()), 3u);
+
+    ObjectStore store;
+    ASSERT_EQ(store.Packs().size(), 1u);
+    EXPECT_FALSE(store.InAnyPack(first));
+    EXPECT_TRUE(store.Contains(first));
+    EXPECT_TRUE(store.InAnyPack(second));
+}
@@ -0,0 +1,320 @@
+#include <gtest/gtest.h>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+#include "../include/clone_gadget.h"
+#include "../src/checkout.h"
+#include "../src/dircache.h"
+#include "../src/http_server.h"
+#include "../src/object_store.h"
+#include "../src/refs.h"
+#include "../src/repack.h"
+#include "../src/sparse.h"
+#include "../src/status.h"
+#include "../src/tree.h"
+#include "../src/upload_pack.h"
+#include "test_util.h"
+
+namespace fs = std::filesystem;
+
+// 工作区是下面 Files() 中的文件
+class SparseTest : public TempRepoTest {
+protected:
+    SparseTest() : TempRepoTest("sparse", "repo") {}
+
+    void SetUp() override {
+        unsetenv("MINIGIT_FSYNC_METHOD");
+        unsetenv("MINIGIT_SHARED_CACHE");
+        TempRepoTest::SetUp();
+        for (const auto &[path, content] : Files()) {
+            WriteFile(path, content);
+        }
+        tree_ = write_tree(".");
+    }
+
+    static std::map<std::string, std::string> Files() {
+        return {{"root.txt", "r\n"}, {"a/f", "a\n"},     {"a/x/f", "ax\n"},
+                {"b/f", "b\n"},      {"b/y/f", "by\n"},  {"b/y/z/f", "byz\n"},
+                {"c/f", "c\n"}};
+    }
+
+    // 工作区中的文件（不含 .git），相对于 root
+    static std::vector<std::string> ListFiles(const fs::path &root = ".") {
+        std::vector<std::string> files;
+        for (auto it = fs::recursive_directory_iterator(root);
+             it != fs::recursive_directory_iterator(); ++it) {
+            if (it->path().filename() == ".git") {
+                it.disable_recursion_pending();
+            } else if (it->is_regular_file()) {
+                files.push_back(fs::relative(it->path(), root).string());
+            }
+        }
+        std::sort(files.begin(), files.end());
+        return files;
+    }
+
+    // index 中的路径，稀疏目录以 '/' 结尾
+    static std::vector<std::string> IndexPaths() {
+        std::vector<std::string> paths;
+        for (const auto &entry : dircache::Index::Read(".git/index").Entries()) {
+            EXPECT_EQ(entry.skip_worktree, entry.IsSparseDir()) << entry.path;
+            paths.push_back(entry.path);
+        }
+        return paths;
+    }
+
+    // tree 中 path 处的对象哈希
+    std::string HashAt(const std::string &path) {
+        ObjectStore store;
+        std::string hash;
+        tree::DiffOptions options;
+        options.recursive = true;
+        options.descend = [&path](const std::string &dir) {
+            return path.starts_with(dir + '/');
+        };
+        tree::DiffTrees(store, "", tree_, options,
+                        [&](const tree::Change &change) {
+                            if (change.path == path) {
+                                hash = change.new_hash;
+                            }
+                        });
+        return hash;
+    }
+
+    // 清空工作区，之后从空的 index 检出
+    static void ClearWorktree() {
+        for (const auto &entry : fs::directory_iterator(".")) {
+            if (entry.path().filename() != ".git") {
+                fs::remove_all(entry.path());
+            }
+        }
+    }
+
+    static bool Clean(const std::string &tree) {
+        ObjectStore store;
+        return status::Status(store, ".", tree).empty();
+    }
+
+    std::string tree_;
+};
+
+// 嵌套的目录只保留外层的；父目录只检出直接位于其中的文件
+TEST_F(SparseTest, ConeClassifiesPaths) {
+    sparse::Cone cone({"b/y", "a/x/", "/a", "c"});
+    EXPECT_EQ(cone.Dirs(), (std::vector<std::string>{"a", "b/y", "c"}));
+    using sparse::Scope;
+    EXPECT_EQ(cone.Classify(""), Scope::kParent);
+    EXPECT_EQ(cone.Classify("a"), Scope::kInside);
+    EXPECT_EQ(cone.Classify("a/x"), Scope::kInside);
+    EXPECT_EQ(cone.Classify("b"), Scope::kParent);
+    EXPECT_EQ(cone.Classify("b/y/z"), Scope::kInside);
+    EXPECT_EQ(cone.Classify("b/z"), Scope::kOutside);
+    EXPECT_EQ(cone.Classify("d"), Scope::kOutside);
+    EXPECT_EQ(cone.Classify("ab"), Scope::kOutside);
+    EXPECT_TRUE(cone.Contains("root.txt"));
+    EXPECT_TRUE(cone.Contains("b/f"));
+    EXPECT_FALSE(cone.Contains("b/z/f"));
+    EXPECT_FALSE(cone.Contains("d/f"));
+
+    EXPECT_THROW(sparse::Cone({"a/../b"}), std::runtime_error);
+    EXPECT_THROW(sparse::Cone({"/"}), std::runtime_error);
+    EXPECT_TRUE(sparse::Cone().Dirs().empty());
+}
+
+// 规则文件与 git sparse-checkout set 写出的相同，可以读回
+TEST_F(SparseTest, ConeFileRoundTrip) {
+    sparse::Cone cone({"b/y", "c", "we*rd"});
+    EXPECT_EQ(cone.Serialize(), "/*\n!/*/\n"
+                                "/b/\n!/b/*/\n"
+                                "/b/y/\n/c/\n/we\\*rd/\n");
+    cone.Write(".git");
+    auto read = sparse::Cone::Read(".git");
+    ASSERT_TRUE(read);
+    EXPECT_EQ(read->Dirs(), cone.Dirs());
+
+    EXPECT_FALSE(sparse::Cone::Parse("/*\n"));
+    EXPECT_TRUE(sparse::Cone::Parse("# comment\n/*\n!/*/\n")->Dirs().empty());
+    EXPECT_THROW(sparse::Cone::Parse("/*\n!/*/\n*.c\n"), std::runtime_error);
+    EXPECT_THROW(sparse::Cone::Parse("/a/\n"), std::runtime_error);
+    fs::remove(".git/info/sparse-checkout");
+    EXPECT_FALSE(sparse::Cone::Read(".git"));
+}
+
+// cone 之外的子树连 tree 对象都不读，在 index 中是一个稀疏目录；
+// status 干净，write-tree 得到完整的 tree
+TEST_F(SparseTest, CheckoutSkipsOutsideTrees) {
+    ClearWorktree();
+    sparse::Cone({"b/y"}).Write(".git");
+    for (const std::string dir : {"a", "c"}) {
+        std::string hash = HashAt(dir);
+        ASSERT_EQ(hash.size(), 40u);
+        fs::rename(".git/objects/" + hash.substr(0, 2) + "/" + hash.substr(2),
+                   "../" + dir + ".tree");
+    }
+    ObjectStore store;
+    ASSERT_TRUE(checkout::CheckoutTree(store, ".", "", tree_).Ok());
+    EXPECT_EQ(ListFiles(), (std::vector<std::string>{"b/f", "b/y/f", "b/y/z/f",
+                                                     "root.txt"}));
+    EXPECT_EQ(IndexPaths(), (std::vector<std::string>{"a/", "b/f", "b/y/f",
+                                                      "b/y/z/f", "c/", "root.txt"}));
+    EXPECT_TRUE(Clean(tree_));
+    EXPECT_EQ(write_tree("."), tree_);
+
+    // 工作区中的改动照常报告和写入
+    WriteFile("b/y/f", "changed\n");
+    ObjectStore again;
+    auto entries = status::Status(again, ".", tree_);
+    ASSERT_EQ(entries.size(), 1u);
+    EXPECT_EQ(status::FormatPorcelain(entries[0]), " M b/y/f");
+    std::string changed = write_tree(".");
+    EXPECT_NE(changed, tree_);
+    WriteFile("b/y/f", "by\n");
+    EXPECT_EQ(write_tree("."), tree_);
+}
+
+// 改变 cone：离开的文件删除，进入的文件写出；有本地改动时什么都不做
+TEST_F(SparseTest, ApplySparseChangesCone) {
+    ClearWorktree();
+    sparse::Cone({"a"}).Write(".git");
+    ObjectStore store;
+    ASSERT_TRUE(checkout::CheckoutTree(store, ".", "", tree_).Ok());
+    EXPECT_EQ(ListFiles(), (std::vector<std::string>{"a/f", "a/x/f", "root.txt"}));
+
+    sparse::Cone moved({"c"});
+    auto result = checkout::ApplySparse(store, ".", tree_, &moved);
+    ASSERT_TRUE(result.Ok());
+    EXPECT_EQ(result.removed, 2u);
+    EXPECT_EQ(result.written, 1u);
+    EXPECT_FALSE(fs::exists("a"));
+    EXPECT_EQ(ListFiles(), (std::vector<std::string>{"c/f", "root.txt"}));
+    EXPECT_EQ(IndexPaths(),
+              (std::vector<std::string>{"a/", "b/", "c/f", "root.txt"}));
+
+    WriteFile("c/f", "local\n");
+    sparse::Cone back({"a"});
+    result = checkout::ApplySparse(store, ".", tree_, &back);
+    EXPECT_EQ(result.local_changes, std::vector<std::string>{"c/f"});
+    EXPECT_EQ(ReadFile("c/f"), "local\n");
+    EXPECT_FALSE(fs::exists("a"));
+
+    // 完整检出
+    WriteFile("c/f", "c\n");
+    ASSERT_TRUE(checkout::ApplySparse(store, ".", tree_, nullptr).Ok());
+    std::vector<std::string> all;
+    for (const auto &[path, content] : Files()) {
+        all.push_back(path);
+        EXPECT_EQ(ReadFile(path), content);
+    }
+    EXPECT_EQ(ListFiles(), all);
+    EXPECT_EQ(IndexPaths(), all);
+    EXPECT_TRUE(Clean(tree_));
+}
+
+// git 可能把稀疏目录展开成带 skip-worktree 的文件条目：write-tree 从 index
+// 中取这些文件；再次应用 cone 时 cone 之内的写出，之外的重新合成稀疏目录
+TEST_F(SparseTest, ApplySparseExpandedIndex) {
+    ClearWorktree();
+    sparse::Cone().Write(".git");
+    ObjectStore store;
+    ASSERT_TRUE(checkout::CheckoutTree(store, ".", "", tree_).Ok());
+    auto index = dircache::Index::Read(".git/index");
+    auto entries = index.Entries();
+    for (auto &entry : entries) {
+        if (entry.path != "root.txt") {
+            entry.skip_worktree = true;
+            fs::remove(entry.path);
+        }
+    }
+    index.SetEntries(std::move(entries));
+    index.Write(".git/index");
+    EXPECT_TRUE(Clean(tree_));
+    EXPECT_EQ(write_tree("."), tree_);
+
+    sparse::Cone cone({"b/y"});
+    ASSERT_TRUE(checkout::ApplySparse(store, ".", tree_, &cone).Ok());
+    EXPECT_EQ(ListFiles(), (std::vector<std::string>{"b/f", "b/y/f", "b/y/z/f",
+                                                     "root.txt"}));
+    EXPECT_EQ(IndexPaths(), (std::vector<std::string>{"a/", "b/f", "b/y/f",
+                                                      "b/y/z/f", "c/", "root.txt"}));
+    EXPECT_TRUE(Clean(tree_));
+}
+
+TEST_F(SparseTest, RestoreTreeWithCone) {
+    fs::create_directory("../out");
+    ObjectStore store;
+    sparse::Cone cone({"a/x"});
+    restore_tree(store, tree_, "../out", &cone);
+    EXPECT_EQ(ListFiles("../out"),
+              (std::vector<std::string>{"a/f", "a/x/f", "root.txt"}));
+}
+
+// blob:none 的部分克隆只下载提交和 tree，检出时按需取回 cone 中的 blob
+TEST_F(SparseTest, PartialClone) {
+    MiniGitRef refs;
+    refs.Init();
+    std::string commit = commit_tree(tree_, "", "init");
+    refs.UpdateCurrentBranch(commit);
+
+    HttpServer server(upload_pack::HttpHandler(".git"), 2);
+    server.Listen("127.0.0.1", 0);
+    std::thread thread([&server] { server.Run(); });
+    std::string url = "http://127.0.0.1:" + std::to_string(server.Port());
+
+    // 提交和 7 个 tree，没有 blob
+    std::string pack = fetch_pack(url, {commit}, {}, "blob:none");
+    size_t start = pack.find("PACK");
+    ASSERT_NE(start, std::string::npos);
+    EXPECT_EQ(static_cast<unsigned char>(pack[start + 11]), 8u);
+
+    CloneOptions options;
+    options.sparse = true;
+    options.sparse_dirs = {"b/y"};
+    options.filter = "blob:none";
+    int status = clone(url, "../clone", "", options);
+    EXPECT_EQ(status, EXIT_SUCCESS);
+    if (status == EXIT_SUCCESS) {
+        EXPECT_EQ(ListFiles("../clone"),
+                  (std::vector<std::string>{"b/f", "b/y/f", "b/y/z/f",
+                                            "root.txt"}));
+        EXPECT_EQ(ReadFile("../clone/b/y/z/f"), "byz\n");
+        ObjectStore clone_store("../clone/.git");
+        EXPECT_TRUE(clone_store.Contains(commit));
+        EXPECT_TRUE(clone_store.Contains(HashAt("c")));
+        EXPECT_FALSE(clone_store.Contains(HashAt("c/f")));
+        EXPECT_FALSE(clone_store.Contains(HashAt("a/x/f")));
+
+        // 扩大 cone：缺少的 blob 从 origin 取回
+        sparse::Cone wider({"a", "b/y"});
+        ASSERT_TRUE(checkout::ApplySparse(clone_store, "../clone", tree_, &wider)
+                        .Ok());
+        EXPECT_EQ(ReadFile("../clone/a/x/f"), "ax\n");
+        EXPECT_TRUE(ObjectStore("../clone/.git").Contains(HashAt("a/x/f")));
+        EXPECT_FALSE(ObjectStore("../clone/.git").Contains(HashAt("c/f")));
+
+        // gc 跳过被过滤掉的 blob：提交、7 个 tree 和检出过的 6 个 blob
+        fs::current_path("../clone");
+        size_t pruned = 0;
+        RepackResult result;
+        EXPECT_NO_THROW(result = Gc(RepackOptions(), time(nullptr) + 1, pruned));
+        fs::current_path(dir_ / "repo");
+        EXPECT_EQ(result.objects, 14u);
+        ObjectStore packed("../clone/.git");
+        EXPECT_TRUE(packed.ListLoose().empty());
+        EXPECT_TRUE(packed.InAnyPack(HashAt("a/x/f")));
+        EXPECT_TRUE(packed.InAnyPack(HashAt("c")));
+        EXPECT_FALSE(packed.Contains(HashAt("c/f")));
+    }
+
+    // 不支持的过滤条件以 ERR 行回复
+    std::string error = fetch_pack(url, {commit}, {}, "tree:0");
+    EXPECT_NE(error.find("ERR upload-pack: unsupported filter 'tree:0'"),
+              std::string::npos);
+    EXPECT_EQ(error.find("PACK"), std::string::npos);
+    server.Stop();
+    thread.join();
+}
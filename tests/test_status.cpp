@@ -0,0 +1,197 @@
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <cstdlib>
+#include <fcntl.h>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+#include "../include/clone_gadget.h"
+#include "../src/checkout.h"
+#include "../src/dircache.h"
+#include "../src/fsmonitor.h"
+#include "../src/object_store.h"
+#include "../src/status.h"
+#include "test_util.h"
+
+namespace fs = std::filesystem;
+
+// HEAD 的 tree 由 checkout 检出到工作区
+class StatusTest : public TempRepoTest {
+protected:
+    StatusTest() : TempRepoTest("status") {}
+
+    void SetUp() override {
+        unsetenv("MINIGIT_FSYNC_METHOD");
+        TempRepoTest::SetUp();
+    }
+
+    void TearDown() override {
+        if (daemon_) {
+            daemon_->Stop();
+            thread_.join();
+        }
+        TempRepoTest::TearDown();
+    }
+
+    // HEAD：a.txt、lib/{b.txt, deep/c.txt}、docs/d.txt，检出后工作区与之相同
+    void CheckoutHead() {
+        std::string one = Store("blob", "one\n");
+        std::string two = Store("blob", "two\n");
+        std::string deep = Tree({{"100644", "c.txt", one}});
+        std::string lib = Tree({{"100644", "b.txt", two}, {"40000", "deep", deep}});
+        std::string docs = Tree({{"100644", "d.txt", one}});
+        head_ = Tree({{"100644", "a.txt", one},
+                      {"40000", "docs", docs},
+                      {"40000", "lib", lib}});
+        ObjectStore store;
+        ASSERT_TRUE(checkout::CheckoutTree(store, ".", "", head_).Ok());
+    }
+
+    std::vector<std::string> Porcelain(const status::Options &options = {}) {
+        ObjectStore store;
+        std::vector<std::string> lines;
+        for (const auto &entry : status::Status(store, ".", head_, options)) {
+            lines.push_back(status::FormatPorcelain(entry));
+        }
+        return lines;
+    }
+
+    // 不使用缓存（也就不使用守护进程的令牌）的结果
+    std::vector<std::string> Uncached() {
+        fs::path cache = ".git/status-cache";
+        fs::path saved = ".git/saved-cache";
+        fs::rename(cache, saved);
+        auto lines = Porcelain();
+        fs::rename(saved, cache);
+        return lines;
+    }
+
+    void StartDaemon() {
+        daemon_ = std::make_unique<fsmonitor::Daemon>(".");
+        thread_ = std::thread([this] { daemon_->Run(); });
+    }
+
+    std::string head_;
+    std::unique_ptr<fsmonitor::Daemon> daemon_;
+    std::thread thread_;
+};
+
+// 已暂存、未暂存和未跟踪的改动，顺序与 git status --porcelain 相同
+TEST_F(StatusTest, ReportsAllKindsOfChanges) {
+    CheckoutHead();
+    EXPECT_TRUE(Porcelain().empty());
+
+    WriteFile("a.txt", "changed\n");
+    fs::remove("docs/d.txt");
+    WriteFile("lib/new.txt", "new\n");
+    WriteFile("extra/deeper/e.txt", "e\n");
+    fs::create_directories("empty/nested");
+    WriteFile("with space", "s\n");
+
+    // 暂存：lib/deep/c.txt 改为新内容，增加 staged.txt
+    dircache::Index index = dircache::Index::Read(".git/index");
+    auto entries = index.Entries();
+    dircache::IndexEntry staged;
+    staged.mode = 0100644;
+    staged.hash = Store("blob", "staged\n");
+    staged.path = "staged.txt";
+    WriteFile("staged.txt", "staged\n");
+    entries.push_back(staged);
+    for (auto &entry : entries) {
+        if (entry.path == "lib/deep/c.txt") {
+            entry.hash = Store("blob", "three\n");
+            entry.stat = {};
+            WriteFile("lib/deep/c.txt", "three\n");
+        }
+    }
+    std::sort(entries.begin(), entries.end(),
+              [](const auto &a, const auto &b) { return a.path < b.path; });
+    index.SetEntries(entries);
+    index.Write(".git/index");
+
+    std::vector<std::string> expected = {
+        " M a.txt",      " D docs/d.txt", "M  lib/deep/c.txt", "A  staged.txt",
+        "?? extra/",     "?? lib/new.txt", "?? \"with space\"",
+    };
+    EXPECT_EQ(Porcelain(), expected);
+    // 第二次使用缓存，结果相同
+    EXPECT_EQ(Porcelain(), expected);
+
+    status::Options no_untracked;
+    no_untracked.untracked = false;
+    EXPECT_EQ(Porcelain(no_untracked),
+              std::vector<std::string>(expected.begin(), expected.begin() + 4));
+}
+
+// 只是 stat 变了的文件不报告，新的 stat 写回 index
+TEST_F(StatusTest, RefreshesStatOnlyChanges) {
+    CheckoutHead();
+    std::string checksum = dircache::Index::Read(".git/index").Checksum();
+    WriteFile("lib/b.txt", "two\n");
+    struct timespec times[2] = {{0, UTIME_OMIT}, {1000000000, 0}};
+    ASSERT_EQ(utimensat(AT_FDCWD, "lib/b.txt", times, 0), 0);
+
+    EXPECT_TRUE(Porcelain().empty());
+    dircache::Index index = dircache::Index::Read(".git/index");
+    EXPECT_NE(index.Checksum(), checksum);
+    struct stat st;
+    ASSERT_EQ(lstat("lib/b.txt", &st), 0);
+    EXPECT_TRUE(index.StatClean(*index.Find("lib/b.txt"), st));
+}
+
+// 缓存的目录列表在目录改变后不再使用
+TEST_F(StatusTest, CacheFollowsDirectoryChanges) {
+    CheckoutHead();
+    WriteFile("lib/deep/u1", "1");
+    EXPECT_EQ(Porcelain(), std::vector<std::string>{"?? lib/deep/u1"});
+    ASSERT_TRUE(fs::exists(".git/status-cache"));
+
+    // 目录 mtime 只有秒以下的精度差别时也要发现
+    for (int i = 0; i < 3; i++) {
+        WriteFile("lib/deep/u2", "2");
+        EXPECT_EQ(Porcelain(), (std::vector<std::string>{"?? lib/deep/u1",
+                                                         "?? lib/deep/u2"}));
+        fs::remove("lib/deep/u2");
+        EXPECT_EQ(Porcelain(), std::vector<std::string>{"?? lib/deep/u1"});
+    }
+    fs::remove("lib/deep/u1");
+    fs::create_directories("lib/deep/sub");
+    EXPECT_TRUE(Porcelain().empty());
+    WriteFile("lib/deep/sub/x", "x");
+    EXPECT_EQ(Porcelain(), std::vector<std::string>{"?? lib/deep/sub/"});
+    EXPECT_EQ(Uncached(), Porcelain());
+}
+
+// 有守护进程时只检查改过的目录，结果与不用缓存时相同
+TEST_F(StatusTest, FsmonitorMatchesFullScan) {
+    CheckoutHead();
+    StartDaemon();
+    EXPECT_TRUE(Porcelain().empty());
+    EXPECT_TRUE(Porcelain().empty());
+
+    WriteFile("lib/deep/c.txt", "edited\n");
+    EXPECT_EQ(Porcelain(), std::vector<std::string>{" M lib/deep/c.txt"});
+    EXPECT_EQ(Porcelain(), Uncached());
+    WriteFile("docs/new/file", "n");
+    EXPECT_EQ(Porcelain(), (std::vector<std::string>{" M lib/deep/c.txt",
+                                                     "?? docs/new/"}));
+    // 上次有改动的条目即使所在目录没再改动也要重新检查
+    WriteFile("lib/deep/c.txt", "one\n");
+    EXPECT_EQ(Porcelain(), std::vector<std::string>{"?? docs/new/"});
+    fs::remove_all("docs");
+    EXPECT_EQ(Porcelain(), std::vector<std::string>{" D docs/d.txt"});
+
+    // -uno 期间的改动在下一次列出未跟踪文件时仍能发现
+    status::Options no_untracked;
+    no_untracked.untracked = false;
+    WriteFile("lib/untracked", "u");
+    EXPECT_EQ(Porcelain(no_untracked), std::vector<std::string>{" D docs/d.txt"});
+    EXPECT_EQ(Porcelain(), (std::vector<std::string>{" D docs/d.txt",
+                                                     "?? lib/untracked"}));
+    EXPECT_EQ(Porcelain(), Uncached());
+}
@@ -0,0 +1,371 @@
+#include <gtest/gtest.h>
+#include <arpa/inet.h>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <netinet/in.h>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include "../include/clone_gadget.h"
+#include "../src/http_server.h"
+#include "../src/object_store.h"
+#include "../src/refs.h"
+#include "../src/repack.h"
+#include "../src/upload_pack.h"
+#include "test_util.h"
+
+namespace fs = std::filesystem;
+
+// 仓库里有三个提交
+class UploadPackTest : public TempRepoTest {
+protected:
+    UploadPackTest() : TempRepoTest("upload") {}
+
+    void SetUp() override {
+        TempRepoTest::SetUp();
+
+        MiniGitRef refs;
+        refs.Init();
+        std::string content;
+        for (int i = 0; i < 3; i++) {
+            for (int line = 0; line < 300; line++) {
+                content += "commit " + std::to_string(i) + " line " +
+                           std::to_string(line) + "\n";
+            }
+            WriteFile("doc.txt", content);
+            WriteFile("sub/n.txt", std::to_string(i));
+            std::string tree = write_tree(".");
+            commits_.push_back(commit_tree(
+                tree, commits_.empty() ? "" : commits_.back(),
+                "c" + std::to_string(i)));
+            refs.UpdateCurrentBranch(commits_.back());
+        }
+        doc_ = content;
+    }
+
+    static std::string ReadAll(int fd, uint64_t offset, uint64_t size) {
+        std::string data(size, '\0');
+        EXPECT_EQ(pread(fd, data.data(), size, offset),
+                  static_cast<ssize_t>(size));
+        return data;
+    }
+
+    // 在后台线程运行服务器，测试结束时停止
+    class ServerThread {
+    public:
+        ServerThread()
+            : server_(upload_pack::HttpHandler(".git"), 2) {
+            server_.Listen("127.0.0.1", 0);
+            thread_ = std::thread([this] { server_.Run(); });
+        }
+        ~ServerThread() {
+            server_.Stop();
+            thread_.join();
+        }
+        uint16_t Port() const { return server_.Port(); }
+
+    private:
+        HttpServer server_;
+        std::thread thread_;
+    };
+
+    static int Connect(uint16_t port) {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+        EXPECT_EQ(connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)),
+                  0);
+        return fd;
+    }
+
+    static void SendAll(int fd, const std::string &data) {
+        size_t done = 0;
+        while (done < data.size()) {
+            ssize_t n = send(fd, data.data() + done, data.size() - done, 0);
+            ASSERT_GT(n, 0);
+            done += n;
+        }
+    }
+
+    static std::string ReadUntilClose(int fd) {
+        std::string data;
+        char buffer[65536];
+        ssize_t n;
+        while ((n = recv(fd, buffer, sizeof(buffer), 0)) > 0) {
+            data.append(buffer, n);
+        }
+        return data;
+    }
+
+    std::vector<std::string> commits_;
+    std::string doc_;
+};
+
+// pkt-line 编解码与协商请求解析
+TEST_F(UploadPackTest, ParseUploadRequest) {
+    EXPECT_EQ(upload_pack::PktLine("done\n"), "0009done\n");
+    std::string body = upload_pack::PktLine(
+                           "want " + commits_[2] +
+                           " multi_ack_detailed side-band-64k ofs-delta\n") +
+                       upload_pack::PktLine("want " + commits_[1] + "\n") +
+                       "0000" + upload_pack::PktLine("have " + commits_[0] + "\n") +
+                       upload_pack::PktLine("done\n");
+    auto request = upload_pack::ParseUploadRequest(body);
+    ASSERT_EQ(request.wants.size(), 2u);
+    EXPECT_EQ(request.wants[0], commits_[2]);
+    ASSERT_EQ(request.haves.size(), 1u);
+    EXPECT_EQ(request.haves[0], commits_[0]);
+    EXPECT_TRUE(request.done);
+    EXPECT_EQ(request.capabilities.count("side-band-64k"), 1u);
+    EXPECT_EQ(request.capabilities.count("ofs-delta"), 1u);
+
+    EXPECT_THROW(upload_pack::ParseUploadRequest("0032want xyz\n"),
+                 std::runtime_error);
+    EXPECT_THROW(upload_pack::ParseUploadRequest("00"), std::runtime_error);
+}
+
+// 引用列表：服务声明、HEAD（带能力列表）和分支
+TEST_F(UploadPackTest, AdvertiseRefs) {
+    std::string refs = upload_pack::UploadPack().AdvertiseRefs();
+    std::string_view input = refs;
+    std::string line;
+    ASSERT_TRUE(upload_pack::NextPktLine(input, line));
+    EXPECT_EQ(line, "# service=git-upload-pack\n");
+    EXPECT_FALSE(upload_pack::NextPktLine(input, line));
+    ASSERT_TRUE(upload_pack::NextPktLine(input, line));
+    EXPECT_TRUE(line.starts_with(commits_[2] + " HEAD"));
+    EXPECT_NE(line.find("symref=HEAD:refs/heads/main"), std::string::npos);
+    EXPECT_NE(line.find("side-band-64k"), std::string::npos);
+    ASSERT_TRUE(upload_pack::NextPktLine(input, line));
+    EXPECT_EQ(line, commits_[2] + " refs/heads/main\n");
+    EXPECT_FALSE(upload_pack::NextPktLine(input, line));
+    EXPECT_TRUE(input.empty());
+}
+
+// 只发送客户端没有的对象；协商阶段回复 common/ready
+TEST_F(UploadPackTest, NegotiationExcludesHaves) {
+    upload_pack::UploadPack upload;
+    upload_pack::UploadRequest request;
+    request.wants = {commits_[2]};
+    request.haves = {commits_[1], std::string(40, 'f')};
+    request.capabilities = {"multi_ack_detailed"};
+    auto result = upload.Process(request);
+    EXPECT_FALSE(result.send_pack);
+    EXPECT_EQ(result.negotiation,
+              upload_pack::PktLine("ACK " + commits_[1] + " common\n") +
+                  upload_pack::PktLine("ACK " + commits_[1] + " ready\n") +
+                  upload_pack::PktLine("NAK\n"));
+
+    request.done = true;
+    auto partial = upload.Process(request);
+    ASSERT_TRUE(partial.send_pack);
+    EXPECT_EQ(partial.negotiation,
+              upload_pack::PktLine("ACK " + commits_[1] + "\n"));
+    // 新提交、根 tree、doc.txt、sub/ 和 sub/n.txt
+    EXPECT_EQ(partial.objects, 5u);
+    close(partial.pack_fd);
+
+    request.haves.clear();
+    auto full = upload.Process(request);
+    EXPECT_EQ(full.negotiation, upload_pack::PktLine("NAK\n"));
+    EXPECT_EQ(full.objects, 15u);
+    std::string data = ReadAll(full.pack_fd, 0, full.pack_size);
+    close(full.pack_fd);
+    EXPECT_TRUE(data.starts_with(std::string("PACK\0\0\0\2\0\0\0\x0f", 12)));
+
+    request.wants = {std::string(40, 'a')};
+    EXPECT_THROW(upload.Process(request), std::runtime_error);
+}
+
+// 只发送从公布的引用可达的对象：存在但不可达的提交和 blob 都被拒绝，
+// 有无位图结果相同
+TEST_F(UploadPackTest, RejectsUnreachableWants) {
+    WriteFile("secret.txt", "not reachable\n");
+    std::string blob = hash_object("secret.txt", true);
+    std::string commit = commit_tree(write_tree("."), commits_[2], "dangling");
+    std::string reachable_blob = hash_object("sub/n.txt", false);
+    ASSERT_TRUE(ObjectStore().Contains(blob));
+    ASSERT_TRUE(ObjectStore().Contains(commit));
+
+    auto expect_refused = [](const std::string &want) {
+        upload_pack::UploadRequest request;
+        request.wants = {want};
+        request.done = true;
+        try {
+            upload_pack::UploadPack().Process(request);
+            ADD_FAILURE() << "served " << want;
+        } catch (const std::runtime_error &e) {
+            EXPECT_EQ(std::string(e.what()), "upload-pack: not our ref " + want);
+        }
+    };
+    auto expect_served = [](const std::string &want) {
+        upload_pack::UploadRequest request;
+        request.wants = {want};
+        request.done = true;
+        auto result = upload_pack::UploadPack().Process(request);
+        EXPECT_TRUE(result.send_pack);
+        close(result.pack_fd);
+    };
+    for (bool with_bitmap : {false, true}) {
+        SCOPED_TRACE(with_bitmap ? "bitmap" : "walk");
+        if (with_bitmap) {
+            RepackOptions options;
+            options.all = options.remove_redundant = options.write_bitmap = true;
+            ASSERT_GT(Repack(options).bitmaps, 0u);
+        }
+        expect_refused(blob);
+        expect_refused(commit);
+        expect_served(commits_[0]); // 较早的提交从分支可达
+        expect_served(reachable_blob);
+    }
+
+    // HTTP 客户端得到 ERR 行，没有 pack
+    ServerThread server;
+    std::string url = "http://127.0.0.1:" + std::to_string(server.Port());
+    std::string response = fetch_pack(url, {blob}, {}, "");
+    EXPECT_NE(response.find("ERR upload-pack: not our ref " + blob),
+              std::string::npos);
+    EXPECT_EQ(response.find("PACK"), std::string::npos);
+}
+
+// 所需对象恰好是已有 pack 时原样发送
+TEST_F(UploadPackTest, ReusesExistingPack) {
+    RepackOptions options;
+    options.all = options.remove_redundant = true;
+    RepackResult repacked = Repack(options);
+    ASSERT_FALSE(repacked.pack_checksum.empty());
+
+    upload_pack::UploadRequest request;
+    request.wants = {commits_[2]};
+    request.done = true;
+    request.capabilities = {"ofs-delta"};
+    auto result = upload_pack::UploadPack().Process(request);
+    ASSERT_TRUE(result.reused);
+    std::string pack_path =
+        ".git/objects/pack/pack-" + repacked.pack_checksum + ".pack";
+    EXPECT_EQ(ReadAll(result.pack_fd, result.pack_offset, result.pack_size),
+              ReadFile(pack_path));
+    close(result.pack_fd);
+
+    // 不支持 ofs-delta 的客户端得到重新生成的 REF_DELTA pack
+    request.capabilities.clear();
+    auto fresh = upload_pack::UploadPack().Process(request);
+    EXPECT_FALSE(fresh.reused);
+    EXPECT_EQ(fresh.objects, repacked.objects);
+    close(fresh.pack_fd);
+}
+
+// 现有的 clone 命令可以作为客户端，pack 仓库和松散对象仓库都能克隆
+TEST_F(UploadPackTest, CloneOverHttp) {
+    ServerThread server;
+    std::string url = "http://127.0.0.1:" + std::to_string(server.Port());
+    ASSERT_EQ(clone(url, "loose_clone"), EXIT_SUCCESS);
+    EXPECT_EQ(ReadFile("loose_clone/doc.txt"), doc_);
+    EXPECT_EQ(ReadFile("loose_clone/sub/n.txt"), "2");
+
+    RepackOptions options;
+    options.all = options.remove_redundant = true;
+    Repack(options);
+    ASSERT_EQ(clone(url + "/repo.git", "packed_clone"), EXIT_SUCCESS);
+    EXPECT_EQ(ReadFile("packed_clone/doc.txt"), doc_);
+    EXPECT_TRUE(ObjectStore("packed_clone/.git").Contains(commits_[0]));
+}
+
+// 多个连接的请求交错到达，事件循环分别完成每一个；side-band 分帧正确
+TEST_F(UploadPackTest, ConcurrentConnections) {
+    ServerThread server;
+    std::string body = upload_pack::PktLine(
+                           "want " + commits_[2] + " side-band-64k ofs-delta\n") +
+                       "0000" + upload_pack::PktLine("done\n");
+    std::string request =
+        "POST /repo.git/git-upload-pack HTTP/1.1\r\nHost: localhost\r\n"
+        "Content-Type: application/x-git-upload-pack-request\r\n"
+        "Connection: close\r\n"
+        "Content-Length: " + std::to_string(body.size()) + "\r\n\r\n" + body;
+
+    constexpr int kClients = 16;
+    std::vector<int> fds;
+    for (int i = 0; i < kClients; i++) {
+        fds.push_back(Connect(server.Port()));
+        SendAll(fds.back(), request.substr(0, 40 + i));
+    }
+    for (int i = 0; i < kClients; i++) {
+        SendAll(fds[i], request.substr(40 + i));
+    }
+    for (int fd : fds) {
+        std::string response = ReadUntilClose(fd);
+        close(fd);
+        ASSERT_TRUE(response.starts_with("HTTP/1.1 200 OK\r\n")) << response;
+        size_t header_end = response.find("\r\n\r\n");
+        std::string payload = response.substr(header_end + 4);
+        size_t length_pos = response.find("Content-Length: ");
+        EXPECT_EQ(std::stoull(response.substr(length_pos + 16)), payload.size());
+
+        // NAK 之后是通道 1 的 pack 数据，以 0000 结束
+        std::string_view input = payload;
+        std::string line;
+        ASSERT_TRUE(upload_pack::NextPktLine(input, line));
+        EXPECT_EQ(line, "NAK\n");
+        std::string pack_data;
+        while (upload_pack::NextPktLine(input, line)) {
+            ASSERT_EQ(line[0], '\1');
+            pack_data += line.substr(1);
+        }
+        EXPECT_TRUE(input.empty());
+        EXPECT_TRUE(pack_data.starts_with("PACK"));
+    }
+
+    // keep-alive 连接上依次处理 GET 和错误的请求
+    int fd = Connect(server.Port());
+    SendAll(fd, "GET /info/refs?service=git-upload-pack HTTP/1.1\r\n"
+                "Host: localhost\r\n\r\n"
+                "GET /info/refs?service=git-receive-pack HTTP/1.1\r\n"
+                "Host: localhost\r\nConnection: close\r\n\r\n");
+    std::string responses = ReadUntilClose(fd);
+    close(fd);
+    EXPECT_TRUE(responses.starts_with("HTTP/1.1 200 OK"));
+    EXPECT_NE(responses.find("application/x-git-upload-pack-advertisement"),
+              std::string::npos);
+    EXPECT_NE(responses.find("HTTP/1.1 403 Forbidden"), std::string::npos);
+}
+
+// chunked 请求体分成很多小段到达：分隔符和 chunk 长度行跨越多次 recv
+TEST_F(UploadPackTest, ChunkedRequestInPieces) {
+    ServerThread server;
+    std::string body = upload_pack::PktLine("want " + commits_[2] + "\n") +
+                       "0000" + upload_pack::PktLine("done\n");
+    std::string request =
+        "POST /repo.git/git-upload-pack HTTP/1.1\r\nHost: localhost\r\n"
+        "Transfer-Encoding: chunked\r\nConnection: close\r\n\r\n";
+    for (size_t pos = 0; pos < body.size(); pos += 7) {
+        std::string chunk = body.substr(pos, 7);
+        char size[16];
+        snprintf(size, sizeof(size), "%zx;ext=1\r\n", chunk.size());
+        request += size + chunk + "\r\n";
+    }
+    request += "0\r\nX-Trailer: 1\r\n\r\n";
+
+    int fd = Connect(server.Port());
+    for (size_t pos = 0; pos < request.size(); pos += 3) {
+        SendAll(fd, request.substr(pos, 3));
+        usleep(200);
+    }
+    std::string response = ReadUntilClose(fd);
+    close(fd);
+    ASSERT_TRUE(response.starts_with("HTTP/1.1 200 OK\r\n")) << response;
+    std::string payload = response.substr(response.find("\r\n\r\n") + 4);
+    EXPECT_TRUE(payload.starts_with(upload_pack::PktLine("NAK\n")));
+    EXPECT_NE(payload.find("PACK"), std::string::npos);
+
+    // 长度行不是十六进制数时回复 400
+    fd = Connect(server.Port());
+    SendAll(fd, "POST /repo.git/git-upload-pack HTTP/1.1\r\n"
+                "Transfer-Encoding: chunked\r\n\r\nzz\r\n");
+    response = ReadUntilClose(fd);
+    close(fd);
+    EXPECT_TRUE(response.starts_with("HTTP/1.1 400 Bad Request")) << response;
+}
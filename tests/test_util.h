@@ -0,0 +1,101 @@
+#pragma once
+
+#include <gtest/gtest.h>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <tuple>
+#include <unistd.h>
+#include <vector>
+#include "../include/clone_gadget.h"
+#include "../src/byte_util.h"
+
+/**
+ * @brief 各测试共用的夹具：每个测试在独立的临时目录中运行
+ *
+ * 临时目录是 <tmp>/minigit_<名字>_<pid>_<测试名>，其中建好
+ * <repo>/.git/objects 并切换到 repo（hash_object 等函数使用相对路径
+ * .git）；结束时切换回原来的目录并删除临时目录。子类重写 SetUp() 时先
+ * 调用这里的，重写 TearDown() 时最后调用这里的。
+ */
+class TempRepoTest : public ::testing::Test {
+protected:
+    // name 区分不同的测试文件；repo 是仓库相对于临时目录的位置
+    explicit TempRepoTest(std::string name, std::filesystem::path repo = "")
+        : name_(std::move(name)), repo_(std::move(repo)) {}
+
+    void SetUp() override {
+        old_cwd_ = std::filesystem::current_path();
+        dir_ = std::filesystem::temp_directory_path() /
+               ("minigit_" + name_ + "_" + std::to_string(getpid()) + "_" +
+                ::testing::UnitTest::GetInstance()->current_test_info()->name());
+        std::filesystem::remove_all(dir_);
+        std::filesystem::create_directories(dir_ / repo_ / ".git/objects");
+        std::filesystem::current_path(dir_ / repo_);
+    }
+
+    void TearDown() override {
+        std::filesystem::current_path(old_cwd_);
+        std::filesystem::remove_all(dir_);
+    }
+
+    static void WriteFile(const std::filesystem::path &path,
+                          const std::string &content) {
+        if (path.has_parent_path()) {
+            std::filesystem::create_directories(path.parent_path());
+        }
+        std::ofstream(path, std::ios::binary) << content;
+    }
+
+    static std::string ReadFile(const std::filesystem::path &path) {
+        std::ifstream file(path, std::ios::binary);
+        return std::string((std::istreambuf_iterator<char>(file)),
+                           std::istreambuf_iterator<char>());
+    }
+
+    // 把 "<type> <size>\0<body>" 写入当前仓库，返回对象哈希
+    static std::string Store(const std::string &type, const std::string &body) {
+        std::string raw = type + " " + std::to_string(body.size()) + '\0' + body;
+        std::string hash = compute_sha1(raw);
+        compress_and_store(hash, raw);
+        return hash;
+    }
+
+    using Entries = std::vector<std::tuple<std::string, std::string, std::string>>;
+
+    static std::string Blob(const std::string &content) {
+        return Store("blob", content);
+    }
+
+    // entries 为 (mode, 名字, 哈希)，调用方按 tree 顺序给出
+    static std::string Tree(const Entries &entries) {
+        std::string body;
+        for (const auto &[mode, name, hash] : entries) {
+            body += mode + " " + name + '\0';
+            byte_util::HexToBinary(hash, body);
+        }
+        return Store("tree", body);
+    }
+
+    // 作者和提交者相同，时间都是 time；父提交按给定顺序
+    static std::string Commit(const std::string &tree,
+                              const std::vector<std::string> &parents,
+                              int64_t time, const std::string &message) {
+        std::string body = "tree " + tree + "\n";
+        for (const auto &parent : parents) {
+            body += "parent " + parent + "\n";
+        }
+        std::string who = "A U Thor <author@example.com> " +
+                          std::to_string(time) + " +0000\n";
+        body += "author " + who + "committer " + who + "\n" + message;
+        return Store("commit", body);
+    }
+
+    std::filesystem::path dir_;
+    std::filesystem::path old_cwd_;
+
+private:
+    std::string name_;
+    std::filesystem::path repo_;
+};